@@ -0,0 +1,546 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/client/Client.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/system/Event.hpp"
+#include "monomux/system/Process.hpp"
+#include "monomux/system/Socket.hpp"
+#include "monomux/system/fd.hpp"
+
+/// An end-to-end benchmark of relaying the output of a session to attached
+/// clients, and the input of a client to a session. The server and the
+/// clients run in this process, while the session runs this program again in
+/// "writer" mode, which writes a configurable amount of output in chunks of a
+/// configurable size, then echoes every byte it receives.
+///
+/// Run it (preferably in a Release build) with:
+///
+///     monomux_bench --mbytes 256 --chunk 4096 --clients 2
+///
+/// With hundreds of \p --clients, it measures the fan-out of one session to
+/// many viewers: the CPU time the server spends per byte, the spread of the
+/// latency between the clients, and the memory each client costs. Some of the
+/// clients may be \p --stalled to stress the flow control. The clients are
+/// read by a single thread, so the CPU time of the server can be told apart.
+///
+/// The process, and thus every thread and the session, is pinned to a single
+/// CPU (0 by default, see \p --cpu) so results of different runs compare.
+
+using namespace monomux;
+
+namespace
+{
+
+/// The number of allocations made by the process so far.
+std::atomic<std::size_t> Allocations{0};
+
+// The bytes exchanged with the writer. The output is lowercase letters, so
+// nothing else that might appear on the terminal is mistaken for it.
+constexpr char GoByte = 'G';
+constexpr char QuitByte = 'Q';
+bool isPayload(char C) noexcept { return C >= 'a' && C <= 'z'; }
+
+/// The main function of the program running in the session.
+int writerMain(std::size_t Bytes, std::size_t Chunk)
+{
+  // The data must pass through the terminal as it is.
+  struct ::termios Mode;
+  if (::tcgetattr(STDIN_FILENO, &Mode) == 0)
+  {
+    ::cfmakeraw(&Mode);
+    ::tcsetattr(STDIN_FILENO, TCSANOW, &Mode);
+  }
+
+  std::string Buffer(Chunk, 0);
+  for (std::size_t I = 0; I < Chunk; ++I)
+    Buffer[I] = static_cast<char>('a' + I % 26);
+
+  char C = 0;
+  while (C != GoByte)
+    if (::read(STDIN_FILENO, &C, 1) != 1)
+      return EXIT_FAILURE;
+
+  for (std::size_t Written = 0; Written < Bytes;)
+  {
+    ::ssize_t W = ::write(
+      STDOUT_FILENO, Buffer.data(), std::min(Chunk, Bytes - Written));
+    if (W <= 0)
+      return EXIT_FAILURE;
+    Written += static_cast<std::size_t>(W);
+  }
+
+  // Echo the keystrokes, like a shell would.
+  while (::read(STDIN_FILENO, &C, 1) == 1 && C != QuitByte)
+    if (::write(STDOUT_FILENO, &C, 1) != 1)
+      return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+struct Options
+{
+  std::size_t MBytes = 64;
+  std::size_t Chunk = 4096;
+  std::size_t Clients = 1;
+  std::size_t Stalled = 0;
+  std::size_t Keystrokes = 1000;
+  int CPU = 0;
+  bool EdgeTriggered = false;
+  bool SpliceRelay = false;
+  std::size_t Reactors = 0;
+  std::size_t ClientBufferLimit = 0;
+};
+
+// clang-format off
+const struct ::option LongOptions[] = {
+  {"mbytes",              required_argument, nullptr, 'm'},
+  {"chunk",               required_argument, nullptr, 'c'},
+  {"clients",             required_argument, nullptr, 'n'},
+  {"stalled",             required_argument, nullptr, 't'},
+  {"keystrokes",          required_argument, nullptr, 'k'},
+  {"cpu",                 required_argument, nullptr, 'p'},
+  {"edge-triggered",      no_argument,       nullptr, 'e'},
+  {"splice-relay",        no_argument,       nullptr, 's'},
+  {"reactors",            required_argument, nullptr, 'r'},
+  {"client-buffer-limit", required_argument, nullptr, 'l'},
+  {nullptr,               0,                 nullptr, 0}
+};
+// clang-format on
+
+void printHelp()
+{
+  std::cout << R"EOF(Usage: monomux_bench [OPTIONS]
+
+    --mbytes N          - Relay N MiB of output from the session. (Default: 64)
+    --chunk N           - The session writes its output N bytes at a time.
+                          (Default: 4096)
+    --clients N         - Attach N clients to the session. Hundreds of clients
+                          measure the fan-out of the output to many viewers.
+                          (Default: 1)
+    --stalled N         - Of the clients, N never read their connection, like
+                          viewers on a frozen network would. They are not
+                          measured, and must not slow the others down.
+                          (Default: 0)
+    --keystrokes N      - Measure the latency of N keystrokes typed by the
+                          first client, and echoed by the session to every
+                          client. (Default: 1000)
+    --cpu N             - Pin the benchmark to CPU N, or do not pin it if N is
+                          -1. (Default: 0)
+    --edge-triggered    - Configure the server like the '--server' flag of the
+    --splice-relay        same name does.
+    --reactors N
+    --client-buffer-limit N
+)EOF";
+}
+
+/// \returns the nearest rank \p Percentile of the sorted \p Samples.
+std::chrono::nanoseconds
+percentile(const std::vector<std::chrono::nanoseconds>& Samples,
+           double Percentile)
+{
+  if (Samples.empty())
+    return {};
+  auto Index = static_cast<std::size_t>(Percentile / 100 * Samples.size());
+  return Samples[std::min(Index, Samples.size() - 1)];
+}
+
+std::chrono::nanoseconds cpuTime(::clockid_t Clock)
+{
+  struct ::timespec T = {};
+  ::clock_gettime(Clock, &T);
+  return std::chrono::seconds{T.tv_sec} + std::chrono::nanoseconds{T.tv_nsec};
+}
+
+/// \returns the resident memory of the process, in bytes.
+std::size_t residentMemory()
+{
+  std::ifstream Statm{"/proc/self/statm"};
+  std::size_t Pages = 0;
+  std::size_t Resident = 0;
+  Statm >> Pages >> Resident;
+  return Resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+/// A client of the benchmark that reads its data connection.
+///
+/// \note The connection is read directly, without buffering it in the client,
+/// so the allocations counted are the server's.
+struct Viewer
+{
+  client::Client* Client;
+  /// The number of bytes of the output of the writer received.
+  std::size_t Payload = 0;
+  /// The number of keystrokes whose echo was received.
+  std::size_t Echoes = 0;
+  /// Whether the entire output of the writer was received.
+  bool Done = false;
+  /// The number of keystrokes whose echo was received and measured.
+  std::size_t Measured = 0;
+};
+
+/// Reads the data connections of the viewers registered in \p Poll that are
+/// readable, waiting for at most \p Timeout.
+///
+/// \returns \p false if a connection was lost.
+bool readViewers(EPoll& Poll, std::chrono::milliseconds Timeout)
+{
+  char Buffer[1 << 16];
+  const std::size_t Events = Poll.wait(Timeout);
+  for (std::size_t I = 0; I < Events; ++I)
+  {
+    EPoll::EventWithMode E = Poll.eventAt(I);
+    if (E.FD == fd::Invalid || !E.UserData)
+      continue;
+    Viewer& V = *static_cast<Viewer*>(E.UserData);
+    ::ssize_t R = ::read(E.FD, Buffer, sizeof(Buffer));
+    if (R == 0 || (R < 0 && errno != EAGAIN && errno != EINTR))
+      return false;
+    for (::ssize_t B = 0; B < R; ++B)
+      if (isPayload(Buffer[B]))
+        ++V.Payload;
+      else if (std::isdigit(static_cast<unsigned char>(Buffer[B])))
+        ++V.Echoes;
+  }
+  return true;
+}
+
+int benchMain(const Options& Opts)
+{
+  if (Opts.CPU >= 0)
+  {
+    // (Threads and child processes started later inherit the mask.)
+    ::cpu_set_t Set;
+    CPU_ZERO(&Set);
+    CPU_SET(Opts.CPU, &Set);
+    if (::sched_setaffinity(0, sizeof(Set), &Set) != 0)
+    {
+      std::cerr << "Pinning to CPU " << Opts.CPU
+                << " failed: " << std::strerror(errno) << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  {
+    // Both ends of the two connections of every client are in this process.
+    struct ::rlimit Files = {};
+    ::getrlimit(RLIMIT_NOFILE, &Files);
+    Files.rlim_cur = Files.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &Files);
+    if (Files.rlim_cur < 4 * Opts.Clients + 64)
+      std::cerr << "Warning: only " << Files.rlim_cur
+                << " files may be opened, attaching might fail" << std::endl;
+  }
+  std::signal(SIGPIPE, SIG_IGN);
+  log::Logger::get().setLimit(log::Warning);
+
+  char Dir[] = "/tmp/monomux-bench-XXXXXX";
+  if (!::mkdtemp(Dir))
+  {
+    std::cerr << "mkdtemp() failed: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string SocketPath = std::string{Dir} + "/server.sock";
+
+  std::optional<server::Server> S;
+  S.emplace(Socket::create(SocketPath));
+  S->setExitIfNoMoreSessions(false);
+  S->setEdgeTriggered(Opts.EdgeTriggered);
+  S->setSpliceRelay(Opts.SpliceRelay);
+  S->setReactorCount(Opts.Reactors);
+  S->setListenBacklog(Opts.Clients);
+  if (Opts.ClientBufferLimit)
+    S->setClientBufferLimit(Opts.ClientBufferLimit);
+  S->listen();
+  std::thread ServerThread{[&S] { S->loop(); }};
+
+  const std::size_t Bytes = Opts.MBytes << 20;
+  const std::size_t MemoryBefore = residentMemory();
+  std::vector<client::Client> Clients;
+  Clients.reserve(Opts.Clients);
+  std::string Failure;
+  std::string SessionName;
+  for (std::size_t I = 0; I < Opts.Clients; ++I)
+  {
+    std::optional<client::Client> C =
+      client::Client::create(SocketPath, &Failure);
+    if (!C || !C->handshake(&Failure))
+    {
+      std::cerr << "Connecting client #" << I << " failed: " << Failure
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (I == 0)
+    {
+      Process::SpawnOptions Writer;
+      Writer.Program = "/proc/self/exe";
+      Writer.Arguments = {
+        "--writer", std::to_string(Bytes), std::to_string(Opts.Chunk)};
+      std::optional<std::string> Name =
+        C->requestMakeSession("bench", std::move(Writer));
+      if (!Name)
+      {
+        std::cerr << "Creating the session failed" << std::endl;
+        return EXIT_FAILURE;
+      }
+      SessionName = std::move(*Name);
+    }
+    if (!C->requestAttach(SessionName))
+    {
+      std::cerr << "Attaching client #" << I << " failed" << std::endl;
+      return EXIT_FAILURE;
+    }
+    Clients.emplace_back(std::move(*C));
+  }
+  const std::size_t MemoryAttached = residentMemory();
+
+  // The stalled clients are the last ones, so the first one can type.
+  const std::size_t Readers = Opts.Clients - Opts.Stalled;
+  std::vector<Viewer> Viewers;
+  Viewers.reserve(Readers);
+  EPoll Poll{std::min<std::size_t>(Readers, 1024)};
+  for (std::size_t I = 0; I < Readers; ++I)
+  {
+    Viewers.push_back(Viewer{&Clients[I]});
+    const raw_fd FD = Clients[I].getDataSocket()->raw();
+    fd::addStatusFlag(FD, O_NONBLOCK);
+    Poll.listen(FD,
+                /* Incoming =*/true,
+                /* Outgoing =*/false,
+                /* EdgeTriggered =*/false,
+                &Viewers.back());
+  }
+
+  std::cout << "Relaying " << Opts.MBytes << " MiB in " << Opts.Chunk
+            << " byte chunks to " << Opts.Clients << " client(s)";
+  if (Opts.Stalled)
+    std::cout << " (" << Opts.Stalled << " of them stalled)";
+  if (Opts.CPU >= 0)
+    std::cout << " on CPU " << Opts.CPU;
+  std::cout << std::endl;
+
+  // Throughput.
+  const std::size_t AllocationsBefore = Allocations.load();
+  const auto ProcessCPUBefore = cpuTime(CLOCK_PROCESS_CPUTIME_ID);
+  const auto ReaderCPUBefore = cpuTime(CLOCK_THREAD_CPUTIME_ID);
+  const auto Begin = std::chrono::steady_clock::now();
+  Clients.front().sendData(std::string_view{&GoByte, 1});
+  std::vector<std::chrono::nanoseconds> Finished;
+  Finished.reserve(Readers);
+  while (Finished.size() < Readers)
+  {
+    if (!readViewers(Poll, EPoll::NoTimeout))
+    {
+      std::cerr << "A client lost the connection" << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (Viewer& V : Viewers)
+      if (!V.Done && V.Payload >= Bytes)
+      {
+        V.Done = true;
+        Finished.emplace_back(std::chrono::steady_clock::now() - Begin);
+      }
+  }
+  const std::chrono::duration<double> Elapsed = Finished.back();
+  // The server is everything in the process, except for the readers.
+  const auto ServerCPU =
+    (cpuTime(CLOCK_PROCESS_CPUTIME_ID) - ProcessCPUBefore) -
+    (cpuTime(CLOCK_THREAD_CPUTIME_ID) - ReaderCPUBefore);
+  const std::size_t AllocationsDuring = Allocations.load() - AllocationsBefore;
+  const std::size_t MemoryRelayed = residentMemory();
+
+  // Latency.
+  std::vector<std::chrono::nanoseconds> Echoes;
+  std::vector<std::chrono::nanoseconds> Deliveries;
+  Echoes.reserve(Opts.Keystrokes);
+  Deliveries.reserve(Opts.Keystrokes * Readers);
+  for (std::size_t K = 1; K <= Opts.Keystrokes; ++K)
+  {
+    const char Key = static_cast<char>('0' + K % 10);
+    const auto Sent = std::chrono::steady_clock::now();
+    Clients.front().sendData(std::string_view{&Key, 1});
+    for (std::size_t Delivered = 0; Delivered < Readers;)
+    {
+      if (!readViewers(Poll, EPoll::NoTimeout))
+      {
+        std::cerr << "A client lost the connection" << std::endl;
+        return EXIT_FAILURE;
+      }
+      const auto Now = std::chrono::steady_clock::now();
+      for (std::size_t I = 0; I < Readers; ++I)
+        if (Viewers[I].Measured < K && Viewers[I].Echoes >= K)
+        {
+          Viewers[I].Measured = K;
+          ++Delivered;
+          Deliveries.emplace_back(Now - Sent);
+          if (I == 0)
+            Echoes.emplace_back(Now - Sent);
+        }
+    }
+  }
+  std::sort(Echoes.begin(), Echoes.end());
+  std::sort(Deliveries.begin(), Deliveries.end());
+  std::sort(Finished.begin(), Finished.end());
+
+  using Micro = std::chrono::duration<double, std::micro>;
+  using Milli = std::chrono::duration<double, std::milli>;
+  const double Delivered = static_cast<double>(Bytes * Readers);
+  std::cout << "Throughput: " << Opts.MBytes / Elapsed.count()
+            << " MiB/s per client, "
+            << Opts.MBytes * Readers / Elapsed.count() << " MiB/s in total\n";
+  if (Readers > 1)
+    std::cout << "Clients finished relaying: p50 "
+              << Milli{percentile(Finished, 50)}.count() << " ms, p99 "
+              << Milli{percentile(Finished, 99)}.count() << " ms, last "
+              << Milli{Finished.back()}.count() << " ms\n";
+  std::cout << "Latency of " << Opts.Keystrokes << " keystrokes: p50 "
+            << Micro{percentile(Echoes, 50)}.count() << " us, p99 "
+            << Micro{percentile(Echoes, 99)}.count() << " us\n";
+  if (Readers > 1)
+    std::cout << "Latency of the echo to every client: p50 "
+              << Micro{percentile(Deliveries, 50)}.count() << " us, p99 "
+              << Micro{percentile(Deliveries, 99)}.count() << " us, max "
+              << Micro{Deliveries.back()}.count() << " us\n";
+  std::cout << "Server CPU: "
+            << static_cast<double>(ServerCPU.count()) /
+                 static_cast<double>(Bytes)
+            << " ns per byte of output, "
+            << static_cast<double>(ServerCPU.count()) / Delivered
+            << " ns per byte delivered\n"
+            << "Memory: "
+            << static_cast<double>(MemoryAttached - MemoryBefore) /
+                 Opts.Clients / 1024
+            << " KiB per client attached, "
+            << static_cast<double>(MemoryRelayed - MemoryBefore) /
+                 Opts.Clients / 1024
+            << " KiB per client after relaying\n"
+            << "Allocations: "
+            << static_cast<double>(AllocationsDuring) /
+                 static_cast<double>(Opts.MBytes * Readers)
+            << " per MiB delivered" << std::endl;
+
+  // The session quitting wakes the server to notice the interrupt.
+  S->interrupt();
+  Clients.front().sendData(std::string_view{&QuitByte, 1});
+  ServerThread.join();
+  S->shutdown();
+  S.reset();
+  Clients.clear();
+  ::rmdir(Dir);
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+void* operator new(std::size_t Size)
+{
+  ++Allocations;
+  if (void* P = std::malloc(Size ? Size : 1))
+    return P;
+  throw std::bad_alloc{};
+}
+void operator delete(void* P) noexcept { std::free(P); }
+void operator delete(void* P, std::size_t /* Size */) noexcept
+{
+  std::free(P);
+}
+
+int main(int ArgC, char* ArgV[])
+{
+  if (ArgC == 4 && std::strcmp(ArgV[1], "--writer") == 0)
+    return writerMain(std::strtoull(ArgV[2], nullptr, 10),
+                      std::strtoull(ArgV[3], nullptr, 10));
+
+  Options Opts;
+  int Opt;
+  while ((Opt = ::getopt_long(ArgC, ArgV, "h", LongOptions, nullptr)) != -1)
+    switch (Opt)
+    {
+      case 'm':
+        Opts.MBytes = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'c':
+        Opts.Chunk = std::max(1ULL, std::strtoull(optarg, nullptr, 10));
+        break;
+      case 'n':
+        Opts.Clients = std::max(1ULL, std::strtoull(optarg, nullptr, 10));
+        break;
+      case 't':
+        Opts.Stalled = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'l':
+        Opts.ClientBufferLimit = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'k':
+        Opts.Keystrokes = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'p':
+        Opts.CPU = std::atoi(optarg);
+        break;
+      case 'e':
+        Opts.EdgeTriggered = true;
+        break;
+      case 's':
+        Opts.SpliceRelay = true;
+        break;
+      case 'r':
+        Opts.Reactors = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'h':
+      default:
+        printHelp();
+        return Opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  if (Opts.Stalled >= Opts.Clients)
+  {
+    std::cerr << "At least one client must not be stalled" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  try
+  {
+    return benchMain(Opts);
+  }
+  catch (const std::system_error& Err)
+  {
+    std::cerr << "Error: " << Err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
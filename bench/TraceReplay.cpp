@@ -0,0 +1,265 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/server/TraceReplay.hpp"
+#include "monomux/system/EventTrace.hpp"
+#include "monomux/system/Socket.hpp"
+
+/// Replays the event loop recorded by the server's \p --event-trace flag
+/// through the event handling of a \p Server, to measure the cost of an
+/// iteration of the loop under the exact same traffic every time.
+///
+/// The sessions and the data connections of the clients of the trace are
+/// created in the server, and are attached and detached as recorded, see
+/// \p server::TraceReplay. Every connection is stood in for by a pair of
+/// sockets, one end of which the server handles, while the replay feeds the
+/// data the traced loop read to the other end, and drains what the server
+/// writes. For each recorded batch, the data is fed, and then the timed
+/// iteration of the server's event loop handles it, relaying the data between
+/// the sessions and the clients.
+///
+/// Run it (preferably in a Release build) with:
+///
+///     monomux_trace_replay /tmp/mnmx.1.trace
+///
+/// The control connections of the clients are not replayed, so the traces of
+/// the reactors (\p .1.trace and up) measure the relaying best.
+///
+/// By default, the batches are replayed back to back. With \p --realtime, the
+/// replay waits between them as long as the server did, so the caches are as
+/// cold as they were.
+
+using namespace monomux;
+
+namespace
+{
+
+struct Options
+{
+  bool Realtime = false;
+  std::size_t Repeat = 1;
+  int CPU = 0;
+  std::vector<std::string> Traces;
+};
+
+// clang-format off
+const struct ::option LongOptions[] = {
+  {"realtime",            no_argument,       nullptr, 't'},
+  {"repeat",              required_argument, nullptr, 'r'},
+  {"cpu",                 required_argument, nullptr, 'p'},
+  {nullptr,               0,                 nullptr, 0}
+};
+// clang-format on
+
+void printHelp()
+{
+  std::cout << R"EOF(Usage: monomux_trace_replay [OPTIONS] TRACE...
+
+    --realtime          - Wait between the batches as long as the traced event
+                          loop did, instead of replaying them back to back.
+    --repeat N          - Replay each trace N times. (Default: 1)
+    --cpu N             - Pin the replay to CPU N, or do not pin it if N is
+                          -1. (Default: 0)
+)EOF";
+}
+
+/// \returns the nearest rank \p Percentile of the sorted \p Samples.
+std::chrono::nanoseconds
+percentile(const std::vector<std::chrono::nanoseconds>& Samples,
+           double Percentile)
+{
+  if (Samples.empty())
+    return {};
+  auto Index = static_cast<std::size_t>(Percentile / 100 * Samples.size());
+  return Samples[std::min(Index, Samples.size() - 1)];
+}
+
+void report(const char* What, std::vector<std::chrono::nanoseconds> Samples)
+{
+  using Micro = std::chrono::duration<double, std::micro>;
+  std::sort(Samples.begin(), Samples.end());
+  std::cout << What << " of " << Samples.size() << " iterations: p50 "
+            << Micro{percentile(Samples, 50)}.count() << " us, p90 "
+            << Micro{percentile(Samples, 90)}.count() << " us, p99 "
+            << Micro{percentile(Samples, 99)}.count() << " us, max "
+            << Micro{Samples.empty() ? std::chrono::nanoseconds{}
+                                     : Samples.back()}
+                 .count()
+            << " us\n";
+}
+
+int replay(const Options& Opts, const std::string& Path)
+{
+  std::optional<std::vector<EventTraceReader::Batch>> Trace =
+    EventTraceReader::load(Path);
+  if (!Trace)
+  {
+    std::cerr << "'" << Path << "' is not an event trace" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::size_t Events = 0;
+  std::size_t Connections = 0;
+  std::size_t BytesRead = 0;
+  std::size_t BytesWritten = 0;
+  std::vector<std::chrono::nanoseconds> Recorded;
+  for (const EventTraceReader::Batch& B : *Trace)
+  {
+    Events += B.Events.size();
+    for (const EventTraceReader::Change& C : B.Changes)
+      if (C.Kind == EventTrace::Open)
+        ++Connections;
+    for (const EventTraceReader::IO& IO : B.IOs)
+      (IO.Kind == EventTrace::Read ? BytesRead : BytesWritten) += IO.Bytes;
+    if (B.Handled)
+      Recorded.emplace_back(*B.Handled);
+  }
+  std::cout << "Replaying '" << Path << "': " << Trace->size() << " batches of "
+            << Events << " events over " << Connections << " connections, "
+            << static_cast<double>(BytesRead) / (1 << 20) << " MiB read, "
+            << static_cast<double>(BytesWritten) / (1 << 20)
+            << " MiB written" << std::endl;
+
+  char Dir[] = "/tmp/monomux-replay-XXXXXX";
+  if (!::mkdtemp(Dir))
+  {
+    std::cerr << "mkdtemp() failed: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::chrono::nanoseconds> Replayed;
+  Replayed.reserve(Trace->size() * Opts.Repeat);
+  std::size_t Truncated = 0;
+  std::size_t Skipped = 0;
+  {
+    server::Server S{Socket::create(std::string{Dir} + "/server.sock")};
+    S.setExitIfNoMoreSessions(false);
+    for (std::size_t Round = 0; Round < Opts.Repeat; ++Round)
+    {
+      // Every round starts from a server without the connections of the
+      // trace.
+      server::TraceReplay R{S};
+      const auto ReplayStart = std::chrono::steady_clock::now();
+      for (const EventTraceReader::Batch& B : *Trace)
+      {
+        if (Opts.Realtime)
+          std::this_thread::sleep_until(ReplayStart + B.Start + B.Waited);
+
+        Replayed.emplace_back(R.replay(B));
+        // The peers consume what the server wrote, so the next batch starts
+        // with empty connections.
+        R.drain();
+      }
+      Truncated += R.truncated();
+      Skipped += R.skippedEvents();
+    }
+  }
+  ::rmdir(Dir);
+
+  if (Truncated)
+    std::cout << "(" << Truncated
+              << " bytes read by the traced loop did not fit the replayed "
+                 "connections)\n";
+  if (Skipped)
+    std::cout << "(" << Skipped
+              << " events of connections that are not replayed, e.g. control "
+                 "connections, were skipped)\n";
+  report("Recorded handling", std::move(Recorded));
+  report("Replayed handling", std::move(Replayed));
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int ArgC, char* ArgV[])
+{
+  Options Opts;
+  int Opt;
+  while ((Opt = ::getopt_long(ArgC, ArgV, "h", LongOptions, nullptr)) != -1)
+    switch (Opt)
+    {
+      case 't':
+        Opts.Realtime = true;
+        break;
+      case 'r':
+        Opts.Repeat = std::max(1ULL, std::strtoull(optarg, nullptr, 10));
+        break;
+      case 'p':
+        Opts.CPU = std::atoi(optarg);
+        break;
+      case 'h':
+      default:
+        printHelp();
+        return Opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  for (int I = optind; I < ArgC; ++I)
+    Opts.Traces.emplace_back(ArgV[I]);
+  if (Opts.Traces.empty())
+  {
+    printHelp();
+    return EXIT_FAILURE;
+  }
+
+  if (Opts.CPU >= 0)
+  {
+    ::cpu_set_t Set;
+    CPU_ZERO(&Set);
+    CPU_SET(Opts.CPU, &Set);
+    if (::sched_setaffinity(0, sizeof(Set), &Set) != 0)
+    {
+      std::cerr << "Pinning to CPU " << Opts.CPU
+                << " failed: " << std::strerror(errno) << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::signal(SIGPIPE, SIG_IGN);
+  log::Logger::get().setLimit(log::Warning);
+
+  try
+  {
+    int Result = EXIT_SUCCESS;
+    for (const std::string& Path : Opts.Traces)
+      if (replay(Opts, Path) != EXIT_SUCCESS)
+        Result = EXIT_FAILURE;
+    return Result;
+  }
+  catch (const std::system_error& Err)
+  {
+    std::cerr << "Error: " << Err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
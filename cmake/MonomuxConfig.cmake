@@ -37,6 +37,35 @@ set(MONOMUX_NON_ESSENTIAL_LOGS ON CACHE BOOL
   "If set, the built binary will contain some additional log outputs that are needed for verbose debugging of the project. Turn off to cut down further on the binary size for production."
   )
 
+include(CheckIncludeFileCXX)
+check_include_file_cxx("linux/io_uring.h" MONOMUX_HAVE_LINUX_IO_URING_H)
+set(MONOMUX_IO_URING ${MONOMUX_HAVE_LINUX_IO_URING_H} CACHE BOOL
+  "If set, the built binary will contain an event queue implementation using io_uring(7), which the server can select at run-time instead of epoll(7). Requires the kernel headers to contain 'linux/io_uring.h'."
+  )
+if (MONOMUX_IO_URING AND NOT MONOMUX_HAVE_LINUX_IO_URING_H)
+  message(WARNING "io_uring requested but 'linux/io_uring.h' was not found. Disabling.")
+  set(MONOMUX_IO_URING OFF CACHE BOOL "" FORCE)
+endif()
+
+find_package(ZLIB)
+set(MONOMUX_COMPRESSION ${ZLIB_FOUND} CACHE BOOL
+  "If set, the built binary will be able to compress the output of sessions sent to the clients that ask for it, using the DEFLATE format of zlib. Requires zlib to be installed."
+  )
+if (MONOMUX_COMPRESSION AND NOT ZLIB_FOUND)
+  message(WARNING "Compression requested but zlib was not found. Disabling.")
+  set(MONOMUX_COMPRESSION OFF CACHE BOOL "" FORCE)
+endif()
+
+check_include_file_cxx("sys/sdt.h" MONOMUX_HAVE_SYS_SDT_H)
+if (MONOMUX_HAVE_SYS_SDT_H)
+  set(MONOMUX_TRACE_PROBES_DEFAULT ON)
+else()
+  set(MONOMUX_TRACE_PROBES_DEFAULT OFF)
+endif()
+set(MONOMUX_TRACE_PROBES ${MONOMUX_TRACE_PROBES_DEFAULT} CACHE BOOL
+  "If set, the built binary will contain static tracing probes in the event loops and the channels, which tools such as bpftrace(8) can attach to at run-time. With 'sys/sdt.h', these are USDT probes, which are a single no-op instruction while not attached to. Otherwise, each probe calls an empty function, which can be traced with uprobes."
+  )
+
 configure_file(src/Config.in.h include/monomux/Config.h)
 install(FILES
     "${CMAKE_BINARY_DIR}/include/monomux/Config.h"
@@ -17,8 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <atomic>
 #include <cassert>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string_view>
 
@@ -71,21 +74,35 @@ constexpr std::int8_t MinimumVerbosity = log::Default - log::Max - 1;
 
 /// The \p Logger class handles emitting log messages to an output device.
 ///
-/// \note This object is \b NOT thread-safe!
+/// By default, every message is written to the output device synchronously,
+/// when the statement that built it finishes. In \e asynchronous mode, the
+/// formatted messages are put into a lock-free queue local to the logging
+/// thread instead, and a dedicated writer thread empties the queues onto the
+/// output device in batches, so logging does not block on a slow device.
+///
+/// \note Messages of different threads might be written in a slightly
+/// different order than they were made in asynchronous mode, but messages of
+/// the same thread are always written in order.
+///
+/// \note Configuring the logger (\p setOutput(), \p setAsynchronous()) is
+/// \b NOT thread-safe with respect to itself, but messages may be logged from
+/// multiple threads at the same time.
 class Logger
 {
 private:
   class OutputBuffer
   {
-    bool Discard;
-    std::ostream* OS;
-    std::ostringstream Buffer;
+    Logger* Owner;
+    Severity S;
+    std::optional<std::ostringstream> Buffer;
 
   public:
-    /// Wraps an output device into a log buffer.
-    ///
-    /// \param Discard Whether to throw the logged data away.
-    OutputBuffer(std::ostream& OS, bool Discard, std::string_view Prefix);
+    /// Creates a log buffer that throws the logged data away.
+    OutputBuffer() noexcept : Owner(nullptr), S(None) {}
+
+    /// Creates a log buffer that, when destroyed, emits the logged data with
+    /// the \p S severity through \p Owner.
+    OutputBuffer(Logger& Owner, Severity S, std::string_view Prefix);
 
     /// Print the contents of the log buffer to the output device.
     ~OutputBuffer() noexcept(false);
@@ -93,12 +110,14 @@ private:
     /// Print the contents of the fed value to the internal buffer.
     template <typename T> OutputBuffer& operator<<(T&& Value)
     {
-      if (!Discard)
-        Buffer << std::forward<T>(Value);
+      if (Buffer)
+        *Buffer << std::forward<T>(Value);
       return *this;
     }
   };
 
+  class AsyncBackend;
+
   /// A global instance of the logger.
   static std::unique_ptr<Logger> Singleton;
 
@@ -124,22 +143,59 @@ public:
   ///
   /// \see get()
   Logger(Severity SeverityLimit, std::ostream& OS);
+  ~Logger();
 
-  Severity getLimit() const noexcept { return SeverityLimit; }
-  void setLimit(Severity Limit) noexcept { SeverityLimit = Limit; }
+  Severity getLimit() const noexcept
+  {
+    return SeverityLimit.load(std::memory_order_relaxed);
+  }
+  void setLimit(Severity Limit) noexcept
+  {
+    SeverityLimit.store(Limit, std::memory_order_relaxed);
+  }
 
   /// Redirects all log messages after the call to this function to another
   /// output device.
-  void setOutput(std::ostream& OS) noexcept { this->OS = &OS; }
+  void setOutput(std::ostream& OS);
+
+  bool isAsynchronous() const noexcept { return Async != nullptr; }
+  /// Switches the logger to \p Async (or back to synchronous) mode. When
+  /// switching back, all the messages queued so far are written before the
+  /// call returns.
+  void setAsynchronous(bool Async);
+
+  /// Writes every message queued so far (in asynchronous mode) to the output
+  /// device, and flushes the device.
+  void flush();
 
   /// Starts printing a log message with the specified \p S severity.
   /// If the \p S severity is lower than the current severity limit, the message
-  /// will be discarded.
-  OutputBuffer operator()(Severity S, std::string_view Facility);
+  /// will be discarded, at the cost of only the comparison.
+  OutputBuffer operator()(Severity S, std::string_view Facility)
+  {
+    if (S > getLimit())
+      return OutputBuffer{};
+    return format(S, Facility);
+  }
 
 private:
-  Severity SeverityLimit;
+  std::atomic<Severity> SeverityLimit;
   std::ostream* OS;
+  /// Serialises the writes to \p OS.
+  std::mutex OutputLock;
+  std::unique_ptr<AsyncBackend> Async;
+
+  /// Starts a log message that will not be discarded.
+  OutputBuffer format(Severity S, std::string_view Facility);
+
+  /// Writes (or queues) the fully formatted \p Message.
+  void emit(Severity S, std::string&& Message);
+
+  /// Handlers that keep the asynchronous mode of the global logger consistent
+  /// over a \p fork(): the writer thread does not exist in the child process.
+  static void atForkPrepare() noexcept;
+  static void atForkParent() noexcept;
+  static void atForkChild() noexcept;
 };
 
 #define MONOMUX_LOGGER_SHORTCUT(NAME, SEVERITY)                                \
@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+
+#include "monomux/Config.h"
+
+#if defined(MONOMUX_TRACE_PROBES) && defined(MONOMUX_HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+#endif /* MONOMUX_TRACE_PROBES && MONOMUX_HAVE_SYS_SDT_H */
+
+/* MONOMUX_PROBE(NAME, A0, A1) marks a static tracing probe at the hot paths,
+ * with two integer arguments. Unlike the trace logs, probes do not format
+ * anything, and are meant to be attached to a running server on demand, e.g.:
+ *
+ *   bpftrace -e 'usdt:/path/to/monomux:monomux:wait_enter { ... }'
+ *
+ * The probes are paired as NAME_enter and NAME_exit around the operation they
+ * measure. The exit probe is not fired if the operation throws.
+ *
+ *   - wait_enter(FD, TimeoutMillis), wait_exit(FD, Events): EPoll::wait().
+ *   - dispatch_enter(FD, Mode), dispatch_exit(FD, Mode): the handling of an
+ *     event by the server, where Mode is 1 if the file is readable, 2 if it
+ *     is writable, and 3 if both.
+ *   - read_enter(FD, Bytes), read_exit(FD, Bytes): BufferedChannel::read().
+ *   - write_enter(FD, Bytes), write_exit(FD, Bytes): BufferedChannel::write().
+ *   - flush_enter(FD, Bytes), flush_exit(FD, Bytes):
+ *     BufferedChannel::flushWrites().
+ */
+#ifdef MONOMUX_TRACE_PROBES
+#ifdef MONOMUX_HAVE_SYS_SDT_H
+/* The probes are USDT probes of the "monomux" provider, which are a no-op
+ * instruction while nothing is attached to them.
+ */
+#define MONOMUX_PROBE(NAME, A0, A1)                                            \
+  STAP_PROBE2(monomux,                                                         \
+              NAME,                                                            \
+              static_cast<std::uint64_t>(A0),                                  \
+              static_cast<std::uint64_t>(A1))
+#else /* !MONOMUX_HAVE_SYS_SDT_H */
+/* Without "sys/sdt.h", every probe calls the empty \p monomux_probe function,
+ * with the name of the probe as its first argument, which can be attached to
+ * as a uprobe, e.g.:
+ *
+ *   bpftrace -e 'uprobe:/path/to/monomux:monomux_probe { @[str(arg0)] ... }'
+ */
+extern "C" void
+monomux_probe(const char* Name, std::uint64_t A0, std::uint64_t A1) noexcept;
+#define MONOMUX_PROBE(NAME, A0, A1)                                            \
+  monomux_probe(                                                               \
+    #NAME, static_cast<std::uint64_t>(A0), static_cast<std::uint64_t>(A1))
+#endif /* MONOMUX_HAVE_SYS_SDT_H */
+#else  /* !MONOMUX_TRACE_PROBES */
+/* The probes are turned \b OFF in this build, and are stripped. */
+#define MONOMUX_PROBE(NAME, A0, A1) ((void)0)
+#endif /* MONOMUX_TRACE_PROBES */
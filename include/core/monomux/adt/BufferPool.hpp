@@ -0,0 +1,190 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace monomux
+{
+
+/// A pool of byte buffers sorted into power-of-two size classes. Buffers
+/// released into the pool are kept for reuse by subsequent requests of the
+/// same class instead of being returned to the global allocator, so that
+/// creating and destroying many similarly sized buffers does not churn and
+/// fragment the heap.
+///
+/// Requests larger than \p MaxPooledSize are served by the global allocator
+/// directly.
+///
+/// \note The pool is thread-safe.
+class BufferPool
+{
+public:
+  /// The size of the smallest size class.
+  static constexpr std::size_t MinPooledSize = 1ULL << 12; // 4 KiB
+  /// The size of the largest size class.
+  static constexpr std::size_t MaxPooledSize = 1ULL << 20; // 1 MiB
+  /// The total size of the free buffers kept in a single size class.
+  static constexpr std::size_t MaxCachedPerClass = 1ULL << 23; // 8 MiB
+
+  /// Returns the released buffer to the pool it was acquired from.
+  class Release
+  {
+    BufferPool* Pool = nullptr;
+    std::size_t Class = 0;
+
+  public:
+    Release() noexcept = default;
+    Release(BufferPool* Pool, std::size_t Class) noexcept
+      : Pool(Pool), Class(Class)
+    {}
+
+    void operator()(char* Buffer) const noexcept
+    {
+      if (Pool)
+        Pool->release(Buffer, Class);
+      else
+        delete[] Buffer;
+    }
+  };
+  using Handle = std::unique_ptr<char[], Release>;
+
+  BufferPool() = default;
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  ~BufferPool() { trim(); }
+
+  /// \returns the pool shared by every user in the process.
+  static BufferPool& global()
+  {
+    static BufferPool Pool;
+    return Pool;
+  }
+
+  /// \returns a buffer that can hold at least \p Size bytes. The contents of
+  /// the buffer are indeterminate.
+  Handle acquire(std::size_t Size)
+  {
+    if (Size > MaxPooledSize)
+      return Handle{new char[Size], Release{}};
+
+    const std::size_t Class = classOf(Size);
+    {
+      std::lock_guard<std::mutex> Lock{Mutex};
+      std::vector<char*>& Free = FreeLists.at(Class);
+      if (!Free.empty())
+      {
+        char* Buffer = Free.back();
+        Free.pop_back();
+        ++Reuses;
+        return Handle{Buffer, Release{this, Class}};
+      }
+    }
+    return Handle{new char[classSize(Class)], Release{this, Class}};
+  }
+
+  /// Frees every buffer currently kept in the pool.
+  void trim() noexcept
+  {
+    std::lock_guard<std::mutex> Lock{Mutex};
+    for (std::vector<char*>& Free : FreeLists)
+    {
+      for (char* Buffer : Free)
+        delete[] Buffer;
+      Free.clear();
+      Free.shrink_to_fit();
+    }
+  }
+
+  /// \returns the total size of the free buffers kept in the pool.
+  std::size_t cachedBytes() const noexcept
+  {
+    std::lock_guard<std::mutex> Lock{Mutex};
+    std::size_t Bytes = 0;
+    for (std::size_t Class = 0; Class < ClassCount; ++Class)
+      Bytes += FreeLists.at(Class).size() * classSize(Class);
+    return Bytes;
+  }
+
+  /// \returns the number of requests that were served by reusing a buffer.
+  std::size_t reuses() const noexcept
+  {
+    std::lock_guard<std::mutex> Lock{Mutex};
+    return Reuses;
+  }
+
+private:
+  static constexpr std::size_t ClassCount = 9; // 4 KiB to 1 MiB.
+  static_assert((MinPooledSize << (ClassCount - 1)) == MaxPooledSize);
+
+  static constexpr std::size_t classSize(std::size_t Class) noexcept
+  {
+    return MinPooledSize << Class;
+  }
+  static constexpr std::size_t classOf(std::size_t Size) noexcept
+  {
+    std::size_t Class = 0;
+    while (classSize(Class) < Size)
+      ++Class;
+    return Class;
+  }
+
+  void release(char* Buffer, std::size_t Class) noexcept
+  {
+    if (!Buffer)
+      return;
+    {
+      std::lock_guard<std::mutex> Lock{Mutex};
+      std::vector<char*>& Free = FreeLists.at(Class);
+      if ((Free.size() + 1) * classSize(Class) <= MaxCachedPerClass)
+      {
+        try
+        {
+          Free.push_back(Buffer);
+          return;
+        }
+        catch (...)
+        {
+          // Fall through to freeing the buffer.
+        }
+      }
+    }
+    delete[] Buffer;
+  }
+
+  mutable std::mutex Mutex;
+  std::array<std::vector<char*>, ClassCount> FreeLists;
+  std::size_t Reuses = 0;
+};
+
+/// A storage policy of \p RingBuffer<char> which takes the arrays from the
+/// \p BufferPool::global() pool.
+struct PooledRingStorage
+{
+  using Pointer = BufferPool::Handle;
+  static Pointer allocate(std::size_t N)
+  {
+    return BufferPool::global().acquire(N);
+  }
+};
+
+} // namespace monomux
@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "monomux/adt/RingBuffer.hpp"
+
+/// Routines that find interesting bytes (line breaks, the start of control
+/// sequences) in buffers of terminal output. The routines process multiple
+/// bytes at once with the vector instructions of the CPU, if available.
+///
+/// \note The instruction set used is selected when the program starts, based
+/// on the capabilities of the CPU, and can be overridden with
+/// \p setActive().
+namespace monomux::scan
+{
+
+/// The instruction sets that implement scanning.
+enum class Implementation : std::uint8_t
+{
+  /// The portable implementation, processing one byte at a time.
+  Scalar,
+  /// 16 bytes at a time, with x86 SSE2.
+  SSE2,
+  /// 32 bytes at a time, with x86 AVX2.
+  AVX2,
+  /// 16 bytes at a time, with ARM NEON (Advanced SIMD).
+  NEON,
+};
+
+const char* name(Implementation I) noexcept;
+/// \returns whether the current CPU supports executing \p I.
+bool isSupported(Implementation I) noexcept;
+/// \returns the implementation used by the scanning routines.
+Implementation active() noexcept;
+/// Forces the scanning routines to use the \p I implementation.
+///
+/// \returns \p false, and keeps the current implementation, if \p I is not
+/// supported.
+bool setActive(Implementation I) noexcept;
+
+/// \returns the index of the first \p C in \p Data, or \p Size if there is
+/// none.
+std::size_t find(const char* Data, std::size_t Size, char C) noexcept;
+/// \returns the index of the first \p A or \p B in \p Data, or \p Size if
+/// there is none.
+std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept;
+/// \returns the index of the first byte in \p Data that is not a printable
+/// ASCII character, i.e. a control character, or part of a multi-byte UTF-8
+/// character, or \p Size if there is none.
+std::size_t findNonPrintable(const char* Data, std::size_t Size) noexcept;
+/// \returns the number of times \p C occurs in \p Data.
+std::size_t count(const char* Data, std::size_t Size, char C) noexcept;
+
+/// \returns the length of the longest prefix of \p Data that does not end in
+/// the middle of a multi-byte UTF-8 character.
+///
+/// \note Only the encoding of the last (at most 3) bytes is checked, the
+/// contents of \p Data are not validated.
+std::size_t utf8CompletePrefix(const char* Data, std::size_t Size) noexcept;
+
+/// \returns the index of the first \p C in the contents of \p Buf, or
+/// \p Buf.size() if there is none.
+template <class Storage>
+std::size_t find(const RingBuffer<char, Storage>& Buf, char C) noexcept
+{
+  std::size_t Offset = 0;
+  for (const auto& R : Buf.peekFrontRanges(Buf.size()))
+  {
+    std::size_t Index = find(R.Begin, R.Size, C);
+    if (Index != R.Size)
+      return Offset + Index;
+    Offset += R.Size;
+  }
+  return Offset;
+}
+
+/// \returns the index of the first \p A or \p B in the contents of \p Buf, or
+/// \p Buf.size() if there is none.
+template <class Storage>
+std::size_t
+findEither(const RingBuffer<char, Storage>& Buf, char A, char B) noexcept
+{
+  std::size_t Offset = 0;
+  for (const auto& R : Buf.peekFrontRanges(Buf.size()))
+  {
+    std::size_t Index = findEither(R.Begin, R.Size, A, B);
+    if (Index != R.Size)
+      return Offset + Index;
+    Offset += R.Size;
+  }
+  return Offset;
+}
+
+/// \returns the number of times \p C occurs in the contents of \p Buf.
+template <class Storage>
+std::size_t count(const RingBuffer<char, Storage>& Buf, char C) noexcept
+{
+  std::size_t N = 0;
+  for (const auto& R : Buf.peekFrontRanges(Buf.size()))
+    N += count(R.Begin, R.Size, C);
+  return N;
+}
+
+} // namespace monomux::scan
@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "monomux/adt/MemberFunctionHelper.hpp"
+
+namespace monomux
+{
+
+/// An implementation of a map where keys are unsigned integers that are
+/// expected to be densely allocated from zero, such as file descriptors.
+/// Elements are stored in a flat array directly indexed by the key, so every
+/// access is a constant operation, regardless of the number of elements.
+///
+/// The default-constructed \p T is the "unmapped" value, similarly to
+/// \p SmallIndexMap's \p IntrusiveDefaultSentinel mode, and thus \p T should
+/// be a small, cheaply copied object, such as a pointer.
+///
+/// The array grows geometrically when a key beyond its end is mapped, and is
+/// never shrunk (except by \p clear()).
+///
+/// \note Mapping a key beyond the end of the array reallocates the storage,
+/// and invalidates \b EVERY reference to existing elements.
+template <typename T, typename KeyTy = std::size_t> class FlatIndexMap
+{
+  static_assert(std::is_integral_v<KeyTy> && std::is_unsigned_v<KeyTy>,
+                "Keys must be index-like for direct indexing to work!");
+  static_assert(std::is_default_constructible_v<T>,
+                "The default constructed value is the unmapped sentinel!");
+
+  std::vector<T> Slots;
+  /// The number of mapped elements.
+  std::size_t Size = 0;
+
+public:
+  /// The number of elements allocated when the first element is mapped.
+  static constexpr std::size_t MinCapacity = 64;
+
+  /// \returns the size of the container, i.e. the number of elements added
+  /// into it.
+  std::size_t size() const noexcept { return Size; }
+  /// \returns whether the container is empty.
+  bool empty() const noexcept { return Size == 0; }
+  /// \returns the number of keys that can be mapped without reallocating.
+  std::size_t capacity() const noexcept { return Slots.size(); }
+
+  /// \returns whether the \p Key is mapped.
+  bool contains(KeyTy Key) const noexcept { return tryGet(Key) != nullptr; }
+
+  /// Sets the element to one constructed by forwarding \p Args, overwriting
+  /// any potential already stored element.
+  ///
+  /// Care must be taken to emplace a \b non-default value. Otherwise, the
+  /// \p size() of the object will not be properly calculated.
+  template <typename... Arg> void set(KeyTy Key, Arg&&... Args)
+  {
+    T& Elem = slot(Key);
+    if (!isMapped(Elem))
+      ++Size;
+    Elem = T{std::forward<Arg>(Args)...};
+  }
+
+  /// Deletes the element mapped to \p Key if such element exists.
+  void erase(KeyTy Key) noexcept
+  {
+    if (Key >= Slots.size() || !isMapped(Slots[Key]))
+      return;
+    Slots[Key] = T{};
+    --Size;
+  }
+
+  /// Deletes all mapped elements, and releases the storage.
+  void clear() noexcept
+  {
+    Slots.clear();
+    Slots.shrink_to_fit();
+    Size = 0;
+  }
+
+  /// Retrieve a non-mutable pointer to the element mapped for \p Key, or
+  /// \p nullptr if \p Key is not mapped.
+  const T* tryGet(KeyTy Key) const noexcept
+  {
+    if (Key >= Slots.size() || !isMapped(Slots[Key]))
+      return nullptr;
+    return &Slots[Key];
+  }
+  /// Retrieve a mutable pointer to the element mapped for \p Key, or
+  /// \p nullptr if \p Key is not mapped.
+  MEMBER_FN_NON_CONST_1_NOEXCEPT(T*, tryGet, KeyTy, Key);
+
+  /// Retrieve a non-mutable reference to the element mapped for \p Key.
+  /// \throws std::out_of_range if \p Key is not mapped.
+  const T& get(KeyTy Key) const
+  {
+    const T* P = tryGet(Key);
+    if (!P)
+      out_of_range(Key);
+    return *P;
+  }
+  /// Retrieve a mutable reference to the element mapped for \p Key.
+  MEMBER_FN_NON_CONST_1(T&, get, KeyTy, Key);
+
+  /// Create a mutable reference to the element mapped for \p Key.
+  /// If no such element exists, the reference is to the default element,
+  /// which supports assigning value to it.
+  ///
+  /// Care must be taken to assign a \b non-default value to the object
+  /// returned by this operator. Otherwise, the \p size() of the object will
+  /// not be properly calculated.
+  T& operator[](KeyTy Key)
+  {
+    T& Elem = slot(Key);
+    if (!isMapped(Elem))
+      ++Size;
+    return Elem;
+  }
+
+private:
+  // NOLINTNEXTLINE(readability-identifier-naming)
+  [[noreturn]] void out_of_range(KeyTy Key) const
+  {
+    std::string Err = std::to_string(Key) + " is not mapped";
+    throw std::out_of_range(Err);
+  }
+
+  /// \returns whether the stored element represents a mapped value.
+  static bool isMapped(const T& Elem) noexcept { return !(Elem == T{}); }
+
+  /// \returns the storage for \p Key, growing the storage if needed.
+  T& slot(KeyTy Key)
+  {
+    if (Key >= Slots.size())
+    {
+      std::size_t NewCapacity = std::max(MinCapacity, Slots.size());
+      while (NewCapacity <= Key)
+        NewCapacity *= 2;
+      Slots.resize(NewCapacity);
+    }
+    return Slots[Key];
+  }
+};
+
+} // namespace monomux
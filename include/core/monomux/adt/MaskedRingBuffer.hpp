@@ -0,0 +1,325 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "monomux/adt/MemberFunctionHelper.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+#include "monomux/adt/UniqueScalar.hpp"
+
+namespace monomux
+{
+
+namespace detail
+{
+
+template <class Storage, class = void> struct IsMirroredStorage
+{
+  static constexpr bool value = false;
+};
+template <class Storage>
+struct IsMirroredStorage<Storage, std::void_t<decltype(Storage::Mirrored)>>
+{
+  static constexpr bool value = Storage::Mirrored;
+};
+
+/// \returns the smallest power of two not less than \p N.
+constexpr std::size_t roundUpToPowerOfTwo(std::size_t N) noexcept
+{
+  std::size_t P = 1;
+  while (P < N)
+    P <<= 1;
+  return P;
+}
+
+} // namespace detail
+
+/// A ring buffer like \p RingBuffer, but the capacity is always a power of
+/// two, and the logical begin and end are tracked as monotonically increasing
+/// counters. Translating a counter to a location in the storage is a single
+/// mask operation, and the size is the difference of the counters, so no
+/// branches are needed to handle the wraparound.
+///
+///   \code
+///
+///      +--------+--------+--------+--------+--------+--------+--------+--------+
+///      | elem 5 |        |        | elem 0 | elem 1 | elem 2 | elem 3 | elem 4 |
+///      +--------+--------+--------+--------+--------+--------+--------+--------+
+///
+///      Head = 11 (& 7 = 3)    Tail = 17 (& 7 = 1)    Size = Tail - Head = 6
+///
+///   \endcode
+///
+/// The \p Storage policy allocates the memory of the buffer, like for
+/// \p RingBuffer. If the policy declares \p Mirrored to be \p true, the
+/// storage must map the memory of the buffer twice, directly after each
+/// other, so any range of at most \p capacity() elements starting in the
+/// buffer is contiguous. Such policies also provide a \p roundCapacity()
+/// function to adjust the requested capacities to what they can map.
+template <class T, class Storage = HeapRingStorage<T>> class MaskedRingBuffer
+{
+  using StorageType = typename Storage::Pointer;
+  static constexpr bool TriviallyCopyable = std::is_trivially_copyable_v<T>;
+
+public:
+  /// Whether every range of the contents is contiguous in memory.
+  static constexpr bool Mirrored = detail::IsMirroredStorage<Storage>::value;
+
+  /// A physically contiguous range of elements in the storage of the buffer.
+  using Range = typename RingBuffer<T>::Range;
+
+  /// Creates the buffer with a capacity of at least \p Capacity.
+  MaskedRingBuffer(std::size_t Capacity)
+  {
+    if (Capacity)
+      grow(Capacity);
+  }
+
+  std::size_t capacity() const noexcept { return Capacity; }
+  std::size_t size() const noexcept { return Tail - Head; }
+  bool empty() const noexcept { return Tail == Head; }
+
+  /// \returns a reference to the element at the specified location \p Index.
+  const T& at(std::size_t Index) const
+  {
+    if (Index >= size())
+      throw std::out_of_range{std::string{"idx "} + std::to_string(Index) +
+                              " >= size " + std::to_string(size())};
+    return *slot(Head + Index);
+  }
+  /// \returns a reference to the element at the specified location \p Index.
+  MEMBER_FN_NON_CONST_1(T&, at, std::size_t, Index);
+  const T& operator[](std::size_t Index) const { return at(Index); }
+  T& operator[](std::size_t Index) { return at(Index); }
+
+  const T& front() const { return at(0); }
+  MEMBER_FN_NON_CONST_0(T&, front);
+  const T& back() const { return at(size() - 1); }
+  MEMBER_FN_NON_CONST_0(T&, back);
+
+  /// Copies the element \p V to the end of the buffer.
+  // NOLINTNEXTLINE(readability-identifier-naming)
+  void push_back(const T& V)
+  {
+    if (size() == Capacity)
+      grow(Capacity + 1);
+    *slot(Tail) = V;
+    ++Tail.get();
+  }
+
+  /// Removes the first element (\p front()) from the buffer.
+  // NOLINTNEXTLINE(readability-identifier-naming)
+  void pop_front()
+  {
+    if (empty())
+      throw std::out_of_range{"Empty buffer."};
+    *slot(Head) = T{};
+    ++Head.get();
+    rewindIfEmpty();
+  }
+
+  void clear()
+  {
+    if constexpr (!TriviallyCopyable)
+      for (std::size_t I = Head; I != Tail; ++I)
+        *slot(I) = T{};
+    Head = 0;
+    Tail = 0;
+  }
+
+  /// \returns the at most two physically contiguous ranges that, in order,
+  /// make up the first (at most) \p N elements of the buffer. The elements are
+  /// not consumed. If the buffer is \p Mirrored, the second range is always
+  /// empty.
+  ///
+  /// \warning The returned ranges are invalidated by any modification of the
+  /// buffer.
+  std::array<Range, 2> peekFrontRanges(std::size_t N) const noexcept
+  {
+    N = std::min(N, size());
+    return contiguousRanges(Head, N);
+  }
+
+  /// Ensures that the buffer has space for at least \p N more elements, and
+  /// returns the at most two physically contiguous ranges that, in order,
+  /// make up the \e entire unused storage after the last element. If the
+  /// buffer is \p Mirrored, the second range is always empty.
+  ///
+  /// Elements written into these ranges become part of the buffer only after
+  /// a call to \p commitBack().
+  std::array<Range, 2> reserveBack(std::size_t N)
+  {
+    if (size() + N > Capacity)
+      grow(size() + N);
+    return contiguousRanges(Tail, Capacity - size());
+  }
+
+  /// Marks the first \p N elements of the unused storage after the last element
+  /// (as returned by \p reserveBack()) as part of the buffer.
+  void commitBack(std::size_t N) noexcept
+  {
+    assert(size() + N <= Capacity && "commitBack() more than reserved!");
+    Tail.get() += N;
+  }
+
+  /// Push \p N elements starting at \p Ptr to the end of the buffer.
+  void putBack(const T* Ptr, std::size_t N)
+  {
+    std::size_t Count = 0;
+    for (const Range& R : reserveBack(N))
+    {
+      const std::size_t Len = std::min(N - Count, R.Size);
+      if constexpr (TriviallyCopyable)
+      {
+        if (Len)
+          std::memcpy(R.Begin, Ptr + Count, Len * sizeof(T));
+      }
+      else
+        std::copy(Ptr + Count, Ptr + Count + Len, R.Begin);
+      Count += Len;
+    }
+    commitBack(N);
+  }
+
+  /// Discard at most \p N elements from the beginning of the buffer.
+  void dropFront(std::size_t N) noexcept
+  {
+    Head.get() += std::min(N, size());
+    rewindIfEmpty();
+  }
+
+  /// Copies out at most \p N elements from the beginning of the buffer to the
+  /// storage starting at \p Out, but do not consume it from the buffer.
+  ///
+  /// \returns the number of elements written to \p Out.
+  std::size_t peekFront(T* Out, std::size_t N) const
+  {
+    std::size_t Count = 0;
+    for (const Range& R : peekFrontRanges(N))
+    {
+      if constexpr (TriviallyCopyable)
+      {
+        if (R.Size)
+          std::memcpy(Out + Count, R.Begin, R.Size * sizeof(T));
+      }
+      else
+        std::copy(R.Begin, R.Begin + R.Size, Out + Count);
+      Count += R.Size;
+    }
+    return Count;
+  }
+
+  /// Consume at most \p N elements from the beginning of the buffer, copying
+  /// them to the storage starting at \p Out.
+  ///
+  /// \returns the number of elements written to \p Out.
+  std::size_t takeFront(T* Out, std::size_t N)
+  {
+    N = peekFront(Out, N);
+    dropFront(N);
+    return N;
+  }
+
+  /// Consume at most \p N elements from the beginning of the buffer.
+  std::vector<T> takeFront(std::size_t N)
+  {
+    std::vector<T> V(std::min(N, size()));
+    takeFront(V.data(), V.size());
+    return V;
+  }
+
+private:
+  StorageType Data;
+  UniqueScalar<std::size_t, 0> Capacity;
+  /// The counter of the first element.
+  UniqueScalar<std::size_t, 0> Head;
+  /// The counter after the last element.
+  UniqueScalar<std::size_t, 0> Tail;
+
+  T* slot(std::size_t Counter) const noexcept
+  {
+    return Data.get() + (Counter & (Capacity - 1));
+  }
+
+  std::array<Range, 2> contiguousRanges(std::size_t Counter,
+                                        std::size_t N) const noexcept
+  {
+    std::array<Range, 2> R{Range{slot(Counter), N}, Range{Data.get(), 0}};
+    if constexpr (!Mirrored)
+    {
+      const std::size_t UntilEnd = Capacity - (Counter & (Capacity - 1));
+      R[0].Size = std::min(N, UntilEnd);
+      R[1].Size = N - R[0].Size;
+    }
+    return R;
+  }
+
+  /// Restarts the counters from the beginning of the storage if the buffer is
+  /// empty, so subsequent ranges are less likely to wrap around.
+  void rewindIfEmpty() noexcept
+  {
+    if (empty())
+    {
+      Head = 0;
+      Tail = 0;
+    }
+  }
+
+  /// Reallocates the storage to have a capacity of at least \p MinCapacity
+  /// and at least twice the current one.
+  void grow(std::size_t MinCapacity)
+  {
+    std::size_t NewCapacity = std::max(MinCapacity, Capacity * 2);
+    if constexpr (Mirrored)
+      NewCapacity = Storage::roundCapacity(NewCapacity);
+    else
+      NewCapacity = detail::roundUpToPowerOfTwo(NewCapacity);
+    assert((NewCapacity & (NewCapacity - 1)) == 0 &&
+           "Capacity must be a power of two!");
+
+    StorageType New = Storage::allocate(NewCapacity);
+    std::size_t Size = 0;
+    for (const Range& R : peekFrontRanges(size()))
+    {
+      if constexpr (TriviallyCopyable)
+      {
+        if (R.Size)
+          std::memcpy(New.get() + Size, R.Begin, R.Size * sizeof(T));
+      }
+      else
+        std::move(R.Begin, R.Begin + R.Size, New.get() + Size);
+      Size += R.Size;
+    }
+
+    Data = std::move(New);
+    Capacity.get() = NewCapacity;
+    Head = 0;
+    Tail.get() = Size;
+  }
+};
+
+} // namespace monomux
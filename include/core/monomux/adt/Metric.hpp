@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "monomux/adt/Atomic.hpp"
+
+namespace monomux
+{
+
+/// A monotonically increasing count of events, which may be incremented and
+/// read concurrently without locking. The ordering of the updates with other
+/// memory operations is not guaranteed, so the value is only meant to be
+/// observed as a statistic.
+class Counter
+{
+public:
+  void add(std::uint64_t N = 1) noexcept
+  {
+    Value.get().fetch_add(N, std::memory_order_relaxed);
+  }
+  std::uint64_t get() const noexcept
+  {
+    return Value.get().load(std::memory_order_relaxed);
+  }
+
+private:
+  Atomic<std::uint64_t> Value;
+};
+
+/// The largest value observed of a quantity, e.g. the size of a buffer.
+class HighWater
+{
+public:
+  void observe(std::uint64_t V) noexcept
+  {
+    std::uint64_t Current = Value.get().load(std::memory_order_relaxed);
+    // Most observations do not raise the mark, and those return without
+    // writing.
+    while (V > Current && !Value.get().compare_exchange_weak(
+                            Current, V, std::memory_order_relaxed))
+      ;
+  }
+  std::uint64_t get() const noexcept
+  {
+    return Value.get().load(std::memory_order_relaxed);
+  }
+
+private:
+  Atomic<std::uint64_t> Value;
+};
+
+/// The distribution of observed values, counted into buckets with
+/// exponentially growing bounds. The bucket \p I counts the values not larger
+/// than \p upperBound(I), and not counted by the previous bucket.
+class Histogram
+{
+public:
+  static constexpr std::size_t BucketCount = 24;
+
+  /// \returns the largest value counted into the bucket \p I. The last bucket
+  /// is unbounded.
+  static constexpr std::uint64_t upperBound(std::size_t I) noexcept
+  {
+    if (I >= BucketCount - 1)
+      return std::numeric_limits<std::uint64_t>::max();
+    return (std::uint64_t{1} << I) - 1;
+  }
+
+  void record(std::uint64_t V) noexcept
+  {
+    std::size_t Bucket =
+      V ? std::numeric_limits<std::uint64_t>::digits - __builtin_clzll(V) : 0;
+    if (Bucket >= BucketCount)
+      Bucket = BucketCount - 1;
+    Buckets.at(Bucket).add();
+    Total.add(V);
+  }
+
+  /// \returns the number of values counted into the bucket \p I.
+  std::uint64_t bucket(std::size_t I) const noexcept
+  {
+    return Buckets.at(I).get();
+  }
+  /// \returns the sum of every value recorded.
+  std::uint64_t sum() const noexcept { return Total.get(); }
+  /// \returns the number of values recorded.
+  std::uint64_t count() const noexcept
+  {
+    std::uint64_t N = 0;
+    for (const Counter& C : Buckets)
+      N += C.get();
+    return N;
+  }
+
+private:
+  std::array<Counter, BucketCount> Buckets;
+  Counter Total;
+};
+
+} // namespace monomux
@@ -18,16 +18,20 @@
  */
 #pragma once
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "monomux/adt/MemberFunctionHelper.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/system/Time.hpp"
 
 namespace monomux
 {
@@ -50,6 +54,8 @@ public:
   bool empty() const noexcept { return Size == 0; }
 
   std::size_t originalCapacity() const noexcept { return OriginalCapacity; }
+  /// \returns the largest number of elements the buffer ever held.
+  std::size_t highWater() const noexcept { return HighWater; }
   std::chrono::time_point<std::chrono::system_clock> lastAccess() const noexcept
   {
     return LastAccess;
@@ -122,7 +128,7 @@ protected:
       return false;
 
     static constexpr std::size_t TimeThresholdSeconds = 60;
-    if (std::chrono::system_clock::now() - LastAccess >=
+    if (CoarseClock::now() - LastAccess >=
         std::chrono::seconds(TimeThresholdSeconds))
       // Consider the buffer for shrinking if operations were successful without
       // accessing the buffer for a sufficient amount of time.
@@ -157,14 +163,17 @@ private:
   /// points (calls to \p resetSize()).
   std::vector<std::size_t> SizePeaks;
   std::size_t CurrentPeakIndex = 0;
+  std::size_t HighWater = 0;
 
   std::chrono::time_point<std::chrono::system_clock> LastAccess;
 
-  void markAccess() noexcept { LastAccess = std::chrono::system_clock::now(); }
+  void markAccess() noexcept { LastAccess = CoarseClock::now(); }
 
   /// Marks the current size as the peak of the current zone, if sufficient.
   void mayBePeak() noexcept
   {
+    if (Size > HighWater)
+      HighWater = Size;
     if (Size == 0 || Capacity <= OriginalCapacity)
       return;
 
@@ -191,6 +200,14 @@ private:
 
 } // namespace detail
 
+/// The default storage policy of \p RingBuffer, which allocates the arrays
+/// with the global allocator.
+template <class T> struct HeapRingStorage
+{
+  using Pointer = std::unique_ptr<T[]>;
+  static Pointer allocate(std::size_t N) { return Pointer{new T[N]}; }
+};
+
 /// A ring buffer based backing store that can contain an arbitrary count of
 /// objects of a type.
 ///
@@ -222,14 +239,19 @@ private:
 ///
 /// \tparam T The element type to store. Ring storage works best if T is
 /// default-constructible and this construction is cheap.
-template <class T> class RingBuffer : public detail::RingBufferBase
+/// \tparam Storage The policy that allocates the arrays the elements are
+/// stored in.
+template <class T, class Storage = HeapRingStorage<T>>
+class RingBuffer : public detail::RingBufferBase
 {
-  using StorageType = std::unique_ptr<T[]>;
+  using StorageType = typename Storage::Pointer;
   static constexpr bool NothrowAssignable = std::is_nothrow_assignable_v<T, T>;
+  /// Whether bulk operations can copy the elements with \p memcpy().
+  static constexpr bool TriviallyCopyable = std::is_trivially_copyable_v<T>;
 
 public:
   RingBuffer(std::size_t Capacity)
-    : RingBufferBase(Capacity), StorageWithOriginalCapacity(new T[Capacity]),
+    : RingBufferBase(Capacity), StorageWithOriginalCapacity(Storage::allocate(Capacity)),
       Origin(physicalBegin()), End(physicalBegin())
   {}
 
@@ -365,6 +387,19 @@ public:
     return V;
   }
 
+  /// Consume at most \p N elements from the beginning of the buffer, moving
+  /// them to the storage starting at \p Out.
+  ///
+  /// \returns the number of elements written to \p Out.
+  ///
+  /// \see dropFront, peekFront
+  std::size_t takeFront(T* Out, std::size_t N)
+  {
+    N = peekFront(Out, N);
+    dropFront(N);
+    return N;
+  }
+
   /// Discard at most \p N elements from the beginning of the buffer.
   ///
   /// \see takeFront, peekFront
@@ -388,6 +423,13 @@ public:
       N = Size;
 
     std::vector<T> V;
+    if constexpr (TriviallyCopyable)
+    {
+      V.resize(N);
+      peekFront(V.data(), N);
+      return V;
+    }
+
     V.reserve(N);
 
     T* P = Origin;
@@ -404,12 +446,104 @@ public:
     return V;
   }
 
+  /// Moves out at most \p N elements from the beginning of the buffer to the
+  /// storage starting at \p Out, but do not consume it from the buffer.
+  ///
+  /// \returns the number of elements written to \p Out.
+  ///
+  /// \see takeFront, dropFront
+  std::size_t peekFront(T* Out, std::size_t N)
+  {
+    std::size_t Count = 0;
+    for (const Range& R : peekFrontRanges(N))
+    {
+      if constexpr (TriviallyCopyable)
+      {
+        if (R.Size)
+          std::memcpy(Out + Count, R.Begin, R.Size * sizeof(T));
+      }
+      else
+        std::move(R.Begin, R.Begin + R.Size, Out + Count);
+      Count += R.Size;
+    }
+    return Count;
+  }
+
+  /// A physically contiguous range of elements in the storage of the buffer.
+  struct Range
+  {
+    T* Begin;
+    std::size_t Size;
+  };
+
+  /// \returns the at most two physically contiguous ranges that, in order,
+  /// make up the first (at most) \p N elements of the buffer. The elements are
+  /// not consumed.
+  ///
+  /// \warning The returned ranges are invalidated by any modification of the
+  /// buffer.
+  ///
+  /// \see dropFront
+  std::array<Range, 2> peekFrontRanges(std::size_t N) const noexcept
+  {
+    if (N > Size)
+      N = Size;
+
+    std::array<Range, 2> R{Range{Origin.get(), 0}, Range{physicalBegin(), 0}};
+    R[0].Size = std::min(N, static_cast<std::size_t>(physicalEnd() - Origin));
+    R[1].Size = N - R[0].Size;
+    return R;
+  }
+
+  /// Ensures that the buffer has space for at least \p N more elements, and
+  /// returns the at most two physically contiguous ranges that, in order,
+  /// make up the \e entire unused storage after the last element.
+  ///
+  /// Elements written into these ranges become part of the buffer only after
+  /// a call to \p commitBack().
+  ///
+  /// \warning The returned ranges are invalidated by any modification of the
+  /// buffer.
+  std::array<Range, 2> reserveBack(std::size_t N)
+  {
+    if (Size + N > Capacity)
+      grow(Size + N);
+
+    const std::size_t Free = Capacity - Size;
+    T* P = End;
+    if (P >= physicalEnd())
+      P = physicalBegin();
+
+    std::array<Range, 2> R{Range{P, 0}, Range{physicalBegin(), 0}};
+    R[0].Size = std::min(Free, static_cast<std::size_t>(physicalEnd() - P));
+    R[1].Size = Free - R[0].Size;
+    return R;
+  }
+
+  /// Marks the first \p N elements of the unused storage after the last element
+  /// (as returned by \p reserveBack()) as part of the buffer.
+  void commitBack(std::size_t N) noexcept
+  {
+    assert(Size + N <= Capacity && "commitBack() more than reserved!");
+    if (!N)
+      return;
+
+    End = translateIndex(Size + N - 1) + 1;
+    addSize(N);
+  }
+
   /// Push the contents of \p V to the end of the buffer.
   void putBack(std::vector<T> V) { putBack(V.data(), V.size()); }
 
   /// Push \p N elements starting at \p Ptr to the end of the buffer.
   void putBack(T* Ptr, std::size_t N)
   {
+    if constexpr (TriviallyCopyable)
+    {
+      putBack(const_cast<const T*>(Ptr), N);
+      return;
+    }
+
     if (Size + N > Capacity)
       grow(Size + N);
 
@@ -434,6 +568,23 @@ public:
   /// Push \p N elements starting at \p Ptr to the end of the buffer.
   void putBack(const T* Ptr, std::size_t N)
   {
+    if constexpr (TriviallyCopyable)
+    {
+      if (!N)
+        return;
+
+      std::size_t Count = 0;
+      for (const Range& R : reserveBack(N))
+      {
+        const std::size_t Len = std::min(N - Count, R.Size);
+        if (Len)
+          std::memcpy(R.Begin, Ptr + Count, Len * sizeof(T));
+        Count += Len;
+      }
+      commitBack(N);
+      return;
+    }
+
     if (Size + N > Capacity)
       grow(Size + N);
 
@@ -562,9 +713,15 @@ private:
     if (NewCapacity <= Capacity)
       return;
 
-    StorageType New{new T[NewCapacity]};
-    for (std::size_t I = 0; I < Size; ++I)
-      New[I] = std::move(getStorage()[I]);
+    StorageType New = Storage::allocate(NewCapacity);
+    if constexpr (TriviallyCopyable)
+    {
+      if (Size)
+        std::memcpy(&New[0], physicalBegin(), Size * sizeof(T));
+    }
+    else
+      for (std::size_t I = 0; I < Size; ++I)
+        New[I] = std::move(getStorage()[I]);
 
     if (UsingGrowingStorage)
       std::swap(GrowingStorage, New);
@@ -601,7 +758,7 @@ private:
     else
     {
       UsingGrowingStorage = true;
-      StorageType New{new T[NewCapacity]};
+      StorageType New = Storage::allocate(NewCapacity);
       std::swap(GrowingStorage, New);
     }
 
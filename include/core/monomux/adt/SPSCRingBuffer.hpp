@@ -0,0 +1,237 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#include "monomux/adt/MaskedRingBuffer.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+
+namespace monomux
+{
+
+/// A fixed-capacity byte ring buffer that one producer thread writes and one
+/// consumer thread reads at the same time, without locks. Neither side ever
+/// waits for the other: a full buffer accepts fewer bytes, and an empty one
+/// provides none.
+///
+/// The positions are monotonically increasing counters, like in
+/// \p MaskedRingBuffer, so the capacity is a power of two. Each side keeps
+/// its own position and a cached copy of the other side's position on its
+/// own cache line, and only reloads the other side's position when the
+/// cached one says the buffer is full (or empty).
+///
+/// Written bytes are only visible to the consumer once \p publish()ed, so the
+/// producer can commit several small writes and pay for the cross-core
+/// synchronisation once.
+///
+/// \note The producer functions are \p reserveBack(), \p commitBack(),
+/// \p publish() and \p putBack(). The consumer functions are
+/// \p peekFrontRanges(), \p dropFront(), \p peekFront() and \p takeFront().
+/// The two sides can be used concurrently, but each side only from a single
+/// thread at a time.
+template <class Storage = HeapRingStorage<char>> class SPSCRingBuffer
+{
+  using StorageType = typename Storage::Pointer;
+
+public:
+  static constexpr std::size_t CacheLineSize = 64;
+  static constexpr bool Mirrored = detail::IsMirroredStorage<Storage>::value;
+  using Range = RingBuffer<char>::Range;
+
+  /// Creates the buffer with a capacity of at least \p Capacity bytes.
+  SPSCRingBuffer(std::size_t Capacity)
+    : Capacity(roundCapacity(Capacity)), Data(Storage::allocate(this->Capacity))
+  {}
+  SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+  SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+  std::size_t capacity() const noexcept { return Capacity; }
+
+  /// \returns the number of bytes published and not yet consumed.
+  ///
+  /// \note If called while the other side is working, the result is only a
+  /// snapshot.
+  std::size_t size() const noexcept
+  {
+    return Producer.Tail.load(std::memory_order_acquire) -
+           Consumer.Head.load(std::memory_order_acquire);
+  }
+  bool empty() const noexcept { return size() == 0; }
+
+  /// (Producer.) \returns the at most two physically contiguous ranges that,
+  /// in order, make up the free storage after the last committed byte. If the
+  /// buffer is \p Mirrored, the second range is always empty.
+  ///
+  /// \note Unlike \p RingBuffer, the buffer is not grown, so the ranges might
+  /// describe less than the \p N bytes needed.
+  std::array<Range, 2> reserveBack(std::size_t N) noexcept
+  {
+    std::size_t Free = Capacity - (Producer.Pending - Producer.CachedHead);
+    if (Free < N)
+    {
+      Producer.CachedHead = Consumer.Head.load(std::memory_order_acquire);
+      Free = Capacity - (Producer.Pending - Producer.CachedHead);
+    }
+    return ranges(Producer.Pending, Free);
+  }
+
+  /// (Producer.) Marks the first \p N bytes of the free storage (as returned
+  /// by \p reserveBack()) as written. The bytes are not visible to the
+  /// consumer until \p publish() is called.
+  void commitBack(std::size_t N) noexcept
+  {
+    assert(Producer.Pending + N - Producer.CachedHead <= Capacity &&
+           "commitBack() more than reserved!");
+    Producer.Pending += N;
+  }
+
+  /// (Producer.) Makes the committed bytes visible to the consumer.
+  void publish() noexcept
+  {
+    Producer.Tail.store(Producer.Pending, std::memory_order_release);
+  }
+
+  /// (Producer.) Copies at most \p N bytes from \p Ptr to the end of the
+  /// buffer, and publishes them.
+  ///
+  /// \returns the number of bytes copied, which is less than \p N if the
+  /// buffer became full.
+  std::size_t putBack(const char* Ptr, std::size_t N) noexcept
+  {
+    std::size_t Count = 0;
+    for (const Range& R : reserveBack(N))
+    {
+      const std::size_t Len = std::min(N - Count, R.Size);
+      if (Len)
+        std::memcpy(R.Begin, Ptr + Count, Len);
+      Count += Len;
+    }
+    commitBack(Count);
+    publish();
+    return Count;
+  }
+
+  /// (Consumer.) \returns the at most two physically contiguous ranges that,
+  /// in order, make up the first (at most) \p N published bytes. If the
+  /// buffer is \p Mirrored, the second range is always empty.
+  std::array<Range, 2> peekFrontRanges(std::size_t N) noexcept
+  {
+    const std::size_t Head = Consumer.Head.load(std::memory_order_relaxed);
+    std::size_t Available = Consumer.CachedTail - Head;
+    if (Available < N)
+    {
+      Consumer.CachedTail = Producer.Tail.load(std::memory_order_acquire);
+      Available = Consumer.CachedTail - Head;
+    }
+    return ranges(Head, std::min(N, Available));
+  }
+
+  /// (Consumer.) Discards at most \p N bytes from the beginning of the
+  /// buffer, freeing up space for the producer.
+  void dropFront(std::size_t N) noexcept
+  {
+    const std::size_t Head = Consumer.Head.load(std::memory_order_relaxed);
+    std::size_t Available = Consumer.CachedTail - Head;
+    if (Available < N)
+    {
+      Consumer.CachedTail = Producer.Tail.load(std::memory_order_acquire);
+      Available = Consumer.CachedTail - Head;
+    }
+    Consumer.Head.store(Head + std::min(N, Available),
+                        std::memory_order_release);
+  }
+
+  /// (Consumer.) Copies out at most \p N bytes from the beginning of the
+  /// buffer to \p Out, but does not consume them.
+  ///
+  /// \returns the number of bytes written to \p Out.
+  std::size_t peekFront(char* Out, std::size_t N) noexcept
+  {
+    std::size_t Count = 0;
+    for (const Range& R : peekFrontRanges(N))
+    {
+      if (R.Size)
+        std::memcpy(Out + Count, R.Begin, R.Size);
+      Count += R.Size;
+    }
+    return Count;
+  }
+
+  /// (Consumer.) Consumes at most \p N bytes from the beginning of the buffer,
+  /// copying them to \p Out.
+  ///
+  /// \returns the number of bytes written to \p Out.
+  std::size_t takeFront(char* Out, std::size_t N) noexcept
+  {
+    N = peekFront(Out, N);
+    dropFront(N);
+    return N;
+  }
+
+private:
+  const std::size_t Capacity;
+  const StorageType Data;
+
+  /// The state written by the producer.
+  struct alignas(CacheLineSize) ProducerState
+  {
+    /// The published end of the data, read by the consumer.
+    std::atomic<std::size_t> Tail{0};
+    /// The end of the committed, but potentially unpublished, data.
+    std::size_t Pending = 0;
+    /// The last seen value of the consumer's \p Head.
+    std::size_t CachedHead = 0;
+  } Producer;
+
+  /// The state written by the consumer.
+  struct alignas(CacheLineSize) ConsumerState
+  {
+    /// The beginning of the unconsumed data, read by the producer.
+    std::atomic<std::size_t> Head{0};
+    /// The last seen value of the producer's \p Tail.
+    std::size_t CachedTail = 0;
+  } Consumer;
+
+  static std::size_t roundCapacity(std::size_t N) noexcept
+  {
+    if constexpr (Mirrored)
+      return Storage::roundCapacity(N);
+    else
+      return detail::roundUpToPowerOfTwo(N);
+  }
+
+  std::array<Range, 2> ranges(std::size_t Counter, std::size_t N) const noexcept
+  {
+    const std::size_t Offset = Counter & (Capacity - 1);
+    std::array<Range, 2> R{Range{Data.get() + Offset, N}, Range{Data.get(), 0}};
+    if constexpr (!Mirrored)
+    {
+      R[0].Size = std::min(N, Capacity - Offset);
+      R[1].Size = N - R[0].Size;
+    }
+    return R;
+  }
+};
+
+} // namespace monomux
@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace monomux
+{
+
+/// An immutable, contiguous chunk of bytes which ownership is shared by
+/// reference counting. Copying a \p SharedChunk does not copy the underlying
+/// data, which allows the same buffer to be handed to multiple consumers, e.g.
+/// the output of a session to be fanned out to every attached client.
+class SharedChunk
+{
+  std::shared_ptr<const std::string> Data;
+
+public:
+  SharedChunk() noexcept = default;
+  /// Takes ownership of \p Str without copying its contents.
+  explicit SharedChunk(std::string&& Str)
+    : Data(std::make_shared<const std::string>(std::move(Str)))
+  {}
+
+  /// \returns a view of the entire chunk.
+  std::string_view view() const noexcept
+  {
+    return Data ? std::string_view{*Data} : std::string_view{};
+  }
+  /// \returns a view of the chunk starting from the \p Offset -th byte.
+  std::string_view view(std::size_t Offset) const noexcept
+  {
+    std::string_view V = view();
+    V.remove_prefix(std::min(Offset, V.size()));
+    return V;
+  }
+
+  std::size_t size() const noexcept { return Data ? Data->size() : 0; }
+  bool empty() const noexcept { return size() == 0; }
+  /// \returns the number of \p SharedChunk instances referencing the same data.
+  long useCount() const noexcept { return Data.use_count(); }
+};
+
+} // namespace monomux
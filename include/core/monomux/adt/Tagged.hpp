@@ -34,6 +34,8 @@ template <std::size_t N, typename T> class Tagged
   T* Ptr;
 
 public:
+  using element_type = T;
+
   Tagged(T* P) noexcept : Ptr(P) {}
 
   /// Retrieve the raw tag value.
@@ -63,4 +65,97 @@ public:
   const T* get() const noexcept { return Ptr; }
 };
 
+/// Stores one of the \p Tagged pointer types \p Ts, or nothing, in the space
+/// of a single pointer. The index of the alternative is stored in the low
+/// bits of the pointer that are always zero due to alignment.
+///
+/// Unlike a \p std::variant of the \p Tagged types, the object is trivially
+/// copyable, and default construction (the "empty" state) is all zero bits.
+/// Storing a \p nullptr of any alternative leaves the object empty.
+template <typename... Ts> class TaggedUnion
+{
+  static_assert(sizeof...(Ts) > 0, "At least one alternative is needed!");
+
+  static constexpr std::size_t bitsFor(std::size_t N) noexcept
+  {
+    std::size_t Bits = 0;
+    while ((std::size_t{1} << Bits) < N)
+      ++Bits;
+    return Bits;
+  }
+  static constexpr std::uintptr_t TagMask =
+    (std::uintptr_t{1} << bitsFor(sizeof...(Ts))) - 1;
+
+  static_assert(((alignof(typename Ts::element_type) > TagMask) && ...),
+                "Pointers of the alternatives must have enough spare bits!");
+
+  /// \returns the index of \p A in \p Ts.
+  template <typename A> static constexpr std::uintptr_t indexOf() noexcept
+  {
+    constexpr bool Matches[] = {std::is_same_v<A, Ts>...};
+    for (std::uintptr_t I = 0; I < sizeof...(Ts); ++I)
+      if (Matches[I])
+        return I;
+    return sizeof...(Ts);
+  }
+  template <typename A>
+  static constexpr bool IsAlternative = indexOf<A>() < sizeof...(Ts);
+
+  std::uintptr_t Value = 0;
+
+public:
+  TaggedUnion() noexcept = default;
+  template <typename A, typename = std::enable_if_t<IsAlternative<A>>>
+  TaggedUnion(A Alternative) noexcept
+  {
+    auto Address = reinterpret_cast<std::uintptr_t>(Alternative.get());
+    assert(!(Address & TagMask) && "Pointer not aligned!");
+    if (Address)
+      Value = Address | indexOf<A>();
+  }
+
+  /// \returns whether the object stores \p nullptr.
+  bool empty() const noexcept { return !(Value & ~TagMask); }
+
+  /// \returns whether the object stores a non-null pointer of alternative
+  /// \p A.
+  template <typename A> bool is() const noexcept
+  {
+    static_assert(IsAlternative<A>, "Not an alternative of the union!");
+    return !empty() && (Value & TagMask) == indexOf<A>();
+  }
+
+  /// \returns the pointer stored in the object if it is of alternative
+  /// \p A, or \p nullptr.
+  template <typename A> typename A::element_type* getIf() const noexcept
+  {
+    if (!is<A>())
+      return nullptr;
+    return reinterpret_cast<typename A::element_type*>(Value & ~TagMask);
+  }
+
+  /// \returns the representation of the object as an opaque pointer, which
+  /// can be passed through interfaces that store user data as \p void*.
+  void* getOpaqueValue() const noexcept
+  {
+    return reinterpret_cast<void*>(Value);
+  }
+  /// Recreates the object from the result of \p getOpaqueValue().
+  static TaggedUnion getFromOpaqueValue(void* Opaque) noexcept
+  {
+    TaggedUnion U;
+    U.Value = reinterpret_cast<std::uintptr_t>(Opaque);
+    return U;
+  }
+
+  bool operator==(TaggedUnion RHS) const noexcept
+  {
+    return Value == RHS.Value;
+  }
+  bool operator!=(TaggedUnion RHS) const noexcept
+  {
+    return Value != RHS.Value;
+  }
+};
+
 } // namespace monomux
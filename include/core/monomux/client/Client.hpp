@@ -17,20 +17,29 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "monomux/adt/Atomic.hpp"
 #include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/control/Message.hpp"
+#include "monomux/control/PascalString.hpp"
+#include "monomux/system/Compression.hpp"
 #include "monomux/system/Event.hpp"
+#include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
+#include "monomux/system/SharedRing.hpp"
 #include "monomux/system/Socket.hpp"
+#include "monomux/system/TimerWheel.hpp"
 
 #include "SessionData.hpp"
 
@@ -92,8 +101,12 @@ public:
   void registerMessageHandler(std::uint16_t Kind,
                               std::function<HandlerFunction> Handler);
 
-  Socket& getControlSocket() noexcept { return ControlSocket; }
-  const Socket& getControlSocket() const noexcept { return ControlSocket; }
+  Socket& getControlSocket() noexcept { return *ControlSocket; }
+  const Socket& getControlSocket() const noexcept { return *ControlSocket; }
+
+  /// Returns the encoding negotiated with the server for the messages sent by
+  /// the client.
+  message::WireFormat wireFormat() const noexcept { return Wire; }
 
   Socket* getDataSocket() noexcept
   {
@@ -111,6 +124,46 @@ public:
   /// client.
   void setDataSocket(Socket&& DataSocket);
 
+  /// Sets whether the \p handshake() should ask the server to carry the data
+  /// over the control connection, instead of a separate data connection.
+  void setMultiplexing(bool Enabled) noexcept { MultiplexRequested = Enabled; }
+  /// \returns whether the control messages and the data are carried over the
+  /// same connection, framed by \p MuxedSocket.
+  bool multiplexed() const noexcept { return Multiplexed; }
+
+  /// Sets whether the \p handshake() should ask the server to send the data
+  /// compressed. Ignored if the build does not support compression.
+  void setCompression(bool Enabled) noexcept
+  {
+    CompressionRequested = Enabled && Deflater::available();
+  }
+  /// \returns whether the data received from the server is compressed, and
+  /// should be decompressed with an \p Inflater.
+  bool compressed() const noexcept { return Compressed; }
+
+  /// Sets whether the \p handshake() should ask the server to publish the
+  /// output of the attached session in a \p SharedRing, if the client is on
+  /// the same machine as the server.
+  void setSharedRing(bool Enabled) noexcept { SharedRingRequested = Enabled; }
+  /// \returns whether the output of the attached session is read from a
+  /// \p SharedRing, after what arrives on the data connection.
+  bool sharedRing() const noexcept { return Ring.has_value(); }
+  /// Reads at most \p Bytes of the output of the attached session published
+  /// in the \p SharedRing into \p Out. If the client fell behind and missed
+  /// some of the output, the session is asked to redraw.
+  ///
+  /// \returns the number of bytes read.
+  std::size_t readSharedRing(std::string& Out, std::size_t Bytes);
+
+  /// Sets whether \p requestAttach() attaches the client as a viewer only. The
+  /// input of such a client is not sent to the server.
+  void setReadOnly(bool Enabled) noexcept { ReadOnly = Enabled; }
+  bool readOnly() const noexcept { return ReadOnly; }
+
+  /// Sets whether \p loop() waits for events with an \p IOUring, if the build
+  /// and the system support it, instead of an \p EPoll.
+  void setIOUring(bool Enabled) noexcept { IOUringRequested = Enabled; }
+
   raw_fd getInputFile() const noexcept { return InputFile; }
 
   /// Sets the file descriptor which the client will consider its "input
@@ -120,6 +173,17 @@ public:
   /// disassociate.
   void setInputFile(raw_fd FD);
 
+  raw_fd getOutputFile() const noexcept { return OutputFile; }
+
+  /// Sets the file descriptor which the client will consider its "output
+  /// stream" and fires the \p OutputCallback for when it becomes writable.
+  /// Unlike the input, the output is only listened for while it is enabled
+  /// by \p enableOutputFile().
+  ///
+  /// \param FD A file descriptor to watch for, or \p fd::Invalid to
+  /// disassociate.
+  void setOutputFile(raw_fd FD);
+
   /// Perform a handshake mechanism over the control socket.
   ///
   /// A successful handshake initialises the client to be fully \e capable of
@@ -169,12 +233,103 @@ public:
   /// \return whether the attachment succeeded.
   bool requestAttach(std::string SessionName);
 
+  /// Sends a request to the server to send the output of the session
+  /// identified by \p SessionName over the data connection, together with the
+  /// output of the other sessions watched. The output arrives in frames, which
+  /// can be split with a \p message::SessionFrameReader. A client watching
+  /// sessions is a viewer only, and can not attach until it stops watching.
+  ///
+  /// \returns the tag of the frames of the session, if the server started
+  /// sending its output.
+  std::optional<std::uint32_t> requestWatch(std::string SessionName);
+
+  /// Sends a request to the server to stop sending the output of the session
+  /// identified by \p SessionName. An empty frame is sent after the last
+  /// output of the session.
+  ///
+  /// \return whether the client was watching the session.
+  bool requestUnwatch(std::string SessionName);
+
+  /// The type of the callbacks that receive the response to a request queued
+  /// by \p queueRequest(), or \p nullopt if no valid response was received.
+  template <typename Response>
+  using ResponseCallback = std::function<void(std::optional<Response>)>;
+
+  /// Queues \p Msg to be sent to the server by the next
+  /// \p sendQueuedRequests() call, together with every other queued request.
+  /// When the response to the request arrives, \p Callback is fired with it.
+  ///
+  /// \returns the identifier of the request, which is increasing in the order
+  /// the requests are queued in.
+  template <typename Request>
+  std::size_t queueRequest(
+    const Request& Msg,
+    ResponseCallback<typename message::ResponseOf<Request>::Type> Callback)
+  {
+    using Response = typename message::ResponseOf<Request>::Type;
+
+    message::frameInto(QueuedFrames, Msg, Wire, /* WithSize =*/true);
+
+    const std::size_t ID = ++LastRequestID;
+    QueuedRequest Q;
+    Q.ID = ID;
+    Q.Kind = Response::Kind;
+    Q.Handler = [Callback = std::move(Callback)](
+                  std::optional<std::string_view> RawData) -> bool {
+      std::optional<Response> Resp;
+      if (RawData)
+        Resp = Response::decode(*RawData);
+      const bool Valid = Resp.has_value();
+      if (Callback)
+        Callback(std::move(Resp));
+      return Valid;
+    };
+    AwaitingResponse.emplace_back(std::move(Q));
+    return ID;
+  }
+
+  /// Sends every request queued by \p queueRequest() to the server in one
+  /// write, and waits for all of the responses, firing the callbacks of the
+  /// requests in order. Unrelated messages that are received in the meantime
+  /// are handled by the usual message handlers.
+  ///
+  /// \note This operation \b MAY block.
+  ///
+  /// \returns whether a valid response was received for every request. The
+  /// callbacks of the requests that did not receive one are fired with
+  /// \p nullopt.
+  bool sendQueuedRequests();
+
+  /// Handles the control messages that already arrived from the server,
+  /// without waiting for more.
+  ///
+  /// \returns whether the control connection is still usable.
+  bool receiveControlMessages();
+
+  /// \returns the changes of the sessions the server notified the client
+  /// about since the last call, in the order they were received.
+  ///
+  /// \see ControlClient::subscribeSessions()
+  std::deque<message::notification::SessionChange> takeSessionChanges()
+  {
+    return std::move(SessionChanges);
+  }
+
   /// \returns whether the client successfully attached to a session on the
   /// server.
   ///
   /// \see requestAttach()
   bool attached() const noexcept { return Attached; }
 
+  /// \returns whether the server sent the recent output of the session when
+  /// the client attached, restoring the display without a redraw.
+  bool replayedOnAttach() const noexcept { return ReplayedOnAttach; }
+
+  /// \returns whether the terminal of the attached session was reported to
+  /// echo the input and edit it line by line, i.e., the program in the
+  /// session does not handle the keystrokes itself.
+  bool sessionEchoesInput() const noexcept { return SessionEchoesInput; }
+
   /// \returns information about the session the client is (if \p attached() is
   /// \p true) or last was (if \p attached() is \p false) attached to. If the
   /// client never attached to any session, returns \p nullptr.
@@ -186,6 +341,14 @@ public:
   /// Sends \p Data to the server over the \e data connection.
   void sendData(std::string_view Data);
 
+  /// Moves the data readable from \p Input to the server over the \e data
+  /// connection with \p splice(), without copying it through the client.
+  ///
+  /// \returns the number of bytes sent, which is \p 0 if the data must be
+  /// read from \p Input and passed to \p sendData() instead, e.g. because the
+  /// connection is multiplexed, or has buffered data that must be sent first.
+  std::size_t spliceData(Pipe& Input);
+
   /// Sends a request to the server to deliver \p Signal to the remote session's
   /// process.
   void sendSignal(int Signal);
@@ -212,25 +375,85 @@ public:
   /// The input is \b NOT read before the callback fires.
   void setInputCallback(std::function<RawCallbackFn> Callback);
 
+  /// Sets the handler that is fired when the output of the client becomes
+  /// writable, while \p enableOutputFile() is in effect.
+  void setOutputCallback(std::function<RawCallbackFn> Callback);
+
   /// Sets the callback object for handling external events when the client's
   /// internal event handling \p loop() is ready for such.
   void setExternalEventProcessor(std::function<RawCallbackFn> Callback);
 
+  /// Makes the client's \p loop() listen for \p FD becoming readable, and
+  /// fire \p Callback when it is. The file is \b NOT read before the callback
+  /// fires.
+  void watchFile(raw_fd FD, std::function<RawCallbackFn> Callback);
+  /// Stops listening for \p FD set up by \p watchFile().
+  void unwatchFile(raw_fd FD);
+
+  /// \returns the timers that are run by the client's \p loop() between the
+  /// batches of events.
+  TimerWheel& getTimers() noexcept { return Timers; }
+
 private:
   /// The control socket is used to communicate control commands with the
   /// server.
-  Socket ControlSocket;
+  std::unique_ptr<Socket> ControlSocket;
+
+  /// The encoding of the messages sent to the server, as advertised by the
+  /// server when the connection was established.
+  message::WireFormat Wire = message::WireFormat::Text;
 
   /// The data connection is used to transmit the process data to the client.
   /// (This is initialised in a lazy fashion during operation.)
   std::unique_ptr<Socket> DataSocket;
 
+  /// The kernel-side buffer used by \p spliceData().
+  std::optional<Pipe::AnonymousPipe> InputRelay;
+  /// Whether \p spliceData() is attempted. Cleared if the input does not
+  /// support \p splice().
+  UniqueScalar<bool, true> SpliceInput;
+
   /// Whether continuous \e handling of data on the \p DataSocket (if connected)
   /// via \p Poll is enabled.
   UniqueScalar<bool, false> DataSocketEnabled;
+  /// Whether the handling of messages on the \p ControlSocket via \p Poll is
+  /// enabled.
+  UniqueScalar<bool, false> ControlResponseEnabled;
+
+  /// Whether the \p handshake() should ask for a multiplexed connection.
+  UniqueScalar<bool, false> MultiplexRequested;
+  /// Whether \p ControlSocket and \p DataSocket are the streams of the same
+  /// \p MuxedSocket.
+  UniqueScalar<bool, false> Multiplexed;
+
+  /// Whether the client should ask the server to compress the data.
+  UniqueScalar<bool, false> CompressionRequested;
+  /// Whether the data received from the server is compressed.
+  UniqueScalar<bool, false> Compressed;
+
+  /// Whether the client should ask the server for a \p SharedRing.
+  UniqueScalar<bool, false> SharedRingRequested;
+  /// Whether \p loop() should use an \p IOUring.
+  UniqueScalar<bool, false> IOUringRequested;
+  /// Whether the server agreed to publish the output in a \p SharedRing.
+  UniqueScalar<bool, false> SharedRingAccepted;
+  /// The output of the attached session, published by the server, if the
+  /// client reads it from there.
+  std::optional<SharedRing> Ring;
+  std::size_t RingSlot = 0;
+  /// The file by which the server wakes the client up when the \p Ring has
+  /// new data.
+  fd RingWakeup;
+
+  /// Whether the client only watches the session it attaches to.
+  UniqueScalar<bool, false> ReadOnly;
 
   /// Whether the client successfully attached to a session on the server.
   UniqueScalar<bool, false> Attached;
+  UniqueScalar<bool, false> ReplayedOnAttach;
+  UniqueScalar<bool, false> SessionEchoesInput;
+  /// The notifications about the changes of the sessions, not yet taken.
+  std::deque<message::notification::SessionChange> SessionChanges;
 
   /// Information about the session the client attached to.
   std::optional<SessionData> AttachedSession;
@@ -243,6 +466,12 @@ private:
   std::function<RawCallbackFn> DataHandler;
   /// The callback object fired when data becomes available on \p InputFile.
   std::function<RawCallbackFn> InputHandler;
+  /// The callback object fired when \p OutputFile becomes writable.
+  std::function<RawCallbackFn> OutputHandler;
+
+  /// The callback objects fired when data becomes available on the additional
+  /// files the client is listening for.
+  std::map<raw_fd, std::function<RawCallbackFn>> WatchedFiles;
 
   /// Weak file handle for the stream that is considered the user-facing input
   /// of the client.
@@ -252,6 +481,14 @@ private:
   /// \p Poll is enabled.
   UniqueScalar<bool, false> InputFileEnabled;
 
+  /// Weak file handle for the stream that is considered the user-facing output
+  /// of the client.
+  UniqueScalar<raw_fd, fd::Invalid> OutputFile;
+
+  /// Whether the \p OutputFile (if set) is listened for becoming writable via
+  /// \p Poll.
+  UniqueScalar<bool, false> OutputFileEnabled;
+
   ExitReason Exit = None;
   int ExitCode = 0;
   std::string ExitMessage;
@@ -261,6 +498,7 @@ private:
 
   mutable Atomic<bool> TerminateLoop = false;
   std::unique_ptr<EPoll> Poll;
+  TimerWheel Timers;
 
   /// A unique identifier of the current \p Client, as returned by the server.
   std::size_t ClientID = -1;
@@ -272,10 +510,58 @@ private:
   /// Return the stored \p Nonce of the current instance, resetting it.
   std::size_t consumeNonce() noexcept;
 
-  /// Maps \p MessageKind to handler functions.
-  std::map<std::uint16_t, std::function<HandlerFunction>> Dispatch;
+  /// A table mapping \p MessageKind to handler functions.
+  using DispatchTable =
+    std::array<HandlerFunction*, message::MessageKindCount>;
+  /// Maps \p MessageKind to the built-in handler functions. This table is
+  /// built at compile time from \p Dispatch.ipp.
+  static const DispatchTable Dispatch;
+  /// The handlers set by \p registerMessageHandler(), indexed by the message
+  /// kind, which take precedence over \p Dispatch. Empty unless a handler was
+  /// overridden.
+  std::vector<std::function<HandlerFunction>> DispatchOverrides;
+
+  static constexpr DispatchTable makeDispatch() noexcept;
+
+  /// Fires the handler registered in \p Dispatch for the received \p Data.
+  void handleControlMessage(std::string_view Data);
+
+  /// Replaces the \p ControlSocket and the \p DataSocket with the streams of
+  /// a \p MuxedSocket over the control connection.
+  void multiplex();
+  /// Schedules the handling of the data buffered in either of the streams of
+  /// the multiplexed connection, which no event of the system would signal.
+  void scheduleMultiplexed();
+
+  /// Takes the \p SharedRing of the attached session, passed over the
+  /// \p ControlSocket with the response to the attachment.
+  bool openSharedRing(std::size_t Slot);
+  void closeSharedRing();
+  /// Schedules the handling of the data already published in the \p Ring,
+  /// or marks the client as waiting for a wake-up if there is none.
+  void scheduleSharedRing();
+
+  /// A request sent (or about to be sent) to the server that waits for its
+  /// response.
+  struct QueuedRequest
+  {
+    std::size_t ID;
+    message::MessageKind Kind;
+    /// Decodes the raw data of the response, if any, and fires the callback
+    /// of the request. \returns whether the response was valid.
+    std::function<bool(std::optional<std::string_view>)> Handler;
+  };
 
-  void setUpDispatch();
+  /// The identifier of the last request queued by \p queueRequest().
+  std::size_t LastRequestID = 0;
+  /// The encoded form of the requests which were queued but not yet sent.
+  std::string QueuedFrames;
+  /// The requests that are waiting for their response from the server. As the
+  /// server answers the requests of a client in order, responses are matched
+  /// to the front of this queue.
+  std::deque<QueuedRequest> AwaitingResponse;
+  /// Reassembles the messages received while waiting for responses.
+  message::PascalStringReader ResponseReader;
 
 #define DISPATCH(KIND, FUNCTION_NAME)                                          \
   static void FUNCTION_NAME(Client& Client, std::string_view Message);
@@ -301,7 +587,8 @@ public:
   Inhibitor inhibitControlResponse();
 
   /// If channel polling is initialised, adds \p DataSocket to the list of
-  /// channels to poll and handle incoming data.
+  /// channels to poll and handle incoming data. Data that was already read
+  /// into the buffer of the connection is handled in the next iteration.
   void enableDataSocket();
   /// If channel polling is initialised, removes \p DataSocket from the list of
   /// channels to poll. When disabled, data sent by the server is left
@@ -321,6 +608,13 @@ public:
   /// A scope-guard version that calls \p disableInputFile() and
   /// \p enableInputFile() when entering and leaving scope.
   Inhibitor inhibitInputFile();
+
+  /// If channel polling is initialised, adds the output device to the list of
+  /// channels to poll for becoming writable, firing the \p OutputCallback.
+  void enableOutputFile();
+  /// If channel polling is initialised, removes the output device from the
+  /// list of channels to poll.
+  void disableOutputFile();
 };
 
 } // namespace monomux::client
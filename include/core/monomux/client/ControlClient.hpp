@@ -17,6 +17,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <cstdint>
+#include <vector>
+
 #include "Client.hpp"
 
 namespace monomux::client
@@ -57,9 +60,56 @@ public:
   /// and it did not produce a response that the client could understand.
   std::string requestStatistics();
 
+  /// Sends a request to the server to collect the current values of its
+  /// counters, and reply them back to this \p Client.
+  ///
+  /// \throws std::runtime_error Thrown if communication with the server failed
+  /// and it did not produce a response that the client could understand.
+  message::response::Metrics requestMetrics();
+
+  /// Sends a request to the server to reply the resources used by each of its
+  /// sessions back to this \p Client.
+  ///
+  /// \throws std::runtime_error Thrown if communication with the server failed
+  /// and it did not produce a response that the client could understand.
+  message::response::Usage requestUsage();
+
+  /// Subscribes to the changes of the sessions on the server, instead of
+  /// polling the list of sessions. If the subscription is renewed, the list is
+  /// only sent again by the server if it changed in the meantime.
+  ///
+  /// \note This operation \b MAY block.
+  ///
+  /// \returns the current list of sessions, or \p nullopt if communication
+  /// with the server failed.
+  std::optional<std::vector<message::SessionStatus>> subscribeSessions();
+
+  /// Stops the notifications about the changes of the sessions.
+  void unsubscribeSessions();
+
+  /// Handles the notifications received since the last call, without waiting
+  /// for more, and applies them to \p sessions(). If a notification was
+  /// missed, the subscription is renewed and \p sessions() is replaced.
+  ///
+  /// \returns the changes applied, in order.
+  std::vector<message::notification::SessionChange> pollSessionChanges();
+
+  /// \returns the list of sessions as known from the subscription.
+  const std::vector<message::SessionStatus>& sessions() const noexcept
+  {
+    return KnownSessions;
+  }
+
 private:
   Client& BackingClient;
 
+  /// The generation of the list of sessions last seen from the server, or
+  /// \p 0 if never subscribed.
+  std::uint64_t KnownGeneration = 0;
+  std::vector<message::SessionStatus> KnownSessions;
+
+  void applySessionChange(const message::notification::SessionChange& Change);
+
   /// The name of the session the controlling client will send requests to.
   std::string SessionName;
 };
@@ -5,5 +5,7 @@
 
 DISPATCH(ClientIDResponse, responseClientID)
 DISPATCH(DetachedNotification, receivedDetachNotification)
+DISPATCH(TerminalModeNotification, receivedTerminalModeNotification)
+DISPATCH(SessionChangeNotification, receivedSessionChangeNotification)
 
 #undef DISPATCH
@@ -24,16 +24,26 @@
 #include <vector>
 
 #include "MessageBase.hpp"
+#include "MessageCodec.hpp"
 
 #define MONOMUX_MESSAGE(KIND, NAME)                                            \
   static constexpr MessageKind Kind = MessageKind::KIND;                       \
   static std::optional<NAME> decode(std::string_view Buffer);                  \
-  static std::string encode(const NAME& Object);
+  static std::optional<NAME> decodeText(std::string_view Buffer);              \
+  static void encode(std::string& Buffer, const NAME& Object);                 \
+  static std::optional<NAME> decodeBinary(std::string_view Buffer)             \
+  {                                                                            \
+    return binary::decode<NAME>(Buffer);                                       \
+  }                                                                            \
+  static std::string encodeBinary(const NAME& Object)                          \
+  {                                                                            \
+    return binary::encode(Object);                                             \
+  }
 
 #define MONOMUX_MESSAGE_BASE(NAME)                                             \
   static constexpr MessageKind Kind = MessageKind::Base;                       \
   static std::optional<NAME> decode(std::string_view& Buffer);                 \
-  static std::string encode(const NAME& Object);
+  static void encode(std::string& Buffer, const NAME& Object);
 
 namespace monomux::message
 {
@@ -48,6 +58,8 @@ struct ClientID
   /// A single-use number the client can use in other unassociated requests
   /// to prove its identity.
   std::size_t Nonce{};
+
+  MONOMUX_MESSAGE_FIELDS(&ClientID::ID, &ClientID::Nonce);
 };
 
 /// A view of the \p Process::SpawnOptions data structure that is sufficient for
@@ -73,6 +85,11 @@ struct ProcessSpawnOptions
   ///
   /// \see Process::SpawnOptions::Environment
   std::vector<std::string> UnsetEnvironment;
+
+  MONOMUX_MESSAGE_FIELDS(&ProcessSpawnOptions::Program,
+                         &ProcessSpawnOptions::Arguments,
+                         &ProcessSpawnOptions::SetEnvironment,
+                         &ProcessSpawnOptions::UnsetEnvironment);
 };
 
 /// A view of the \p Server::SessionData data structure that is sufficient for
@@ -86,6 +103,63 @@ struct SessionData
 
   /// \see server::SessionData::Created.
   std::time_t Created{};
+
+  MONOMUX_MESSAGE_FIELDS(&SessionData::Name, &SessionData::Created);
+};
+
+/// The state of a session that is tracked by the clients subscribed to the
+/// changes of the sessions.
+struct SessionStatus
+{
+  MONOMUX_MESSAGE_BASE(SessionStatus);
+
+  SessionData Session;
+  /// The number of clients attached to the session.
+  std::size_t AttachedClients{};
+
+  MONOMUX_MESSAGE_FIELDS(&SessionStatus::Session,
+                         &SessionStatus::AttachedClients);
+};
+
+/// The resources used by a session, as last sampled by the server.
+struct SessionUsage
+{
+  MONOMUX_MESSAGE_BASE(SessionUsage);
+
+  /// \see server::SessionData::Name.
+  std::string Name;
+  /// The PID of the process running in the session, or \p -1 if there is
+  /// none.
+  std::int32_t PID{-1};
+  /// The number of bytes read from the session, to be relayed to the clients.
+  std::uint64_t OutputBytes{};
+  /// The number of bytes of input written to the session.
+  std::uint64_t InputBytes{};
+  /// The output of the session, in bytes per second, over the last sampling
+  /// interval.
+  std::uint64_t OutputRate{};
+  /// The most bytes ever held in the buffer of the output of the session.
+  std::uint64_t OutputBufferPeak{};
+  /// The CPU time used by the process over the last sampling interval, in
+  /// thousandths of one CPU.
+  std::uint64_t CPUPermille{};
+  /// The resident memory of the process, in bytes.
+  std::uint64_t RSSBytes{};
+  /// The IDs of the clients attached to the session.
+  std::vector<std::uint64_t> Clients;
+  /// The number of bytes buffered for each of \p Clients, not yet sent.
+  std::vector<std::uint64_t> ClientBufferedBytes;
+
+  MONOMUX_MESSAGE_FIELDS(&SessionUsage::Name,
+                         &SessionUsage::PID,
+                         &SessionUsage::OutputBytes,
+                         &SessionUsage::InputBytes,
+                         &SessionUsage::OutputRate,
+                         &SessionUsage::OutputBufferPeak,
+                         &SessionUsage::CPUPermille,
+                         &SessionUsage::RSSBytes,
+                         &SessionUsage::Clients,
+                         &SessionUsage::ClientBufferedBytes);
 };
 
 /// A base class for responding boolean values consistently.
@@ -101,6 +175,46 @@ struct Boolean
   }
 
   bool Value{};
+
+  MONOMUX_MESSAGE_FIELDS(&Boolean::Value);
+};
+
+/// The values of the same set of metrics for a number of subjects (e.g. the
+/// clients of the server), as a table.
+struct MetricTable
+{
+  MONOMUX_MESSAGE_BASE(MetricTable);
+
+  enum MetricKind
+  {
+    /// A monotonically increasing count of events.
+    Counter,
+    /// A value which might go up and down, e.g. the size of a buffer.
+    Gauge,
+    /// The buckets, the sum, and the count of the values of a histogram.
+    Histogram
+  };
+
+  /// The names of the metrics, i.e. the columns of the table.
+  std::vector<std::string> Names;
+  /// The kind of each metric in \p Names.
+  std::vector<MetricKind> Kinds;
+  /// The identifiers of the subjects, i.e. the rows of the table.
+  std::vector<std::string> Subjects;
+  /// The values of the table in row-major order, i.e. the value of the metric
+  /// \p Names[N] of \p Subjects[S] is at \p Values[S * Names.size() + N].
+  std::vector<std::uint64_t> Values;
+
+  /// \returns the value of the metric \p N of the subject \p S.
+  std::uint64_t at(std::size_t S, std::size_t N) const
+  {
+    return Values.at(S * Names.size() + N);
+  }
+
+  MONOMUX_MESSAGE_FIELDS(&MetricTable::Names,
+                         &MetricTable::Kinds,
+                         &MetricTable::Subjects,
+                         &MetricTable::Values);
 };
 
 namespace request
@@ -114,6 +228,7 @@ namespace request
 struct ClientID
 {
   MONOMUX_MESSAGE(ClientIDRequest, ClientID);
+  MONOMUX_MESSAGE_FIELDS();
 };
 
 /// A request from the client to the server sent over the data connection to
@@ -126,6 +241,39 @@ struct DataSocket
 {
   MONOMUX_MESSAGE(DataSocketRequest, DataSocket);
   monomux::message::ClientID Client;
+
+  MONOMUX_MESSAGE_FIELDS(&DataSocket::Client);
+};
+
+/// A request from the client to the server to deliver the identity information
+/// to the client, and register the connection passed along with the message
+/// as the client's data connection.
+///
+/// This message is sent as the initial handshake after a connection is
+/// established, instead of \p ClientID and \p DataSocket. The data
+/// connection is one end of a \p Socket::pair(), attached to the request
+/// with \p Socket::writeWithFile().
+///
+/// If \p Multiplexed is set, the client asks for the control messages and the
+/// data to be carried together over the control connection, framed by
+/// \p MuxedSocket, and the data connection is only a fallback.
+///
+/// If \p Compressed is set, the client asks for the output of the sessions to
+/// be sent compressed by a \p Deflater.
+///
+/// If \p SharedRing is set, the client, running on the same host as the
+/// server, asks for the output of the sessions to be read from a
+/// \p SharedRing, instead of being sent over the data connection.
+struct Handshake
+{
+  MONOMUX_MESSAGE(HandshakeRequest, Handshake);
+  monomux::message::Boolean Multiplexed;
+  monomux::message::Boolean Compressed;
+  monomux::message::Boolean SharedRing;
+
+  MONOMUX_MESSAGE_FIELDS(&Handshake::Multiplexed,
+                         &Handshake::Compressed,
+                         &Handshake::SharedRing);
 };
 
 /// A request from the client to the server to advise the client about the
@@ -133,6 +281,7 @@ struct DataSocket
 struct SessionList
 {
   MONOMUX_MESSAGE(SessionListRequest, SessionList);
+  MONOMUX_MESSAGE_FIELDS();
 };
 
 /// A request from the client to the server to initialise a new session with
@@ -147,6 +296,8 @@ struct MakeSession
 
   /// The options for the program to create in the session.
   ProcessSpawnOptions SpawnOpts;
+
+  MONOMUX_MESSAGE_FIELDS(&MakeSession::Name, &MakeSession::SpawnOpts);
 };
 
 /// A request from the client to the server to attach the client to the
@@ -156,6 +307,11 @@ struct Attach
   MONOMUX_MESSAGE(AttachRequest, Attach);
   /// The name of the session to attach to.
   std::string Name;
+  /// Whether the client only watches the session. The input of such viewers is
+  /// not passed to the session, and they do not affect its size.
+  monomux::message::Boolean ReadOnly;
+
+  MONOMUX_MESSAGE_FIELDS(&Attach::Name, &Attach::ReadOnly);
 };
 
 /// A request from a client to the server to detach some clients from an ongoing
@@ -171,6 +327,8 @@ struct Detach
     All
   };
   DetachMode Mode = Latest;
+
+  MONOMUX_MESSAGE_FIELDS(&Detach::Mode);
 };
 
 /// A request from the client to the server to deliver a process signal to the
@@ -180,6 +338,8 @@ struct Signal
   MONOMUX_MESSAGE(SignalRequest, Signal);
   /// \see signal(7)
   int SigNum{};
+
+  MONOMUX_MESSAGE_FIELDS(&Signal::SigNum);
 };
 
 /// A request from a client to the server to respond with statistical
@@ -187,6 +347,56 @@ struct Signal
 struct Statistics
 {
   MONOMUX_MESSAGE(StatisticsRequest, Statistics);
+  MONOMUX_MESSAGE_FIELDS();
+};
+
+/// A request from a client to the server to respond with the values of its
+/// metrics.
+struct Metrics
+{
+  MONOMUX_MESSAGE(MetricsRequest, Metrics);
+  MONOMUX_MESSAGE_FIELDS();
+};
+
+/// A request from a client to the server to push a
+/// \p notification::SessionChange to the client whenever the sessions change,
+/// instead of the client polling with \p SessionList requests.
+struct SessionSubscribe
+{
+  MONOMUX_MESSAGE(SessionSubscribeRequest, SessionSubscribe);
+  /// Whether to subscribe. If \p false, the client is unsubscribed.
+  monomux::message::Boolean Subscribe;
+  /// The generation of the sessions, as last seen in a response or a
+  /// notification, that the client already knows. If it is still current,
+  /// the response does not repeat the state of the sessions.
+  std::uint64_t KnownGeneration{};
+
+  MONOMUX_MESSAGE_FIELDS(&SessionSubscribe::Subscribe,
+                         &SessionSubscribe::KnownGeneration);
+};
+
+/// A request from a client to the server to respond with the resources used
+/// by each session.
+struct Usage
+{
+  MONOMUX_MESSAGE(UsageRequest, Usage);
+  MONOMUX_MESSAGE_FIELDS();
+};
+
+/// A request from the client to the server to start (or stop) watching the
+/// specified session. The output of every session a client watches is sent
+/// over its single data connection, in \p SessionFrame chunks, and the input
+/// of the client is not passed to any of them. A client either watches
+/// sessions, or is attached to one.
+struct Watch
+{
+  MONOMUX_MESSAGE(WatchRequest, Watch);
+  /// The name of the session to watch.
+  std::string Name;
+  /// Whether to stop watching the session, instead of starting it.
+  monomux::message::Boolean Stop;
+
+  MONOMUX_MESSAGE_FIELDS(&Watch::Name, &Watch::Stop);
 };
 
 } // namespace request
@@ -199,6 +409,8 @@ struct ClientID
 {
   MONOMUX_MESSAGE(ClientIDResponse, ClientID);
   monomux::message::ClientID Client;
+
+  MONOMUX_MESSAGE_FIELDS(&ClientID::Client);
 };
 
 /// The response to the \p request::DataSocket, sent by the server.
@@ -210,6 +422,40 @@ struct DataSocket
 {
   MONOMUX_MESSAGE(DataSocketResponse, DataSocket);
   monomux::message::Boolean Success;
+
+  MONOMUX_MESSAGE_FIELDS(&DataSocket::Success);
+};
+
+/// The response to the \p request::Handshake, sent by the server.
+///
+/// If the data connection could not be registered, \p Success is \p false,
+/// but the \p Client identity is valid, and the client may establish the data
+/// connection with a \p request::DataSocket.
+///
+/// If \p Multiplexed is \p true, the server accepted to multiplex the
+/// connection, and every message after this response is framed by
+/// \p MuxedSocket. The data connection passed with the request is closed.
+///
+/// If \p Compressed is \p true, the server accepted to compress the output,
+/// and every byte of data sent to the client is part of a raw DEFLATE stream.
+///
+/// If \p SharedRing is \p true, the server accepted to publish the output of
+/// the sessions the client attaches to in a \p SharedRing, see
+/// \p response::Attach.
+struct Handshake
+{
+  MONOMUX_MESSAGE(HandshakeResponse, Handshake);
+  monomux::message::ClientID Client;
+  monomux::message::Boolean Success;
+  monomux::message::Boolean Multiplexed;
+  monomux::message::Boolean Compressed;
+  monomux::message::Boolean SharedRing;
+
+  MONOMUX_MESSAGE_FIELDS(&Handshake::Client,
+                         &Handshake::Success,
+                         &Handshake::Multiplexed,
+                         &Handshake::Compressed,
+                         &Handshake::SharedRing);
 };
 
 /// The response to the \p request::SessionList, sent by the server.
@@ -217,6 +463,8 @@ struct SessionList
 {
   MONOMUX_MESSAGE(SessionListResponse, SessionList);
   std::vector<monomux::message::SessionData> Sessions;
+
+  MONOMUX_MESSAGE_FIELDS(&SessionList::Sessions);
 };
 
 /// The response to the \p request::MakeSession,sent by the server.
@@ -228,6 +476,8 @@ struct MakeSession
   /// The name of the created session. This \b MAY \b NOT be the same as the
   /// \e requested \p Name.
   std::string Name;
+
+  MONOMUX_MESSAGE_FIELDS(&MakeSession::Success, &MakeSession::Name);
 };
 
 /// The response to the \p request::Attach specifying whether the server
@@ -239,12 +489,33 @@ struct Attach
   /// Information about the session the client attached to. Only meaningful if
   /// \p Success is \p true.
   SessionData Session;
+  /// Whether the recent output of the session was sent to the client, in
+  /// which case the session need not be asked to redraw. Only meaningful if
+  /// \p Success is \p true.
+  monomux::message::Boolean Replayed;
+  /// Whether the output of the session is published in a \p SharedRing, and
+  /// not sent over the data connection, once the output sent before (e.g.,
+  /// the replayed one) was read from the data connection. The memory of the
+  /// ring, and the file by which the client is woken up when new output is
+  /// published, are attached to the message with \p Socket::writeWithFiles(),
+  /// in this order. Only meaningful if \p Success is \p true.
+  monomux::message::Boolean SharedRing;
+  /// The slot of the \p SharedRing the client reads with. Only meaningful if
+  /// \p SharedRing is \p true.
+  std::uint64_t RingSlot{};
+
+  MONOMUX_MESSAGE_FIELDS(&Attach::Success,
+                         &Attach::Session,
+                         &Attach::Replayed,
+                         &Attach::SharedRing,
+                         &Attach::RingSlot);
 };
 
 /// The response to the \p request::Detach indicating receipt.
 struct Detach
 {
   MONOMUX_MESSAGE(DetachResponse, Detach);
+  MONOMUX_MESSAGE_FIELDS();
 };
 
 /// The response ot the \p request::Statistics containing the response data.
@@ -256,6 +527,79 @@ struct Statistics
   /// \warning This text is \b NOT meant to be machine-readable, and only useful
   /// for development and debugging by a human!
   std::string Contents;
+
+  MONOMUX_MESSAGE_FIELDS(&Statistics::Contents);
+};
+
+/// The response to the \p request::Metrics, containing the current values of
+/// the counters of the server, in a form meant to be processed by machines.
+struct Metrics
+{
+  MONOMUX_MESSAGE(MetricsResponse, Metrics);
+  /// The metrics of the server process as a whole, with a single subject.
+  MetricTable Server;
+  /// The metrics of every connected client, identified by their ID.
+  MetricTable Clients;
+  /// The metrics of every running session, identified by their name.
+  MetricTable Sessions;
+
+  MONOMUX_MESSAGE_FIELDS(&Metrics::Server,
+                         &Metrics::Clients,
+                         &Metrics::Sessions);
+};
+
+/// The response to the \p request::SessionSubscribe, sent by the server.
+struct SessionSubscribe
+{
+  MONOMUX_MESSAGE(SessionSubscribeResponse, SessionSubscribe);
+  /// The current generation of the sessions, which every subsequent
+  /// \p notification::SessionChange increments by one.
+  std::uint64_t Generation{};
+  /// Whether \p Sessions is the current state of the sessions. \p false if
+  /// the generation the client knew is still current, or if the client
+  /// unsubscribed.
+  monomux::message::Boolean Snapshot;
+  std::vector<monomux::message::SessionStatus> Sessions;
+
+  MONOMUX_MESSAGE_FIELDS(&SessionSubscribe::Generation,
+                         &SessionSubscribe::Snapshot,
+                         &SessionSubscribe::Sessions);
+};
+
+/// The response to the \p request::Usage, containing the resources used by
+/// every running session, as last sampled.
+struct Usage
+{
+  MONOMUX_MESSAGE(UsageResponse, Usage);
+  /// The length of the interval the rates are measured over, in milliseconds.
+  /// \p 0 if this is the first sample, and no rates are known yet.
+  std::uint64_t IntervalMs{};
+  std::vector<monomux::message::SessionUsage> Sessions;
+
+  MONOMUX_MESSAGE_FIELDS(&Usage::IntervalMs, &Usage::Sessions);
+};
+
+/// The response to the \p request::Watch specifying whether the server
+/// accepted the request.
+struct Watch
+{
+  MONOMUX_MESSAGE(WatchResponse, Watch);
+  monomux::message::Boolean Success;
+  /// Information about the session watched.
+  SessionData Session;
+  /// The tag of the \p SessionFrame chunks the output of the session is sent
+  /// in. When the watching stops, a frame without payload is sent with it.
+  /// Only meaningful if \p Success is \p true.
+  std::uint64_t Tag{};
+  /// Whether the recent output of the session was sent to the client in the
+  /// first frames. Only meaningful if \p Success is \p true, and the watching
+  /// started.
+  monomux::message::Boolean Replayed;
+
+  MONOMUX_MESSAGE_FIELDS(&Watch::Success,
+                         &Watch::Session,
+                         &Watch::Tag,
+                         &Watch::Replayed);
 };
 
 } // namespace response
@@ -272,6 +616,14 @@ struct Connection
   /// The reason why the connection cannot be established, if \p Accepted is
   /// \p false.
   std::string Reason;
+  /// The highest version of the \p WireFormat::Binary encoding the server
+  /// understands, or \p 0 if only \p WireFormat::Text is supported.
+  /// Only meaningful if \p Accepted is \p true.
+  std::uint8_t BinaryVersion{};
+
+  MONOMUX_MESSAGE_FIELDS(&Connection::Accepted,
+                         &Connection::Reason,
+                         &Connection::BinaryVersion);
 };
 
 /// A notification sent by the server to the client(s) indicating that the
@@ -304,6 +656,10 @@ struct Detached
   /// The reason behind the server kicking the client ungracefully.
   /// Only meaingful if \p Mode is \p Kicked.
   std::string Reason;
+
+  MONOMUX_MESSAGE_FIELDS(&Detached::Mode,
+                         &Detached::ExitCode,
+                         &Detached::Reason);
 };
 
 /// A notification send by the client to the server indicating that its terminal
@@ -316,10 +672,97 @@ struct Redraw
   MONOMUX_MESSAGE(RedrawNotification, Redraw);
   unsigned short Rows{};
   unsigned short Columns{};
+
+  MONOMUX_MESSAGE_FIELDS(&Redraw::Rows, &Redraw::Columns);
+};
+
+/// A notification sent by the server to the client(s) attached to a session
+/// indicating how the terminal of the session currently treats the input
+/// typed into it.
+///
+/// \see termios(3)
+struct TerminalMode
+{
+  MONOMUX_MESSAGE(TerminalModeNotification, TerminalMode);
+  /// Whether the terminal echoes the input back, i.e., \p ECHO is set.
+  monomux::message::Boolean Echo;
+  /// Whether the input is edited line by line by the terminal, i.e.,
+  /// \p ICANON is set. Unset in "raw" mode, when the program handles every
+  /// keystroke itself.
+  monomux::message::Boolean Canonical;
+
+  MONOMUX_MESSAGE_FIELDS(&TerminalMode::Echo, &TerminalMode::Canonical);
+};
+
+/// A notification sent by the server to the clients that subscribed with a
+/// \p request::SessionSubscribe, indicating that a session changed.
+///
+/// The \p Generation of subsequent notifications is increasing by one. If a
+/// client sees a gap, it should resynchronise with another subscribe request.
+struct SessionChange
+{
+  MONOMUX_MESSAGE(SessionChangeNotification, SessionChange);
+  enum ChangeKind
+  {
+    /// The session was created.
+    Created,
+    /// The session exited.
+    Destroyed,
+    /// A client attached to or detached from the session.
+    Attachment
+  };
+  ChangeKind Change = Created;
+  /// The generation of the sessions after the change.
+  std::uint64_t Generation{};
+  /// The state of the session after the change.
+  SessionStatus Session;
+
+  MONOMUX_MESSAGE_FIELDS(&SessionChange::Change,
+                         &SessionChange::Generation,
+                         &SessionChange::Session);
 };
 
 } // namespace notification
 
+/// Maps the type of every request that is answered by the server to the type
+/// of the response, as \p Type.
+template <typename Request> struct ResponseOf;
+#define MONOMUX_RESPONSE_OF(NAME)                                              \
+  template <> struct ResponseOf<request::NAME>                                 \
+  {                                                                            \
+    using Type = response::NAME;                                               \
+  };
+MONOMUX_RESPONSE_OF(ClientID)
+MONOMUX_RESPONSE_OF(DataSocket)
+MONOMUX_RESPONSE_OF(Handshake)
+MONOMUX_RESPONSE_OF(SessionList)
+MONOMUX_RESPONSE_OF(MakeSession)
+MONOMUX_RESPONSE_OF(Attach)
+MONOMUX_RESPONSE_OF(Detach)
+MONOMUX_RESPONSE_OF(Statistics)
+MONOMUX_RESPONSE_OF(Metrics)
+MONOMUX_RESPONSE_OF(SessionSubscribe)
+MONOMUX_RESPONSE_OF(Usage)
+MONOMUX_RESPONSE_OF(Watch)
+#undef MONOMUX_RESPONSE_OF
+
+template <> struct EnumLimit<MetricTable::MetricKind>
+{
+  static constexpr auto Max = MetricTable::Histogram;
+};
+template <> struct EnumLimit<request::Detach::DetachMode>
+{
+  static constexpr auto Max = request::Detach::All;
+};
+template <> struct EnumLimit<notification::Detached::DetachMode>
+{
+  static constexpr auto Max = notification::Detached::Kicked;
+};
+template <> struct EnumLimit<notification::SessionChange::ChangeKind>
+{
+  static constexpr auto Max = notification::SessionChange::Attachment;
+};
+
 } // namespace monomux::message
 
 #undef MONOMUX_MESSAGE
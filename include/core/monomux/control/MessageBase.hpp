@@ -17,7 +17,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -92,8 +94,73 @@ enum class MessageKind : std::uint16_t
   StatisticsRequest,
   /// A response to the \p StatisticsRequest.
   StatisticsResponse,
+
+  /// A request to the server to respond with the values of the counters it
+  /// keeps about its operation.
+  MetricsRequest,
+  /// A response to the \p MetricsRequest.
+  MetricsResponse,
+
+  /// A request to the server to reply the client's ID to the client, and to
+  /// register the connection passed along with the message as the data
+  /// connection/socket of the client.
+  HandshakeRequest,
+  /// A response for the \p HandshakeRequest, containing the client's ID, and
+  /// whether the data connection was registered.
+  HandshakeResponse,
+
+  /// A notification sent by the server to the attached clients about how the
+  /// terminal of the session handles the input.
+  TerminalModeNotification,
+
+  /// A request to the server to start (or stop) notifying the client about
+  /// the changes of the sessions.
+  SessionSubscribeRequest,
+  /// A response to the \p SessionSubscribeRequest, containing the current
+  /// state of the sessions, if the client did not know it yet.
+  SessionSubscribeResponse,
+  /// A notification sent by the server to the subscribed clients about a
+  /// session being created, destroyed, or attached to.
+  SessionChangeNotification,
+
+  /// A request to the server to respond with the resources used by each
+  /// session.
+  UsageRequest,
+  /// A response to the \p UsageRequest.
+  UsageResponse,
+
+  /// A request to the server to start (or stop) sending the output of a
+  /// session to the client, alongside the other sessions the client watches.
+  WatchRequest,
+  /// A response to the \p WatchRequest, containing the tag the output of the
+  /// session is sent with.
+  WatchResponse,
+};
+
+/// The number of \p MessageKind values, which are dense, starting from
+/// \p Invalid. Handlers are looked up in tables of this size.
+///
+/// \note Keep this in sync with the last entry of \p MessageKind!
+static constexpr std::size_t MessageKindCount =
+  static_cast<std::size_t>(MessageKind::WatchResponse) + 1;
+
+/// The encodings the raw data of a \p Message may be transmitted in.
+enum class WireFormat : std::uint8_t
+{
+  /// The human-readable, markup-like encoding that every peer understands.
+  Text,
+  /// The compact, fixed-layout encoding of \p BinaryWireVersion, which is only
+  /// used after the peers negotiated it during the connection handshake.
+  Binary
 };
 
+/// The version of the \p WireFormat::Binary encoding implemented by this
+/// build. The raw data of binary messages start with this byte, which can not
+/// begin any message in the \p WireFormat::Text encoding.
+///
+/// \note Increment this number whenever the layout of any message changes!
+static constexpr std::uint8_t BinaryWireVersion = 5;
+
 /// Helper class that contains the parsed \p MessageKind of a \p Message, and
 /// the remaining, not yet parsed \p Buffer.
 struct Message
@@ -119,30 +186,72 @@ struct Message
 
   /// Unpack an encoded and fully read payload into its base constitutents.
   static Message unpack(std::string_view Str) noexcept;
+
+  /// Returns the \p WireFormat the given \p RawData of a message is encoded
+  /// in.
+  static WireFormat formatOf(std::string_view RawData) noexcept;
+  WireFormat format() const noexcept { return formatOf(RawData); }
 };
 
-/// Encodes a message object into its raw data form.
-template <typename T> std::string encode(const T& Msg)
+namespace binary
+{
+template <typename T>
+void packInto(std::string& Buffer, const T& Msg, bool WithSize);
+} // namespace binary
+
+/// Appends the full transmissible payload of \p Msg, as if by
+/// \p Message::pack(), to the end of \p Buffer, optionally prefixed with the
+/// size of the payload. The kind, the raw data, and the terminator are all
+/// serialised in place, without any intermediate buffers.
+template <typename T>
+void frameInto(std::string& Buffer,
+               const T& Msg,
+               WireFormat Format,
+               bool WithSize)
 {
-  std::string RawForm = T::encode(Msg);
+  if (Format == WireFormat::Binary)
+  {
+    binary::packInto(Buffer, Msg, WithSize);
+    return;
+  }
+
+  const std::size_t Start = Buffer.size();
+  if (WithSize)
+    Buffer.append(sizeof(std::size_t), '\0');
+  const MessageKind Kind = T::Kind;
+  Buffer.append(reinterpret_cast<const char*>(&Kind), sizeof(MessageKind));
+  T::encode(Buffer, Msg);
+  Buffer.push_back('\0');
 
-  Message MB;
-  MB.Kind = Msg.Kind;
-  MB.RawData = RawForm;
+  if (WithSize)
+  {
+    // The length of the text form is only known after it had been written.
+    const std::size_t PayloadSize = Buffer.size() - Start - sizeof(std::size_t);
+    std::memcpy(&Buffer[Start], &PayloadSize, sizeof(std::size_t));
+  }
+}
 
-  return MB.pack();
+/// Encodes a message object into its raw data form.
+template <typename T>
+std::string encode(const T& Msg, WireFormat Format = WireFormat::Text)
+{
+  std::string Buffer;
+  frameInto(Buffer, Msg, Format, /* WithSize =*/false);
+  return Buffer;
 }
 
 /// Encodes a message object into its raw data form, prefixed with a payload
 /// size.
-template <typename T> std::string encodeWithSize(const T& Msg)
+template <typename T>
+std::string encodeWithSize(const T& Msg, WireFormat Format = WireFormat::Text)
 {
-  std::string Payload = encode(Msg);
-  return Message::sizeToBinaryString(Payload.size()) + std::move(Payload);
+  std::string Buffer;
+  frameInto(Buffer, Msg, Format, /* WithSize =*/true);
+  return Buffer;
 }
 
 /// Decodes the given received buffer as a specific message object, and returns
-/// it if successful.
+/// it if successful. The \p WireFormat of the buffer is detected automatically.
 template <typename T> std::optional<T> decode(std::string_view Str) noexcept
 {
   Message MB = Message::unpack(Str);
@@ -0,0 +1,316 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "MessageBase.hpp"
+
+/// Declares the list of data members of a message \p struct that make up its
+/// serialised form, in order, e.g.
+/// \code
+/// MONOMUX_MESSAGE_FIELDS(&Attach::Name);
+/// \endcode
+///
+/// The \p WireFormat::Binary codec of the message is generated from this list.
+#define MONOMUX_MESSAGE_FIELDS(...)                                            \
+  static constexpr auto fields() noexcept                                      \
+  {                                                                            \
+    return std::make_tuple(__VA_ARGS__);                                       \
+  }
+
+namespace monomux::message
+{
+
+/// Specialised for every enumeration that is a field of a message to provide
+/// the largest valid enumerator as \p Max, against which received values are
+/// checked.
+template <typename E> struct EnumLimit;
+
+/// Implementation of the fixed-layout \p WireFormat::Binary encoding, generated
+/// at compile time from the \p fields() of the message types.
+///
+/// Integers are written in little-endian byte order with the width of their
+/// declared type, \p bool and enumerations as a single byte, and strings and
+/// lists are prefixed by their length as a \p std::uint32_t. Nested messages
+/// are written as the sequence of their fields. Decoding advances a buffer in
+/// place and does not copy anything out apart from the resulting values.
+namespace binary
+{
+
+namespace detail
+{
+
+template <typename T, typename = void> struct HasFields : std::false_type
+{};
+template <typename T>
+struct HasFields<T, std::void_t<decltype(T::fields())>> : std::true_type
+{};
+
+template <typename T> struct IsVector : std::false_type
+{};
+template <typename E> struct IsVector<std::vector<E>> : std::true_type
+{};
+
+template <typename T> struct IsPair : std::false_type
+{};
+template <typename A, typename B>
+struct IsPair<std::pair<A, B>> : std::true_type
+{};
+
+template <typename T> struct AlwaysFalse : std::false_type
+{};
+
+/// The type of the size prefix of strings and lists.
+using Length = std::uint32_t;
+
+/// Calls \p Fn with a reference to each field of \p Object in order, and
+/// returns whether all calls returned \p true.
+template <typename T, typename Fn> bool forEachField(T& Object, Fn&& Callback)
+{
+  return std::apply(
+    [&Object, &Callback](auto... Members) {
+      return (Callback(Object.*Members) && ...);
+    },
+    std::remove_const_t<T>::fields());
+}
+
+} // namespace detail
+
+/// Returns the smallest number of bytes any value of \p T is encoded into.
+template <typename T> constexpr std::size_t minimumSize() noexcept
+{
+  if constexpr (std::is_same_v<T, bool> || std::is_enum_v<T>)
+    return sizeof(std::uint8_t);
+  else if constexpr (std::is_integral_v<T>)
+    return sizeof(T);
+  else if constexpr (std::is_same_v<T, std::string> || detail::IsVector<T>{})
+    return sizeof(detail::Length);
+  else if constexpr (detail::IsPair<T>{})
+    return minimumSize<typename T::first_type>() +
+           minimumSize<typename T::second_type>();
+  else if constexpr (detail::HasFields<T>{})
+    return std::apply(
+      [](auto... Members) {
+        return (std::size_t{0} + ... +
+                minimumSize<std::remove_reference_t<
+                  decltype(std::declval<T&>().*Members)>>());
+      },
+      T::fields());
+  else
+    static_assert(detail::AlwaysFalse<T>{}, "Type can not be serialised!");
+}
+
+/// Returns the number of bytes \p Value is encoded into.
+template <typename T> std::size_t sizeOf(const T& Value) noexcept
+{
+  if constexpr (std::is_same_v<T, std::string>)
+    return sizeof(detail::Length) + Value.size();
+  else if constexpr (detail::IsVector<T>{})
+  {
+    std::size_t Size = sizeof(detail::Length);
+    for (const auto& Elem : Value)
+      Size += sizeOf(Elem);
+    return Size;
+  }
+  else if constexpr (detail::IsPair<T>{})
+    return sizeOf(Value.first) + sizeOf(Value.second);
+  else if constexpr (detail::HasFields<T>{})
+  {
+    std::size_t Size = 0;
+    detail::forEachField(Value, [&Size](const auto& Field) {
+      Size += sizeOf(Field);
+      return true;
+    });
+    return Size;
+  }
+  else
+    return minimumSize<T>();
+}
+
+/// Appends the encoded form of \p Value to \p Buffer.
+template <typename T> void put(std::string& Buffer, const T& Value)
+{
+  if constexpr (std::is_same_v<T, bool>)
+    Buffer.push_back(static_cast<char>(Value ? 1 : 0));
+  else if constexpr (std::is_enum_v<T>)
+  {
+    static_assert(static_cast<std::uint64_t>(EnumLimit<T>::Max) <= UINT8_MAX,
+                  "Enumeration does not fit a single byte!");
+    Buffer.push_back(static_cast<char>(Value));
+  }
+  else if constexpr (std::is_integral_v<T>)
+  {
+    auto Bits = static_cast<std::make_unsigned_t<T>>(Value);
+    for (std::size_t I = 0; I < sizeof(T); ++I)
+      Buffer.push_back(static_cast<char>((Bits >> (I * 8)) & 0xFF));
+  }
+  else if constexpr (std::is_same_v<T, std::string>)
+  {
+    put(Buffer, static_cast<detail::Length>(Value.size()));
+    Buffer.append(Value);
+  }
+  else if constexpr (detail::IsVector<T>{})
+  {
+    put(Buffer, static_cast<detail::Length>(Value.size()));
+    for (const auto& Elem : Value)
+      put(Buffer, Elem);
+  }
+  else if constexpr (detail::IsPair<T>{})
+  {
+    put(Buffer, Value.first);
+    put(Buffer, Value.second);
+  }
+  else if constexpr (detail::HasFields<T>{})
+    detail::forEachField(Value, [&Buffer](const auto& Field) {
+      put(Buffer, Field);
+      return true;
+    });
+  else
+    static_assert(detail::AlwaysFalse<T>{}, "Type can not be serialised!");
+}
+
+/// Decodes a \p Value from the beginning of \p Buffer, and advances \p Buffer
+/// past the consumed data.
+///
+/// \returns Whether the decoding was successful. If not, the contents of both
+/// \p Buffer and \p Value are unspecified.
+template <typename T> bool take(std::string_view& Buffer, T& Value)
+{
+  if constexpr (std::is_same_v<T, bool> || std::is_enum_v<T>)
+  {
+    if (Buffer.empty())
+      return false;
+    auto Byte = static_cast<unsigned char>(Buffer.front());
+    Buffer.remove_prefix(1);
+
+    if constexpr (std::is_same_v<T, bool>)
+    {
+      Value = Byte == 1;
+      return Byte <= 1;
+    }
+    else
+    {
+      Value = static_cast<T>(Byte);
+      return Byte <= static_cast<unsigned char>(EnumLimit<T>::Max);
+    }
+  }
+  else if constexpr (std::is_integral_v<T>)
+  {
+    using U = std::make_unsigned_t<T>;
+    if (Buffer.size() < sizeof(T))
+      return false;
+
+    U Bits = 0;
+    for (std::size_t I = 0; I < sizeof(T); ++I)
+      Bits |= static_cast<U>(static_cast<unsigned char>(Buffer[I])) << (I * 8);
+    Value = static_cast<T>(Bits);
+    Buffer.remove_prefix(sizeof(T));
+    return true;
+  }
+  else if constexpr (std::is_same_v<T, std::string>)
+  {
+    detail::Length Size;
+    if (!take(Buffer, Size) || Buffer.size() < Size)
+      return false;
+    Value.assign(Buffer.data(), Size);
+    Buffer.remove_prefix(Size);
+    return true;
+  }
+  else if constexpr (detail::IsVector<T>{})
+  {
+    using E = typename T::value_type;
+    detail::Length Count;
+    // Reject counts that the rest of the buffer could not possibly contain
+    // before allocating for them.
+    if (!take(Buffer, Count) || Buffer.size() / minimumSize<E>() < Count)
+      return false;
+    Value.resize(Count);
+    for (E& Elem : Value)
+      if (!take(Buffer, Elem))
+        return false;
+    return true;
+  }
+  else if constexpr (detail::IsPair<T>{})
+    return take(Buffer, Value.first) && take(Buffer, Value.second);
+  else if constexpr (detail::HasFields<T>{})
+    return detail::forEachField(
+      Value, [&Buffer](auto& Field) { return take(Buffer, Field); });
+  else
+    static_assert(detail::AlwaysFalse<T>{}, "Type can not be serialised!");
+}
+
+/// Encodes the message \p Msg into its raw data form, starting with the version
+/// header.
+template <typename T> std::string encode(const T& Msg)
+{
+  std::string Buffer;
+  Buffer.reserve(sizeof(BinaryWireVersion) + sizeOf(Msg));
+  put(Buffer, BinaryWireVersion);
+  put(Buffer, Msg);
+  return Buffer;
+}
+
+/// Decodes a message of type \p T from the entirety of the raw data in
+/// \p Buffer.
+template <typename T> std::optional<T> decode(std::string_view Buffer)
+{
+  std::uint8_t Version;
+  if (!take(Buffer, Version) || Version != BinaryWireVersion)
+    return std::nullopt;
+
+  T Msg;
+  if (!take(Buffer, Msg) || !Buffer.empty())
+    return std::nullopt;
+  return Msg;
+}
+
+/// Appends the message \p Msg as a full transmissible payload, as if by
+/// \p Message::pack(), optionally prefixed with the payload size, to
+/// \p Buffer. The exact size is reserved in advance.
+template <typename T>
+void packInto(std::string& Buffer, const T& Msg, bool WithSize)
+{
+  const std::size_t PayloadSize = sizeof(MessageKind) +
+                                  sizeof(BinaryWireVersion) + sizeOf(Msg) +
+                                  sizeof('\0');
+  Buffer.reserve(Buffer.size() + (WithSize ? sizeof(std::size_t) : 0) +
+                 PayloadSize);
+
+  // The framing is in the native representation, as in Message::pack().
+  if (WithSize)
+    Buffer.append(reinterpret_cast<const char*>(&PayloadSize),
+                  sizeof(std::size_t));
+  const MessageKind Kind = T::Kind;
+  Buffer.append(reinterpret_cast<const char*>(&Kind), sizeof(MessageKind));
+  put(Buffer, BinaryWireVersion);
+  put(Buffer, Msg);
+  Buffer.push_back('\0');
+}
+
+} // namespace binary
+
+} // namespace monomux::message
@@ -17,20 +17,40 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+
 #include "monomux/control/MessageBase.hpp"
 #include "monomux/system/BufferedChannel.hpp"
 
 namespace monomux::message
 {
 
+namespace detail
+{
+
+/// Returns an empty buffer, local to the calling thread, that outgoing messages
+/// are framed into. The allocation of the buffer is reused between messages.
+std::string& sendBuffer();
+
+} // namespace detail
+
 /// Sends a specific message, fully encoded for transportation, on the
 /// \p Channel.
 ///
+/// \param Format The encoding to use, which \b MUST be one that the peer on
+/// the other end of \p Channel had agreed to understand.
+///
 /// \note This operation \b MAY block.
 template <typename T>
-std::size_t sendMessage(BufferedChannel& Channel, const T& Msg)
+std::size_t sendMessage(BufferedChannel& Channel,
+                        const T& Msg,
+                        WireFormat Format = WireFormat::Text)
 {
-  return Channel.write(encodeWithSize(Msg));
+  std::string& Buffer = detail::sendBuffer();
+  frameInto(Buffer, Msg, Format, /* WithSize =*/true);
+  return Channel.write(Buffer);
 }
 
 /// Reads a size-prefixed payload from the \p Channel.
@@ -54,4 +74,59 @@ template <typename T> std::optional<T> receiveMessage(BufferedChannel& Channel)
   return Msg;
 }
 
+/// Incrementally reassembles the size-prefixed payloads sent by
+/// \p sendMessage() from a non-blocking \p Channel.
+///
+/// Unlike \p readPascalString(), data of a partially received payload is kept
+/// between calls, and all the payloads that arrived together are returned,
+/// instead of only the first one.
+class PascalStringReader
+{
+public:
+  /// Reads the data that is currently available on \p Channel, without
+  /// waiting for more to arrive.
+  ///
+  /// \returns the number of bytes held, including incomplete payloads.
+  ///
+  /// \throws buffer_overflow See \p BufferedChannel::read().
+  std::size_t fill(BufferedChannel& Channel);
+
+  /// Returns the next fully received payload, if any.
+  ///
+  /// \warning The returned view points into the reader, and is invalidated by
+  /// the next call to \p fill() or \p clear().
+  std::optional<std::string_view> next();
+
+  /// \returns whether the last \p fill() might have left data unread in the
+  /// channel, in which case it should be called again before waiting for more.
+  bool mightHaveMore() const noexcept { return MightHaveMore; }
+
+  /// \returns whether some bytes of an incomplete payload are held.
+  bool hasPartial() const noexcept { return Offset < Buffer.size(); }
+
+  /// \returns whether a size prefix was encountered that could only be the
+  /// result of a corrupted stream. After this, no more payloads are returned.
+  bool corrupted() const noexcept { return Corrupted; }
+
+  /// \returns the bytes held that were not yet returned by \p next().
+  std::string_view partial() const noexcept
+  {
+    return std::string_view{Buffer}.substr(Offset);
+  }
+
+  /// Replaces the held bytes with \p Data, e.g. the \p partial() payload of
+  /// another reader of the same stream, which the next \p fill() continues.
+  void assign(std::string Data) noexcept;
+
+  /// Discards every buffered byte, and releases the memory held.
+  void clear() noexcept;
+
+private:
+  std::string Buffer;
+  /// The position in \p Buffer where the next size prefix begins.
+  std::size_t Offset = 0;
+  bool MightHaveMore = false;
+  bool Corrupted = false;
+};
+
 } // namespace monomux::message
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace monomux::message
+{
+
+/// A chunk of the output of one of the sessions a client \e watches, see
+/// \p request::Watch.
+///
+/// The output of every watched session is sent over the single data
+/// connection of the client, split into frames, each prefixed with a header
+/// that names the session by the tag the server assigned to it when the
+/// watching started, and the size of the payload: the tag (4 bytes), and the
+/// size (4 bytes), both little-endian. A frame without payload marks the end
+/// of the output of the session, after which its tag is not used again.
+struct SessionFrame
+{
+  static constexpr std::size_t HeaderSize = 8;
+
+  /// Encodes the header of a frame of \p Size bytes of the session \p Tag into
+  /// \p Header.
+  static void encodeHeader(char (&Header)[HeaderSize],
+                           std::uint32_t Tag,
+                           std::uint32_t Size) noexcept;
+
+  std::uint32_t Tag{};
+  /// The output of the session, or empty if the output of the session ended.
+  std::string_view Data;
+};
+
+/// Splits the data received over the data connection of a watching client
+/// into \p SessionFrame chunks. The data of a partially received frame is
+/// kept between calls.
+class SessionFrameReader
+{
+public:
+  /// Appends \p Data received from the connection to the reader.
+  void append(std::string_view Data);
+
+  /// Returns the next fully received frame, if any.
+  ///
+  /// \warning The payload of the returned frame points into the reader, and
+  /// is invalidated by the next call to \p append() or \p clear().
+  std::optional<SessionFrame> next() noexcept;
+
+  /// \returns whether some bytes of an incomplete frame are held.
+  bool hasPartial() const noexcept { return Offset < Buffer.size(); }
+
+  /// Discards every buffered byte, and releases the memory held.
+  void clear() noexcept;
+
+private:
+  std::string Buffer;
+  /// The position in \p Buffer where the next header begins.
+  std::size_t Offset = 0;
+};
+
+} // namespace monomux::message
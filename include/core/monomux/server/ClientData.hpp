@@ -17,18 +17,23 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <cassert>
 #include <chrono>
 #include <memory>
 #include <optional>
+#include <vector>
 
+#include "monomux/adt/Metric.hpp"
 #include "monomux/control/Message.hpp"
+#include "monomux/control/PascalString.hpp"
 #include "monomux/system/Socket.hpp"
+#include "monomux/system/Time.hpp"
+
+#include "SessionData.hpp"
 
 namespace monomux::server
 {
 
-class SessionData;
-
 /// Stores information about and associated resources to a connected client.
 class ClientData
 {
@@ -52,15 +57,87 @@ public:
   {
     return LastActivity;
   }
-  void activity() noexcept { LastActivity = std::chrono::system_clock::now(); }
+  void activity() noexcept { LastActivity = CoarseClock::now(); }
+
+  /// Returns the \p WireFormat the client understands. This is \p Text until
+  /// the client sends a message in another format.
+  message::WireFormat wireFormat() const noexcept { return Wire; }
+  void setWireFormat(message::WireFormat F) noexcept { Wire = F; }
 
   Socket& getControlSocket() noexcept { return *ControlConnection; }
+  /// Returns the reader that holds the partially received messages of the
+  /// control connection between reads.
+  message::PascalStringReader& getControlReader() noexcept
+  {
+    return ControlReader;
+  }
   Socket* getDataSocket() noexcept { return DataConnection.get(); }
 
   /// Releases the control socket of the other client and associates it as the
   /// data connection of the current client.
   void subjugateIntoDataSocket(ClientData& Other) noexcept;
 
+  /// Associates the \p Connection, which was passed to the server by the
+  /// client itself, as the data connection of the current client.
+  void attachDataSocket(std::unique_ptr<Socket> Connection) noexcept;
+
+  /// Replaces the control connection with the control stream of a
+  /// \p MuxedSocket over the same connection, and associates the data stream
+  /// of it as the data connection of the current client.
+  ///
+  /// \note The low-level connection, and thus the \p id() of the client, is
+  /// unchanged.
+  void multiplex();
+  /// \returns whether the control messages and the data of the client are
+  /// carried over the same connection.
+  bool multiplexed() const noexcept { return Multiplexed; }
+
+  /// \returns whether the output of the sessions is sent to the client
+  /// compressed.
+  bool compressed() const noexcept { return Compressed; }
+  void setCompressed(bool Compressed) noexcept
+  {
+    this->Compressed = Compressed;
+    changed();
+  }
+
+  /// \returns whether the client agreed to read the output of the sessions
+  /// from a \p SharedRing, instead of the data connection.
+  bool sharedRing() const noexcept { return SharedRingAccepted; }
+  void setSharedRing(bool Accepted) noexcept { SharedRingAccepted = Accepted; }
+
+  /// \returns the slot of the \p SharedRing of the attached session the
+  /// client reads with, if any.
+  std::optional<std::size_t> ringSlot() const noexcept { return RingSlot; }
+  /// \returns the file by which the client is woken up when output is
+  /// published in the \p SharedRing.
+  raw_fd ringWakeup() const noexcept { return RingWakeup.get(); }
+  /// \returns whether the output of the attached session is published to the
+  /// client in the \p SharedRing, instead of being sent over the data
+  /// connection.
+  bool ringActive() const noexcept { return RingActive; }
+  /// Records that the client reads the \p SharedRing of the attached session
+  /// with \p Slot, and is woken up with \p Wakeup. The output is not published
+  /// to the client until \p activateRing().
+  void attachRing(std::size_t Slot, fd Wakeup) noexcept
+  {
+    assert(!RingSlot && "Already reading a ring!");
+    RingSlot = Slot;
+    RingWakeup = std::move(Wakeup);
+  }
+  void activateRing() noexcept
+  {
+    RingActive = true;
+    changed();
+  }
+  void detachRing() noexcept
+  {
+    RingSlot.reset();
+    fd Closed = std::move(RingWakeup);
+    RingActive = false;
+    changed();
+  }
+
   SessionData* getAttachedSession() noexcept { return AttachedSession; }
   const SessionData* getAttachedSession() const noexcept
   {
@@ -72,6 +149,79 @@ public:
     AttachedSession = &Session;
   }
 
+  /// A session the client watches, instead of being attached to it.
+  struct WatchedSession
+  {
+    SessionData* Session;
+    /// The tag of the \p message::SessionFrame chunks the output of the
+    /// session is sent to the client in.
+    std::uint32_t Tag;
+  };
+  /// \returns whether the client watches any session. Such a client is not
+  /// attached to a session, and is sent the output of every session it
+  /// watches over its data connection, framed.
+  bool watching() const noexcept { return !Watched.empty(); }
+  const std::vector<WatchedSession>& watchedSessions() const noexcept
+  {
+    return Watched;
+  }
+  /// \returns the tag the output of \p Session is sent to the client with, if
+  /// the client watches it.
+  std::optional<std::uint32_t>
+  watchTag(const SessionData& Session) const noexcept;
+  /// Records that the client watches \p Session.
+  ///
+  /// \returns the tag assigned to the session.
+  std::uint32_t watch(SessionData& Session);
+  void unwatch(SessionData& Session) noexcept;
+
+  /// Returns whether the client is attached as a viewer only, whose input is
+  /// not passed to the session, and whose terminal does not affect the size of
+  /// the session.
+  bool readOnly() const noexcept { return ReadOnly; }
+  void setReadOnly(bool ReadOnly) noexcept
+  {
+    this->ReadOnly = ReadOnly;
+    changed();
+  }
+
+  /// Returns whether the client asked to be notified about the changes of the
+  /// sessions of the server.
+  bool sessionSubscriber() const noexcept { return SessionSubscriber; }
+  void setSessionSubscriber(bool Subscribed) noexcept
+  {
+    SessionSubscriber = Subscribed;
+  }
+
+  /// \returns the size of the terminal of the client, as most recently
+  /// reported by it.
+  std::optional<WindowSize> windowSize() const noexcept { return Size; }
+  void setWindowSize(WindowSize Size) noexcept { this->Size = Size; }
+
+  /// Returns whether the output of the attached session is being dropped
+  /// instead of sent to the client, because the client could not keep up with
+  /// it.
+  bool outputDropped() const noexcept { return OutputDropped; }
+  void setOutputDropped(bool Dropped) noexcept
+  {
+    if (Dropped && !OutputDropped)
+      Stats.OutputDrops.add();
+    OutputDropped = Dropped;
+    changed();
+  }
+
+  /// The running counters of the client's activity, exported by the server's
+  /// metrics.
+  struct Metrics
+  {
+    /// The number of control messages received from the client.
+    Counter ControlMessages;
+    /// The number of times the client fell behind and its output was dropped.
+    Counter OutputDrops;
+  };
+  const Metrics& metrics() const noexcept { return Stats; }
+  Metrics& metrics() noexcept { return Stats; }
+
   /// Sends the specified detachment reason to the client, if it is connected.
   ///
   /// \param EC The exit code of the session that is detaching from. Not always
@@ -82,6 +232,16 @@ public:
                         std::string Reason = {});
 
 private:
+  /// Tells the \p AttachedSession that the state it relays the output by
+  /// changed.
+  void changed() noexcept
+  {
+    if (AttachedSession)
+      AttachedSession->clientChanged(*this);
+    for (const WatchedSession& W : Watched)
+      W.Session->clientChanged(*this);
+  }
+
   std::size_t ID;
   std::optional<std::size_t> Nonce;
   /// The timestamp when the client connected.
@@ -89,15 +249,58 @@ private:
   /// The timestamp when the client was most recently trasmitting \b data.
   std::chrono::time_point<std::chrono::system_clock> LastActivity;
 
+  /// The encoding of the messages sent to the client.
+  message::WireFormat Wire = message::WireFormat::Text;
+
   /// The control connection transcieves control information and commands.
   std::unique_ptr<Socket> ControlConnection;
 
+  /// Keeps the messages received on \p ControlConnection until complete.
+  message::PascalStringReader ControlReader;
+
   /// The data connection transcieves the actual program data.
   std::unique_ptr<Socket> DataConnection;
 
   /// \e If the client is attached to a session, points to the data record of
   /// the session.
   SessionData* AttachedSession;
+
+  /// The sessions the client watches, if it is not attached to one.
+  std::vector<WatchedSession> Watched;
+  /// The tag assigned to the next session watched. Tags are not reused while
+  /// the client is connected.
+  std::uint32_t NextWatchTag = 0;
+
+  /// Whether the output of \p AttachedSession is not sent to the client.
+  bool OutputDropped = false;
+
+  /// Whether the client only watches \p AttachedSession.
+  bool ReadOnly = false;
+
+  /// Whether the client is sent a notification when the sessions change.
+  bool SessionSubscriber = false;
+
+  /// The size of the terminal of the client, if it was reported.
+  std::optional<WindowSize> Size;
+
+  /// Whether \p ControlConnection and \p DataConnection are the streams of
+  /// the same \p MuxedSocket.
+  bool Multiplexed = false;
+
+  /// Whether the data sent to the client is compressed by a \p Deflater.
+  bool Compressed = false;
+
+  /// Whether the client reads the output from a \p SharedRing when attached.
+  bool SharedRingAccepted = false;
+  /// The slot of the \p SharedRing of \p AttachedSession the client reads
+  /// with, if any.
+  std::optional<std::size_t> RingSlot;
+  fd RingWakeup;
+  /// Whether the output of \p AttachedSession is published to the client in
+  /// the \p SharedRing.
+  bool RingActive = false;
+
+  Metrics Stats;
 };
 
 } // namespace monomux::server
@@ -5,16 +5,21 @@
 
 DISPATCH(ClientIDRequest, requestClientID)
 DISPATCH(DataSocketRequest, requestDataSocket)
+DISPATCH(HandshakeRequest, requestHandshake)
 
 DISPATCH(SessionListRequest, requestSessionList)
+DISPATCH(SessionSubscribeRequest, requestSessionSubscribe)
+DISPATCH(UsageRequest, usageRequest)
 DISPATCH(MakeSessionRequest, requestMakeSession)
 DISPATCH(AttachRequest, requestAttach)
 DISPATCH(DetachRequest, requestDetach)
+DISPATCH(WatchRequest, requestWatch)
 
 DISPATCH(SignalRequest, signalSession)
 
 DISPATCH(RedrawNotification, redrawNotified)
 
 DISPATCH(StatisticsRequest, statisticsRequest)
+DISPATCH(MetricsRequest, metricsRequest)
 
 #undef DISPATCH
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "monomux/control/MessageCodec.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux::server
+{
+
+/// The state of a session, as handed over to the new instance of the server
+/// during a live upgrade.
+struct HandedOverSession
+{
+  std::string Name;
+  std::string Alias;
+  /// The creation time, as \p std::time_t.
+  std::int64_t Created;
+  std::int32_t PID;
+  /// The inherited master side of the terminal.
+  std::int32_t PtyFD;
+  std::string PtyName;
+  /// The output read from the session, but not yet sent to the clients.
+  std::string Output;
+  /// The input of the clients, not yet written to the session.
+  std::string Input;
+  /// The recent output of the session, to restore the scrollback or the
+  /// screen from.
+  std::string Recent;
+
+  MONOMUX_MESSAGE_FIELDS(&HandedOverSession::Name,
+                         &HandedOverSession::Alias,
+                         &HandedOverSession::Created,
+                         &HandedOverSession::PID,
+                         &HandedOverSession::PtyFD,
+                         &HandedOverSession::PtyName,
+                         &HandedOverSession::Output,
+                         &HandedOverSession::Input,
+                         &HandedOverSession::Recent);
+};
+
+/// The state of a client, as handed over to the new instance of the server
+/// during a live upgrade.
+struct HandedOverClient
+{
+  std::string Identifier;
+  std::int32_t ControlFD;
+  /// \p -1, if the client has no separate data connection.
+  std::int32_t DataFD;
+  bool BinaryWire;
+  bool Multiplexed;
+  bool Compressed;
+  bool ReadOnly;
+  /// Whether the client is subscribed to the changes of the sessions.
+  bool SessionSubscriber;
+  bool HasSize;
+  std::uint16_t Rows;
+  std::uint16_t Columns;
+  /// The name of the session the client is attached to, if any.
+  std::string Session;
+  /// The incomplete control message received from the client.
+  std::string ControlInput;
+  /// The data buffered for the connections of the client, but not yet sent.
+  std::string ControlOutput;
+  std::string DataOutput;
+  /// The data sent by the client, but not yet relayed to the session.
+  std::string DataInput;
+
+  MONOMUX_MESSAGE_FIELDS(&HandedOverClient::Identifier,
+                         &HandedOverClient::ControlFD,
+                         &HandedOverClient::DataFD,
+                         &HandedOverClient::BinaryWire,
+                         &HandedOverClient::Multiplexed,
+                         &HandedOverClient::Compressed,
+                         &HandedOverClient::ReadOnly,
+                         &HandedOverClient::SessionSubscriber,
+                         &HandedOverClient::HasSize,
+                         &HandedOverClient::Rows,
+                         &HandedOverClient::Columns,
+                         &HandedOverClient::Session,
+                         &HandedOverClient::ControlInput,
+                         &HandedOverClient::ControlOutput,
+                         &HandedOverClient::DataOutput,
+                         &HandedOverClient::DataInput);
+};
+
+/// Everything a running server hands over to the new instance it \p exec()s
+/// into, to continue serving the same sessions and clients. The file
+/// descriptors named in the state are inherited by the new instance.
+struct HandOverState
+{
+  std::string SocketPath;
+  std::int32_t SocketFD;
+  std::string MetricsSocketPath;
+  /// \p -1, if the server had no metrics socket.
+  std::int32_t MetricsSocketFD;
+  std::vector<HandedOverSession> Sessions;
+  std::vector<HandedOverClient> Clients;
+  /// The number of sessions ever started in advance, so the new instance
+  /// does not reuse the names of those already handed out.
+  std::uint64_t SessionPoolSpawned;
+  /// The generation of the session list, so subscribers can tell whether
+  /// they missed a change over the upgrade.
+  std::uint64_t SessionGeneration;
+
+  MONOMUX_MESSAGE_FIELDS(&HandOverState::SocketPath,
+                         &HandOverState::SocketFD,
+                         &HandOverState::MetricsSocketPath,
+                         &HandOverState::MetricsSocketFD,
+                         &HandOverState::Sessions,
+                         &HandOverState::Clients,
+                         &HandOverState::SessionPoolSpawned,
+                         &HandOverState::SessionGeneration);
+
+  /// Serialises the state into a compact, binary form.
+  std::string encode() const;
+  /// Restores the state from the form created by \p encode(), if valid.
+  static std::optional<HandOverState> decode(std::string_view Data);
+
+  /// Writes the state, serialised, into an anonymous file that is inherited
+  /// by programs \p exec()ed.
+  ///
+  /// \returns the file, rewound to its beginning.
+  fd writeToFile() const;
+  /// Reads and deserialises the state from \p File, created by
+  /// \p writeToFile().
+  static std::optional<HandOverState> readFromFile(raw_fd File);
+};
+
+} // namespace monomux::server
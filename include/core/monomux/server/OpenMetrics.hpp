@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <string>
+
+#include "monomux/control/Message.hpp"
+
+namespace monomux::server
+{
+
+/// The media type of the output of \p formatOpenMetrics().
+constexpr char OpenMetricsContentType[] =
+  "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+/// Formats the tables of \p Metrics in the OpenMetrics text exposition format,
+/// understood by e.g. Prometheus.
+///
+/// Every metric of a table becomes a metric family named after the table and
+/// the metric, e.g. \p monomux_client_bytes_read, in which the subjects
+/// (except for the single row of the server) are distinguished by a label.
+/// The columns of a histogram, named \p FAMILY_le_BOUND, \p FAMILY_sum, and
+/// \p FAMILY_count, with the count of every bucket individually, are turned
+/// into a single family of cumulative buckets.
+std::string formatOpenMetrics(const message::response::Metrics& Metrics);
+
+} // namespace monomux::server
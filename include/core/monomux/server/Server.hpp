@@ -17,23 +17,38 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <variant>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "monomux/adt/Atomic.hpp"
-#include "monomux/adt/SmallIndexMap.hpp"
+#include "monomux/adt/FlatIndexMap.hpp"
+#include "monomux/adt/Metric.hpp"
 #include "monomux/adt/Tagged.hpp"
+#include "monomux/system/CPUSet.hpp"
 #include "monomux/system/Event.hpp"
+#include "monomux/system/EventTrace.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
 #include "monomux/system/Process.hpp"
+#include "monomux/system/Recorder.hpp"
 #include "monomux/system/Socket.hpp"
+#include "monomux/system/TimerWheel.hpp"
 #include "monomux/system/fd.hpp"
 
 #include "ClientData.hpp"
+#include "HandOver.hpp"
 #include "SessionData.hpp"
 
 namespace monomux::server
@@ -73,6 +88,15 @@ public:
                                ClientData& Client,
                                std::string_view RawMessage);
 
+  /// The amount of output buffered for a client by default, above which the
+  /// client is considered to be unable to keep up with the session.
+  static constexpr std::size_t DefaultClientBufferLimit = 8ULL << 20; // 8 MiB
+
+  /// The time \p shutdown() waits by default for the clients to receive the
+  /// notification of the shutdown, and for the programs of the sessions to
+  /// exit.
+  static constexpr std::chrono::milliseconds DefaultShutdownTimeout{2000};
+
   /// Create a new server that will listen on the associated socket.
   Server(Socket&& Sock);
 
@@ -93,19 +117,258 @@ public:
   /// session running under it terminated.
   void setExitIfNoMoreSessions(bool ExitIfNoMoreSessions);
 
+  /// Sets whether the output of a session with only a single client attached
+  /// should be relayed inside the kernel with \p splice(), instead of being
+  /// copied through the server's buffers.
+  void setSpliceRelay(bool SpliceRelay);
+
+  /// Sets whether the session and data connections should be listened to in
+  /// \e edge-triggered mode, with the callbacks consuming the connections
+  /// until there is no more data ready, instead of relying on rescheduling.
+  ///
+  /// \note This must be set before calling \p loop().
+  void setEdgeTriggered(bool EdgeTriggered);
+
+  /// Sets whether the server's event queues should be backed by
+  /// \p io_uring(7) instead of \p epoll(7). If the facility is not available,
+  /// the server falls back to using \p epoll(7).
+  ///
+  /// \note This must be set before calling \p loop().
+  void setIOUring(bool IOUring);
+
+  /// Sets the limits of holding back the output of sessions so that it is
+  /// sent to the clients in fewer, larger chunks. If the limits are not
+  /// \p enabled(), output is sent as soon as it is read.
+  ///
+  /// \note This only affects sessions created after the call.
+  void setOutputCoalescing(CoalescingLimits Limits);
+
+  /// Sets the limits of the rate the output of each session is read at. Once
+  /// a session exceeds it, its output is not read until the rate allows it
+  /// again, and the buffer of the terminal holds back the program in the
+  /// session, instead of the server buffering the output it can not send. If
+  /// the limits are not \p enabled(), output is read as fast as it arrives.
+  ///
+  /// \note This only affects sessions created after the call.
+  void setOutputThrottle(ThrottleLimits Limits);
+
+  /// Sets the time after which a session that has no clients attached and
+  /// produced no output starts hibernating. The buffers of a hibernating
+  /// session are released, its scrollback is moved to a temporary file, and
+  /// its terminal is not listened for being writable, until the session
+  /// produces output or a client attaches to it. If \p 0, sessions do not
+  /// hibernate.
+  void setHibernation(std::chrono::seconds After);
+
+  /// Sets the time \p shutdown() may take in total. The connections of the
+  /// clients which did not receive the notification of the shutdown by then
+  /// are closed, and the programs of the sessions still running are no
+  /// longer waited for.
+  void setShutdownTimeout(std::chrono::milliseconds Timeout);
+
+  /// Sets the amount of output buffered for a client above which the client
+  /// is considered \e saturated. If every client attached to a session is
+  /// saturated, the output of the session is not read until one of them
+  /// catches up. Otherwise, output is dropped for the saturated clients, and
+  /// once they catch up, the session is asked to redraw. The limit is at most
+  /// half of \p BufferedChannel::bufferSizeMax(), which is also used if
+  /// \p 0.
+  ///
+  /// Clients are also considered saturated while the
+  /// \p BufferedChannel::globalBudget() is exceeded.
+  void setClientBufferLimit(std::size_t Limit);
+
+  /// Sets the amount of the most recent output of sessions that is kept
+  /// and replayed to clients when they attach, so the display of the client
+  /// is restored without the program in the session redrawing it. If \p 0,
+  /// output is not kept.
+  ///
+  /// \note Sessions keeping their output are not relayed with \p splice().
+  void setScrollback(std::size_t Bytes);
+
+  /// Sets the amount of the most recent output of sessions that is kept in
+  /// files next to the server's socket, for as long as the session runs. If
+  /// \p setScrollback() is non-zero, the output replayed to clients attaching
+  /// is read from these files, and is not kept in memory.
+  void setSessionLog(std::size_t Bytes);
+
+  /// Sets the directory the output of the sessions which name matches the
+  /// \p fnmatch(3) \p Pattern is recorded to, in asciicast files. The files
+  /// are written by a background thread, and if it falls behind, the output is
+  /// dropped from the recording instead of delaying the relay. If
+  /// \p Directory is empty, sessions are not recorded.
+  ///
+  /// \note This only affects sessions created after the call.
+  void setRecording(std::string Directory, std::string Pattern);
+
+  /// Sets the size of the \p SharedRing the output of each session is
+  /// published in for the clients running on the same host that ask for it.
+  /// Such clients read the output from shared memory, and are woken up with
+  /// an \p eventfd(2), so relaying a chunk of output to any number of them is
+  /// a single copy, and none of it is buffered for their connections.
+  ///
+  /// The session is never held back for these clients. Those that fall behind
+  /// by more than the size of the ring miss the oldest output, and ask the
+  /// session to redraw. If \p 0, every client is sent the output over its data
+  /// connection.
+  void setSharedRing(std::size_t Bytes);
+
+  /// Sets whether the contents of the screen of sessions is tracked, and
+  /// drawn to clients when they attach, instead of replaying the recent
+  /// output.
+  ///
+  /// \note Sessions tracking their screen are not relayed with \p splice().
+  void setScreenSnapshot(bool Enabled);
+
+  /// How the size of the terminal of a session is chosen when the clients
+  /// attached to it report different sizes.
+  enum class ResizePolicy
+  {
+    /// The size most recently reported by any client is used.
+    Latest,
+    /// The smallest number of rows and columns reported by the attached
+    /// clients is used, so the session fits every client.
+    Smallest
+  };
+  void setResizePolicy(ResizePolicy Policy);
+
+  /// The terminal of a session is resized at most once in this interval.
+  /// Sizes reported in the meantime are coalesced, and only the size
+  /// effective at the end of the interval is set, so the program running in
+  /// the session redraws fewer times while a window is being resized.
+  static constexpr std::chrono::milliseconds ResizeInterval{50};
+
+  /// Sets the number of sessions running the default shell of the server
+  /// that are started in advance. A request to create a session for the same
+  /// program, without arguments or changes to the environment, is handed one
+  /// of these sessions, and the pool is refilled in the background. If \p 0,
+  /// sessions are only started on request.
+  void setSessionPool(std::size_t Size);
+
+  /// Sets the number of additional threads the server should distribute the
+  /// handling of sessions (and the clients attached to them) to. If \p 0, all
+  /// connections are handled by the thread executing \p loop().
+  ///
+  /// \note This must be set before calling \p loop().
+  void setReactorCount(std::size_t ReactorCount);
+
+  /// Sets the CPUs the threads of the server run on. The coordinator may run on
+  /// any of \p CPUs, while each reactor is pinned to a single one of them, with
+  /// consecutive reactors spread over the NUMA nodes of the system. If
+  /// \p nullopt, the threads are not restricted.
+  ///
+  /// \note This must be set before calling \p loop().
+  void setServerAffinity(std::optional<CPUSet> CPUs);
+
+  /// Records the event loops of the server into \p EventTrace files, named
+  /// \p Prefix followed by \p ".0.trace" for the coordinator and
+  /// \p ".N.trace" for the Nth reactor. If \p Prefix is empty, nothing is
+  /// recorded.
+  ///
+  /// \note This must be set before calling \p loop().
+  void setEventTrace(std::string Prefix);
+
+  /// Sets the CPUs the programs of sessions run on, keeping them off the CPUs
+  /// of the server's threads. If \p nullopt, the programs may run wherever the
+  /// server could before \p setServerAffinity() restricted it.
+  ///
+  /// \note This only affects sessions created after the call.
+  void setSessionAffinity(std::optional<CPUSet> CPUs);
+
+  static constexpr std::size_t DefaultListenBacklog = 16;
+  /// Sets the number of connections that may wait for being accepted by the
+  /// server, see \p listen(2).
+  ///
+  /// \note This must be set before calling \p loop().
+  void setListenBacklog(std::size_t Backlog);
+
+  /// Sets the socket on which the counters of the server are served, in the
+  /// OpenMetrics text format, to whoever connects and sends a request (e.g.
+  /// \p "GET /metrics HTTP/1.1").
+  ///
+  /// \note This must be set before calling \p loop().
+  ///
+  /// \see formatOpenMetrics()
+  void setMetricsSocket(Socket&& MetricsSock);
+
+  /// Sets the file on which the signals of the process arrive. When it becomes
+  /// readable, \p Dispatch is fired to handle them, and the children reported
+  /// dead are reaped in the same iteration of the \p loop().
+  ///
+  /// \note This must be set before calling \p loop().
+  ///
+  /// \see signalfd(2)
+  void setSignalFile(raw_fd FD, std::function<void()> Dispatch);
+
+  /// Starts accepting connections on the server socket (and the metrics
+  /// socket, if any) into the listen backlog, without handling them yet.
+  /// Clients connecting after this call are served once \p loop() starts.
+  ///
+  /// \note Calling this is optional, \p loop() starts listening if it has
+  /// not been done already.
+  void listen();
+
   /// Start actively listening and handling connections.
   ///
   /// \note This is a blocking call!
   void loop();
 
+  /// Runs one iteration of the event loop of \p loop(), handling the events
+  /// that arrive in at most \p Timeout, or until the next timer is due. The
+  /// event loop is set up on the first call, if \p loop() was not called.
+  ///
+  /// \returns the number of events received.
+  std::size_t iterate(std::chrono::milliseconds Timeout);
+
   /// Atomcially request the server's \p listen() loop to die.
   void interrupt() const noexcept;
 
+  /// Sets the function that replaces the running program with a new instance
+  /// of the server during a live upgrade. It receives the file that holds the
+  /// \p HandOverState, and should \p exec() the new program, passing the file
+  /// to it. If the function returns, the upgrade is considered failed, and
+  /// the server continues running.
+  void setUpgradeHandler(std::function<void(raw_fd StateFile)> Handler);
+  /// Atomically request the server's \p loop() to hand its sessions and
+  /// clients over to a new instance of the program, via the upgrade handler.
+  void requestUpgrade() const noexcept;
+  /// Sets the \p State handed over by the previous instance of the server,
+  /// which is restored when the \p loop() starts.
+  ///
+  /// \note The serving and metrics sockets of the state must be set by the
+  /// caller, separately.
+  void setHandedOverState(HandOverState State);
+
   /// After the server's \p listen() loop has terminated, performs graceful
   /// shutdown of connections and sessions.
+  ///
+  /// Every client is sent the notification of the shutdown at once, and the
+  /// connections are flushed together as they become writable. Then, the
+  /// programs of every session are hung up together, and reaped as they
+  /// exit. Both wait for at most the time set by \p setShutdownTimeout().
   void shutdown();
 
 private:
+  /// A connection accepted on the metrics socket, which is answered with the
+  /// metrics, and closed, once its request had arrived.
+  struct MetricsScraper
+  {
+    Socket Connection;
+    std::string Request;
+    /// Whether the answer was written (or buffered) to the connection.
+    bool Answered = false;
+  };
+
+  /// A process started in advance, to become the session requested by a
+  /// client later.
+  struct PooledSession
+  {
+    /// The name of the session the process knows from its environment,
+    /// which the session is also found by once it is handed out.
+    std::string Alias;
+    Process Proc;
+  };
+
   /// Create a data structure that allows us to (in the optimal case) quickly
   /// resolve a file descriptor to its origin kind, e.g. whether the connection
   /// is a client control connection, a client data connection, or a session
@@ -115,28 +378,68 @@ private:
     CT_None = 0,
     CT_ClientControl = 1,
     CT_ClientData = 2,
-    CT_Session = 4
+    CT_Session = 4,
+    CT_SessionTimer = 8,
+    CT_MetricsScraper = 16
   };
 
   using ClientControlConnection = Tagged<CT_ClientControl, ClientData>;
   using ClientDataConnection = Tagged<CT_ClientData, ClientData>;
   using SessionConnection = Tagged<CT_Session, SessionData>;
-  using LookupVariant = std::variant<std::monostate,
-                                     ClientControlConnection,
-                                     ClientDataConnection,
-                                     SessionConnection>;
+  using SessionTimerConnection = Tagged<CT_SessionTimer, SessionData>;
+  using MetricsScraperConnection = Tagged<CT_MetricsScraper, MetricsScraper>;
+  using LookupEntry = TaggedUnion<ClientControlConnection,
+                                  ClientDataConnection,
+                                  SessionConnection,
+                                  SessionTimerConnection,
+                                  MetricsScraperConnection>;
 
   Socket Sock;
   std::chrono::time_point<std::chrono::system_clock> WhenStarted;
 
-  static constexpr std::size_t FDLookupSize = 256;
+  using LookupMap = FlatIndexMap<LookupEntry>;
   /// A quick lookup that associates a file descriptor to the data for the
   /// entity behind the file descriptor.
-  SmallIndexMap<LookupVariant,
-                FDLookupSize,
-                /* StoreInPlace =*/true,
-                /* IntrusiveDefaultSentinel =*/true>
-    FDLookup;
+  LookupMap FDLookup;
+
+  /// A reactor is an event loop running on its own thread, which handles the
+  /// session connections of the sessions assigned to it, and the data
+  /// connections of the clients attached to these sessions.
+  ///
+  /// The thread executing \p loop() remains the \e coordinator, which accepts
+  /// clients and handles the control connections. The coordinator only
+  /// touches the connections of a reactor while holding its \p Lock.
+  struct Reactor
+  {
+    /// The recording of the reactor's event loop, if any.
+    std::unique_ptr<EventTrace> Trace;
+    std::unique_ptr<EPoll> Poll;
+    LookupMap FDLookup;
+    /// The timers of the reactor's event loop, only accessed by its thread.
+    TimerWheel Timers;
+    /// Held by the reactor's thread while handling events, and by the
+    /// coordinator while it modifies the data served by the reactor.
+    std::mutex Lock;
+    std::thread Thread;
+    /// The CPU the reactor's thread is pinned to, if any.
+    std::optional<unsigned> CPU;
+    std::size_t SessionCount = 0;
+    /// The events of the batch being handled, see \p collectEvents().
+    std::vector<std::size_t> Batch;
+  };
+  std::size_t ReactorCount;
+  std::vector<std::unique_ptr<Reactor>> Reactors;
+
+  /// Clients for whom a reactor found the connection to have failed, to be
+  /// torn down by the coordinator. The \p string contains the reason for
+  /// kicking the client, if not empty.
+  std::vector<std::pair<std::size_t, std::string>> DeferredExits;
+  std::mutex DeferredExitsLock;
+
+  /// The names of the sessions which received input on a reactor, and which
+  /// the coordinator should check the input mode of the terminal of.
+  std::vector<std::string> DeferredModeChecks;
+  std::mutex DeferredModeChecksLock;
 
   /// Map client IDs to the client information data structure.
   ///
@@ -149,16 +452,428 @@ private:
   /// \note \p unique_ptr is used so changing the map's balancing does not
   /// invalidate other references to the data.
   std::map<std::string, std::unique_ptr<SessionData>> Sessions;
+  /// Hashed index of \p Sessions by name.
+  ///
+  /// \note The keys refer to the keys of \p Sessions.
+  std::unordered_map<std::string_view, SessionData*> SessionsByName;
+  /// Index of \p Sessions by the PID of the process running in them.
+  std::unordered_map<Process::raw_handle, SessionData*> SessionsByPID;
+  /// Index of \p Sessions handed out from the \p SessionPool by the alias
+  /// they were started with.
+  std::unordered_map<std::string_view, SessionData*> SessionsByAlias;
 
-  static constexpr std::size_t DeadChildrenVecSize = 8;
-  /// A list of process handles that were signalle
-  mutable std::array<Process::raw_handle, DeadChildrenVecSize> DeadChildren;
+  /// The number of changes of the sessions so far, sent with every
+  /// notification about a change, so subscribers can detect if they missed
+  /// one. Starts from \p 1, so a client that knows no generation always gets
+  /// the state of the sessions.
+  std::uint64_t SessionGeneration = 1;
+  /// The IDs of the clients that subscribed to the changes of the sessions,
+  /// so notifying them does not visit every client.
+  std::vector<std::size_t> SessionSubscribers;
+
+  /// The number of processes to keep in the \p SessionPool.
+  std::size_t SessionPoolSize = 0;
+  /// The processes started in advance for the sessions requested later.
+  std::vector<PooledSession> SessionPool;
+  /// The number of processes ever started in the \p SessionPool, used to
+  /// create unique aliases.
+  std::size_t SessionPoolSpawned = 0;
+  /// Refills the \p SessionPool after a session was handed out from it.
+  TimerWheel::Handle SessionPoolRefill;
+
+  static constexpr std::size_t DeadChildrenVecSize = 64;
+  /// A list of process handles that were signalled as dead. The signal handler
+  /// claims any free (\p Process::Invalid) slot, and the \p loop() empties the
+  /// slots it reaps, so no locking is needed.
+  mutable std::array<std::atomic<Process::raw_handle>, DeadChildrenVecSize>
+    DeadChildren;
+  /// Set whenever a child was signalled as dead, even if there was no free slot
+  /// to record it in \p DeadChildren.
+  mutable std::atomic<bool> ChildrenDied;
 
   mutable Atomic<bool> TerminateLoop;
+  mutable Atomic<bool> UpgradeRequested;
   bool ExitIfNoMoreSessions;
+  /// Turned off by any reactor thread that finds \p splice() unsupported.
+  std::atomic<bool> SpliceRelay;
+  bool EdgeTriggered;
+  bool IOUring;
+  CoalescingLimits Coalescing;
+  ThrottleLimits Throttling;
+  std::optional<CPUSet> ServerCPUs;
+  std::optional<CPUSet> SessionCPUs;
+  /// The CPUs the server could run on before it was restricted to
+  /// \p ServerCPUs.
+  std::optional<CPUSet> InheritedCPUs;
+  std::string RecordDirectory;
+  std::string RecordPattern;
+  /// Writes the recordings of the sessions, created when the first session
+  /// is recorded.
+  std::unique_ptr<Recorder> Recordings;
+  std::string EventTracePrefix;
+  /// The recording of the coordinator's event loop, if any.
+  std::unique_ptr<EventTrace> Trace;
+  std::chrono::seconds HibernateAfter;
+  std::chrono::milliseconds ShutdownTimeout;
+  /// The directory the scrollback of hibernating sessions is saved to.
+  std::string SpillDirectory;
+  std::size_t ClientBufferLimit;
+  std::size_t ScrollbackSize;
+  std::size_t SessionLogSize;
+  std::size_t SharedRingSize;
+  bool ScreenSnapshot;
+  ResizePolicy Resizing = ResizePolicy::Latest;
+  std::size_t ListenBacklog;
+  /// Whether \p listen() was already called.
+  bool Listening = false;
   std::unique_ptr<EPoll> Poll;
+  /// The timers of the coordinator's event loop, which are run between the
+  /// batches of events.
+  TimerWheel Timers;
+
+  /// A \p statistics() report being rendered by \p requestStatistics().
+  struct StatisticsJob
+  {
+    /// The client that requested the report.
+    std::size_t Requester = 0;
+    /// The sessions and the clients to describe, as they were when the report
+    /// was requested. Those that are gone by the time they are reached are
+    /// skipped.
+    std::vector<std::string> Sessions;
+    std::vector<std::size_t> Clients;
+    std::size_t NextSession = 0;
+    std::size_t NextClient = 0;
+    std::string Output;
+  };
+  /// The number of sessions and clients a \p StatisticsJob describes in one
+  /// turn of the event loop.
+  static constexpr std::size_t StatisticsSliceSize = 16;
+  std::vector<StatisticsJob> StatisticsJobs;
+  /// Continues the first of the \p StatisticsJobs, if any.
+  TimerWheel::Handle StatisticsStep;
+
+  /// Retries accepting clients after it failed due to a lack of resources
+  /// (e.g. file descriptors), while the server socket is not listened for.
+  TimerWheel::Handle AcceptBackoff;
+  /// The current wait between the retries of accepting clients, which grows
+  /// as long as the failures persist.
+  std::chrono::milliseconds AcceptBackoffDelay{0};
+
+  /// The socket serving the metrics, if enabled.
+  std::optional<Socket> MetricsSock;
+  /// The file on which the signals of the process arrive, if set.
+  raw_fd SignalFile = fd::Invalid;
+  std::function<void()> SignalDispatch;
+  std::function<void(raw_fd)> UpgradeHandler;
+  /// The state handed over by the previous instance, restored once the
+  /// \p loop() starts.
+  std::optional<HandOverState> HandedOver;
+  /// The connections of the metrics socket not yet answered or closed.
+  std::unordered_map<raw_fd, std::unique_ptr<MetricsScraper>> Scrapers;
+  /// The number of connections of the metrics socket kept at once. More are
+  /// closed right after being accepted.
+  static constexpr std::size_t MaxScrapers = 16;
+  /// The size of the request of a connection of the metrics socket after
+  /// which it is closed without an answer.
+  static constexpr std::size_t MaxScraperRequest = 8192;
+
+  /// Accepts the connections waiting on the metrics socket.
+  void acceptScrapers();
+  /// Handles the events of the connection \p Scraper of the metrics socket.
+  void scraperCallback(MetricsScraper& Scraper,
+                       bool Incoming,
+                       bool Outgoing);
+  /// Stops listening to \p Scraper, and closes its connection.
+  void removeScraper(MetricsScraper& Scraper);
+
+  /// Accepts the clients waiting on the server socket, in a bounded batch.
+  void acceptClients();
+  /// Stops accepting clients until \p AcceptBackoff expires.
+  void backOffAccepting();
+
+  /// The time between the steps of the sweep that frees the memory which the
+  /// connections do not use anymore.
+  static constexpr std::chrono::milliseconds ReclaimInterval{1000};
+  /// The number of clients and sessions visited in one step of the sweep.
+  static constexpr std::size_t ReclaimBatch = 32;
+  /// The ID of the next client to visit in the current pass of the sweep.
+  std::size_t ReclaimClientCursor = 0;
+  /// The name of the next session to visit in the current pass of the sweep,
+  /// once all clients were visited.
+  std::optional<std::string> ReclaimSessionCursor;
+  /// The number of buffer reuses from the \p BufferPool observed at the end
+  /// of the previous pass of the sweep.
+  std::size_t ReclaimPoolReuses = 0;
+
+  /// The time between the samples of the resources used by the sessions.
+  static constexpr std::chrono::milliseconds UsageInterval{2000};
+  /// The time after the last \p usage() request after which the resources
+  /// used by the sessions are no longer sampled.
+  static constexpr std::chrono::seconds UsageLinger{30};
+  /// Takes the next sample of the resources used by the sessions, if they
+  /// were asked for recently.
+  TimerWheel::Handle UsageSampling;
+  /// When the resources used by the sessions were last asked for.
+  TimerWheel::Clock::time_point UsageRequested;
+  /// The time between the last two samples, or \p 0 if the last sample was
+  /// the first since the sampling (re)started.
+  std::chrono::milliseconds UsageSampleInterval{0};
+
+  /// The server-wide counters exported by \p metrics(). These are updated by
+  /// every event loop, without locking.
+  struct Metrics
+  {
+    /// The number of batches of events handled by the event loops.
+    Counter LoopIterations;
+    /// The time spent handling a batch of events, in microseconds.
+    Histogram LoopLatency;
+    /// The number of clients that connected.
+    Counter ClientsAccepted;
+    /// The number of clients disconnected by the server due to an error.
+    Counter ClientsKicked;
+  };
+  Metrics Stats;
+  /// Records the handling of a batch of events by an event loop, which
+  /// started at \p Started.
+  void recordBatch(std::chrono::steady_clock::time_point Started) noexcept;
+
+  /// Performs a bounded step of the sweep over the channels of every client
+  /// and session, releasing the grown buffers that are no longer needed,
+  /// even if the connection is idle. At the end of a full pass, the buffers
+  /// cached by the pool are returned to the system if none were reused since
+  /// the previous pass.
+  void reclaimResources();
+
+  /// Creates the event queue for the server or a reactor, as configured.
+  std::unique_ptr<EPoll> makePoll(std::size_t EventCount) const;
 
   void reapDeadChildren();
+  /// Reaps the process \p PID if it is dead, and destroys the session it
+  /// belonged to.
+  ///
+  /// \returns whether \p PID was the process of a session.
+  bool reapDeadChild(Process::raw_handle PID);
+  /// Snapshots the state described by a \p statistics() report into \p Job,
+  /// and renders the server-wide counters.
+  void beginStatistics(StatisticsJob& Job) const;
+  /// Renders at most \p Budget sessions and clients of \p Job.
+  ///
+  /// \returns whether the report is complete.
+  bool continueStatistics(StatisticsJob& Job, std::size_t Budget) const;
+  /// Renders the next slice of the first of the \p StatisticsJobs, and sends
+  /// the reports that are complete.
+  void stepStatistics();
+  /// Sends the report of \p Job to the client that requested it, if it is
+  /// still connected.
+  void sendStatistics(StatisticsJob& Job);
+  /// Completes each of the \p StatisticsJobs right away, and sends them.
+  void finishStatistics();
+
+  /// Tears down the clients in \p DeferredExits.
+  void handleDeferredExits();
+  /// Checks the input mode of the sessions in \p DeferredModeChecks.
+  void handleDeferredModeChecks();
+
+  /// Starts the reactor threads, with each reactor able to handle at most
+  /// \p EventCount events at once.
+  void startReactors(std::size_t EventCount);
+  /// Stops and joins the reactor threads.
+  void stopReactors();
+  /// Sends what is buffered for the clients, as their connections become
+  /// writable, until every notification is sent, or \p Deadline passes.
+  void flushClientsUntil(std::chrono::steady_clock::time_point Deadline);
+  /// Hangs up the programs of the sessions, and reaps them as they exit, until
+  /// all of them did, or \p Deadline passes.
+  void terminateSessionsUntil(std::chrono::steady_clock::time_point Deadline);
+  /// Starts recording the event loop of \p Poll into the Nth trace file, if
+  /// \p setEventTrace() was called.
+  std::unique_ptr<EventTrace> startTrace(EPoll& Poll, std::size_t N);
+  /// Restricts the calling thread to \p CPUs, logging if it failed.
+  static void pinThread(const CPUSet& CPUs, std::string_view Name);
+  /// \returns the CPUs the programs of the sessions should run on.
+  std::optional<CPUSet> sessionAffinity() const;
+  /// Sets up the event loop of the coordinator, and starts the reactors, if
+  /// it was not done yet.
+  void prepareLoop();
+  /// The event loop executed by a reactor thread.
+  void reactorLoop(Reactor& R);
+  /// Locks every reactor, so the coordinator may freely modify sessions and
+  /// clients handled by them.
+  std::vector<std::unique_lock<std::mutex>> lockReactors();
+
+  /// The events of the batch being handled by the coordinator.
+  std::vector<std::size_t> Batch;
+
+  /// Collects the indices of the \p Count events received by the last
+  /// \p wait() of \p Poll into \p Batch, ordered so that the connections of
+  /// clients are handled first, as they carry keystrokes and requests that a
+  /// user is waiting on, and the output of sessions last.
+  ///
+  /// \note The events must be fetched from \p Poll only when they are
+  /// handled, as handling an earlier event might stop the files of a later
+  /// one.
+  static void collectEvents(EPoll& Poll,
+                            std::size_t Count,
+                            std::vector<std::size_t>& Batch);
+  /// Dispatches the \p Event that fired in \p Poll to the appropriate callback
+  /// of the entity found in \p Lookup.
+  void handleEvent(EPoll& Poll, LookupMap& Lookup, EPoll::EventWithMode Event);
+
+  /// \returns the reactor handling the connections of \p Session, or
+  /// \p nullptr if the session is handled by the coordinator.
+  Reactor* reactorOf(const SessionData& Session) const noexcept;
+  /// \returns the reactor handling the data connection of \p Client, or
+  /// \p nullptr if the connection is handled by the coordinator.
+  Reactor* reactorOf(const ClientData& Client) const noexcept;
+  EPoll& pollOf(Reactor* R) const noexcept { return R ? *R->Poll : *Poll; }
+  /// \returns the recording of the event loop handling the connections of
+  /// \p R, or the coordinator, if it is recorded.
+  EventTrace* traceOf(Reactor* R) const noexcept
+  {
+    return R ? R->Trace.get() : Trace.get();
+  }
+  LookupMap& lookupOf(Reactor* R) noexcept
+  {
+    return R ? R->FDLookup : FDLookup;
+  }
+  /// Moves listening for the data connection of \p Client from the \p From
+  /// reactor to the \p To reactor.
+  void moveDataSocket(ClientData& Client, Reactor* From, Reactor* To);
+  /// Kicks the \p Client (if \p KickReason is not empty) and fires
+  /// \p exitCallback() for it. If the client is handled by a reactor, this is
+  /// deferred to the coordinator.
+  void clientFailed(ClientData& Client, std::string KickReason);
+
+  /// Relays the pending output of \p Session to the only attached \p Client
+  /// through the session's relay pipe.
+  ///
+  /// \returns the number of bytes relayed, which is \p 0 if the relay could
+  /// not be used, and the data must be sent through the buffered channels
+  /// instead.
+  std::size_t spliceDataToClient(SessionData& Session, ClientData& Client);
+  /// Reads one chunk of the data sent by \p Client and relays it to the
+  /// attached session.
+  ///
+  /// \returns whether there could be more data pending, and the \p Client is
+  /// still alive to read again.
+  bool relayClientData(ClientData& Client);
+  /// Reads one chunk of the output of \p Session and relays it to the
+  /// attached clients.
+  ///
+  /// \returns the number of bytes relayed. If non-zero, there could be more
+  /// data pending.
+  std::size_t relaySessionData(SessionData& Session);
+  /// \returns whether \p Client does not accept output from its session,
+  /// either because too much is buffered for it, or output is being dropped.
+  bool clientSaturated(ClientData& Client) const noexcept;
+  /// \returns whether too much is buffered for the data connection \p DS of a
+  /// client for it to accept more output.
+  bool channelSaturated(const Socket& DS) const noexcept;
+  /// \returns the number of bytes buffered for a client after which it is
+  /// considered saturated.
+  std::size_t effectiveClientBufferLimit() const noexcept;
+  /// \returns whether every interactive client of \p Session is saturated.
+  /// Read-only clients are not considered, so they never pause the session.
+  bool driversSaturated(SessionData& Session) const noexcept;
+  /// Suspends or resumes reading the output of \p Session, depending on
+  /// whether every attached client is saturated, or the session is
+  /// \p throttled().
+  void updateSessionFlow(SessionData& Session);
+  /// \returns whether \p Session has been idle and detached for long enough to
+  /// start hibernating.
+  bool shouldHibernate(SessionData& Session) const;
+  /// Releases the resources of the idle \p Session.
+  void hibernateSession(SessionData& Session);
+  /// Ends the hibernation of \p Session, if it was hibernating.
+  void wakeSession(SessionData& Session);
+  /// Accounts for the \p Bytes of output read from \p Session against the
+  /// rate it is limited to, and suspends reading it if the limit is reached.
+  void throttleSession(SessionData& Session, std::size_t Bytes);
+  /// Fired after the buffered output of \p Client was (partially) sent.
+  void clientDrained(ClientData& Client);
+  /// Reserves a slot in the \p SharedRing of \p Session for \p Client, which
+  /// had just attached to it.
+  ///
+  /// \returns whether the client can read the output of the session from the
+  /// ring, once \p activateSharedRing().
+  bool attachSharedRing(ClientData& Client, SessionData& Session);
+  /// Starts publishing the output of the attached session to \p Client in the
+  /// \p SharedRing, instead of sending it over the data connection, once the
+  /// output buffered for the connection was sent.
+  void activateSharedRing(ClientData& Client);
+  /// Releases the slot of \p Client in the \p SharedRing of \p Session.
+  void detachSharedRing(ClientData& Client, SessionData& Session);
+  /// Publishes \p Data, the output of \p Session, in the session's
+  /// \p SharedRing, and wakes up the clients waiting for it.
+  void publishSessionOutput(SessionData& Session, std::string_view Data);
+  /// Starts recording the output of \p Session, if enabled for it.
+  void startRecording(SessionData& Session);
+  /// Records \p Data, the output of \p Session, in the session's log,
+  /// scrollback, screen and recording, whichever are enabled.
+  void recordOutput(SessionData& Session, std::string_view Data);
+  /// Sends \p Data, the output of \p Session, to the attached clients.
+  void sendSessionOutput(SessionData& Session, std::string_view Data);
+  /// Sends the output of \p Session that was held back, if the delay of the
+  /// session's \p OutputCoalescer expired.
+  void coalescingTimerCallback(SessionData& Session);
+  /// Resumes reading the output of \p Session, if the rate it is limited to
+  /// allows it again.
+  void throttleTimerCallback(SessionData& Session);
+  /// Records the \p Size of the terminal of \p Client, and resizes the
+  /// terminal of the attached session accordingly.
+  void clientResized(ClientData& Client, WindowSize Size);
+  /// \returns the size the terminal of \p Session should have, according to
+  /// the \p ResizePolicy.
+  std::optional<WindowSize> effectiveWindowSize(SessionData& Session) const;
+  /// Sets the effective size of the terminal of \p Session, if the
+  /// \p ResizeInterval since the last change passed, or schedules setting it
+  /// at the end of the interval.
+  void resizeSession(SessionData& Session);
+  /// Sets the effective size of the terminal of \p Session.
+  void applyWindowSize(SessionData& Session);
+  /// Queries how the terminal of \p Session handles the input, and notifies
+  /// the attached clients if it changed since the last query.
+  void checkInputMode(SessionData& Session);
+  /// Has \p checkInputMode() executed for \p Session by the coordinator,
+  /// either immediately, or deferred if called from a reactor.
+  void requestInputModeCheck(SessionData& Session);
+  /// Sends the most recently seen input mode of the terminal of \p Session to
+  /// \p Client.
+  void sendInputMode(ClientData& Client, const SessionData& Session);
+
+  /// \returns the state of \p Session, as tracked by the clients subscribed
+  /// to the changes of the sessions.
+  static message::SessionStatus sessionStatus(const SessionData& Session);
+  /// Subscribes (or unsubscribes) \p Client to the changes of the sessions.
+  void setSessionSubscriber(ClientData& Client, bool Subscribed);
+  /// Increments the \p SessionGeneration, and notifies the subscribed
+  /// clients that \p Session changed.
+  void notifySessionChange(const SessionData& Session,
+                           message::notification::SessionChange::ChangeKind
+                             Change);
+  /// Sends \p Msg to every client subscribed to the changes of the sessions.
+  void broadcastSessionChange(const message::notification::SessionChange& Msg);
+
+  /// \returns the options the processes of the \p SessionPool are started
+  /// with, without the variables identifying the session.
+  Process::SpawnOptions pooledSessionOptions() const;
+  /// Starts processes in the \p SessionPool until it is full.
+  void refillSessionPool();
+  /// Schedules refilling the \p SessionPool \p After some time, if it is not
+  /// yet scheduled.
+  void scheduleSessionPoolRefill(std::chrono::milliseconds After);
+  /// Takes a process from the \p SessionPool, if there is one that was started
+  /// with the same \p Opts as a session requested to be created.
+  std::optional<PooledSession>
+  takePooledSession(const Process::SpawnOptions& Opts);
+  /// \returns whether \p Name is the alias of a process waiting in the
+  /// \p SessionPool.
+  bool isPooledAlias(std::string_view Name) const noexcept;
+  /// Reaps the process \p PID if it is in the \p SessionPool.
+  ///
+  /// \returns whether \p PID was a process of the pool.
+  bool reapPooledSession(Process::raw_handle PID);
+
   /// Sends a connection accpetance message to the client.
   void sendAcceptClient(ClientData& Client);
   /// Sends a rejection message to the client.
@@ -202,20 +917,38 @@ public:
   /// had died. This function is meaningful to be called from a signal handler.
   /// The server's \p loop() will take care of destroying the session in its
   /// normal iteration.
+  ///
+  /// \note Children that can not be recorded (or whose signal was merged with
+  /// another one by the system) are found by the \p loop() waiting for any
+  /// dead child.
   void registerDeadChild(Process::raw_handle PID) const noexcept;
 
   /// The callback function that is fired when a new \p Client connected.
   void acceptCallback(ClientData& Client);
+  /// Starts handling the control messages of \p Client in the loop.
+  void listenOnControlSocket(ClientData& Client);
   /// The callback function that is fired for transmission on a \p Client's
   /// control connection. This method deals with parsing a \p Message
   /// from the control connection, and fire a message-specific handler.
   ///
   /// \see registerMessageHandler().
   void controlCallback(ClientData& Client);
+  /// Parses a single, fully received control message \p Data of \p Client,
+  /// and fires the message-specific handler.
+  ///
+  /// \note The handler might destroy \p Client.
+  void handleControlMessage(ClientData& Client, std::string_view Data);
   /// The clalback function that is fired for transmission on a \p Client's
   /// data connection. It sends the data received to the session the client
   /// attached to.
   void dataCallback(ClientData& Client);
+  /// The callback function that is fired for transmission on the connection
+  /// of a multiplexed \p Client, after the control messages were handled.
+  /// It relays the data received, and flushes both of the streams.
+  void multiplexedCallback(EPoll& Poll,
+                           ClientData& Client,
+                           bool Incoming,
+                           bool Outgoing);
   /// The callback function that is fired when a \p Client has disconnected.
   void exitCallback(ClientData& Client);
 
@@ -228,12 +961,44 @@ public:
   /// The callback function that is fired when a \p Client attaches to a
   /// \p Session.
   void clientAttachedCallback(ClientData& Client, SessionData& Session);
+  /// Sends the snapshot of the screen, or the output kept in the scrollback
+  /// of \p Session to the \p Client that had attached to it.
+  ///
+  /// \returns whether any output was sent.
+  bool replayScrollback(ClientData& Client, SessionData& Session);
+  /// \returns the snapshot of the screen, or the output kept in the
+  /// scrollback of \p Session, whichever is enabled.
+  std::string recentOutput(SessionData& Session) const;
   /// The callback function that is fired when a \p Client had detached from a
-  /// \p Session.
+  /// \p Session. If the client only watched the session, it stops watching.
   void clientDetachedCallback(ClientData& Client, SessionData& Session);
+  /// The callback function that is fired when a \p Client starts watching a
+  /// \p Session, alongside the other sessions it watches.
+  ///
+  /// \returns whether the client can watch the session. With reactors, every
+  /// session a client watches must be handled by the same one, as the data
+  /// connection of the client is.
+  bool clientWatchCallback(ClientData& Client, SessionData& Session);
+  /// The callback function that is fired when a \p Client stops watching a
+  /// \p Session. The end of the output of the session is sent to the client.
+  void clientUnwatchCallback(ClientData& Client, SessionData& Session);
+  /// Stops the \p Client watching any session.
+  void clientUnwatchAll(ClientData& Client);
   /// The callback function that is fired when a \p Session is destroyed.
   void destroyCallback(SessionData& Session);
 
+  /// Hands the sessions and clients over to a new instance of the program,
+  /// which \p exec()s in place of the current one.
+  ///
+  /// \note Does not return if the upgrade succeeded.
+  void upgrade();
+  /// Collects the state of the sessions and clients to hand over. Clients
+  /// whose connection can not be taken over are left out.
+  HandOverState handOver();
+  /// Takes over the sessions and clients from the \p State handed over by
+  /// the previous instance of the program.
+  void restore(HandOverState& State);
+
   /// A special step during the handshake maneuvre is when a user client
   /// connects to the server again, and establishes itself as the data
   /// connection of its own already existing control client.
@@ -241,16 +1006,62 @@ public:
   /// This method takes care of associating that in the \p Clients map.
   void turnClientIntoDataOfOtherClient(ClientData& MainClient,
                                        ClientData& DataClient);
+  /// The single round-trip alternative of the handshake is when the user
+  /// client passes the data connection over the control connection.
+  ///
+  /// This method takes care of associating the \p Connection as the data
+  /// connection of \p Client.
+  void attachDataSocket(ClientData& Client, fd&& Connection);
+  /// Starts listening on the data connection of \p Client that was just
+  /// established.
+  void listenOnDataSocket(ClientData& Client);
+  /// \returns whether the server can carry the control messages and the data
+  /// of clients over the same connection. The streams of such a connection
+  /// must be handled together, which is only done if the coordinator handles
+  /// every connection, and the events are level-triggered.
+  bool canMultiplex() const noexcept
+  {
+    return !ReactorCount && !EdgeTriggered;
+  }
+  /// Switches the connection of \p Client to carry both the control messages
+  /// and the data, framed by \p MuxedSocket, after the handshake response was
+  /// sent.
+  void multiplexClient(ClientData& Client);
 
   /// \returns a statistical breakdown of the state of the server and the
   /// connections handled. This data is not meant to be machine-readable!
   std::string statistics() const;
+  /// Renders the \p statistics() for \p Client a few sessions and clients at
+  /// a time, between the batches of events, and sends the report to it once
+  /// done, so a large report does not stall the connections served.
+  void requestStatistics(ClientData& Client);
+
+  /// \returns the current values of the counters kept by the server, and the
+  /// connections handled, in a machine-readable format.
+  message::response::Metrics metrics() const;
+
+  /// \returns the resources used by the sessions, as last sampled. Sampling
+  /// is started by the first call, and continues every \p UsageInterval
+  /// until no call is made for \p UsageLinger.
+  message::response::Usage usage();
 
 private:
-  /// Maps \p MessageKind to handler functions.
-  std::map<std::uint16_t, std::function<HandlerFunction>> Dispatch;
+  /// Samples the resources used by each session, and schedules the next
+  /// sample, if needed.
+  void sampleUsage();
+
+  /// A table mapping \p MessageKind to handler functions.
+  using DispatchTable =
+    std::array<HandlerFunction*, message::MessageKindCount>;
+  /// Maps \p MessageKind to the built-in handler functions. This table is
+  /// built at compile time from \p Dispatch.ipp.
+  static const DispatchTable Dispatch;
+  /// The handlers set by \p registerMessageHandler(), indexed by the message
+  /// kind, which take precedence over \p Dispatch. Empty unless a handler was
+  /// overridden.
+  std::vector<std::function<HandlerFunction>> DispatchOverrides;
 
-  void setUpDispatch();
+  static constexpr DispatchTable makeDispatch() noexcept;
 
 #define DISPATCH(KIND, FUNCTION_NAME)                                          \
   static void FUNCTION_NAME(                                                   \
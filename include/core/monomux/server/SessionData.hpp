@@ -19,17 +19,53 @@
 #pragma once
 #include <cassert>
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <utility>
 
+#include "monomux/adt/Metric.hpp"
+#include "monomux/system/Compression.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
+#include "monomux/system/OutputThrottle.hpp"
+#include "monomux/system/Scrollback.hpp"
+#include "monomux/system/SessionLog.hpp"
+#include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
+#include "monomux/system/Pty.hpp"
+#include "monomux/system/Recorder.hpp"
+#include "monomux/system/ScreenState.hpp"
+#include "monomux/system/SharedRing.hpp"
+#include "monomux/system/Time.hpp"
+#include "monomux/system/TimerWheel.hpp"
+
+namespace monomux
+{
+class Socket;
+} // namespace monomux
 
 namespace monomux::server
 {
 
 class ClientData;
 
+/// The size of a terminal, in characters.
+struct WindowSize
+{
+  unsigned short Rows;
+  unsigned short Columns;
+
+  bool operator==(const WindowSize& RHS) const noexcept
+  {
+    return Rows == RHS.Rows && Columns == RHS.Columns;
+  }
+  bool operator!=(const WindowSize& RHS) const noexcept
+  {
+    return !(*this == RHS);
+  }
+};
+
 /// Encapsulates a running session under the server owning the instance.
 class SessionData
 {
@@ -39,16 +75,24 @@ public:
   {}
 
   const std::string& name() const noexcept { return Name; }
+  /// \returns the name the process of the session was started with, if it
+  /// was started in advance, before the session was requested.
+  const std::string& alias() const noexcept { return Alias; }
+  void setAlias(std::string Alias) noexcept { this->Alias = std::move(Alias); }
   std::chrono::time_point<std::chrono::system_clock>
   whenCreated() const noexcept
   {
     return Created;
   }
+  void setCreated(std::chrono::time_point<std::chrono::system_clock> When)
+  {
+    Created = When;
+  }
   std::chrono::time_point<std::chrono::system_clock> lastActive() const noexcept
   {
     return LastActivity;
   }
-  void activity() noexcept { LastActivity = std::chrono::system_clock::now(); }
+  void activity() noexcept { LastActivity = CoarseClock::now(); }
 
   bool hasProcess() const noexcept { return MainProcess.has_value(); }
   void setProcess(Process&& Process) noexcept;
@@ -84,10 +128,216 @@ public:
     return &getProcess().getPty()->writer();
   }
 
+  /// \returns the index of the server's reactor thread handling the
+  /// connections of the session, if it is not handled by the main thread.
+  std::optional<std::size_t> getReactor() const noexcept { return Reactor; }
+  void setReactor(std::optional<std::size_t> Index) noexcept
+  {
+    Reactor = Index;
+  }
+
+  /// \returns the intermediate pipe through which data of the session can be
+  /// relayed to a client without copying it through userspace. The pipe is
+  /// created on the first call.
+  Pipe::AnonymousPipe& getRelayPipe();
+
+  /// \returns the compressor of the output of the session, which is shared by
+  /// the clients receiving the output compressed. The compressor is created
+  /// on the first call.
+  Deflater& getCompressor();
+
+  /// \returns the ring the output of the session is published in for the
+  /// clients reading it from shared memory, if any such client is attached.
+  SharedRing* getRing() noexcept { return Ring ? &*Ring : nullptr; }
+  /// Reserves a slot in the \p getRing(), which is created with \p Capacity
+  /// bytes if it does not exist yet.
+  ///
+  /// \returns \p nullopt if every slot is taken.
+  std::optional<std::size_t> acquireRingSlot(std::size_t Capacity);
+  /// Releases the \p Slot of the \p getRing(), and the ring itself, once no
+  /// slot is used.
+  void releaseRingSlot(std::size_t Slot) noexcept;
+
+  /// Releases the \p getRelayPipe() and the \p getCompressor(), which are
+  /// created again when next needed.
+  void releaseRelayResources() noexcept;
+
+  /// \returns whether the session is hibernating: it was detached and idle for
+  /// long enough that the resources used for relaying its output were
+  /// released.
+  bool hibernating() const noexcept { return Hibernating; }
+  void setHibernating(bool Hibernate) noexcept
+  {
+    if (Hibernate && !Hibernating)
+      Stats.Hibernations.add();
+    Hibernating = Hibernate;
+  }
+
+  /// \returns whether reading the output of the session is suspended, because
+  /// none of the attached clients can accept more of it.
+  bool readingPaused() const noexcept { return ReadingPaused; }
+  void setReadingPaused(bool Paused) noexcept
+  {
+    if (Paused && !ReadingPaused)
+      Stats.ReadPauses.add();
+    ReadingPaused = Paused;
+  }
+
+  /// The running counters of the session's relay activity, exported by the
+  /// server's metrics.
+  struct Metrics
+  {
+    /// The number of bytes relayed to clients with \p splice().
+    Counter SplicedBytes;
+    /// The number of times reading the session's output was suspended.
+    Counter ReadPauses;
+    /// The number of times reading the session's output was suspended by the
+    /// \p OutputThrottle.
+    Counter Throttles;
+    /// The number of times the session started hibernating.
+    Counter Hibernations;
+  };
+  const Metrics& metrics() const noexcept { return Stats; }
+  Metrics& metrics() noexcept { return Stats; }
+
+  /// The resources used by the session, as sampled by \p Server::usage().
+  struct UsageSample
+  {
+    /// When the sample was taken, or the epoch if never.
+    TimerWheel::Clock::time_point When;
+    std::uint64_t OutputBytes = 0;
+    /// The output, in bytes per second, since the previous sample.
+    std::uint64_t OutputRate = 0;
+    std::chrono::microseconds CPUTime{0};
+    /// The CPU time used since the previous sample, in thousandths of the
+    /// time passed.
+    std::uint64_t CPUPermille = 0;
+    std::uint64_t RSSBytes = 0;
+  };
+  const UsageSample& getUsage() const noexcept { return Usage; }
+  UsageSample& getUsage() noexcept { return Usage; }
+
+  /// \returns the coalescer deciding when the output of the session is sent
+  /// to the attached clients, if output coalescing is enabled for the session.
+  OutputCoalescer* getCoalescer() noexcept
+  {
+    return Coalescer ? &*Coalescer : nullptr;
+  }
+  void setCoalescing(CoalescingLimits Limits) { Coalescer.emplace(Limits); }
+
+  /// \returns the limiter of the rate the output of the session is read at,
+  /// if output throttling is enabled for the session.
+  OutputThrottle* getThrottle() noexcept
+  {
+    return Throttle ? &*Throttle : nullptr;
+  }
+  const OutputThrottle* getThrottle() const noexcept
+  {
+    return Throttle ? &*Throttle : nullptr;
+  }
+  void setThrottle(ThrottleLimits Limits) { Throttle.emplace(Limits); }
+  /// \returns whether reading the output of the session is suspended because
+  /// it exceeded the rate it is limited to.
+  bool throttled() const noexcept { return Throttle && Throttle->throttled(); }
+
+  /// \returns the output of the session that was read, but is held back by
+  /// the \p OutputCoalescer from being sent to the clients.
+  std::string& getPendingOutput() noexcept { return PendingOutput; }
+
+  /// \returns the recent output of the session that is replayed to clients
+  /// attaching, if enabled for the session.
+  Scrollback* getScrollback() noexcept { return History ? &*History : nullptr; }
+  void setScrollback(std::size_t Limit) { History.emplace(Limit); }
+
+  /// \returns the on-disk log of the output of the session, if enabled for
+  /// the session. If set, it is used instead of the \p Scrollback.
+  SessionLog* getLog() noexcept { return Log ? &*Log : nullptr; }
+  void setLog(std::string PathPrefix, std::size_t Limit)
+  {
+    Log.emplace(std::move(PathPrefix), Limit);
+  }
+
+  /// \returns the recording of the session's output, if the session is
+  /// recorded.
+  Recording* getRecording() noexcept { return Rec.get(); }
+  const Recording* getRecording() const noexcept { return Rec.get(); }
+  void setRecording(std::shared_ptr<Recording> R) noexcept
+  {
+    Rec = std::move(R);
+  }
+
+  /// \returns the tracked contents of the screen of the session, which is
+  /// drawn to clients attaching, if enabled for the session.
+  ScreenState* getScreen() noexcept { return Screen ? &*Screen : nullptr; }
+  void setScreen() { Screen.emplace(); }
+
+  /// The state of setting the size of the terminal of the session, which is
+  /// done at most once in every \p Server::ResizeInterval.
+  struct ResizeState
+  {
+    /// The size most recently reported by any of the clients.
+    std::optional<WindowSize> Requested;
+    /// The size the terminal was most recently set to.
+    std::optional<WindowSize> Applied;
+    /// When the size of the terminal was most recently set.
+    TimerWheel::Clock::time_point LastApplied;
+    /// Sets the size requested in the meantime, once the interval passed.
+    TimerWheel::Handle Timer;
+  };
+  ResizeState& getResize() noexcept { return Resize; }
+
+  /// \returns how the terminal of the session was most recently seen to
+  /// handle the input, if it was queried.
+  const std::optional<Pty::InputMode>& getInputMode() const noexcept
+  {
+    return InputMode;
+  }
+  void setInputMode(Pty::InputMode Mode) noexcept { InputMode = Mode; }
+
+  /// \returns whether the output sent by the session is recorded, and thus
+  /// must pass through the server instead of being spliced to a client.
+  bool recordsOutput() const noexcept
+  {
+    return History || Log || Screen || Rec;
+  }
+
   const std::vector<ClientData*>& getAttachedClients() const noexcept
   {
     return AttachedClients;
   }
+
+  /// The state of the attached clients that relaying the output of the
+  /// session reads for every chunk, in arrays parallel to
+  /// \p getAttachedClients(). Sending a chunk to many clients streams through
+  /// these, instead of visiting the \p ClientData, and then the connection,
+  /// of each client.
+  struct FanOut
+  {
+    enum Flag : std::uint8_t
+    {
+      ReadOnly = 1 << 0,
+      Compressed = 1 << 1,
+      OutputDropped = 1 << 2,
+      /// The output is published in the \p SharedRing of the session, and
+      /// not sent over the data connection.
+      SharedRing = 1 << 3,
+      /// The client watches the session, and the output is sent in a
+      /// \p message::SessionFrame with the tag in \p Tags.
+      Tagged = 1 << 4
+    };
+
+    /// The data connections of the clients, or \p nullptr if there is none.
+    std::vector<Socket*> Channels;
+    /// The \p Flag values of the clients.
+    std::vector<std::uint8_t> Flags;
+    /// The tags of the clients watching the session, \p 0 for the others.
+    std::vector<std::uint32_t> Tags;
+  };
+  const FanOut& getFanOut() const noexcept { return Targets; }
+  /// Updates the \p FanOut state of the attached \p Client after its data
+  /// connection or its flags changed.
+  void clientChanged(ClientData& Client) noexcept;
+
   /// \returns the \p ClientData from all attached client which \p activity()
   /// field is the newest (most recently active client).
   ClientData* getLatestClient() const;
@@ -97,6 +347,8 @@ public:
 private:
   /// A user-given identifier for the session.
   std::string Name;
+  /// The identifier of the session known to the process running in it.
+  std::string Alias;
   /// The timestamp when the session was spawned.
   std::chrono::time_point<std::chrono::system_clock> Created;
   /// The timestamp when the underlying program was most recently trasmitted
@@ -110,8 +362,48 @@ private:
   /// control, changing its image via an \p exec() call...
   std::optional<Process> MainProcess;
 
+  /// The reactor thread of the server handling the session, if any.
+  std::optional<std::size_t> Reactor;
+
+  /// The kernel-side buffer used when relaying the output of the session
+  /// with \p splice().
+  std::optional<Pipe::AnonymousPipe> RelayPipe;
+
+  std::optional<Deflater> Compressor;
+
+  /// The output published for the clients on the same host, if any of them
+  /// is attached.
+  std::optional<SharedRing> Ring;
+  /// The number of slots of \p Ring in use.
+  std::size_t RingReaders = 0;
+
+  /// Whether the session's connection is not listened for, as the clients
+  /// are saturated.
+  bool ReadingPaused = false;
+  bool Hibernating = false;
+
+  ResizeState Resize;
+  std::optional<Pty::InputMode> InputMode;
+
+  Metrics Stats;
+  UsageSample Usage;
+
+  /// Decides when the output of the session is sent, if it is coalesced.
+  std::optional<OutputCoalescer> Coalescer;
+  std::string PendingOutput;
+  /// Limits the rate the output is read at, if it is throttled.
+  std::optional<OutputThrottle> Throttle;
+
+  /// The recent output of the session sent to the clients.
+  std::optional<Scrollback> History;
+  std::optional<SessionLog> Log;
+  std::shared_ptr<Recording> Rec;
+  std::optional<ScreenState> Screen;
+
   /// The list of clients currently attached to this session.
   std::vector<ClientData*> AttachedClients;
+  /// The state of \p AttachedClients used when relaying the output.
+  FanOut Targets;
 };
 
 } // namespace monomux::server
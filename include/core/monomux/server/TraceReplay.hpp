@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <string>
+
+#include "monomux/system/EventTrace.hpp"
+#include "monomux/system/Socket.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux::server
+{
+
+class ClientData;
+class Server;
+class SessionData;
+
+/// Replays the event loop recorded by an \p EventTrace through the event
+/// handling of a \p Server.
+///
+/// The sessions and the data connections of the clients opened in the trace
+/// are created in the server, attached and detached as recorded, and torn
+/// down when the trace closes them. Every traced connection is stood in for
+/// by a connected pair of sockets: the server reads and writes one end as if
+/// it was the terminal of the session, or the connection of the client, and
+/// the replay feeds the data the traced loop read to the other end, and
+/// consumes the data the server writes.
+///
+/// Only the session and the client data connections are replayed. The
+/// events of other connections (e.g., the control messages of the clients,
+/// which are not recorded) are counted by \p skippedEvents().
+///
+/// \note The server must outlive the replay, which tears the sessions and the
+/// clients it created down when destroyed.
+class TraceReplay
+{
+public:
+  /// Prepares to replay into \p S, which event loop is set up by running an
+  /// iteration of it.
+  TraceReplay(Server& S);
+  TraceReplay(const TraceReplay&) = delete;
+  TraceReplay& operator=(const TraceReplay&) = delete;
+  ~TraceReplay();
+
+  /// Applies the changes of the connections recorded before \p B, feeds the
+  /// data read while handling \p B, and runs an iteration of the event loop of
+  /// the server.
+  ///
+  /// \returns the time the iteration took.
+  std::chrono::nanoseconds replay(const EventTraceReader::Batch& B);
+
+  /// Consumes the data the server wrote to the replayed connections, as the
+  /// program of the session, or the client, would.
+  void drain();
+
+  /// \returns the session created for the traced connection \p FD, if it is
+  /// replayed.
+  SessionData* session(raw_fd FD) const noexcept;
+  /// \returns the client created for the traced data connection \p FD, if it
+  /// is replayed.
+  ClientData* client(raw_fd FD) const noexcept;
+  /// \returns the number of bytes the server wrote to the traced connection
+  /// \p FD, while it was replayed.
+  std::size_t received(raw_fd FD) const noexcept;
+
+  /// \returns the number of bytes read by the traced loop that did not fit
+  /// the replayed connections.
+  std::size_t truncated() const noexcept { return Truncated; }
+  /// \returns the number of events of connections that are not replayed.
+  std::size_t skippedEvents() const noexcept { return Skipped; }
+
+private:
+  /// Stands in for a connection of the trace.
+  struct Connection
+  {
+    EventTrace::Role Role;
+    /// The end the replay feeds and drains.
+    Socket Remote;
+    /// The other end of the control connection of a client, which is only
+    /// drained.
+    std::optional<Socket> ControlRemote = std::nullopt;
+    SessionData* Session = nullptr;
+    ClientData* Client = nullptr;
+    std::size_t Received = 0;
+  };
+
+  Server& S;
+  std::map<raw_fd, Connection> Connections;
+  std::string Filler;
+  std::string Scratch;
+  std::size_t Truncated = 0;
+  std::size_t Skipped = 0;
+
+  void apply(const EventTraceReader::Change& C);
+  void open(raw_fd FD, EventTrace::Role Role);
+  void close(raw_fd FD);
+  /// Writes as much of \p Bytes of filler to \p Remote as fits without
+  /// blocking.
+  void feed(Socket& Remote, std::size_t Bytes);
+  /// \returns the number of bytes read from \p Remote without blocking.
+  std::size_t consume(Socket& Remote);
+};
+
+} // namespace monomux::server
@@ -0,0 +1,750 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <sys/uio.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/Trace.hpp"
+#include "monomux/adt/BufferPool.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+#include "monomux/adt/SharedChunk.hpp"
+#include "monomux/system/BufferedChannel.hpp"
+#include "monomux/system/EventTrace.hpp"
+
+namespace monomux
+{
+
+namespace detail
+{
+
+/// The storage of the buffers is shared between all channels, so connections
+/// coming and going reuse the same memory.
+class BufferedChannelBuffer : public RingBuffer<char, PooledRingStorage>
+{
+public:
+  BufferedChannelBuffer(std::size_t SizeHint) : RingBuffer(SizeHint) {}
+
+  /// A reference to a \p SharedChunk that has only been partially consumed.
+  struct SharedPart
+  {
+    SharedChunk Chunk;
+    std::size_t Offset;
+
+    std::string_view view() const noexcept { return Chunk.view(Offset); }
+  };
+
+  /// Shared chunks that are logically \e after the contents of the ring.
+  std::deque<SharedPart> Shared;
+  /// The number of unconsumed bytes in \p Shared.
+  std::size_t SharedSize = 0;
+
+  /// \returns the number of bytes stored in the ring and the shared chunks.
+  std::size_t totalSize() const noexcept { return size() + SharedSize; }
+
+  /// Saves the \p Data at the end of the buffer, by copying.
+  void append(std::string_view Data)
+  {
+    if (Data.empty())
+      return;
+    if (Shared.empty())
+    {
+      putBack(Data.data(), Data.size());
+      return;
+    }
+
+    // If there are shared chunks, the ring must not be appended to, as that
+    // would reorder the data.
+    appendShared(SharedChunk{std::string{Data}}, 0);
+  }
+
+  /// Saves the unconsumed part of \p Chunk, starting from \p Offset, at the end
+  /// of the buffer, without copying.
+  void appendShared(SharedChunk Chunk, std::size_t Offset)
+  {
+    if (Offset >= Chunk.size())
+      return;
+    SharedSize += Chunk.size() - Offset;
+    Shared.push_back(SharedPart{std::move(Chunk), Offset});
+  }
+
+  /// Fills \p Vectors with the (at most two) contiguous parts of the free
+  /// space at the end of the ring, growing it if needed, so that exactly \p N
+  /// bytes are described. The data read into them must be added with
+  /// \p commitBack().
+  ///
+  /// \returns the number of elements filled in \p Vectors.
+  std::size_t scatterBack(::iovec* Vectors, std::size_t N)
+  {
+    std::size_t Count = 0;
+    for (const Range& R : reserveBack(N))
+    {
+      if (!N)
+        break;
+      if (!R.Size)
+        continue;
+
+      const std::size_t Len = std::min(N, R.Size);
+      Vectors[Count++] = ::iovec{R.Begin, Len};
+      N -= Len;
+    }
+    return Count;
+  }
+
+  /// The maximum number of buffers to gather in one operation.
+  static constexpr std::size_t MaxVectors = 16;
+
+  /// Fills \p Vectors with the contiguous parts of the buffer, in order,
+  /// first the ring, then the shared chunks.
+  ///
+  /// \param Bytes Set to the total number of bytes described by the vectors.
+  /// \returns the number of elements filled in \p Vectors.
+  std::size_t gatherFront(std::array<::iovec, MaxVectors>& Vectors,
+                          std::size_t& Bytes) const noexcept
+  {
+    std::size_t Count = 0;
+    Bytes = 0;
+    for (const Range& R : peekFrontRanges(size()))
+      if (R.Size)
+      {
+        Vectors[Count++] = ::iovec{R.Begin, R.Size};
+        Bytes += R.Size;
+      }
+    for (auto It = Shared.begin(); It != Shared.end() && Count < MaxVectors;
+         ++It)
+    {
+      std::string_view V = It->view();
+      Vectors[Count++] =
+        ::iovec{const_cast<char*>(V.data()), V.size()}; // NOLINT
+      Bytes += V.size();
+    }
+    return Count;
+  }
+
+  /// \returns a copy of the contents of the ring and the shared chunks.
+  std::string copy() const
+  {
+    std::string Data;
+    Data.reserve(totalSize());
+    for (const Range& R : peekFrontRanges(size()))
+      Data.append(R.Begin, R.Size);
+    for (const SharedPart& Part : Shared)
+      Data.append(Part.view());
+    return Data;
+  }
+
+  /// Marks \p N bytes from the front of the buffer consumed, first from the
+  /// ring, then from the shared chunks.
+  void dropFrontAll(std::size_t N)
+  {
+    const std::size_t FromRing = std::min(N, size());
+    dropFront(FromRing);
+    dropSharedFront(N - FromRing);
+  }
+
+  /// Marks \p N bytes from the front of the shared chunks consumed.
+  void dropSharedFront(std::size_t N)
+  {
+    while (N && !Shared.empty())
+    {
+      SharedPart& Front = Shared.front();
+      const std::size_t Remaining = Front.Chunk.size() - Front.Offset;
+      const std::size_t Drop = std::min(N, Remaining);
+      Front.Offset += Drop;
+      SharedSize -= Drop;
+      N -= Drop;
+      if (Front.Offset >= Front.Chunk.size())
+        Shared.pop_front();
+    }
+  }
+};
+
+inline void throwIfChannelFailed(bool Failed)
+{
+  if (Failed)
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Channel has failed."};
+}
+inline void throwIfChannelNoRead(bool Read)
+{
+  if (!Read)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Channel does not support reading."};
+}
+inline void throwIfChannelNoWrite(bool Write)
+{
+  if (!Write)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Channel does not support writing."};
+}
+
+/// \returns the error the throwing operations raise for a channel that
+/// \p Failed, or that is not \p Supported for the operation, if any.
+inline std::error_code channelUnusable(bool Failed, bool Supported) noexcept
+{
+  if (Failed)
+    return std::make_error_code(std::errc::io_error);
+  if (!Supported)
+    return std::make_error_code(std::errc::operation_not_permitted);
+  return {};
+}
+
+/// Runs \p Operation, which returns the number of bytes transferred, and
+/// reports the errors of the underlying implementation as a failed result.
+template <typename Fn>
+BufferedChannel::Result attemptChannelOperation(std::error_code Unusable,
+                                                Fn&& Operation)
+{
+  BufferedChannel::Result R;
+  if (Unusable)
+  {
+    R.State = BufferedChannel::Status::Failed;
+    R.Error = Unusable;
+    return R;
+  }
+
+  try
+  {
+    R.Bytes = Operation();
+  }
+  catch (const std::system_error& Err)
+  {
+    R.State = BufferedChannel::Status::Failed;
+    R.Error = Err.code();
+  }
+  return R;
+}
+
+} // namespace detail
+
+/// A \p BufferedChannel of the kind \p Transport, the buffered operations of
+/// which call the low-level operations of \p Transport directly, instead of
+/// through the virtual \p readvImpl(), \p writeImpl(), and \p writevImpl().
+/// The loops of the operations are instantiated for the transport, so the
+/// system calls and the operations on the buffers are inlined into them.
+///
+/// This is what the relay of the server moves the data of the sessions
+/// through: \p Pipe and \p Socket are such channels. The operations are only
+/// direct when called through the type of the channel. Calls through a
+/// \p BufferedChannel, the embedding API, still dispatch virtually.
+///
+/// \p Transport derives from this class, and provides the non-virtual
+/// \p transportReadv(), \p transportWrite(), and \p transportWritev(), with the
+/// signatures of \p readvImpl(), \p writeImpl(), and \p writevImpl().
+///
+/// \p BufferPolicy sizes the low-level operations, see
+/// \p BufferedChannel::AdaptiveChunks.
+template <typename Transport,
+          typename BufferPolicy = BufferedChannel::AdaptiveChunks>
+class BasicBufferedChannel : public BufferedChannel
+{
+  struct DirectIO
+  {
+    using Policy = BufferPolicy;
+
+    static std::size_t readv(BufferedChannel& C,
+                             const ::iovec* Vectors,
+                             std::size_t Count,
+                             bool& Continue)
+    {
+      return static_cast<Transport&>(C).transportReadv(
+        Vectors, Count, Continue);
+    }
+    static std::size_t
+    write(BufferedChannel& C, std::string_view Buffer, bool& Continue)
+    {
+      return static_cast<Transport&>(C).transportWrite(Buffer, Continue);
+    }
+    static std::size_t writev(BufferedChannel& C,
+                              const ::iovec* Vectors,
+                              std::size_t Count,
+                              bool& Continue)
+    {
+      return static_cast<Transport&>(C).transportWritev(
+        Vectors, Count, Continue);
+    }
+  };
+
+public:
+  std::string read(std::size_t Bytes) { return readVia<DirectIO>(Bytes); }
+  std::string_view peek(std::size_t Bytes)
+  {
+    return peekVia<DirectIO>(Bytes);
+  }
+  std::size_t write(std::string_view Data) { return writeVia<DirectIO>(Data); }
+  std::size_t write(const SharedChunk& Data)
+  {
+    return writeVia<DirectIO>(Data);
+  }
+  std::size_t load(std::size_t Bytes) { return loadVia<DirectIO>(Bytes); }
+  std::size_t flushWrites() { return flushWritesVia<DirectIO>(); }
+
+  Result tryWrite(std::string_view Data) { return tryWriteVia<DirectIO>(Data); }
+  Result tryWrite(const SharedChunk& Data)
+  {
+    return tryWriteVia<DirectIO>(Data);
+  }
+  Result tryFlushWrites() { return tryFlushWritesVia<DirectIO>(); }
+  Result tryLoad(std::size_t Bytes) { return tryLoadVia<DirectIO>(Bytes); }
+  Result tryPeek(std::size_t Bytes, std::string_view& View)
+  {
+    return tryPeekVia<DirectIO>(Bytes, View);
+  }
+
+protected:
+  using BufferedChannel::BufferedChannel;
+};
+
+#define MONOMUX_CHANNEL_LOG(SEVERITY)                                          \
+  monomux::log::SEVERITY("system/BufferedChannel") << identifier() << ": "
+
+template <typename IO> std::string BufferedChannel::readVia(std::size_t Bytes)
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoRead(readable());
+
+  std::string Return;
+  Return.reserve(Bytes);
+
+  MONOMUX_PROBE(read_enter, raw(), Bytes);
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "read(" << Bytes << ")...");
+  if (std::size_t StoredBufferSize = readInBuffer())
+  {
+    Return.resize(std::min(Bytes, StoredBufferSize));
+    std::size_t BytesFromBuffer = Read->takeFront(Return.data(), Return.size());
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "read() "
+                      << "<- " << BytesFromBuffer << " bytes buffer");
+
+    Bytes -= BytesFromBuffer;
+  }
+  if (!Bytes)
+  {
+    account();
+    MONOMUX_PROBE(read_exit, raw(), Return.size());
+    return Return;
+  }
+
+  const std::size_t ChunkSize = optimalReadSize();
+  bool ContinueReading = true;
+  while (ContinueReading && Bytes > 0)
+  {
+    if (readInBuffer() >= bufferSizeMax())
+    {
+      // Leave the data in the underlying implementation until the buffer is
+      // consumed.
+      MONOMUX_CHANNEL_LOG(trace) << "(read) "
+                                 << "Buffer full!";
+      break;
+    }
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(read) "
+                      << "Request " << ChunkSize << " bytes...");
+
+    // Read the requested amount directly into the result, and anything that
+    // is extra (because the chunk is larger) directly into the buffer.
+    const std::size_t Offset = Return.size();
+    const std::size_t IntoReturn = std::min(Bytes, ChunkSize);
+    Return.resize(Offset + IntoReturn);
+
+    std::array<::iovec, 3> Vectors;
+    Vectors[0] = ::iovec{Return.data() + Offset, IntoReturn};
+    std::size_t Count = 1;
+    if (ChunkSize > IntoReturn)
+      Count +=
+        readBuffer().scatterBack(Vectors.data() + 1, ChunkSize - IntoReturn);
+
+    const std::size_t ReadSize =
+      IO::readv(*this, Vectors.data(), Count, ContinueReading);
+    Stats.ReadCalls.add();
+    EventTrace::traceIO(EventTrace::Read, raw(), ReadSize);
+    Stats.BytesRead.add(ReadSize);
+    ReadChunk = IO::Policy::adaptRead(ReadChunk, ChunkSize, ReadSize);
+    const std::size_t BytesFromRead = std::min(ReadSize, IntoReturn);
+    Return.resize(Offset + BytesFromRead);
+    if (!ReadSize)
+    {
+      MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "(read) "
+                                                   << "No more data!");
+      break;
+    }
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(read) "
+                      << "Received " << ReadSize << " bytes");
+    if (ReadSize < ChunkSize)
+      // Managed to read less data than wanted to for the current chunk.
+      // Assume no more data remaining.
+      ContinueReading = false;
+
+    if (ReadSize > IntoReturn)
+    {
+      // Anything that remained in the read chunk -- and thus already
+      // consumed from the system resource -- was read into the buffer.
+      const std::size_t BytesToSave = ReadSize - IntoReturn;
+      MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                        << "(read) "
+                        << "Buffering " << BytesToSave << " bytes");
+      Read->commitBack(BytesToSave);
+      ContinueReading = false;
+    }
+
+    Bytes -= BytesFromRead;
+  }
+
+  account();
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "read() "
+                                               << "-> " << Return.size());
+  MONOMUX_PROBE(read_exit, raw(), Return.size());
+  return Return;
+}
+
+template <typename IO>
+std::string_view BufferedChannel::peekVia(std::size_t Bytes)
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoRead(readable());
+
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "peek(" << Bytes << ")...");
+  if (!hasBufferedRead())
+    loadVia<IO>(Bytes);
+  if (!Read)
+    return {};
+
+  const auto Ranges = Read->peekFrontRanges(Bytes);
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "peek() "
+                                               << "-> " << Ranges[0].Size);
+  return std::string_view{Ranges[0].Begin, Ranges[0].Size};
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeUnbufferedVia(std::string_view& Data)
+{
+  const std::size_t ChunkSize = optimalWriteSize();
+  std::size_t BytesSent = 0;
+  bool ContinueWriting = true;
+  while (ContinueWriting && !Data.empty())
+  {
+    const std::size_t ToSend = std::min(ChunkSize, Data.size());
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "Send " << ToSend << " bytes...");
+
+    std::string_view Chunk = Data.substr(0, ToSend);
+    const std::size_t ChunkWrittenSize =
+      IO::write(*this, Chunk, ContinueWriting);
+    Stats.WriteCalls.add();
+    EventTrace::traceIO(EventTrace::Write, raw(), ChunkWrittenSize);
+    Stats.BytesWritten.add(ChunkWrittenSize);
+    WriteChunk = IO::Policy::adaptWrite(
+      WriteChunk, ToSend, ChunkWrittenSize, Data.size() > ToSend);
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "Sent " << ChunkWrittenSize << " bytes");
+
+    if (ChunkWrittenSize < ToSend)
+      // Managed to write less data than wanted to for the current chunk.
+      // This is very likely an error, and we should stop trying for now.
+      // Assume no more data remaining.
+      ContinueWriting = false;
+
+    BytesSent += ChunkWrittenSize;
+    Data.remove_prefix(ChunkWrittenSize);
+  }
+  return BytesSent;
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeVia(std::string_view Data)
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoWrite(writable());
+  const std::size_t BytesSent = writeOrBufferVia<IO>(Data);
+  throwIfWriteOverflow("write");
+  return BytesSent;
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeOrBufferVia(std::string_view Data)
+{
+  MONOMUX_PROBE(write_enter, raw(), Data.size());
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                    << "write(" << Data.size() << ")...");
+
+  // First, try to see if there is data in the write buffer that could be served
+  // first.
+  if (const std::size_t InWriteBuffer = writeInBuffer(),
+      BufferSent = flushWritesVia<IO>();
+      BufferSent < InWriteBuffer)
+  {
+    // There was data in the buffer and not all of it managed to send. We can't
+    // send Data because that would be an out-of-order send.
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(write) "
+                      << "Buffering " << Data.size() << " bytes");
+    writeBuffer().append(Data);
+    account();
+    MONOMUX_PROBE(write_exit, raw(), 0);
+    return 0;
+  }
+  if (Data.empty())
+  {
+    MONOMUX_PROBE(write_exit, raw(), 0);
+    return 0;
+  }
+
+  // If we are this point, the buffer should be clear and Data is still unsent.
+  const std::size_t BytesSent = writeUnbufferedVia<IO>(Data);
+  if (!Data.empty())
+  {
+    // Buffer anything that remained in the write chunk -- and thus already
+    // consumed from the client!
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "Buffering " << Data.size() << " bytes");
+    writeBuffer().append(Data);
+  }
+
+  account();
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "write() "
+                                               << "-> " << BytesSent);
+  MONOMUX_PROBE(write_exit, raw(), BytesSent);
+  return BytesSent;
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeVia(const SharedChunk& Data)
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoWrite(writable());
+  const std::size_t BytesSent = writeOrBufferVia<IO>(Data);
+  throwIfWriteOverflow("write");
+  return BytesSent;
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeOrBufferVia(const SharedChunk& Data)
+{
+  MONOMUX_PROBE(write_enter, raw(), Data.size());
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                    << "write(shared " << Data.size() << ")...");
+
+  if (const std::size_t InWriteBuffer = writeInBuffer(),
+      BufferSent = flushWritesVia<IO>();
+      BufferSent < InWriteBuffer)
+  {
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(write) "
+                      << "Referencing " << Data.size() << " bytes");
+    writeBuffer().appendShared(Data, 0);
+    account();
+    MONOMUX_PROBE(write_exit, raw(), 0);
+    return 0;
+  }
+  if (Data.empty())
+  {
+    MONOMUX_PROBE(write_exit, raw(), 0);
+    return 0;
+  }
+
+  std::string_view Unsent = Data.view();
+  const std::size_t BytesSent = writeUnbufferedVia<IO>(Unsent);
+  if (!Unsent.empty())
+  {
+    // Instead of copying the remainder, only keep a reference to it.
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "Referencing " << Unsent.size() << " bytes");
+    writeBuffer().appendShared(Data, BytesSent);
+  }
+
+  account();
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "write() "
+                                               << "-> " << BytesSent);
+  MONOMUX_PROBE(write_exit, raw(), BytesSent);
+  return BytesSent;
+}
+
+template <typename IO> std::size_t BufferedChannel::loadVia(std::size_t Bytes)
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoRead(readable());
+
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "load(" << Bytes << ")...");
+  const std::size_t ChunkSize = optimalReadSize();
+  bool ContinueReading = true;
+  std::size_t ReadBytes = 0;
+  while (ContinueReading && Bytes > 0)
+  {
+    if (readInBuffer() >= bufferSizeMax())
+    {
+      MONOMUX_CHANNEL_LOG(trace) << "(load) "
+                                 << "Buffer full!";
+      break;
+    }
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(load) "
+                      << "Request " << ChunkSize << " bytes...");
+
+    // Read directly into the free space of the buffer.
+    std::array<::iovec, 2> Vectors;
+    const std::size_t Count =
+      readBuffer().scatterBack(Vectors.data(), ChunkSize);
+    const std::size_t ReadSize =
+      IO::readv(*this, Vectors.data(), Count, ContinueReading);
+    Stats.ReadCalls.add();
+    EventTrace::traceIO(EventTrace::Read, raw(), ReadSize);
+    Stats.BytesRead.add(ReadSize);
+    ReadChunk = IO::Policy::adaptRead(ReadChunk, ChunkSize, ReadSize);
+    if (!ReadSize)
+    {
+      MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "(load) "
+                                                   << "No more data!");
+      break;
+    }
+
+    ReadBytes += ReadSize;
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(load) "
+                      << "Received " << ReadSize << " bytes");
+    if (ReadSize < ChunkSize)
+      // Managed to read less data than wanted to for the current chunk.
+      // Assume no more data remaining.
+      ContinueReading = false;
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(load) "
+                      << "Storing " << ReadSize << " bytes");
+    Read->commitBack(ReadSize);
+
+    Bytes -= std::min(ReadSize, Bytes);
+  }
+
+  account();
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "load() "
+                                               << "-> " << ReadBytes);
+  return ReadBytes;
+}
+
+template <typename IO> std::size_t BufferedChannel::flushWritesVia()
+{
+  detail::throwIfChannelFailed(failed());
+  detail::throwIfChannelNoWrite(writable());
+  if (!hasBufferedWrite())
+    return 0;
+
+  MONOMUX_PROBE(flush_enter, raw(), writeInBuffer());
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                    << "flush(" << writeInBuffer() << ")...");
+  std::size_t BytesSent = 0;
+  bool ContinueWriting = true;
+  while (ContinueWriting && hasBufferedWrite())
+  {
+    // Send the (potentially wrapped around) contents of the ring, and the
+    // referenced shared chunks, in one operation.
+    std::array<::iovec, OpaqueBufferType::MaxVectors> Vectors;
+    std::size_t VectorsSize = 0;
+    const std::size_t Count = Write->gatherFront(Vectors, VectorsSize);
+    const std::size_t ChunkBytesSent =
+      IO::writev(*this, Vectors.data(), Count, ContinueWriting);
+    Stats.WriteCalls.add();
+    EventTrace::traceIO(EventTrace::Write, raw(), ChunkBytesSent);
+    Stats.BytesWritten.add(ChunkBytesSent);
+    BytesSent += ChunkBytesSent;
+
+    MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace)
+                      << "(flush) "
+                      << "<- " << ChunkBytesSent << " bytes buffer");
+
+    if (ChunkBytesSent < VectorsSize)
+      // If we managed to send less data then the chunk size, something is
+      // wrong and writing should stop. But only the actually sent bytes
+      // should be removed from the buffer!
+      ContinueWriting = false;
+
+    Write->dropFrontAll(ChunkBytesSent);
+  }
+  account();
+  MONOMUX_TRACE_LOG(MONOMUX_CHANNEL_LOG(trace) << "flush() "
+                                               << "-> " << BytesSent);
+  MONOMUX_PROBE(flush_exit, raw(), BytesSent);
+
+  return BytesSent;
+}
+
+template <typename IO>
+BufferedChannel::Result BufferedChannel::tryWriteVia(std::string_view Data)
+{
+  Result R = detail::attemptChannelOperation(
+    detail::channelUnusable(failed(), writable()),
+    [this, Data] { return writeOrBufferVia<IO>(Data); });
+  if (R.ok() && writeOverflowed("write"))
+    R.State = Status::Overflow;
+  return R;
+}
+
+template <typename IO>
+BufferedChannel::Result BufferedChannel::tryWriteVia(const SharedChunk& Data)
+{
+  Result R = detail::attemptChannelOperation(
+    detail::channelUnusable(failed(), writable()),
+    [this, &Data] { return writeOrBufferVia<IO>(Data); });
+  if (R.ok() && writeOverflowed("write"))
+    R.State = Status::Overflow;
+  return R;
+}
+
+template <typename IO>
+BufferedChannel::Result BufferedChannel::tryFlushWritesVia()
+{
+  return detail::attemptChannelOperation(
+    detail::channelUnusable(failed(), writable()),
+    [this] { return flushWritesVia<IO>(); });
+}
+
+template <typename IO>
+BufferedChannel::Result BufferedChannel::tryLoadVia(std::size_t Bytes)
+{
+  return detail::attemptChannelOperation(
+    detail::channelUnusable(failed(), readable()),
+    [this, Bytes] { return loadVia<IO>(Bytes); });
+}
+
+template <typename IO>
+BufferedChannel::Result BufferedChannel::tryPeekVia(std::size_t Bytes,
+                                                    std::string_view& View)
+{
+  View = {};
+  return detail::attemptChannelOperation(
+    detail::channelUnusable(failed(), readable()), [this, Bytes, &View] {
+      View = peekVia<IO>(Bytes);
+      return View.size();
+    });
+}
+
+#undef MONOMUX_CHANNEL_LOG
+
+} // namespace monomux
@@ -17,12 +17,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
+#include <sys/uio.h>
+
+#include "monomux/adt/Metric.hpp"
+#include "monomux/adt/SharedChunk.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
 #include "monomux/system/Channel.hpp"
 
@@ -50,6 +58,9 @@ class BufferedChannelBuffer;
 /// read/write that many data. In some cases, reading \p N bytes might consume
 /// a larger amount from the kernel-backed data structure, in which case the
 /// tail end is dropped.
+///
+/// \see BasicBufferedChannel, which performs the operations of a known kind of
+/// channel without calling the low-level operations virtually.
 class BufferedChannel : public Channel
 {
   using OpaqueBufferType = detail::BufferedChannelBuffer;
@@ -57,7 +68,95 @@ class BufferedChannel : public Channel
 public:
   /// The initial size of the buffers that are allocated for a
   /// \p BufferedChannel.
+  ///
+  /// \note The buffers are only allocated when data first has to be buffered,
+  /// and are released again by \p tryFreeResources() after staying empty for
+  /// \p IdleRelease.
   static constexpr std::size_t BufferSize = 1ULL << 14; // 16 KiB
+  /// The time a buffer must stay empty before \p tryFreeResources() releases
+  /// its storage.
+  static constexpr std::chrono::seconds IdleRelease{10};
+  /// The default size when the dynamic size of a buffer triggers a
+  /// \p buffer_overflow.
+  static constexpr std::size_t DefaultBufferSizeMax = 1ULL << 31; // 2 GiB
+  static_assert(BufferSize < DefaultBufferSizeMax,
+                "Default constructed buffer would throw");
+
+  /// \returns the size of the buffers of a single channel when writing more
+  /// triggers a \p buffer_overflow, and reading stops taking data from the
+  /// underlying implementation.
+  static std::size_t bufferSizeMax() noexcept;
+  /// Sets the per-channel limit returned by \p bufferSizeMax(), for every
+  /// channel.
+  static void setBufferSizeMax(std::size_t Size) noexcept;
+
+  /// \returns the number of bytes that all channels together might buffer
+  /// before \p overBudget() reports backpressure. \p 0 if unlimited.
+  static std::size_t globalBudget() noexcept;
+  static void setGlobalBudget(std::size_t Size) noexcept;
+  /// \returns the number of bytes currently held in the buffers of all
+  /// channels.
+  static std::size_t globalBufferedBytes() noexcept;
+
+  /// The bounds of the dynamically adapted sizes of single low-level read or
+  /// write operations, as reported by \p optimalReadSize() and
+  /// \p optimalWriteSize().
+  static constexpr std::size_t MinChunkSize = 1ULL << 12; // 4 KiB
+  static constexpr std::size_t MaxChunkSize = 1ULL << 16; // 64 KiB
+
+  /// The default sizing of the low-level operations: the size of a single
+  /// read or write grows while the operations transfer full chunks, and
+  /// shrinks while they only transfer a fraction.
+  struct AdaptiveChunks
+  {
+    /// \returns the size of the next read, after \p Got bytes were read from
+    /// a request of \p Requested bytes of the current \p Chunk size.
+    static std::size_t adaptRead(std::size_t Chunk,
+                                 std::size_t Requested,
+                                 std::size_t Got) noexcept;
+    /// \returns the size of the next write, after \p Sent bytes of
+    /// \p Requested bytes were written, with \p More data remaining.
+    static std::size_t adaptWrite(std::size_t Chunk,
+                                  std::size_t Requested,
+                                  std::size_t Sent,
+                                  bool More) noexcept;
+  };
+
+  /// Learns how large the buffers of a kind of channel (e.g. sockets) get,
+  /// from the largest size the buffers of the already destroyed channels of
+  /// the kind reached. New channels of the kind are created with buffers that
+  /// most of the previous ones never had to grow beyond.
+  ///
+  /// \note The hint is thread-safe, and is meant to be a static object.
+  class SizeHint
+  {
+  public:
+    /// The buffer sizes tracked, each twice as large as the previous.
+    static constexpr std::size_t MinSize = 1ULL << 12; // 4 KiB
+    static constexpr std::size_t Classes = 9;          // ... 1 MiB
+    /// Recorded sizes are only taken into account after this many channels.
+    static constexpr std::uint32_t MinSamples = 4;
+
+    constexpr SizeHint(std::size_t Default) noexcept : Default(Default) {}
+
+    /// \returns the size of the buffer new channels of the kind should be
+    /// created with, which is at least the default of the kind, and large
+    /// enough for most of the recorded sizes.
+    std::size_t initialSize() const noexcept;
+    /// Records that the buffer of a channel of the kind held at most \p Peak
+    /// bytes.
+    void record(std::size_t Peak) noexcept;
+
+  private:
+    /// Records beyond this count make the older ones count half, so the hint
+    /// follows the recent behaviour of the channels.
+    static constexpr std::uint32_t DecayAfter = 256;
+
+    const std::size_t Default;
+    /// The number of recorded sizes that fit into each size class.
+    std::atomic<std::uint32_t> Counts[Classes] = {};
+    std::atomic<std::uint32_t> Total{0};
+  };
 
   /// Thrown if the \p Buffer of a \p BufferedChannel exceeds a (reasonable)
   /// size limit.
@@ -103,15 +202,31 @@ public:
   ///
   /// Sufficiently sized requests do not interact with the buffer.
   ///
-  /// \throws buffer_overflow If the buffer is interacted with and exceeds the
-  /// limit \p BufferSizeMax, the command throws. \p BufferSizeMax is a soft
-  /// limit enforced by this class, not the underlying structure. The read data
-  /// is \e NOT lost, but stored into the buffer, however, care must be taken
-  /// so that system resources are not exhausted.
+  /// If the buffer is interacted with and reaches the limit
+  /// \p bufferSizeMax(), no more data is taken from the underlying
+  /// implementation, leaving it unread there.
   ///
   /// \see load
   std::string read(std::size_t Bytes);
 
+  /// \returns a view of at \b maximum \p Bytes of data read from the channel,
+  /// without copying and without consuming it.
+  ///
+  /// If the buffer is empty, data is first \p load()ed into it. Otherwise,
+  /// only the data already in the buffer is considered. The returned view
+  /// is \e contiguous, so it might contain less data than what is available in
+  /// the buffer.
+  ///
+  /// \warning The returned view points into the buffer and is invalidated by
+  /// any subsequent read operation on the channel, including \p consume().
+  ///
+  /// \see consume
+  std::string_view peek(std::size_t Bytes);
+
+  /// Discards at \b maximum \p Bytes of data from the beginning of the read
+  /// buffer, typically after the data returned by \p peek() was handled.
+  void consume(std::size_t Bytes);
+
   /// Writes the contents of \p Data into the channel.
   ///
   /// This function \e buffers: if thers is data that had been put into the
@@ -123,22 +238,37 @@ public:
   /// \returns the number of bytes of \p Data written to the channel.
   ///
   /// \throws buffer_overflow If the buffer is interacted with and exceeds the
-  /// limit \p BufferSizeMax, the command throws. \p BufferSizeMax is a soft
-  /// limit enforced by this class, not the underlying structure. The unwritten
-  /// data is \e NOT lost, but stored into the buffer, however, care must be
-  /// taken so that system resources are not exhausted.
+  /// limit \p bufferSizeMax(), the command throws. \p bufferSizeMax() is a
+  /// soft limit enforced by this class, not the underlying structure. The
+  /// unwritten data is \e NOT lost, but stored into the buffer, however, care
+  /// must be taken so that system resources are not exhausted.
+  ///
+  /// \see overBudget
   std::size_t write(std::string_view Data);
 
+  /// Writes the contents of the shared \p Data into the channel.
+  ///
+  /// This function behaves exactly like \p write(std::string_view), except
+  /// that if not all of \p Data could be sent, the unsent part is \b NOT
+  /// copied into the buffer. Instead, only a reference to \p Data and the
+  /// offset of the first unsent byte is stored. This allows the same chunk of
+  /// data to be written to multiple channels without keeping a copy of it for
+  /// every channel.
+  ///
+  /// \returns the number of bytes of \p Data written to the channel.
+  ///
+  /// \throws buffer_overflow If the buffer is interacted with and exceeds the
+  /// limit \p bufferSizeMax().
+  std::size_t write(const SharedChunk& Data);
+
   /// Reads at \b least \p Bytes bytes from the underlying implementation,
   /// consuming it, and unconditionally placing it into the locally held buffer.
   ///
   /// \returns the number of writes read and placed.
   ///
-  /// \throws buffer_overflow If the buffer is interacted with and exceeds the
-  /// limit \p BufferSizeMax, the command throws. \p BufferSizeMax is a soft
-  /// limit enforced by this class, not the underlying structure. The read data
-  /// is \e NOT lost, but stored into the buffer, however, care must be taken
-  /// so that system resources are not exhausted.
+  /// Once the buffer reaches the limit \p bufferSizeMax(), no more data is
+  /// taken from the underlying implementation, even if less than \p Bytes was
+  /// read.
   ///
   /// \see read
   std::size_t load(std::size_t Bytes);
@@ -152,6 +282,56 @@ public:
   /// thus will not throw \p buffer_overflow.
   std::size_t flushWrites();
 
+  /// The outcome of the non-throwing variants of the operations, which report
+  /// the conditions the throwing variants raise exceptions for.
+  enum class Status : std::uint8_t
+  {
+    /// The operation succeeded. What could not be sent was buffered.
+    Ok,
+    /// The data was buffered, but the write buffer exceeds
+    /// \p bufferSizeMax(). The throwing variant raises \p buffer_overflow.
+    Overflow,
+    /// The channel failed, or does not support the operation.
+    Failed
+  };
+
+  /// The result of a non-throwing operation.
+  struct Result
+  {
+    /// The number of bytes transferred by the operation.
+    std::size_t Bytes = 0;
+    Status State = Status::Ok;
+    /// The reason of a \p Failed operation.
+    std::error_code Error;
+
+    bool ok() const noexcept { return State == Status::Ok; }
+    bool overflow() const noexcept { return State == Status::Overflow; }
+    bool failed() const noexcept { return State == Status::Failed; }
+  };
+
+  /// Performs \p write(), but reports overflowing the buffer and the errors of
+  /// the underlying implementation in the result, instead of throwing.
+  ///
+  /// This is meant for event loops, where backpressure and broken connections
+  /// are expected, and should not cost an exception every time.
+  Result tryWrite(std::string_view Data);
+  /// Performs \p write() of a shared chunk, like \p tryWrite().
+  Result tryWrite(const SharedChunk& Data);
+  /// Performs \p flushWrites(), but reports the errors of the underlying
+  /// implementation in the result, instead of throwing.
+  Result tryFlushWrites();
+  /// Performs \p load(), but reports the errors of the underlying
+  /// implementation in the result, instead of throwing.
+  Result tryLoad(std::size_t Bytes);
+  /// Performs \p peek() into \p View, but reports the errors of the
+  /// underlying implementation in the result, instead of throwing.
+  Result tryPeek(std::size_t Bytes, std::string_view& View);
+
+  /// \returns whether the channel supports reading.
+  bool readable() const noexcept { return ReadCapacity != 0; }
+  /// \returns whether the channel supports writing.
+  bool writable() const noexcept { return WriteCapacity != 0; }
+
   /// \returns whether there are buffered data read but not yet consumed.
   bool hasBufferedRead() const noexcept;
   /// \returns whether there are buffered data written but not yet flushed.
@@ -160,39 +340,198 @@ public:
   std::size_t readInBuffer() const noexcept;
   /// \returns the number of bytes already written but not yet flushed.
   std::size_t writeInBuffer() const noexcept;
+  /// \returns a copy of the data read but not yet consumed, leaving the
+  /// buffer intact.
+  std::string bufferedRead() const;
+  /// \returns a copy of the data written but not yet flushed, leaving the
+  /// buffer intact.
+  std::string bufferedWrite() const;
+
+  /// \returns whether the buffers of all channels together exceed the
+  /// \p globalBudget(), and this channel holds some of the buffered data.
+  /// Writers should hold back until the data of the channel is flushed.
+  bool overBudget() const noexcept;
 
   /// \returns the size of low-level single read operations that are in some
   /// sense "optimal" for the underlying implementation.
-  virtual std::size_t optimalReadSize() const noexcept { return BufferSize; }
+  ///
+  /// This adapts to the data transferred: it grows while reads fill the chunk
+  /// fully, and shrinks while reads only return a fraction.
+  ///
+  /// \note This is not virtual, so the relay loops can inline it.
+  std::size_t optimalReadSize() const noexcept { return ReadChunk; }
   /// \returns the size of low-level single write operations that are in some
   /// sense "optimal" for the underlying implementation.
-  virtual std::size_t optimalWriteSize() const noexcept { return BufferSize; }
+  ///
+  /// This adapts to the data transferred: it grows while writes are accepted
+  /// fully, and shrinks when the implementation accepts less.
+  std::size_t optimalWriteSize() const noexcept { return WriteChunk; }
 
   /// Attempts to automatically free auto-growing memory resources associated
   /// with the buffer(s), if it is possible and deemed meaningful. This is a
-  /// heuristics-based call that does not always actually free resources.
+  /// heuristics-based call that does not always actually free resources. The
+  /// freed memory is returned to the \p BufferPool for reuse.
+  ///
+  /// Buffers that have been empty for at least \p IdleRelease are released
+  /// entirely, and are allocated again only when data next has to be buffered.
   void tryFreeResources();
+  /// Releases the storage of the buffers that are currently empty, regardless
+  /// of when they were last used.
+  void releaseBuffers();
+  /// \returns the number of bytes of storage the buffers of the channel
+  /// currently hold allocated, whether or not data is buffered in them.
+  std::size_t allocatedBufferBytes() const noexcept;
 
   /// \returns statistical information, formatted to be human-readable, about
   /// the underlying buffer implementation.
   std::string statistics() const;
 
+  /// The counters of the operations of a channel, which may be read from any
+  /// thread.
+  struct Metrics
+  {
+    Counter BytesRead;
+    Counter BytesWritten;
+    /// The number of low-level read operations performed.
+    Counter ReadCalls;
+    /// The number of low-level write operations performed.
+    Counter WriteCalls;
+    /// The number of times writing overflowed the buffer.
+    Counter Overflows;
+    HighWater ReadBufferPeak;
+    HighWater WriteBufferPeak;
+  };
+  const Metrics& metrics() const noexcept { return Stats; }
+
 protected:
+  /// The buffers, which are only allocated when the first data has to be
+  /// buffered in them.
   UniqueScalar<OpaqueBufferType*, nullptr> Read;
   UniqueScalar<OpaqueBufferType*, nullptr> Write;
+  /// The size the buffers are allocated with. \p 0 if the channel does not
+  /// support the direction.
+  UniqueScalar<std::size_t, 0> ReadCapacity;
+  UniqueScalar<std::size_t, 0> WriteCapacity;
+  /// The largest sizes the already released buffers reached.
+  UniqueScalar<std::size_t, 0> ReadPeak;
+  UniqueScalar<std::size_t, 0> WritePeak;
+  /// The number of bytes this channel contributes to
+  /// \p globalBufferedBytes().
+  UniqueScalar<std::size_t, 0> Accounted;
+  /// The hints that the sizes of the buffers are learnt into, if any.
+  UniqueScalar<SizeHint*, nullptr> ReadHint;
+  UniqueScalar<SizeHint*, nullptr> WriteHint;
+  UniqueScalar<std::size_t, BufferSize> ReadChunk;
+  UniqueScalar<std::size_t, BufferSize> WriteChunk;
+  Metrics Stats;
 
   /// Creates the buffering structure for the object.
   /// \param ReadBufferSize If non-zero, the size of the read buffer. If zero,
-  /// a read buffer will not be created.
+  /// the channel does not support reading.
   /// \param WriteBufferSize If non-zero, the size of the write buffer. If zero,
-  /// a write buffer will not be created.
+  /// the channel does not support writing.
   BufferedChannel(fd Handle,
                   std::string Identifier,
                   bool NeedsCleanup,
                   std::size_t ReadBufferSize = BufferSize,
                   std::size_t WriteBufferSize = BufferSize);
+  /// Creates the buffering structure for the object, with the initial sizes
+  /// of the buffers taken from, and the sizes reached learnt into, the
+  /// hints.
+  /// \param ReadHint If non-null, the hint for the read buffer. If null, the
+  /// channel does not support reading.
+  /// \param WriteHint If non-null, the hint for the write buffer. If null, the
+  /// channel does not support writing.
+  BufferedChannel(fd Handle,
+                  std::string Identifier,
+                  bool NeedsCleanup,
+                  SizeHint* ReadHint,
+                  SizeHint* WriteHint);
   BufferedChannel(BufferedChannel&&) noexcept = default;
-  BufferedChannel& operator=(BufferedChannel&&) noexcept = default;
+  BufferedChannel& operator=(BufferedChannel&& RHS) noexcept;
+
+  /// Saves \p Data, which was obtained for this channel by other means than
+  /// reading from the underlying implementation, at the end of the read
+  /// buffer.
+  void bufferRead(std::string_view Data);
+
+  /// The low-level operations of the buffered operations of this class, which
+  /// are the virtual \p readvImpl(), \p writeImpl() and \p writevImpl() of
+  /// the dynamic type of the channel.
+  ///
+  /// \see BasicBufferedChannel
+  struct VirtualIO
+  {
+    using Policy = AdaptiveChunks;
+
+    static std::size_t readv(BufferedChannel& C,
+                             const ::iovec* Vectors,
+                             std::size_t Count,
+                             bool& Continue)
+    {
+      return C.readvImpl(Vectors, Count, Continue);
+    }
+    static std::size_t
+    write(BufferedChannel& C, std::string_view Buffer, bool& Continue)
+    {
+      return C.writeImpl(Buffer, Continue);
+    }
+    static std::size_t writev(BufferedChannel& C,
+                              const ::iovec* Vectors,
+                              std::size_t Count,
+                              bool& Continue)
+    {
+      return C.writevImpl(Vectors, Count, Continue);
+    }
+  };
+
+  /// The implementations of the buffered operations, performing the low-level
+  /// operations through the static functions of \p IO, and sizing them
+  /// according to \p IO::Policy.
+  ///
+  /// \note These are defined in \p BasicBufferedChannel.hpp.
+  template <typename IO> std::string readVia(std::size_t Bytes);
+  template <typename IO> std::string_view peekVia(std::size_t Bytes);
+  template <typename IO> std::size_t writeVia(std::string_view Data);
+  template <typename IO> std::size_t writeVia(const SharedChunk& Data);
+  template <typename IO> std::size_t loadVia(std::size_t Bytes);
+  template <typename IO> std::size_t flushWritesVia();
+  template <typename IO> Result tryWriteVia(std::string_view Data);
+  template <typename IO> Result tryWriteVia(const SharedChunk& Data);
+  template <typename IO> Result tryFlushWritesVia();
+  template <typename IO> Result tryLoadVia(std::size_t Bytes);
+  template <typename IO>
+  Result tryPeekVia(std::size_t Bytes, std::string_view& View);
+
+private:
+  /// \returns the read buffer, allocating it if it was not yet, or was
+  /// released.
+  OpaqueBufferType& readBuffer();
+  /// \returns the write buffer, allocating it if it was not yet, or was
+  /// released.
+  OpaqueBufferType& writeBuffer();
+  /// Releases the storage of the buffers that are empty, and, if \p IdleOnly,
+  /// have not been used for \p IdleRelease.
+  void releaseEmpty(bool IdleOnly) noexcept;
+
+  /// Sends as much from the beginning of \p Data as possible directly via the
+  /// underlying implementation, removing the sent prefix from \p Data.
+  ///
+  /// \returns the number of bytes sent.
+  template <typename IO> std::size_t writeUnbufferedVia(std::string_view& Data);
+  /// Performs \p write() without checking whether the channel is usable, and
+  /// without checking the buffer for overflow afterwards.
+  template <typename IO> std::size_t writeOrBufferVia(std::string_view Data);
+  template <typename IO> std::size_t writeOrBufferVia(const SharedChunk& Data);
+  /// \returns whether the write buffer exceeded the limit, which is counted
+  /// as an overflow.
+  bool writeOverflowed(const char* Operation) noexcept;
+  /// Throws \p buffer_overflow if the write buffer exceeded the limit.
+  void throwIfWriteOverflow(const char* Operation);
+  /// Updates \p globalBufferedBytes() with the current size of the buffers.
+  void account() noexcept;
+  /// Records the sizes the buffers reached into the hints.
+  void learnSizes() noexcept;
 };
 
 using buffer_overflow = BufferedChannel::OverflowError;
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sched.h>
+
+namespace monomux
+{
+
+/// A set of CPUs that a thread or a process may be scheduled to run on.
+class CPUSet
+{
+public:
+  /// Creates an empty set.
+  CPUSet() = default;
+
+  /// Parses a list of CPUs, such as \p "0-3,8,10-11", in the format used by
+  /// the kernel and \p taskset.
+  ///
+  /// \returns \p nullopt if the list is malformed or empty.
+  static std::optional<CPUSet> parse(std::string_view List);
+
+  /// \returns the CPUs the calling thread may run on.
+  static CPUSet ofThisThread();
+
+  /// \returns the CPUs of each NUMA node of the system, as reported by the
+  /// kernel, in the order of the nodes. Empty if the system does not report
+  /// them.
+  static std::vector<CPUSet> numaNodes();
+
+  void add(unsigned CPU) noexcept;
+  bool has(unsigned CPU) const noexcept;
+  std::size_t size() const noexcept;
+  bool empty() const noexcept { return !size(); }
+
+  /// \returns the CPUs of the set, in increasing order.
+  std::vector<unsigned> cpus() const;
+
+  /// \returns the CPUs of the set ordered such that consecutive elements are
+  /// on different \p Nodes as long as possible, so threads placed on them in
+  /// order are spread evenly over the nodes. The CPUs not found in any of
+  /// \p Nodes are at the end.
+  std::vector<unsigned> interleaved(const std::vector<CPUSet>& Nodes) const;
+
+  /// \returns the set in the format understood by \p parse().
+  std::string toString() const;
+
+  /// Restricts the calling thread to the CPUs of the set.
+  ///
+  /// \throws std::system_error if the kernel refused the set.
+  void applyToThisThread() const;
+
+  /// Restricts the calling thread to the CPUs of the set, like
+  /// \p applyToThisThread(), but only using async-signal-safe calls.
+  ///
+  /// \returns whether the kernel accepted the set.
+  bool applyToThisThreadUnchecked() const noexcept;
+
+  bool operator==(const CPUSet& RHS) const noexcept;
+  bool operator!=(const CPUSet& RHS) const noexcept { return !(*this == RHS); }
+
+private:
+  ::cpu_set_t Set{};
+};
+
+} // namespace monomux
@@ -21,6 +21,8 @@
 #include <string_view>
 #include <vector>
 
+#include <sys/uio.h>
+
 #include "monomux/adt/UniqueScalar.hpp"
 #include "monomux/system/fd.hpp"
 
@@ -86,6 +88,32 @@ protected:
   /// might continue, because there is more space available.
   virtual std::size_t writeImpl(std::string_view Buffer, bool& Continue) = 0;
 
+  /// Implemented by subclasses to perform a scattering read from the system
+  /// into the \p Count buffers described by \p Vectors, in a single
+  /// operation, if possible.
+  ///
+  /// The default implementation calls \p readImpl() and copies the result into
+  /// the buffers.
+  ///
+  /// \param Continue Whether the read operation from the low-level resource
+  /// might continue, because there is more data available.
+  ///
+  /// \returns the number of bytes read, spread over the buffers in order.
+  virtual std::size_t
+  readvImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue);
+  /// Implemented by subclasses to perform a gathering write of the \p Count
+  /// buffers described by \p Vectors into the system, in a single operation,
+  /// if possible.
+  ///
+  /// The default implementation calls \p writeImpl() for each buffer.
+  ///
+  /// \param Continue Whether the write operation to the low-level resource
+  /// might continue, because there is more space available.
+  ///
+  /// \returns the number of bytes written, taken from the buffers in order.
+  virtual std::size_t
+  writevImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue);
+
   bool needsCleanup() const noexcept { return EntityCleanup; }
   void setFailed() noexcept { Failed = true; }
 
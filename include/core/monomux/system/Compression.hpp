@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "monomux/Config.h"
+
+struct z_stream_s;
+
+namespace monomux
+{
+
+/// Compresses a stream of data, chunk by chunk, into raw DEFLATE format.
+///
+/// Every chunk is flushed completely and independently of the earlier ones,
+/// so the compressed chunks can be decompressed by an \p Inflater that started
+/// receiving the stream at any chunk. This allows one compressed chunk to be
+/// shared between multiple receivers, no matter when they joined.
+///
+/// \note The compression is only implemented if the build has
+/// \p MONOMUX_COMPRESSION set, see \p available().
+class Deflater
+{
+public:
+  /// \returns whether the current build supports compression.
+  static constexpr bool available() noexcept
+  {
+#ifdef MONOMUX_COMPRESSION
+    return true;
+#else  /* !MONOMUX_COMPRESSION */
+    return false;
+#endif /* MONOMUX_COMPRESSION */
+  }
+
+  /// The default compression level, which favours speed, as the output of
+  /// terminals is usually very compressible anyway.
+  static constexpr int DefaultLevel = 1;
+
+  /// \throws std::logic_error if compression is not \p available().
+  explicit Deflater(int Level = DefaultLevel);
+  ~Deflater();
+  Deflater(Deflater&&) noexcept;
+  Deflater& operator=(Deflater&& RHS) noexcept;
+
+  /// Compresses \p Data as the next chunk of the stream.
+  ///
+  /// \returns the compressed chunk, which is valid until the next call.
+  std::string_view compress(std::string_view Data);
+
+private:
+  std::unique_ptr<struct ::z_stream_s> Stream;
+  std::string Output;
+};
+
+/// Decompresses a stream of raw DEFLATE data, as created by a \p Deflater.
+/// The input may be split at arbitrary points between calls.
+class Inflater
+{
+public:
+  /// \throws std::logic_error if compression is not \p available().
+  Inflater();
+  ~Inflater();
+  Inflater(Inflater&&) noexcept;
+  Inflater& operator=(Inflater&& RHS) noexcept;
+
+  /// Decompresses the next part of the stream, \p Data.
+  ///
+  /// \returns the decompressed data, which is valid until the next call.
+  /// \throws std::runtime_error if the stream is corrupted.
+  std::string_view decompress(std::string_view Data);
+
+private:
+  std::unique_ptr<struct ::z_stream_s> Stream;
+  std::string Output;
+};
+
+} // namespace monomux
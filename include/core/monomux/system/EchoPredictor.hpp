@@ -0,0 +1,102 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "monomux/adt/UniqueScalar.hpp"
+
+namespace monomux
+{
+
+/// Predicts the echo of the input typed into a terminal, so that it can be
+/// displayed before the echo makes the round trip through a slow connection,
+/// similarly to Mosh.
+///
+/// Only printable (ASCII) characters are predicted. The prediction of every
+/// character is kept until the same character arrives in the output, in which
+/// case it is \e confirmed and removed from the output, as it is already
+/// displayed. If the output differs from the prediction, the predicted
+/// characters are erased from the screen, and the output is written as is.
+///
+/// Predictions are only displayed once the echo of the typed input was seen,
+/// after every non-printable key (e.g. \p Enter) or mismatch: the program
+/// might have started handling the keys itself, without echoing them.
+/// Predicted characters are not displayed as long as the predictor is not
+/// \p enabled(), e.g. while the terminal of the program does not echo.
+class EchoPredictor
+{
+public:
+  /// The sequence that erases the displayed predictions, written after moving
+  /// the cursor back over them.
+  static constexpr std::string_view EraseLine = "\033[K";
+
+  bool enabled() const noexcept { return Enabled; }
+
+  /// Sets whether input is predicted.
+  ///
+  /// \returns the data that should be written to the terminal, to erase the
+  /// predictions that are already displayed if prediction is disabled.
+  std::string_view setEnabled(bool Enabled);
+
+  /// Records the \p Input typed by the user.
+  ///
+  /// \returns the data that should be written to the terminal immediately,
+  /// to display the predicted echo of the input.
+  std::string_view predict(std::string_view Input);
+
+  /// Matches the \p Output received from the program against the current
+  /// predictions.
+  ///
+  /// \returns the data that should be written to the terminal instead of
+  /// \p Output. The result is valid until the next call to the predictor, and
+  /// is \p Output itself if nothing was predicted.
+  std::string_view reconcile(std::string_view Output);
+
+  /// \returns the number of characters typed whose echo did not arrive yet.
+  std::size_t outstanding() const noexcept { return Predicted.size(); }
+  /// \returns the number of predicted characters currently displayed.
+  std::size_t displayed() const noexcept { return Displayed; }
+
+private:
+  UniqueScalar<bool, false> Enabled;
+  /// Whether the echo of the input typed was seen since the predictions were
+  /// last reset, and the predictions may be displayed.
+  UniqueScalar<bool, false> Confirmed;
+  /// Whether a non-printable character was typed, after which the input can
+  /// not be matched to the output, until the earlier predictions are
+  /// resolved.
+  UniqueScalar<bool, false> Barrier;
+
+  /// The characters typed whose echo did not arrive yet.
+  std::string Predicted;
+  /// The number of characters from the beginning of \p Predicted that are
+  /// displayed.
+  std::size_t Displayed = 0;
+
+  /// The buffer of data to write, returned by the calls.
+  std::string Result;
+
+  /// Drops every prediction, and appends the erasure of the displayed ones
+  /// to \p Result.
+  void discard();
+};
+
+} // namespace monomux
@@ -17,14 +17,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <vector>
 
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
-#include "monomux/adt/MemberFunctionHelper.hpp"
 #include "monomux/adt/POD.hpp"
 #include "monomux/adt/SmallIndexMap.hpp"
 #include "monomux/system/fd.hpp"
@@ -32,6 +37,8 @@
 namespace monomux
 {
 
+class EventTrace;
+
 /// A type-safe wrapper over an \p epoll(7) event polling structure.
 /// \p epoll(7) works as an I/O event notification system similarly to the
 /// hopefully widely known \p select(2) kernel functionality.
@@ -42,19 +49,39 @@ namespace monomux
 ///
 /// Using \p eventfd(2), this implementation is also capable of having events
 /// crafted by clients appear as if they were created by the kernel.
+///
+/// Subclasses may replace the kernel facility used to register files and to
+/// wait for events, while keeping the interface and the scheduling logic
+/// intact.
 class EPoll
 {
   friend class Listener;
   /// Helper RAII object that manages assigning a file descriptor into the
   /// listen-set of an \p epoll(7) structure.
+  ///
+  /// The kernel reports the address of the object with every event, so the
+  /// file descriptor and the user's data are available without a lookup.
   class Listener
   {
     EPoll& Master;
-    raw_fd FDToListenFor;
 
   public:
-    Listener(EPoll& Master, raw_fd FD, bool Incoming, bool Outgoing);
+    raw_fd FDToListenFor;
+    void* UserData;
+    /// Whether the file is still registered. Events of the already fetched
+    /// batch may still refer to the object after \p stop().
+    bool Listening;
+
+    Listener(EPoll& Master,
+             raw_fd FD,
+             bool Incoming,
+             bool Outgoing,
+             bool EdgeTriggered,
+             void* UserData);
     ~Listener();
+
+    /// Removes the registration from the kernel.
+    void stop();
   };
 
 public:
@@ -63,7 +90,7 @@ public:
   /// The structure is initialised to support at most \p EventCount events.
   EPoll(std::size_t EventCount);
 
-  ~EPoll();
+  virtual ~EPoll();
 
   /// Get the number of events that fired in the last successful \p wait().
   std::size_t getEventCount() const noexcept { return NotificationCount; }
@@ -76,24 +103,23 @@ public:
 
   std::size_t getMaxEventCount() const noexcept { return Notifications.size(); }
 
+  /// Passed to \p wait() to block until a notification arrives, however long
+  /// it takes.
+  static constexpr std::chrono::milliseconds NoTimeout{-1};
+
   /// Blocks and waits until there is a notification that signalled the event
-  /// watcher.
+  /// watcher, or \p Timeout passes, if it is not negative. If events were
+  /// scheduled already, only the notifications that are ready at the time of
+  /// the call are collected, without blocking.
   ///
   /// \return The number of events received, either from the system or by
-  /// manual scheduling.
-  std::size_t wait();
+  /// manual scheduling, which is \p 0 if the wait timed out.
+  std::size_t wait(std::chrono::milliseconds Timeout = NoTimeout);
 
-  /// Retrieve the Nth event.
-  const struct ::epoll_event& operator[](std::size_t Index) const
-  {
-    return at(Index);
-  }
-  /// Retrieve the Nth event.
-  MEMBER_FN_NON_CONST_1(struct ::epoll_event&, operator[], std::size_t, Index);
-  /// Retrieve the Nth event.
-  const struct ::epoll_event& at(std::size_t Index) const;
-  /// Retrieve the Nth event.
-  MEMBER_FN_NON_CONST_1(struct ::epoll_event&, at, std::size_t, Index);
+  /// Records every batch returned by \p wait() into \p Trace, which becomes
+  /// the \p EventTrace::current() trace of the thread calling \p wait().
+  /// Passing \p nullptr stops the recording.
+  void setTrace(EventTrace* Trace) noexcept { this->Trace = Trace; }
 
   /// Retrieve the file descriptor that fired for the Nth event.
   raw_fd fdAt(std::size_t Index) noexcept;
@@ -103,6 +129,9 @@ public:
     raw_fd FD;
     bool Incoming;
     bool Outgoing;
+    /// The data given to \p listen() for \p FD, or \p nullptr if none was
+    /// given, or \p FD was \p stop()ped since the event was received.
+    void* UserData = nullptr;
   };
   /// Retrieve the Nth event.
   EventWithMode eventAt(std::size_t Index) noexcept;
@@ -110,9 +139,28 @@ public:
   /// Adds the specified file descriptor \p FD to the event queue. Events will
   /// trigger for \p Incoming (the file is available for reading) or \p Outgoing
   /// (the file is available for writing) operations.
-  void listen(raw_fd FD, bool Incoming, bool Outgoing);
+  ///
+  /// If \p EdgeTriggered is set, an event will only fire when the state of the
+  /// file changes (e.g. new data arrives), and not for as long as the state
+  /// persists. Clients must consume the file until \p EAGAIN, otherwise no new
+  /// events will be delivered.
+  ///
+  /// The opaque \p UserData is reported with every event of \p FD, so the
+  /// client can dispatch the event without looking up its state from \p FD.
+  /// Events scheduled for \p FD before it was \p stop()ped are reported with
+  /// the new \p UserData, if \p FD is listened for again before \p wait().
+  ///
+  /// \see EPOLLET
+  void listen(raw_fd FD,
+              bool Incoming,
+              bool Outgoing,
+              bool EdgeTriggered = false,
+              void* UserData = nullptr);
 
   /// Stop listening for changes of \p FD.
+  ///
+  /// The events of \p FD that were already received by the last \p wait()
+  /// are still reported, but without their \p UserData.
   void stop(raw_fd FD);
 
   /// Stop listening on \b all associated file descriptors.
@@ -126,33 +174,165 @@ public:
   /// result \b after a call to \p wait(), but do not \e override system
   /// results. A file descriptor both "hand-scheduled" and system notified will
   /// appear twice in the result array.
+  ///
+  /// Scheduling does not involve the kernel, unless the event queue is
+  /// blocked in a \p wait() at the time of the call, in which case it is woken
+  /// up.
+  ///
+  /// \note This function may be called from a thread other than the one
+  /// \p wait()ing.
   void schedule(raw_fd FD, bool Incoming, bool Outgoing);
 
+  /// Makes a blocking \p wait() return without any event appearing in the
+  /// result.
+  ///
+  /// \note This function may be called from a thread other than the one
+  /// \p wait()ing.
+  void wake();
+
+  /// The state of the writes of a file that are performed by an event queue,
+  /// see \p writeQueued(). The requests in flight share the state, so the file
+  /// may be closed, or moved to another queue, while a write is in flight.
+  struct QueuedWrites
+  {
+    QueuedWrites(raw_fd FD) : FD(FD) {}
+
+    const raw_fd FD;
+    /// The queue that performs the new writes of the file. It is sent an
+    /// \p Outgoing event for the file when the write in flight completes.
+    std::atomic<EPoll*> Queue = nullptr;
+    /// The queue in which a write of the file is in flight, if any. At most
+    /// one write is in flight at a time, so the data is sent in order.
+    std::atomic<EPoll*> InFlight = nullptr;
+    /// The error the write in flight failed with, reported by the next write.
+    std::atomic<int> Error = 0;
+  };
+
+  /// \returns whether the event queue can perform the reads and writes of
+  /// files itself, instead of only reporting that the files are ready.
+  virtual bool queuesIO() const noexcept { return false; }
+
+  /// Makes the event queue read \p FD into a buffer of its own while \p FD is
+  /// listened for \p Incoming events, which then report that data was read,
+  /// to be taken by \p readQueued(). Must be called while \p FD is not
+  /// listened for.
+  ///
+  /// \returns whether the queue reads \p FD. If not, \p FD must be read as
+  /// usual.
+  virtual bool startQueuedReads(raw_fd FD);
+  /// Stops the reading of \p FD by the queue, discarding the data not yet
+  /// taken. Must be called while \p FD is not listened for.
+  virtual void stopQueuedReads(raw_fd FD);
+  /// Moves the data the queue read from \p FD into the \p Count buffers of
+  /// \p Vectors, like \p readv(2).
+  ///
+  /// \param Continue Set to \p false if no more data was read yet.
+  /// \param EndOfFile Set to \p true if \p FD reached its end.
+  ///
+  /// \throws std::system_error if reading \p FD failed.
+  virtual std::size_t readQueued(raw_fd FD,
+                                 const ::iovec* Vectors,
+                                 std::size_t Count,
+                                 bool& Continue,
+                                 bool& EndOfFile);
+
+  /// Copies the data of the \p Count buffers of \p Vectors, like
+  /// \p writev(2), to be written to the file of \p Writes by the queue.
+  ///
+  /// \param Continue Set to \p false if the queue does not take more data
+  /// until the next \p Outgoing event of the file.
+  ///
+  /// \returns the number of bytes taken, or \p std::nullopt if the queue
+  /// can not perform the write, in which case the caller must write the file.
+  ///
+  /// \throws std::system_error if the previous write failed.
+  virtual std::optional<std::size_t>
+  writeQueued(const std::shared_ptr<QueuedWrites>& Writes,
+              const ::iovec* Vectors,
+              std::size_t Count,
+              bool& Continue);
+  /// Cancels the write of \p Writes that is in flight in the queue, if any.
+  ///
+  /// \note This function may be called from a thread other than the one
+  /// \p wait()ing.
+  virtual void cancelQueuedWrite(const QueuedWrites& Writes);
+
+protected:
+  /// Tag type that selects the constructor which does not create an
+  /// \p epoll(7) structure, for subclasses that use another facility.
+  struct NoKernelPoll
+  {};
+  EPoll(std::size_t EventCount, NoKernelPoll);
+
+  /// Starts listening for the internal file descriptor that marks manually
+  /// scheduled events. Subclasses constructed with \p NoKernelPoll must call
+  /// this once they can \p listen().
+  void listenForScheduled();
+
+  /// Registers \p FD in the kernel for the \p Events, which are a mask of
+  /// \p EPOLL* flags. Events of \p FD must be reported with \p Data.
+  virtual void addImpl(raw_fd FD, std::uint32_t Events, ::epoll_data_t Data);
+  /// Removes the registration of \p FD from the kernel.
+  virtual void removeImpl(raw_fd FD);
+  /// Stores at most \p MaxEvents received events into \p Events. Waits
+  /// until at least one event is received, or \p Timeout passes. A negative
+  /// \p Timeout waits indefinitely, and zero does not wait at all.
+  ///
+  /// \returns the number of events received, which is \p 0 if the wait was
+  /// interrupted or timed out.
+  virtual std::size_t waitImpl(struct ::epoll_event* Events,
+                               std::size_t MaxEvents,
+                               std::chrono::milliseconds Timeout);
+
 private:
   std::size_t NotificationCount = 0;
+  EventTrace* Trace = nullptr;
   /// The file descriptor registered in the system for the event structure.
   fd MasterFD;
   std::map<raw_fd, Listener> Listeners;
+  /// The listeners that were stopped since the last \p wait(), which might
+  /// still be referred by the received events. Guarded by \p ScheduleLock.
+  std::vector<decltype(Listeners)::node_type> Stopped;
+
+  /// An event manually scheduled for a file descriptor.
+  struct ScheduledEvent
+  {
+    raw_fd FD;
+    std::uint32_t Events;
+    /// The registration of \p FD at the time of scheduling, if any.
+    const Listener* Registration;
+  };
 
   /// Contains the events that fired and triggered a notification from the
   /// system.
   std::vector<POD<struct ::epoll_event>> Notifications;
   /// Contains the events that were manually scheduled before the most recent
   /// \p wait() call.
-  std::vector<POD<struct ::epoll_event>> ScheduledResult;
+  std::vector<ScheduledEvent> ScheduledResult;
 
   /// The file descriptor registered in the system for the manually scheduled
   /// event callbacks.
   fd ScheduleFD;
+  const Listener* ScheduleListener = nullptr;
   /// Contains the index in the \p Notifications vector, after a successful call
   /// to \p wait(), where the \p ScheduleFD's notification was placed.
   std::optional<std::size_t> ScheduleFDNotifiedAtIndex;
 
+  /// Guards the \p ScheduledWaiting list, which might be filled from other
+  /// threads while \p wait() is blocking.
+  std::mutex ScheduleLock;
+  /// Whether \p wait() is (about to be) blocked in the kernel, and thus
+  /// scheduling an event must wake it up. Guarded by \p ScheduleLock.
+  bool Blocking = false;
+  /// The number of \p wake() tokens written to \p ScheduleFD that were not
+  /// yet consumed.
+  std::atomic<std::uint64_t> PendingWakes = 0;
+
   static const std::size_t FDLookupSize = 256;
   /// Contains the events that were manually scheduled by the client before a
   /// call to \p wait(). After \p wait() is called, the events are moved to
   /// the \p ScheduledResult list to be accessed appropriately.
-  std::vector<POD<struct ::epoll_event>> ScheduledWaiting;
+  std::vector<ScheduledEvent> ScheduledWaiting;
   /// Map file descriptor values to existing records in the \p ScheduledWaiting
   /// vector. Used only to de-duplicate the same file descriptor being scheduled
   /// more than once.
@@ -163,6 +343,11 @@ private:
     ScheduledWaitingMap;
 
   bool isValidIndex(std::size_t I) const noexcept;
+  /// \returns the Nth event as received from the system, or \p nullptr if
+  /// the Nth event is a manually scheduled one, which is stored to \p Scheduled
+  /// instead.
+  const struct ::epoll_event* at(std::size_t Index,
+                                 const ScheduledEvent** Scheduled) const;
 };
 
 } // namespace monomux
@@ -0,0 +1,226 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// Captures the behaviour of an event loop into a compact binary file: the
+/// batches of events returned by each \p EPoll::wait(), how long the loop
+/// waited for them, and the size of every read and write done on the
+/// \p BufferedChannel connections while handling them.
+///
+/// The trace of an event loop is recorded by the thread that runs it, which
+/// \p EPoll::wait() makes the \p current() trace of the thread. Records are
+/// kept in memory and written to the file in large chunks. The trace may be
+/// \p flush()ed from another thread.
+///
+/// The file starts with \p Magic, followed by the records. Every record
+/// starts with its \p RecordKind byte and the time elapsed since the previous
+/// record, in microseconds, as a 32-bit number. The numbers are little-endian.
+///
+///   - \p Batch: the time waited (32 bits), and the number of events (16
+///     bits), followed by each event as the file descriptor (32 bits) and a
+///     byte of \p EventIncoming and \p EventOutgoing flags.
+///   - \p Read and \p Write: the file descriptor (32 bits) and the number of
+///     bytes (32 bits).
+///   - \p Open and \p Close: the file descriptor (32 bits) of the connection
+///     that the loop started or stopped handling, and its \p Role byte.
+///   - \p Attach and \p Detach: the file descriptor (32 bits) of the data
+///     connection of the client, and of the session (32 bits), that the
+///     client attached to or detached from.
+///
+/// The connection records may be written by another thread that changes the
+/// connections of the loop. They are kept until the events of a batch being
+/// written are all recorded.
+class EventTrace
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::string_view Magic{"MNMXTRC1", 8};
+
+  enum RecordKind : std::uint8_t
+  {
+    Batch = 'B',
+    Read = 'R',
+    Write = 'W',
+    Open = 'O',
+    Close = 'C',
+    Attach = 'A',
+    Detach = 'D',
+  };
+  static constexpr std::uint8_t EventIncoming = 1;
+  static constexpr std::uint8_t EventOutgoing = 2;
+
+  /// The kind of a connection \p Open or \p Close records refer to.
+  enum Role : std::uint8_t
+  {
+    SessionRole = 'S',
+    ClientDataRole = 'D',
+  };
+
+  /// The amount of records kept in memory before they are written.
+  static constexpr std::size_t FlushSize = 1 << 16;
+
+  /// Creates the trace in a new file at \p Path.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  explicit EventTrace(const std::string& Path);
+  EventTrace(const EventTrace&) = delete;
+  EventTrace& operator=(const EventTrace&) = delete;
+  /// Writes the records kept in memory.
+  ~EventTrace();
+
+  const std::string& path() const noexcept { return Path; }
+
+  /// \returns the trace the calling thread records its event loop into, if
+  /// any.
+  static EventTrace* current() noexcept;
+  static void setCurrent(EventTrace* Trace) noexcept;
+
+  /// Records that \p wait() started at \p WaitStart and returned \p Count
+  /// events at \p Now. The events must be recorded with \p event() next.
+  void batch(Clock::time_point WaitStart,
+             std::size_t Count,
+             Clock::time_point Now = Clock::now());
+  void event(raw_fd FD, bool Incoming, bool Outgoing);
+
+  /// Records that \p Bytes were read from, or written to, \p FD.
+  void io(RecordKind Kind,
+          raw_fd FD,
+          std::size_t Bytes,
+          Clock::time_point Now = Clock::now());
+  /// Records that the loop started (\p Open) or stopped (\p Close) handling
+  /// the connection \p FD of \p Kind.
+  void connection(RecordKind Change,
+                  raw_fd FD,
+                  Role Kind,
+                  Clock::time_point Now = Clock::now());
+  /// Records that the client with the data connection \p Client attached to
+  /// (\p Attach), or detached from (\p Detach), the session read through
+  /// \p Session.
+  void attachment(RecordKind Change,
+                  raw_fd Client,
+                  raw_fd Session,
+                  Clock::time_point Now = Clock::now());
+
+  /// Records the I/O into the \p current() trace of the thread, if any.
+  static void traceIO(RecordKind Kind, raw_fd FD, std::size_t Bytes)
+  {
+    if (EventTrace* T = current(); T && Bytes)
+      T->io(Kind, FD, Bytes);
+  }
+
+  /// Writes the records kept in memory to the file. If writing fails, the
+  /// error is logged, and the rest of the trace is discarded.
+  void flush();
+
+private:
+  std::string Path;
+  fd File;
+  std::mutex Lock;
+  bool Failed = false;
+  std::string Buffer;
+  Clock::time_point Last;
+  /// The number of events of the last batch that are not yet recorded.
+  std::size_t PendingEvents = 0;
+  /// The records written while \p PendingEvents were expected, which are
+  /// appended after the last event.
+  std::string Deferred;
+
+  /// \returns the buffer the next record must be written to.
+  std::string& out() noexcept { return PendingEvents ? Deferred : Buffer; }
+  void header(RecordKind Kind, Clock::time_point Now);
+  void write();
+};
+
+/// Parses the files written by \p EventTrace.
+class EventTraceReader
+{
+public:
+  /// A read or a write done while handling a batch.
+  struct IO
+  {
+    EventTrace::RecordKind Kind;
+    raw_fd FD;
+    std::size_t Bytes;
+  };
+
+  /// A change of the connections handled by the loop.
+  struct Change
+  {
+    /// \p Open, \p Close, \p Attach, or \p Detach.
+    EventTrace::RecordKind Kind;
+    /// The connection, or the data connection of the client attaching or
+    /// detaching.
+    raw_fd FD;
+    /// The kind of the connection \p Open or \p Close refers to.
+    EventTrace::Role Role;
+    /// The session the client attached to or detached from.
+    raw_fd Session;
+  };
+
+  /// An event of a batch.
+  struct Event
+  {
+    raw_fd FD;
+    bool Incoming;
+    bool Outgoing;
+  };
+
+  /// An iteration of the event loop.
+  struct Batch
+  {
+    /// When \p wait() was called, since the start of the trace.
+    std::chrono::microseconds Start;
+    /// The time spent waiting in \p wait().
+    std::chrono::microseconds Waited;
+    /// The time spent handling the batch, until the next \p wait(), if known.
+    std::optional<std::chrono::microseconds> Handled;
+    /// The changes of the connections, in order, made after the previous
+    /// batch was received and before this one.
+    std::vector<Change> Changes;
+    std::vector<Event> Events;
+    std::vector<IO> IOs;
+  };
+
+  /// Parses the \p Data of a trace file.
+  ///
+  /// \returns \p nullopt if \p Data is not a trace. A trace cut short (e.g.,
+  /// because the program was killed) is parsed up to its last whole record.
+  static std::optional<std::vector<Batch>> parse(std::string_view Data);
+
+  /// Parses the trace file at \p Path.
+  ///
+  /// \returns \p nullopt if the file could not be read, or is not a trace.
+  static std::optional<std::vector<Batch>> load(const std::string& Path);
+};
+
+} // namespace monomux
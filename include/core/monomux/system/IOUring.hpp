@@ -0,0 +1,244 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "monomux/system/Event.hpp"
+#include "monomux/system/fd.hpp"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace monomux
+{
+
+/// An event queue with the interface of \p EPoll, but implemented using the
+/// \p io_uring(7) facility of the kernel instead of \p epoll(7).
+///
+/// Registered files are watched with \p IORING_OP_POLL_ADD requests. The
+/// requests that fired are re-armed in a single batch when \p wait() is next
+/// called, and completions are harvested from the shared ring without
+/// blocking in the kernel if they are already available.
+///
+/// Edge-triggered registrations use multishot poll requests, which stay armed
+/// until removed. Level-triggered registrations resubmit a one-shot request
+/// after every notification, which fires again immediately if the file is
+/// still ready.
+///
+/// Timeouts of \p wait() are implemented by an \p IORING_OP_TIMEOUT request
+/// submitted together with the batch.
+///
+/// The queue also performs the reads and writes of files itself, see
+/// \p startQueuedReads() and \p writeQueued(). Instead of reporting that a
+/// file became readable, and leaving the \p read(2) to the caller, a read
+/// request is kept in flight for the file, and its completion is reported as
+/// the event. Writes are copied, and sent by a request in the background.
+/// The data is read into and written from a set of buffers which are
+/// registered with the kernel, if possible, so the requests need not map
+/// them. The requests prepared while handling the events are submitted
+/// together with the next \p wait().
+///
+/// \note Similarly to \p epoll(7), files may be registered to and removed from
+/// the queue by a thread other than the one \p wait()ing on it.
+class IOUring : public EPoll
+{
+public:
+  /// Create a new \p io_uring(7) structure associated with the current
+  /// process.
+  ///
+  /// The structure is initialised to support at most \p EventCount events.
+  ///
+  /// \throws std::system_error if the kernel does not support \p io_uring(7).
+  IOUring(std::size_t EventCount);
+
+  ~IOUring() override;
+
+  /// The size of each of the buffers the queue reads into and writes from.
+  static constexpr std::size_t BufferSize = 16 * 1024;
+  /// The number of buffers of the queue. A buffer is held by every file read
+  /// by the queue, and by every write in flight. If no buffer is left, the
+  /// files must be read and written by the caller.
+  static constexpr std::size_t BufferCount = 64;
+
+  bool queuesIO() const noexcept override { return true; }
+  bool startQueuedReads(raw_fd FD) override;
+  void stopQueuedReads(raw_fd FD) override;
+  std::size_t readQueued(raw_fd FD,
+                         const ::iovec* Vectors,
+                         std::size_t Count,
+                         bool& Continue,
+                         bool& EndOfFile) override;
+  std::optional<std::size_t>
+  writeQueued(const std::shared_ptr<QueuedWrites>& Writes,
+              const ::iovec* Vectors,
+              std::size_t Count,
+              bool& Continue) override;
+  void cancelQueuedWrite(const QueuedWrites& Writes) override;
+
+protected:
+  void addImpl(raw_fd FD, std::uint32_t Events, ::epoll_data_t Data) override;
+  void removeImpl(raw_fd FD) override;
+  std::size_t waitImpl(struct ::epoll_event* Events,
+                       std::size_t MaxEvents,
+                       std::chrono::milliseconds Timeout) override;
+
+private:
+  struct Registration
+  {
+    std::uint32_t Events;
+    std::uint32_t Generation;
+    /// The data reported with the events of the file.
+    ::epoll_data_t Data;
+    /// Whether a poll request is currently in flight in the kernel.
+    bool Armed;
+    bool Multishot;
+  };
+
+  fd RingFD;
+  /// Guards the submission queue and the registrations, as these are accessed
+  /// by \p listen() and \p stop() too.
+  std::mutex RingLock;
+  void* SQRing = nullptr;
+  std::size_t SQRingSize = 0;
+  void* CQRing = nullptr;
+  std::size_t CQRingSize = 0;
+  struct io_uring_sqe* SQEs = nullptr;
+  std::size_t SQEsSize = 0;
+
+  unsigned* SQHead;
+  unsigned* SQTail;
+  unsigned SQMask;
+  unsigned SQEntries;
+  unsigned* SQArray;
+  /// The tail of the submission queue that is not yet visible to the kernel.
+  unsigned SQLocalTail;
+  unsigned* CQHead;
+  unsigned* CQTail;
+  unsigned CQMask;
+  struct io_uring_cqe* CQEs;
+
+  std::map<raw_fd, Registration> Registrations;
+  /// The file descriptors which need a new poll request in the next batch.
+  std::vector<raw_fd> ToArm;
+  std::uint32_t NextGeneration = 0;
+  /// Whether \p wait() is blocked in the kernel, so the requests prepared by
+  /// other threads must be submitted immediately.
+  bool Waiting = false;
+
+  /// The memory of the buffers of the queued reads and writes.
+  char* Buffers = nullptr;
+  /// Whether \p Buffers are registered with the kernel, and the requests use
+  /// them as fixed buffers.
+  bool BuffersRegistered = false;
+  std::vector<unsigned> FreeBuffers;
+
+  /// A read or write performed by the kernel using one of the buffers.
+  struct Operation
+  {
+    enum OpKind
+    {
+      None,
+      Read,
+      Write
+    };
+    OpKind Kind = None;
+    /// The file, which is invalid if the reads of the file were stopped while
+    /// the request was in flight.
+    raw_fd FD = fd::Invalid;
+    bool InFlight = false;
+    /// The part of the buffer that is still to be written.
+    std::size_t Offset = 0;
+    std::size_t Length = 0;
+    std::shared_ptr<QueuedWrites> Writes;
+  };
+  /// The operations of the buffers, indexed by the buffer.
+  std::vector<Operation> Operations;
+
+  /// The state of a file read by the queue.
+  struct QueuedRead
+  {
+    /// The buffer holding the data read, which belongs to the file.
+    unsigned Buffer;
+    /// The part of the buffer which was read, but not yet taken.
+    std::size_t Begin = 0;
+    std::size_t End = 0;
+    bool EndOfFile = false;
+    int Error = 0;
+  };
+  std::map<raw_fd, QueuedRead> Reads;
+  /// The files whose data was read while they were not listened for, which
+  /// are reported by the next \p wait().
+  std::vector<raw_fd> ToReport;
+  /// The files whose write completed after they were moved to another queue,
+  /// which is notified by the next \p wait().
+  std::vector<std::shared_ptr<QueuedWrites>> MovedWrites;
+
+  void unmap() noexcept;
+  /// Cancels the requests in flight, and waits until they complete.
+  void settle() noexcept;
+
+  /// \returns a free submission queue entry, which will be submitted in the
+  /// next batch.
+  struct io_uring_sqe& getSQE();
+  /// \returns the events that the poll request of \p FD must wait for.
+  std::uint32_t pollEvents(raw_fd FD, const Registration& R) const noexcept;
+  void arm(raw_fd FD, Registration& R);
+  /// Prepares a poll request for every file that fired since the last batch.
+  void armPending();
+  /// Submits the pending entries to the kernel, and if \p WaitLock is set,
+  /// blocks until at least one completion is available, releasing the lock
+  /// for the duration of the wait.
+  ///
+  /// \returns \p false if the call was interrupted.
+  bool enter(std::unique_lock<std::mutex>* WaitLock);
+  /// Submits the prepared requests immediately if another thread is blocked
+  /// in \p wait(), which would not submit them before it returns.
+  void submitIfWaiting();
+  /// Prepares an \p IORING_OP_ASYNC_CANCEL request for the request of
+  /// \p UserData.
+  void cancel(std::uint64_t UserData);
+
+  char* bufferAt(unsigned Buffer) const noexcept
+  {
+    return Buffers + static_cast<std::size_t>(Buffer) * BufferSize;
+  }
+  void releaseBuffer(unsigned Buffer);
+  /// Prepares the read of the file of \p Q, unless the data read before is
+  /// not yet taken, or the file is not listened for.
+  void readAhead(raw_fd FD, QueuedRead& Q);
+  void submitWrite(unsigned Buffer);
+  /// Makes \p Event the event of the data read from \p FD, if \p FD is
+  /// listened for \p Incoming events.
+  bool reportRead(raw_fd FD, struct ::epoll_event& Event);
+  /// Handles the completion of the read or write of \p CQE, and makes
+  /// \p Event the event to report for it, if any.
+  bool complete(const struct io_uring_cqe& CQE, struct ::epoll_event& Event);
+
+  /// Consumes the available completions, and stores at most \p MaxEvents of
+  /// the ones that correspond to a registered file into \p Events.
+  std::size_t harvest(struct ::epoll_event* Events, std::size_t MaxEvents);
+};
+
+} // namespace monomux
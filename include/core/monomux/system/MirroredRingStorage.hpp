@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <memory>
+
+namespace monomux
+{
+
+/// A storage policy for \p MaskedRingBuffer<char> that maps the same memory
+/// twice, directly after each other (a "magic ring"). Any range of at most
+/// the capacity of the buffer is contiguous in memory, even if it wraps
+/// around the end, so the contents of the buffer can be passed to a single
+/// \p write() or \p read() call.
+///
+/// The memory is backed by an anonymous \p memfd_create(2) file, and the
+/// capacity must be a multiple of the page size.
+struct MirroredRingStorage
+{
+  static constexpr bool Mirrored = true;
+
+  /// Unmaps both views of the mirrored storage.
+  class Unmap
+  {
+    std::size_t Size = 0;
+
+  public:
+    Unmap() noexcept = default;
+    explicit Unmap(std::size_t Size) noexcept : Size(Size) {}
+
+    void operator()(char* Buffer) const noexcept;
+  };
+  using Pointer = std::unique_ptr<char[], Unmap>;
+
+  /// \returns the smallest capacity not less than \p N that can be mirrored,
+  /// which is a power of two and a multiple of the page size.
+  static std::size_t roundCapacity(std::size_t N) noexcept;
+
+  /// Maps \p N bytes of storage twice.
+  ///
+  /// \throws std::system_error If the mapping failed.
+  static Pointer allocate(std::size_t N);
+};
+
+} // namespace monomux
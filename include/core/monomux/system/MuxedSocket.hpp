@@ -0,0 +1,121 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "monomux/system/Socket.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// One of the two streams of a connection that carries the control messages
+/// and the data of a client interleaved over a single socket.
+///
+/// Every write is sent as one or more \e frames, each prefixed with a small
+/// header that names the stream the payload belongs to and the size of the
+/// payload. The payload itself is sent straight from the buffers of the
+/// stream, without copying. Reading from either stream demultiplexes the
+/// connection: the payload of the stream is returned, and the payload of the
+/// other stream is saved into the read buffer of that stream,
+/// \p hasBufferedRead() of which should be checked after reads.
+///
+/// Frames of the two streams are never mixed, so while a frame of a stream is
+/// only partially sent, writes to the other stream are buffered. Once a frame
+/// is sent, the other stream may continue with \p flushWrites(), see
+/// \p flushConnection().
+///
+/// \note The two streams share the underlying file descriptor, and thus the
+/// value of \p raw(). The connection is closed when both are destroyed.
+class MuxedSocket final : public Socket
+{
+public:
+  enum Stream : std::uint8_t
+  {
+    DataStream = 0,
+    ControlStream = 1
+  };
+
+  /// The size of the header of a frame: the stream (1 byte), a reserved byte
+  /// that must be zero, and the size of the payload (2 bytes, little-endian).
+  static constexpr std::size_t HeaderSize = 4;
+  /// The largest payload a single frame carries.
+  static constexpr std::size_t MaxFrameSize = 0xFFFF;
+
+  /// Encodes the header of a frame of \p Size bytes on \p S into \p Header.
+  static void encodeHeader(char (&Header)[HeaderSize],
+                           Stream S,
+                           std::uint16_t Size) noexcept;
+
+  /// Takes ownership of the connection \p FD and creates the streams over it.
+  /// The control stream is identified as \p Identifier, and the data stream
+  /// as \p Identifier with \p "#data" appended.
+  ///
+  /// \returns the control and the data stream, in this order.
+  static std::pair<std::unique_ptr<MuxedSocket>, std::unique_ptr<MuxedSocket>>
+  create(fd&& FD, std::string Identifier);
+
+  ~MuxedSocket() noexcept override;
+  MuxedSocket(MuxedSocket&&) = delete;
+  MuxedSocket& operator=(MuxedSocket&&) = delete;
+
+  Stream stream() const noexcept { return Kind; }
+
+  /// Flushes the write buffers of both streams of the connection, starting
+  /// with the stream that has a frame partially sent.
+  void flushConnection();
+  /// \returns whether either stream of the connection holds buffered data.
+  bool connectionHasBufferedRead() const noexcept;
+  bool connectionHasBufferedWrite() const noexcept;
+  /// \returns whether a frame is only partially received or sent over the
+  /// connection, in which case another reader or writer could not continue
+  /// the stream from the current state of the socket.
+  bool midFrame() const noexcept;
+
+  /// The state of the connection shared by the two streams.
+  struct Connection;
+
+protected:
+  MuxedSocket(std::shared_ptr<Connection> Conn,
+              Stream Kind,
+              std::string Identifier);
+
+  std::string readImpl(std::size_t Bytes, bool& Continue) final;
+  std::size_t writeImpl(std::string_view Buffer, bool& Continue) final;
+  std::size_t readvImpl(const ::iovec* Vectors,
+                        std::size_t Count,
+                        bool& Continue) final;
+  std::size_t writevImpl(const ::iovec* Vectors,
+                         std::size_t Count,
+                         bool& Continue) final;
+
+private:
+  std::shared_ptr<Connection> Conn;
+  Stream Kind;
+
+  /// \returns the other stream of the connection, if it is still alive.
+  MuxedSocket* sibling() const noexcept;
+  /// Marks both streams of the connection failed.
+  void failConnection() noexcept;
+};
+
+} // namespace monomux
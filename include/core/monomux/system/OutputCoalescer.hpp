@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstddef>
+
+#include "monomux/system/Timer.hpp"
+
+namespace monomux
+{
+
+/// The limits of holding back output so that it is written in fewer, larger
+/// chunks.
+struct CoalescingLimits
+{
+  /// The amount of output written without waiting for \p MaxDelay if it is
+  /// not set explicitly.
+  static constexpr std::size_t DefaultMaxBytes = 16 * 1024;
+
+  /// The longest time output is held back for. If zero, output is never held
+  /// back.
+  std::chrono::milliseconds MaxDelay{};
+  /// The amount of held back output that is written without waiting for the
+  /// rest of \p MaxDelay.
+  std::size_t MaxBytes = DefaultMaxBytes;
+
+  bool enabled() const noexcept { return MaxDelay.count() > 0 && MaxBytes; }
+};
+
+/// Decides when output that arrives in small pieces should be written, based
+/// on \p CoalescingLimits.
+///
+/// Output is written immediately if nothing was written for \p MaxDelay, which
+/// keeps interactive echo unaffected. After a write, subsequent output is held
+/// back until \p MaxDelay elapses or \p MaxBytes accumulates, whichever comes
+/// first. The expiry of the delay is signalled by \p timerFD() becoming
+/// readable, which should be listened for by the event loop.
+class OutputCoalescer
+{
+public:
+  OutputCoalescer(CoalescingLimits Limits) : Limits(Limits) {}
+
+  const CoalescingLimits& limits() const noexcept { return Limits; }
+  raw_fd timerFD() const noexcept { return Clock.raw(); }
+
+  /// Decides what to do when output arrived, and \p PendingBytes are held
+  /// back in total.
+  ///
+  /// \returns whether the pending output should be written now.
+  bool shouldWrite(std::size_t PendingBytes);
+
+  /// Decides what to do when \p timerFD() fired, with \p PendingBytes held
+  /// back in total.
+  ///
+  /// \returns whether the pending output should be written now.
+  bool expired(std::size_t PendingBytes);
+
+private:
+  CoalescingLimits Limits;
+  /// Armed for as long as a write recently happened, and further output is
+  /// to be held back.
+  Timer Clock;
+};
+
+} // namespace monomux
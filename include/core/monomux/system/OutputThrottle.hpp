@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "monomux/system/Timer.hpp"
+
+namespace monomux
+{
+
+/// The limits of the rate the output of a session is read at.
+struct ThrottleLimits
+{
+  /// The sustained rate of reading, in bytes per second. If zero, the reading
+  /// is not limited.
+  std::size_t Rate = 0;
+  /// The amount that can be read at once after the output was idle. If zero,
+  /// \p Rate is used.
+  std::size_t Burst = 0;
+
+  bool enabled() const noexcept { return Rate; }
+  std::size_t burst() const noexcept { return Burst ? Burst : Rate; }
+};
+
+/// Limits the rate output is read at with a token bucket, based on
+/// \p ThrottleLimits.
+///
+/// Every byte read takes a token, and tokens are added at \p Rate, up to
+/// \p Burst. Once the tokens run out, reading should stop until \p timerFD()
+/// becomes readable, which should be listened for by the event loop. Reading
+/// is resumed once a quarter of \p Burst is available again, so a producer
+/// that is over the limit is read in chunks, not byte by byte.
+class OutputThrottle
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  OutputThrottle(ThrottleLimits Limits, Clock::time_point Now = Clock::now());
+
+  const ThrottleLimits& limits() const noexcept { return Limits; }
+  raw_fd timerFD() const noexcept { return Wakeup.raw(); }
+
+  /// \returns whether reading is suspended until \p timerFD() fires.
+  bool throttled() const noexcept { return Wakeup.armed(); }
+
+  /// Accounts for \p Bytes of output read.
+  ///
+  /// \returns whether more output may be read now. If not, \p timerFD() is
+  /// armed to fire when reading may resume.
+  bool consumed(std::size_t Bytes, Clock::time_point Now = Clock::now());
+
+  /// Decides what to do when \p timerFD() fired.
+  ///
+  /// \returns whether reading may resume.
+  bool expired(Clock::time_point Now = Clock::now());
+
+private:
+  ThrottleLimits Limits;
+  /// The number of bytes that may be read. Negative, if more was read at once
+  /// than was available.
+  std::int64_t Tokens;
+  Clock::time_point LastRefill;
+  Timer Wakeup;
+
+  void refill(Clock::time_point Now) noexcept;
+  /// Arms \p Wakeup for when enough tokens will be available to resume.
+  void waitForTokens();
+};
+
+} // namespace monomux
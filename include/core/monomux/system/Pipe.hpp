@@ -23,12 +23,14 @@
 #include <fcntl.h>
 
 #include "monomux/adt/UniqueScalar.hpp"
-#include "monomux/system/BufferedChannel.hpp"
+#include "monomux/system/BasicBufferedChannel.hpp"
 #include "monomux/system/fd.hpp"
 
 namespace monomux
 {
 
+class EPoll;
+
 /// A pipe is a one-way communication channel between a reading and a writing
 /// end.
 ///
@@ -38,7 +40,7 @@ namespace monomux
 /// This class wraps a nameless pipe or a Unix named pipe (\e FIFO) appearing as
 /// a file in the filesystem, and allows reading or writing (but noth both!) to
 /// it.
-class Pipe : public BufferedChannel
+class Pipe final : public BasicBufferedChannel<Pipe>
 {
 public:
   /// The mode with which the \p Pipe is opened.
@@ -135,6 +137,13 @@ public:
   bool isBlocking() const noexcept { return !Nonblock; }
   bool isNonblocking() const noexcept { return Nonblock; }
 
+  /// Makes the reads of the pipe take the data that \p Queue read from the
+  /// pipe, see \p EPoll::startQueuedReads(). Passing \p nullptr makes the
+  /// pipe read its file itself again.
+  void readThrough(EPoll* Queue) noexcept { ReadQueue = Queue; }
+  /// \returns whether the data of the pipe is read by an event queue.
+  bool readsQueued() const noexcept { return ReadQueue.get() != nullptr; }
+
   /// Directly read and consume at most \p Bytes of data from the given file
   /// descriptor \p FD.
   ///
@@ -152,26 +161,70 @@ public:
   // static std::size_t
   // write(raw_fd FD, std::string_view Buffer, bool* Success = nullptr);
 
+  /// Moves at most \p Bytes of data from \p From to \p To without copying it
+  /// through userspace. At least one of the file descriptors must refer to a
+  /// pipe. The operation is non-blocking on the pipe end(s).
+  ///
+  /// \param Continue Set to \p false if no more data could be moved without
+  /// blocking.
+  ///
+  /// \returns The number of bytes moved, \p 0 if \p From reached \e EOF.
+  ///
+  /// \see splice(2)
+  static std::size_t
+  splice(raw_fd From, raw_fd To, std::size_t Bytes, bool& Continue);
+
   ~Pipe() noexcept override;
   Pipe(Pipe&&) noexcept = default;
   Pipe& operator=(Pipe&&) noexcept = default;
 
-  using BufferedChannel::read;
-  using BufferedChannel::write;
-
-  std::size_t optimalReadSize() const noexcept override;
-  std::size_t optimalWriteSize() const noexcept override;
+  using BasicBufferedChannel::read;
+  using BasicBufferedChannel::write;
 
 protected:
   Pipe(fd Handle, std::string Identifier, bool NeedsCleanup, Mode OpenMode);
 
-  std::string readImpl(std::size_t Bytes, bool& Continue) override;
-  std::size_t writeImpl(std::string_view Buffer, bool& Continue) override;
+  std::string readImpl(std::size_t Bytes, bool& Continue) final;
+  std::size_t writeImpl(std::string_view Buffer, bool& Continue) final;
+  std::size_t readvImpl(const ::iovec* Vectors,
+                        std::size_t Count,
+                        bool& Continue) final;
+  std::size_t writevImpl(const ::iovec* Vectors,
+                         std::size_t Count,
+                         bool& Continue) final;
 
 private:
+  friend class BasicBufferedChannel<Pipe>;
+
+  /// The low-level operations of the buffered operations, which are the
+  /// overriders of the virtual functions, called directly.
+  std::size_t
+  transportReadv(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    return ReadQueue ? readQueued(Vectors, Count, Continue)
+                     : Pipe::readvImpl(Vectors, Count, Continue);
+  }
+  std::size_t transportWrite(std::string_view Buffer, bool& Continue)
+  {
+    return Pipe::writeImpl(Buffer, Continue);
+  }
+  std::size_t
+  transportWritev(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    return Pipe::writevImpl(Vectors, Count, Continue);
+  }
+
+  /// Takes the data that \p ReadQueue read.
+  std::size_t
+  readQueued(const ::iovec* Vectors, std::size_t Count, bool& Continue);
+
   UniqueScalar<Mode, None> OpenedAs;
   UniqueScalar<bool, false> Nonblock;
   UniqueScalar<bool, false> Weak;
+  /// The event queue that reads the pipe, if any.
+  UniqueScalar<EPoll*, nullptr> ReadQueue;
 };
 
+extern template class BasicBufferedChannel<Pipe>;
+
 } // namespace monomux
@@ -18,6 +18,8 @@
  */
 #pragma once
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <map>
 #include <optional>
 #include <string>
@@ -25,6 +27,7 @@
 
 #include <unistd.h>
 
+#include "monomux/system/CPUSet.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/system/Pty.hpp"
 
@@ -55,6 +58,10 @@ public:
     ///
     /// This option has no effect if \p CreatePTY is \p true.
     std::optional<raw_fd> StandardInput, StandardOutput, StandardError;
+
+    /// Restrict the spawned process to run on the CPUs given. If the set can
+    /// not be applied, the process runs wherever the parent may.
+    std::optional<CPUSet> Affinity;
   };
 
   raw_handle raw() const noexcept { return Handle; }
@@ -104,6 +111,20 @@ public:
   /// Sends the \p Signal to the process identified by \p PID.
   static void signal(raw_handle Handle, int Signal);
 
+  /// The resources used by a process, as reported by the kernel.
+  struct ResourceUsage
+  {
+    /// The CPU time the process spent in user and in kernel mode.
+    std::chrono::microseconds CPUTime;
+    /// The resident memory of the process, in bytes.
+    std::uint64_t RSSBytes;
+  };
+
+  /// \returns the resources used so far by the process identified by
+  /// \p Handle, read from \p /proc, or \p nullopt if the process does not
+  /// exist.
+  static std::optional<ResourceUsage> usage(raw_handle Handle);
+
   /// Replaces the current process (as if by calling the \p exec() family) in
   /// the system with the started one. This is a low-level operation that
   /// performs no additional meaningful setup of process state.
@@ -122,6 +143,11 @@ public:
   /// \note This call does \b NOT return in the child!
   static Process spawn(const SpawnOptions& Opts);
 
+  /// Takes over the child process \p Handle, and its \p PTY, that were
+  /// spawned by a previous instance of the program, which \p exec()ed into
+  /// the current one. The process remains the child of the current one.
+  static Process adopt(raw_handle Handle, std::optional<Pty> PTY);
+
   /// \p fork(): Ask the kernel to create an exact duplicate of the current
   /// process. The specified callbacks \p ParentAction and \p ChildAction will
   /// be run in the parent and the child process, respectively.
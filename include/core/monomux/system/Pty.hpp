@@ -43,10 +43,22 @@ class Pty
   /// setting up either as parent or childside.
   std::unique_ptr<Pipe> Write;
 
+  Pty(fd Master, std::string Name) noexcept
+    : Master(std::move(Master)), Name(std::move(Name))
+  {}
+
+  /// Wraps the already open \p Master side for reading and writing.
+  void wrapMaster();
+
 public:
   /// Creates a new PTY-pair.
   Pty();
 
+  /// Takes over the master side \p Master of the PTY named \p Name, which
+  /// was set up as parent by a previous instance of the program, and
+  /// inherited over \p exec().
+  static Pty adopt(fd Master, std::string Name);
+
   /// \returns whether the current instance is open on the master (PTM, control)
   /// side.
   bool isMaster() const noexcept { return IsMaster; }
@@ -94,10 +106,40 @@ public:
   ///
   /// Normally, after a call to this function, it is expected for the child
   /// process to be replaced with another one.
-  void setupChildrenSide();
+  ///
+  /// \note This call only executes system calls, and does not modify the
+  /// instance, so it is safe to call in a child created by \p vfork() which
+  /// shares the memory of the parent.
+  ///
+  /// \returns whether the set-up succeeded. On failure, \p errno is set.
+  bool setupChildrenSide() const noexcept;
 
   /// Sets the size of the pseudoterminal device to have the given dimensions.
   void setSize(unsigned short Rows, unsigned short Columns);
+
+  /// How the line discipline of the terminal treats the input written to it.
+  struct InputMode
+  {
+    /// Whether the input is echoed back to the output.
+    bool Echo;
+    /// Whether the input is edited and delivered to the program line by line.
+    bool Canonical;
+
+    bool operator==(const InputMode& RHS) const noexcept
+    {
+      return Echo == RHS.Echo && Canonical == RHS.Canonical;
+    }
+    bool operator!=(const InputMode& RHS) const noexcept
+    {
+      return !(*this == RHS);
+    }
+  };
+
+  /// \returns the mode the program on the slave side of the terminal
+  /// configured for the input, as seen by the master side.
+  ///
+  /// \see termios(3)
+  InputMode getInputMode() const;
 };
 
 } // namespace monomux
@@ -0,0 +1,177 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "monomux/adt/SPSCRingBuffer.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+class Recorder;
+
+/// The output of a program, recorded into an asciicast (version 2) file by a
+/// \p Recorder.
+///
+/// The events are put into a lock-free queue by the thread that handles the
+/// program, and are formatted and written by the background thread of the
+/// \p Recorder. If the queue is full, the event is dropped and counted, so a
+/// slow disk never holds back the thread that queues the events.
+///
+/// \note The producer functions, \p output(), \p resize() and \p finish(),
+/// must only be called by one thread at a time.
+class Recording
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// The size of the queue of a recording if not set explicitly.
+  static constexpr std::size_t DefaultQueueSize = 1 << 20; // 1 MiB
+
+  const std::string& path() const noexcept { return Path; }
+
+  /// (Producer.) Queues \p Data, the output of the program at \p Now.
+  ///
+  /// \returns whether the event was queued, instead of dropped.
+  bool output(std::string_view Data, Clock::time_point Now = Clock::now());
+
+  /// (Producer.) Queues that the terminal of the program was resized at
+  /// \p Now.
+  ///
+  /// \returns whether the event was queued, instead of dropped.
+  bool resize(std::uint16_t Rows,
+              std::uint16_t Columns,
+              Clock::time_point Now = Clock::now());
+
+  /// (Producer.) Ends the recording. The events queued so far are still
+  /// written, after which the file is closed.
+  void finish() noexcept { Finished.store(true, std::memory_order_release); }
+
+  /// \returns the number of events dropped because the queue was full.
+  std::size_t dropped() const noexcept
+  {
+    return Dropped.load(std::memory_order_relaxed);
+  }
+
+  /// \returns whether writing the file failed, after which the events are
+  /// discarded.
+  bool failed() const noexcept { return Failed.load(std::memory_order_relaxed); }
+
+  /// Creates the recording, use \p Recorder::start() instead.
+  Recording(Recorder& Owner,
+            std::string Path,
+            fd File,
+            std::size_t QueueSize,
+            Clock::time_point Start);
+
+private:
+  friend class Recorder;
+
+  /// The header of an event in the queue, followed by \p Size bytes of data.
+  struct Event
+  {
+    /// The time of the event since the start of the recording.
+    std::uint64_t Microseconds;
+    std::uint32_t Size;
+    char Kind;
+  };
+
+  Recorder& Owner;
+  const std::string Path;
+  fd File;
+  const Clock::time_point Start;
+  SPSCRingBuffer<> Queue;
+  std::atomic<std::size_t> Dropped = 0;
+  std::atomic<bool> Finished = false;
+  std::atomic<bool> Failed = false;
+
+  /// (Writer.) The end of the output that is not yet a whole UTF-8 character.
+  std::string Partial;
+
+  bool push(char Kind, std::string_view Data, Clock::time_point Now);
+
+  /// (Writer.) Formats the queued events and writes them to the file.
+  ///
+  /// \returns whether anything was written.
+  bool drain(std::string& Scratch);
+};
+
+/// Writes \p Recording files on a background thread.
+///
+/// The thread wakes up periodically, or when a queue fills up, and writes the
+/// events of every recording in a single write each. When destroyed, every
+/// queued event is written.
+class Recorder
+{
+public:
+  /// The longest time a queued event waits for being written.
+  static constexpr std::chrono::milliseconds WakeInterval{100};
+
+  Recorder();
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+  ~Recorder();
+
+  /// Starts a new recording of a terminal of \p Rows and \p Columns, in a new
+  /// file at \p Path.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  std::shared_ptr<Recording>
+  start(std::string Path,
+        std::uint16_t Rows,
+        std::uint16_t Columns,
+        std::string_view Title,
+        std::size_t QueueSize = Recording::DefaultQueueSize);
+
+  /// Writes every event queued so far, on the calling thread.
+  void flush();
+
+private:
+  friend class Recording;
+
+  std::mutex RegistryLock;
+  std::vector<std::shared_ptr<Recording>> Recordings;
+  /// Held while the queues are drained, as each has only one consumer.
+  std::mutex DrainLock;
+
+  std::mutex WakeLock;
+  std::condition_variable Wake;
+  std::atomic<bool> Sleeping = false;
+  std::atomic<bool> Stopping = false;
+  std::thread Writer;
+
+  /// Wakes up the writer thread, if it is asleep.
+  void wake();
+  /// Writes the queued events, and retires the finished recordings.
+  void drain();
+  void run();
+};
+
+} // namespace monomux
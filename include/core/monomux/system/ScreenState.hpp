@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace monomux
+{
+
+/// Tracks the visible contents of a terminal screen by interpreting the
+/// subset of VT sequences that move the cursor and edit the screen, so that
+/// the current screen can be reproduced for a terminal that starts displaying
+/// the output later.
+///
+/// The tracking is lossy: only the characters and the cursor position are
+/// kept. Graphic renditions (colours) and unknown sequences are dropped, and
+/// every character is assumed to be a single column wide. The live output of
+/// a program is never altered by the tracker.
+class ScreenState
+{
+public:
+  static constexpr std::size_t DefaultRows = 24;
+  static constexpr std::size_t DefaultColumns = 80;
+
+  ScreenState(std::size_t Rows = DefaultRows,
+              std::size_t Columns = DefaultColumns);
+
+  std::size_t rows() const noexcept { return Rows; }
+  std::size_t columns() const noexcept { return Columns; }
+  std::size_t cursorRow() const noexcept { return CursorRow; }
+  std::size_t cursorColumn() const noexcept { return CursorColumn; }
+
+  /// Changes the size of the screen, keeping the top-left part of the
+  /// contents. An empty size is ignored.
+  void resize(std::size_t Rows, std::size_t Columns);
+
+  /// Interprets the next chunk of \p Data written to the terminal. Sequences
+  /// might be split between chunks.
+  void feed(std::string_view Data);
+
+  /// \returns the text of the row at \p Row, without trailing blanks.
+  std::string rowText(std::size_t Row) const;
+
+  /// \returns the sequence of characters that clears a terminal, and draws
+  /// the current contents of the screen and positions the cursor on it.
+  ///
+  /// Only the rows that changed since the last snapshot are re-rendered.
+  std::string snapshot();
+
+private:
+  /// A single character on the screen, as its (UTF-8) bytes.
+  struct Cell
+  {
+    static constexpr std::size_t MaxBytes = 4;
+    char Bytes[MaxBytes] = {' '};
+    std::uint8_t Size = 1;
+  };
+  struct Row
+  {
+    std::vector<Cell> Cells;
+    /// The rendering of \p Cells, valid if not \p Dirty.
+    std::string Rendered;
+    bool Dirty = true;
+  };
+
+  enum class ParseState : std::uint8_t
+  {
+    Ground,
+    Escape,
+    /// After \p ESC and an intermediate byte, e.g. a charset designation.
+    EscapeIntermediate,
+    CSI,
+    /// A string (OSC, DCS, ...) that is ignored until its terminator.
+    String,
+    StringEscape,
+  };
+
+  std::size_t Rows, Columns;
+  std::vector<Row> Screen;
+  /// The contents of the main screen while the alternate one is shown.
+  std::vector<Row> SavedScreen;
+  bool AlternateScreen = false;
+
+  std::size_t CursorRow = 0, CursorColumn = 0;
+  std::size_t SavedCursorRow = 0, SavedCursorColumn = 0;
+  /// Set after a character was written to the last column. The next character
+  /// wraps to the next line.
+  bool WrapPending = false;
+  /// The scrolling region, inclusive.
+  std::size_t ScrollTop = 0, ScrollBottom;
+
+  ParseState State = ParseState::Ground;
+  /// The parameter and intermediate bytes of the sequence being parsed.
+  std::string Sequence;
+  /// The bytes of a multi-byte UTF-8 character that is being received.
+  Cell Partial;
+  std::uint8_t PartialExpected = 0;
+
+  void printable(const char* Bytes, std::size_t Size);
+  void utf8(unsigned char C);
+  void control(char C);
+  void escape(char Final);
+  void csi(char Final);
+
+  void lineFeed();
+  void reverseLineFeed();
+  /// Moves the rows of the region [\p Top, \p Bottom] up (if positive) or down
+  /// (if negative) by \p N, filling the uncovered rows with blanks.
+  void scroll(std::size_t Top, std::size_t Bottom, long N);
+  void clearCells(std::size_t Row, std::size_t From, std::size_t To);
+  void moveCursor(std::size_t Row, std::size_t Column);
+  void setAlternateScreen(bool Enabled);
+
+  /// \returns the numeric parameter at \p Index of the current CSI sequence,
+  /// or \p Default if it is missing or 0.
+  std::size_t param(std::size_t Index, std::size_t Default = 1) const;
+};
+
+} // namespace monomux
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "monomux/adt/BufferPool.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// Keeps the most recent output of a program, at most \p limit() bytes of it,
+/// so it can be replayed to a client that starts displaying the output later.
+///
+/// The oldest output is discarded as new output arrives. The storage is taken
+/// from the \p BufferPool, and grows only as output accumulates.
+///
+/// The recorded output may be \p spill()ed out of memory, to a temporary file,
+/// while it is not needed.
+class Scrollback
+{
+public:
+  Scrollback(std::size_t Limit);
+
+  std::size_t limit() const noexcept { return Limit; }
+  std::size_t size() const noexcept
+  {
+    return History ? History->size() : SpilledSize;
+  }
+  bool empty() const noexcept { return size() == 0; }
+
+  /// Records \p Data as the newest output, discarding the oldest if needed.
+  void append(std::string_view Data);
+
+  /// \returns the recorded output, suitable for replaying to a terminal.
+  ///
+  /// If output was discarded, the tail starts after the first line break, so
+  /// the replay does not begin in the middle of an escape sequence or a
+  /// multibyte character.
+  std::string tail() const;
+
+  void clear() noexcept;
+
+  /// Releases the storage of the recorded output, moving the output into an
+  /// unlinked temporary file created in \p Directory, compressed if
+  /// compression is available. The output is loaded back into memory when
+  /// the next output is recorded.
+  ///
+  /// \returns the number of bytes of storage released.
+  /// \throws std::system_error if the output could not be saved, in which case
+  /// it stays in memory.
+  std::size_t spill(const std::string& Directory);
+  /// \returns whether the recorded output is not held in memory.
+  bool spilled() const noexcept { return !History; }
+  /// \returns the number of bytes the spilled output takes up on disk.
+  std::size_t spilledBytes() const noexcept { return SpilledStored; }
+
+private:
+  std::size_t Limit;
+  /// Whether some of the output had been discarded since the last \p clear().
+  bool Truncated = false;
+  /// The recorded output, unless it was \p spill()ed.
+  std::optional<RingBuffer<char, PooledRingStorage>> History;
+  /// The file the spilled output is saved in, if any output was recorded.
+  fd Spill;
+  /// The size of the output in the \p Spill, before and after compression.
+  std::size_t SpilledSize = 0;
+  std::size_t SpilledStored = 0;
+
+  /// \returns the recorded output, as it is stored.
+  std::string contents() const;
+  /// Loads the spilled output back into memory.
+  void restore();
+};
+
+} // namespace monomux
@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// Keeps the most recent output of a program, at least \p limit() bytes of
+/// it, in append-only segment files on disk instead of memory.
+///
+/// Output is copied into the memory-mapped newest segment. Full segments are
+/// unmapped, so only one segment's worth of memory is ever mapped, and
+/// reading the tail of older segments is served from the page cache. Once the
+/// retained output exceeds \p limit() by a whole segment, the oldest segment
+/// is deleted.
+///
+/// The segment files are deleted when the log is destroyed.
+class SessionLog
+{
+public:
+  /// The size of a single segment file if not set explicitly.
+  static constexpr std::size_t DefaultSegmentSize = 1ULL << 20; // 1 MiB
+
+  /// Creates the log, placing the segment files at paths starting with
+  /// \p PathPrefix.
+  ///
+  /// \throws std::system_error If the first segment could not be created.
+  SessionLog(std::string PathPrefix,
+             std::size_t Limit,
+             std::size_t SegmentSize = DefaultSegmentSize);
+  SessionLog(const SessionLog&) = delete;
+  SessionLog(SessionLog&& RHS) noexcept;
+  SessionLog& operator=(const SessionLog&) = delete;
+  SessionLog& operator=(SessionLog&&) = delete;
+  ~SessionLog();
+
+  std::size_t limit() const noexcept { return Limit; }
+  /// \returns the number of bytes of output retained.
+  std::size_t size() const noexcept { return Retained; }
+  bool empty() const noexcept { return Retained == 0; }
+  /// \returns the number of segment files currently on disk.
+  std::size_t segmentCount() const noexcept { return Segments.size(); }
+
+  /// Records \p Data as the newest output.
+  ///
+  /// \throws std::system_error If a new segment could not be created.
+  void append(std::string_view Data);
+
+  /// \returns at most \p Bytes of the newest output, suitable for replaying
+  /// to a terminal.
+  ///
+  /// If older output exists, the tail starts after the first line break, so
+  /// the replay does not begin in the middle of an escape sequence or a
+  /// multibyte character.
+  std::string tail(std::size_t Bytes) const;
+
+private:
+  struct Segment
+  {
+    std::string Path;
+    std::size_t Size;
+  };
+
+  std::string PathPrefix;
+  std::size_t Limit;
+  std::size_t SegmentSize;
+  /// The segments on disk, the oldest first. The last one, if \p Map is set,
+  /// is open for appending.
+  std::deque<Segment> Segments;
+  std::size_t NextSequence = 0;
+  std::size_t Retained = 0;
+  /// Whether some of the output had been deleted.
+  bool Truncated = false;
+
+  fd Current;
+  UniqueScalar<char*, nullptr> Map;
+
+  void openSegment();
+  void closeSegment() noexcept;
+  /// Deletes the oldest segments that are not needed to retain \p Limit bytes.
+  void rotate() noexcept;
+};
+
+} // namespace monomux
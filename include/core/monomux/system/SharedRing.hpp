@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// A ring buffer of bytes in memory shared between processes, which one
+/// process, the writer, publishes data into, and up to \p MaxReaders others
+/// read from, each at their own pace.
+///
+/// The memory is backed by a \p memfd_create(2) file, which is passed to the
+/// readers, e.g., with \p Socket::writeWithFiles(). The writer never waits for
+/// the readers: a reader that falls behind by more than the \p capacity()
+/// loses the oldest data, which \p read() reports.
+///
+/// Each reader is assigned a slot, in which it keeps its cursor. The slot also
+/// carries the flag by which the reader tells that it waits to be woken up, so
+/// the writer only needs to \p wake() it then.
+class SharedRing
+{
+public:
+  static constexpr std::size_t MaxReaders = 32;
+
+  /// Creates a new ring storing at least \p Capacity bytes, for the writer.
+  ///
+  /// \throws std::system_error If the memory could not be allocated.
+  static SharedRing create(std::size_t Capacity);
+  /// Maps the ring in \p Memory, created by \p create() in another process,
+  /// for a reader.
+  ///
+  /// \throws std::system_error If the memory could not be mapped, or it is
+  /// not a ring.
+  static SharedRing open(fd Memory);
+
+  SharedRing(SharedRing&& RHS) noexcept;
+  SharedRing& operator=(SharedRing&& RHS) noexcept;
+  ~SharedRing();
+
+  /// \returns the file of the memory of the ring.
+  raw_fd file() const noexcept { return Memory.get(); }
+  std::size_t capacity() const noexcept { return Capacity; }
+  /// \returns the number of bytes published into the ring in total.
+  std::uint64_t head() const noexcept;
+
+  // The operations of the writer.
+
+  /// Appends \p Data to the ring, overwriting the oldest data if needed.
+  void publish(std::string_view Data) noexcept;
+
+  /// Reserves a free slot for a new reader, which reads nothing until the
+  /// slot is \p activate()d.
+  ///
+  /// \returns \p nullopt if every slot is taken.
+  std::optional<std::size_t> acquire() noexcept;
+  /// Lets the reader of \p Slot read the data published from now on.
+  void activate(std::size_t Slot) noexcept;
+  void release(std::size_t Slot) noexcept;
+
+  /// \returns the number of bytes published that the reader of \p Slot has
+  /// not read yet.
+  std::uint64_t lag(std::size_t Slot) const noexcept;
+  /// \returns whether the reader of \p Slot is waiting for new data, and
+  /// should be woken up. The flag is cleared.
+  bool takeReaderWaiting(std::size_t Slot) noexcept;
+
+  // The operations of the readers.
+
+  /// \returns whether the reader of \p Slot was \p activate()d.
+  bool active(std::size_t Slot) const noexcept;
+
+  struct ReadResult
+  {
+    /// The number of bytes read.
+    std::size_t Read = 0;
+    /// The number of bytes that were overwritten before they could be read.
+    std::uint64_t Lost = 0;
+  };
+  /// Appends at most \p Bytes of the data the reader of \p Slot has not read
+  /// yet to \p Out, and advances the cursor of the reader past it.
+  ReadResult read(std::size_t Slot, std::string& Out, std::size_t Bytes);
+  /// Marks the reader of \p Slot as waiting for new data.
+  ///
+  /// \returns \p false, in which case the reader is not marked, if there is
+  /// data to read already.
+  bool wait(std::size_t Slot) noexcept;
+
+  // The notification of the readers.
+
+  /// Creates the file by which the writer wakes up a reader, which the reader
+  /// listens to becoming readable.
+  ///
+  /// \see eventfd(2)
+  static fd makeWakeup();
+  /// Wakes up the reader listening to \p Wakeup.
+  static void wake(raw_fd Wakeup) noexcept;
+  /// Consumes the wake-ups of \p Wakeup, which is not readable until the next
+  /// \p wake().
+  static void clearWakeup(raw_fd Wakeup) noexcept;
+
+private:
+  struct Header;
+
+  /// \returns the size of the mapping of the \p Header, which the data
+  /// follows.
+  static std::size_t headerSize() noexcept;
+
+  SharedRing(fd Memory, std::size_t Capacity, Header* Control, char* Data);
+
+  fd Memory;
+  std::size_t Capacity = 0;
+  /// The shared state of the ring, at the beginning of the \p Memory.
+  Header* Control = nullptr;
+  /// The data of the ring, following the \p Control. (Readers map it as
+  /// read-only.)
+  char* Data = nullptr;
+};
+
+} // namespace monomux
@@ -17,12 +17,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "monomux/adt/UniqueScalar.hpp"
-#include "monomux/system/BufferedChannel.hpp"
+#include "monomux/system/BasicBufferedChannel.hpp"
+#include "monomux/system/Event.hpp"
 #include "monomux/system/fd.hpp"
 
 namespace monomux
@@ -33,6 +40,9 @@ namespace monomux
 ///
 /// This class wraps a Unix domain socket (appearing to applications as a named
 /// file in the filesystem) and allows reading or writing to the socket.
+/// Addresses of the form \p tcp:HOST:PORT and \p vsock:CID:PORT select a TCP
+/// or a \p AF_VSOCK (virtual machine) connection instead, which behave the
+/// same, except that no files can be passed over them.
 ///
 /// This implementation uses \p SOCK_STREAM, which is similar to TCP
 /// connections: clients connect to the server socket and then a connection is
@@ -44,9 +54,20 @@ namespace monomux
 /// facilitating socket behaviour.
 ///
 /// \see socket(7)
-class Socket : public BufferedChannel
+class Socket : public BasicBufferedChannel<Socket>
 {
 public:
+  /// The kind of the connection behind a \p Socket.
+  enum class Transport
+  {
+    Unix,
+    TCP,
+    VSock
+  };
+
+  /// \returns the kind of connection that \p Address selects.
+  static Transport transportOf(std::string_view Address) noexcept;
+
   /// Creates a new \p Socket which will be owned by the current instance, and
   /// removed on exit. Such sockets can be used to await connections and
   /// implement server-like behaviour.
@@ -76,10 +97,25 @@ public:
   /// \param Identifier An identifier to assign to the \p Socket. If empty, a
   /// default value will be created.
   ///
+  /// \param Kind The kind of connection \p FD is.
+  ///
   /// \note This method does \b NOT verify whether the wrapped file descriptor
   /// is indeed a socket, and assumes it is set up (either in server, or client
   /// mode) already.
-  static Socket wrap(fd&& FD, std::string Identifier);
+  static Socket
+  wrap(fd&& FD, std::string Identifier, Transport Kind = Transport::Unix);
+
+  /// Takes over the serving socket \p FD, created at \p Path by a previous
+  /// instance of the program, and inherited over \p exec(). The socket is
+  /// owned as if by \p create(), and \p listen() must be called again to
+  /// accept the connections (which had been queued since) through it.
+  static Socket adopt(fd&& FD, std::string Path);
+
+  /// Creates a pair of connected, anonymous sockets, one for each end of the
+  /// connection. Neither is inherited by child processes.
+  ///
+  /// \see socketpair(2)
+  static std::pair<Socket, Socket> pair(std::string Identifier);
 
   /// Starts listening for incoming connection on the current socket by calling
   /// \p listen(). This is only valid if the current socket was created in full
@@ -92,6 +128,9 @@ public:
   /// \b MAY block. This call is only valid if the current socket was created in
   /// full ownership mode, and \p listen() had already been called for it.
   ///
+  /// The accepted connection is non-blocking, and is not inherited by child
+  /// processes.
+  ///
   /// \param Error If non-null and the accepting of the client fails, the error
   /// code is returned in this parameter.
   /// \param Recoverable If non-null and the accepting of the client fails, but
@@ -106,25 +145,137 @@ public:
   Socket(Socket&&) noexcept = default;
   Socket& operator=(Socket&&) noexcept = default;
 
-  using BufferedChannel::read;
-  using BufferedChannel::write;
+  using BasicBufferedChannel::read;
+  using BasicBufferedChannel::write;
+
+  /// The number of files passed over the socket (and not yet taken) that are
+  /// kept. Further files are closed as they arrive.
+  static constexpr std::size_t MaxReceivedFiles = 4;
+
+  /// Writes \p Data to the socket, with a duplicate of the \p File passed to
+  /// the other end attached to it. The file arrives when the first byte of
+  /// \p Data is read by the peer.
+  ///
+  /// The write buffer is flushed first, and what is not sent of \p Data is
+  /// buffered, like in \p write().
+  ///
+  /// \see unix(7), \p SCM_RIGHTS.
+  std::size_t writeWithFile(std::string_view Data, raw_fd File);
+  /// Writes \p Data to the socket, with duplicates of each of the \p Files
+  /// attached to it, like \p writeWithFile(). At most \p MaxReceivedFiles
+  /// are kept by the peer.
+  std::size_t writeWithFiles(std::string_view Data,
+                             const std::vector<raw_fd>& Files);
+
+  /// \returns the oldest file that was passed to this end of the socket with
+  /// the data read so far, or an invalid \p fd if there is none.
+  fd takeReceivedFile();
 
-  std::size_t optimalReadSize() const noexcept override;
-  std::size_t optimalWriteSize() const noexcept override;
+  Transport transport() const noexcept { return Kind; }
+  /// \returns whether \p writeWithFile() can pass files over the connection.
+  bool canPassFiles() const noexcept { return Kind == Transport::Unix; }
+
+  /// Sets whether small writes are sent immediately over a TCP connection,
+  /// instead of being delayed to be merged with the following ones.
+  ///
+  /// \see tcp(7), \p TCP_NODELAY.
+  void setNoDelay(bool NoDelay);
+  /// Holds back partial frames in a TCP connection until \p uncork() is
+  /// called, so a burst of writes leaves in as few packets as possible.
+  ///
+  /// \note Does nothing if the connection is not TCP.
+  ///
+  /// \see tcp(7), \p TCP_CORK.
+  void cork();
+  /// Releases the data held back since \p cork().
+  void uncork();
+
+  /// Makes the writes of the socket be performed by \p Queue, if it can, see
+  /// \p EPoll::writeQueued(). Passing \p nullptr makes the socket write its
+  /// file itself again.
+  ///
+  /// \note Connections that override the low-level operations always write
+  /// their file themselves.
+  void writeThrough(EPoll* Queue);
+  /// \returns whether the writes of the socket are performed by an event
+  /// queue.
+  bool writesQueued() const noexcept { return Queued && Queued->Queue.load(); }
 
 protected:
   Socket(fd Handle, std::string Identifier, bool NeedsCleanup);
 
   std::string readImpl(std::size_t Bytes, bool& Continue) override;
   std::size_t writeImpl(std::string_view Buffer, bool& Continue) override;
+  std::size_t readvImpl(const ::iovec* Vectors,
+                        std::size_t Count,
+                        bool& Continue) override;
+  std::size_t writevImpl(const ::iovec* Vectors,
+                         std::size_t Count,
+                         bool& Continue) override;
+
+  /// Whether the socket is a stream of a connection that overrides the
+  /// low-level operations, which the buffered operations must then call
+  /// virtually.
+  UniqueScalar<bool, false> Overridden;
 
 private:
+  friend class BasicBufferedChannel<Socket>;
+
+  /// The low-level operations of the buffered operations, which are the
+  /// overriders of this class, called directly, unless \p Overridden.
+  std::size_t
+  transportReadv(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    return Overridden ? readvImpl(Vectors, Count, Continue)
+                      : Socket::readvImpl(Vectors, Count, Continue);
+  }
+  std::size_t transportWrite(std::string_view Buffer, bool& Continue)
+  {
+    if (Overridden)
+      return writeImpl(Buffer, Continue);
+    if (Queued)
+    {
+      ::iovec Vector{const_cast<char*>(Buffer.data()), Buffer.size()};
+      if (std::optional<std::size_t> Taken = writeQueued(&Vector, 1, Continue))
+        return *Taken;
+    }
+    return Socket::writeImpl(Buffer, Continue);
+  }
+  std::size_t
+  transportWritev(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    if (Overridden)
+      return writevImpl(Vectors, Count, Continue);
+    if (Queued)
+      if (std::optional<std::size_t> Taken =
+            writeQueued(Vectors, Count, Continue))
+        return *Taken;
+    return Socket::writevImpl(Vectors, Count, Continue);
+  }
+
+  /// Hands the data to the event queue that writes the socket, if any.
+  std::optional<std::size_t>
+  writeQueued(const ::iovec* Vectors, std::size_t Count, bool& Continue);
+
   /// Whether the current instance is \e owning a socket, i.e. controlling it
   /// as a server.
   UniqueScalar<bool, false> Owning;
   /// Whether the current instance is \e listening for incoming connections
   /// via \p listen().
   UniqueScalar<bool, false> Listening;
+  /// Whether the writes are currently held back by \p cork().
+  UniqueScalar<bool, false> Corked;
+  Transport Kind = Transport::Unix;
+  /// The files passed by the peer, in the order of arrival.
+  std::vector<fd> ReceivedFiles;
+  /// The state of the writes performed by an event queue, see
+  /// \p writeThrough().
+  std::shared_ptr<EPoll::QueuedWrites> Queued;
+
+  /// Takes ownership of the files passed in the ancillary data of \p Msg.
+  void collectFiles(const struct ::msghdr& Msg);
 };
 
+extern template class BasicBufferedChannel<Socket>;
+
 } // namespace monomux
@@ -18,25 +18,71 @@
  */
 #pragma once
 #include <chrono>
+#include <cstddef>
 #include <ctime>
-#include <iomanip>
-#include <sstream>
 #include <string>
 
+#include <time.h>
+
 namespace monomux
 {
 
-/// Formats the given \p Chrono \p Time object to an internationally viable
-/// representation.
-template <typename T> std::string formatTime(const T& Time)
+/// A clock that is compatible with \p std::chrono::system_clock, but is cheaper
+/// to read at the cost of precision. The time is read from
+/// \p CLOCK_REALTIME_COARSE, which is the time of the last timer tick of the
+/// kernel, usually accurate to a few milliseconds.
+///
+/// This is meant for timestamps that are taken often (e.g. on every buffer
+/// access), but are only compared on the scale of seconds.
+struct CoarseClock
+{
+  using duration = std::chrono::system_clock::duration;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::system_clock::time_point;
+  // NOLINTNEXTLINE(readability-identifier-naming)
+  static constexpr bool is_steady = false;
+
+  static time_point now() noexcept
+  {
+#ifdef CLOCK_REALTIME_COARSE
+    ::timespec TS;
+    if (::clock_gettime(CLOCK_REALTIME_COARSE, &TS) == 0)
+      return time_point{
+        std::chrono::duration_cast<duration>(std::chrono::seconds{TS.tv_sec}) +
+        std::chrono::duration_cast<duration>(
+          std::chrono::nanoseconds{TS.tv_nsec})};
+#endif
+    return std::chrono::system_clock::now();
+  }
+};
+
+/// The size of the buffer that the representation of a time by
+/// \p formatTime() always fits into.
+static constexpr std::size_t FormattedTimeSize = 64;
+
+/// Formats the given \p Chrono \p Time object like \p formatTime(), into
+/// \p Buffer, without allocating memory.
+///
+/// \returns the length of the formatted text.
+template <typename T>
+std::size_t formatTime(const T& Time, char (&Buffer)[FormattedTimeSize])
 {
   std::time_t RawTime = T::clock::to_time_t(Time);
-  std::tm SplitTime = *std::localtime(&RawTime);
+  std::tm SplitTime;
+  ::localtime_r(&RawTime, &SplitTime);
 
-  std::ostringstream Buf;
   // Mirror the behaviour of tmux/byobu menu.
-  Buf << std::put_time(&SplitTime, "%a %b %e %H:%M:%S %Y");
-  return Buf.str();
+  return std::strftime(
+    Buffer, FormattedTimeSize, "%a %b %e %H:%M:%S %Y", &SplitTime);
+}
+
+/// Formats the given \p Chrono \p Time object to an internationally viable
+/// representation.
+template <typename T> std::string formatTime(const T& Time)
+{
+  char Buffer[FormattedTimeSize];
+  return std::string(Buffer, formatTime(Time, Buffer));
 }
 
 } // namespace monomux
@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// A type-safe wrapper over a one-shot \p timerfd_create(2) timer, which
+/// becomes readable when it expires, and can thus be listened for by an event
+/// queue like any other file.
+class Timer
+{
+public:
+  /// Creates a new, disarmed timer measuring the monotonic clock.
+  Timer();
+
+  raw_fd raw() const noexcept { return Handle; }
+
+  /// \returns whether the timer is ticking, i.e. \p arm() was called, and the
+  /// expiry had not yet been observed by \p consume().
+  bool armed() const noexcept { return Armed; }
+
+  /// Sets the timer to expire once, \p After the current time. If the timer
+  /// was already armed, the previous expiry is overridden.
+  void arm(std::chrono::nanoseconds After);
+
+  /// Stops the timer without it expiring.
+  void disarm();
+
+  /// Clears the readiness of the timer after it expired.
+  ///
+  /// \returns whether the timer did expire since it was armed.
+  bool consume() noexcept;
+
+private:
+  fd Handle;
+  bool Armed = false;
+};
+
+} // namespace monomux
@@ -0,0 +1,155 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace monomux
+{
+
+/// A hierarchical timing wheel that keeps a large number of one-shot timers
+/// for an event loop, without a kernel timer or a thread for each of them.
+///
+/// Time is measured in ticks of a fixed resolution. Each level of the wheel
+/// has \p SlotCount slots, and a slot of a level spans \p SlotCount slots of
+/// the level below. Timers are placed into the lowest level that can represent
+/// their distance from the current tick, and are moved down (cascaded) as the
+/// wheel turns, so scheduling, cancelling, and expiring are all constant time.
+///
+/// The wheel does not measure time by itself. The event loop should block for
+/// at most \p timeout(), and call \p advance() after waking up, which runs the
+/// callbacks of the timers that expired.
+///
+/// \note This class is not thread-safe.
+class TimerWheel
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+
+  static constexpr std::chrono::milliseconds DefaultResolution{1};
+  static constexpr std::size_t LevelCount = 4;
+  static constexpr std::size_t SlotBits = 6;
+  static constexpr std::size_t SlotCount = 1 << SlotBits;
+
+  /// Identifies a scheduled timer. The handle of an expired or cancelled
+  /// timer is never reused for another timer.
+  class Handle
+  {
+    friend class TimerWheel;
+    std::uint32_t Index = 0;
+    std::uint32_t Generation = 0;
+
+  public:
+    Handle() = default;
+    /// \returns whether the handle was ever returned by \p schedule().
+    explicit operator bool() const noexcept { return Generation != 0; }
+  };
+
+  /// Creates a wheel that measures time in ticks of \p Resolution, starting
+  /// at \p Start.
+  explicit TimerWheel(std::chrono::milliseconds Resolution = DefaultResolution,
+                      Clock::time_point Start = Clock::now());
+
+  std::size_t size() const noexcept { return Count; }
+  bool empty() const noexcept { return Count == 0; }
+
+  /// Schedules \p Fn to be called by the first \p advance() at or after
+  /// \p Deadline. The deadline is rounded up to the resolution of the wheel.
+  Handle schedule(Clock::time_point Deadline, Callback Fn);
+  /// Schedules \p Fn to be called once \p After time has passed.
+  Handle schedule(Clock::duration After, Callback Fn)
+  {
+    return schedule(Clock::now() + After, std::move(Fn));
+  }
+
+  /// \returns whether the timer \p H is still waiting to expire.
+  bool scheduled(Handle H) const noexcept;
+
+  /// Stops the timer \p H without calling its callback.
+  ///
+  /// \returns whether the timer was still waiting to expire.
+  bool cancel(Handle H) noexcept;
+
+  /// Turns the wheel to \p Now and calls the callbacks of every timer that
+  /// expired, in the order of their deadlines. Callbacks may schedule and
+  /// cancel timers.
+  ///
+  /// \returns the number of callbacks called.
+  std::size_t advance(Clock::time_point Now = Clock::now());
+
+  /// \returns how long an event loop may block at \p Now before it has to
+  /// \p advance() the wheel, or a negative value if no timers are scheduled.
+  ///
+  /// The result is not later than the earliest deadline, but might be earlier
+  /// if the earliest timer is on a higher level of the wheel and must be
+  /// cascaded first.
+  std::chrono::milliseconds
+  timeout(Clock::time_point Now = Clock::now()) const noexcept;
+
+private:
+  static constexpr std::uint32_t None = ~std::uint32_t{0};
+
+  struct Node
+  {
+    /// The tick at which the timer expires.
+    std::uint64_t Expiry;
+    /// The generation of the node, which is incremented whenever the node is
+    /// released. A node with \p 0 is never a valid handle.
+    std::uint32_t Generation = 1;
+    /// The slot (\p Level * \p SlotCount + \p Slot) the node is linked into,
+    /// or \p None if the node is free.
+    std::uint32_t SlotIndex = None;
+    std::uint32_t Prev = None;
+    std::uint32_t Next = None;
+    Callback Fn;
+  };
+
+  std::chrono::milliseconds Resolution;
+  Clock::time_point Epoch;
+  /// The last tick that \p advance() processed.
+  std::uint64_t CurrentTick = 0;
+  std::size_t Count = 0;
+
+  std::vector<Node> Nodes;
+  /// The head of the list of released \p Nodes, linked through \p Next.
+  std::uint32_t FreeList = None;
+  /// The first node of each slot, for every level.
+  std::array<std::uint32_t, LevelCount * SlotCount> Slots;
+  /// Whether the slots of a level are non-empty, one bit for each slot.
+  std::array<std::uint64_t, LevelCount> Occupied{};
+
+  /// \returns the number of ticks passed from \p Epoch to \p T, rounded
+  /// down, or up if \p RoundUp is set.
+  std::uint64_t ticksAt(Clock::time_point T, bool RoundUp) const noexcept;
+  Clock::time_point timeOf(std::uint64_t Tick) const noexcept;
+
+  /// Links the node \p I into the slot matching its expiry.
+  void link(std::uint32_t I) noexcept;
+  void unlink(std::uint32_t I) noexcept;
+  void release(std::uint32_t I) noexcept;
+  /// Re-links every node of the \p Slot of \p Level into the lower levels.
+  void cascade(std::size_t Level, std::size_t Slot) noexcept;
+};
+
+} // namespace monomux
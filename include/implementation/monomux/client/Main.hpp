@@ -23,6 +23,7 @@
 
 #include "monomux/client/Client.hpp"
 #include "monomux/system/Environment.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
 #include "monomux/system/Process.hpp"
 
 namespace monomux::client
@@ -67,6 +68,40 @@ struct Options
   /// \note This is a control-mode flag.
   bool StatisticsRequest : 1;
 
+  /// Whether it was requested to gather the counters of the running server.
+  ///
+  /// \note This is a control-mode flag.
+  bool MetricsRequest : 1;
+
+  /// Whether it was requested to show the resources used by the sessions of
+  /// the running server.
+  ///
+  /// \note This is a control-mode flag.
+  bool TopRequest : 1;
+
+  /// Whether the client should ask the server to multiplex the data and the
+  /// control messages over a single connection.
+  bool Multiplex : 1;
+
+  /// Whether the client should ask the server to send the output of the
+  /// session compressed.
+  bool Compress : 1;
+
+  /// Whether the client should ask the server to publish the output of the
+  /// session in shared memory.
+  bool SharedRing : 1;
+
+  /// Whether the echo of the keystrokes should be predicted and displayed
+  /// before it arrives from the session.
+  bool LocalEcho : 1;
+
+  /// Whether the client should attach as a viewer only, whose input is not
+  /// sent to the session.
+  bool ReadOnly : 1;
+
+  /// Whether the client should wait for events with \p io_uring(7).
+  bool IOUring : 1;
+
   /// The path to the server socket where the client should connect to.
   std::optional<std::string> SocketPath;
 
@@ -74,6 +109,10 @@ struct Options
   /// attach to if exists.
   std::optional<std::string> SessionName;
 
+  /// The limits of holding back the output of the session before writing it
+  /// to the terminal.
+  CoalescingLimits OutputCoalescing;
+
   /// The options of the programs to start if a new session is created during
   /// the client's connection. (Ignored if the client attaches to an existing
   /// session.)
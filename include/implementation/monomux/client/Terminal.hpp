@@ -17,11 +17,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <memory>
+#include <string>
+
 #include <termios.h>
 
 #include "monomux/adt/Atomic.hpp"
 #include "monomux/adt/POD.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/system/Compression.hpp"
+#include "monomux/system/EchoPredictor.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
 #include "monomux/system/Pipe.hpp"
 
 namespace monomux::client
@@ -57,6 +63,20 @@ public:
   /// \p output().
   void setupClient(Client& Client);
 
+  /// Sets the limits of holding back the output received by the client
+  /// before writing it to \p output(). If the limits are not \p enabled(),
+  /// output is written as soon as it is received.
+  ///
+  /// \note This must be set before calling \p setupClient().
+  void setOutputCoalescing(CoalescingLimits Limits);
+
+  /// Sets whether the echo of printable keystrokes is displayed immediately,
+  /// before the echo from the session arrives, while the terminal of the
+  /// attached session echoes the input.
+  ///
+  /// \see EchoPredictor
+  void setLocalEcho(bool Enabled);
+
   Client* getClient() noexcept { return AssociatedClient; }
   const Client* getClient() const noexcept { return AssociatedClient; }
 
@@ -81,6 +101,36 @@ private:
   UniqueScalar<bool, false> Engaged;
   POD<struct ::termios> OriginalTerminalSettings;
 
+  /// Decides when the output received by the client is written, if it is
+  /// coalesced.
+  std::unique_ptr<OutputCoalescer> Coalescer;
+  /// The output received by the client but not yet written to \p Out.
+  std::string PendingOutput;
+
+  /// Decompresses the output received by the client, if it is compressed.
+  std::unique_ptr<Inflater> Decompressor;
+  /// The output last read from the shared ring of the session.
+  std::string RingOutput;
+
+  /// Predicts the echo of the input, if local echo is enabled.
+  std::unique_ptr<EchoPredictor> Predictor;
+
+  /// Whether reading the output of the session is suspended because the
+  /// terminal can not keep up with writing it.
+  UniqueScalar<bool, false> OutputThrottled;
+
+  /// Writes \p Data to \p Out, buffering what the terminal can not accept
+  /// right now.
+  void writeOutput(std::string_view Data);
+  /// Writes \p Data produced by the \p Predictor to \p Out, after the output
+  /// held back.
+  void writePrediction(std::string_view Data);
+  /// Listens for \p Out becoming writable while there is buffered output,
+  /// and suspends reading more output if too much is buffered.
+  void updateOutputBackpressure();
+  /// Blocks until all output buffered for \p Out is written.
+  void drainOutput();
+
   /// Whether a signal interrupt indicated that the window size of the client
   /// had changed.
   mutable Atomic<bool> WindowSizeChanged;
@@ -97,6 +147,12 @@ private:
   static void clientInput(Terminal* Term, Client& Client);
   /// Callback function fired when the client reports available output.
   static void clientOutput(Terminal* Term, Client& Client);
+  /// Callback function fired when the terminal is ready to accept buffered
+  /// output.
+  static void clientOutputReady(Terminal* Term, Client& Client);
+  /// Callback function fired when the delay of holding back the output
+  /// expired.
+  static void clientOutputTimer(Terminal* Term, Client& Client);
   /// Callback function fired when the client is ready to process events of the
   /// environment.
   static void clientEventReady(Terminal* Term, Client& Client);
@@ -17,10 +17,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <chrono>
+#include <cstddef>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "monomux/system/CPUSet.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
+#include "monomux/system/OutputThrottle.hpp"
+
 namespace monomux::server
 {
 
@@ -43,8 +49,101 @@ struct Options
   /// has terminated.
   bool ExitOnLastSessionTerminate : 1;
 
+  /// Whether the output of sessions should be relayed to a single attached
+  /// client with \p splice().
+  bool SpliceRelay : 1;
+
+  /// Whether the session and data connections should be listened to in
+  /// edge-triggered mode.
+  bool EdgeTriggered : 1;
+
+  /// Whether the event queues should be backed by \p io_uring(7).
+  bool IOUring : 1;
+
+  /// Whether the contents of the screen of sessions is tracked and drawn to
+  /// clients attaching.
+  bool ScreenSnapshot : 1;
+
+  /// Whether the terminal of sessions should be sized to fit the smallest of
+  /// the attached clients, instead of following the most recent resize.
+  bool ResizeToSmallest : 1;
+
+  /// The number of additional threads to distribute the handling of sessions
+  /// to.
+  std::size_t ReactorCount;
+
+  /// The number of connections that may wait for being accepted.
+  std::size_t ListenBacklog;
+
+  /// The CPUs the threads of the server run on.
+  std::optional<CPUSet> ServerCPUs;
+
+  /// The CPUs the programs of the sessions run on.
+  std::optional<CPUSet> SessionCPUs;
+
+  /// The limits of holding back the output of sessions before sending it to
+  /// the clients.
+  CoalescingLimits OutputCoalescing;
+
+  /// The limits of the rate the output of each session is read at.
+  ThrottleLimits OutputThrottle;
+
+  /// The time after which idle sessions without clients hibernate, if
+  /// non-zero.
+  std::chrono::seconds HibernateAfter;
+
+  /// The time the server may take to shut down, if not the default.
+  std::optional<std::chrono::milliseconds> ShutdownTimeout;
+
+  /// The number of bytes buffered for a client after which it is considered
+  /// unable to keep up with the output of its session.
+  std::optional<std::size_t> ClientBufferLimit;
+
+  /// The number of bytes a single channel might buffer.
+  std::optional<std::size_t> BufferSizeMax;
+
+  /// The number of bytes all channels together might buffer before writers
+  /// are held back.
+  std::optional<std::size_t> BufferBudget;
+
+  /// The number of bytes of the most recent output of sessions that is
+  /// replayed to clients attaching.
+  std::size_t Scrollback;
+
+  /// The number of bytes of the most recent output of sessions that is kept
+  /// on disk.
+  std::size_t SessionLog;
+
+  /// The directory the output of sessions is recorded to, if any.
+  std::optional<std::string> RecordDirectory;
+
+  /// The pattern of the names of the sessions that are recorded.
+  std::optional<std::string> RecordPattern;
+
+  /// The prefix of the files the event loops of the server are traced to.
+  std::optional<std::string> EventTrace;
+
+  /// The size of the shared memory ring the output of sessions is published
+  /// in for local clients, if non-zero.
+  std::size_t SharedRing;
+
+  /// The number of sessions running the default shell to start in advance.
+  std::size_t SessionPool;
+
   /// The path of the server socket to start listening on.
   std::optional<std::string> SocketPath;
+
+  /// The path of the socket to serve the metrics of the server on, if any.
+  std::optional<std::string> MetricsSocketPath;
+
+  /// The inherited file descriptor to write a byte to, and close, once the
+  /// server socket accepts connections. Used by clients starting a server, to
+  /// connect without polling for it.
+  std::optional<int> ReadyFD;
+
+  /// The inherited file descriptor to read the state handed over by the
+  /// previous instance of the server from, during a live upgrade.
+  std::optional<int> RestoreFD;
 };
 
 /// \p exec() into a server process that is created with the \p Opts options.
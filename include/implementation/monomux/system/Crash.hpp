@@ -19,6 +19,7 @@
 #pragma once
 #include <cstdint>
 #include <iosfwd>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -28,6 +29,54 @@
 namespace monomux
 {
 
+/// The raw data about a crash written by \p writeCrashReport(): the return
+/// addresses of the stack frames, and where the objects of the program were
+/// loaded in memory, which suffice to symbolise the stack afterwards.
+struct CrashReport
+{
+  struct Module
+  {
+    /// The range of memory the segments of the object are loaded to.
+    std::uintptr_t Begin, End;
+    /// The address the object is loaded at, relative to which the addresses
+    /// in the image on the disk are.
+    std::uintptr_t Base;
+    std::string Path;
+  };
+
+  std::string Version;
+  int Signal = 0;
+  std::vector<Module> Modules;
+  /// The return addresses of the stack frames, the most recent first.
+  std::vector<std::uintptr_t> Frames;
+
+  /// \returns the module the code at \p Address is loaded from, if any.
+  const Module* moduleOf(std::uintptr_t Address) const noexcept;
+
+  /// Parses the format written by \p writeCrashReport().
+  static std::optional<CrashReport> parse(std::string_view Data);
+  /// Reads and parses the report in the file at \p Path.
+  static std::optional<CrashReport> load(const std::string& Path);
+};
+
+/// Prepares writing crash reports of the running program, of \p Version, to
+/// files in \p Directory, so \p writeCrashReport() does not have to allocate
+/// memory, or load libraries.
+void prepareCrashReport(const std::string& Directory,
+                        const std::string& Version);
+
+/// Writes the \p CrashReport of the current stack, due to \p Signal, to a new
+/// file in the directory set by \p prepareCrashReport().
+///
+/// \note Only async-signal-safe functions are called, except for
+/// \p dl_iterate_phdr(), which takes the lock of the dynamic loader.
+///
+/// \returns the path of the file written, in a static buffer, or \p nullptr,
+/// if the file could not be created.
+const char* writeCrashReport(int Signal) noexcept;
+
+class SymbolCache;
+
 /// Handler for formatting a raw "Segmentation fault" or "Aborted" crash message
 /// into something meaningful that aids with debugging.
 class Backtrace
@@ -119,6 +168,10 @@ public:
   /// skipped from the report.
   Backtrace(std::size_t Depth = MaxSize, std::size_t Ignore = 0);
 
+  /// Creates the backtrace of the stack recorded in \p Report. The frames
+  /// only have their address and binary set, until \p prettify() is called.
+  explicit Backtrace(const CrashReport& Report);
+
   ~Backtrace();
 
   /// \returns the stack frames created and stored when the \p Backtrace
@@ -128,7 +181,10 @@ public:
 
   /// Prettify the stack symbol information and fill \p Pretty for each \p Frame
   /// by calling system binaries such as \p addr2line on the collected raw data.
-  void prettify();
+  ///
+  /// If \p Cache is set, the frames found in it are not symbolised again, and
+  /// the results for the rest are added to it.
+  void prettify(SymbolCache* Cache = nullptr);
 
   const std::size_t IgnoredFrameCount;
 
@@ -138,6 +194,46 @@ private:
   /// The buffer where the backtrace generator returns the symbol information
   /// in a string format.
   const char* const* SymbolDataBuffer;
+  /// The storage for the raw data of frames loaded from a \p CrashReport.
+  ///
+  /// \note The size is reserved in advance, so the views into the elements
+  /// remain valid.
+  std::vector<std::string> LoadedData;
+};
+
+/// Keeps the results of symbolisation in a file, so the stack frames in the
+/// same build of a binary are not symbolised again in later runs.
+class SymbolCache
+{
+public:
+  /// Loads the cache from \p Path, if the file exists.
+  explicit SymbolCache(std::string Path);
+
+  /// \returns the default location of the cache, in \p XDG_CACHE_HOME.
+  static std::string defaultPath();
+
+  /// \returns the symbol for the frame at \p ImageOffset in \p Binary, if
+  /// it had been symbolised, and the binary did not change since.
+  std::optional<Backtrace::Symbol> find(const std::string& Binary,
+                                        const void* ImageOffset) const;
+  void insert(const std::string& Binary,
+              const void* ImageOffset,
+              const Backtrace::Symbol& Symbol);
+  std::size_t size() const noexcept { return Entries.size(); }
+
+  /// Writes the cache to its file, if it changed since it was loaded.
+  void save() const;
+
+private:
+  std::string Path;
+  /// Maps the identity of a frame to the serialised symbol of it.
+  std::map<std::string, std::string> Entries;
+  bool Changed = false;
+
+  /// \returns the key that identifies the frame at \p ImageOffset in the
+  /// current build of \p Binary, or an empty string, if the file does not
+  /// exist.
+  static std::string key(const std::string& Binary, const void* ImageOffset);
 };
 
 /// Prints \p Trace to the output \p OS using the default formatting logic.
@@ -25,6 +25,10 @@
 #include <memory>
 #include <string>
 
+#include <signal.h>
+
+#include "monomux/system/fd.hpp"
+
 namespace monomux
 {
 
@@ -33,6 +37,11 @@ namespace monomux
 /// This class allows client code to register specific callbacks to fire when a
 /// signal is received by the running program.
 ///
+/// Signals chosen with \p deliverThroughFile() are blocked instead, and arrive
+/// through a \p signalfd, which the event loop of the program can wait on
+/// together with its other files. Their callbacks fire from \p dispatchFile(),
+/// in the normal flow of the program, not interrupting it.
+///
 /// \warning Signal settings of a process is a \b GLOBAL state! This class
 /// exposes a user interface for signal management but puts no effort into
 /// tracking changes done by the low-level API: do \b NOT use this class and the
@@ -130,6 +139,18 @@ private:
   /// A lookup table for the signal codes that were masked by \p ignore().
   std::array<bool, SignalCount> MaskedSignals;
 
+  /// A lookup table for the signal codes selected by \p deliverThroughFile().
+  std::array<bool, SignalCount> FileSignals;
+  /// The signals currently blocked and read from \p SignalFile.
+  ::sigset_t SignalFileSet;
+  fd SignalFile;
+
+  /// Blocks the signals in \p SignalFileSet and updates \p SignalFile to
+  /// receive them, or closes it if there are none.
+  void updateSignalFile();
+  /// Stops receiving \p SigNum through \p SignalFile, if it was.
+  void releaseFromFile(Signal SigNum);
+
 public:
   /// Retrieve the \b GLOBAL \p SignalHandling object for the process.
   /// If no such object exists, it will be constructed.
@@ -170,6 +191,25 @@ public:
   /// restored.
   void disable();
 
+  /// Sets \p SigNum to be delivered through \p signalFile() instead of an
+  /// asynchronous handler, once \p enable() is called.
+  ///
+  /// \note The signal is blocked in the thread calling \p enable(), and the
+  /// threads it starts later. Threads started earlier must block it too, as
+  /// otherwise the signal can get the default treatment in them.
+  ///
+  /// \see signalfd(2)
+  void deliverThroughFile(Signal SigNum);
+
+  /// \returns the file the signals selected by \p deliverThroughFile() can be
+  /// read from, or \p fd::Invalid if no such signal is enabled.
+  raw_fd signalFile() const noexcept { return SignalFile.get(); }
+
+  /// Reads the signals pending on \p signalFile(), and fires their callbacks.
+  ///
+  /// \returns the number of signals handled.
+  std::size_t dispatchFile();
+
   /// Reset the signal handling configuration for the current process to its
   /// default state.
   void reset();
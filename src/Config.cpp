@@ -46,6 +46,28 @@ std::string getHumanReadableConfiguration()
   Buf << " + Non-essential trace logs\n";
 #endif /* MONOMUX_NON_ESSENTIAL_LOGS */
 
+#ifndef MONOMUX_IO_URING
+  Buf << " - io_uring event queue\n";
+#else  /* !MONOMUX_IO_URING */
+  Buf << " + io_uring event queue\n";
+#endif /* MONOMUX_IO_URING */
+
+#ifndef MONOMUX_COMPRESSION
+  Buf << " - Output compression\n";
+#else  /* !MONOMUX_COMPRESSION */
+  Buf << " + Output compression (zlib)\n";
+#endif /* MONOMUX_COMPRESSION */
+
+#ifndef MONOMUX_TRACE_PROBES
+  Buf << " - Tracing probes\n";
+#else /* !MONOMUX_TRACE_PROBES */
+#ifdef MONOMUX_HAVE_SYS_SDT_H
+  Buf << " + Tracing probes (USDT)\n";
+#else  /* !MONOMUX_HAVE_SYS_SDT_H */
+  Buf << " + Tracing probes (uprobe on 'monomux_probe')\n";
+#endif /* MONOMUX_HAVE_SYS_SDT_H */
+#endif /* MONOMUX_TRACE_PROBES */
+
   std::string S = Buf.str();
 
   {
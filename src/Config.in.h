@@ -28,6 +28,24 @@
  */
 #cmakedefine MONOMUX_NON_ESSENTIAL_LOGS
 
+/* If set, the built binary will contain an io_uring(7)-based event queue that
+ * can be selected at run-time as an alternative to epoll(7).
+ */
+#cmakedefine MONOMUX_IO_URING
+
+/* If set, the built binary can compress the output of sessions sent to the
+ * clients with zlib.
+ */
+#cmakedefine MONOMUX_COMPRESSION
+
+/* If set, the built binary contains static tracing probes at the hot paths,
+ * see "monomux/Trace.hpp".
+ */
+#cmakedefine MONOMUX_TRACE_PROBES
+
+/* Whether the USDT probe macros of SystemTap's "sys/sdt.h" are available. */
+#cmakedefine MONOMUX_HAVE_SYS_SDT_H
+
 /* The build type for the current build. */
 #define MONOMUX_BUILD_TYPE "${CMAKE_BUILD_TYPE}"
 
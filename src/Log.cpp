@@ -16,8 +16,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <thread>
+#include <vector>
 
+#include <pthread.h>
+
+#include "monomux/adt/SPSCRingBuffer.hpp"
 #include "monomux/system/Time.hpp"
 
 #include "monomux/Log.hpp"
@@ -47,28 +54,265 @@ const char* Logger::levelName(Severity S) noexcept
   return SeverityName[S];
 }
 
-Logger::OutputBuffer::OutputBuffer(std::ostream& OS,
-                                   bool Discard,
+Logger::OutputBuffer::OutputBuffer(Logger& Owner,
+                                   Severity S,
                                    std::string_view Prefix)
-  : Discard(Discard), OS(&OS)
+  : Owner(&Owner), S(S)
 {
-  if (!Discard)
-    Buffer << Prefix;
+  Buffer.emplace();
+  *Buffer << Prefix;
 }
 
 Logger::OutputBuffer::~OutputBuffer() noexcept(false)
 {
-  if (!Discard)
-    (*OS) << Buffer.str() << std::endl;
+  if (Buffer)
+    Owner->emit(S, Buffer->str());
+}
+
+/// The implementation of the asynchronous mode of the \p Logger.
+///
+/// Every thread that logs gets its own single-producer, single-consumer queue
+/// of formatted messages, so putting a message into the queue does not
+/// synchronise with any other logging threads. The writer thread wakes up
+/// when a message is queued after it went to sleep, or periodically, and
+/// writes the contents of all the queues at once.
+class Logger::AsyncBackend
+{
+public:
+  /// The capacity of a thread's queue. A message that does not fit is written
+  /// synchronously by the thread that logs it.
+  static constexpr std::size_t QueueSize = 1 << 16;
+  /// The longest time a queued message waits for the writer thread.
+  static constexpr std::chrono::milliseconds WakeInterval{50};
+
+  struct Queue
+  {
+    SPSCRingBuffer<> Ring{QueueSize};
+    /// Set when the thread that logs into the queue has exited.
+    std::atomic<bool> Retired{false};
+  };
+
+  AsyncBackend(Logger& Owner);
+  ~AsyncBackend();
+
+  /// (Logging thread.) Puts \p Message into the queue of the current thread.
+  ///
+  /// \returns \p false, and queues nothing, if the message did not fit.
+  bool push(std::string_view Message);
+
+  /// (Logging thread.) Writes the queue of the current thread to the output.
+  ///
+  /// \pre The \p OutputLock of the owner is held.
+  void drainLocal();
+
+  /// Writes every queue to the output.
+  ///
+  /// \pre The \p OutputLock of the owner is held.
+  void drain();
+
+  /// Detaches from the writer thread, which does not exist after a \p fork().
+  void abandon() noexcept { Writer.release(); }
+
+private:
+  Logger& Owner;
+  /// Identifies this instance for the thread-local queue pointers, which
+  /// might outlive it.
+  const std::size_t Generation;
+
+  std::mutex RegistryLock;
+  std::vector<std::shared_ptr<Queue>> Queues;
+
+  std::mutex WakeLock;
+  std::condition_variable Wake;
+  std::atomic<bool> Sleeping = false;
+  std::atomic<bool> Stopping = false;
+  std::unique_ptr<std::thread> Writer;
+
+  /// The queue of the current thread, which is retired when the thread exits.
+  struct LocalQueue
+  {
+    std::size_t Generation = 0;
+    std::shared_ptr<Queue> Q;
+
+    ~LocalQueue()
+    {
+      if (Q)
+        Q->Retired.store(true, std::memory_order_release);
+    }
+  };
+  static thread_local LocalQueue CurrentQueue;
+  static std::atomic<std::size_t> NextGeneration;
+
+  Queue& localQueue();
+  /// Writes the published contents of \p Q to the output.
+  ///
+  /// \returns whether anything was written.
+  bool drain(Queue& Q);
+  void run();
+};
+
+thread_local Logger::AsyncBackend::LocalQueue
+  Logger::AsyncBackend::CurrentQueue;
+std::atomic<std::size_t> Logger::AsyncBackend::NextGeneration = 1;
+
+Logger::AsyncBackend::AsyncBackend(Logger& Owner)
+  : Owner(Owner), Generation(NextGeneration.fetch_add(1))
+{
+  Writer = std::make_unique<std::thread>([this] { run(); });
+}
+
+Logger::AsyncBackend::~AsyncBackend()
+{
+  if (Writer)
+  {
+    {
+      std::lock_guard<std::mutex> Lock{WakeLock};
+      Stopping.store(true);
+    }
+    Wake.notify_one();
+    Writer->join();
+  }
+
+  std::lock_guard<std::mutex> Lock{Owner.OutputLock};
+  drain();
+}
+
+Logger::AsyncBackend::Queue& Logger::AsyncBackend::localQueue()
+{
+  if (CurrentQueue.Generation != Generation)
+  {
+    if (CurrentQueue.Q)
+      CurrentQueue.Q->Retired.store(true, std::memory_order_release);
+    CurrentQueue.Q = std::make_shared<Queue>();
+    CurrentQueue.Generation = Generation;
+
+    std::lock_guard<std::mutex> Lock{RegistryLock};
+    Queues.emplace_back(CurrentQueue.Q);
+  }
+  return *CurrentQueue.Q;
+}
+
+bool Logger::AsyncBackend::push(std::string_view Message)
+{
+  Queue& Q = localQueue();
+  std::array<SPSCRingBuffer<>::Range, 2> Free =
+    Q.Ring.reserveBack(Message.size());
+  if (Free[0].Size + Free[1].Size < Message.size())
+    return false;
+
+  std::size_t Count = 0;
+  for (const SPSCRingBuffer<>::Range& R : Free)
+  {
+    const std::size_t Len = std::min(Message.size() - Count, R.Size);
+    Message.copy(R.Begin, Len, Count);
+    Count += Len;
+  }
+  Q.Ring.commitBack(Count);
+  Q.Ring.publish();
+
+  if (Sleeping.exchange(false))
+    Wake.notify_one();
+  return true;
+}
+
+bool Logger::AsyncBackend::drain(Queue& Q)
+{
+  // Only what is already published is written, so a busy thread can not keep
+  // the output locked.
+  std::size_t Count = 0;
+  for (const SPSCRingBuffer<>::Range& R : Q.Ring.peekFrontRanges(QueueSize))
+  {
+    if (!R.Size)
+      continue;
+    Owner.OS->write(R.Begin, static_cast<std::streamsize>(R.Size));
+    Count += R.Size;
+  }
+  Q.Ring.dropFront(Count);
+  return Count != 0;
+}
+
+void Logger::AsyncBackend::drainLocal()
+{
+  if (CurrentQueue.Generation == Generation && CurrentQueue.Q)
+    drain(*CurrentQueue.Q);
+}
+
+void Logger::AsyncBackend::drain()
+{
+  bool Written = false;
+  {
+    std::lock_guard<std::mutex> Lock{RegistryLock};
+    for (auto It = Queues.begin(); It != Queues.end();)
+    {
+      // If the thread exited, nothing more will be published after the
+      // contents here are written.
+      const bool Retired = (*It)->Retired.load(std::memory_order_acquire);
+      Written |= drain(**It);
+      if (Retired)
+        It = Queues.erase(It);
+      else
+        ++It;
+    }
+  }
+  if (Written)
+    Owner.OS->flush();
+}
+
+void Logger::AsyncBackend::run()
+{
+  std::unique_lock<std::mutex> Lock{WakeLock};
+  while (!Stopping.load())
+  {
+    Lock.unlock();
+    {
+      std::lock_guard<std::mutex> OutLock{Owner.OutputLock};
+      drain();
+    }
+    Lock.lock();
+
+    // A message queued between the drain and falling asleep waits for at most
+    // one interval.
+    Sleeping.store(true);
+    if (!Stopping.load())
+      Wake.wait_for(Lock, WakeInterval);
+    Sleeping.store(false);
+  }
 }
 
 std::unique_ptr<Logger> Logger::Singleton;
 
+void Logger::atForkPrepare() noexcept
+{
+  if (Singleton)
+    Singleton->OutputLock.lock();
+}
+
+void Logger::atForkParent() noexcept
+{
+  if (Singleton)
+    Singleton->OutputLock.unlock();
+}
+
+void Logger::atForkChild() noexcept
+{
+  if (!Singleton)
+    return;
+  Singleton->OutputLock.unlock();
+  if (Singleton->Async)
+  {
+    // The messages queued belong to the parent, and the writer thread only
+    // exists there. The child continues logging synchronously.
+    Singleton->Async->abandon();
+    (void)Singleton->Async.release();
+  }
+}
+
 Logger& Logger::get()
 {
   if (!Singleton)
   {
     Singleton = std::make_unique<Logger>(Default, std::clog);
+    ::pthread_atfork(&atForkPrepare, &atForkParent, &atForkChild);
     MONOMUX_TRACE_LOG(Singleton->operator()(log::Debug, "logger")
                       << "Initialised at address " << Singleton.get());
   }
@@ -91,21 +335,80 @@ std::size_t Logger::digits(std::size_t Number)
 
 Logger::Logger(Severity S, std::ostream& OS) : SeverityLimit(S), OS(&OS) {}
 
-Logger::OutputBuffer Logger::operator()(Severity S, std::string_view Facility)
+Logger::~Logger() = default;
+
+void Logger::setOutput(std::ostream& OS)
+{
+  std::lock_guard<std::mutex> Lock{OutputLock};
+  if (Async)
+    Async->drain();
+  this->OS = &OS;
+}
+
+void Logger::setAsynchronous(bool Async)
+{
+  if (Async && !this->Async)
+    this->Async = std::make_unique<AsyncBackend>(*this);
+  else if (!Async)
+    this->Async.reset();
+}
+
+void Logger::flush()
+{
+  std::lock_guard<std::mutex> Lock{OutputLock};
+  if (Async)
+    Async->drain();
+  OS->flush();
+}
+
+/// \returns the formatted current time. As the format has a resolution of
+/// seconds, the string is only rebuilt once every second, per thread.
+static const std::string& timestamp()
 {
-  std::ostringstream LogPrefix;
-  bool Discarding = S > getLimit();
-  if (!Discarding)
+  thread_local std::time_t CachedTime = -1;
+  thread_local std::string CachedStamp;
+
+  const auto Now = std::chrono::system_clock::now();
+  if (std::time_t T = std::chrono::system_clock::to_time_t(Now);
+      T != CachedTime)
   {
-    LogPrefix << '[' << formatTime(std::chrono::system_clock::now()) << ']';
-    if (std::string_view SN = SeverityName[S]; !SN.empty())
-      LogPrefix << '[' << SN << "] ";
-    if (!Facility.empty())
-      LogPrefix << Facility << ": ";
-    else
-      LogPrefix << "?: ";
+    CachedTime = T;
+    CachedStamp = formatTime(Now);
   }
-  return OutputBuffer{*OS, Discarding, LogPrefix.str()};
+  return CachedStamp;
+}
+
+Logger::OutputBuffer Logger::format(Severity S, std::string_view Facility)
+{
+  std::string LogPrefix;
+  LogPrefix.reserve(64); // NOLINT(readability-magic-numbers)
+  LogPrefix.push_back('[');
+  LogPrefix.append(timestamp());
+  LogPrefix.push_back(']');
+  if (std::string_view SN = SeverityName[S]; !SN.empty())
+  {
+    LogPrefix.push_back('[');
+    LogPrefix.append(SN);
+    LogPrefix.append("] ");
+  }
+  LogPrefix.append(!Facility.empty() ? Facility : "?");
+  LogPrefix.append(": ");
+  return OutputBuffer{*this, S, LogPrefix};
+}
+
+void Logger::emit(Severity S, std::string&& Message)
+{
+  Message.push_back('\n');
+  if (Async && S > Fatal && Async->push(Message))
+    return;
+
+  // Messages are written synchronously if the queue is full, and the last
+  // words of the program are never left in a queue.
+  std::lock_guard<std::mutex> Lock{OutputLock};
+  if (Async)
+    Async->drainLocal();
+  OS->write(Message.data(), static_cast<std::streamsize>(Message.size()));
+  OS->flush();
 }
 
 } // namespace monomux::log
@@ -0,0 +1,29 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "monomux/Trace.hpp"
+
+#if defined(MONOMUX_TRACE_PROBES) && !defined(MONOMUX_HAVE_SYS_SDT_H)
+extern "C" __attribute__((noinline, used)) void
+monomux_probe(const char* Name, std::uint64_t A0, std::uint64_t A1) noexcept
+{
+  // The function must not be optimised away, as it is the point the tracer
+  // attaches to.
+  asm volatile("" : : "r"(Name), "r"(A0), "r"(A1) : "memory");
+}
+#endif /* MONOMUX_TRACE_PROBES && !MONOMUX_HAVE_SYS_SDT_H */
@@ -0,0 +1,462 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define MONOMUX_SCAN_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define MONOMUX_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#include "monomux/adt/ByteScan.hpp"
+
+namespace monomux::scan
+{
+
+namespace
+{
+
+/// The set of routines implemented with a particular instruction set.
+struct Kernels
+{
+  std::size_t (*Find)(const char*, std::size_t, char) noexcept;
+  std::size_t (*FindEither)(const char*, std::size_t, char, char) noexcept;
+  std::size_t (*FindNonPrintable)(const char*, std::size_t) noexcept;
+  std::size_t (*Count)(const char*, std::size_t, char) noexcept;
+};
+
+bool isPrintable(char C) noexcept { return C >= 0x20 && C < 0x7F; }
+
+namespace scalar
+{
+
+std::size_t find(const char* Data, std::size_t Size, char C) noexcept
+{
+  const void* P = std::memchr(Data, C, Size);
+  return P ? static_cast<std::size_t>(static_cast<const char*>(P) - Data)
+           : Size;
+}
+
+std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept
+{
+  std::size_t I = 0;
+  for (; I < Size; ++I)
+    if (Data[I] == A || Data[I] == B)
+      break;
+  return I;
+}
+
+std::size_t findNonPrintable(const char* Data, std::size_t Size) noexcept
+{
+  std::size_t I = 0;
+  for (; I < Size; ++I)
+    if (!isPrintable(Data[I]))
+      break;
+  return I;
+}
+
+std::size_t count(const char* Data, std::size_t Size, char C) noexcept
+{
+  std::size_t N = 0;
+  for (std::size_t I = 0; I < Size; ++I)
+    N += Data[I] == C;
+  return N;
+}
+
+constexpr Kernels Set{&find, &findEither, &findNonPrintable, &count};
+
+} // namespace scalar
+
+#ifdef MONOMUX_SCAN_X86
+namespace sse2
+{
+
+constexpr std::size_t Width = 16;
+
+/// Scans \p Data in vectors, with \p Match calculating the mask of the
+/// interesting bytes in a vector, and the rest of the bytes with \p Tail.
+template <typename MatchFn, typename TailFn>
+std::size_t
+scan(const char* Data, std::size_t Size, MatchFn Match, TailFn Tail) noexcept
+{
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + I));
+    if (int Mask = _mm_movemask_epi8(Match(V)))
+      return I + __builtin_ctz(Mask);
+  }
+  return I + Tail(Data + I, Size - I);
+}
+
+std::size_t find(const char* Data, std::size_t Size, char C) noexcept
+{
+  const __m128i Needle = _mm_set1_epi8(C);
+  return scan(
+    Data,
+    Size,
+    [Needle](__m128i V) { return _mm_cmpeq_epi8(V, Needle); },
+    [C](const char* D, std::size_t S) { return scalar::find(D, S, C); });
+}
+
+std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept
+{
+  const __m128i NeedleA = _mm_set1_epi8(A);
+  const __m128i NeedleB = _mm_set1_epi8(B);
+  return scan(
+    Data,
+    Size,
+    [NeedleA, NeedleB](__m128i V) {
+      return _mm_or_si128(_mm_cmpeq_epi8(V, NeedleA),
+                          _mm_cmpeq_epi8(V, NeedleB));
+    },
+    [A, B](const char* D, std::size_t S) {
+      return scalar::findEither(D, S, A, B);
+    });
+}
+
+std::size_t findNonPrintable(const char* Data, std::size_t Size) noexcept
+{
+  // Compared as signed, bytes 0x80 and above are negative, so they are all
+  // found by the "less than 0x20" check.
+  const __m128i Space = _mm_set1_epi8(0x20);
+  const __m128i Delete = _mm_set1_epi8(0x7F);
+  return scan(
+    Data,
+    Size,
+    [Space, Delete](__m128i V) {
+      return _mm_or_si128(_mm_cmplt_epi8(V, Space), _mm_cmpeq_epi8(V, Delete));
+    },
+    &scalar::findNonPrintable);
+}
+
+std::size_t count(const char* Data, std::size_t Size, char C) noexcept
+{
+  const __m128i Needle = _mm_set1_epi8(C);
+  std::size_t N = 0;
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + I));
+    N += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(V, Needle)));
+  }
+  return N + scalar::count(Data + I, Size - I, C);
+}
+
+constexpr Kernels Set{&find, &findEither, &findNonPrintable, &count};
+
+} // namespace sse2
+
+namespace avx2
+{
+
+#define MONOMUX_AVX2 __attribute__((target("avx2")))
+
+constexpr std::size_t Width = 32;
+
+MONOMUX_AVX2 __m256i load(const char* P) noexcept
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P));
+}
+
+MONOMUX_AVX2 std::size_t find(const char* Data, std::size_t Size, char C) noexcept
+{
+  const __m256i Needle = _mm256_set1_epi8(C);
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+    if (auto Mask = static_cast<unsigned>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(load(Data + I), Needle))))
+      return I + __builtin_ctz(Mask);
+  return I + sse2::find(Data + I, Size - I, C);
+}
+
+MONOMUX_AVX2 std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept
+{
+  const __m256i NeedleA = _mm256_set1_epi8(A);
+  const __m256i NeedleB = _mm256_set1_epi8(B);
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    __m256i V = load(Data + I);
+    if (auto Mask = static_cast<unsigned>(_mm256_movemask_epi8(
+          _mm256_or_si256(_mm256_cmpeq_epi8(V, NeedleA),
+                          _mm256_cmpeq_epi8(V, NeedleB)))))
+      return I + __builtin_ctz(Mask);
+  }
+  return I + sse2::findEither(Data + I, Size - I, A, B);
+}
+
+MONOMUX_AVX2 std::size_t findNonPrintable(const char* Data,
+                                          std::size_t Size) noexcept
+{
+  const __m256i Space = _mm256_set1_epi8(0x20);
+  const __m256i Delete = _mm256_set1_epi8(0x7F);
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    __m256i V = load(Data + I);
+    if (auto Mask = static_cast<unsigned>(_mm256_movemask_epi8(
+          _mm256_or_si256(_mm256_cmpgt_epi8(Space, V),
+                          _mm256_cmpeq_epi8(V, Delete)))))
+      return I + __builtin_ctz(Mask);
+  }
+  return I + sse2::findNonPrintable(Data + I, Size - I);
+}
+
+MONOMUX_AVX2 std::size_t count(const char* Data,
+                               std::size_t Size,
+                               char C) noexcept
+{
+  const __m256i Needle = _mm256_set1_epi8(C);
+  std::size_t N = 0;
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+    N += __builtin_popcount(static_cast<unsigned>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(load(Data + I), Needle))));
+  return N + sse2::count(Data + I, Size - I, C);
+}
+
+#undef MONOMUX_AVX2
+
+constexpr Kernels Set{&find, &findEither, &findNonPrintable, &count};
+
+} // namespace avx2
+#endif // MONOMUX_SCAN_X86
+
+#ifdef MONOMUX_SCAN_NEON
+namespace neon
+{
+
+constexpr std::size_t Width = 16;
+
+/// \returns a mask of 4 bits per byte of the comparison result \p M, as NEON
+/// has no equivalent of \p movemask.
+std::uint64_t mask(uint8x16_t M) noexcept
+{
+  return vget_lane_u64(
+    vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(M), 4)), 0);
+}
+
+/// Scans \p Data in vectors, with \p Match calculating the interesting bytes
+/// in a vector, and the rest of the bytes with \p Tail.
+template <typename MatchFn, typename TailFn>
+std::size_t
+scan(const char* Data, std::size_t Size, MatchFn Match, TailFn Tail) noexcept
+{
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    uint8x16_t V = vld1q_u8(reinterpret_cast<const std::uint8_t*>(Data + I));
+    if (std::uint64_t Mask = mask(Match(V)))
+      return I + (__builtin_ctzll(Mask) >> 2);
+  }
+  return I + Tail(Data + I, Size - I);
+}
+
+std::size_t find(const char* Data, std::size_t Size, char C) noexcept
+{
+  const uint8x16_t Needle = vdupq_n_u8(static_cast<std::uint8_t>(C));
+  return scan(
+    Data,
+    Size,
+    [Needle](uint8x16_t V) { return vceqq_u8(V, Needle); },
+    [C](const char* D, std::size_t S) { return scalar::find(D, S, C); });
+}
+
+std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept
+{
+  const uint8x16_t NeedleA = vdupq_n_u8(static_cast<std::uint8_t>(A));
+  const uint8x16_t NeedleB = vdupq_n_u8(static_cast<std::uint8_t>(B));
+  return scan(
+    Data,
+    Size,
+    [NeedleA, NeedleB](uint8x16_t V) {
+      return vorrq_u8(vceqq_u8(V, NeedleA), vceqq_u8(V, NeedleB));
+    },
+    [A, B](const char* D, std::size_t S) {
+      return scalar::findEither(D, S, A, B);
+    });
+}
+
+std::size_t findNonPrintable(const char* Data, std::size_t Size) noexcept
+{
+  const uint8x16_t Space = vdupq_n_u8(0x20);
+  const uint8x16_t Delete = vdupq_n_u8(0x7F);
+  return scan(
+    Data,
+    Size,
+    [Space, Delete](uint8x16_t V) {
+      return vorrq_u8(vcltq_u8(V, Space), vcgeq_u8(V, Delete));
+    },
+    &scalar::findNonPrintable);
+}
+
+std::size_t count(const char* Data, std::size_t Size, char C) noexcept
+{
+  const uint8x16_t Needle = vdupq_n_u8(static_cast<std::uint8_t>(C));
+  std::size_t N = 0;
+  std::size_t I = 0;
+  for (; I + Width <= Size; I += Width)
+  {
+    uint8x16_t V = vld1q_u8(reinterpret_cast<const std::uint8_t*>(Data + I));
+    N += __builtin_popcountll(mask(vceqq_u8(V, Needle))) >> 2;
+  }
+  return N + scalar::count(Data + I, Size - I, C);
+}
+
+constexpr Kernels Set{&find, &findEither, &findNonPrintable, &count};
+
+} // namespace neon
+#endif // MONOMUX_SCAN_NEON
+
+const Kernels* kernelsOf(Implementation I) noexcept
+{
+  switch (I)
+  {
+    case Implementation::Scalar:
+      return &scalar::Set;
+#ifdef MONOMUX_SCAN_X86
+    case Implementation::SSE2:
+      return &sse2::Set;
+    case Implementation::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") ? &avx2::Set : nullptr;
+#endif
+#ifdef MONOMUX_SCAN_NEON
+    case Implementation::NEON:
+      return &neon::Set;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+Implementation best() noexcept
+{
+  for (Implementation I : {Implementation::AVX2,
+                           Implementation::SSE2,
+                           Implementation::NEON})
+    if (isSupported(I))
+      return I;
+  return Implementation::Scalar;
+}
+
+/// The implementation in use, selected on first use if unset.
+std::atomic<const Kernels*> ActiveKernels{nullptr};
+std::atomic<Implementation> ActiveImplementation{Implementation::Scalar};
+
+const Kernels& kernels() noexcept
+{
+  const Kernels* K = ActiveKernels.load(std::memory_order_relaxed);
+  if (!K)
+  {
+    Implementation I = best();
+    K = kernelsOf(I);
+    ActiveImplementation.store(I, std::memory_order_relaxed);
+    ActiveKernels.store(K, std::memory_order_relaxed);
+  }
+  return *K;
+}
+
+} // namespace
+
+const char* name(Implementation I) noexcept
+{
+  switch (I)
+  {
+    case Implementation::Scalar:
+      return "scalar";
+    case Implementation::SSE2:
+      return "SSE2";
+    case Implementation::AVX2:
+      return "AVX2";
+    case Implementation::NEON:
+      return "NEON";
+  }
+  return "<unknown>";
+}
+
+bool isSupported(Implementation I) noexcept { return kernelsOf(I); }
+
+Implementation active() noexcept
+{
+  (void)kernels();
+  return ActiveImplementation.load(std::memory_order_relaxed);
+}
+
+bool setActive(Implementation I) noexcept
+{
+  const Kernels* K = kernelsOf(I);
+  if (!K)
+    return false;
+  ActiveImplementation.store(I, std::memory_order_relaxed);
+  ActiveKernels.store(K, std::memory_order_relaxed);
+  return true;
+}
+
+std::size_t find(const char* Data, std::size_t Size, char C) noexcept
+{
+  return kernels().Find(Data, Size, C);
+}
+
+std::size_t
+findEither(const char* Data, std::size_t Size, char A, char B) noexcept
+{
+  return kernels().FindEither(Data, Size, A, B);
+}
+
+std::size_t findNonPrintable(const char* Data, std::size_t Size) noexcept
+{
+  return kernels().FindNonPrintable(Data, Size);
+}
+
+std::size_t count(const char* Data, std::size_t Size, char C) noexcept
+{
+  return kernels().Count(Data, Size, C);
+}
+
+std::size_t utf8CompletePrefix(const char* Data, std::size_t Size) noexcept
+{
+  // Find the lead byte of the last character, which is at most 3 bytes back.
+  for (std::size_t Back = 1; Back <= 4 && Back <= Size; ++Back)
+  {
+    const auto C = static_cast<unsigned char>(Data[Size - Back]);
+    if (C < 0x80)
+      // ASCII, which is always complete. (Continuation bytes before it are
+      // invalid, and not split further.)
+      return Size;
+    if (C < 0xC0)
+      // A continuation byte.
+      continue;
+
+    std::size_t Length = C >= 0xF0 ? 4 : C >= 0xE0 ? 3 : 2;
+    return Back >= Length ? Size : Size - Back;
+  }
+  return Size;
+}
+
+} // namespace monomux::scan
@@ -16,10 +16,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <csignal>
 #include <utility>
 
+#include <poll.h>
+
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
+#include "monomux/system/IOUring.hpp"
+#include "monomux/system/MuxedSocket.hpp"
 #include "monomux/system/Pipe.hpp"
 
 #include "monomux/client/Client.hpp"
@@ -50,6 +55,8 @@ std::optional<Client> Client::create(std::string SocketPath,
     }
 
     Client Conn{std::move(S)};
+    if (ConnStatus->BinaryVersion >= BinaryWireVersion)
+      Conn.Wire = WireFormat::Binary;
     return Conn;
   }
   catch (const std::system_error& Err)
@@ -59,15 +66,16 @@ std::optional<Client> Client::create(std::string SocketPath,
   return std::nullopt;
 }
 
-Client::Client(Socket&& ControlSock) : ControlSocket(std::move(ControlSock))
-{
-  setUpDispatch();
-}
+Client::Client(Socket&& ControlSock)
+  : ControlSocket(std::make_unique<Socket>(std::move(ControlSock)))
+{}
 
 void Client::registerMessageHandler(std::uint16_t Kind,
                                     std::function<HandlerFunction> Handler)
 {
-  Dispatch[Kind] = std::move(Handler);
+  if (Kind >= DispatchOverrides.size())
+    DispatchOverrides.resize(Kind + 1);
+  DispatchOverrides[Kind] = std::move(Handler);
 }
 
 void Client::setDataSocket(Socket&& DataSocket)
@@ -96,16 +104,87 @@ void Client::setInputFile(raw_fd FD)
     enableInputFile();
 }
 
+void Client::setOutputFile(raw_fd FD)
+{
+  bool PreviousOutputFileWasEnabled = OutputFileEnabled;
+  if (PreviousOutputFileWasEnabled)
+    disableOutputFile();
+
+  OutputFile = FD;
+  if (FD == fd::Invalid)
+    return;
+
+  if (PreviousOutputFileWasEnabled)
+    enableOutputFile();
+}
+
 bool Client::handshake(std::string* FailureReason)
 {
   using namespace monomux::message;
 
+  // A server that speaks the binary encoding takes the data connection over
+  // the control connection, which makes the handshake a single round trip.
+  bool Identified = false;
+  if (Wire == WireFormat::Binary)
+  {
+    auto [Connection, PeerEnd] =
+      Socket::pair(ControlSocket->identifier() + "-data");
+    request::Handshake Req;
+    Req.Multiplexed = MultiplexRequested;
+    Req.Compressed = CompressionRequested;
+    Req.SharedRing = SharedRingRequested && ControlSocket->canPassFiles();
+    std::string Request = encodeWithSize(Req, Wire);
+    if (ControlSocket->canPassFiles())
+      ControlSocket->writeWithFile(Request, PeerEnd.raw());
+    else
+      // (Over the network, the data connection is made separately, unless the
+      // server multiplexes the control one.)
+      ControlSocket->write(Request);
+
+    std::optional<response::Handshake> Response =
+      receiveMessage<response::Handshake>(*ControlSocket);
+    if (!Response)
+    {
+      if (FailureReason)
+        *FailureReason = "ERROR: Invalid response from Server when trying to "
+                         "establish connection.";
+      return false;
+    }
+    ClientID = Response->Client.ID;
+    Nonce.emplace(Response->Client.Nonce);
+    Compressed = Response->Compressed;
+    SharedRingAccepted = Response->SharedRing;
+    if (Response->Success && Response->Multiplexed)
+    {
+      if (ControlSocket->hasBufferedRead())
+      {
+        if (FailureReason)
+          *FailureReason = "ERROR: Unexpected data from Server when trying to "
+                           "multiplex the connection.";
+        return false;
+      }
+      // The connection passed over is not needed, and is closed.
+      multiplex();
+      return true;
+    }
+    if (Response->Success)
+    {
+      DataSocket = std::make_unique<Socket>(std::move(Connection));
+      return true;
+    }
+
+    // Otherwise, the identity is known, and the data connection is made the
+    // old-fashioned way.
+    Identified = true;
+  }
+
   // Authenticate the client on the server.
+  if (!Identified)
   {
-    sendMessage(ControlSocket, request::ClientID{});
+    sendMessage(*ControlSocket, request::ClientID{}, Wire);
 
     // We decode the response message to be able to fire the handler manually.
-    std::string Data = readPascalString(ControlSocket);
+    std::string Data = readPascalString(*ControlSocket);
     Message MB = Message::unpack(Data);
     if (MB.Kind != MessageKind::ClientIDResponse)
     {
@@ -127,7 +206,7 @@ bool Client::handshake(std::string* FailureReason)
   // If the control socket is now successfully established, establish another
   // connection to the same location, but for the data socket.
   auto DS =
-    std::make_unique<Socket>(Socket::connect(ControlSocket.identifier()));
+    std::make_unique<Socket>(Socket::connect(ControlSocket->identifier()));
   {
     // See if the server successfully accepted the second connection.
     std::optional<notification::Connection> ConnStatus =
@@ -154,7 +233,7 @@ bool Client::handshake(std::string* FailureReason)
     request::DataSocket Req;
     Req.Client.ID = ClientID;
     Req.Client.Nonce = consumeNonce();
-    sendMessage(*DS, Req);
+    sendMessage(*DS, Req, Wire);
 
     std::optional<response::DataSocket> Response =
       receiveMessage<response::DataSocket>(*DS);
@@ -178,10 +257,10 @@ bool Client::handshake(std::string* FailureReason)
   // After a successful data connection establishment, the Nonce value was
   // consumed, so we need to request a new one.
   {
-    sendMessage(ControlSocket, request::ClientID{});
+    sendMessage(*ControlSocket, request::ClientID{}, Wire);
 
     // We decode the response message to be able to fire the handler manually.
-    std::string Data = readPascalString(ControlSocket);
+    std::string Data = readPascalString(*ControlSocket);
     Message MB = Message::unpack(Data);
     if (MB.Kind != MessageKind::ClientIDResponse)
     {
@@ -219,25 +298,45 @@ void Client::loop()
                             "Client input callback is not registered."};
 
   static constexpr std::size_t EventQueue = 1 << 4;
-  Poll = std::make_unique<EPoll>(EventQueue);
+  Poll.reset();
+#ifdef MONOMUX_IO_URING
+  if (IOUringRequested)
+    try
+    {
+      Poll = std::make_unique<IOUring>(EventQueue);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(warn) << "Failed to create io_uring event queue, falling back to "
+                   "epoll: "
+                << Err.what();
+    }
+#endif /* MONOMUX_IO_URING */
+  if (!Poll)
+    Poll = std::make_unique<EPoll>(EventQueue);
 
-  fd::addStatusFlag(ControlSocket.raw(), O_NONBLOCK);
+  fd::addStatusFlag(ControlSocket->raw(), O_NONBLOCK);
   fd::addStatusFlag(DataSocket->raw(), O_NONBLOCK);
 
   enableControlResponse();
   enableDataSocket();
   enableInputFile();
+  for (const auto& File : WatchedFiles)
+    Poll->listen(File.first, /* Incoming =*/true, /* Outgoing =*/false);
 
   while (!TerminateLoop.get().load())
   {
-    ControlSocket.flushWrites();
+    ControlSocket->flushWrites();
+    if (Multiplexed)
+      scheduleMultiplexed();
     if (ExternalEventProcessor)
       // Process "external" events before blocking on "wait()".
       ExternalEventProcessor(*this);
-    ControlSocket.tryFreeResources();
+    ControlSocket->tryFreeResources();
     DataSocket->tryFreeResources();
 
-    const std::size_t NumTriggeredFDs = Poll->wait();
+    const std::size_t NumTriggeredFDs = Poll->wait(Timers.timeout());
+    Timers.advance();
     for (std::size_t I = 0; I < NumTriggeredFDs; ++I)
     {
       EPoll::EventWithMode Event;
@@ -258,6 +357,23 @@ void Client::loop()
 
       try
       {
+        if (Event.FD == DataSocket->raw() && Multiplexed)
+        {
+          // Reading either stream might keep the data of the other aside, so
+          // the streams are handled together.
+          if (Event.Incoming)
+          {
+            if (DataHandler && DataSocketEnabled)
+              DataHandler(*this);
+            if (ControlResponseEnabled &&
+                (!DataSocketEnabled || ControlSocket->hasBufferedRead()))
+              controlCallback();
+          }
+          if (Event.Outgoing)
+            static_cast<MuxedSocket&>(*DataSocket).flushConnection();
+          scheduleMultiplexed();
+          continue;
+        }
         if (Event.FD == DataSocket->raw())
         {
           if (Event.Incoming)
@@ -265,30 +381,53 @@ void Client::loop()
             if (DataHandler)
               DataHandler(*this);
 
-            if (DataSocket->hasBufferedRead())
+            if (DataSocketEnabled && DataSocket->hasBufferedRead())
               Poll->schedule(
                 DataSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+            else
+              scheduleSharedRing();
           }
           if (Event.Outgoing)
           {
-            DataSocket->flushWrites();
-            if (DataSocket->hasBufferedWrite())
+            if (DataSocket->tryFlushWrites().ok() &&
+                DataSocket->hasBufferedWrite())
               Poll->schedule(
                 DataSocket->raw(), /* Incoming =*/false, /* Outgoing =*/true);
           }
           continue;
         }
+        if (Ring && Event.FD == RingWakeup.get())
+        {
+          SharedRing::clearWakeup(RingWakeup.get());
+          if (DataHandler && DataSocketEnabled)
+            DataHandler(*this);
+          scheduleSharedRing();
+          continue;
+        }
+        if (OutputFile != fd::Invalid && Event.FD == OutputFile)
+        {
+          if (Event.Outgoing && OutputHandler)
+            OutputHandler(*this);
+          continue;
+        }
         if (InputFile != fd::Invalid && Event.FD == InputFile)
         {
           if (Event.Incoming && InputHandler)
             InputHandler(*this);
           continue;
         }
-        if (Event.FD == ControlSocket.raw() && Event.Incoming)
+        if (Event.FD == ControlSocket->raw() && Event.Incoming)
         {
           controlCallback();
           continue;
         }
+        if (auto File = WatchedFiles.find(Event.FD);
+            File != WatchedFiles.end() && Event.Incoming)
+        {
+          if (File->second)
+            File->second(*this);
+          continue;
+        }
       }
       catch (const buffer_overflow& BO)
       {
@@ -302,6 +441,10 @@ void Client::loop()
     }
   }
 
+  if (Poll)
+    for (const auto& File : WatchedFiles)
+      Poll->stop(File.first);
+  disableOutputFile();
   disableInputFile();
   disableDataSocket();
   disableControlResponse();
@@ -314,14 +457,14 @@ void Client::controlCallback()
 
   try
   {
-    Data = readPascalString(ControlSocket);
+    Data = readPascalString(*ControlSocket);
   }
   catch (const buffer_overflow& BO)
   {
     LOG(error) << "Reading CONTROL: "
                << "\n\t" << BO.what();
     Poll->schedule(
-      ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+      ControlSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
     return;
   }
   catch (const std::system_error& Err)
@@ -329,23 +472,33 @@ void Client::controlCallback()
     LOG(error) << "Reading CONTROL: " << Err.what();
   }
 
-  if (ControlSocket.failed())
+  if (ControlSocket->failed())
   {
     exit(Failed, -1, "");
     return;
   }
 
-  if (ControlSocket.hasBufferedRead())
+  if (ControlSocket->hasBufferedRead())
     Poll->schedule(
-      ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+      ControlSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
 
   if (Data.empty())
     return;
 
+  handleControlMessage(Data);
+}
+
+void Client::handleControlMessage(std::string_view Data)
+{
+  using namespace monomux::message;
   Message MB = Message::unpack(Data);
-  auto Action =
-    Dispatch.find(static_cast<decltype(Dispatch)::key_type>(MB.Kind));
-  if (Action == Dispatch.end())
+  const auto Kind = static_cast<std::uint16_t>(MB.Kind);
+  std::function<HandlerFunction>* Override =
+    Kind < DispatchOverrides.size() && DispatchOverrides[Kind]
+      ? &DispatchOverrides[Kind]
+      : nullptr;
+  HandlerFunction* Action = Kind < Dispatch.size() ? Dispatch[Kind] : nullptr;
+  if (!Override && !Action)
   {
     MONOMUX_TRACE_LOG(LOG(trace) << "Unknown message type "
                                  << static_cast<int>(MB.Kind) << " received");
@@ -355,13 +508,17 @@ void Client::controlCallback()
   MONOMUX_TRACE_LOG(LOG(data) << MB.RawData);
   try
   {
-    Action->second(*this, MB.RawData);
+    if (Override)
+      (*Override)(*this, MB.RawData);
+    else
+      Action(*this, MB.RawData);
   }
   catch (const buffer_overflow& BO)
   {
     LOG(error) << "Error when handling message"
                << "\n\t" << BO.what();
-    Poll->schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
+    if (Poll)
+      Poll->schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
   }
   catch (const std::system_error& Err)
   {
@@ -371,6 +528,103 @@ void Client::controlCallback()
   }
 }
 
+bool Client::sendQueuedRequests()
+{
+  using namespace monomux::message;
+  if (AwaitingResponse.empty())
+    return true;
+
+  auto X = inhibitControlResponse();
+  bool AllValid = true;
+  auto HandleFrame = [this, &AllValid](std::string_view Frame) {
+    Message MB = Message::unpack(Frame);
+    if (AwaitingResponse.empty() || MB.Kind != AwaitingResponse.front().Kind)
+    {
+      // Notifications are not answers to requests, and might arrive at any
+      // time.
+      handleControlMessage(Frame);
+      return;
+    }
+
+    QueuedRequest Q = std::move(AwaitingResponse.front());
+    AwaitingResponse.pop_front();
+    MONOMUX_TRACE_LOG(LOG(trace) << "Response to request #" << Q.ID);
+    AllValid &= Q.Handler(MB.RawData);
+  };
+
+  try
+  {
+    // Keep going until a partially received message is left over, so the
+    // next read from the control socket starts at a message boundary.
+    while (!AwaitingResponse.empty() || ResponseReader.hasPartial())
+    {
+      // (Callbacks of responses might have queued further requests.)
+      if (!QueuedFrames.empty())
+      {
+        ControlSocket->write(QueuedFrames);
+        QueuedFrames.clear();
+      }
+
+      ResponseReader.fill(*ControlSocket);
+      while (std::optional<std::string_view> Frame = ResponseReader.next())
+        HandleFrame(*Frame);
+      if (ResponseReader.corrupted() || ControlSocket->failed())
+        break;
+    }
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Sending queued requests: " << Err.what();
+  }
+
+  QueuedFrames.clear();
+  ResponseReader.clear();
+  while (!AwaitingResponse.empty())
+  {
+    QueuedRequest Q = std::move(AwaitingResponse.front());
+    AwaitingResponse.pop_front();
+    Q.Handler(std::nullopt);
+    AllValid = false;
+  }
+  return AllValid;
+}
+
+bool Client::receiveControlMessages()
+{
+  if (!ControlSocket || ControlSocket->failed())
+    return false;
+
+  try
+  {
+    while (true)
+    {
+      // A partially received message is waited for, so the next read from
+      // the control socket starts at a message boundary.
+      if (!ResponseReader.hasPartial() && !ResponseReader.mightHaveMore() &&
+          !ControlSocket->hasBufferedRead())
+      {
+        struct pollfd P{};
+        P.fd = ControlSocket->raw();
+        P.events = POLLIN;
+        if (::poll(&P, 1, 0) <= 0 || !(P.revents & (POLLIN | POLLHUP)))
+          break;
+      }
+
+      ResponseReader.fill(*ControlSocket);
+      while (std::optional<std::string_view> Frame = ResponseReader.next())
+        handleControlMessage(*Frame);
+      if (ResponseReader.corrupted() || ControlSocket->failed())
+        return false;
+    }
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Receiving control messages: " << Err.what();
+    return false;
+  }
+  return true;
+}
+
 void Client::setDataCallback(std::function<RawCallbackFn> Callback)
 {
   DataHandler = std::move(Callback);
@@ -381,11 +635,29 @@ void Client::setInputCallback(std::function<RawCallbackFn> Callback)
   InputHandler = std::move(Callback);
 }
 
+void Client::setOutputCallback(std::function<RawCallbackFn> Callback)
+{
+  OutputHandler = std::move(Callback);
+}
+
 void Client::setExternalEventProcessor(std::function<RawCallbackFn> Callback)
 {
   ExternalEventProcessor = std::move(Callback);
 }
 
+void Client::watchFile(raw_fd FD, std::function<RawCallbackFn> Callback)
+{
+  WatchedFiles[FD] = std::move(Callback);
+  if (Poll)
+    Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
+}
+
+void Client::unwatchFile(raw_fd FD)
+{
+  if (WatchedFiles.erase(FD) && Poll)
+    Poll->stop(FD);
+}
+
 void Client::exit(ExitReason E, int ECode, std::string Message)
 {
   if (Exit != None)
@@ -410,26 +682,25 @@ std::size_t Client::consumeNonce() noexcept
 std::optional<std::vector<SessionData>> Client::requestSessionList()
 {
   using namespace monomux::message;
-  auto X = inhibitControlResponse();
-
-  sendMessage(ControlSocket, request::SessionList{});
-
-  std::optional<response::SessionList> Resp =
-    receiveMessage<response::SessionList>(ControlSocket);
-  if (!Resp)
-    return std::nullopt;
-
-  std::vector<SessionData> R;
-
-  for (monomux::message::SessionData& TransmitData : Resp->Sessions)
-  {
-    SessionData SD;
-    SD.Name = std::move(TransmitData.Name);
-    SD.Created = std::chrono::system_clock::from_time_t(TransmitData.Created);
-
-    R.emplace_back(std::move(SD));
-  }
-
+  std::optional<std::vector<SessionData>> R;
+  queueRequest(request::SessionList{},
+               [&R](std::optional<response::SessionList> Resp) {
+                 if (!Resp)
+                   return;
+
+                 R.emplace();
+                 for (monomux::message::SessionData& TransmitData :
+                      Resp->Sessions)
+                 {
+                   SessionData SD;
+                   SD.Name = std::move(TransmitData.Name);
+                   SD.Created = std::chrono::system_clock::from_time_t(
+                     TransmitData.Created);
+
+                   R->emplace_back(std::move(SD));
+                 }
+               });
+  sendQueuedRequests();
   return R;
 }
 
@@ -437,7 +708,6 @@ std::optional<std::string>
 Client::requestMakeSession(std::string Name, Process::SpawnOptions Opts)
 {
   using namespace monomux::message;
-  auto X = inhibitControlResponse();
 
   request::MakeSession Msg;
   Msg.Name = std::move(Name);
@@ -451,43 +721,76 @@ Client::requestMakeSession(std::string Name, Process::SpawnOptions Opts)
     else
       Msg.SpawnOpts.SetEnvironment.emplace_back(E.first, std::move(*E.second));
   }
-  sendMessage(ControlSocket, Msg);
-
-  std::optional<response::MakeSession> Resp =
-    receiveMessage<response::MakeSession>(ControlSocket);
-  if (!Resp || !Resp->Success)
-    return std::nullopt;
 
-  return std::move(Resp->Name);
+  std::optional<std::string> R;
+  queueRequest(Msg, [&R](std::optional<response::MakeSession> Resp) {
+    if (Resp && Resp->Success)
+      R = std::move(Resp->Name);
+  });
+  sendQueuedRequests();
+  return R;
 }
 
 bool Client::requestAttach(std::string SessionName)
 {
   using namespace monomux::message;
-  auto X = inhibitControlResponse();
 
   request::Attach Msg;
   Msg.Name = std::move(SessionName);
-  sendMessage(ControlSocket, Msg);
+  Msg.ReadOnly = ReadOnly;
+  queueRequest(Msg, [this](std::optional<response::Attach> Resp) {
+    if (!Resp)
+      Attached = false;
+    else
+      Attached = Resp->Success;
+    ReplayedOnAttach = Attached && Resp->Replayed;
+    closeSharedRing();
+    if (Attached && Resp->SharedRing && !openSharedRing(Resp->RingSlot))
+      // The output would go missing.
+      Attached = false;
+
+    if (Attached)
+    {
+      if (!AttachedSession)
+        AttachedSession.emplace();
 
-  std::optional<response::Attach> Resp =
-    receiveMessage<response::Attach>(ControlSocket);
-  if (!Resp)
-    Attached = false;
-  else
-    Attached = Resp->Success;
+      AttachedSession->Name = std::move(Resp->Session.Name);
+      AttachedSession->Created =
+        std::chrono::system_clock::from_time_t(Resp->Session.Created);
+    }
+  });
+  sendQueuedRequests();
+  return Attached;
+}
 
-  if (Attached)
-  {
-    if (!AttachedSession)
-      AttachedSession.emplace();
+std::optional<std::uint32_t> Client::requestWatch(std::string SessionName)
+{
+  using namespace monomux::message;
 
-    AttachedSession->Name = std::move(Resp->Session.Name);
-    AttachedSession->Created =
-      std::chrono::system_clock::from_time_t(std::move(Resp->Session.Created));
-  }
+  request::Watch Msg;
+  Msg.Name = std::move(SessionName);
+  std::optional<std::uint32_t> Tag;
+  queueRequest(Msg, [&Tag](std::optional<response::Watch> Resp) {
+    if (Resp && Resp->Success)
+      Tag = static_cast<std::uint32_t>(Resp->Tag);
+  });
+  sendQueuedRequests();
+  return Tag;
+}
 
-  return Attached;
+bool Client::requestUnwatch(std::string SessionName)
+{
+  using namespace monomux::message;
+
+  request::Watch Msg;
+  Msg.Name = std::move(SessionName);
+  Msg.Stop = true;
+  bool Success = false;
+  queueRequest(Msg, [&Success](std::optional<response::Watch> Resp) {
+    Success = Resp && Resp->Success;
+  });
+  sendQueuedRequests();
+  return Success;
 }
 
 void Client::sendData(std::string_view Data)
@@ -497,18 +800,135 @@ void Client::sendData(std::string_view Data)
     LOG(error) << "Trying to sendData() but the connection was not established";
     return;
   }
+  if (ReadOnly)
+    // (The server would discard the input of a viewer anyway.)
+    return;
+  // What overflows is kept in the buffer, and is sent when the connection
+  // becomes writable again.
+  if (DataSocket->tryWrite(Data).failed())
+    return;
+  if (DataSocket->hasBufferedWrite())
+    Poll->schedule(
+      DataSocket->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+std::size_t Client::spliceData(Pipe& Input)
+{
+  // The size of a pipe's buffer by default.
+  static constexpr std::size_t RelaySize = 1 << 16;
+
+  if (!SpliceInput || !DataSocket || Multiplexed || ReadOnly ||
+      Input.hasBufferedRead() || DataSocket->hasBufferedWrite())
+    // Data that is already buffered must be sent first, in order. (The data
+    // of multiplexed connections must be framed.)
+    return 0;
+
+  if (!InputRelay)
+  {
+    InputRelay.emplace(Pipe::create());
+    InputRelay->getRead()->setNonblocking();
+    InputRelay->getWrite()->setNonblocking();
+  }
+  std::size_t Bytes;
   try
   {
-    DataSocket->write(Data);
+    bool Continue;
+    Bytes = Pipe::splice(
+      Input.raw(), InputRelay->getWrite()->raw(), RelaySize, Continue);
   }
-  catch (const buffer_overflow& BO)
+  catch (const std::system_error& Err)
   {
-    // Allow reschedule later.
+    if (Err.code() == std::errc::invalid_argument)
+    {
+      LOG(debug) << "splice() is not supported for the input: " << Err.what();
+      SpliceInput = false;
+    }
+    // Let the normal read path handle (and report) the error.
+    return 0;
   }
+  if (!Bytes)
+    return 0;
 
-  if (DataSocket->hasBufferedWrite())
-    Poll->schedule(
-      DataSocket->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  std::size_t Sent = 0;
+  try
+  {
+    bool Continue = true;
+    while (Continue && Sent < Bytes)
+      Sent += Pipe::splice(InputRelay->getRead()->raw(),
+                           DataSocket->raw(),
+                           Bytes - Sent,
+                           Continue);
+  }
+  catch (const std::system_error& Err)
+  {
+    MONOMUX_TRACE_LOG(LOG(trace) << "Relaying input failed: " << Err.what());
+  }
+  if (Sent < Bytes)
+    // The socket pushed back. Take the rest of the data out of the relay pipe,
+    // and let the buffer of the connection handle it.
+    sendData(InputRelay->getRead()->read(Bytes - Sent));
+  return Bytes;
+}
+
+std::size_t Client::readSharedRing(std::string& Out, std::size_t Bytes)
+{
+  if (!Ring)
+    return 0;
+  SharedRing::ReadResult R = Ring->read(RingSlot, Out, Bytes);
+  if (R.Lost)
+  {
+    LOG(warn) << "Fell behind the shared ring, " << R.Lost
+              << " bytes of output lost, requesting redraw";
+    sendSignal(SIGWINCH);
+  }
+  return R.Read;
+}
+
+bool Client::openSharedRing(std::size_t Slot)
+{
+  // The files arrive in the order the server passed them.
+  fd Memory = ControlSocket->takeReceivedFile();
+  fd Wakeup = ControlSocket->takeReceivedFile();
+  if (!Memory.has() || !Wakeup.has() || Slot >= SharedRing::MaxReaders)
+  {
+    LOG(error) << "Invalid shared ring received from the server";
+    return false;
+  }
+  try
+  {
+    Ring.emplace(SharedRing::open(std::move(Memory)));
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Failed to map the shared ring: " << Err.what();
+    return false;
+  }
+  RingSlot = Slot;
+  RingWakeup = std::move(Wakeup);
+  if (Poll && DataSocketEnabled)
+  {
+    Poll->listen(RingWakeup.get(), /* Incoming =*/true, /* Outgoing =*/false);
+    scheduleSharedRing();
+  }
+  return true;
+}
+
+void Client::closeSharedRing()
+{
+  if (!Ring)
+    return;
+  if (Poll && DataSocketEnabled)
+    Poll->stop(RingWakeup.get());
+  Ring.reset();
+  fd Closed = std::move(RingWakeup);
+}
+
+void Client::scheduleSharedRing()
+{
+  if (!Poll || !Ring || !DataSocketEnabled)
+    return;
+  if (!Ring->wait(RingSlot))
+    Poll->schedule(RingWakeup.get(), /* Incoming =*/true, /* Outgoing =*/false);
 }
 
 void Client::sendSignal(int Signal)
@@ -517,7 +937,7 @@ void Client::sendSignal(int Signal)
   auto X = inhibitControlResponse();
   request::Signal M;
   M.SigNum = Signal;
-  sendMessage(ControlSocket, M);
+  sendMessage(*ControlSocket, M, Wire);
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
@@ -528,21 +948,31 @@ void Client::notifyWindowSize(unsigned short Rows, unsigned short Columns)
   notification::Redraw M;
   M.Rows = Rows;
   M.Columns = Columns;
-  sendMessage(ControlSocket, M);
+  sendMessage(*ControlSocket, M, Wire);
 }
 
 void Client::enableControlResponse()
 {
   if (!Poll)
     return;
-  Poll->listen(ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  Poll->listen(ControlSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  ControlResponseEnabled = true;
+
+  // Reading the data of a multiplexed connection might have kept messages.
+  if (Multiplexed && ControlSocket->hasBufferedRead())
+    Poll->schedule(
+      ControlSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
 }
 
 void Client::disableControlResponse()
 {
   if (!Poll)
     return;
-  Poll->stop(ControlSocket.raw());
+  ControlResponseEnabled = false;
+  if (Multiplexed && DataSocketEnabled)
+    // The connection is still listened to for the data.
+    return;
+  Poll->stop(ControlSocket->raw());
 }
 
 void Client::enableDataSocket()
@@ -551,14 +981,54 @@ void Client::enableDataSocket()
     return;
   Poll->listen(DataSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
   DataSocketEnabled = true;
+
+  // The kernel will not signal the data that was already consumed from it.
+  if (DataSocket->hasBufferedRead())
+    Poll->schedule(
+      DataSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  if (Ring)
+  {
+    Poll->listen(RingWakeup.get(), /* Incoming =*/true, /* Outgoing =*/false);
+    scheduleSharedRing();
+  }
 }
 
 void Client::disableDataSocket()
 {
   if (!Poll || !DataSocket)
     return;
-  Poll->stop(DataSocket->raw());
   DataSocketEnabled = false;
+  if (Ring)
+    Poll->stop(RingWakeup.get());
+  if (Multiplexed && ControlResponseEnabled)
+    // The connection is still listened to for the control messages.
+    return;
+  Poll->stop(DataSocket->raw());
+}
+
+void Client::multiplex()
+{
+  std::string Identifier = ControlSocket->identifier();
+  auto [Control, Data] = MuxedSocket::create(
+    std::move(*ControlSocket).release(), std::move(Identifier));
+  ControlSocket = std::move(Control);
+  DataSocket = std::move(Data);
+  Multiplexed = true;
+}
+
+void Client::scheduleMultiplexed()
+{
+  if (!Poll || (!DataSocketEnabled && !ControlResponseEnabled))
+    return;
+
+  auto& DS = static_cast<MuxedSocket&>(*DataSocket);
+  const bool Incoming =
+    (DataSocketEnabled && DS.hasBufferedRead()) ||
+    (ControlResponseEnabled && ControlSocket->hasBufferedRead());
+  const bool Outgoing = DS.connectionHasBufferedWrite();
+  if (Incoming || Outgoing)
+    Poll->schedule(DS.raw(), Incoming, Outgoing);
 }
 
 void Client::enableInputFile()
@@ -577,6 +1047,22 @@ void Client::disableInputFile()
   InputFileEnabled = false;
 }
 
+void Client::enableOutputFile()
+{
+  if (!Poll || OutputFile == fd::Invalid || OutputFileEnabled)
+    return;
+  Poll->listen(OutputFile, /* Incoming =*/false, /* Outgoing =*/true);
+  OutputFileEnabled = true;
+}
+
+void Client::disableOutputFile()
+{
+  if (!Poll || OutputFile == fd::Invalid || !OutputFileEnabled)
+    return;
+  Poll->stop(OutputFile);
+  OutputFileEnabled = false;
+}
+
 Client::Inhibitor Client::inhibitControlResponse()
 {
   return Inhibitor{[this] { disableControlResponse(); },
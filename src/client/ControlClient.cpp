@@ -16,6 +16,8 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
 
@@ -38,10 +40,8 @@ void ControlClient::requestDetachLatestClient()
   if (!BackingClient.attached())
     return;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(),
-              request::Detach{request::Detach::Latest});
-  receiveMessage<response::Detach>(BackingClient.getControlSocket());
+  BackingClient.queueRequest(request::Detach{request::Detach::Latest}, {});
+  BackingClient.sendQueuedRequests();
 }
 
 void ControlClient::requestDetachAllClients()
@@ -50,24 +50,142 @@ void ControlClient::requestDetachAllClients()
   if (!BackingClient.attached())
     return;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(),
-              request::Detach{request::Detach::All});
-  receiveMessage<response::Detach>(BackingClient.getControlSocket());
+  BackingClient.queueRequest(request::Detach{request::Detach::All}, {});
+  BackingClient.sendQueuedRequests();
 }
 
 std::string ControlClient::requestStatistics()
 {
   using namespace monomux::message;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(), request::Statistics{});
-  auto Response =
-    receiveMessage<response::Statistics>(BackingClient.getControlSocket());
+  std::optional<std::string> Contents;
+  BackingClient.queueRequest(
+    request::Statistics{}, [&Contents](std::optional<response::Statistics> R) {
+      if (R)
+        Contents = std::move(R->Contents);
+    });
+  BackingClient.sendQueuedRequests();
 
-  if (!Response)
+  if (!Contents)
     throw std::runtime_error{"Failed to receive a valid response!"};
-  return std::move(Response)->Contents;
+  return std::move(*Contents);
+}
+
+message::response::Metrics ControlClient::requestMetrics()
+{
+  using namespace monomux::message;
+
+  std::optional<response::Metrics> Result;
+  BackingClient.queueRequest(
+    request::Metrics{},
+    [&Result](std::optional<response::Metrics> R) { Result = std::move(R); });
+  BackingClient.sendQueuedRequests();
+
+  if (!Result)
+    throw std::runtime_error{"Failed to receive a valid response!"};
+  return std::move(*Result);
+}
+
+message::response::Usage ControlClient::requestUsage()
+{
+  using namespace monomux::message;
+
+  std::optional<response::Usage> Result;
+  BackingClient.queueRequest(
+    request::Usage{},
+    [&Result](std::optional<response::Usage> R) { Result = std::move(R); });
+  BackingClient.sendQueuedRequests();
+
+  if (!Result)
+    throw std::runtime_error{"Failed to receive a valid response!"};
+  return std::move(*Result);
+}
+
+std::optional<std::vector<message::SessionStatus>>
+ControlClient::subscribeSessions()
+{
+  using namespace monomux::message;
+
+  request::SessionSubscribe Req;
+  Req.Subscribe = true;
+  Req.KnownGeneration = KnownGeneration;
+
+  bool Valid = false;
+  BackingClient.queueRequest(
+    Req, [this, &Valid](std::optional<response::SessionSubscribe> R) {
+      if (!R)
+        return;
+      Valid = true;
+      KnownGeneration = R->Generation;
+      if (R->Snapshot)
+        KnownSessions = std::move(R->Sessions);
+    });
+  BackingClient.sendQueuedRequests();
+
+  if (!Valid)
+    return std::nullopt;
+  return KnownSessions;
+}
+
+void ControlClient::unsubscribeSessions()
+{
+  using namespace monomux::message;
+  request::SessionSubscribe Req;
+  Req.Subscribe = false;
+  BackingClient.queueRequest(Req, {});
+  BackingClient.sendQueuedRequests();
+  KnownGeneration = 0;
+}
+
+std::vector<message::notification::SessionChange>
+ControlClient::pollSessionChanges()
+{
+  std::vector<message::notification::SessionChange> Applied;
+  BackingClient.receiveControlMessages();
+
+  for (auto& Change : BackingClient.takeSessionChanges())
+  {
+    if (Change.Generation <= KnownGeneration)
+      // Already contained in the last list received.
+      continue;
+    if (Change.Generation != KnownGeneration + 1)
+    {
+      // A change was missed, the list of the sessions must be fetched again.
+      subscribeSessions();
+      BackingClient.takeSessionChanges();
+      break;
+    }
+
+    applySessionChange(Change);
+    KnownGeneration = Change.Generation;
+    Applied.emplace_back(std::move(Change));
+  }
+  return Applied;
+}
+
+void ControlClient::applySessionChange(
+  const message::notification::SessionChange& Change)
+{
+  using namespace monomux::message::notification;
+  auto It = std::find_if(KnownSessions.begin(),
+                         KnownSessions.end(),
+                         [&Change](const message::SessionStatus& S) {
+                           return S.Session.Name == Change.Session.Session.Name;
+                         });
+  switch (Change.Change)
+  {
+    case SessionChange::Created:
+    case SessionChange::Attachment:
+      if (It == KnownSessions.end())
+        KnownSessions.emplace_back(Change.Session);
+      else
+        *It = Change.Session;
+      break;
+    case SessionChange::Destroyed:
+      if (It != KnownSessions.end())
+        KnownSessions.erase(It);
+      break;
+  }
 }
 
 } // namespace monomux::client
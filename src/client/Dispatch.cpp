@@ -28,16 +28,20 @@ using namespace monomux::message;
 namespace monomux::client
 {
 
-void Client::setUpDispatch()
+constexpr Client::DispatchTable Client::makeDispatch() noexcept
 {
-#define KIND(E) static_cast<std::uint16_t>(MessageKind::E)
+  DispatchTable Table{};
+#define KIND(E) static_cast<std::size_t>(MessageKind::E)
 #define MEMBER(NAME) &Client::NAME
-#define DISPATCH(K, FUNCTION) registerMessageHandler(KIND(K), MEMBER(FUNCTION));
+#define DISPATCH(K, FUNCTION) Table[KIND(K)] = MEMBER(FUNCTION);
 #include "monomux/client/Dispatch.ipp"
 #undef MEMBER
 #undef KIND
+  return Table;
 }
 
+const Client::DispatchTable Client::Dispatch = makeDispatch();
+
 #define HANDLER(NAME)                                                          \
   void Client::NAME(Client& Client, std::string_view Message)
 
@@ -80,6 +84,18 @@ HANDLER(receivedDetachNotification)
   }
 }
 
+HANDLER(receivedTerminalModeNotification)
+{
+  MSG(notification::TerminalMode);
+  Client.SessionEchoesInput = Msg->Echo && Msg->Canonical;
+}
+
+HANDLER(receivedSessionChangeNotification)
+{
+  MSG(notification::SessionChange);
+  Client.SessionChanges.emplace_back(std::move(*Msg));
+}
+
 #undef HANDLER
 
 } // namespace monomux::client
@@ -16,9 +16,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <thread>
+#include <tuple>
+
+#include <unistd.h>
 
 #include "monomux/adt/Lazy.hpp"
 #include "monomux/adt/ScopeGuard.hpp"
@@ -44,7 +50,10 @@ namespace monomux::client
 Options::Options()
   : ClientMode(false), OnlyListSessions(false), InteractiveSessionMenu(false),
     DetachRequestLatest(false), DetachRequestAll(false),
-    StatisticsRequest(false)
+    StatisticsRequest(false), MetricsRequest(false), TopRequest(false),
+    Multiplex(false),
+    Compress(false), SharedRing(false), LocalEcho(false), ReadOnly(false),
+    IOUring(false)
 {}
 
 std::vector<std::string> Options::toArgv() const
@@ -73,6 +82,28 @@ std::vector<std::string> Options::toArgv() const
     Ret.emplace_back("--detach-all");
   if (StatisticsRequest)
     Ret.emplace_back("--statistics");
+  if (MetricsRequest)
+    Ret.emplace_back("--metrics");
+  if (TopRequest)
+    Ret.emplace_back("--top");
+  if (Multiplex)
+    Ret.emplace_back("--multiplex");
+  if (Compress)
+    Ret.emplace_back("--compress");
+  if (LocalEcho)
+    Ret.emplace_back("--local-echo");
+  if (ReadOnly)
+    Ret.emplace_back("--read-only");
+  if (IOUring)
+    Ret.emplace_back("--io-uring");
+
+  if (OutputCoalescing.enabled())
+  {
+    Ret.emplace_back("--coalesce-delay");
+    Ret.emplace_back(std::to_string(OutputCoalescing.MaxDelay.count()));
+    Ret.emplace_back("--coalesce-bytes");
+    Ret.emplace_back(std::to_string(OutputCoalescing.MaxBytes));
+  }
 
   if (Program)
   {
@@ -102,7 +133,8 @@ std::vector<std::string> Options::toArgv() const
 
 bool Options::isControlMode() const noexcept
 {
-  return DetachRequestLatest || DetachRequestAll || StatisticsRequest;
+  return DetachRequestLatest || DetachRequestAll || StatisticsRequest ||
+         MetricsRequest || TopRequest;
 }
 
 std::optional<Client>
@@ -223,11 +255,19 @@ int main(Options& Opts)
 
   // ----------------------------- Be a real client ----------------------------
   Terminal Term{fd::fileno(stdin), fd::fileno(stdout)};
+  Term.setOutputCoalescing(Opts.OutputCoalescing);
+  // (The keystrokes of a viewer are not echoed by the session.)
+  Term.setLocalEcho(Opts.LocalEcho && !Opts.ReadOnly);
 
   {
+    // If the server replayed the recent output, the display is already
+    // restored, and the program need not redraw.
+    const bool ForceRedraw = !Client.replayedOnAttach();
+
     // Ask the remote program to redraw by generating the "window size changed"
     // signal explicitly.
-    Client.sendSignal(SIGWINCH);
+    if (ForceRedraw)
+      Client.sendSignal(SIGWINCH);
 
     // Send the initial window size to the server so the attached session prompt
     // is appropriately (re)drawn to the right size, if the size is different.
@@ -237,7 +277,8 @@ int main(Options& Opts)
     // This is a little bit of a hack, but we observed that certain elaborate
     // prompts, such as multiline ZSH Powerline do not really redraw when the
     // size remains the same.
-    Client.notifyWindowSize(S.Rows - 1, S.Columns - 1);
+    if (ForceRedraw)
+      Client.notifyWindowSize(S.Rows - 1, S.Columns - 1);
 
     Client.notifyWindowSize(S.Rows, S.Columns);
   }
@@ -245,13 +286,18 @@ int main(Options& Opts)
   {
     ScopeGuard TerminalSetup{[&Term, &Client] { Term.setupClient(Client); },
                              [&Term] { Term.releaseClient(); }};
-    ScopeGuard Signal{[&Term] {
+    ScopeGuard Signal{[&Term, &Client] {
                         SignalHandling& Sig = SignalHandling::get();
                         Sig.registerObject(SignalHandling::ModuleObjName,
                                            "Client");
                         Sig.registerObject(TerminalObjName, &Term);
                         Sig.registerCallback(SIGWINCH, &windowSizeChange);
+                        Sig.deliverThroughFile(SIGWINCH);
                         Sig.enable();
+                        if (Sig.signalFile() != fd::Invalid)
+                          Client.watchFile(Sig.signalFile(), [](auto&) {
+                            SignalHandling::get().dispatchFile();
+                          });
 
                         // Override the SIGABRT handler with a custom one that
                         // resets the terminal during a crash.
@@ -261,8 +307,10 @@ int main(Options& Opts)
                         Sig.registerCallback(SIGSYS, &coreDumped);
                         Sig.registerCallback(SIGSTKFLT, &coreDumped);
                       },
-                      [] {
+                      [&Client] {
                         SignalHandling& Sig = SignalHandling::get();
+                        if (Sig.signalFile() != fd::Invalid)
+                          Client.unwatchFile(Sig.signalFile());
                         Sig.defaultCallback(SIGWINCH);
                         Sig.deleteObject(TerminalObjName);
 
@@ -421,6 +469,71 @@ SessionSelectionResult selectSession(const std::string& ClientID,
   return {Sessions.at(UserChoice - 1).Name, SessionSelectionResult::Attach};
 }
 
+namespace
+{
+
+/// Formats \p Bytes with a binary unit suffix, e.g. \p 12.5K.
+std::string humanBytes(std::uint64_t Bytes)
+{
+  static constexpr const char* Units = "BKMGT";
+  double Value = Bytes;
+  std::size_t Unit = 0;
+  while (Value >= 1024 && Unit < 4)
+  {
+    Value /= 1024;
+    ++Unit;
+  }
+
+  std::ostringstream OS;
+  if (Unit == 0)
+    OS << Bytes;
+  else
+    OS << std::fixed << std::setprecision(1) << Value << Units[Unit];
+  return OS.str();
+}
+
+/// Prints the resources used by the sessions as a table, the busiest session
+/// first.
+void printUsage(std::ostream& OS, message::response::Usage& Usage)
+{
+  std::sort(Usage.Sessions.begin(),
+            Usage.Sessions.end(),
+            [](const auto& L, const auto& R) {
+              return std::tie(L.OutputRate, L.CPUPermille, L.RSSBytes) >
+                     std::tie(R.OutputRate, R.CPUPermille, R.RSSBytes);
+            });
+
+  auto Row = [&OS](const auto&... Columns) {
+    static constexpr int Widths[] = {16, 8, 7, 9, 9, 9, 9, 9};
+    std::size_t I = 0;
+    ((OS << std::left << std::setw(Widths[I++]) << Columns << ' '), ...);
+  };
+
+  Row("SESSION", "PID", "CPU%", "RSS", "OUT/s", "OUT", "IN", "PEAK");
+  OS << "CLIENTS (ID:BUFFERED)\n";
+  for (const message::SessionUsage& U : Usage.Sessions)
+  {
+    std::ostringstream CPU;
+    CPU << std::fixed << std::setprecision(1)
+        << static_cast<double>(U.CPUPermille) / 10;
+    Row(U.Name,
+        U.PID == Process::Invalid ? std::string{"-"} : std::to_string(U.PID),
+        Usage.IntervalMs ? CPU.str() : std::string{"-"},
+        humanBytes(U.RSSBytes),
+        Usage.IntervalMs ? humanBytes(U.OutputRate) : std::string{"-"},
+        humanBytes(U.OutputBytes),
+        humanBytes(U.InputBytes),
+        humanBytes(U.OutputBufferPeak));
+    for (std::size_t I = 0; I < U.Clients.size(); ++I)
+      OS << (I ? "," : "") << U.Clients.at(I) << ':'
+         << humanBytes(U.ClientBufferedBytes.at(I));
+    OS << '\n';
+  }
+  OS << std::flush;
+}
+
+} // namespace
+
 /// Handles operations through a \p ControlClient -only connection.
 ExitCode mainForControlClient(Options& Opts)
 {
@@ -440,6 +553,63 @@ ExitCode mainForControlClient(Options& Opts)
     }
   }
 
+  if (Opts.MetricsRequest)
+  {
+    ControlClient CC{*Opts.Connection};
+    try
+    {
+      message::response::Metrics Metrics = CC.requestMetrics();
+      auto Print = [](const char* Table, const message::MetricTable& T) {
+        for (std::size_t S = 0; S < T.Subjects.size(); ++S)
+          for (std::size_t N = 0; N < T.Names.size(); ++N)
+            std::cout << Table << ' ' << T.Subjects.at(S) << ' '
+                      << T.Names.at(N) << ' ' << T.at(S, N) << '\n';
+      };
+      Print("server", Metrics.Server);
+      Print("client", Metrics.Clients);
+      Print("session", Metrics.Sessions);
+      std::cout << std::flush;
+      return EXIT_Success;
+    }
+    catch (const std::runtime_error& Err)
+    {
+      std::cerr << Err.what() << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+
+  if (Opts.TopRequest)
+  {
+    ControlClient CC{*Opts.Connection};
+    const bool Interactive = ::isatty(STDOUT_FILENO);
+    try
+    {
+      while (true)
+      {
+        message::response::Usage Usage = CC.requestUsage();
+        if (!Usage.IntervalMs)
+        {
+          // The rates are only known from the second sample of the server.
+          std::this_thread::sleep_for(std::chrono::milliseconds{2100});
+          Usage = CC.requestUsage();
+        }
+
+        if (Interactive)
+          // Clear the screen, and draw from its top.
+          std::cout << "\033[H\033[2J";
+        printUsage(std::cout, Usage);
+        if (!Interactive)
+          return EXIT_Success;
+        std::this_thread::sleep_for(std::chrono::seconds{2});
+      }
+    }
+    catch (const std::runtime_error& Err)
+    {
+      std::cerr << Err.what() << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+
   if (!Opts.SessionData)
     Opts.SessionData = MonomuxSession::loadFromEnv();
   if (!Opts.SessionData)
@@ -512,6 +682,11 @@ ExitCode handleSessionCreateOrAttach(Options& Opts)
   {
     {
       std::string DataFailure;
+      Client.setMultiplexing(Opts.Multiplex);
+      Client.setCompression(Opts.Compress);
+      Client.setSharedRing(Opts.SharedRing);
+      Client.setReadOnly(Opts.ReadOnly);
+      Client.setIOUring(Opts.IOUring);
       if (!makeWholeWithData(Client, &DataFailure))
       {
         LOG(fatal) << DataFailure;
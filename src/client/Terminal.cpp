@@ -35,6 +35,11 @@
 namespace monomux::client
 {
 
+/// The amount of output buffered for the terminal above which no more output
+/// is read from the server, until the buffer drains below the low-water mark.
+static constexpr std::size_t OutputHighWater = 4 * BufferedChannel::BufferSize;
+static constexpr std::size_t OutputLowWater = BufferedChannel::BufferSize;
+
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 Terminal::Terminal(raw_fd InputStream, raw_fd OutputStream)
   : AssociatedClient(nullptr)
@@ -54,6 +59,22 @@ Terminal::Terminal(raw_fd InputStream, raw_fd OutputStream)
     Pipe::weakWrap(OutputStream, Pipe::Write, OutName.str()));
 }
 
+void Terminal::setOutputCoalescing(CoalescingLimits Limits)
+{
+  if (Limits.enabled())
+    Coalescer = std::make_unique<OutputCoalescer>(Limits);
+  else
+    Coalescer.reset();
+}
+
+void Terminal::setLocalEcho(bool Enabled)
+{
+  if (Enabled)
+    Predictor = std::make_unique<EchoPredictor>();
+  else
+    Predictor.reset();
+}
+
 void Terminal::engage()
 {
   if (engaged())
@@ -66,6 +87,7 @@ void Terminal::engage()
     -1);
 
   In->setNonblocking();
+  Out->setNonblocking();
 
   POD<struct ::termios> NewSettings = OriginalTerminalSettings;
   NewSettings->c_iflag &=
@@ -95,6 +117,8 @@ void Terminal::disengage()
     return;
 
   In->setBlocking();
+  Out->setBlocking();
+  drainOutput();
 
   CheckedPOSIXThrow(
     [this] {
@@ -115,14 +139,26 @@ void Terminal::clientInput(Terminal* Term, Client& Client)
   if (Client.getInputFile() != Term->input()->raw())
     throw std::invalid_argument{"Client InputFD != Terminal input"};
 
+  // The input must be seen to predict its echo.
+  if (!Term->Predictor && Client.spliceData(*Term->input()))
+    return;
+  if (Term->Predictor)
+    Term->writePrediction(
+      Term->Predictor->setEnabled(Client.sessionEchoesInput()));
+
   do
   {
+    // The input is sent from the buffer of the terminal, without copying it
+    // out.
     static constexpr std::size_t ReadSize = BUFSIZ;
-    std::string Input = Term->input()->read(ReadSize);
-    if (Input.empty())
+    std::string_view Input;
+    if (!Term->input()->tryPeek(ReadSize, Input).ok() || Input.empty())
       return;
 
     Client.sendData(Input);
+    if (Term->Predictor)
+      Term->writePrediction(Term->Predictor->predict(Input));
+    Term->input()->consume(Input.size());
   } while (Term->input()->hasBufferedRead());
   Term->input()->tryFreeResources();
 }
@@ -132,13 +168,138 @@ void Terminal::clientOutput(Terminal* Term, Client& Client)
   assert(Term->MovedFromCheck &&
          "Terminal object registered as callback was moved.");
 
+  if (Term->OutputThrottled)
+    // Leave the data in the connection until the terminal catches up.
+    return;
+
   static constexpr std::size_t ReadSize = BUFSIZ;
-  std::string Output = Client.getDataSocket()->read(ReadSize);
-  Term->output()->write(Output);
+  static constexpr std::size_t RingReadSize = 1 << 16;
+  Socket& DataSocket = *Client.getDataSocket();
+  std::string_view Received;
+  if (!DataSocket.tryPeek(ReadSize, Received).ok())
+    // The client notices the broken connection on its own.
+    return;
+  const std::size_t Consumed = Received.size();
+  std::string_view Output = Received;
+  if (!Consumed && Client.sharedRing())
+  {
+    // What was sent over the data connection, e.g. the replay, precedes the
+    // output in the ring. (The ring is never compressed.)
+    Term->RingOutput.clear();
+    Client.readSharedRing(Term->RingOutput, RingReadSize);
+    Received = Output = Term->RingOutput;
+  }
+  else if (Term->Decompressor)
+    try
+    {
+      Output = Term->Decompressor->decompress(Received);
+    }
+    catch (const std::runtime_error& Err)
+    {
+      LOG(error) << "Failed to decompress output: " << Err.what();
+      Output = {};
+    }
+  if (Term->Predictor)
+  {
+    Term->writePrediction(
+      Term->Predictor->setEnabled(Client.sessionEchoesInput()));
+    // The echo of the predicted input is already on the screen.
+    Output = Term->Predictor->reconcile(Received);
+  }
+  if (!Term->Coalescer)
+  {
+    Term->writeOutput(Output);
+    DataSocket.consume(Consumed);
+    return;
+  }
+
+  Term->PendingOutput.append(Output);
+  DataSocket.consume(Consumed);
+  if (Term->Coalescer->shouldWrite(Term->PendingOutput.size()))
+  {
+    Term->writeOutput(Term->PendingOutput);
+    Term->PendingOutput.clear();
+  }
+}
+
+void Terminal::clientOutputReady(Terminal* Term, Client& /* Client */)
+{
+  assert(Term->MovedFromCheck &&
+         "Terminal object registered as callback was moved.");
 
-  while (Term->output()->hasBufferedWrite())
-    Term->output()->flushWrites();
-  Term->output()->tryFreeResources();
+  Term->Out->tryFlushWrites();
+  Term->Out->tryFreeResources();
+  Term->updateOutputBackpressure();
+}
+
+void Terminal::clientOutputTimer(Terminal* Term, Client& /* Client */)
+{
+  assert(Term->MovedFromCheck &&
+         "Terminal object registered as callback was moved.");
+
+  if (Term->Coalescer->expired(Term->PendingOutput.size()))
+  {
+    Term->writeOutput(Term->PendingOutput);
+    Term->PendingOutput.clear();
+  }
+}
+
+void Terminal::writeOutput(std::string_view Data)
+{
+  if (Data.empty())
+    return;
+
+  // An overflowing write is kept in the buffer regardless, and the
+  // backpressure below stops reading more from the server.
+  Out->tryWrite(Data);
+  updateOutputBackpressure();
+}
+
+void Terminal::writePrediction(std::string_view Data)
+{
+  if (Data.empty())
+    return;
+
+  // The predictions are displayed after the output that was already received.
+  if (!PendingOutput.empty())
+  {
+    writeOutput(PendingOutput);
+    PendingOutput.clear();
+  }
+  writeOutput(Data);
+}
+
+void Terminal::updateOutputBackpressure()
+{
+  Client* C = AssociatedClient;
+  if (!C)
+    return;
+
+  if (Out->hasBufferedWrite())
+    C->enableOutputFile();
+  else
+    C->disableOutputFile();
+
+  const std::size_t Buffered = Out->writeInBuffer();
+  if (!OutputThrottled && Buffered >= OutputHighWater)
+  {
+    // Not reading the connection lets the flow control of the socket hold
+    // back the server, too.
+    OutputThrottled = true;
+    C->disableDataSocket();
+  }
+  else if (OutputThrottled && Buffered <= OutputLowWater)
+  {
+    OutputThrottled = false;
+    C->enableDataSocket();
+  }
+}
+
+void Terminal::drainOutput()
+{
+  while (Out->hasBufferedWrite())
+    Out->flushWrites();
+  Out->tryFreeResources();
 }
 
 void Terminal::clientEventReady(Terminal* Term, Client& Client)
@@ -166,9 +327,20 @@ void Terminal::setupClient(Client& Client)
   Client.setDataCallback(
     // NOLINTNEXTLINE(modernize-avoid-bind)
     std::bind(&Terminal::clientOutput, this, std::placeholders::_1));
+  Client.setOutputFile(Out->raw());
+  Client.setOutputCallback(
+    // NOLINTNEXTLINE(modernize-avoid-bind)
+    std::bind(&Terminal::clientOutputReady, this, std::placeholders::_1));
   Client.setExternalEventProcessor(
     // NOLINTNEXTLINE(modernize-avoid-bind)
     std::bind(&Terminal::clientEventReady, this, std::placeholders::_1));
+  if (Coalescer)
+    Client.watchFile(
+      Coalescer->timerFD(),
+      // NOLINTNEXTLINE(modernize-avoid-bind)
+      std::bind(&Terminal::clientOutputTimer, this, std::placeholders::_1));
+  if (Client.compressed())
+    Decompressor = std::make_unique<Inflater>();
 
   AssociatedClient = &Client;
 }
@@ -182,6 +354,18 @@ void Terminal::releaseClient()
   AssociatedClient->setInputCallback({});
   AssociatedClient->setExternalEventProcessor({});
   AssociatedClient->setInputFile(fd::Invalid);
+  AssociatedClient->setOutputCallback({});
+  AssociatedClient->setOutputFile(fd::Invalid);
+  if (Coalescer)
+  {
+    AssociatedClient->unwatchFile(Coalescer->timerFD());
+    // Output that was received must not be lost.
+    writeOutput(PendingOutput);
+    PendingOutput.clear();
+  }
+  drainOutput();
+  OutputThrottled = false;
+  Decompressor.reset();
 
   AssociatedClient = nullptr;
 }
@@ -16,21 +16,34 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <charconv>
 #include <cstring>
-#include <sstream>
+#include <iterator>
+#include <limits>
+#include <type_traits>
 
 #include "monomux/control/Message.hpp"
-#include "monomux/control/PascalString.hpp"
 
 #include "monomux/Log.hpp"
 #define LOG(SEVERITY) monomux::log::SEVERITY("control/Message")
 
-#define DECODE(NAME) std::optional<NAME> NAME::decode(std::string_view Buffer)
-#define ENCODE(NAME) std::string NAME::encode(const NAME& Object)
+// Top-level messages are decoded from either wire format, selected by the
+// prefix of the raw data. The body following DECODE is the text decoder.
+#define DECODE(NAME)                                                           \
+  std::optional<NAME> NAME::decode(std::string_view Buffer)                    \
+  {                                                                            \
+    if (Message::formatOf(Buffer) == WireFormat::Binary)                       \
+      return decodeBinary(Buffer);                                             \
+    return decodeText(Buffer);                                                 \
+  }                                                                            \
+  std::optional<NAME> NAME::decodeText(std::string_view Buffer)
+#define ENCODE(NAME)                                                           \
+  void NAME::encode(std::string& Buffer, const NAME& Object)
 
 #define DECODE_BASE(NAME)                                                      \
   std::optional<NAME> NAME::decode(std::string_view& Buffer)
-#define ENCODE_BASE(NAME) std::string NAME::encode(const NAME& Object)
+#define ENCODE_BASE(NAME)                                                      \
+  void NAME::encode(std::string& Buffer, const NAME& Object)
 
 namespace monomux::message
 {
@@ -109,22 +122,13 @@ Message Message::unpack(std::string_view Str) noexcept
   return MB;
 }
 
-std::string readPascalString(BufferedChannel& Channel)
+WireFormat Message::formatOf(std::string_view RawData) noexcept
 {
-  static constexpr std::size_t MaxMeaningfulMessageSize = 1 << 24;
-
-  std::string SizeStr = Channel.read(sizeof(std::size_t));
-  std::size_t Size = Message::binaryStringToSize(SizeStr);
-  if (Size > MaxMeaningfulMessageSize)
-  {
-    LOG(error)
-      << "When reading a Pascal String, got a prefix of " << Size
-      << " that was deemed too large (>= " << MaxMeaningfulMessageSize
-      << "). This is likely due to memory corruption. Ignoring message!";
-    return {};
-  }
-  std::string DataStr = Channel.read(Size);
-  return DataStr;
+  // Text messages always begin with a '<', and binary ones with the version
+  // number. Any control character is reserved for (future) binary versions.
+  if (!RawData.empty() && static_cast<unsigned char>(RawData.front()) < ' ')
+    return WireFormat::Binary;
+  return WireFormat::Text;
 }
 
 namespace
@@ -166,6 +170,40 @@ std::string_view takeUntilAndConsume(std::string_view& Data,
   return Match;
 }
 
+/// A minimal replacement of \p std::ostringstream that formats directly at the
+/// end of a \p Buffer.
+class TextWriter
+{
+public:
+  explicit TextWriter(std::string& Buffer) : Buffer(Buffer) {}
+
+  TextWriter& operator<<(std::string_view Str)
+  {
+    Buffer.append(Str);
+    return *this;
+  }
+
+  template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+  TextWriter& operator<<(T Value)
+  {
+    char Digits[std::numeric_limits<T>::digits10 + 2];
+    auto Result = std::to_chars(std::begin(Digits), std::end(Digits), Value);
+    Buffer.append(Digits, Result.ptr);
+    return *this;
+  }
+
+private:
+  std::string& Buffer;
+};
+
+/// Parses the entirety of \p Str as a decimal number into \p Value.
+template <typename T> bool parseNumber(std::string_view Str, T& Value) noexcept
+{
+  const char* End = Str.data() + Str.size();
+  auto Result = std::from_chars(Str.data(), End, Value);
+  return Result.ec == std::errc{} && Result.ptr == End;
+}
+
 } // namespace
 
 #define CONSUME_OR_NONE(LITERAL)                                               \
@@ -195,14 +233,13 @@ std::string_view takeUntilAndConsume(std::string_view& Data,
 
 ENCODE_BASE(ClientID)
 {
-  std::ostringstream Ret;
+  TextWriter Ret{Buffer};
   Ret << "<CLIENT>";
   {
     Ret << "<ID>" << Object.ID << "</ID>";
     Ret << "<NONCE>" << Object.Nonce << "</NONCE>";
   }
   Ret << "</CLIENT>";
-  return Ret.str();
 }
 DECODE_BASE(ClientID)
 {
@@ -221,9 +258,10 @@ DECODE_BASE(ClientID)
   return Ret;
 }
 
+
 ENCODE_BASE(ProcessSpawnOptions)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<PROCESS>";
   {
     Buf << "<IMAGE>" << Object.Program << "</IMAGE>";
@@ -262,7 +300,6 @@ ENCODE_BASE(ProcessSpawnOptions)
     Buf << "</ENVIRONMENT>";
   }
   Buf << "</PROCESS>";
-  return Buf.str();
 }
 DECODE_BASE(ProcessSpawnOptions)
 {
@@ -339,14 +376,14 @@ DECODE_BASE(ProcessSpawnOptions)
   return Ret;
 }
 
+
 ENCODE_BASE(SessionData)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<SESSION>";
   Buf << "<NAME>" << Object.Name << "</NAME>";
   Buf << "<CREATED>" << Object.Created << "</CREATED>";
   Buf << "</SESSION>";
-  return Buf.str();
 }
 DECODE_BASE(SessionData)
 {
@@ -384,7 +421,120 @@ DECODE_BASE(SessionData)
   return Ret;
 }
 
-ENCODE_BASE(Boolean) { return Object.Value ? "<TRUE />" : "<FALSE />"; }
+
+ENCODE_BASE(SessionStatus)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<SESSION-STATUS>";
+  monomux::message::SessionData::encode(Buffer, Object.Session);
+  Buf << "<CLIENTS>" << Object.AttachedClients << "</CLIENTS>";
+  Buf << "</SESSION-STATUS>";
+}
+DECODE_BASE(SessionStatus)
+{
+  SessionStatus Ret;
+  HEADER_OR_NONE("<SESSION-STATUS>");
+
+  auto Session = monomux::message::SessionData::decode(View);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+
+  CONSUME_OR_NONE("<CLIENTS>");
+  EXTRACT_OR_NONE(Clients, "</CLIENTS>");
+  if (!parseNumber(Clients, Ret.AttachedClients))
+    return std::nullopt;
+
+  BASE_FOOTER_OR_NONE("</SESSION-STATUS>");
+  return Ret;
+}
+
+
+ENCODE_BASE(SessionUsage)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<SESSION-USAGE>";
+  Buf << "<NAME Size=\"" << Object.Name.size() << "\">" << Object.Name
+      << "</NAME>";
+  Buf << "<PID>" << Object.PID << "</PID>";
+  Buf << "<OUTPUT Bytes=\"" << Object.OutputBytes << "\" Rate=\""
+      << Object.OutputRate << "\" Peak=\"" << Object.OutputBufferPeak
+      << "\" />";
+  Buf << "<INPUT Bytes=\"" << Object.InputBytes << "\" />";
+  Buf << "<PROCESS CPU=\"" << Object.CPUPermille << "\" RSS=\""
+      << Object.RSSBytes << "\" />";
+  Buf << "<CLIENTS Count=\"" << Object.Clients.size() << "\">";
+  for (std::size_t I = 0; I < Object.Clients.size(); ++I)
+    Buf << Object.Clients.at(I) << ":"
+        << (I < Object.ClientBufferedBytes.size()
+              ? Object.ClientBufferedBytes.at(I)
+              : 0)
+        << ";";
+  Buf << "</CLIENTS>";
+  Buf << "</SESSION-USAGE>";
+}
+DECODE_BASE(SessionUsage)
+{
+  SessionUsage Ret;
+  HEADER_OR_NONE("<SESSION-USAGE>");
+
+  CONSUME_OR_NONE("<NAME Size=\"");
+  EXTRACT_OR_NONE(NameSize, "\">");
+  std::size_t Size;
+  if (!parseNumber(NameSize, Size) || View.size() < Size)
+    return std::nullopt;
+  Ret.Name = splice(View, Size);
+  CONSUME_OR_NONE("</NAME>");
+
+  CONSUME_OR_NONE("<PID>");
+  EXTRACT_OR_NONE(PID, "</PID>");
+  if (!parseNumber(PID, Ret.PID))
+    return std::nullopt;
+
+  CONSUME_OR_NONE("<OUTPUT Bytes=\"");
+  EXTRACT_OR_NONE(OutputBytes, "\" Rate=\"");
+  EXTRACT_OR_NONE(OutputRate, "\" Peak=\"");
+  EXTRACT_OR_NONE(OutputPeak, "\" />");
+  CONSUME_OR_NONE("<INPUT Bytes=\"");
+  EXTRACT_OR_NONE(InputBytes, "\" />");
+  CONSUME_OR_NONE("<PROCESS CPU=\"");
+  EXTRACT_OR_NONE(CPU, "\" RSS=\"");
+  EXTRACT_OR_NONE(RSS, "\" />");
+  if (!parseNumber(OutputBytes, Ret.OutputBytes) ||
+      !parseNumber(OutputRate, Ret.OutputRate) ||
+      !parseNumber(OutputPeak, Ret.OutputBufferPeak) ||
+      !parseNumber(InputBytes, Ret.InputBytes) ||
+      !parseNumber(CPU, Ret.CPUPermille) || !parseNumber(RSS, Ret.RSSBytes))
+    return std::nullopt;
+
+  {
+    CONSUME_OR_NONE("<CLIENTS Count=\"");
+    EXTRACT_OR_NONE(CountStr, "\">");
+    std::size_t Count;
+    if (!parseNumber(CountStr, Count))
+      return std::nullopt;
+    Ret.Clients.resize(Count);
+    Ret.ClientBufferedBytes.resize(Count);
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      EXTRACT_OR_NONE(ID, ":");
+      EXTRACT_OR_NONE(Buffered, ";");
+      if (!parseNumber(ID, Ret.Clients.at(I)) ||
+          !parseNumber(Buffered, Ret.ClientBufferedBytes.at(I)))
+        return std::nullopt;
+    }
+    CONSUME_OR_NONE("</CLIENTS>");
+  }
+
+  BASE_FOOTER_OR_NONE("</SESSION-USAGE>");
+  return Ret;
+}
+
+
+ENCODE_BASE(Boolean)
+{
+  Buffer.append(Object.Value ? "<TRUE />" : "<FALSE />");
+}
 DECODE_BASE(Boolean)
 {
   Boolean Ret;
@@ -397,6 +547,110 @@ DECODE_BASE(Boolean)
   return Ret;
 }
 
+
+ENCODE_BASE(MetricTable)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<METRIC-TABLE>";
+  {
+    Buf << "<NAMES Count=\"" << Object.Names.size() << "\">";
+    for (const std::string& Name : Object.Names)
+      Buf << "<NAME Size=\"" << Name.size() << "\">" << Name << "</NAME>";
+    Buf << "</NAMES>";
+    Buf << "<KINDS Count=\"" << Object.Kinds.size() << "\">";
+    for (MetricTable::MetricKind Kind : Object.Kinds)
+      Buf << static_cast<int>(Kind) << ";";
+    Buf << "</KINDS>";
+    Buf << "<SUBJECTS Count=\"" << Object.Subjects.size() << "\">";
+    for (const std::string& Subject : Object.Subjects)
+      Buf << "<SUBJECT Size=\"" << Subject.size() << "\">" << Subject
+          << "</SUBJECT>";
+    Buf << "</SUBJECTS>";
+    Buf << "<VALUES Count=\"" << Object.Values.size() << "\">";
+    for (std::uint64_t Value : Object.Values)
+      Buf << Value << ";";
+    Buf << "</VALUES>";
+  }
+  Buf << "</METRIC-TABLE>";
+}
+DECODE_BASE(MetricTable)
+{
+  MetricTable Ret;
+  HEADER_OR_NONE("<METRIC-TABLE>");
+
+  // Decodes the list of strings, each wrapped in a Tag element, that follows
+  // the opening Count attribute.
+  auto DecodeStrings = [&View](std::string_view Tag,
+                               std::vector<std::string>& Strings) {
+    std::size_t Count;
+    if (!parseNumber(takeUntilAndConsume(View, "\">"), Count))
+      return false;
+    Strings.resize(Count);
+    for (std::string& Str : Strings)
+    {
+      View = consume(consume(consume(View, "<"), Tag), " Size=\"");
+      std::size_t Size;
+      if (!parseNumber(takeUntilAndConsume(View, "\">"), Size) ||
+          View.size() < Size)
+        return false;
+      Str = splice(View, Size);
+      View = consume(consume(consume(View, "</"), Tag), ">");
+      if (View.empty())
+        return false;
+    }
+    return true;
+  };
+
+  CONSUME_OR_NONE("<NAMES Count=\"");
+  if (!DecodeStrings("NAME", Ret.Names))
+    return std::nullopt;
+  CONSUME_OR_NONE("</NAMES>");
+
+  {
+    CONSUME_OR_NONE("<KINDS Count=\"");
+    EXTRACT_OR_NONE(CountStr, "\">");
+    std::size_t Count;
+    if (!parseNumber(CountStr, Count))
+      return std::nullopt;
+    Ret.Kinds.resize(Count);
+    for (MetricTable::MetricKind& Kind : Ret.Kinds)
+    {
+      EXTRACT_OR_NONE(KindStr, ";");
+      int KindValue;
+      if (!parseNumber(KindStr, KindValue) || KindValue < 0 ||
+          KindValue > EnumLimit<MetricTable::MetricKind>::Max)
+        return std::nullopt;
+      Kind = static_cast<MetricTable::MetricKind>(KindValue);
+    }
+    CONSUME_OR_NONE("</KINDS>");
+  }
+
+  CONSUME_OR_NONE("<SUBJECTS Count=\"");
+  if (!DecodeStrings("SUBJECT", Ret.Subjects))
+    return std::nullopt;
+  CONSUME_OR_NONE("</SUBJECTS>");
+
+  {
+    CONSUME_OR_NONE("<VALUES Count=\"");
+    EXTRACT_OR_NONE(CountStr, "\">");
+    std::size_t Count;
+    if (!parseNumber(CountStr, Count))
+      return std::nullopt;
+    Ret.Values.resize(Count);
+    for (std::uint64_t& Value : Ret.Values)
+    {
+      EXTRACT_OR_NONE(ValueStr, ";");
+      if (!parseNumber(ValueStr, Value))
+        return std::nullopt;
+    }
+    CONSUME_OR_NONE("</VALUES>");
+  }
+
+  BASE_FOOTER_OR_NONE("</METRIC-TABLE>");
+  return Ret;
+}
+
+
 #undef BASE_FOOTER_OR_NONE
 #define FOOTER_OR_NONE(LITERAL)                                                \
   if (View != (LITERAL))                                                       \
@@ -409,7 +663,7 @@ namespace request
 ENCODE(ClientID)
 {
   (void)Object;
-  return "<CLIENT-ID />";
+  Buffer.append("<CLIENT-ID />");
 }
 DECODE(ClientID)
 {
@@ -418,14 +672,14 @@ DECODE(ClientID)
   return std::nullopt;
 }
 
+
 ENCODE(DataSocket)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<DATASOCKET>";
-  Buf << monomux::message::ClientID::encode(Object.Client);
+  monomux::message::ClientID::encode(Buffer, Object.Client);
   Buf << "</DATASOCKET>";
 
-  return Buf.str();
 }
 DECODE(DataSocket)
 {
@@ -441,10 +695,49 @@ DECODE(DataSocket)
   return Ret;
 }
 
+
+ENCODE(Handshake)
+{
+  if (!Object.Multiplexed && !Object.Compressed && !Object.SharedRing)
+  {
+    Buffer.append("<HANDSHAKE />");
+    return;
+  }
+
+  TextWriter Buf{Buffer};
+  Buf << "<HANDSHAKE>";
+  monomux::message::Boolean::encode(Buffer, Object.Multiplexed);
+  if (Object.Compressed)
+    Buf << "<COMPRESSED />";
+  if (Object.SharedRing)
+    Buf << "<SHARED-RING />";
+  Buf << "</HANDSHAKE>";
+}
+DECODE(Handshake)
+{
+  if (Buffer == "<HANDSHAKE />")
+    return Handshake{};
+
+  Handshake Ret;
+  HEADER_OR_NONE("<HANDSHAKE>");
+
+  auto Multiplexed = monomux::message::Boolean::decode(View);
+  if (!Multiplexed)
+    return std::nullopt;
+  Ret.Multiplexed = *Multiplexed;
+
+  PEEK_AND_CONSUME("<COMPRESSED />") { Ret.Compressed = true; }
+  PEEK_AND_CONSUME("<SHARED-RING />") { Ret.SharedRing = true; }
+
+  FOOTER_OR_NONE("</HANDSHAKE>");
+  return Ret;
+}
+
+
 ENCODE(SessionList)
 {
   (void)Object;
-  return "<SESSION-LIST />";
+  Buffer.append("<SESSION-LIST />");
 }
 DECODE(SessionList)
 {
@@ -453,17 +746,17 @@ DECODE(SessionList)
   return std::nullopt;
 }
 
+
 ENCODE(MakeSession)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<MAKE-SESSION>";
   if (Object.Name.empty())
     Buf << "<NAME />";
   else
     Buf << "<NAME>" << Object.Name << "</NAME>";
-  Buf << monomux::message::ProcessSpawnOptions::encode(Object.SpawnOpts);
+  monomux::message::ProcessSpawnOptions::encode(Buffer, Object.SpawnOpts);
   Buf << "</MAKE-SESSION>";
-  return Buf.str();
 }
 DECODE(MakeSession)
 {
@@ -486,13 +779,15 @@ DECODE(MakeSession)
   return Ret;
 }
 
+
 ENCODE(Attach)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<ATTACH>";
   Buf << "<NAME>" << Object.Name << "</NAME>";
+  if (Object.ReadOnly)
+    Buf << "<READ-ONLY />";
   Buf << "</ATTACH>";
-  return Buf.str();
 }
 DECODE(Attach)
 {
@@ -503,13 +798,16 @@ DECODE(Attach)
   EXTRACT_OR_NONE(Name, "</NAME>");
   Ret.Name = Name;
 
+  PEEK_AND_CONSUME("<READ-ONLY />") { Ret.ReadOnly = true; }
+
   FOOTER_OR_NONE("</ATTACH>");
   return Ret;
 }
 
+
 ENCODE(Detach)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<DETACH><MODE>";
   switch (Object.Mode)
   {
@@ -521,7 +819,6 @@ ENCODE(Detach)
       break;
   }
   Buf << "</MODE></DETACH>";
-  return Buf.str();
 }
 DECODE(Detach)
 {
@@ -541,11 +838,11 @@ DECODE(Detach)
   return Ret;
 }
 
+
 ENCODE(Signal)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<SIGNAL>" << Object.SigNum << "</SIGNAL>";
-  return Buf.str();
 }
 DECODE(Signal)
 {
@@ -559,10 +856,11 @@ DECODE(Signal)
   return Ret;
 }
 
+
 ENCODE(Statistics)
 {
   (void)Object;
-  return "<SEND-STATISTICS />";
+  Buffer.append("<SEND-STATISTICS />");
 }
 DECODE(Statistics)
 {
@@ -571,6 +869,85 @@ DECODE(Statistics)
   return std::nullopt;
 }
 
+
+ENCODE(Metrics)
+{
+  (void)Object;
+  Buffer.append("<SEND-METRICS />");
+}
+DECODE(Metrics)
+{
+  if (Buffer == "<SEND-METRICS />")
+    return Metrics{};
+  return std::nullopt;
+}
+
+
+ENCODE(SessionSubscribe)
+{
+  TextWriter Buf{Buffer};
+  if (!Object.Subscribe)
+  {
+    Buf << "<SESSION-UNSUBSCRIBE />";
+    return;
+  }
+  Buf << "<SESSION-SUBSCRIBE><GENERATION>" << Object.KnownGeneration
+      << "</GENERATION></SESSION-SUBSCRIBE>";
+}
+DECODE(SessionSubscribe)
+{
+  if (Buffer == "<SESSION-UNSUBSCRIBE />")
+    return SessionSubscribe{};
+
+  SessionSubscribe Ret;
+  Ret.Subscribe = true;
+  HEADER_OR_NONE("<SESSION-SUBSCRIBE>");
+
+  CONSUME_OR_NONE("<GENERATION>");
+  EXTRACT_OR_NONE(Generation, "</GENERATION>");
+  if (!parseNumber(Generation, Ret.KnownGeneration))
+    return std::nullopt;
+
+  FOOTER_OR_NONE("</SESSION-SUBSCRIBE>");
+  return Ret;
+}
+
+
+ENCODE(Usage)
+{
+  (void)Object;
+  Buffer.append("<SEND-USAGE />");
+}
+DECODE(Usage)
+{
+  if (Buffer == "<SEND-USAGE />")
+    return Usage{};
+  return std::nullopt;
+}
+
+
+ENCODE(Watch)
+{
+  TextWriter Buf{Buffer};
+  Buf << (Object.Stop ? "<UNWATCH>" : "<WATCH>");
+  Buf << "<NAME>" << Object.Name << "</NAME>";
+  Buf << (Object.Stop ? "</UNWATCH>" : "</WATCH>");
+}
+DECODE(Watch)
+{
+  Watch Ret;
+  Ret.Stop = Buffer.rfind("<UNWATCH>", 0) == 0;
+  HEADER_OR_NONE(Ret.Stop ? "<UNWATCH>" : "<WATCH>");
+
+  CONSUME_OR_NONE("<NAME>");
+  EXTRACT_OR_NONE(Name, "</NAME>");
+  Ret.Name = Name;
+
+  FOOTER_OR_NONE(Ret.Stop ? "</UNWATCH>" : "</WATCH>");
+  return Ret;
+}
+
+
 } // namespace request
 
 namespace response
@@ -578,11 +955,10 @@ namespace response
 
 ENCODE(ClientID)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<CLIENT-ID>";
-  Buf << monomux::message::ClientID::encode(Object.Client);
+  monomux::message::ClientID::encode(Buffer, Object.Client);
   Buf << "</CLIENT-ID>";
-  return Buf.str();
 }
 DECODE(ClientID)
 {
@@ -598,17 +974,17 @@ DECODE(ClientID)
   return Ret;
 }
 
+
 ENCODE(DataSocket)
 {
-  std::ostringstream Ret;
+  TextWriter Ret{Buffer};
   Ret << "<DATASOCKET>";
-  Ret << monomux::message::Boolean::encode(Object.Success);
+  monomux::message::Boolean::encode(Buffer, Object.Success);
   Ret << "</DATASOCKET>";
 
   using namespace std::string_literals;
   Ret << "!MAINTAIN-RADIO-SILENCE!\0\0\0"s;
 
-  return Ret.str();
 }
 DECODE(DataSocket)
 {
@@ -625,14 +1001,58 @@ DECODE(DataSocket)
   return Ret;
 }
 
+
+ENCODE(Handshake)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<HANDSHAKE>";
+  monomux::message::ClientID::encode(Buffer, Object.Client);
+  monomux::message::Boolean::encode(Buffer, Object.Success);
+  monomux::message::Boolean::encode(Buffer, Object.Multiplexed);
+  monomux::message::Boolean::encode(Buffer, Object.Compressed);
+  if (Object.SharedRing)
+    Buf << "<SHARED-RING />";
+  Buf << "</HANDSHAKE>";
+}
+DECODE(Handshake)
+{
+  Handshake Ret;
+  HEADER_OR_NONE("<HANDSHAKE>");
+
+  auto ClientID = monomux::message::ClientID::decode(View);
+  if (!ClientID)
+    return std::nullopt;
+  Ret.Client = std::move(*ClientID);
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  auto Multiplexed = monomux::message::Boolean::decode(View);
+  if (!Multiplexed)
+    return std::nullopt;
+  Ret.Multiplexed = *Multiplexed;
+
+  auto Compressed = monomux::message::Boolean::decode(View);
+  if (!Compressed)
+    return std::nullopt;
+  Ret.Compressed = *Compressed;
+
+  PEEK_AND_CONSUME("<SHARED-RING />") { Ret.SharedRing = true; }
+
+  FOOTER_OR_NONE("</HANDSHAKE>");
+  return Ret;
+}
+
+
 ENCODE(SessionList)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<SESSION-LIST Count=\"" << Object.Sessions.size() << "\">";
   for (const SessionData& SD : Object.Sessions)
-    Buf << monomux::message::SessionData::encode(SD);
+    monomux::message::SessionData::encode(Buffer, SD);
   Buf << "</SESSION-LIST>";
-  return Buf.str();
 }
 DECODE(SessionList)
 {
@@ -656,14 +1076,14 @@ DECODE(SessionList)
   return Ret;
 }
 
+
 ENCODE(MakeSession)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<MAKE-SESSION>";
-  Buf << monomux::message::Boolean::encode(Object.Success);
+  monomux::message::Boolean::encode(Buffer, Object.Success);
   Buf << "<NAME>" << Object.Name << "</NAME>";
   Buf << "</MAKE-SESSION>";
-  return Buf.str();
 }
 DECODE(MakeSession)
 {
@@ -683,15 +1103,20 @@ DECODE(MakeSession)
   return Ret;
 }
 
+
 ENCODE(Attach)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<ATTACH>";
-  Buf << monomux::message::Boolean::encode(Object.Success);
+  monomux::message::Boolean::encode(Buffer, Object.Success);
   if (Object.Success)
-    Buf << monomux::message::SessionData::encode(Object.Session);
+  {
+    monomux::message::SessionData::encode(Buffer, Object.Session);
+    monomux::message::Boolean::encode(Buffer, Object.Replayed);
+    if (Object.SharedRing)
+      Buf << "<SHARED-RING Slot=\"" << Object.RingSlot << "\" />";
+  }
   Buf << "</ATTACH>";
-  return Buf.str();
 }
 DECODE(Attach)
 {
@@ -709,16 +1134,30 @@ DECODE(Attach)
     if (!Session)
       return std::nullopt;
     Ret.Session = std::move(*Session);
+
+    auto Replayed = monomux::message::Boolean::decode(View);
+    if (!Replayed)
+      return std::nullopt;
+    Ret.Replayed = *Replayed;
+
+    PEEK_AND_CONSUME("<SHARED-RING Slot=\"")
+    {
+      EXTRACT_OR_NONE(Slot, "\" />");
+      if (!parseNumber(Slot, Ret.RingSlot))
+        return std::nullopt;
+      Ret.SharedRing = true;
+    }
   }
 
   FOOTER_OR_NONE("</ATTACH>");
   return Ret;
 }
 
+
 ENCODE(Detach)
 {
   (void)Object;
-  return "<DETACH />";
+  Buffer.append("<DETACH />");
 }
 DECODE(Detach)
 {
@@ -727,13 +1166,13 @@ DECODE(Detach)
   return std::nullopt;
 }
 
+
 ENCODE(Statistics)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<STATISTICS Size=\"" << Object.Contents.size() << "\">";
   Buf << Object.Contents;
   Buf << "</STATISTICS>";
-  return Buf.str();
 }
 DECODE(Statistics)
 {
@@ -753,6 +1192,169 @@ DECODE(Statistics)
   return Ret;
 }
 
+
+ENCODE(Metrics)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<METRICS>";
+  Buf << "<SERVER>";
+  monomux::message::MetricTable::encode(Buffer, Object.Server);
+  Buf << "</SERVER>";
+  Buf << "<CLIENTS>";
+  monomux::message::MetricTable::encode(Buffer, Object.Clients);
+  Buf << "</CLIENTS>";
+  Buf << "<SESSIONS>";
+  monomux::message::MetricTable::encode(Buffer, Object.Sessions);
+  Buf << "</SESSIONS>";
+  Buf << "</METRICS>";
+}
+DECODE(Metrics)
+{
+  Metrics Ret;
+  HEADER_OR_NONE("<METRICS>");
+
+  for (auto [Tag, Table] :
+       {std::make_pair(std::string_view{"SERVER"}, &Ret.Server),
+        std::make_pair(std::string_view{"CLIENTS"}, &Ret.Clients),
+        std::make_pair(std::string_view{"SESSIONS"}, &Ret.Sessions)})
+  {
+    View = consume(consume(View, "<"), Tag);
+    CONSUME_OR_NONE(">");
+    auto T = monomux::message::MetricTable::decode(View);
+    if (!T)
+      return std::nullopt;
+    *Table = std::move(*T);
+    View = consume(consume(View, "</"), Tag);
+    CONSUME_OR_NONE(">");
+  }
+
+  FOOTER_OR_NONE("</METRICS>");
+  return Ret;
+}
+
+
+ENCODE(SessionSubscribe)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<SESSION-SUBSCRIBE Generation=\"" << Object.Generation << "\">";
+  monomux::message::Boolean::encode(Buffer, Object.Snapshot);
+  if (Object.Snapshot)
+  {
+    Buf << "<SESSIONS Count=\"" << Object.Sessions.size() << "\">";
+    for (const SessionStatus& S : Object.Sessions)
+      monomux::message::SessionStatus::encode(Buffer, S);
+    Buf << "</SESSIONS>";
+  }
+  Buf << "</SESSION-SUBSCRIBE>";
+}
+DECODE(SessionSubscribe)
+{
+  SessionSubscribe Ret;
+  HEADER_OR_NONE("<SESSION-SUBSCRIBE Generation=\"");
+
+  EXTRACT_OR_NONE(Generation, "\">");
+  if (!parseNumber(Generation, Ret.Generation))
+    return std::nullopt;
+
+  auto Snapshot = monomux::message::Boolean::decode(View);
+  if (!Snapshot)
+    return std::nullopt;
+  Ret.Snapshot = *Snapshot;
+
+  if (Ret.Snapshot)
+  {
+    CONSUME_OR_NONE("<SESSIONS Count=\"");
+    EXTRACT_OR_NONE(CountStr, "\">");
+    std::size_t Count = 0;
+    if (!parseNumber(CountStr, Count))
+      return std::nullopt;
+    Ret.Sessions.reserve(Count);
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      auto S = monomux::message::SessionStatus::decode(View);
+      if (!S)
+        return std::nullopt;
+      Ret.Sessions.emplace_back(std::move(*S));
+    }
+    CONSUME_OR_NONE("</SESSIONS>");
+  }
+
+  FOOTER_OR_NONE("</SESSION-SUBSCRIBE>");
+  return Ret;
+}
+
+
+ENCODE(Usage)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<USAGE Interval=\"" << Object.IntervalMs << "\" Count=\""
+      << Object.Sessions.size() << "\">";
+  for (const SessionUsage& S : Object.Sessions)
+    monomux::message::SessionUsage::encode(Buffer, S);
+  Buf << "</USAGE>";
+}
+DECODE(Usage)
+{
+  Usage Ret;
+  HEADER_OR_NONE("<USAGE Interval=\"");
+
+  EXTRACT_OR_NONE(Interval, "\" Count=\"");
+  EXTRACT_OR_NONE(CountStr, "\">");
+  std::size_t Count;
+  if (!parseNumber(Interval, Ret.IntervalMs) || !parseNumber(CountStr, Count))
+    return std::nullopt;
+  Ret.Sessions.reserve(Count);
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    auto S = monomux::message::SessionUsage::decode(View);
+    if (!S)
+      return std::nullopt;
+    Ret.Sessions.emplace_back(std::move(*S));
+  }
+
+  FOOTER_OR_NONE("</USAGE>");
+  return Ret;
+}
+
+
+ENCODE(Watch)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<WATCH Tag=\"" << Object.Tag << "\">";
+  monomux::message::Boolean::encode(Buffer, Object.Success);
+  monomux::message::SessionData::encode(Buffer, Object.Session);
+  monomux::message::Boolean::encode(Buffer, Object.Replayed);
+  Buf << "</WATCH>";
+}
+DECODE(Watch)
+{
+  Watch Ret;
+  HEADER_OR_NONE("<WATCH Tag=\"");
+
+  EXTRACT_OR_NONE(Tag, "\">");
+  if (!parseNumber(Tag, Ret.Tag))
+    return std::nullopt;
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  auto Session = monomux::message::SessionData::decode(View);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+
+  auto Replayed = monomux::message::Boolean::decode(View);
+  if (!Replayed)
+    return std::nullopt;
+  Ret.Replayed = *Replayed;
+
+  FOOTER_OR_NONE("</WATCH>");
+  return Ret;
+}
+
+
 } // namespace response
 
 namespace notification
@@ -760,13 +1362,15 @@ namespace notification
 
 ENCODE(Connection)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<CONNECTION>";
-  Buf << monomux::message::Boolean::encode(Object.Accepted);
+  monomux::message::Boolean::encode(Buffer, Object.Accepted);
   if (!Object.Accepted)
     Buf << "<REASON>" << Object.Reason << " </REASON>";
+  else if (Object.BinaryVersion)
+    Buf << "<WIRE Version=\"" << static_cast<int>(Object.BinaryVersion)
+        << "\" />";
   Buf << "</CONNECTION>";
-  return Buf.str();
 }
 DECODE(Connection)
 {
@@ -786,14 +1390,24 @@ DECODE(Connection)
     if (Ret.Reason.back() == ' ')
       Ret.Reason.pop_back();
   }
+  else
+  {
+    PEEK_AND_CONSUME("<WIRE Version=\"")
+    {
+      EXTRACT_OR_NONE(Version, "\" />");
+      if (!parseNumber(Version, Ret.BinaryVersion))
+        return std::nullopt;
+    }
+  }
 
   FOOTER_OR_NONE("</CONNECTION>");
   return Ret;
 }
 
+
 ENCODE(Detached)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<DETACHED>";
   Buf << "<MODE>";
   switch (Object.Mode)
@@ -817,7 +1431,6 @@ ENCODE(Detached)
   if (Object.Mode == Kicked)
     Buf << "<REASON>" << Object.Reason << "</REASON>";
   Buf << "</DETACHED>";
-  return Buf.str();
 }
 DECODE(Detached)
 {
@@ -854,14 +1467,14 @@ DECODE(Detached)
   return Ret;
 }
 
+
 ENCODE(Redraw)
 {
-  std::ostringstream Buf;
+  TextWriter Buf{Buffer};
   Buf << "<WINDOW-SIZE-CHANGE>";
   Buf << "<ROWS>" << Object.Rows << "</ROWS>";
   Buf << "<COLS>" << Object.Columns << "</COLS>";
   Buf << "</WINDOW-SIZE-CHANGE>";
-  return Buf.str();
 }
 DECODE(Redraw)
 {
@@ -880,6 +1493,93 @@ DECODE(Redraw)
   return Ret;
 }
 
+ENCODE(TerminalMode)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<TERMINAL-MODE>";
+  Buf << "<ECHO>";
+  monomux::message::Boolean::encode(Buffer, Object.Echo);
+  Buf << "</ECHO>";
+  Buf << "<CANONICAL>";
+  monomux::message::Boolean::encode(Buffer, Object.Canonical);
+  Buf << "</CANONICAL>";
+  Buf << "</TERMINAL-MODE>";
+}
+DECODE(TerminalMode)
+{
+  TerminalMode Ret;
+  HEADER_OR_NONE("<TERMINAL-MODE>");
+
+  CONSUME_OR_NONE("<ECHO>");
+  auto Echo = monomux::message::Boolean::decode(View);
+  if (!Echo)
+    return std::nullopt;
+  Ret.Echo = *Echo;
+  CONSUME_OR_NONE("</ECHO>");
+
+  CONSUME_OR_NONE("<CANONICAL>");
+  auto Canonical = monomux::message::Boolean::decode(View);
+  if (!Canonical)
+    return std::nullopt;
+  Ret.Canonical = *Canonical;
+  CONSUME_OR_NONE("</CANONICAL>");
+
+  FOOTER_OR_NONE("</TERMINAL-MODE>");
+  return Ret;
+}
+
+
+ENCODE(SessionChange)
+{
+  TextWriter Buf{Buffer};
+  Buf << "<SESSION-CHANGE Generation=\"" << Object.Generation << "\">";
+  Buf << "<MODE>";
+  switch (Object.Change)
+  {
+    case Created:
+      Buf << "Created";
+      break;
+    case Destroyed:
+      Buf << "Destroyed";
+      break;
+    case Attachment:
+      Buf << "Attachment";
+      break;
+  }
+  Buf << "</MODE>";
+  monomux::message::SessionStatus::encode(Buffer, Object.Session);
+  Buf << "</SESSION-CHANGE>";
+}
+DECODE(SessionChange)
+{
+  SessionChange Ret;
+  HEADER_OR_NONE("<SESSION-CHANGE Generation=\"");
+
+  EXTRACT_OR_NONE(Generation, "\">");
+  if (!parseNumber(Generation, Ret.Generation))
+    return std::nullopt;
+
+  CONSUME_OR_NONE("<MODE>");
+  EXTRACT_OR_NONE(Mode, "</MODE>");
+  if (Mode == "Created")
+    Ret.Change = Created;
+  else if (Mode == "Destroyed")
+    Ret.Change = Destroyed;
+  else if (Mode == "Attachment")
+    Ret.Change = Attachment;
+  else
+    return std::nullopt;
+
+  auto Session = monomux::message::SessionStatus::decode(View);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+
+  FOOTER_OR_NONE("</SESSION-CHANGE>");
+  return Ret;
+}
+
+
 } // namespace notification
 
 } // namespace monomux::message
@@ -0,0 +1,132 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include "monomux/control/MessageBase.hpp"
+
+#include "monomux/control/PascalString.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("control/PascalString")
+
+namespace monomux::message
+{
+
+/// Size prefixes larger than this are considered to be the result of a
+/// corrupted stream.
+static constexpr std::size_t MaxMeaningfulMessageSize = 1 << 24;
+
+namespace detail
+{
+
+std::string& sendBuffer()
+{
+  // Buffers larger than this are not kept around after an unusually large
+  // message had been sent.
+  static constexpr std::size_t MaxRetainedCapacity = 64 * 1024;
+  thread_local std::string Buffer;
+
+  if (Buffer.capacity() > MaxRetainedCapacity)
+    std::string{}.swap(Buffer);
+  Buffer.clear();
+  return Buffer;
+}
+
+} // namespace detail
+
+std::string readPascalString(BufferedChannel& Channel)
+{
+  std::string SizeStr = Channel.read(sizeof(std::size_t));
+  std::size_t Size = Message::binaryStringToSize(SizeStr);
+  if (Size > MaxMeaningfulMessageSize)
+  {
+    LOG(error)
+      << "When reading a Pascal String, got a prefix of " << Size
+      << " that was deemed too large (>= " << MaxMeaningfulMessageSize
+      << "). This is likely due to memory corruption. Ignoring message!";
+    return {};
+  }
+  std::string DataStr = Channel.read(Size);
+  return DataStr;
+}
+
+std::size_t PascalStringReader::fill(BufferedChannel& Channel)
+{
+  if (Offset)
+  {
+    Buffer.erase(0, Offset);
+    Offset = 0;
+  }
+
+  // Data already buffered in the channel is consumed on its own, without
+  // touching the underlying resource, so a fill on a blocking channel does
+  // not wait for data that might never arrive.
+  const std::size_t Requested = Channel.hasBufferedRead()
+                                  ? Channel.readInBuffer()
+                                  : Channel.optimalReadSize();
+  std::string Data = Channel.read(Requested);
+  MightHaveMore = Data.size() == Requested || Channel.hasBufferedRead();
+  if (Buffer.empty())
+    Buffer = std::move(Data);
+  else
+    Buffer.append(Data);
+  return Buffer.size();
+}
+
+std::optional<std::string_view> PascalStringReader::next()
+{
+  std::string_view Rest{Buffer};
+  Rest.remove_prefix(Offset);
+  if (Corrupted || Rest.size() < sizeof(std::size_t))
+    return std::nullopt;
+
+  std::size_t Size = Message::binaryStringToSize(Rest);
+  if (Size > MaxMeaningfulMessageSize)
+  {
+    LOG(error)
+      << "When reading a Pascal String, got a prefix of " << Size
+      << " that was deemed too large (>= " << MaxMeaningfulMessageSize
+      << "). This is likely due to memory corruption. Dropping stream!";
+    Corrupted = true;
+    clear();
+    return std::nullopt;
+  }
+  Rest.remove_prefix(sizeof(std::size_t));
+  if (Rest.size() < Size)
+    return std::nullopt;
+
+  Offset += sizeof(std::size_t) + Size;
+  return Rest.substr(0, Size);
+}
+
+void PascalStringReader::assign(std::string Data) noexcept
+{
+  Buffer = std::move(Data);
+  Offset = 0;
+}
+
+void PascalStringReader::clear() noexcept
+{
+  std::string{}.swap(Buffer);
+  Offset = 0;
+}
+
+} // namespace monomux::message
+
+#undef LOG
@@ -0,0 +1,84 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include "monomux/control/SessionFrame.hpp"
+
+namespace monomux::message
+{
+
+static void encodeLittleEndian(char* Out, std::uint32_t Value) noexcept
+{
+  for (std::size_t I = 0; I < sizeof(Value); ++I)
+    Out[I] = static_cast<char>((Value >> (I * 8)) & 0xFF);
+}
+
+static std::uint32_t decodeLittleEndian(const char* In) noexcept
+{
+  std::uint32_t Value = 0;
+  for (std::size_t I = 0; I < sizeof(Value); ++I)
+    Value |= static_cast<std::uint32_t>(static_cast<unsigned char>(In[I]))
+             << (I * 8);
+  return Value;
+}
+
+void SessionFrame::encodeHeader(char (&Header)[HeaderSize],
+                                std::uint32_t Tag,
+                                std::uint32_t Size) noexcept
+{
+  encodeLittleEndian(Header, Tag);
+  encodeLittleEndian(Header + sizeof(Tag), Size);
+}
+
+void SessionFrameReader::append(std::string_view Data)
+{
+  if (Offset)
+  {
+    Buffer.erase(0, Offset);
+    Offset = 0;
+  }
+  Buffer.append(Data);
+}
+
+std::optional<SessionFrame> SessionFrameReader::next() noexcept
+{
+  std::string_view Rest{Buffer};
+  Rest.remove_prefix(Offset);
+  if (Rest.size() < SessionFrame::HeaderSize)
+    return std::nullopt;
+
+  SessionFrame Frame;
+  Frame.Tag = decodeLittleEndian(Rest.data());
+  const std::uint32_t Size = decodeLittleEndian(Rest.data() + sizeof(Frame.Tag));
+  Rest.remove_prefix(SessionFrame::HeaderSize);
+  if (Rest.size() < Size)
+    return std::nullopt;
+
+  Frame.Data = Rest.substr(0, Size);
+  Offset += SessionFrame::HeaderSize + Size;
+  return Frame;
+}
+
+void SessionFrameReader::clear() noexcept
+{
+  std::string{}.swap(Buffer);
+  Offset = 0;
+}
+
+} // namespace monomux::message
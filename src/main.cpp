@@ -16,21 +16,30 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cerrno>
+#include <charconv>
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <string>
 #include <system_error>
-#include <thread>
 
+#include <execinfo.h>
 #include <getopt.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include "monomux/Version.hpp"
 #include "monomux/client/Main.hpp"
 #include "monomux/server/Main.hpp"
+#include "monomux/system/BufferedChannel.hpp"
+#include "monomux/system/CPUSet.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/system/Crash.hpp"
 #include "monomux/system/Environment.hpp"
+#include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
 #include "monomux/system/Signal.hpp"
 
@@ -49,22 +58,57 @@ const char ShortOptions[] = "hvqVs:e:u:n:lidDNk";
 
 // clang-format off
 struct ::option LongOptions[] = {
-  {"help",        no_argument,       nullptr, 'h'},
-  {"verbose",     no_argument,       nullptr, 'v'},
-  {"quiet",       no_argument,       nullptr, 'q'},
-  {"server",      no_argument,       nullptr, 0},
-  {"socket",      required_argument, nullptr, 's'},
-  {"env",         required_argument, nullptr, 'e'},
-  {"unset",       required_argument, nullptr, 'u'},
-  {"name",        required_argument, nullptr, 'n'},
-  {"list",        no_argument,       nullptr, 'l'},
-  {"interactive", no_argument,       nullptr, 'i'},
-  {"detach",      no_argument,       nullptr, 'd'},
-  {"detach-all",  no_argument,       nullptr, 'D'},
-  {"statistics",  no_argument,       nullptr, 0},
-  {"no-daemon",   no_argument,       nullptr, 'N'},
-  {"keepalive",   no_argument,       nullptr, 'k'},
-  {nullptr,       0,                 nullptr, 0}
+  {"help",                no_argument,       nullptr, 'h'},
+  {"verbose",             no_argument,       nullptr, 'v'},
+  {"quiet",               no_argument,       nullptr, 'q'},
+  {"server",              no_argument,       nullptr, 0},
+  {"socket",              required_argument, nullptr, 's'},
+  {"env",                 required_argument, nullptr, 'e'},
+  {"unset",               required_argument, nullptr, 'u'},
+  {"name",                required_argument, nullptr, 'n'},
+  {"list",                no_argument,       nullptr, 'l'},
+  {"interactive",         no_argument,       nullptr, 'i'},
+  {"detach",              no_argument,       nullptr, 'd'},
+  {"detach-all",          no_argument,       nullptr, 'D'},
+  {"statistics",          no_argument,       nullptr, 0},
+  {"metrics",             no_argument,       nullptr, 0},
+  {"top",                 no_argument,       nullptr, 0},
+  {"no-daemon",           no_argument,       nullptr, 'N'},
+  {"keepalive",           no_argument,       nullptr, 'k'},
+  {"splice-relay",        no_argument,       nullptr, 0},
+  {"reactors",            required_argument, nullptr, 0},
+  {"server-cpus",         required_argument, nullptr, 0},
+  {"session-cpus",        required_argument, nullptr, 0},
+  {"listen-backlog",      required_argument, nullptr, 0},
+  {"edge-triggered",      no_argument,       nullptr, 0},
+  {"io-uring",            no_argument,       nullptr, 0},
+  {"coalesce-delay",      required_argument, nullptr, 0},
+  {"coalesce-bytes",      required_argument, nullptr, 0},
+  {"output-rate-limit",   required_argument, nullptr, 0},
+  {"output-burst",        required_argument, nullptr, 0},
+  {"client-buffer-limit", required_argument, nullptr, 0},
+  {"buffer-size-max",     required_argument, nullptr, 0},
+  {"buffer-budget",       required_argument, nullptr, 0},
+  {"scrollback",          required_argument, nullptr, 0},
+  {"session-log",         required_argument, nullptr, 0},
+  {"record-dir",          required_argument, nullptr, 0},
+  {"record-sessions",     required_argument, nullptr, 0},
+  {"event-trace",         required_argument, nullptr, 0},
+  {"screen-snapshot",     no_argument,       nullptr, 0},
+  {"resize-smallest",     no_argument,       nullptr, 0},
+  {"session-pool",        required_argument, nullptr, 0},
+  {"hibernate-after",     required_argument, nullptr, 0},
+  {"shutdown-timeout",    required_argument, nullptr, 0},
+  {"metrics-socket",      required_argument, nullptr, 0},
+  {"multiplex",           no_argument,       nullptr, 0},
+  {"compress",            no_argument,       nullptr, 0},
+  {"shared-ring",         required_argument, nullptr, 0},
+  {"local-echo",          no_argument,       nullptr, 0},
+  {"read-only",           no_argument,       nullptr, 0},
+  {"ready-fd",            required_argument, nullptr, 0},
+  {"restore-fd",          required_argument, nullptr, 0},
+  {"symbolize-crash",     required_argument, nullptr, 0},
+  {nullptr,               0,                 nullptr, 0}
 };
 // clang-format on
 
@@ -89,11 +133,16 @@ struct MainOptions
 
   /// \p -v and \p -q translated to \p Severity choice.
   log::Severity Severity;
+
+  /// \p --symbolize-crash
+  std::optional<std::string> SymbolizeCrash;
 };
 
 void printHelp();
 void printVersion();
 void printFeatures();
+bool waitForServer(const Pipe& Ready);
+int symbolizeCrash(const std::string& ReportPath);
 void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* Info,
                 const SignalHandling* Handling);
@@ -115,6 +164,19 @@ int main(int ArgC, char* ArgV[])
       return std::cerr;
     };
 
+    auto ParseCount = [&ArgError](std::string_view Opt,
+                                  std::size_t& Count) -> bool {
+      std::string_view Arg = optarg;
+      auto [End, EC] =
+        std::from_chars(Arg.data(), Arg.data() + Arg.size(), Count);
+      if (EC != std::errc{} || End != Arg.data() + Arg.size())
+      {
+        ArgError() << "option '--" << Opt << "' requires a number\n";
+        return false;
+      }
+      return true;
+    };
+
     int Opt;
     int LongOptIndex;
     while ((Opt = ::getopt_long(
@@ -135,6 +197,214 @@ int main(int ArgC, char* ArgV[])
           {
             ClientOpts.StatisticsRequest = true;
           }
+          else if (Opt == "metrics")
+          {
+            ClientOpts.MetricsRequest = true;
+          }
+          else if (Opt == "top")
+          {
+            ClientOpts.TopRequest = true;
+          }
+          else if (Opt == "splice-relay")
+          {
+            ServerOpts.SpliceRelay = true;
+          }
+          else if (Opt == "edge-triggered")
+          {
+            ServerOpts.EdgeTriggered = true;
+          }
+          else if (Opt == "io-uring")
+          {
+            ServerOpts.IOUring = true;
+            ClientOpts.IOUring = true;
+          }
+          else if (Opt == "reactors")
+          {
+            std::size_t Count = 0;
+            if (!ParseCount(Opt, Count))
+              break;
+            ServerOpts.ReactorCount = Count;
+          }
+          else if (Opt == "server-cpus" || Opt == "session-cpus")
+          {
+            std::optional<CPUSet> CPUs = CPUSet::parse(optarg);
+            if (!CPUs)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' requires a list of CPUs, such as '0-3,6'\n";
+              break;
+            }
+            (Opt == "server-cpus" ? ServerOpts.ServerCPUs
+                                  : ServerOpts.SessionCPUs) = std::move(CPUs);
+          }
+          else if (Opt == "listen-backlog")
+          {
+            std::size_t Count = 0;
+            if (!ParseCount(Opt, Count))
+              break;
+            ServerOpts.ListenBacklog = Count;
+          }
+          else if (Opt == "coalesce-delay")
+          {
+            std::size_t Millis = 0;
+            if (!ParseCount(Opt, Millis))
+              break;
+            ServerOpts.OutputCoalescing.MaxDelay =
+              std::chrono::milliseconds{Millis};
+            ClientOpts.OutputCoalescing.MaxDelay =
+              std::chrono::milliseconds{Millis};
+          }
+          else if (Opt == "coalesce-bytes")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.OutputCoalescing.MaxBytes = Bytes;
+            ClientOpts.OutputCoalescing.MaxBytes = Bytes;
+          }
+          else if (Opt == "output-rate-limit")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.OutputThrottle.Rate = Bytes;
+          }
+          else if (Opt == "output-burst")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.OutputThrottle.Burst = Bytes;
+          }
+          else if (Opt == "client-buffer-limit")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.ClientBufferLimit = Bytes;
+          }
+          else if (Opt == "buffer-size-max")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            if (Bytes < BufferedChannel::BufferSize)
+            {
+              ArgError() << "option '--" << Opt << "' must be at least "
+                         << BufferedChannel::BufferSize << '\n';
+              break;
+            }
+            ServerOpts.BufferSizeMax = Bytes;
+          }
+          else if (Opt == "buffer-budget")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.BufferBudget = Bytes;
+          }
+          else if (Opt == "scrollback")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.Scrollback = Bytes;
+          }
+          else if (Opt == "session-log")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.SessionLog = Bytes;
+          }
+          else if (Opt == "record-dir")
+          {
+            ServerOpts.RecordDirectory.emplace(optarg);
+          }
+          else if (Opt == "record-sessions")
+          {
+            ServerOpts.RecordPattern.emplace(optarg);
+          }
+          else if (Opt == "event-trace")
+          {
+            ServerOpts.EventTrace.emplace(optarg);
+          }
+          else if (Opt == "screen-snapshot")
+          {
+            ServerOpts.ScreenSnapshot = true;
+          }
+          else if (Opt == "resize-smallest")
+          {
+            ServerOpts.ResizeToSmallest = true;
+          }
+          else if (Opt == "session-pool")
+          {
+            std::size_t Count = 0;
+            if (!ParseCount(Opt, Count))
+              break;
+            ServerOpts.SessionPool = Count;
+          }
+          else if (Opt == "hibernate-after")
+          {
+            std::size_t Seconds = 0;
+            if (!ParseCount(Opt, Seconds))
+              break;
+            ServerOpts.HibernateAfter = std::chrono::seconds{Seconds};
+          }
+          else if (Opt == "shutdown-timeout")
+          {
+            std::size_t Milliseconds = 0;
+            if (!ParseCount(Opt, Milliseconds))
+              break;
+            ServerOpts.ShutdownTimeout =
+              std::chrono::milliseconds{Milliseconds};
+          }
+          else if (Opt == "metrics-socket")
+          {
+            ServerOpts.MetricsSocketPath.emplace(optarg);
+          }
+          else if (Opt == "multiplex")
+          {
+            ClientOpts.Multiplex = true;
+          }
+          else if (Opt == "compress")
+          {
+            ClientOpts.Compress = true;
+          }
+          else if (Opt == "shared-ring")
+          {
+            std::size_t Bytes = 0;
+            if (!ParseCount(Opt, Bytes))
+              break;
+            ServerOpts.SharedRing = Bytes;
+            ClientOpts.SharedRing = Bytes != 0;
+          }
+          else if (Opt == "local-echo")
+          {
+            ClientOpts.LocalEcho = true;
+          }
+          else if (Opt == "read-only")
+          {
+            ClientOpts.ReadOnly = true;
+          }
+          else if (Opt == "ready-fd")
+          {
+            std::size_t FD = 0;
+            if (!ParseCount(Opt, FD))
+              break;
+            ServerOpts.ReadyFD = static_cast<int>(FD);
+          }
+          else if (Opt == "restore-fd")
+          {
+            std::size_t FD = 0;
+            if (!ParseCount(Opt, FD))
+              break;
+            ServerOpts.RestoreFD = static_cast<int>(FD);
+          }
+          else if (Opt == "symbolize-crash")
+          {
+            MainOpts.SymbolizeCrash = optarg;
+          }
           else
           {
             ArgError() << "option '--" << Opt
@@ -250,6 +520,8 @@ int main(int ArgC, char* ArgV[])
         printFeatures();
       return EXIT_Success;
     }
+    if (MainOpts.SymbolizeCrash)
+      return symbolizeCrash(*MainOpts.SymbolizeCrash);
 
     {
       using namespace monomux::log;
@@ -324,6 +596,8 @@ int main(int ArgC, char* ArgV[])
     Sig.registerCallback(SIGSTKFLT, &coreDumped);
     Sig.registerObject(SignalHandling::ModuleObjName, "main");
     Sig.enable();
+
+    prepareCrashReport(SocketPath::defaultSocketPath().Path, getFullVersion());
   }
 
   // --------------------- Set up some internal environment --------------------
@@ -372,20 +646,25 @@ int main(int ArgC, char* ArgV[])
     {
       LOG(info) << "No running server found, starting one automatically...";
       ServerOpts.ServerMode = true;
+      // The server tells through this pipe when it accepts connections.
+      Pipe::AnonymousPipe Ready = Pipe::create();
+      fd::raw_fd ReadyW = Ready.getWrite()->raw();
       Process::fork([] { /* Parent: noop. */ },
-                    [&ServerOpts, &ArgV] {
+                    [&ServerOpts, &ArgV, ReadyW] {
                       // Perform the server restart in the child, so it gets
                       // disowned when we eventually exit, and we can remain the
                       // client.
+                      fd::removeDescriptorFlag(ReadyW, FD_CLOEXEC);
+                      ServerOpts.ReadyFD = ReadyW;
                       server::exec(ServerOpts, ArgV[0]);
                     });
+      // The server holds the only write end now, so its exit ends the pipe.
+      std::unique_ptr<Pipe> ReadyR = Ready.takeRead();
 
-      // Give some time for the server to spawn...
-      std::this_thread::sleep_for(std::chrono::seconds(1));
-
+      bool Started = waitForServer(*ReadyR);
       try
       {
-        ToServer = client::connect(ClientOpts, true, &FailureReason);
+        ToServer = client::connect(ClientOpts, !Started, &FailureReason);
       }
       catch (...)
       {}
@@ -449,6 +728,12 @@ Options:
     -q, --quiet                 - Decrease the verbosity of the built-in logging
                                   mechanism. Each '-q' supplied disables one
                                   more level. (Meaningless together with '-v'.)
+    --symbolize-crash FILE      - Print the stack trace in the crash report
+                                  FILE, written when Monomux crashed, with the
+                                  functions and source locations resolved.
+                                  The results are cached in
+                                  '$XDG_CACHE_HOME/monomux/symbols' for later
+                                  runs.
 
 
 Client options:
@@ -484,6 +769,9 @@ Client options:
                                   This flag may be specified multiple times for
                                   multiple environment variables.
     -s PATH, --socket PATH      - Path of the server socket to connect to.
+                                  'tcp:HOST:PORT' or 'vsock:CID:PORT' connect
+                                  to a server listening on the network, or on
+                                  the host of a virtual machine, instead.
     -n NAME, --name NAME        - Name of the remote session to attach to or
                                   create. (Defaults to an automatically
                                   generated value.)
@@ -496,6 +784,37 @@ Client options:
                                   server. (The default behaviour is to
                                   automatically create a session or attach in
                                   this case.)
+    --multiplex                 - Ask the server to carry the data of the
+                                  session over the same connection as the
+                                  control messages, instead of a separate one.
+                                  (Falls back to a separate connection if the
+                                  server runs reactors or is edge-triggered.)
+    --compress                  - Ask the server to compress the output of
+                                  the session sent to the client, which saves
+                                  bandwidth if the connection to the server is
+                                  forwarded over the network. (Only if the
+                                  build supports compression.)
+    --local-echo                - Display the typed characters immediately,
+                                  before their echo arrives from the session,
+                                  which hides the latency of slow connections.
+                                  (Only done while the terminal of the session
+                                  echoes the input and edits it line by line.)
+    --read-only                 - Attach to the session as a viewer only. The
+                                  input typed is not sent to the session, and
+                                  the size of the terminal does not affect the
+                                  size of the session. A viewer that can not
+                                  keep up skips the output it missed.
+    --metrics                   - Print the counters kept by the server
+                                  listening on the socket given to '--socket',
+                                  one per line, in the format of
+                                  'TABLE SUBJECT NAME VALUE', and exit.
+    --top                       - Show the resources used by each session of
+                                  the server listening on the socket given to
+                                  '--socket': the CPU and memory of its
+                                  program, the rate of its output, and the
+                                  data buffered for its clients, refreshed
+                                  every 2 seconds. If the output is not a
+                                  terminal, print it once and exit.
 
 
 In-session options:
@@ -507,11 +826,150 @@ In-session options:
 
 Server options:
     -s PATH, --socket PATH      - Path of the sever socket to create and await
-                                  clients on.
+                                  clients on. 'tcp:HOST:PORT' (HOST may be '*'
+                                  for all interfaces) or 'vsock:CID:PORT'
+                                  listen on the network instead. There is no
+                                  authentication of the clients connecting!
     -k, --keepalive             - Do not automatically shut the server down if
                                   the only session running in it had exited.
     -N, --no-daemon             - Do not daemonise (put the running server into
                                   the background) automatically. Implies '-k'.
+    --splice-relay              - Relay the output of a session with only one
+                                  client attached inside the kernel, without
+                                  copying it through the server's buffers.
+    --reactors N                - Distribute the sessions, and the clients
+                                  attached to them, over N additional threads,
+                                  each with its own event loop. (Usually, the
+                                  number of CPU cores.) The main thread keeps
+                                  accepting clients and handling control
+                                  messages.
+    --server-cpus LIST          - Run the threads of the server on the CPUs in
+                                  LIST, such as '0-3,6'. Each reactor is pinned
+                                  to one of them, spread over the NUMA nodes.
+    --session-cpus LIST         - Run the programs in the sessions on the CPUs
+                                  in LIST, so heavy work in a session does not
+                                  delay the server. (Defaults to the CPUs the
+                                  server could originally run on.)
+    --listen-backlog N          - Allow at most N clients to wait for being
+                                  accepted by the server. (Defaults to 16.)
+    --edge-triggered            - Listen to sessions and data connections in
+                                  edge-triggered mode, reading each until it is
+                                  drained, instead of rescheduling leftovers.
+    --io-uring                  - Use io_uring(7) instead of epoll(7) to wait
+                                  for events, if supported by the system. The
+                                  server also reads the output of the sessions
+                                  and sends it to the clients with io_uring(7)
+                                  requests. If given to a client, applies to
+                                  the client's event loop, too.
+    --coalesce-delay MS         - Hold back the output of sessions for at most
+                                  MS milliseconds (usually, 1 to 5) after
+                                  output was sent, so that quickly streaming
+                                  output reaches the terminal in fewer, larger
+                                  writes. Output after a pause is still sent
+                                  immediately. If given to a client, applies
+                                  to the client's writes to the terminal, too.
+    --coalesce-bytes N          - Send the held back output as soon as N bytes
+                                  accumulated. (Defaults to 16384. Only
+                                  meaningful with '--coalesce-delay'.)
+    --output-rate-limit N       - Read the output of each session at most at
+                                  N bytes per second. Beyond that, the program
+                                  in the session blocks writing its terminal
+                                  until the limit allows reading again, so
+                                  runaway output does not flood the server
+                                  and the clients. (Defaults to unlimited.)
+    --output-burst N            - Allow reading N bytes in a burst above the
+                                  rate limit. (Defaults to the rate. Only
+                                  meaningful with '--output-rate-limit'.)
+    --client-buffer-limit N     - Consider a client unable to keep up once N
+                                  bytes of output are buffered for it.
+                                  (Defaults to 8 MiB. At most, and if 0, half
+                                  of '--buffer-size-max'.)
+                                  If every client of a session is saturated,
+                                  the session's output is not read until one
+                                  catches up. Otherwise, saturated clients
+                                  miss output, and the program is asked to
+                                  redraw once they catch up.
+    --buffer-size-max N         - Allow at most N bytes to be buffered in
+                                  memory for a single connection. A client
+                                  exceeding this is kicked. (Defaults to
+                                  2 GiB.)
+    --buffer-budget N           - Hold back the output to clients while the
+                                  buffers of all connections together exceed
+                                  N bytes. (Defaults to no limit.)
+    --scrollback N              - Keep the last N bytes of the output of each
+                                  session, and send them to clients attaching,
+                                  instead of asking the program to redraw the
+                                  screen. (Defaults to 0, keeping nothing.)
+    --session-log N             - Keep at least the last N bytes of the output
+                                  of each session in files next to the socket,
+                                  for as long as the session runs. The output
+                                  replayed by '--scrollback' is then read from
+                                  these files, and is not kept in memory.
+    --record-dir DIR            - Record the output of sessions to asciicast
+                                  files in DIR. The files are written in the
+                                  background, and output is dropped from the
+                                  recording, not delayed, if the disk is slow.
+    --record-sessions PATTERN   - Only record the sessions which name matches
+                                  the shell PATTERN. (Defaults to '*'. Only
+                                  meaningful with '--record-dir'.)
+    --event-trace PREFIX        - Record every batch of events handled by the
+                                  server, and the size of the reads and writes
+                                  done for them, to 'PREFIX.N.trace' files,
+                                  one for each event loop. The traces can be
+                                  replayed with 'monomux_trace_replay'.
+    --screen-snapshot           - Track the contents of the screen of each
+                                  session, and draw it to clients attaching,
+                                  instead of replaying the recent output or
+                                  asking the program to redraw the screen.
+                                  (Colours and character attributes are not
+                                  restored.)
+    --resize-smallest           - Size the terminal of sessions to fit the
+                                  smallest of the attached clients, instead
+                                  of the client that was resized last.
+    --session-pool N            - Keep N sessions running the default shell
+                                  of the server started in advance, and hand
+                                  them out to clients creating a session for
+                                  the same shell, without arguments or
+                                  changes to the environment. (Defaults to 0,
+                                  starting every session on request.)
+    --shared-ring N             - Publish the output of each session in a
+                                  ring of N bytes of shared memory, which
+                                  clients on the same machine read directly,
+                                  instead of being sent the output through
+                                  their connection. The session is never held
+                                  back by these clients: one that falls more
+                                  than N bytes behind misses the output, and
+                                  the program is asked to redraw. If given to
+                                  a client, it asks the server for the ring.
+    --hibernate-after SECONDS   - Release the memory used by sessions that had
+                                  no clients attached and produced no output
+                                  for SECONDS, moving their '--scrollback' to
+                                  a temporary file, until they produce output
+                                  or a client attaches again. (Defaults to 0,
+                                  sessions never hibernate.)
+    --shutdown-timeout MS       - When the server is stopped, wait at most MS
+                                  milliseconds for the clients to be notified
+                                  and for the programs of the sessions to exit
+                                  after being hung up. (Defaults to 2000.)
+    --metrics-socket PATH       - Serve the counters of the server in the
+                                  OpenMetrics text format over HTTP on the
+                                  socket created at PATH, e.g. for scraping by
+                                  Prometheus:
+
+                                      curl --unix-socket PATH localhost/metrics
+
+    --ready-fd FD               - Write a byte to, and close, the inherited
+                                  file descriptor FD once the server accepts
+                                  connections. (Used when a client starts the
+                                  server automatically.)
+    --restore-fd FD             - Take over the sessions and clients of the
+                                  previous instance of the server from the
+                                  state in the inherited file descriptor FD.
+                                  (Used when the server upgrades itself.)
+
+  Sending SIGUSR2 to the server upgrades it in place: the program, as found
+  on the disk at the time, is started instead of the running one, and takes
+  over the sessions and the clients connected, without interrupting them.
 )EOF";
   std::cout << std::endl;
 }
@@ -526,6 +984,51 @@ void printFeatures()
   std::cout << "Features:\n" << getHumanReadableConfiguration() << std::endl;
 }
 
+int symbolizeCrash(const std::string& ReportPath)
+{
+  std::optional<CrashReport> Report = CrashReport::load(ReportPath);
+  if (!Report)
+  {
+    std::cerr << "'" << ReportPath << "' is not a crash report of Monomux"
+              << std::endl;
+    return EXIT_InvocationError;
+  }
+
+  Backtrace BT{*Report};
+  std::optional<SymbolCache> Cache;
+  if (std::string CachePath = SymbolCache::defaultPath(); !CachePath.empty())
+    Cache.emplace(std::move(CachePath));
+  BT.prettify(Cache ? &*Cache : nullptr);
+  if (Cache)
+    Cache->save();
+
+  std::cout << "Monomux (v" << Report->Version << ") crashed with signal "
+            << Report->Signal << " '"
+            << SignalHandling::signalName(Report->Signal) << "'\n";
+  if (Report->Version != getFullVersion())
+    std::cout << "(Symbolised with v" << getFullVersion()
+              << ", the result might be inaccurate.)\n";
+  std::cout << '\n';
+  printBacktrace(std::cout, BT);
+  return EXIT_Success;
+}
+
+/// Writes \p Str to the standard error, in an async-signal-safe manner.
+void writeError(const char* Str)
+{
+  std::size_t Length = std::strlen(Str);
+  while (Length)
+  {
+    ::ssize_t Written = ::write(STDERR_FILENO, Str, Length);
+    if (Written == -1 && errno == EINTR)
+      continue;
+    if (Written <= 0)
+      return;
+    Str += Written;
+    Length -= static_cast<std::size_t>(Written);
+  }
+}
+
 void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* /* Info */,
                 const SignalHandling* Handling)
@@ -534,27 +1037,61 @@ void coreDumped(SignalHandling::Signal SigNum,
   // and logics properly receive the fact that we are ending, anyway...
   SignalHandling::get().defaultCallback(SigNum);
 
+  // The state of the memory allocator, or of any lock, can not be trusted
+  // after a crash, and the sessions of a server are in limbo until it exits.
+  // Only the raw data is saved here, the symbolisation is done later.
   const volatile auto* ModulePtr = std::any_cast<const char*>(
     Handling->getObject(SignalHandling::ModuleObjName));
   const char* Module = ModulePtr ? *ModulePtr : "<Unknown>";
-  LOG(fatal) << "in '" << Module << "' - FATAL SIGNAL " << SigNum << " '"
-             << SignalHandling::signalName(SigNum) << "' RECEIVED!";
-
-  Backtrace BT;
-  BT.prettify();
-
-  std::cerr << "- * - * - * - * - * - * - * - * - * - * - * - * - * - * - * - "
-               "* - * - * - * - * - * - * - * - * - * - * - * -\n";
-  std::cerr << "\t\tMonomux (v" << getFullVersion() << ") has crashed!\n";
-  std::cerr << "---------------------------------------------------------------"
-               "-----------------------------------------------\n";
-  std::cerr << '\n';
-  std::cerr << getHumanReadableConfiguration() << '\n';
-  std::cerr << "---------------------------------------------------------------"
-               "-----------------------------------------------\n";
-  printBacktrace(std::cerr, BT);
-  std::cerr << "- * - * - * - * - * - * - * - * - * - * - * - * - * - * - * - "
-               "* - * - * - * - * - * - * - * - * - * - * - * -\n";
+  writeError("- * - * - * - * - * - * - * - * - * - * - * - * - * - * - * - "
+             "* - * - * - * - * - * - * - * - * - * - * - * -\n");
+  writeError("\t\tMonomux has crashed in '");
+  writeError(Module);
+  writeError("' with FATAL SIGNAL '");
+  writeError(SignalHandling::signalName(SigNum));
+  writeError("'!\n\n");
+
+  void* Addresses[Backtrace::MaxSize];
+  ::backtrace_symbols_fd(
+    Addresses, ::backtrace(Addresses, Backtrace::MaxSize), STDERR_FILENO);
+
+  if (const char* Report = writeCrashReport(SigNum))
+  {
+    writeError("\nThe crash report was saved to '");
+    writeError(Report);
+    writeError("'. See the trace with its symbols resolved by running:\n\n"
+               "    monomux --symbolize-crash ");
+    writeError(Report);
+    writeError("\n");
+  }
+  writeError("- * - * - * - * - * - * - * - * - * - * - * - * - * - * - * - "
+             "* - * - * - * - * - * - * - * - * - * - * - * -\n");
+}
+
+/// Waits for the server started by the current process to notify about its
+/// readiness on the \p Ready pipe.
+///
+/// \returns whether the server reported it accepts connections. If \p false,
+/// the server exited, or did not report in time.
+bool waitForServer(const Pipe& Ready)
+{
+  static constexpr int TimeoutMs = 5000;
+  ::pollfd PFD{};
+  PFD.fd = Ready.raw();
+  PFD.events = POLLIN;
+  int Ret;
+  do
+    Ret = ::poll(&PFD, 1, TimeoutMs);
+  while (Ret == -1 && errno == EINTR);
+  if (Ret != 1)
+    return false;
+
+  char Byte;
+  ::ssize_t Read;
+  do
+    Read = ::read(Ready.raw(), &Byte, 1);
+  while (Read == -1 && errno == EINTR);
+  return Read == 1;
 }
 
 } // namespace
@@ -19,6 +19,7 @@
 #include <cassert>
 
 #include "monomux/control/PascalString.hpp"
+#include "monomux/system/MuxedSocket.hpp"
 
 #include "monomux/server/ClientData.hpp"
 
@@ -53,6 +54,53 @@ void ClientData::subjugateIntoDataSocket(ClientData& Other) noexcept
          "Other client already has a data connection!");
   DataConnection.swap(Other.ControlConnection);
   assert(!Other.ControlConnection && "Other client stayed alive");
+  changed();
+}
+
+void ClientData::attachDataSocket(std::unique_ptr<Socket> Connection) noexcept
+{
+  assert(!DataConnection && "Current client already has a data connection!");
+  DataConnection = std::move(Connection);
+  changed();
+}
+
+void ClientData::multiplex()
+{
+  assert(!DataConnection && "Current client already has a data connection!");
+  std::string Identifier = ControlConnection->identifier();
+  auto [Control, Data] = MuxedSocket::create(
+    std::move(*ControlConnection).release(), std::move(Identifier));
+  ControlConnection = std::move(Control);
+  DataConnection = std::move(Data);
+  Multiplexed = true;
+  changed();
+}
+
+std::optional<std::uint32_t>
+ClientData::watchTag(const SessionData& Session) const noexcept
+{
+  for (const WatchedSession& W : Watched)
+    if (W.Session == &Session)
+      return W.Tag;
+  return std::nullopt;
+}
+
+std::uint32_t ClientData::watch(SessionData& Session)
+{
+  assert(!AttachedSession && "Watching while attached!");
+  assert(!watchTag(Session) && "Already watching the session!");
+  Watched.push_back(WatchedSession{&Session, NextWatchTag++});
+  return Watched.back().Tag;
+}
+
+void ClientData::unwatch(SessionData& Session) noexcept
+{
+  for (auto It = Watched.begin(); It != Watched.end(); ++It)
+    if (It->Session == &Session)
+    {
+      Watched.erase(It);
+      return;
+    }
 }
 
 void ClientData::sendDetachReason(
@@ -62,7 +110,8 @@ void ClientData::sendDetachReason(
 {
   message::sendMessage(
     getControlSocket(),
-    monomux::message::notification::Detached{R, EC, std::move(Reason)});
+    monomux::message::notification::Detached{R, EC, std::move(Reason)},
+    Wire);
 }
 
 } // namespace monomux::server
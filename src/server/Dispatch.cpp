@@ -16,6 +16,11 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <csignal>
+
+#include <sys/socket.h>
+
+#include "monomux/adt/POD.hpp"
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
 #include "monomux/system/Environment.hpp"
@@ -31,26 +36,31 @@ using namespace monomux::message;
 namespace monomux::server
 {
 
-void Server::setUpDispatch()
+constexpr Server::DispatchTable Server::makeDispatch() noexcept
 {
-#define KIND(E) static_cast<std::uint16_t>(MessageKind::E)
+  DispatchTable Table{};
+#define KIND(E) static_cast<std::size_t>(MessageKind::E)
 #define MEMBER(NAME) &Server::NAME
-#define DISPATCH(K, FUNCTION) registerMessageHandler(KIND(K), MEMBER(FUNCTION));
+#define DISPATCH(K, FUNCTION) Table[KIND(K)] = MEMBER(FUNCTION);
 #include "monomux/server/Dispatch.ipp"
 #undef MEMBER
 #undef KIND
+  return Table;
 }
 
+const Server::DispatchTable Server::Dispatch = makeDispatch();
+
 /// Reschedules the overflown buffer identified by \p BO to the next iteration
 /// of \p Poll.
 template <typename T>
 static std::size_t sendMessageAndRescheduleIfOverflow(EPoll& Poll,
                                                       BufferedChannel& Channel,
-                                                      const T& Msg)
+                                                      const T& Msg,
+                                                      WireFormat Format)
 {
   try
   {
-    return sendMessage(Channel, Msg);
+    return sendMessage(Channel, Msg, Format);
   }
   catch (const buffer_overflow&)
   {
@@ -61,8 +71,12 @@ static std::size_t sendMessageAndRescheduleIfOverflow(EPoll& Poll,
 
 void Server::sendAcceptClient(ClientData& Client)
 {
+  // The client has not said anything yet, so this must be understood by every
+  // client, but it advertises the binary encoding for the rest of the
+  // connection.
+  notification::Connection Msg{{true}, {}, BinaryWireVersion};
   sendMessageAndRescheduleIfOverflow(
-    *Poll, Client.getControlSocket(), notification::Connection{{true}, {}});
+    *Poll, Client.getControlSocket(), Msg, WireFormat::Text);
 }
 
 void Server::sendRejectClient(ClientData& Client, std::string Reason)
@@ -70,7 +84,19 @@ void Server::sendRejectClient(ClientData& Client, std::string Reason)
   sendMessageAndRescheduleIfOverflow(
     *Poll,
     Client.getControlSocket(),
-    notification::Connection{{false}, std::move(Reason)});
+    notification::Connection{{false}, std::move(Reason)},
+    WireFormat::Text);
+}
+
+/// \returns whether \p FD is a connection-oriented socket, i.e. a file that
+/// is fit to become the data connection of a client.
+static bool isStreamSocket(raw_fd FD)
+{
+  POD<int> Type;
+  POD<::socklen_t> Length;
+  *Length = sizeof(int);
+  return ::getsockopt(FD, SOL_SOCKET, SO_TYPE, &Type, &Length) == 0 &&
+         *Type == SOCK_STREAM;
 }
 
 #define HANDLER(NAME)                                                          \
@@ -91,7 +117,7 @@ HANDLER(requestClientID)
   Resp.Client.ID = Client.id();
   Resp.Client.Nonce = Client.makeNewNonce();
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
 }
 
 HANDLER(requestDataSocket)
@@ -106,27 +132,73 @@ HANDLER(requestDataSocket)
   auto MainIt = Server.Clients.find(Msg->Client.ID);
   if (MainIt == Server.Clients.end())
   {
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
     return;
   }
 
   ClientData& MainClient = *MainIt->second;
   if (MainClient.getDataSocket() != nullptr)
   {
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
     return;
   }
   if (MainClient.consumeNonce() != Msg->Client.Nonce)
   {
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
     return;
   }
 
+  // The turnover destroys the record of the sender connection.
+  WireFormat Format = Client.wireFormat();
   Server.turnClientIntoDataOfOtherClient(MainClient, Client);
   assert(MainClient.getDataSocket() &&
          "Turnover should have subjugated client!");
   Resp.Success = true;
-  sendMessage(*MainClient.getDataSocket(), Resp);
+  sendMessage(*MainClient.getDataSocket(), Resp, Format);
+}
+
+HANDLER(requestHandshake)
+{
+  MSG(request::Handshake);
+  response::Handshake Resp;
+  Resp.Client.ID = Client.id();
+  Resp.Success = false;
+  Resp.Multiplexed = false;
+  Resp.Compressed = false;
+  if (Msg->Compressed && Deflater::available())
+  {
+    Client.setCompressed(true);
+    Resp.Compressed = true;
+  }
+
+  // The data connection arrived with the bytes of the request.
+  fd Connection = Client.getControlSocket().takeReceivedFile();
+  if (Msg->Multiplexed && Server.canMultiplex() && !Client.getDataSocket())
+  {
+    // The data connection was only passed as a fallback, and is closed.
+    Resp.Success = true;
+    Resp.Multiplexed = true;
+    Resp.Client.Nonce = Client.makeNewNonce();
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+    Server.multiplexClient(Client);
+    return;
+  }
+  if (Connection.has() && isStreamSocket(Connection) &&
+      !Client.getDataSocket())
+  {
+    Server.attachDataSocket(Client, std::move(Connection));
+    Resp.Success = true;
+  }
+  // The ring is passed as a file, so the client must be on the same machine.
+  if (Msg->SharedRing && Server.SharedRingSize &&
+      Client.getControlSocket().canPassFiles())
+  {
+    Client.setSharedRing(true);
+    Resp.SharedRing = true;
+  }
+  Resp.Client.Nonce = Client.makeNewNonce();
+
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
 }
 
 HANDLER(requestSessionList)
@@ -144,7 +216,26 @@ HANDLER(requestSessionList)
     Resp.Sessions.emplace_back(std::move(TransmitData));
   }
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+}
+
+HANDLER(requestSessionSubscribe)
+{
+  MSG(request::SessionSubscribe);
+  Server.setSessionSubscriber(Client, Msg->Subscribe);
+
+  response::SessionSubscribe Resp;
+  Resp.Generation = Server.SessionGeneration;
+  // A subscriber that is already up to date does not need the list again.
+  Resp.Snapshot = Msg->Subscribe && Msg->KnownGeneration != Resp.Generation;
+  if (Resp.Snapshot)
+  {
+    Resp.Sessions.reserve(Server.Sessions.size());
+    for (const auto& SessionElem : Server.Sessions)
+      Resp.Sessions.emplace_back(Server::sessionStatus(*SessionElem.second));
+  }
+
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
 }
 
 HANDLER(requestMakeSession)
@@ -158,7 +249,16 @@ HANDLER(requestMakeSession)
   if (!Msg->Name.empty() && Server.getSession(Msg->Name))
   {
     LOG(debug) << "Session \"" << Msg->Name << "\" already exists";
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+    return;
+  }
+  if (!Msg->Name.empty() && Server.isPooledAlias(Msg->Name))
+  {
+    // The program started in advance knows itself by this name, and would
+    // act on the new session once it is handed out.
+    LOG(debug) << "Session \"" << Msg->Name
+               << "\" is the name of a session started in advance";
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
     return;
   }
   if (Msg->Name.empty())
@@ -172,10 +272,11 @@ HANDLER(requestMakeSession)
 
   LOG(info) << "Creating Session \"" << Msg->Name << "\"...";
   Resp.Name = Msg->Name;
-  auto S = std::make_unique<SessionData>(std::move(Msg->Name));
+  SessionData S{std::move(Msg->Name)};
 
   Process::SpawnOptions SOpts;
   SOpts.CreatePTY = true;
+  SOpts.Affinity = Server.sessionAffinity();
   SOpts.Program = std::move(Msg->SpawnOpts.Program);
   SOpts.Arguments = std::move(Msg->SpawnOpts.Arguments);
   for (std::pair<std::string, std::string>& EnvVar :
@@ -185,6 +286,14 @@ HANDLER(requestMakeSession)
   for (std::string& UnsetEnvVar : Msg->SpawnOpts.UnsetEnvironment)
     SOpts.Environment.try_emplace(std::move(UnsetEnvVar), std::nullopt);
 
+  if (std::optional<PooledSession> Pooled = Server.takePooledSession(SOpts))
+  {
+    LOG(debug) << "Handing out session \"" << Pooled->Alias
+               << "\" started in advance";
+    S.setAlias(std::move(Pooled->Alias));
+    S.setProcess(std::move(Pooled->Proc));
+  }
+  else
   {
     // Inject the variables needed by the controlling client to detach from the
     // session.
@@ -195,17 +304,16 @@ HANDLER(requestMakeSession)
     for (std::pair<std::string, std::string> BuiltinEnvVar : MS.createEnvVars())
       SOpts.Environment[std::move(BuiltinEnvVar.first)] =
         std::move(BuiltinEnvVar.second);
-  }
 
-  // TODO: How to detect process creation failing?
-  Process P = Process::spawn(SOpts);
-  S->setProcess(std::move(P));
+    // TODO: How to detect process creation failing?
+    Process P = Process::spawn(SOpts);
+    S.setProcess(std::move(P));
+  }
 
-  auto InsertResult = Server.Sessions.try_emplace(Resp.Name, std::move(S));
-  Server.createCallback(*InsertResult.first->second);
+  Server.createCallback(*Server.makeSession(std::move(S)));
 
   Resp.Success = true;
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
 }
 
 HANDLER(requestAttach)
@@ -215,17 +323,47 @@ HANDLER(requestAttach)
   Resp.Success = false;
 
   SessionData* S = Server.getSession(Msg->Name);
-  if (!S)
+  if (!S || Client.watching())
   {
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
     return;
   }
 
+  Client.setReadOnly(Msg->ReadOnly);
   Server.clientAttachedCallback(Client, *S);
   Resp.Success = true;
+  Resp.Replayed = Server.replayScrollback(Client, *S);
   Resp.Session.Name = S->name();
   Resp.Session.Created = std::chrono::system_clock::to_time_t(S->whenCreated());
-  sendMessage(Client.getControlSocket(), Resp);
+  Resp.SharedRing = false;
+  if (Server.attachSharedRing(Client, *S))
+  {
+    Resp.SharedRing = true;
+    Resp.RingSlot = *Client.ringSlot();
+    try
+    {
+      Client.getControlSocket().writeWithFiles(
+        encodeWithSize(Resp, Client.wireFormat()),
+        {S->getRing()->file(), Client.ringWakeup()});
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(warn) << "Client \"" << Client.id()
+                << "\": failed to pass shared ring: " << Err.what();
+      Server.detachSharedRing(Client, *S);
+      Resp.SharedRing = false;
+    }
+  }
+  if (!Resp.SharedRing)
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+  Server.activateSharedRing(Client);
+
+  // If the mode changed, every attached client is notified, otherwise only the
+  // new one needs to learn it.
+  std::optional<Pty::InputMode> Mode = S->getInputMode();
+  Server.checkInputMode(*S);
+  if (Mode == S->getInputMode())
+    Server.sendInputMode(Client, *S);
 }
 
 HANDLER(requestDetach)
@@ -247,7 +385,10 @@ HANDLER(requestDetach)
         ClientsToDetach.emplace_back(C);
       break;
     case Detach::All:
-      ClientsToDetach = S->getAttachedClients();
+      // (The clients only watching the session keep watching it.)
+      for (ClientData* C : S->getAttachedClients())
+        if (C->getAttachedSession() == S)
+          ClientsToDetach.emplace_back(C);
       break;
   }
 
@@ -257,7 +398,43 @@ HANDLER(requestDetach)
     Server.clientDetachedCallback(*C, *S);
   }
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+}
+
+HANDLER(requestWatch)
+{
+  MSG(request::Watch);
+  response::Watch Resp;
+  Resp.Success = false;
+
+  SessionData* S = Server.getSession(Msg->Name);
+  if (!S || !Client.getDataSocket() || Client.getAttachedSession())
+  {
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+    return;
+  }
+  Resp.Session.Name = S->name();
+  Resp.Session.Created = std::chrono::system_clock::to_time_t(S->whenCreated());
+
+  if (std::optional<std::uint32_t> Tag = Client.watchTag(*S))
+  {
+    Resp.Success = true;
+    Resp.Tag = *Tag;
+    if (Msg->Stop)
+      Server.clientUnwatchCallback(Client, *S);
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+    return;
+  }
+  if (Msg->Stop || !Server.clientWatchCallback(Client, *S))
+  {
+    sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
+    return;
+  }
+
+  Resp.Success = true;
+  Resp.Tag = *Client.watchTag(*S);
+  Resp.Replayed = Server.replayScrollback(Client, *S);
+  sendMessage(Client.getControlSocket(), Resp, Client.wireFormat());
 }
 
 HANDLER(signalSession)
@@ -267,26 +444,35 @@ HANDLER(signalSession)
   SessionData* S = Client.getAttachedSession();
   if (!S || !S->hasProcess())
     return;
+  // Viewers may only tell the session that their window changed.
+  if (Client.readOnly() && Msg->SigNum != SIGWINCH)
+    return;
   S->getProcess().signal(Msg->SigNum);
 }
 
 HANDLER(redrawNotified)
 {
-  (void)Server;
   MSG(notification::Redraw);
-
-  SessionData* S = Client.getAttachedSession();
-  if (!S)
-    return;
-  if (S->hasProcess() && S->getProcess().hasPty())
-    S->getProcess().getPty()->setSize(Msg->Rows, Msg->Columns);
+  Server.clientResized(Client, WindowSize{Msg->Rows, Msg->Columns});
 }
 
 HANDLER(statisticsRequest)
 {
   MSG(request::Statistics);
-  sendMessage(Client.getControlSocket(),
-              response::Statistics{Server.statistics()});
+  Server.requestStatistics(Client);
+}
+
+HANDLER(metricsRequest)
+{
+  MSG(request::Metrics);
+  sendMessage(
+    Client.getControlSocket(), Server.metrics(), Client.wireFormat());
+}
+
+HANDLER(usageRequest)
+{
+  MSG(request::Usage);
+  sendMessage(Client.getControlSocket(), Server.usage(), Client.wireFormat());
 }
 
 #undef HANDLER
@@ -0,0 +1,432 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "monomux/control/MessageCodec.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/MuxedSocket.hpp"
+#include "monomux/system/Pty.hpp"
+
+#include "monomux/server/HandOver.hpp"
+#include "monomux/server/Server.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("server/HandOver")
+
+namespace monomux::server
+{
+
+std::string HandOverState::encode() const
+{
+  return message::binary::encode(*this);
+}
+
+std::optional<HandOverState> HandOverState::decode(std::string_view Data)
+{
+  return message::binary::decode<HandOverState>(Data);
+}
+
+fd HandOverState::writeToFile() const
+{
+  // (The file must survive the exec(), so it is not created with CLOEXEC.)
+  fd File = CheckedPOSIXThrow(
+    [] { return ::memfd_create("monomux-handover", 0); },
+    "memfd_create()",
+    -1);
+
+  const std::string Data = encode();
+  std::string_view Rest = Data;
+  while (!Rest.empty())
+  {
+    auto Written = CheckedPOSIX(
+      [&File, Rest] { return ::write(File, Rest.data(), Rest.size()); }, -1);
+    if (!Written)
+    {
+      if (Written.getError() == std::errc::interrupted /* EINTR */)
+        continue;
+      throw std::system_error{Written.getError(), "write(handover)"};
+    }
+    Rest.remove_prefix(static_cast<std::size_t>(Written.get()));
+  }
+
+  CheckedPOSIXThrow([&File] { return ::lseek(File, 0, SEEK_SET); },
+                    "lseek(handover)",
+                    -1);
+  return File;
+}
+
+std::optional<HandOverState> HandOverState::readFromFile(raw_fd File)
+{
+  static constexpr std::size_t ChunkSize = 1 << 16;
+  std::string Data;
+  while (true)
+  {
+    const std::size_t Have = Data.size();
+    Data.resize(Have + ChunkSize);
+    auto Read = CheckedPOSIX(
+      [File, &Data, Have] {
+        return ::read(File, Data.data() + Have, ChunkSize);
+      },
+      -1);
+    if (!Read)
+    {
+      if (Read.getError() == std::errc::interrupted /* EINTR */)
+      {
+        Data.resize(Have);
+        continue;
+      }
+      throw std::system_error{Read.getError(), "read(handover)"};
+    }
+    Data.resize(Have + static_cast<std::size_t>(Read.get()));
+    if (!Read.get())
+      break;
+  }
+  return decode(Data);
+}
+
+/// The time the multiplexed connections are given to send what is buffered in
+/// them, and to finish the frames in flight, before the upgrade. Connections
+/// that are still busy after this are not handed over.
+static constexpr std::chrono::milliseconds MuxedFlushDeadline{500};
+
+/// \returns whether the multiplexed connection of \p Client is at a frame
+/// boundary with nothing left to send, so the new instance of the program can
+/// continue it.
+static bool muxedQuiescent(ClientData& Client)
+{
+  auto& Control = static_cast<MuxedSocket&>(Client.getControlSocket());
+  return !Control.connectionHasBufferedWrite() && !Control.midFrame();
+}
+
+/// Sends what is buffered for the multiplexed clients, and receives the rest
+/// of the frames already started, until every connection is quiescent, or
+/// the \p MuxedFlushDeadline passes.
+static void
+flushMultiplexed(std::map<std::size_t, std::unique_ptr<ClientData>>& Clients)
+{
+  const auto Deadline = std::chrono::steady_clock::now() + MuxedFlushDeadline;
+  while (true)
+  {
+    bool Busy = false;
+    for (auto& [ID, C] : Clients)
+    {
+      if (!C->multiplexed() || muxedQuiescent(*C))
+        continue;
+
+      auto& Control = static_cast<MuxedSocket&>(C->getControlSocket());
+      try
+      {
+        Control.flushConnection();
+        if (Control.midFrame() && !Control.connectionHasBufferedWrite())
+          // (What is received is kept in the buffers of the streams, which
+          // are handed over.)
+          Control.load(Control.optimalReadSize());
+      }
+      catch (const std::system_error&)
+      {}
+      Busy = Busy || (!Control.failed() && !muxedQuiescent(*C));
+    }
+
+    if (!Busy || std::chrono::steady_clock::now() >= Deadline)
+      return;
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+}
+
+/// \returns the files in \p State which the new instance of the program must
+/// inherit.
+static std::vector<raw_fd> inheritedFiles(const HandOverState& State)
+{
+  std::vector<raw_fd> Files;
+  Files.push_back(State.SocketFD);
+  if (State.MetricsSocketFD != fd::Invalid)
+    Files.push_back(State.MetricsSocketFD);
+  for (const HandedOverSession& S : State.Sessions)
+    Files.push_back(S.PtyFD);
+  for (const HandedOverClient& C : State.Clients)
+  {
+    Files.push_back(C.ControlFD);
+    if (C.DataFD != fd::Invalid)
+      Files.push_back(C.DataFD);
+  }
+  return Files;
+}
+
+void Server::upgrade()
+{
+  if (!UpgradeHandler)
+  {
+    LOG(warn) << "Upgrade requested, but it is not supported";
+    return;
+  }
+
+  LOG(info) << "Upgrading the server in place...";
+  auto Locks = lockReactors();
+  finishStatistics();
+  flushMultiplexed(Clients);
+
+  HandOverState State = handOver();
+  fd File;
+  try
+  {
+    File = State.writeToFile();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Failed to save the state to hand over: " << Err.what();
+    return;
+  }
+
+  const std::vector<raw_fd> Inherited = inheritedFiles(State);
+  for (raw_fd FD : Inherited)
+    fd::removeDescriptorFlag(FD, FD_CLOEXEC);
+
+  LOG(info) << "Handing over " << State.Sessions.size() << " sessions and "
+            << State.Clients.size() << " clients...";
+  // The writer of the recordings does not survive the exec().
+  if (Recordings)
+    Recordings->flush();
+  // Neither do the records of the event loops kept in memory.
+  if (Trace)
+    Trace->flush();
+  for (std::unique_ptr<Reactor>& R : Reactors)
+    if (R->Trace)
+      R->Trace->flush();
+  // The new instance restricts itself again, if it is asked to.
+  if (InheritedCPUs)
+    pinThread(*InheritedCPUs, "coordinator");
+  UpgradeHandler(File.get());
+
+  LOG(error) << "Upgrade failed, continuing with the current instance";
+  if (ServerCPUs)
+    pinThread(*ServerCPUs, "coordinator");
+  for (raw_fd FD : Inherited)
+    fd::addDescriptorFlag(FD, FD_CLOEXEC);
+}
+
+HandOverState Server::handOver()
+{
+  HandOverState State;
+  State.SocketPath = Sock.identifier();
+  State.SocketFD = Sock.raw();
+  State.MetricsSocketFD = fd::Invalid;
+  if (MetricsSock)
+  {
+    State.MetricsSocketPath = MetricsSock->identifier();
+    State.MetricsSocketFD = MetricsSock->raw();
+  }
+  State.SessionPoolSpawned = SessionPoolSpawned;
+  State.SessionGeneration = SessionGeneration;
+
+  for (auto& [Name, S] : Sessions)
+  {
+    if (!S->hasProcess() || !S->getProcess().hasPty())
+      continue;
+
+    HandedOverSession HS;
+    HS.Name = S->name();
+    HS.Alias = S->alias();
+    HS.Created = std::chrono::system_clock::to_time_t(S->whenCreated());
+    HS.PID = S->getProcess().raw();
+    HS.PtyFD = S->getIdentifyingFD();
+    HS.PtyName = S->getProcess().getPty()->name();
+    Pipe& Reader = *S->getReader();
+    if (Reader.readsQueued())
+      // The data already read by the event queue is handed over, too.
+      while (Reader.tryLoad(Reader.optimalReadSize()).Bytes)
+        ;
+    HS.Output = S->getPendingOutput() + Reader.bufferedRead();
+    HS.Input = S->getWriter()->bufferedWrite();
+    HS.Recent = recentOutput(*S);
+    State.Sessions.push_back(std::move(HS));
+  }
+
+  for (auto& [ID, C] : Clients)
+  {
+    if (C->multiplexed() && !muxedQuiescent(*C))
+    {
+      LOG(warn) << "Client \"" << C->id()
+                << "\": connection busy, can not be handed over";
+      continue;
+    }
+    if (C->ringSlot())
+    {
+      // The ring of the session does not survive the upgrade.
+      LOG(warn) << "Client \"" << C->id()
+                << "\": reads a shared ring, can not be handed over";
+      continue;
+    }
+    if (C->watching())
+    {
+      // The tags of the watched sessions are not carried over.
+      LOG(warn) << "Client \"" << C->id()
+                << "\": watches sessions, can not be handed over";
+      continue;
+    }
+
+    Socket& Control = C->getControlSocket();
+    Socket* Data = C->getDataSocket();
+    HandedOverClient HC;
+    HC.Identifier = Control.identifier();
+    HC.ControlFD = Control.raw();
+    HC.DataFD = Data && !C->multiplexed() ? Data->raw() : fd::Invalid;
+    HC.BinaryWire = C->wireFormat() == message::WireFormat::Binary;
+    HC.Multiplexed = C->multiplexed();
+    HC.Compressed = C->compressed();
+    HC.ReadOnly = C->readOnly();
+    HC.SessionSubscriber = C->sessionSubscriber();
+    HC.HasSize = C->windowSize().has_value();
+    HC.Rows = HC.HasSize ? C->windowSize()->Rows : 0;
+    HC.Columns = HC.HasSize ? C->windowSize()->Columns : 0;
+    if (const SessionData* S = C->getAttachedSession())
+      HC.Session = S->name();
+    HC.ControlInput =
+      std::string{C->getControlReader().partial()} + Control.bufferedRead();
+    HC.ControlOutput = Control.bufferedWrite();
+    if (Data)
+    {
+      HC.DataOutput = Data->bufferedWrite();
+      HC.DataInput = Data->bufferedRead();
+    }
+    State.Clients.push_back(std::move(HC));
+  }
+
+  return State;
+}
+
+/// Writes \p Data that was buffered by the previous instance of the program
+/// to \p C, and schedules flushing what is not sent immediately in \p Poll.
+static void
+writeHandedOver(EPoll& Poll, BufferedChannel& C, std::string_view Data)
+{
+  if (Data.empty())
+    return;
+  try
+  {
+    C.write(Data);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << C.identifier() << ": failed to write data handed over: "
+               << Err.what();
+    return;
+  }
+  if (C.hasBufferedWrite())
+    Poll.schedule(C.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+void Server::restore(HandOverState& State)
+{
+  auto Locks = lockReactors();
+  LOG(info) << "Taking over " << State.Sessions.size() << " sessions and "
+            << State.Clients.size() << " clients...";
+  SessionPoolSpawned = State.SessionPoolSpawned;
+
+  // The output pending in the previous instance is sent once the clients are
+  // attached again.
+  std::vector<std::pair<SessionData*, std::string>> PendingOutput;
+  for (HandedOverSession& HS : State.Sessions)
+  {
+    SessionData S{std::move(HS.Name)};
+    S.setAlias(std::move(HS.Alias));
+    S.setCreated(std::chrono::system_clock::from_time_t(HS.Created));
+    S.setProcess(Process::adopt(
+      HS.PID, Pty::adopt(fd{HS.PtyFD}, std::move(HS.PtyName))));
+    SessionData* Session = makeSession(std::move(S));
+    if (!Session)
+      continue;
+    createCallback(*Session);
+    recordOutput(*Session, HS.Recent);
+
+    EPoll& SessionPoll = pollOf(reactorOf(*Session));
+    writeHandedOver(SessionPoll, *Session->getWriter(), HS.Input);
+    // Output might have arrived while the previous instance was exiting, for
+    // which no new event is reported in edge-triggered mode.
+    SessionPoll.schedule(Session->getIdentifyingFD(),
+                         /* Incoming =*/true,
+                         /* Outgoing =*/false);
+    PendingOutput.emplace_back(Session, std::move(HS.Output));
+  }
+
+  std::vector<ClientData*> Subscribers;
+  for (HandedOverClient& HC : State.Clients)
+  {
+    fd ControlFD{HC.ControlFD};
+    fd::addDescriptorFlag(ControlFD, FD_CLOEXEC);
+    ClientData* Client = makeClient(ClientData{std::make_unique<Socket>(
+      Socket::wrap(std::move(ControlFD), HC.Identifier, Sock.transport()))});
+    if (!Client)
+      continue;
+
+    Client->setWireFormat(HC.BinaryWire ? message::WireFormat::Binary
+                                        : message::WireFormat::Text);
+    Client->setCompressed(HC.Compressed);
+    if (HC.HasSize)
+      Client->setWindowSize(WindowSize{HC.Rows, HC.Columns});
+    Client->getControlReader().assign(std::move(HC.ControlInput));
+    listenOnControlSocket(*Client);
+    if (HC.SessionSubscriber)
+      Subscribers.push_back(Client);
+
+    if (HC.Multiplexed)
+      Client->multiplex();
+    else if (HC.DataFD != fd::Invalid)
+      attachDataSocket(*Client, fd{HC.DataFD});
+
+    writeHandedOver(*Poll, Client->getControlSocket(), HC.ControlOutput);
+    Poll->schedule(Client->getControlSocket().raw(),
+                   /* Incoming =*/true,
+                   /* Outgoing =*/false);
+
+    SessionData* Session =
+      HC.Session.empty() ? nullptr : getSession(HC.Session);
+    if (!Session)
+      continue;
+    Client->setReadOnly(HC.ReadOnly);
+    clientAttachedCallback(*Client, *Session);
+
+    Socket& DS = *Client->getDataSocket();
+    EPoll& DataPoll = pollOf(reactorOf(*Client));
+    writeHandedOver(DataPoll, DS, HC.DataOutput);
+    if (!HC.ReadOnly)
+      writeHandedOver(DataPoll, *Session->getWriter(), HC.DataInput);
+    if (!HC.Multiplexed)
+      DataPoll.schedule(DS.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  }
+
+  for (const auto& [Session, Output] : PendingOutput)
+    sendSessionOutput(*Session, Output);
+
+  // Restoring the sessions and the attachments is not a change the
+  // subscribers should hear about, so they are only subscribed again now.
+  SessionGeneration = State.SessionGeneration;
+  for (ClientData* Client : Subscribers)
+    setSessionSubscriber(*Client, true);
+
+  // The sessions left behind by the previous instance (e.g. those started in
+  // advance) exited, without the signal reaching the current one.
+  ChildrenDied.store(true);
+}
+
+} // namespace monomux::server
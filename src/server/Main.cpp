@@ -16,13 +16,21 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cerrno>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/server/Server.hpp"
+#include "monomux/system/BufferedChannel.hpp"
 #include "monomux/system/Environment.hpp"
 #include "monomux/system/Process.hpp"
 #include "monomux/system/Signal.hpp"
+#include "monomux/system/fd.hpp"
 #include "monomux/unreachable.hpp"
 
 #include "ExitCode.hpp"
@@ -35,7 +43,11 @@ namespace monomux::server
 {
 
 Options::Options()
-  : ServerMode(false), Background(true), ExitOnLastSessionTerminate(true)
+  : ServerMode(false), Background(true), ExitOnLastSessionTerminate(true),
+    SpliceRelay(false), EdgeTriggered(false), IOUring(false),
+    ScreenSnapshot(false), ResizeToSmallest(false), ReactorCount(0),
+    ListenBacklog(0), HibernateAfter(0), Scrollback(0), SessionLog(0),
+    SharedRing(0), SessionPool(0)
 {}
 
 std::vector<std::string> Options::toArgv() const
@@ -53,6 +65,128 @@ std::vector<std::string> Options::toArgv() const
     Ret.emplace_back("--no-daemon");
   if (!ExitOnLastSessionTerminate)
     Ret.emplace_back("--keepalive");
+  if (SpliceRelay)
+    Ret.emplace_back("--splice-relay");
+  if (EdgeTriggered)
+    Ret.emplace_back("--edge-triggered");
+  if (IOUring)
+    Ret.emplace_back("--io-uring");
+  if (ReactorCount)
+  {
+    Ret.emplace_back("--reactors");
+    Ret.emplace_back(std::to_string(ReactorCount));
+  }
+  if (ListenBacklog)
+  {
+    Ret.emplace_back("--listen-backlog");
+    Ret.emplace_back(std::to_string(ListenBacklog));
+  }
+  if (ServerCPUs)
+  {
+    Ret.emplace_back("--server-cpus");
+    Ret.emplace_back(ServerCPUs->toString());
+  }
+  if (SessionCPUs)
+  {
+    Ret.emplace_back("--session-cpus");
+    Ret.emplace_back(SessionCPUs->toString());
+  }
+  if (OutputCoalescing.enabled())
+  {
+    Ret.emplace_back("--coalesce-delay");
+    Ret.emplace_back(std::to_string(OutputCoalescing.MaxDelay.count()));
+    Ret.emplace_back("--coalesce-bytes");
+    Ret.emplace_back(std::to_string(OutputCoalescing.MaxBytes));
+  }
+  if (OutputThrottle.enabled())
+  {
+    Ret.emplace_back("--output-rate-limit");
+    Ret.emplace_back(std::to_string(OutputThrottle.Rate));
+    if (OutputThrottle.Burst)
+    {
+      Ret.emplace_back("--output-burst");
+      Ret.emplace_back(std::to_string(OutputThrottle.Burst));
+    }
+  }
+  if (ClientBufferLimit)
+  {
+    Ret.emplace_back("--client-buffer-limit");
+    Ret.emplace_back(std::to_string(*ClientBufferLimit));
+  }
+  if (BufferSizeMax)
+  {
+    Ret.emplace_back("--buffer-size-max");
+    Ret.emplace_back(std::to_string(*BufferSizeMax));
+  }
+  if (BufferBudget)
+  {
+    Ret.emplace_back("--buffer-budget");
+    Ret.emplace_back(std::to_string(*BufferBudget));
+  }
+  if (Scrollback)
+  {
+    Ret.emplace_back("--scrollback");
+    Ret.emplace_back(std::to_string(Scrollback));
+  }
+  if (SessionLog)
+  {
+    Ret.emplace_back("--session-log");
+    Ret.emplace_back(std::to_string(SessionLog));
+  }
+  if (RecordDirectory)
+  {
+    Ret.emplace_back("--record-dir");
+    Ret.emplace_back(*RecordDirectory);
+  }
+  if (RecordPattern)
+  {
+    Ret.emplace_back("--record-sessions");
+    Ret.emplace_back(*RecordPattern);
+  }
+  if (EventTrace)
+  {
+    Ret.emplace_back("--event-trace");
+    Ret.emplace_back(*EventTrace);
+  }
+  if (SharedRing)
+  {
+    Ret.emplace_back("--shared-ring");
+    Ret.emplace_back(std::to_string(SharedRing));
+  }
+  if (ScreenSnapshot)
+    Ret.emplace_back("--screen-snapshot");
+  if (ResizeToSmallest)
+    Ret.emplace_back("--resize-smallest");
+  if (SessionPool)
+  {
+    Ret.emplace_back("--session-pool");
+    Ret.emplace_back(std::to_string(SessionPool));
+  }
+  if (HibernateAfter.count())
+  {
+    Ret.emplace_back("--hibernate-after");
+    Ret.emplace_back(std::to_string(HibernateAfter.count()));
+  }
+  if (ShutdownTimeout)
+  {
+    Ret.emplace_back("--shutdown-timeout");
+    Ret.emplace_back(std::to_string(ShutdownTimeout->count()));
+  }
+  if (MetricsSocketPath.has_value())
+  {
+    Ret.emplace_back("--metrics-socket");
+    Ret.emplace_back(*MetricsSocketPath);
+  }
+  if (ReadyFD)
+  {
+    Ret.emplace_back("--ready-fd");
+    Ret.emplace_back(std::to_string(*ReadyFD));
+  }
+  if (RestoreFD)
+  {
+    Ret.emplace_back("--restore-fd");
+    Ret.emplace_back(std::to_string(*RestoreFD));
+  }
 
   return Ret;
 }
@@ -77,6 +211,9 @@ constexpr char ServerObjName[] = "Server";
 void serverShutdown(SignalHandling::Signal SigNum,
                     ::siginfo_t* Info,
                     const SignalHandling* Handling);
+void serverUpgrade(SignalHandling::Signal SigNum,
+                   ::siginfo_t* Info,
+                   const SignalHandling* Handling);
 void childExited(SignalHandling::Signal SigNum,
                  ::siginfo_t* Info,
                  const SignalHandling* Handling);
@@ -86,12 +223,74 @@ void coreDumped(SignalHandling::Signal SigNum,
 
 } // namespace
 
+/// Replaces the current program with a new instance of the server, started
+/// with \p Opts, which takes over from the state in \p StateFile.
+///
+/// \note Returns only if the \p exec() failed.
+static void upgrade(const Options& Opts, raw_fd StateFile)
+{
+  Options NewOpts = Opts;
+  NewOpts.RestoreFD = StateFile;
+  NewOpts.ReadyFD.reset();
+
+  // The binary of the program might had been replaced on the disk, which is
+  // exactly the reason of the upgrade.
+  static constexpr std::string_view Deleted = " (deleted)";
+  std::string Program = Process::thisProcessPath();
+  if (Program.size() > Deleted.size() &&
+      Program.compare(
+        Program.size() - Deleted.size(), Deleted.size(), Deleted) == 0)
+    Program.resize(Program.size() - Deleted.size());
+
+  std::vector<std::string> Args = NewOpts.toArgv();
+  std::vector<char*> ArgV;
+  ArgV.reserve(Args.size() + 2);
+  ArgV.push_back(Program.data());
+  for (std::string& Arg : Args)
+    ArgV.push_back(Arg.data());
+  ArgV.push_back(nullptr);
+
+  LOG(info) << "Upgrading to '" << Program << '\'';
+  // The messages still queued would be lost in the exec().
+  log::Logger::get().setAsynchronous(false);
+  ::execv(Program.c_str(), ArgV.data());
+  LOG(error) << "exec() of '" << Program << "' failed: "
+             << std::make_error_code(static_cast<std::errc>(errno)).message();
+  log::Logger::get().setAsynchronous(true);
+}
+
 int main(Options& Opts)
 {
+  std::optional<HandOverState> HandedOver;
+  if (Opts.RestoreFD)
+  {
+    fd StateFile{*Opts.RestoreFD};
+    Opts.RestoreFD.reset();
+    try
+    {
+      HandedOver = HandOverState::readFromFile(StateFile);
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(fatal) << "Reading the state handed over failed:\n\t" << SE.what();
+      return EXIT_SystemError;
+    }
+    if (!HandedOver)
+    {
+      LOG(fatal) << "The state handed over is invalid";
+      return EXIT_SystemError;
+    }
+  }
+  const bool Restoring = HandedOver.has_value();
+
   std::optional<Socket> ServerSock;
   try
   {
-    ServerSock.emplace(Socket::create(*Opts.SocketPath));
+    if (HandedOver)
+      ServerSock.emplace(
+        Socket::adopt(fd{HandedOver->SocketFD}, HandedOver->SocketPath));
+    else
+      ServerSock.emplace(Socket::create(*Opts.SocketPath));
   }
   catch (const std::system_error& SE)
   {
@@ -103,8 +302,80 @@ int main(Options& Opts)
     return EXIT_SystemError;
   }
 
+  std::optional<Socket> MetricsSock;
+  if (HandedOver && HandedOver->MetricsSocketFD != fd::Invalid)
+    MetricsSock.emplace(Socket::adopt(fd{HandedOver->MetricsSocketFD},
+                                      HandedOver->MetricsSocketPath));
+  else if (Opts.MetricsSocketPath)
+    try
+    {
+      MetricsSock.emplace(Socket::create(*Opts.MetricsSocketPath));
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(fatal) << "Creating the metrics socket '" << *Opts.MetricsSocketPath
+                 << "' failed:\n\t" << SE.what();
+      return EXIT_SystemError;
+    }
+
   Server S = Server(std::move(*ServerSock));
   S.setExitIfNoMoreSessions(Opts.ExitOnLastSessionTerminate);
+  S.setSpliceRelay(Opts.SpliceRelay);
+  S.setEdgeTriggered(Opts.EdgeTriggered);
+  S.setIOUring(Opts.IOUring);
+  S.setReactorCount(Opts.ReactorCount);
+  S.setServerAffinity(Opts.ServerCPUs);
+  S.setSessionAffinity(Opts.SessionCPUs);
+  S.setListenBacklog(Opts.ListenBacklog);
+  S.setOutputCoalescing(Opts.OutputCoalescing);
+  S.setOutputThrottle(Opts.OutputThrottle);
+  if (Opts.ClientBufferLimit)
+    S.setClientBufferLimit(*Opts.ClientBufferLimit);
+  if (Opts.BufferSizeMax)
+    BufferedChannel::setBufferSizeMax(*Opts.BufferSizeMax);
+  if (Opts.BufferBudget)
+    BufferedChannel::setGlobalBudget(*Opts.BufferBudget);
+  S.setScrollback(Opts.Scrollback);
+  S.setSessionLog(Opts.SessionLog);
+  if (Opts.RecordDirectory)
+    S.setRecording(*Opts.RecordDirectory, Opts.RecordPattern.value_or("*"));
+  if (Opts.EventTrace)
+    S.setEventTrace(*Opts.EventTrace);
+  S.setSharedRing(Opts.SharedRing);
+  S.setScreenSnapshot(Opts.ScreenSnapshot);
+  S.setResizePolicy(Opts.ResizeToSmallest ? Server::ResizePolicy::Smallest
+                                          : Server::ResizePolicy::Latest);
+  S.setSessionPool(Opts.SessionPool);
+  S.setHibernation(Opts.HibernateAfter);
+  if (Opts.ShutdownTimeout)
+    S.setShutdownTimeout(*Opts.ShutdownTimeout);
+  if (MetricsSock)
+    S.setMetricsSocket(std::move(*MetricsSock));
+  if (HandedOver)
+    S.setHandedOverState(std::move(*HandedOver));
+  S.setUpgradeHandler(
+    [&Opts](raw_fd StateFile) { upgrade(Opts, StateFile); });
+
+  // Accept connections as early as possible, so a client that started the
+  // server may connect while the rest of the set-up happens.
+  try
+  {
+    S.listen();
+  }
+  catch (const std::system_error& SE)
+  {
+    LOG(fatal) << "Listening on the socket failed:\n\t" << SE.what();
+    return EXIT_SystemError;
+  }
+  if (Opts.ReadyFD)
+  {
+    fd Ready{*Opts.ReadyFD};
+    Opts.ReadyFD.reset();
+    static constexpr char Byte = 1;
+    if (::write(Ready, &Byte, 1) != 1)
+      LOG(warn) << "Notifying about the readiness of the server failed";
+  }
+
   ScopeGuard Signal{[&S] {
                       SignalHandling& Sig = SignalHandling::get();
                       Sig.registerObject(SignalHandling::ModuleObjName,
@@ -113,9 +384,20 @@ int main(Options& Opts)
                       Sig.registerCallback(SIGHUP, &serverShutdown);
                       Sig.registerCallback(SIGINT, &serverShutdown);
                       Sig.registerCallback(SIGTERM, &serverShutdown);
+                      Sig.registerCallback(SIGUSR2, &serverUpgrade);
                       Sig.registerCallback(SIGCHLD, &childExited);
+                      // These arrive as events of the loop, instead of
+                      // interrupting it.
+                      Sig.deliverThroughFile(SIGHUP);
+                      Sig.deliverThroughFile(SIGINT);
+                      Sig.deliverThroughFile(SIGTERM);
+                      Sig.deliverThroughFile(SIGUSR2);
+                      Sig.deliverThroughFile(SIGCHLD);
                       Sig.ignore(SIGPIPE);
                       Sig.enable();
+                      S.setSignalFile(Sig.signalFile(), [] {
+                        SignalHandling::get().dispatchFile();
+                      });
 
                       // Override the SIGABRT handler with a custom one that
                       // kills the server.
@@ -129,6 +411,7 @@ int main(Options& Opts)
                       SignalHandling& Sig = SignalHandling::get();
                       Sig.unignore(SIGPIPE);
                       Sig.defaultCallback(SIGCHLD);
+                      Sig.defaultCallback(SIGUSR2);
                       Sig.defaultCallback(SIGTERM);
                       Sig.defaultCallback(SIGINT);
                       Sig.defaultCallback(SIGHUP);
@@ -142,10 +425,15 @@ int main(Options& Opts)
                     }};
 
   LOG(info) << "Starting Monomux Server";
-  if (Opts.Background)
+  // (The instance taking over is already in the background.)
+  if (Opts.Background && !Restoring)
     CheckedPOSIXThrow(
       [] { return ::daemon(0, 0); }, "Backgrounding ourselves failed", -1);
 
+  // The server's own messages should not block the event loop on a slow
+  // output device.
+  ScopeGuard AsyncLog{[] { log::Logger::get().setAsynchronous(true); },
+                      [] { log::Logger::get().setAsynchronous(false); }};
   ScopeGuard Server{[&S] { S.loop(); }, [&S] { S.shutdown(); }};
   LOG(info) << "Monomux Server stopped";
   return EXIT_Success;
@@ -166,6 +454,18 @@ void serverShutdown(SignalHandling::Signal /* SigNum */,
   (*Srv)->interrupt();
 }
 
+/// Handler for request to upgrade the server in place.
+void serverUpgrade(SignalHandling::Signal /* SigNum */,
+                   ::siginfo_t* /* Info */,
+                   const SignalHandling* Handling)
+{
+  const volatile auto* Srv =
+    std::any_cast<Server*>(Handling->getObject(ServerObjName));
+  if (!Srv)
+    return;
+  (*Srv)->requestUpgrade();
+}
+
 /// Handler for \p SIGCHLD when a process spawned by the server quits.
 void childExited(SignalHandling::Signal /* SigNum */,
                  ::siginfo_t* Info,
@@ -0,0 +1,183 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+#include "monomux/server/OpenMetrics.hpp"
+
+namespace monomux::server
+{
+
+namespace
+{
+
+using message::MetricTable;
+
+/// Writes \p Value as the value of a label, escaped as required.
+void writeLabelValue(std::ostringstream& OS, std::string_view Value)
+{
+  for (char C : Value)
+    switch (C)
+    {
+      case '\\':
+        OS << "\\\\";
+        break;
+      case '"':
+        OS << "\\\"";
+        break;
+      case '\n':
+        OS << "\\n";
+        break;
+      default:
+        OS << C;
+        break;
+    }
+}
+
+/// The role of a column of a histogram in a \p MetricTable.
+struct HistogramColumn
+{
+  std::string_view Family;
+  /// The suffix of the sample in the exposition, e.g. \p _bucket.
+  std::string_view Suffix;
+  /// The upper bound of the bucket, if the column is a bucket.
+  std::string_view Bound;
+};
+
+std::optional<HistogramColumn> parseHistogramColumn(std::string_view Name)
+{
+  static constexpr std::string_view BucketInfix = "_le_";
+  if (auto Pos = Name.rfind(BucketInfix); Pos != std::string_view::npos)
+  {
+    std::string_view Bound = Name.substr(Pos + BucketInfix.size());
+    return HistogramColumn{
+      Name.substr(0, Pos), "_bucket", Bound == "inf" ? "+Inf" : Bound};
+  }
+  for (std::string_view Suffix : {"_sum", "_count"})
+    if (Name.size() > Suffix.size() &&
+        Name.substr(Name.size() - Suffix.size()) == Suffix)
+      return HistogramColumn{
+        Name.substr(0, Name.size() - Suffix.size()), Suffix, {}};
+  return std::nullopt;
+}
+
+/// Writes the metrics of \p Table as the families prefixed with \p Prefix.
+/// If \p Label is not empty, the subject of each sample is written as the
+/// value of the label.
+void writeTable(std::ostringstream& OS,
+                std::string_view Prefix,
+                std::string_view Label,
+                const MetricTable& Table)
+{
+  auto KindAt = [&Table](std::size_t N) {
+    return N < Table.Kinds.size() ? Table.Kinds.at(N) : MetricTable::Gauge;
+  };
+  auto WriteType = [&OS, Prefix](std::string_view Family,
+                                 std::string_view Type) {
+    OS << "# TYPE monomux_" << Prefix << '_' << Family << ' ' << Type << '\n';
+  };
+  auto WriteSample = [&OS, Prefix, Label, &Table](std::string_view Family,
+                                                  std::string_view Suffix,
+                                                  std::size_t S,
+                                                  std::string_view Bound,
+                                                  std::uint64_t Value) {
+    OS << "monomux_" << Prefix << '_' << Family << Suffix;
+    if (!Label.empty() || !Bound.empty())
+    {
+      OS << '{';
+      if (!Label.empty())
+      {
+        OS << Label << "=\"";
+        writeLabelValue(OS, Table.Subjects.at(S));
+        OS << '"';
+      }
+      if (!Bound.empty())
+        OS << (Label.empty() ? "" : ",") << "le=\"" << Bound << '"';
+      OS << '}';
+    }
+    OS << ' ' << Value << '\n';
+  };
+
+  for (std::size_t N = 0; N < Table.Names.size();)
+  {
+    const std::string& Name = Table.Names.at(N);
+    const MetricTable::MetricKind Kind = KindAt(N);
+    if (Kind != MetricTable::Histogram)
+    {
+      const bool IsCounter = Kind == MetricTable::Counter;
+      WriteType(Name, IsCounter ? "counter" : "gauge");
+      for (std::size_t S = 0; S < Table.Subjects.size(); ++S)
+        WriteSample(Name, IsCounter ? "_total" : "", S, {}, Table.at(S, N));
+      ++N;
+      continue;
+    }
+
+    // The columns of a histogram are adjacent, with the buckets in order.
+    std::optional<HistogramColumn> First = parseHistogramColumn(Name);
+    std::size_t End = N;
+    while (End < Table.Names.size() && KindAt(End) == MetricTable::Histogram)
+    {
+      std::optional<HistogramColumn> Column =
+        parseHistogramColumn(Table.Names.at(End));
+      if (!First || !Column || Column->Family != First->Family)
+        break;
+      ++End;
+    }
+    if (End == N)
+    {
+      // Not a column of a histogram that could be understood.
+      ++N;
+      continue;
+    }
+
+    WriteType(First->Family, "histogram");
+    for (std::size_t S = 0; S < Table.Subjects.size(); ++S)
+    {
+      std::uint64_t Cumulative = 0;
+      for (std::size_t I = N; I < End; ++I)
+      {
+        HistogramColumn Column = *parseHistogramColumn(Table.Names.at(I));
+        if (Column.Bound.empty())
+        {
+          WriteSample(Column.Family, Column.Suffix, S, {}, Table.at(S, I));
+          continue;
+        }
+        Cumulative += Table.at(S, I);
+        WriteSample(Column.Family, Column.Suffix, S, Column.Bound, Cumulative);
+      }
+    }
+    N = End;
+  }
+}
+
+} // namespace
+
+std::string formatOpenMetrics(const message::response::Metrics& Metrics)
+{
+  std::ostringstream OS;
+  writeTable(OS, "server", {}, Metrics.Server);
+  writeTable(OS, "client", "client", Metrics.Clients);
+  writeTable(OS, "session", "session", Metrics.Sessions);
+  OS << "# EOF\n";
+  return OS.str();
+}
+
+} // namespace monomux::server
@@ -16,16 +16,34 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <iomanip>
-#include <set>
 #include <thread>
 
+#ifdef __GLIBC__
+#include <fnmatch.h>
+#include <malloc.h>
+#endif /* __GLIBC__ */
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "monomux/Trace.hpp"
+#include "monomux/adt/BufferPool.hpp"
 #include "monomux/adt/POD.hpp"
+#include "monomux/adt/SharedChunk.hpp"
 #include "monomux/control/PascalString.hpp"
+#include "monomux/control/SessionFrame.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/IOUring.hpp"
+#include "monomux/system/Environment.hpp"
+#include "monomux/system/MuxedSocket.hpp"
 #include "monomux/system/Time.hpp"
 
+#include "monomux/server/OpenMetrics.hpp"
 #include "monomux/server/Server.hpp"
 
 #include "monomux/Log.hpp"
@@ -35,18 +53,28 @@ namespace monomux::server
 {
 
 Server::Server(Socket&& Sock)
-  : Sock(std::move(Sock)), ExitIfNoMoreSessions(false)
+  : Sock(std::move(Sock)), ReactorCount(0), ExitIfNoMoreSessions(false),
+    SpliceRelay(false), EdgeTriggered(false), IOUring(false),
+    HibernateAfter(0), ShutdownTimeout(DefaultShutdownTimeout),
+    ClientBufferLimit(DefaultClientBufferLimit),
+    ScrollbackSize(0), SessionLogSize(0), SharedRingSize(0),
+    ScreenSnapshot(false),
+    ListenBacklog(DefaultListenBacklog)
 {
-  setUpDispatch();
-  DeadChildren.fill(Process::Invalid);
+  for (std::atomic<Process::raw_handle>& Slot : DeadChildren)
+    Slot.store(Process::Invalid);
+  ChildrenDied.store(false);
+  UpgradeRequested.get().store(false);
 }
 
-Server::~Server() = default;
+Server::~Server() { stopReactors(); }
 
 void Server::registerMessageHandler(std::uint16_t Kind,
                                     std::function<HandlerFunction> Handler)
 {
-  Dispatch[Kind] = std::move(Handler);
+  if (Kind >= DispatchOverrides.size())
+    DispatchOverrides.resize(Kind + 1);
+  DispatchOverrides[Kind] = std::move(Handler);
 }
 
 void Server::setExitIfNoMoreSessions(bool ExitIfNoMoreSessions)
@@ -54,6 +82,119 @@ void Server::setExitIfNoMoreSessions(bool ExitIfNoMoreSessions)
   this->ExitIfNoMoreSessions = ExitIfNoMoreSessions;
 }
 
+void Server::setEdgeTriggered(bool EdgeTriggered)
+{
+  this->EdgeTriggered = EdgeTriggered;
+}
+
+void Server::setIOUring(bool IOUring) { this->IOUring = IOUring; }
+
+void Server::setReactorCount(std::size_t ReactorCount)
+{
+  this->ReactorCount = ReactorCount;
+}
+
+void Server::setRecording(std::string Directory, std::string Pattern)
+{
+  RecordDirectory = std::move(Directory);
+  RecordPattern = std::move(Pattern);
+}
+
+void Server::setEventTrace(std::string Prefix)
+{
+  EventTracePrefix = std::move(Prefix);
+}
+
+void Server::setServerAffinity(std::optional<CPUSet> CPUs)
+{
+  ServerCPUs = std::move(CPUs);
+  if (ServerCPUs && !InheritedCPUs)
+    InheritedCPUs = CPUSet::ofThisThread();
+}
+
+void Server::setSessionAffinity(std::optional<CPUSet> CPUs)
+{
+  SessionCPUs = std::move(CPUs);
+}
+
+void Server::setSpliceRelay(bool SpliceRelay)
+{
+  this->SpliceRelay.store(SpliceRelay, std::memory_order_relaxed);
+}
+
+void Server::setOutputCoalescing(CoalescingLimits Limits)
+{
+  Coalescing = Limits;
+}
+
+void Server::setOutputThrottle(ThrottleLimits Limits)
+{
+  Throttling = Limits;
+}
+
+void Server::setShutdownTimeout(std::chrono::milliseconds Timeout)
+{
+  ShutdownTimeout = Timeout;
+}
+
+void Server::setHibernation(std::chrono::seconds After)
+{
+  HibernateAfter = After;
+  if (SpillDirectory.empty())
+  {
+    // (The runtime directory of the user is usually in memory.)
+    SpillDirectory = getEnv("TMPDIR");
+    if (SpillDirectory.empty())
+      SpillDirectory = "/tmp";
+  }
+}
+
+void Server::setClientBufferLimit(std::size_t Limit)
+{
+  ClientBufferLimit = Limit;
+}
+
+void Server::setScrollback(std::size_t Bytes)
+{
+  ScrollbackSize = Bytes;
+}
+
+void Server::setSessionLog(std::size_t Bytes)
+{
+  SessionLogSize = Bytes;
+}
+
+void Server::setSharedRing(std::size_t Bytes) { SharedRingSize = Bytes; }
+
+void Server::setScreenSnapshot(bool Enabled) { ScreenSnapshot = Enabled; }
+
+void Server::setResizePolicy(ResizePolicy Policy) { Resizing = Policy; }
+
+void Server::setSessionPool(std::size_t Size) { SessionPoolSize = Size; }
+
+void Server::setListenBacklog(std::size_t Backlog)
+{
+  ListenBacklog = Backlog ? Backlog : DefaultListenBacklog;
+}
+
+void Server::setMetricsSocket(Socket&& Listener)
+{
+  MetricsSock.emplace(std::move(Listener));
+}
+
+void Server::setSignalFile(raw_fd FD, std::function<void()> Dispatch)
+{
+  SignalFile = FD;
+  SignalDispatch = std::move(Dispatch);
+}
+
+/// \returns the readiness of \p Event as reported to the tracing probes:
+/// \p 1 for incoming, \p 2 for outgoing, and \p 3 for both.
+[[maybe_unused]] static unsigned eventMode(const EPoll::EventWithMode& Event)
+{
+  return (Event.Incoming ? 1U : 0U) | (Event.Outgoing ? 2U : 0U);
+}
+
 /// Reschedules the overflown buffer identified by \p BO to the next iteration
 /// of \p Poll.
 static void rescheduleOverflow(EPoll& Poll, const buffer_overflow& BO)
@@ -61,46 +202,227 @@ static void rescheduleOverflow(EPoll& Poll, const buffer_overflow& BO)
   Poll.schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
 }
 
-/// Tries to flush the contents of the socket, and if the flushing fails,
+/// Tries to flush the contents of the channel, and if the flushing fails,
 /// schedules it for the next iteration of \p Poll.
-static void flushAndReschedule(EPoll& Poll, Socket& S)
+static void flushAndReschedule(EPoll& Poll, BufferedChannel& C)
+{
+  if (BufferedChannel::Result R = C.tryFlushWrites(); R.failed())
+  {
+    LOG(debug) << C.identifier() << ": flushing failed: "
+               << R.Error.message();
+    return;
+  }
+  if (C.hasBufferedWrite())
+    Poll.schedule(C.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+/// \returns \p Name with the characters that are not safe in a file name
+/// replaced.
+static std::string sanitiseFileName(std::string Name)
+{
+  for (char& C : Name)
+    if (!std::isalnum(static_cast<unsigned char>(C)) && C != '-' && C != '_')
+      C = '_';
+  return Name;
+}
+
+std::unique_ptr<EPoll> Server::makePoll(std::size_t EventCount) const
+{
+  if (IOUring)
+  {
+#ifdef MONOMUX_IO_URING
+    try
+    {
+      return std::make_unique<monomux::IOUring>(EventCount);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(warn) << "Failed to create io_uring event queue, falling back to "
+                   "epoll: "
+                << Err.what();
+    }
+#else  /* !MONOMUX_IO_URING */
+    LOG(warn) << "io_uring event queue is not supported by this build, "
+                 "falling back to epoll";
+#endif /* MONOMUX_IO_URING */
+  }
+  return std::make_unique<EPoll>(EventCount);
+}
+
+void Server::listen()
 {
-  S.flushWrites();
-  if (S.hasBufferedWrite())
-    Poll.schedule(S.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  Sock.listen(ListenBacklog);
+  if (MetricsSock)
+    MetricsSock->listen(ListenBacklog);
+  Listening = true;
 }
 
 void Server::loop()
 {
-  static constexpr std::size_t ListenQueue = 16;
+  prepareLoop();
+  while (!TerminateLoop.get().load())
+    iterate(EPoll::NoTimeout);
+  stopReactors();
+}
+
+void Server::prepareLoop()
+{
   static constexpr std::size_t EventQueue = 1 << 13;
 
+  if (Poll)
+    return;
   WhenStarted = std::chrono::system_clock::now();
-  Sock.listen(ListenQueue);
+  if (!Listening)
+    listen();
 
   fd::addStatusFlag(Sock.raw(), O_NONBLOCK);
-  Poll = std::make_unique<EPoll>(EventQueue);
+  Poll = makePoll(EventQueue);
+  Trace = startTrace(*Poll, 0);
   Poll->listen(Sock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  if (MetricsSock)
+  {
+    fd::addStatusFlag(MetricsSock->raw(), O_NONBLOCK);
+    Poll->listen(
+      MetricsSock->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  }
+  if (SignalFile != fd::Invalid)
+    Poll->listen(SignalFile, /* Incoming =*/true, /* Outgoing =*/false);
+
+  if (ServerCPUs)
+    pinThread(*ServerCPUs, "coordinator");
+  startReactors(EventQueue);
+  if (HandedOver)
+  {
+    restore(*HandedOver);
+    HandedOver.reset();
+  }
+  Timers.schedule(ReclaimInterval, [this] { reclaimResources(); });
+  if (SessionPoolSize)
+    scheduleSessionPoolRefill(std::chrono::milliseconds{0});
+}
+
+std::size_t Server::iterate(std::chrono::milliseconds Timeout)
+{
+  prepareLoop();
+  if (UpgradeRequested.get().exchange(false))
+    upgrade();
+
+  // Process "external" events.
+  reapDeadChildren();
+  handleDeferredExits();
+  handleDeferredModeChecks();
+
+  std::chrono::milliseconds Wait = Timers.timeout();
+  if (Timeout >= std::chrono::milliseconds::zero() &&
+      (Wait < std::chrono::milliseconds::zero() || Timeout < Wait))
+    Wait = Timeout;
+  const std::size_t NumTriggeredFDs = Poll->wait(Wait);
+  MONOMUX_TRACE_LOG(LOG(data) << NumTriggeredFDs << " events received!");
+  const auto BatchStart = std::chrono::steady_clock::now();
+  Timers.advance();
+  collectEvents(*Poll, NumTriggeredFDs, Batch);
+  for (std::size_t I = 0; I < Batch.size(); ++I)
+  {
+    const EPoll::EventWithMode Event = Poll->eventAt(Batch[I]);
+
+    if (Event.FD == Sock.raw())
+    {
+      // Event occured on the main socket.
+      acceptClients();
+      continue;
+    }
+    if (MetricsSock && Event.FD == MetricsSock->raw())
+    {
+      acceptScrapers();
+      continue;
+    }
+    if (Event.FD == SignalFile)
+    {
+      SignalDispatch();
+      reapDeadChildren();
+      continue;
+    }
+
+    // Control connections may change the sessions and clients handled by
+    // any of the reactors.
+    std::vector<std::unique_lock<std::mutex>> Locks;
+    if (LookupEntry::getFromOpaqueValue(Event.UserData)
+          .is<ClientControlConnection>())
+      Locks = lockReactors();
+
+    MONOMUX_PROBE(dispatch_enter, Event.FD, eventMode(Event));
+    handleEvent(*Poll, FDLookup, Event);
+    MONOMUX_PROBE(dispatch_exit, Event.FD, eventMode(Event));
+  }
+  recordBatch(BatchStart);
+  return NumTriggeredFDs;
+}
+
+void Server::collectEvents(EPoll& Poll,
+                           std::size_t Count,
+                           std::vector<std::size_t>& Batch)
+{
+  Batch.clear();
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    if (Poll.fdAt(I) == fd::Invalid)
+    {
+      LOG(error) << '#' << I
+                 << " event received but there was no associated file";
+      continue;
+    }
+    Batch.push_back(I);
+  }
+
+  auto EntityAt = [&Poll](std::size_t I) {
+    return LookupEntry::getFromOpaqueValue(Poll.eventAt(I).UserData);
+  };
+  // Events not belonging to a session (e.g. the server socket) are kept
+  // among the client connections.
+  auto IsClient = [&EntityAt](std::size_t I) {
+    LookupEntry Entity = EntityAt(I);
+    return !Entity.is<SessionConnection>() &&
+           !Entity.is<SessionTimerConnection>();
+  };
+  auto IsTimer = [&EntityAt](std::size_t I) {
+    return EntityAt(I).is<SessionTimerConnection>();
+  };
+  // Flushing the coalesced output is due, so it goes before new output.
+  auto Sessions = std::stable_partition(Batch.begin(), Batch.end(), IsClient);
+  std::stable_partition(Sessions, Batch.end(), IsTimer);
+}
 
-  auto NewClient = [this]() -> bool {
+void Server::acceptClients()
+{
+  // Accepting is bounded so a flood of connections does not delay the
+  // handling of the existing ones. The rest is accepted in the next batch,
+  // as the server socket remains readable.
+  static constexpr std::size_t MaxAcceptBatch = 64;
+  for (std::size_t I = 0; I < MaxAcceptBatch; ++I)
+  {
     std::error_code Error;
-    bool Recoverable;
+    bool Recoverable = false;
     std::optional<Socket> ClientSock = Sock.accept(&Error, &Recoverable);
     if (!ClientSock)
     {
+      if (Error == std::errc::resource_unavailable_try_again /* EAGAIN */)
+        // No more clients waiting.
+        return;
+      if (Error == std::errc::interrupted /* EINTR */ ||
+          Error == std::errc::connection_aborted /* ECONNABORTED */)
+        continue;
+
       if (Recoverable)
+      {
         LOG(warn) << "accept() did not succeed: " << Error;
+        backOffAccepting();
+      }
       else
         LOG(error) << "accept() did not succeed: " << Error
                    << " (not recoverable)";
-
-      if (Recoverable)
-      {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        return true;
-      }
-      return false;
+      return;
     }
+    AcceptBackoffDelay = std::chrono::milliseconds::zero();
 
     // A new client was accepted.
     if (ClientData* ExistingClient = getClient(ClientSock->raw()))
@@ -109,165 +431,660 @@ void Server::loop()
       // TODO: What is the good way of handling this?
       LOG(debug) << "Stale socket of gone client, " << ClientSock->raw()
                  << " left behind?";
+      auto Locks = lockReactors();
       exitCallback(*ExistingClient);
       removeClient(*ExistingClient);
     }
 
     ClientData* Client =
       makeClient(ClientData{std::make_unique<Socket>(std::move(*ClientSock))});
+    Stats.ClientsAccepted.add();
     acceptCallback(*Client);
-    return false;
-  };
+  }
+}
 
-  while (!TerminateLoop.get().load())
+void Server::acceptScrapers()
+{
+  for (std::size_t I = 0; I < MaxScrapers; ++I)
   {
-    // Process "external" events.
-    reapDeadChildren();
+    std::error_code Error;
+    std::optional<Socket> Connection = MetricsSock->accept(&Error);
+    if (!Connection)
+    {
+      if (Error == std::errc::resource_unavailable_try_again /* EAGAIN */)
+        return;
+      if (Error == std::errc::interrupted /* EINTR */ ||
+          Error == std::errc::connection_aborted /* ECONNABORTED */)
+        continue;
 
-    const std::size_t NumTriggeredFDs = Poll->wait();
-    MONOMUX_TRACE_LOG(LOG(data) << NumTriggeredFDs << " events received!");
-    for (std::size_t I = 0; I < NumTriggeredFDs; ++I)
+      // The metrics socket would remain readable, so it is not listened for
+      // until the error (e.g. the lack of file descriptors) might subside.
+      LOG(warn) << "accept() on the metrics socket did not succeed: " << Error;
+      Poll->stop(MetricsSock->raw());
+      Timers.schedule(std::chrono::seconds{1}, [this] {
+        Poll->listen(
+          MetricsSock->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+      });
+      return;
+    }
+    if (Scrapers.size() >= MaxScrapers)
     {
-      EPoll::EventWithMode Event;
-      try
+      LOG(debug) << "Too many connections to the metrics socket, closing "
+                 << Connection->raw();
+      continue;
+    }
+
+    auto Scraper = std::make_unique<MetricsScraper>(
+      MetricsScraper{std::move(*Connection), {}});
+    const raw_fd FD = Scraper->Connection.raw();
+    const LookupEntry Entity = MetricsScraperConnection{Scraper.get()};
+    Poll->listen(FD,
+                 /* Incoming =*/true,
+                 /* Outgoing =*/false,
+                 /* EdgeTriggered =*/false,
+                 Entity.getOpaqueValue());
+    FDLookup[FD] = Entity;
+    Scrapers.emplace(FD, std::move(Scraper));
+  }
+}
+
+void Server::scraperCallback(MetricsScraper& Scraper,
+                             bool Incoming,
+                             bool Outgoing)
+{
+  Socket& Connection = Scraper.Connection;
+  try
+  {
+    if (Incoming)
+    {
+      std::string Data = Connection.read(MaxScraperRequest);
+      if (Connection.failed())
       {
-        Event = Poll->eventAt(I);
+        removeScraper(Scraper);
+        return;
       }
-      catch (...)
+      if (!Scraper.Answered)
+        Scraper.Request.append(Data);
+    }
+
+    // The request itself is not interpreted, only its end is waited for.
+    if (!Scraper.Answered &&
+        (Scraper.Request.find("\r\n\r\n") != std::string::npos ||
+         Scraper.Request.find("\n\n") != std::string::npos))
+    {
+      std::string Body;
       {
-        Event.FD = fd::Invalid;
+        // The connections of the reactors are inspected too.
+        auto Locks = lockReactors();
+        Body = formatOpenMetrics(metrics());
       }
-      if (Event.FD == fd::Invalid)
+      std::ostringstream Response;
+      Response << "HTTP/1.0 200 OK\r\n"
+               << "Content-Type: " << OpenMetricsContentType << "\r\n"
+               << "Content-Length: " << Body.size() << "\r\n"
+               << "Connection: close\r\n"
+               << "\r\n"
+               << Body;
+      Scraper.Answered = true;
+      Scraper.Request.clear();
+      Connection.write(Response.str());
+    }
+    else if (!Scraper.Answered && Scraper.Request.size() >= MaxScraperRequest)
+    {
+      LOG(debug) << "Request on the metrics socket too long, closing "
+                 << Connection.raw();
+      removeScraper(Scraper);
+      return;
+    }
+
+    if (Outgoing)
+      Connection.flushWrites();
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(warn) << "Answer on the metrics socket too large:\n\t" << BO.what();
+    removeScraper(Scraper);
+    return;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(debug) << "Error on the metrics socket: " << Err.what();
+    removeScraper(Scraper);
+    return;
+  }
+
+  if (Scraper.Answered && !Connection.hasBufferedWrite())
+    removeScraper(Scraper);
+  else if (Connection.hasBufferedWrite())
+    Poll->schedule(
+      Connection.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+void Server::removeScraper(MetricsScraper& Scraper)
+{
+  const raw_fd FD = Scraper.Connection.raw();
+  Poll->stop(FD);
+  FDLookup.erase(FD);
+  Scrapers.erase(FD);
+}
+
+void Server::backOffAccepting()
+{
+  using namespace std::chrono_literals;
+  static constexpr std::chrono::milliseconds MinDelay = 100ms;
+  static constexpr std::chrono::milliseconds MaxDelay = 1s;
+
+  AcceptBackoffDelay =
+    std::clamp(AcceptBackoffDelay * 2, MinDelay, MaxDelay);
+  LOG(info) << "Not accepting clients for " << AcceptBackoffDelay.count()
+            << " ms";
+
+  // The server socket stays readable while the clients are waiting, so it
+  // must not be listened for until the backoff expires. Other connections
+  // are handled in the meantime.
+  Poll->stop(Sock.raw());
+  Timers.cancel(AcceptBackoff);
+  AcceptBackoff = Timers.schedule(AcceptBackoffDelay, [this] {
+    LOG(debug) << "Retrying accepting clients";
+    Poll->listen(Sock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  });
+}
+
+void Server::reclaimResources()
+{
+  std::size_t Budget = ReclaimBatch;
+  bool PassFinished = false;
+  {
+    auto Locks = lockReactors();
+    if (!ReclaimSessionCursor)
+    {
+      auto It = Clients.lower_bound(ReclaimClientCursor);
+      for (; It != Clients.end() && Budget; ++It, --Budget)
       {
-        LOG(error) << '#' << I
-                   << " event received but there was no associated file";
-        continue;
+        ClientData& C = *It->second;
+        C.getControlSocket().tryFreeResources();
+        if (Socket* DS = C.getDataSocket())
+          DS->tryFreeResources();
+      }
+      if (It != Clients.end())
+        ReclaimClientCursor = It->first;
+      else
+      {
+        ReclaimClientCursor = 0;
+        ReclaimSessionCursor.emplace();
+      }
+    }
+    if (ReclaimSessionCursor)
+    {
+      auto It = Sessions.lower_bound(*ReclaimSessionCursor);
+      for (; It != Sessions.end() && Budget; ++It, --Budget)
+      {
+        SessionData& S = *It->second;
+        if (Pipe* R = S.getReader())
+          R->tryFreeResources();
+        if (Pipe* W = S.getWriter())
+          W->tryFreeResources();
+        if (shouldHibernate(S))
+          hibernateSession(S);
       }
+      if (It != Sessions.end())
+        *ReclaimSessionCursor = It->first;
+      else
+      {
+        ReclaimSessionCursor.reset();
+        PassFinished = true;
+      }
+    }
+  }
 
-      if (Event.FD == Sock.raw())
+  if (PassFinished)
+  {
+    // A pass of the sweep finished. If the cached buffers were not needed
+    // since the previous one, the server is likely idle after a burst.
+    BufferPool& Pool = BufferPool::global();
+    const std::size_t Reuses = Pool.reuses();
+    if (Reuses == ReclaimPoolReuses)
+      if (const std::size_t Cached = Pool.cachedBytes())
       {
-        // Event occured on the main socket.
-        bool Retry = NewClient();
-        if (Retry)
-          --I;
-        continue;
+        LOG(debug) << "Releasing " << Cached << " bytes of pooled buffers";
+        Pool.trim();
+#ifdef __GLIBC__
+        // Return the free pages of the heap to the system.
+        ::malloc_trim(0);
+#endif /* __GLIBC__ */
       }
+    ReclaimPoolReuses = Reuses;
+  }
 
-      // Event occured on another (connected client or session) socket.
-      MONOMUX_TRACE_LOG(LOG(trace)
-                        << "Event on file descriptor " << Event.FD
-                        << " (incoming: " << std::boolalpha << Event.Incoming
-                        << ", outgoing: " << Event.Outgoing << std::noboolalpha
-                        << ')');
+  Timers.schedule(ReclaimInterval, [this] { reclaimResources(); });
+}
 
-      LookupVariant* Entity = FDLookup.tryGet(Event.FD);
-      if (!Entity)
+void Server::handleEvent(EPoll& Poll,
+                         LookupMap& Lookup,
+                         EPoll::EventWithMode Event)
+{
+  // Event occured on a connected client or session socket.
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Event on file descriptor " << Event.FD
+                    << " (incoming: " << std::boolalpha << Event.Incoming
+                    << ", outgoing: " << Event.Outgoing << std::noboolalpha
+                    << ')');
+
+  // The entity is registered with the event, and not looked up.
+  const LookupEntry Entity = LookupEntry::getFromOpaqueValue(Event.UserData);
+  if (Entity.empty())
+  {
+    LOG(error) << "\tEntity for file descriptor " << Event.FD
+               << " not registered? (Possible internal error, "
+                  "race condition, or mid-handling disconnect?)";
+    return;
+  }
+  try
+  {
+    if (auto* Session = Entity.getIf<SessionConnection>())
+    {
+      SessionData& S = *Session;
+      if (Event.Incoming)
       {
-        LOG(error) << "\tEntity for file descriptor " << Event.FD
-                   << " missing from lookup table? (Possible internal error, "
-                      "race condition, or mid-handling disconnect?)";
-        continue;
+        // First check for data coming from a session. This is the most
+        // populous in terms of bandwidth.
+        dataCallback(S);
+        S.getReader()->tryFreeResources();
       }
-      try
+      if (Event.Outgoing)
       {
-        if (auto* Session = std::get_if<SessionConnection>(Entity))
+        try
         {
-          SessionData& S = **Session;
-          if (Event.Incoming)
-          {
-            // First check for data coming from a session. This is the most
-            // populous in terms of bandwidth.
-            dataCallback(S);
-            S.getReader()->tryFreeResources();
-          }
-          if (Event.Outgoing)
-          {
-            try
-            {
-              S.getWriter()->flushWrites();
-              S.getWriter()->tryFreeResources();
-            }
-            catch (const buffer_overflow& BO)
-            {
-              rescheduleOverflow(*Poll, BO);
-            }
-          }
-          continue;
-        }
-        if (auto* Data = std::get_if<ClientDataConnection>(Entity))
-        {
-          ClientData& C = **Data;
-          auto ClientID = C.id();
-
-          if (Event.Incoming)
-            // Second, try to see if the data is coming from a client, like
-            // keypresses and such. We expect to see many of these, too.
-            dataCallback(C);
-          if (Event.Outgoing)
-            flushAndReschedule(*Poll, *C.getDataSocket());
-
-          if (Clients.find(ClientID) != Clients.end())
-            C.getDataSocket()->tryFreeResources();
-          continue;
+          flushAndReschedule(Poll, *S.getWriter());
+          S.getWriter()->tryFreeResources();
         }
-        if (auto* Control = std::get_if<ClientControlConnection>(Entity))
+        catch (const buffer_overflow& BO)
         {
-          ClientData& C = **Control;
-          auto ClientID = C.id();
-
-          if (Event.Incoming)
-            // Lastly, check if the receive is happening on the control
-            // connection, where messages are small and far inbetween.
-            controlCallback(C);
-          if (Event.Outgoing)
-            flushAndReschedule(*Poll, C.getControlSocket());
-
-          if (Clients.find(ClientID) != Clients.end())
-            C.getControlSocket().tryFreeResources();
-          continue;
+          rescheduleOverflow(Poll, BO);
         }
       }
-      catch (const buffer_overflow& BO)
+      return;
+    }
+    if (auto* Timer = Entity.getIf<SessionTimerConnection>())
+    {
+      // (The timers of a session share the entry, so each checks whether it
+      // is the one that fired.)
+      throttleTimerCallback(*Timer);
+      coalescingTimerCallback(*Timer);
+      return;
+    }
+    if (auto* Data = Entity.getIf<ClientDataConnection>())
+    {
+      ClientData& C = *Data;
+
+      if (Event.Incoming)
+        // Second, try to see if the data is coming from a client, like
+        // keypresses and such. We expect to see many of these, too.
+        dataCallback(C);
+      if (Event.Outgoing && Lookup.tryGet(Event.FD))
       {
-        LOG(error) << "Generic handling error:\n\t" << BO.what();
-        rescheduleOverflow(*Poll, BO);
+        if (EdgeTriggered)
+          // A new event will fire when the socket becomes writable again.
+          C.getDataSocket()->flushWrites();
+        else
+          flushAndReschedule(Poll, *C.getDataSocket());
+        clientDrained(C);
       }
-      catch (const std::system_error& Err)
+
+      // (If the client exited, the connection is no longer listened for.)
+      if (Lookup.tryGet(Event.FD))
+        C.getDataSocket()->tryFreeResources();
+      return;
+    }
+    if (auto* Control = Entity.getIf<ClientControlConnection>())
+    {
+      ClientData& C = *Control;
+      auto ClientID = C.id();
+
+      if (Event.Incoming)
+        // Lastly, check if the receive is happening on the control
+        // connection, where messages are small and far inbetween.
+        controlCallback(C);
+      if (Clients.find(ClientID) != Clients.end() && C.multiplexed())
       {
-        // Ignore the error on the sockets and pipes, and do not tear the
-        // server down just because of them.
-        LOG(error) << "Generic handling error:\n\t" << Err.what();
+        multiplexedCallback(Poll, C, Event.Incoming, Event.Outgoing);
+        return;
       }
+      if (Event.Outgoing)
+        flushAndReschedule(Poll, C.getControlSocket());
+
+      if (Clients.find(ClientID) != Clients.end())
+        C.getControlSocket().tryFreeResources();
+      return;
+    }
+    if (auto* Scraper = Entity.getIf<MetricsScraperConnection>())
+    {
+      scraperCallback(*Scraper, Event.Incoming, Event.Outgoing);
+      return;
     }
   }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Generic handling error:\n\t" << BO.what();
+    rescheduleOverflow(Poll, BO);
+  }
+  catch (const std::system_error& Err)
+  {
+    // Ignore the error on the sockets and pipes, and do not tear the
+    // server down just because of them.
+    LOG(error) << "Generic handling error:\n\t" << Err.what();
+  }
 }
 
-void Server::interrupt() const noexcept { TerminateLoop.get().store(true); }
-
-static void sendKickClient(ClientData& Client, std::string Reason)
+void Server::multiplexedCallback(EPoll& Poll,
+                                 ClientData& Client,
+                                 bool Incoming,
+                                 bool Outgoing)
 {
-  try
+  // The data of the client arrives over the control connection, and reading
+  // the control messages kept it aside.
+  auto& DS = static_cast<MuxedSocket&>(*Client.getDataSocket());
+  const std::size_t ClientID = Client.id();
+  if (Incoming && DS.hasBufferedRead())
+    dataCallback(Client);
+  if (Clients.find(ClientID) == Clients.end())
+    return;
+
+  if (Outgoing)
   {
-    Client.sendDetachReason(
-      monomux::message::notification::Detached::Kicked, 0, std::move(Reason));
+    DS.flushConnection();
+    clientDrained(Client);
   }
-  // Ignore the error. It could be that the client got auto-detached when
-  // their associated session ended.
-  catch (const buffer_overflow&)
-  {}
-  catch (const std::system_error&)
-  {}
+  if (DS.connectionHasBufferedRead() || DS.connectionHasBufferedWrite())
+    Poll.schedule(DS.raw(),
+                  DS.connectionHasBufferedRead(),
+                  DS.connectionHasBufferedWrite());
+
+  Client.getControlSocket().tryFreeResources();
+  DS.tryFreeResources();
 }
 
-void Server::shutdown()
+void Server::interrupt() const noexcept { TerminateLoop.get().store(true); }
+
+void Server::setUpgradeHandler(std::function<void(raw_fd StateFile)> Handler)
 {
-  LOG(info) << "Detaching all clients...";
-  while (!Clients.empty())
+  UpgradeHandler = std::move(Handler);
+}
+
+void Server::requestUpgrade() const noexcept
+{
+  UpgradeRequested.get().store(true);
+  if (Poll)
+    Poll->wake();
+}
+
+void Server::setHandedOverState(HandOverState State)
+{
+  HandedOver.emplace(std::move(State));
+}
+
+static void sendKickClient(ClientData& Client, std::string Reason)
+{
+  try
+  {
+    Client.sendDetachReason(
+      monomux::message::notification::Detached::Kicked, 0, std::move(Reason));
+  }
+  // Ignore the error. It could be that the client got auto-detached when
+  // their associated session ended.
+  catch (const buffer_overflow&)
+  {}
+  catch (const std::system_error&)
+  {}
+}
+
+void Server::startReactors(std::size_t EventCount)
+{
+  if (!ReactorCount)
+    return;
+
+  // The signals meant for the server must only be received by the coordinator,
+  // so that they interrupt the main event loop. The started threads inherit
+  // the mask active at their creation.
+  POD<::sigset_t> Signals;
+  POD<::sigset_t> OldSignals;
+  ::sigemptyset(&Signals);
+  for (int SigNum : {SIGHUP, SIGINT, SIGTERM, SIGUSR2, SIGCHLD, SIGPIPE})
+    ::sigaddset(&Signals, SigNum);
+  ::pthread_sigmask(SIG_BLOCK, &Signals, &OldSignals);
+
+  // Reactors on different NUMA nodes do not compete for the same memory
+  // bandwidth and caches.
+  std::vector<unsigned> CPUs;
+  if (ServerCPUs)
+    CPUs = ServerCPUs->interleaved(CPUSet::numaNodes());
+
+  LOG(debug) << "Starting " << ReactorCount << " reactor threads...";
+  for (std::size_t I = 0; I < ReactorCount; ++I)
+  {
+    auto R = std::make_unique<Reactor>();
+    R->Poll = makePoll(EventCount);
+    R->Trace = startTrace(*R->Poll, I + 1);
+    if (!CPUs.empty())
+      R->CPU = CPUs[I % CPUs.size()];
+    Reactor& RR = *Reactors.emplace_back(std::move(R));
+    RR.Thread = std::thread{[this, &RR] { reactorLoop(RR); }};
+  }
+
+  ::pthread_sigmask(SIG_SETMASK, &OldSignals, nullptr);
+}
+
+void Server::stopReactors()
+{
+  TerminateLoop.get().store(true);
+  for (std::unique_ptr<Reactor>& R : Reactors)
+  {
+    R->Poll->wake();
+    if (R->Thread.joinable())
+      R->Thread.join();
+  }
+}
+
+std::unique_ptr<EventTrace> Server::startTrace(EPoll& Poll, std::size_t N)
+{
+  if (EventTracePrefix.empty())
+    return nullptr;
+
+  const std::string Path =
+    EventTracePrefix + '.' + std::to_string(N) + ".trace";
+  try
+  {
+    auto T = std::make_unique<EventTrace>(Path);
+    Poll.setTrace(T.get());
+    LOG(info) << "Recording event loop #" << N << " to '" << Path << '\'';
+    return T;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(warn) << "Failed to record event loop #" << N << ": " << Err.what();
+    return nullptr;
+  }
+}
+
+void Server::pinThread(const CPUSet& CPUs, std::string_view Name)
+{
+  try
+  {
+    CPUs.applyToThisThread();
+    LOG(debug) << "Running the " << Name << " on CPUs " << CPUs.toString();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(warn) << "Restricting the " << Name << " to CPUs " << CPUs.toString()
+              << " failed: " << Err.what();
+  }
+}
+
+std::optional<CPUSet> Server::sessionAffinity() const
+{
+  if (SessionCPUs)
+    return SessionCPUs;
+  // The programs must not inherit the restriction of the server.
+  return InheritedCPUs;
+}
+
+void Server::reactorLoop(Reactor& R)
+{
+  if (R.CPU)
+  {
+    CPUSet Only;
+    Only.add(*R.CPU);
+    pinThread(Only, "reactor");
+  }
+  while (!TerminateLoop.get().load())
+  {
+    const std::size_t NumTriggeredFDs = R.Poll->wait(R.Timers.timeout());
+    std::lock_guard<std::mutex> Lock{R.Lock};
+    const auto BatchStart = std::chrono::steady_clock::now();
+    R.Timers.advance();
+    collectEvents(*R.Poll, NumTriggeredFDs, R.Batch);
+    for (std::size_t I : R.Batch)
+    {
+      EPoll::EventWithMode Event = R.Poll->eventAt(I);
+      if (Event.FD == fd::Invalid)
+        continue;
+      MONOMUX_PROBE(dispatch_enter, Event.FD, eventMode(Event));
+      handleEvent(*R.Poll, R.FDLookup, Event);
+      MONOMUX_PROBE(dispatch_exit, Event.FD, eventMode(Event));
+    }
+    recordBatch(BatchStart);
+  }
+}
+
+void Server::recordBatch(std::chrono::steady_clock::time_point Started) noexcept
+{
+  Stats.LoopIterations.add();
+  Stats.LoopLatency.record(
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Started)
+      .count());
+}
+
+std::vector<std::unique_lock<std::mutex>> Server::lockReactors()
+{
+  std::vector<std::unique_lock<std::mutex>> Locks;
+  Locks.reserve(Reactors.size());
+  for (std::unique_ptr<Reactor>& R : Reactors)
+    Locks.emplace_back(R->Lock);
+  return Locks;
+}
+
+Server::Reactor* Server::reactorOf(const SessionData& Session) const noexcept
+{
+  std::optional<std::size_t> Index = Session.getReactor();
+  if (!Index || *Index >= Reactors.size())
+    return nullptr;
+  return Reactors.at(*Index).get();
+}
+
+Server::Reactor* Server::reactorOf(const ClientData& Client) const noexcept
+{
+  if (const SessionData* S = Client.getAttachedSession())
+    return reactorOf(*S);
+  // Every session a client watches is handled by the same reactor.
+  if (Client.watching())
+    return reactorOf(*Client.watchedSessions().front().Session);
+  return nullptr;
+}
+
+void Server::moveDataSocket(ClientData& Client, Reactor* From, Reactor* To)
+{
+  if (From == To)
+    return;
+
+  Socket& DS = *Client.getDataSocket();
+  pollOf(From).stop(DS.raw());
+  lookupOf(From).erase(DS.raw());
+  if (EventTrace* T = traceOf(From))
+    T->connection(EventTrace::Close, DS.raw(), EventTrace::ClientDataRole);
+
+  const LookupEntry Entity = ClientDataConnection{&Client};
+  // (A write still in flight in the previous queue is completed there.)
+  DS.writeThrough(&pollOf(To));
+  pollOf(To).listen(DS.raw(),
+                    /* Incoming =*/true,
+                    /* Outgoing =*/EdgeTriggered,
+                    EdgeTriggered,
+                    Entity.getOpaqueValue());
+  lookupOf(To)[DS.raw()] = Entity;
+  if (EventTrace* T = traceOf(To))
+    T->connection(EventTrace::Open, DS.raw(), EventTrace::ClientDataRole);
+  if (DS.hasBufferedRead() || DS.hasBufferedWrite())
+    pollOf(To).schedule(DS.raw(), DS.hasBufferedRead(), DS.hasBufferedWrite());
+}
+
+void Server::clientFailed(ClientData& Client, std::string KickReason)
+{
+  Reactor* R = reactorOf(Client);
+  if (!R)
   {
-    ClientData& Client = *Clients.begin()->second;
+    if (!KickReason.empty())
+    {
+      Stats.ClientsKicked.add();
+      sendKickClient(Client, std::move(KickReason));
+    }
+    exitCallback(Client);
+    return;
+  }
+
+  // The reactor must not touch the rest of the server's state. Stop listening
+  // to the client for now, and let the coordinator tear it down.
+  if (const auto* DS = Client.getDataSocket())
+  {
+    R->Poll->stop(DS->raw());
+    R->FDLookup.erase(DS->raw());
+  }
+
+  {
+    std::lock_guard<std::mutex> Lock{DeferredExitsLock};
+    for (const auto& E : DeferredExits)
+      if (E.first == Client.id())
+        return;
+    DeferredExits.emplace_back(Client.id(), std::move(KickReason));
+  }
+  Poll->wake();
+}
+
+void Server::handleDeferredExits()
+{
+  decltype(DeferredExits) Exits;
+  {
+    std::lock_guard<std::mutex> Lock{DeferredExitsLock};
+    if (DeferredExits.empty())
+      return;
+    Exits.swap(DeferredExits);
+  }
+
+  auto Locks = lockReactors();
+  for (std::pair<std::size_t, std::string>& E : Exits)
+  {
+    ClientData* C = getClient(E.first);
+    if (!C)
+      continue;
+    if (!E.second.empty())
+    {
+      Stats.ClientsKicked.add();
+      sendKickClient(*C, std::move(E.second));
+    }
+    exitCallback(*C);
+  }
+}
+
+void Server::shutdown()
+{
+  const auto Deadline = std::chrono::steady_clock::now() + ShutdownTimeout;
+
+  LOG(info) << "Detaching all clients...";
+  for (auto& [ID, Client] : Clients)
     try
     {
-      Client.sendDetachReason(
+      // (The connections do not block, the notification is buffered.)
+      Client->sendDetachReason(
         monomux::message::notification::Detached::ServerShutdown);
     }
     // Ignore the error. It could be that the client got auto-detached when
@@ -276,15 +1093,166 @@ void Server::shutdown()
     {}
     catch (const std::system_error&)
     {}
-    removeClient(Client);
-  }
+  flushClientsUntil(Deadline);
+  while (!Clients.empty())
+    removeClient(*Clients.begin()->second);
 
   LOG(info) << "Terminating all sessions...";
+  terminateSessionsUntil(Deadline);
   while (!Sessions.empty())
   {
     SessionData& Session = *Sessions.begin()->second;
     removeSession(Session);
   }
+  // Closing the terminals hangs up the processes started in advance.
+  SessionPool.clear();
+}
+
+/// \returns whether the \p Client still has data buffered to be sent on its
+/// control connection.
+static bool hasPendingNotification(ClientData& Client)
+{
+  Socket& Control = Client.getControlSocket();
+  if (Control.failed())
+    return false;
+  if (Client.multiplexed())
+    return static_cast<MuxedSocket&>(Control).connectionHasBufferedWrite();
+  return Control.hasBufferedWrite();
+}
+
+void Server::flushClientsUntil(std::chrono::steady_clock::time_point Deadline)
+{
+  EPoll Flush{std::max<std::size_t>(Clients.size(), 1)};
+  std::size_t Pending = 0;
+  for (auto& [ID, Client] : Clients)
+    if (hasPendingNotification(*Client))
+    {
+      Flush.listen(Client->getControlSocket().raw(),
+                   /* Incoming =*/false,
+                   /* Outgoing =*/true,
+                   /* EdgeTriggered =*/false,
+                   Client.get());
+      ++Pending;
+    }
+
+  while (Pending)
+  {
+    const auto Now = std::chrono::steady_clock::now();
+    if (Now >= Deadline)
+      break;
+    const std::size_t Count = Flush.wait(
+      std::chrono::ceil<std::chrono::milliseconds>(Deadline - Now));
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      const EPoll::EventWithMode Event = Flush.eventAt(I);
+      auto* Client = static_cast<ClientData*>(Event.UserData);
+      if (!Client)
+        continue;
+
+      Socket& Control = Client->getControlSocket();
+      try
+      {
+        if (Client->multiplexed())
+          static_cast<MuxedSocket&>(Control).flushConnection();
+        else
+          Control.flushWrites();
+      }
+      catch (const std::system_error&)
+      {}
+      if (!hasPendingNotification(*Client))
+      {
+        Flush.stop(Event.FD);
+        --Pending;
+      }
+    }
+  }
+
+  if (Pending)
+    LOG(warn) << Pending
+              << " clients were not notified of the shutdown in time";
+}
+
+/// \returns a file descriptor that becomes readable when the process \p PID
+/// exits, or an invalid one if the system does not support it.
+static fd processExitFile(Process::raw_handle PID)
+{
+#ifdef SYS_pidfd_open
+  auto File = CheckedPOSIX(
+    [PID] { return static_cast<int>(::syscall(SYS_pidfd_open, PID, 0)); },
+    -1);
+  if (File)
+    return fd{File.get()};
+#else
+  (void)PID;
+#endif
+  return fd{};
+}
+
+void Server::terminateSessionsUntil(
+  std::chrono::steady_clock::time_point Deadline)
+{
+  struct Exiting
+  {
+    Process* Proc;
+    /// Becomes readable when the process exits, if supported.
+    fd File;
+  };
+
+  // The processes started for the sessions lead their own process groups,
+  // which are all hung up together, like closing their terminals would.
+  std::vector<Exiting> Running;
+  for (auto& [Name, Session] : Sessions)
+  {
+    if (!Session->hasProcess() || Session->getProcess().dead())
+      continue;
+    Process& Proc = Session->getProcess();
+    Proc.signal(SIGHUP);
+    Proc.signal(SIGCONT);
+    Running.push_back(Exiting{&Proc, processExitFile(Proc.raw())});
+  }
+  if (Running.empty())
+    return;
+
+  EPoll Exits{Running.size()};
+  // Without a file to wait for, the processes are checked periodically.
+  static constexpr std::chrono::milliseconds PollInterval{10};
+  bool Polled = false;
+  for (const Exiting& E : Running)
+    if (E.File.has())
+      Exits.listen(E.File.get(), /* Incoming =*/true, /* Outgoing =*/false);
+    else
+      Polled = true;
+
+  while (true)
+  {
+    Running.erase(std::remove_if(Running.begin(),
+                                 Running.end(),
+                                 [&Exits](Exiting& E) {
+                                   if (!E.Proc->reapIfDead())
+                                     return false;
+                                   if (E.File.has())
+                                   {
+                                     Exits.stop(E.File.get());
+                                     fd Closed = std::move(E.File);
+                                   }
+                                   return true;
+                                 }),
+                  Running.end());
+    const auto Now = std::chrono::steady_clock::now();
+    if (Running.empty() || Now >= Deadline)
+      break;
+
+    auto Timeout = std::chrono::ceil<std::chrono::milliseconds>(Deadline - Now);
+    if (Polled)
+      Timeout = std::min(Timeout, PollInterval);
+    Exits.wait(Timeout);
+  }
+
+  if (!Running.empty())
+    // (Their terminals are closed nevertheless, and the processes are
+    // inherited by the system when the server exits.)
+    LOG(warn) << Running.size()
+              << " sessions did not exit in time, leaving them behind";
 }
 
 ClientData* Server::getClient(std::size_t ID) noexcept
@@ -295,11 +1263,11 @@ ClientData* Server::getClient(std::size_t ID) noexcept
 
 SessionData* Server::getSession(std::string_view Name) noexcept
 {
-  auto It =
-    std::find_if(Sessions.begin(), Sessions.end(), [Name](const auto& Elem) {
-      return Elem.first == Name;
-    });
-  return It != Sessions.end() ? It->second.get() : nullptr;
+  auto It = SessionsByName.find(Name);
+  if (It != SessionsByName.end())
+    return It->second;
+  auto AliasIt = SessionsByAlias.find(Name);
+  return AliasIt != SessionsByAlias.end() ? AliasIt->second : nullptr;
 }
 
 ClientData* Server::makeClient(ClientData Client)
@@ -319,7 +1287,14 @@ SessionData* Server::makeSession(SessionData Session)
     Sessions.try_emplace(SN, std::make_unique<SessionData>(std::move(Session)));
   if (!InsertRes.second)
     return nullptr;
-  return InsertRes.first->second.get();
+
+  SessionData* S = InsertRes.first->second.get();
+  SessionsByName.try_emplace(InsertRes.first->first, S);
+  if (S->hasProcess())
+    SessionsByPID.try_emplace(S->getProcess().raw(), S);
+  if (!S->alias().empty())
+    SessionsByAlias.try_emplace(S->alias(), S);
+  return S;
 }
 
 void Server::removeClient(ClientData& Client)
@@ -327,6 +1302,9 @@ void Server::removeClient(ClientData& Client)
   std::size_t CID = Client.id();
   if (SessionData* S = Client.getAttachedSession())
     clientDetachedCallback(Client, *S);
+  clientUnwatchAll(Client);
+  if (Client.sessionSubscriber())
+    setSessionSubscriber(Client, false);
   Clients.erase(CID);
 }
 
@@ -334,7 +1312,15 @@ void Server::removeSession(SessionData& Session)
 {
   for (ClientData* C : Session.getAttachedClients())
     clientDetachedCallback(*C, Session);
-
+  if (Recording* Rec = Session.getRecording())
+    Rec->finish();
+
+  if (Session.hasProcess())
+    SessionsByPID.erase(Session.getProcess().raw());
+  if (!Session.alias().empty())
+    SessionsByAlias.erase(Session.alias());
+  Timers.cancel(Session.getResize().Timer);
+  SessionsByName.erase(Session.name());
   Sessions.erase(Session.name());
 
   if (Sessions.empty() && ExitIfNoMoreSessions)
@@ -343,23 +1329,33 @@ void Server::removeSession(SessionData& Session)
 
 void Server::registerDeadChild(Process::raw_handle PID) const noexcept
 {
-  for (std::size_t I = 0; I < DeadChildrenVecSize; ++I)
-    if (DeadChildren.at(I) == Process::Invalid)
-    {
-      DeadChildren.at(I) = PID;
-      return;
-    }
+  for (std::atomic<Process::raw_handle>& Slot : DeadChildren)
+  {
+    Process::raw_handle Free = Process::Invalid;
+    if (Slot.compare_exchange_strong(Free, PID))
+      break;
+  }
+  ChildrenDied.store(true);
+
+  // The signal might have arrived after the loop last checked for dead
+  // children, and before it started waiting for events.
+  if (Poll)
+    Poll->wake();
 }
 
 void Server::acceptCallback(ClientData& Client)
 {
   LOG(info) << "Client \"" << Client.id() << "\" connected";
-  raw_fd FD = Client.getControlSocket().raw();
 
   // (8 is a good guesstimate because FDLookup usually counts from 5 or 6, not
   // from 0.)
   static constexpr std::size_t FDKeepSpare = 8;
   std::size_t FDCount = FDLookup.size();
+  for (const std::unique_ptr<Reactor>& R : Reactors)
+  {
+    std::lock_guard<std::mutex> Lock{R->Lock};
+    FDCount += R->FDLookup.size();
+  }
   std::size_t MaxFDs = fd::maxNumFDs() - FDKeepSpare;
   if (FDCount >= MaxFDs)
   {
@@ -373,24 +1369,33 @@ void Server::acceptCallback(ClientData& Client)
     return;
   }
 
-  fd::setNonBlockingCloseOnExec(FD);
-  Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
-  FDLookup[FD] = ClientControlConnection{&Client};
-
+  listenOnControlSocket(Client);
   sendAcceptClient(Client);
 }
 
+void Server::listenOnControlSocket(ClientData& Client)
+{
+  raw_fd FD = Client.getControlSocket().raw();
+  const LookupEntry Entity = ClientControlConnection{&Client};
+  Poll->listen(FD,
+               /* Incoming =*/true,
+               /* Outgoing =*/false,
+               /* EdgeTriggered =*/false,
+               Entity.getOpaqueValue());
+  FDLookup[FD] = Entity;
+}
+
 void Server::controlCallback(ClientData& Client)
 {
   using namespace monomux::message;
   MONOMUX_TRACE_LOG(LOG(trace)
                     << "Client \"" << Client.id() << "\" sent CONTROL!");
   Socket& ClientSock = Client.getControlSocket();
-  std::string Data;
+  PascalStringReader& Reader = Client.getControlReader();
 
   try
   {
-    Data = readPascalString(ClientSock);
+    Reader.fill(ClientSock);
   }
   catch (const buffer_overflow& BO)
   {
@@ -413,18 +1418,46 @@ void Server::controlCallback(ClientData& Client)
     return;
   }
 
-  if (ClientSock.hasBufferedRead())
+  if (Reader.mightHaveMore())
     Poll->schedule(ClientSock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
   else
     ClientSock.tryFreeResources();
 
-  if (Data.empty())
-    return;
+  // Handle every message that arrived together in this wakeup. A handler might
+  // destroy the client (e.g. turning the connection into a data connection of
+  // another client), after which it must not be touched anymore.
+  const std::size_t ID = Client.id();
+  while (std::optional<std::string_view> Frame = Reader.next())
+  {
+    if (Frame->empty())
+      continue;
+    Client.metrics().ControlMessages.add();
+    handleControlMessage(Client, *Frame);
+
+    auto It = Clients.find(ID);
+    if (It == Clients.end() || It->second.get() != &Client)
+      return;
+  }
+
+  if (Reader.corrupted())
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": CONTROL stream corrupted, dropping client";
+    exitCallback(Client);
+  }
+}
 
+void Server::handleControlMessage(ClientData& Client, std::string_view Data)
+{
+  using namespace monomux::message;
   Message MB = Message::unpack(Data);
-  auto Action =
-    Dispatch.find(static_cast<decltype(Dispatch)::key_type>(MB.Kind));
-  if (Action == Dispatch.end())
+  const auto Kind = static_cast<std::uint16_t>(MB.Kind);
+  std::function<HandlerFunction>* Override =
+    Kind < DispatchOverrides.size() && DispatchOverrides[Kind]
+      ? &DispatchOverrides[Kind]
+      : nullptr;
+  HandlerFunction* Action = Kind < Dispatch.size() ? Dispatch[Kind] : nullptr;
+  if (!Override && !Action)
   {
     MONOMUX_TRACE_LOG(LOG(trace) << "Client \"" << Client.id()
                                  << "\": unknown message type "
@@ -432,11 +1465,19 @@ void Server::controlCallback(ClientData& Client)
     return;
   }
 
+  // The client opts in to the binary encoding advertised during the connection
+  // handshake by speaking it, and expects to be answered in kind.
+  if (MB.format() != Client.wireFormat())
+    Client.setWireFormat(MB.format());
+
   MONOMUX_TRACE_LOG(LOG(data) << "Client \"" << Client.id() << "\"\n"
                               << MB.RawData);
   try
   {
-    Action->second(*this, Client, MB.RawData);
+    if (Override)
+      (*Override)(*this, Client, MB.RawData);
+    else
+      Action(*this, Client, MB.RawData);
   }
   catch (const buffer_overflow& BO)
   {
@@ -449,401 +1490,1804 @@ void Server::controlCallback(ClientData& Client)
   {
     LOG(error) << "Client \"" << Client.id()
                << "\": error when handling message";
-    if (ClientSock.failed())
+    if (Client.getControlSocket().failed())
       exitCallback(Client);
   }
 }
 
-void Server::dataCallback(ClientData& Client)
+/// The number of times a connection is read in one go in edge-triggered mode,
+/// before other connections are given a chance to be handled.
+static constexpr std::size_t MaxDrainRounds = 16;
+/// The number of bytes of output relayed from a session in one go in
+/// edge-triggered mode, before other connections are given a chance to be
+/// handled. This keeps a session with a lot of output from delaying the
+/// keystrokes of users of other sessions.
+static constexpr std::size_t SessionOutputQuota = 1 << 16;
+
+void Server::dataCallback(ClientData& Client)
+{
+  if (!EdgeTriggered)
+  {
+    relayClientData(Client);
+    return;
+  }
+
+  // In edge-triggered mode, there will be no new event for the connection
+  // until it is drained.
+  for (std::size_t Round = 0; Round < MaxDrainRounds; ++Round)
+    if (!relayClientData(Client))
+      return;
+  pollOf(reactorOf(Client))
+    .schedule(Client.getDataSocket()->raw(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false);
+}
+
+bool Server::relayClientData(ClientData& Client)
+{
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Client \"" << Client.id() << "\" sent DATA!");
+  EPoll& DataPoll = pollOf(reactorOf(Client));
+  Socket& DS = *Client.getDataSocket();
+  std::string Data;
+  try
+  {
+    Data = DS.read(DS.optimalReadSize());
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Client \"" << Client.id() << "\": error when reading DATA: "
+               << "\n\t" << BO.what();
+    clientFailed(Client,
+                 "Overflow when reading connection, " +
+                   std::to_string(BO.channel().readInBuffer()) +
+                   " bytes already pending");
+    return false;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": error when reading DATA: " << Err.what();
+    return false;
+  }
+
+  if (DS.failed())
+  {
+    // We realise the client disconnected during an attempt to read.
+    clientFailed(Client, {});
+    return false;
+  }
+
+  if (!EdgeTriggered && DS.hasBufferedRead())
+    DataPoll.schedule(DS.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  Client.activity();
+  MONOMUX_TRACE_LOG(LOG(data)
+                    << "Client \"" << Client.id() << "\" data: " << Data);
+
+  if (Client.readOnly())
+    // Viewers can not type into the session, what they sent is discarded.
+    return !Data.empty();
+
+  if (SessionData* S = Client.getAttachedSession())
+  {
+    Pipe& Writer = *S->getWriter();
+    BufferedChannel::Result R = Writer.tryWrite(Data);
+    if (R.failed())
+    {
+      LOG(error) << "Session \"" << S->name()
+                 << "\": error when relaying input from client \""
+                 << Client.id() << "\": " << R.Error.message();
+      return !Data.empty();
+    }
+    if (R.overflow())
+      LOG(trace) << "Session \"" << S->name()
+                 << "\" when relaying input from client \"" << Client.id()
+                 << "\": input buffer overflow";
+    // The program might not be reading its input as fast as it arrives.
+    if (Writer.hasBufferedWrite())
+      DataPoll.schedule(
+        Writer.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+    // The program reading the input might have changed how the terminal
+    // handles it since the previous keystroke.
+    if (R.ok())
+      requestInputModeCheck(*S);
+  }
+
+  return !Data.empty();
+}
+
+void Server::exitCallback(ClientData& Client)
+{
+  LOG(info) << "Client \"" << Client.id() << "\" exited";
+
+  // Detaching moves the data connection back to the main event loop, so it
+  // must happen before the connection is unregistered.
+  if (SessionData* S = Client.getAttachedSession())
+    clientDetachedCallback(Client, *S);
+  clientUnwatchAll(Client);
+
+  if (const auto* DS = Client.getDataSocket())
+  {
+    Reactor* R = reactorOf(Client);
+    pollOf(R).stop(DS->raw());
+    lookupOf(R).erase(DS->raw());
+    if (EventTrace* T = traceOf(R))
+      T->connection(EventTrace::Close, DS->raw(), EventTrace::ClientDataRole);
+  }
+
+  Poll->stop(Client.getControlSocket().raw());
+  FDLookup.erase(Client.getControlSocket().raw());
+
+  removeClient(Client);
+}
+
+void Server::createCallback(SessionData& Session)
+{
+  LOG(info) << "Session \"" << Session.name() << "\" created";
+  if (Session.hasProcess() && Session.getProcess().hasPty())
+  {
+    raw_fd FD = Session.getIdentifyingFD();
+
+    if (!Reactors.empty())
+    {
+      // Assign the session to the least busy reactor.
+      std::size_t Index = 0;
+      for (std::size_t I = 1; I < Reactors.size(); ++I)
+        if (Reactors.at(I)->SessionCount < Reactors.at(Index)->SessionCount)
+          Index = I;
+      Session.setReactor(Index);
+      ++Reactors.at(Index)->SessionCount;
+      LOG(debug) << "Session \"" << Session.name() << "\" handled by reactor #"
+                 << Index;
+    }
+
+    Reactor* R = reactorOf(Session);
+    // The terminal is read by the event queue itself, if it can.
+    if (pollOf(R).startQueuedReads(FD))
+      Session.getReader()->readThrough(&pollOf(R));
+    const LookupEntry Entity = SessionConnection{&Session};
+    pollOf(R).listen(FD,
+                     /* Incoming =*/true,
+                     /* Outgoing =*/EdgeTriggered,
+                     EdgeTriggered,
+                     Entity.getOpaqueValue());
+    lookupOf(R)[FD] = Entity;
+    if (EventTrace* T = traceOf(R))
+      T->connection(EventTrace::Open, FD, EventTrace::SessionRole);
+
+    if (SessionLogSize)
+    {
+      try
+      {
+        std::string LogBase = Sock.identifier();
+        if (Sock.transport() != Socket::Transport::Unix)
+          // (Network addresses are not in the file system, so the logs are
+          // placed where the socket would be by default.)
+          LogBase = SocketPath::defaultSocketPath().Path + '/' +
+                    sanitiseFileName(LogBase);
+        Session.setLog(LogBase + '.' + sanitiseFileName(Session.name()),
+                       SessionLogSize);
+      }
+      catch (const std::system_error& Err)
+      {
+        LOG(error) << "Session \"" << Session.name()
+                   << "\": failed to create output log: " << Err.what();
+      }
+    }
+    if (!Session.getLog() && ScrollbackSize)
+      Session.setScrollback(ScrollbackSize);
+    if (ScreenSnapshot)
+      Session.setScreen();
+    startRecording(Session);
+
+    if (Coalescing.enabled())
+    {
+      Session.setCoalescing(Coalescing);
+      raw_fd TimerFD = Session.getCoalescer()->timerFD();
+      const LookupEntry Timer = SessionTimerConnection{&Session};
+      pollOf(R).listen(TimerFD,
+                       /* Incoming =*/true,
+                       /* Outgoing =*/false,
+                       EdgeTriggered,
+                       Timer.getOpaqueValue());
+      lookupOf(R)[TimerFD] = Timer;
+    }
+    if (Throttling.enabled())
+    {
+      Session.setThrottle(Throttling);
+      raw_fd TimerFD = Session.getThrottle()->timerFD();
+      const LookupEntry Timer = SessionTimerConnection{&Session};
+      pollOf(R).listen(TimerFD,
+                       /* Incoming =*/true,
+                       /* Outgoing =*/false,
+                       EdgeTriggered,
+                       Timer.getOpaqueValue());
+      lookupOf(R)[TimerFD] = Timer;
+    }
+  }
+
+  notifySessionChange(Session, message::notification::SessionChange::Created);
+}
+
+std::size_t Server::spliceDataToClient(SessionData& Session, ClientData& Client)
+{
+  // The size of a pipe's buffer by default.
+  static constexpr std::size_t RelaySize = 1 << 16;
+
+  EPoll& DataPoll = pollOf(reactorOf(Session));
+  Pipe& Reader = *Session.getReader();
+  Socket* DS = Client.getDataSocket();
+  if (!DS || Client.multiplexed() || Reader.hasBufferedRead() ||
+      DS->hasBufferedWrite() || DS->writesQueued())
+    // Data that is already buffered (or handed to the event queue) must be
+    // sent first, in order. (The data of multiplexed connections must be
+    // framed.)
+    return 0;
+
+  Pipe::AnonymousPipe& Relay = Session.getRelayPipe();
+  std::size_t Bytes;
+  try
+  {
+    bool Continue;
+    Bytes = Pipe::splice(
+      Reader.raw(), Relay.getWrite()->raw(), RelaySize, Continue);
+  }
+  catch (const std::system_error& Err)
+  {
+    if (Err.code() == std::errc::invalid_argument)
+    {
+      LOG(warn) << "Session \"" << Session.name()
+                << "\": splice() is not supported, disabling relay: "
+                << Err.what();
+      SpliceRelay.store(false, std::memory_order_relaxed);
+    }
+    // Let the normal read path handle (and report) the error.
+    return 0;
+  }
+  if (!Bytes)
+    return 0;
+
+  Session.activity();
+  MONOMUX_TRACE_LOG(LOG(data) << "Session \"" << Session.name()
+                              << "\" relaying " << Bytes << " bytes");
+
+  std::size_t Sent = 0;
+  try
+  {
+    bool Continue = true;
+    while (Continue && Sent < Bytes)
+      Sent += Pipe::splice(
+        Relay.getRead()->raw(), DS->raw(), Bytes - Sent, Continue);
+    Session.metrics().SplicedBytes.add(Sent);
+  }
+  catch (const std::system_error& Err)
+  {
+    MONOMUX_TRACE_LOG(LOG(trace) << "Session \"" << Session.name()
+                                 << "\": relay to client \"" << Client.id()
+                                 << "\" failed: " << Err.what());
+  }
+  if (Sent == Bytes)
+    return Bytes;
+
+  // The socket pushed back. Take the rest of the data out of the relay pipe,
+  // and let the client's buffer handle it.
+  Pipe& RelayRead = *Relay.getRead();
+  BufferedChannel::Result R;
+  while (R.ok() && Sent < Bytes)
+  {
+    std::string_view Rest;
+    R = RelayRead.tryPeek(Bytes - Sent, Rest);
+    if (!R.ok() || Rest.empty())
+      break;
+    R = DS->tryWrite(Rest);
+    RelayRead.consume(Rest.size());
+    Sent += Rest.size();
+  }
+  if (R.overflow())
+  {
+    clientFailed(Client,
+                 "Overflow when sending, " +
+                   std::to_string(DS->writeInBuffer()) +
+                   " bytes already pending");
+    return Bytes;
+  }
+  if (R.failed())
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when sending DATA to attached client \""
+               << Client.id() << "\": " << R.Error.message();
+
+    if (DS->failed())
+    {
+      // We realise the client disconnected during an attempt to send.
+      clientFailed(Client, {});
+      return Bytes;
+    }
+  }
+
+  if (!EdgeTriggered && DS->hasBufferedWrite())
+    DataPoll.schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  return Bytes;
+}
+
+/// Holds back (or releases) the output written to the data connections of the
+/// clients attached to \p Session, if they are over TCP.
+static void corkAttachedClients(SessionData& Session, bool Cork)
+{
+  for (Socket* DS : Session.getFanOut().Channels)
+    if (DS)
+    {
+      if (Cork)
+        DS->cork();
+      else
+        DS->uncork();
+    }
+}
+
+void Server::dataCallback(SessionData& Session)
+{
+  wakeSession(Session);
+  if (!EdgeTriggered)
+  {
+    relaySessionData(Session);
+    return;
+  }
+
+  // In edge-triggered mode, there will be no new event for the session until
+  // it is drained. The chunks relayed meanwhile are sent over the network in
+  // full packets.
+  corkAttachedClients(Session, true);
+  bool Drained = false;
+  for (std::size_t Relayed = 0; Relayed < SessionOutputQuota;)
+  {
+    const std::size_t Bytes = relaySessionData(Session);
+    if (!Bytes)
+    {
+      Drained = true;
+      break;
+    }
+    Relayed += Bytes;
+  }
+  corkAttachedClients(Session, false);
+  if (Drained)
+    return;
+  pollOf(reactorOf(Session))
+    .schedule(Session.getIdentifyingFD(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false);
+}
+
+std::size_t Server::relaySessionData(SessionData& Session)
+{
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Session \"" << Session.name() << "\" sent DATA!");
+  if (Session.readingPaused())
+    // (An event might have been scheduled before the reading was paused.)
+    return 0;
+  // (The data read by the event queue is already copied out of the kernel.)
+  if (SpliceRelay.load(std::memory_order_relaxed) &&
+      !Session.getReader()->readsQueued() && !Session.recordsOutput() &&
+      Session.getAttachedClients().size() == 1 &&
+      !Session.getAttachedClients().front()->compressed() &&
+      !Session.getAttachedClients().front()->ringSlot() &&
+      !Session.getAttachedClients().front()->watching() &&
+      Session.getPendingOutput().empty())
+    if (std::size_t Bytes =
+          spliceDataToClient(Session, *Session.getAttachedClients().front()))
+    {
+      throttleSession(Session, Bytes);
+      return Bytes;
+    }
+
+  EPoll& DataPoll = pollOf(reactorOf(Session));
+  Pipe& Reader = *Session.getReader();
+  std::string_view Data;
+  if (BufferedChannel::Result R =
+        Reader.tryPeek(Reader.optimalReadSize(), Data);
+      R.failed())
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when reading DATA: " << R.Error.message();
+    return 0;
+  }
+
+  Session.activity();
+  MONOMUX_TRACE_LOG(LOG(data)
+                    << "Session \"" << Session.name() << "\" data: " << Data);
+
+  if (OutputCoalescer* C = Session.getCoalescer())
+  {
+    std::string& Pending = Session.getPendingOutput();
+    Pending.append(Data);
+    if (C->shouldWrite(Pending.size()))
+    {
+      sendSessionOutput(Session, Pending);
+      Pending.clear();
+    }
+  }
+  else
+    sendSessionOutput(Session, Data);
+  updateSessionFlow(Session);
+
+  const std::size_t Bytes = Data.size();
+  Reader.consume(Bytes);
+  throttleSession(Session, Bytes);
+  if (!EdgeTriggered && Reader.hasBufferedRead())
+    DataPoll.schedule(Session.getIdentifyingFD(),
+                      /* Incoming =*/true,
+                      /* Outgoing =*/false);
+  return Bytes;
+}
+
+void Server::startRecording(SessionData& Session)
+{
+  if (RecordDirectory.empty() ||
+      ::fnmatch(RecordPattern.c_str(), Session.name().c_str(), 0) != 0)
+    return;
+
+  // Until a client resizes the session, its terminal is of the usual size.
+  WindowSize Size{24, 80};
+  if (Session.getResize().Applied)
+    Size = *Session.getResize().Applied;
+  const std::string Path =
+    RecordDirectory + '/' + sanitiseFileName(Session.name()) + '-' +
+    std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count()) +
+    ".cast";
+  try
+  {
+    if (!Recordings)
+      Recordings = std::make_unique<Recorder>();
+    Session.setRecording(
+      Recordings->start(Path, Size.Rows, Size.Columns, Session.name()));
+    LOG(info) << "Session \"" << Session.name() << "\" recorded to '" << Path
+              << '\'';
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": failed to start recording: " << Err.what();
+  }
+}
+
+void Server::recordOutput(SessionData& Session, std::string_view Data)
+{
+  if (Recording* Rec = Session.getRecording())
+    // (If the recording falls behind, the output is dropped from it.)
+    Rec->output(Data);
+  if (SessionLog* Log = Session.getLog())
+  {
+    try
+    {
+      Log->append(Data);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Session \"" << Session.name()
+                 << "\": failed to write output log: " << Err.what();
+    }
+  }
+  else if (Scrollback* History = Session.getScrollback())
+    History->append(Data);
+  if (ScreenState* Screen = Session.getScreen())
+    Screen->feed(Data);
+}
+
+/// Frames \p Data as the output of the session watched with \p Tag.
+///
+/// \warning The returned view points into the send buffer of the thread, see
+/// \p message::detail::sendBuffer().
+static std::string_view sessionFrame(std::uint32_t Tag, std::string_view Data)
+{
+  char Header[message::SessionFrame::HeaderSize];
+  message::SessionFrame::encodeHeader(
+    Header, Tag, static_cast<std::uint32_t>(Data.size()));
+  std::string& Buffer = message::detail::sendBuffer();
+  Buffer.append(Header, sizeof(Header));
+  Buffer.append(Data);
+  return Buffer;
+}
+
+void Server::sendSessionOutput(SessionData& Session, std::string_view Data)
+{
+  if (Data.empty())
+    return;
+  recordOutput(Session, Data);
+  publishSessionOutput(Session, Data);
+
+  EPoll& DataPoll = pollOf(reactorOf(Session));
+
+  // If every interactive client is saturated, the data is still buffered for
+  // them, and the reading of the session will be paused. Otherwise, the
+  // saturated clients miss the data, and they will be sent a redraw later.
+  // Viewers never hold the session back.
+  const bool AllSaturated = driversSaturated(Session);
+
+  const SessionData::FanOut& Targets = Session.getFanOut();
+  const std::vector<ClientData*>& Clients = Session.getAttachedClients();
+
+  // The output is compressed once, for every client that asked for it.
+  // (The clients reading the shared ring are already served, and the clients
+  // watching the session are sent the output framed.)
+  std::size_t CompressedClients = 0;
+  std::size_t PlainClients = 0;
+  for (std::uint8_t Flags : Targets.Flags)
+    if (!(Flags &
+          (SessionData::FanOut::SharedRing | SessionData::FanOut::Tagged)))
+    {
+      CompressedClients += (Flags & SessionData::FanOut::Compressed) != 0;
+      PlainClients += (Flags & SessionData::FanOut::Compressed) == 0;
+    }
+  std::string_view CompressedData;
+  if (CompressedClients)
+    CompressedData = Session.getCompressor().compress(Data);
+
+  // If there are multiple clients, the same chunk is shared between all of
+  // them, and only referenced by those that could not send it in full.
+  // Otherwise, the data is sent directly from the read buffer.
+  SharedChunk SharedData;
+  SharedChunk SharedCompressedData;
+  if (PlainClients > 1)
+    SharedData = SharedChunk{std::string{Data}};
+  if (CompressedClients > 1)
+    SharedCompressedData = SharedChunk{std::string{CompressedData}};
+
+  // The interactive clients are served first, so the latency of the typing
+  // client does not depend on how many are watching.
+  for (const bool Viewers : {false, true})
+    for (std::size_t I = 0; I < Targets.Channels.size(); ++I)
+    {
+      Socket* DS = Targets.Channels[I];
+      const std::uint8_t Flags = Targets.Flags[I];
+      if (!DS || ((Flags & SessionData::FanOut::ReadOnly) != 0) != Viewers ||
+          (Flags & (SessionData::FanOut::OutputDropped |
+                    SessionData::FanOut::SharedRing)))
+        continue;
+      ClientData* C = Clients[I];
+      if ((!AllSaturated || Viewers) && channelSaturated(*DS))
+      {
+        LOG(debug) << "Session \"" << Session.name() << "\": client \""
+                   << C->id() << "\" can not keep up, dropping output";
+        C->setOutputDropped(true);
+        continue;
+      }
+      // Without reactors, a failed client is detached right away, and the
+      // clients after it are shifted down to its index. (Wraps around at
+      // 0, which the increment of the loop undoes.)
+      const auto SkipIfDetached = [&Clients, &I, C] {
+        if (I >= Clients.size() || Clients[I] != C)
+          --I;
+      };
+
+      BufferedChannel::Result R;
+      if (Flags & SessionData::FanOut::Tagged)
+        R = DS->tryWrite(sessionFrame(Targets.Tags[I], Data));
+      else if (Flags & SessionData::FanOut::Compressed)
+        R = SharedCompressedData.empty() ? DS->tryWrite(CompressedData)
+                                         : DS->tryWrite(SharedCompressedData);
+      else
+        R = SharedData.empty() ? DS->tryWrite(Data) : DS->tryWrite(SharedData);
+
+      if (R.overflow())
+      {
+        // This is the part that can usually hang if there is too much data
+        // coming from the session that can't be sent to the clients in a
+        // timely manner.
+        clientFailed(*C,
+                     "Overflow when sending, " +
+                       std::to_string(DS->writeInBuffer()) +
+                       " bytes already pending");
+        SkipIfDetached();
+        continue;
+      }
+      if (R.failed())
+      {
+        LOG(error) << "Session \"" << Session.name()
+                   << "\": error when sending DATA to attached client \""
+                   << C->id() << "\": " << R.Error.message();
+
+        if (DS->failed())
+        {
+          // We realise the client disconnected during an attempt to send.
+          clientFailed(*C, {});
+          SkipIfDetached();
+          continue;
+        }
+      }
+
+      if (!EdgeTriggered && DS->hasBufferedWrite())
+        DataPoll.schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+    }
+}
+
+void Server::coalescingTimerCallback(SessionData& Session)
+{
+  OutputCoalescer* C = Session.getCoalescer();
+  if (!C)
+    return;
+
+  std::string& Pending = Session.getPendingOutput();
+  if (C->expired(Pending.size()))
+  {
+    sendSessionOutput(Session, Pending);
+    Pending.clear();
+    updateSessionFlow(Session);
+  }
+}
+
+void Server::throttleSession(SessionData& Session, std::size_t Bytes)
+{
+  OutputThrottle* T = Session.getThrottle();
+  if (!T || T->consumed(Bytes))
+    return;
+
+  Session.metrics().Throttles.add();
+  updateSessionFlow(Session);
+}
+
+void Server::throttleTimerCallback(SessionData& Session)
+{
+  OutputThrottle* T = Session.getThrottle();
+  if (!T || !T->throttled())
+    return;
+  if (T->expired())
+    updateSessionFlow(Session);
+}
+
+std::size_t Server::effectiveClientBufferLimit() const noexcept
+{
+  // Stay clear of the hard limit of the channel, the crossing of which would
+  // get the client kicked.
+  const std::size_t HardLimit = BufferedChannel::bufferSizeMax() / 2;
+  return ClientBufferLimit ? std::min(ClientBufferLimit, HardLimit)
+                           : HardLimit;
+}
+
+bool Server::channelSaturated(const Socket& DS) const noexcept
+{
+  return DS.writeInBuffer() >= effectiveClientBufferLimit() || DS.overBudget();
+}
+
+bool Server::clientSaturated(ClientData& Client) const noexcept
+{
+  if (Client.ringActive())
+    return false;
+  if (Client.outputDropped())
+    return true;
+  const Socket* DS = Client.getDataSocket();
+  return DS && channelSaturated(*DS);
+}
+
+bool Server::driversSaturated(SessionData& Session) const noexcept
+{
+  const SessionData::FanOut& Targets = Session.getFanOut();
+  bool AllSaturated = false;
+  for (std::size_t I = 0; I < Targets.Channels.size(); ++I)
+    if (Targets.Channels[I] &&
+        !(Targets.Flags[I] & SessionData::FanOut::ReadOnly))
+    {
+      // The shared ring never holds the session back.
+      if (Targets.Flags[I] & SessionData::FanOut::SharedRing)
+        return false;
+      AllSaturated = (Targets.Flags[I] & SessionData::FanOut::OutputDropped) ||
+                     channelSaturated(*Targets.Channels[I]);
+      if (!AllSaturated)
+        break;
+    }
+  return AllSaturated;
+}
+
+void Server::updateSessionFlow(SessionData& Session)
+{
+  if (!Session.getReader())
+    return;
+
+  const bool Throttled = Session.throttled();
+  const bool AllSaturated = driversSaturated(Session);
+  const bool Pause = AllSaturated || Throttled;
+  if (Pause == Session.readingPaused())
+    return;
+
+  Reactor* R = reactorOf(Session);
+  const raw_fd FD = Session.getIdentifyingFD();
+  if (!lookupOf(R).tryGet(FD))
+    // The session is being destroyed.
+    return;
+  EPoll& DataPoll = pollOf(R);
+  Session.setReadingPaused(Pause);
+  if (Pause)
+  {
+    // Once the buffer of the PTY fills up, the program in the session blocks
+    // until the clients catch up, or the rate limit allows reading again.
+    MONOMUX_TRACE_LOG(LOG(trace)
+                      << "Session \"" << Session.name() << "\": "
+                      << (Throttled ? "throttled" : "clients saturated")
+                      << ", pausing");
+    // Only the output is paused. The input of the clients, e.g., an interrupt
+    // sent to a runaway program, must still reach the terminal.
+    DataPoll.stop(FD);
+    DataPoll.listen(FD,
+                    /* Incoming =*/false,
+                    /* Outgoing =*/EdgeTriggered && !Session.hibernating(),
+                    EdgeTriggered,
+                    LookupEntry{SessionConnection{&Session}}.getOpaqueValue());
+    if (Session.getWriter()->hasBufferedWrite())
+      DataPoll.schedule(FD, /* Incoming =*/false, /* Outgoing =*/true);
+    return;
+  }
+
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Session \"" << Session.name() << "\": resuming");
+  DataPoll.stop(FD);
+  DataPoll.listen(FD,
+                  /* Incoming =*/true,
+                  /* Outgoing =*/EdgeTriggered && !Session.hibernating(),
+                  EdgeTriggered,
+                  LookupEntry{SessionConnection{&Session}}.getOpaqueValue());
+  if (Session.getReader()->hasBufferedRead())
+    DataPoll.schedule(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  if (Session.getWriter()->hasBufferedWrite())
+    DataPoll.schedule(FD, /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+bool Server::shouldHibernate(SessionData& Session) const
+{
+  if (!HibernateAfter.count() || Session.hibernating() ||
+      !Session.getAttachedClients().empty())
+    return false;
+  if (std::chrono::system_clock::now() - Session.lastActive() < HibernateAfter)
+    return false;
+
+  // Data still waiting to be relayed keeps the session awake.
+  Pipe* R = Session.getReader();
+  Pipe* W = Session.getWriter();
+  return R && W && !R->hasBufferedRead() && !W->hasBufferedWrite() &&
+         Session.getPendingOutput().empty();
+}
+
+void Server::hibernateSession(SessionData& Session)
+{
+  Pipe& R = *Session.getReader();
+  Pipe& W = *Session.getWriter();
+  std::size_t Released = R.allocatedBufferBytes() + W.allocatedBufferBytes();
+  R.releaseBuffers();
+  W.releaseBuffers();
+  Session.releaseRelayResources();
+  if (Scrollback* History = Session.getScrollback())
+    try
+    {
+      Released += History->spill(SpillDirectory);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(warn) << "Session \"" << Session.name()
+                << "\": failed to save scrollback: " << Err.what();
+    }
+
+  Session.setHibernating(true);
+  if (EdgeTriggered)
+  {
+    // Nothing is written to the session until a client attaches, so the
+    // terminal need not be listened for being writable.
+    const raw_fd FD = Session.getIdentifyingFD();
+    EPoll& DataPoll = pollOf(reactorOf(Session));
+    DataPoll.stop(FD);
+    DataPoll.listen(FD,
+                    /* Incoming =*/!Session.readingPaused(),
+                    /* Outgoing =*/false,
+                    EdgeTriggered,
+                    LookupEntry{SessionConnection{&Session}}.getOpaqueValue());
+  }
+  LOG(debug) << "Session \"" << Session.name() << "\" hibernating, released "
+             << Released << " bytes";
+}
+
+void Server::wakeSession(SessionData& Session)
+{
+  if (!Session.hibernating())
+    return;
+
+  Session.setHibernating(false);
+  if (EdgeTriggered)
+  {
+    const raw_fd FD = Session.getIdentifyingFD();
+    EPoll& DataPoll = pollOf(reactorOf(Session));
+    DataPoll.stop(FD);
+    DataPoll.listen(FD,
+                    /* Incoming =*/!Session.readingPaused(),
+                    /* Outgoing =*/true,
+                    EdgeTriggered,
+                    LookupEntry{SessionConnection{&Session}}.getOpaqueValue());
+  }
+  LOG(debug) << "Session \"" << Session.name() << "\" woke up";
+}
+
+/// Calls \p F with the session \p Client is attached to, or with each session
+/// it watches.
+template <typename Fn> static void forEachSessionOf(ClientData& Client, Fn&& F)
+{
+  if (SessionData* S = Client.getAttachedSession())
+  {
+    F(*S);
+    return;
+  }
+  // (The list is copied, as the callback might stop watching.)
+  std::vector<ClientData::WatchedSession> Watched = Client.watchedSessions();
+  for (const ClientData::WatchedSession& W : Watched)
+    F(*W.Session);
+}
+
+void Server::clientDrained(ClientData& Client)
+{
+  Socket* DS = Client.getDataSocket();
+  if ((!Client.getAttachedSession() && !Client.watching()) || !DS)
+    return;
+
+  if (Client.outputDropped() &&
+      DS->writeInBuffer() <= effectiveClientBufferLimit() / 2 &&
+      !DS->overBudget())
+  {
+    Client.setOutputDropped(false);
+    forEachSessionOf(Client, [this, &Client](SessionData& Session) {
+      // The client missed some output, so the screen it shows is likely
+      // broken.
+      LOG(debug) << "Client \"" << Client.id()
+                 << "\" caught up, requesting redraw of \"" << Session.name()
+                 << '"';
+      // A viewer is sent the current screen instead, so the program is not
+      // disturbed on behalf of someone who is only watching.
+      if (!(Client.readOnly() && replayScrollback(Client, Session)) &&
+          Session.hasProcess())
+        Session.getProcess().signal(SIGWINCH);
+    });
+  }
+  activateSharedRing(Client);
+  forEachSessionOf(
+    Client, [this](SessionData& Session) { updateSessionFlow(Session); });
+}
+
+bool Server::attachSharedRing(ClientData& Client, SessionData& Session)
+{
+  if (!SharedRingSize || !Client.sharedRing() ||
+      Client.getAttachedSession() != &Session)
+    return false;
+
+  std::optional<std::size_t> Slot;
+  fd Wakeup;
+  try
+  {
+    Slot = Session.acquireRingSlot(SharedRingSize);
+    if (Slot)
+      Wakeup = SharedRing::makeWakeup();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": failed to set up shared ring: " << Err.what();
+    if (Slot)
+      Session.releaseRingSlot(*Slot);
+    return false;
+  }
+  if (!Slot)
+  {
+    LOG(debug) << "Session \"" << Session.name()
+               << "\": shared ring has no free slot for client \""
+               << Client.id() << '"';
+    return false;
+  }
+
+  Client.attachRing(*Slot, std::move(Wakeup));
+  return true;
+}
+
+void Server::activateSharedRing(ClientData& Client)
+{
+  SessionData* Session = Client.getAttachedSession();
+  if (!Session || !Client.ringSlot() || Client.ringActive())
+    return;
+  // Everything written to the data connection before must be read by the
+  // client before what is published in the ring from now on.
+  const Socket* DS = Client.getDataSocket();
+  if (DS && DS->hasBufferedWrite())
+    return;
+
+  LOG(debug) << "Client \"" << Client.id() << "\": reading \""
+             << Session->name() << "\" from the shared ring";
+  Session->getRing()->activate(*Client.ringSlot());
+  Client.activateRing();
+}
+
+void Server::detachSharedRing(ClientData& Client, SessionData& Session)
+{
+  if (!Client.ringSlot())
+    return;
+  Session.releaseRingSlot(*Client.ringSlot());
+  Client.detachRing();
+}
+
+void Server::publishSessionOutput(SessionData& Session, std::string_view Data)
+{
+  SharedRing* Ring = Session.getRing();
+  if (!Ring)
+    return;
+  Ring->publish(Data);
+
+  // Only the readers that went to sleep are woken up.
+  const SessionData::FanOut& Targets = Session.getFanOut();
+  const std::vector<ClientData*>& Clients = Session.getAttachedClients();
+  for (std::size_t I = 0; I < Targets.Flags.size(); ++I)
+    if ((Targets.Flags[I] & SessionData::FanOut::SharedRing) &&
+        Ring->takeReaderWaiting(*Clients[I]->ringSlot()))
+      SharedRing::wake(Clients[I]->ringWakeup());
+}
+
+void Server::clientAttachedCallback(ClientData& Client, SessionData& Session)
+{
+  LOG(info) << "Client \"" << Client.id() << "\" attached to \""
+            << Session.name() << '"';
+  if (Client.getDataSocket())
+    moveDataSocket(Client, reactorOf(Client), reactorOf(Session));
+  Client.attachToSession(Session);
+  Session.attachClient(Client);
+  if (EventTrace* T = traceOf(reactorOf(Session));
+      T && Client.getDataSocket())
+    T->attachment(EventTrace::Attach,
+                  Client.getDataSocket()->raw(),
+                  Session.getIdentifyingFD());
+  wakeSession(Session);
+  // A new client can accept output even if the others are saturated.
+  updateSessionFlow(Session);
+  notifySessionChange(Session,
+                      message::notification::SessionChange::Attachment);
+}
+
+bool Server::clientWatchCallback(ClientData& Client, SessionData& Session)
+{
+  if (Client.watching() && reactorOf(Client) != reactorOf(Session))
+  {
+    // The data connection of the client can only be served by one reactor.
+    LOG(warn) << "Client \"" << Client.id() << "\" can not watch \""
+              << Session.name() << "\" on another reactor";
+    return false;
+  }
+
+  LOG(info) << "Client \"" << Client.id() << "\" watching \""
+            << Session.name() << '"';
+  if (!Client.watching() && Client.getDataSocket())
+    moveDataSocket(Client, nullptr, reactorOf(Session));
+  Client.watch(Session);
+  Client.setReadOnly(true);
+  Session.attachClient(Client);
+  wakeSession(Session);
+  updateSessionFlow(Session);
+  notifySessionChange(Session,
+                      message::notification::SessionChange::Attachment);
+  return true;
+}
+
+void Server::clientUnwatchCallback(ClientData& Client, SessionData& Session)
+{
+  const std::optional<std::uint32_t> Tag = Client.watchTag(Session);
+  if (!Tag)
+    return;
+  LOG(info) << "Client \"" << Client.id() << "\" stopped watching \""
+            << Session.name() << '"';
+  Reactor* R = reactorOf(Session);
+  if (Socket* DS = Client.getDataSocket())
+  {
+    // An empty frame tells the client that no more output of the session
+    // follows.
+    const BufferedChannel::Result Written = DS->tryWrite(sessionFrame(*Tag, {}));
+    if (Written.ok() && !EdgeTriggered && DS->hasBufferedWrite())
+      pollOf(R).schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  }
+  Session.removeClient(Client);
+  Client.unwatch(Session);
+  if (!Client.watching())
+  {
+    Client.setReadOnly(false);
+    Client.setOutputDropped(false);
+    if (Client.getDataSocket())
+      moveDataSocket(Client, R, nullptr);
+  }
+  updateSessionFlow(Session);
+  notifySessionChange(Session,
+                      message::notification::SessionChange::Attachment);
+}
+
+void Server::clientUnwatchAll(ClientData& Client)
+{
+  while (Client.watching())
+    clientUnwatchCallback(Client, *Client.watchedSessions().back().Session);
+}
+
+std::string Server::recentOutput(SessionData& Session) const
+{
+  if (ScreenState* Screen = Session.getScreen())
+    return Screen->snapshot();
+  if (SessionLog* Log = Session.getLog())
+    return Log->tail(ScrollbackSize);
+  if (Scrollback* History = Session.getScrollback())
+    return History->tail();
+  return {};
+}
+
+bool Server::replayScrollback(ClientData& Client, SessionData& Session)
+{
+  Socket* DS = Client.getDataSocket();
+  if (!DS)
+    return false;
+
+  std::string Tail = recentOutput(Session);
+  if (Tail.empty())
+    return false;
+
+  LOG(debug) << "Client \"" << Client.id() << "\": replaying " << Tail.size()
+             << " bytes of \"" << Session.name() << "\"";
+  try
+  {
+    if (const std::optional<std::uint32_t> Tag = Client.watchTag(Session))
+      DS->write(sessionFrame(*Tag, Tail));
+    else if (Client.compressed())
+      // The chunks of the session's compressor are independent, so the replay
+      // can be compressed separately.
+      DS->write(Deflater{}.compress(Tail));
+    else
+      DS->write(Tail);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": error when replaying output: " << Err.what();
+    return false;
+  }
+  if (!EdgeTriggered && DS->hasBufferedWrite())
+    pollOf(reactorOf(Session))
+      .schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  return true;
+}
+
+void Server::clientDetachedCallback(ClientData& Client, SessionData& Session)
+{
+  if (Client.watchTag(Session))
+  {
+    clientUnwatchCallback(Client, Session);
+    return;
+  }
+  if (Client.getAttachedSession() != &Session)
+    return;
+  LOG(info) << "Client \"" << Client.id() << "\" detached from \""
+            << Session.name() << '"';
+  if (EventTrace* T = traceOf(reactorOf(Session));
+      T && Client.getDataSocket())
+    T->attachment(EventTrace::Detach,
+                  Client.getDataSocket()->raw(),
+                  Session.getIdentifyingFD());
+  if (Client.getDataSocket())
+    moveDataSocket(Client, reactorOf(Session), nullptr);
+  detachSharedRing(Client, Session);
+  Client.detachSession();
+  Client.setOutputDropped(false);
+  Client.setReadOnly(false);
+  Session.removeClient(Client);
+  // The remaining clients might be able to accept output.
+  updateSessionFlow(Session);
+  // ... or fit a larger terminal.
+  if (Resizing == ResizePolicy::Smallest &&
+      !Session.getAttachedClients().empty())
+    resizeSession(Session);
+  notifySessionChange(Session,
+                      message::notification::SessionChange::Attachment);
+}
+
+void Server::destroyCallback(SessionData& Session)
+{
+  LOG(info) << "Session \"" << Session.name() << "\" exited";
+  if (Session.hasProcess() && Session.getProcess().hasPty())
+  {
+    raw_fd FD = Session.getProcess().getPty()->raw();
+
+    Reactor* R = reactorOf(Session);
+    pollOf(R).stop(FD);
+    pollOf(R).stopQueuedReads(FD);
+    Session.getReader()->readThrough(nullptr);
+    lookupOf(R).erase(FD);
+    if (EventTrace* T = traceOf(R))
+      T->connection(EventTrace::Close, FD, EventTrace::SessionRole);
+    if (OutputCoalescer* C = Session.getCoalescer())
+    {
+      // The last output of the session must not be lost.
+      sendSessionOutput(Session, Session.getPendingOutput());
+      Session.getPendingOutput().clear();
+
+      pollOf(R).stop(C->timerFD());
+      lookupOf(R).erase(C->timerFD());
+    }
+    if (OutputThrottle* T = Session.getThrottle())
+    {
+      pollOf(R).stop(T->timerFD());
+      lookupOf(R).erase(T->timerFD());
+    }
+    if (R)
+      --R->SessionCount;
+  }
+
+  // The clients are detached (and the subscribers notified about it) first.
+  const std::string Name = Session.name();
+  const auto Created = Session.whenCreated();
+  removeSession(Session);
+
+  message::SessionData Gone;
+  Gone.Name = Name;
+  Gone.Created = std::chrono::system_clock::to_time_t(Created);
+  ++SessionGeneration;
+  message::notification::SessionChange Msg;
+  Msg.Change = message::notification::SessionChange::Destroyed;
+  Msg.Generation = SessionGeneration;
+  Msg.Session.Session = std::move(Gone);
+  broadcastSessionChange(Msg);
+}
+
+void Server::turnClientIntoDataOfOtherClient(ClientData& MainClient,
+                                             ClientData& DataClient)
+{
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Client \"" << DataClient.id()
+                    << "\" becoming the DATA connection for Client \""
+                    << MainClient.id() << '"');
+  MainClient.subjugateIntoDataSocket(DataClient);
+  // The connection was registered as a control connection.
+  Poll->stop(MainClient.getDataSocket()->raw());
+  listenOnDataSocket(MainClient);
+
+  // Remove the object from the owning data structure but do not fire the exit
+  // handler!
+  Clients.erase(DataClient.id());
+}
+
+void Server::attachDataSocket(ClientData& Client, fd&& Connection)
+{
+  MONOMUX_TRACE_LOG(LOG(trace) << "Client \"" << Client.id()
+                               << "\" passed its DATA connection "
+                               << Connection.get());
+  fd::setNonBlockingCloseOnExec(Connection);
+  Client.attachDataSocket(std::make_unique<Socket>(Socket::wrap(
+    std::move(Connection),
+    Client.getControlSocket().identifier() + "#data")));
+  listenOnDataSocket(Client);
+}
+
+void Server::multiplexClient(ClientData& Client)
+{
+  Socket& Control = Client.getControlSocket();
+  if (Control.hasBufferedWrite() || Control.hasBufferedRead())
+  {
+    // The unframed bytes would be mixed with the frames on the connection.
+    LOG(error) << "Client \"" << Client.id()
+               << "\": connection busy, could not multiplex it";
+    exitCallback(Client);
+    return;
+  }
+
+  // The connection remains registered as the control connection, and the
+  // events of the data stream are handled together with it.
+  Client.multiplex();
+  LOG(debug) << "Client \"" << Client.id() << "\" multiplexed its connection";
+}
+
+void Server::listenOnDataSocket(ClientData& Client)
+{
+  raw_fd DataFD = Client.getDataSocket()->raw();
+  const LookupEntry Entity = ClientDataConnection{&Client};
+  FDLookup[DataFD] = Entity;
+  Client.getDataSocket()->writeThrough(Poll.get());
+  Poll->listen(DataFD,
+               /* Incoming =*/true,
+               /* Outgoing =*/EdgeTriggered,
+               EdgeTriggered,
+               Entity.getOpaqueValue());
+  if (Trace)
+    Trace->connection(EventTrace::Open, DataFD, EventTrace::ClientDataRole);
+  if (Reactor* R = reactorOf(Client))
+    moveDataSocket(Client, nullptr, R);
+}
+
+void Server::reapDeadChildren()
 {
+  if (!ChildrenDied.exchange(false))
+    return;
 
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Client \"" << Client.id() << "\" sent DATA!");
-  Socket& DS = *Client.getDataSocket();
-  std::string Data;
-  try
+  for (std::atomic<Process::raw_handle>& Slot : DeadChildren)
   {
-    Data = DS.read(DS.optimalReadSize());
-  }
-  catch (const buffer_overflow& BO)
-  {
-    LOG(error) << "Client \"" << Client.id() << "\": error when reading DATA: "
-               << "\n\t" << BO.what();
-    sendKickClient(Client,
-                   "Overflow when reading connection, " +
-                     std::to_string(BO.channel().readInBuffer()) +
-                     " bytes already pending");
-    exitCallback(Client);
-    return;
+    Process::raw_handle PID = Slot.exchange(Process::Invalid);
+    if (PID != Process::Invalid)
+      reapDeadChild(PID);
   }
-  catch (const std::system_error& Err)
+
+  // SIGCHLD is not queued, so children that died together might have been
+  // reported only once, and the list might have been full. Look for any
+  // remaining dead child, without reaping it yet, so its exit code is kept.
+  while (true)
   {
-    LOG(error) << "Client \"" << Client.id()
-               << "\": error when reading DATA: " << Err.what();
-    return;
+    POD<::siginfo_t> Info;
+    if (::waitid(P_ALL, 0, &Info, WEXITED | WNOHANG | WNOWAIT) == -1 ||
+        Info->si_pid == 0)
+      break;
+
+    Process::raw_handle PID = Info->si_pid;
+    if (!reapDeadChild(PID))
+    {
+      LOG(debug) << "Reaping unknown child PID " << PID;
+      ::waitpid(PID, nullptr, WNOHANG);
+    }
+    else if (SessionsByPID.find(PID) != SessionsByPID.end())
+      // The session's process could not be reaped, do not spin on it.
+      break;
   }
+}
 
-  if (DS.failed())
+bool Server::reapDeadChild(Process::raw_handle PID)
+{
+  auto SessionForProc = SessionsByPID.find(PID);
+  if (SessionForProc == SessionsByPID.end())
+    return reapPooledSession(PID);
+  SessionData& Session = *SessionForProc->second;
+  Process& Proc = Session.getProcess();
+
+  bool Dead = Proc.reapIfDead();
+  if (Dead)
   {
-    // We realise the client disconnected during an attempt to read.
-    exitCallback(Client);
-    return;
+    auto Locks = lockReactors();
+    LOG(debug) << "Child PID " << PID << " of Session \"" << Session.name()
+               << "\" exited with " << Proc.exitCode();
+
+    for (ClientData* AC : Session.getAttachedClients())
+      if (AC->getAttachedSession() == &Session)
+        // (The clients watching the session are sent the end of its output.)
+        AC->sendDetachReason(monomux::message::notification::Detached::Exit,
+                             Proc.exitCode());
+    destroyCallback(Session);
   }
+  return true;
+}
 
-  if (DS.hasBufferedRead())
-    Poll->schedule(DS.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+void Server::clientResized(ClientData& Client, WindowSize Size)
+{
+  Client.setWindowSize(Size);
+  SessionData* Session = Client.getAttachedSession();
+  if (!Session || Client.readOnly())
+    // Viewers adapt to the size of the session, and never resize it.
+    return;
+  Session->getResize().Requested = Size;
+  resizeSession(*Session);
+}
 
-  Client.activity();
-  MONOMUX_TRACE_LOG(LOG(data)
-                    << "Client \"" << Client.id() << "\" data: " << Data);
+std::optional<WindowSize>
+Server::effectiveWindowSize(SessionData& Session) const
+{
+  if (Resizing == ResizePolicy::Latest)
+    return Session.getResize().Requested;
 
-  if (SessionData* S = Client.getAttachedSession())
-    try
-    {
-      S->getWriter()->write(Data);
-    }
-    catch (const buffer_overflow& BO)
+  std::optional<WindowSize> Size;
+  for (const ClientData* C : Session.getAttachedClients())
+  {
+    std::optional<WindowSize> CS = C->windowSize();
+    if (!CS || C->readOnly())
+      continue;
+    if (!Size)
+      Size = CS;
+    else
     {
-      LOG(trace) << "Session \"" << S->name()
-                 << "\" when relaying input from client \"" << Client.id()
-                 << "\"\n\t" << BO.what();
-      rescheduleOverflow(*Poll, BO);
+      Size->Rows = std::min(Size->Rows, CS->Rows);
+      Size->Columns = std::min(Size->Columns, CS->Columns);
     }
+  }
+  return Size;
 }
 
-void Server::exitCallback(ClientData& Client)
+void Server::resizeSession(SessionData& Session)
 {
-  LOG(info) << "Client \"" << Client.id() << "\" exited";
+  SessionData::ResizeState& RS = Session.getResize();
+  if (Timers.scheduled(RS.Timer))
+    // The size in effect when the timer fires will be set.
+    return;
 
-  if (const auto* DS = Client.getDataSocket())
+  const auto Deadline = RS.LastApplied + ResizeInterval;
+  if (TimerWheel::Clock::now() >= Deadline)
   {
-    Poll->stop(DS->raw());
-    FDLookup.erase(DS->raw());
+    applyWindowSize(Session);
+    return;
   }
 
-  Poll->stop(Client.getControlSocket().raw());
-  FDLookup.erase(Client.getControlSocket().raw());
-
-  removeClient(Client);
+  RS.Timer = Timers.schedule(Deadline, [this, &Session] {
+    // The timers run outside of the batches of events, when the reactors
+    // might be handling the session.
+    std::unique_lock<std::mutex> Lock;
+    if (Reactor* R = reactorOf(Session))
+      Lock = std::unique_lock<std::mutex>{R->Lock};
+    applyWindowSize(Session);
+  });
 }
 
-void Server::createCallback(SessionData& Session)
+void Server::applyWindowSize(SessionData& Session)
 {
-  LOG(info) << "Session \"" << Session.name() << "\" created";
-  if (Session.hasProcess() && Session.getProcess().hasPty())
-  {
-    raw_fd FD = Session.getIdentifyingFD();
+  SessionData::ResizeState& RS = Session.getResize();
+  std::optional<WindowSize> Size = effectiveWindowSize(Session);
+  if (!Size || Size == RS.Applied)
+    return;
 
-    Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
-    FDLookup[FD] = SessionConnection{&Session};
-  }
+  MONOMUX_TRACE_LOG(LOG(debug) << "Session \"" << Session.name()
+                               << "\" resized to rows=" << Size->Rows
+                               << ", columns=" << Size->Columns);
+  if (Session.hasProcess() && Session.getProcess().hasPty())
+    Session.getProcess().getPty()->setSize(Size->Rows, Size->Columns);
+  if (ScreenState* Screen = Session.getScreen())
+    Screen->resize(Size->Rows, Size->Columns);
+  if (Recording* Rec = Session.getRecording())
+    Rec->resize(Size->Rows, Size->Columns);
+  RS.Applied = Size;
+  RS.LastApplied = TimerWheel::Clock::now();
 }
 
-void Server::dataCallback(SessionData& Session)
+void Server::checkInputMode(SessionData& Session)
 {
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Session \"" << Session.name() << "\" sent DATA!");
-  std::string Data;
+  if (!Session.hasProcess() || !Session.getProcess().hasPty())
+    return;
+
+  Pty::InputMode Mode;
   try
   {
-    Data = Session.getReader()->read(Session.getReader()->optimalReadSize());
+    Mode = Session.getProcess().getPty()->getInputMode();
   }
-  catch (const buffer_overflow& BO)
+  catch (const std::system_error& Err)
   {
-    LOG(error) << "Session \"" << Session.name()
-               << "\": error when reading DATA: "
-               << "\n\t" << BO.what();
-    rescheduleOverflow(*Poll, BO);
+    LOG(debug) << "Session \"" << Session.name()
+               << "\": failed to query terminal mode: " << Err.what();
     return;
   }
-  catch (const std::system_error& Err)
+  if (Session.getInputMode() == Mode)
+    return;
+
+  MONOMUX_TRACE_LOG(LOG(debug)
+                    << "Session \"" << Session.name()
+                    << "\" terminal mode: echo=" << Mode.Echo
+                    << ", canonical=" << Mode.Canonical);
+  Session.setInputMode(Mode);
+  for (ClientData* C : Session.getAttachedClients())
+    if (C->getAttachedSession() == &Session)
+      sendInputMode(*C, Session);
+}
+
+void Server::requestInputModeCheck(SessionData& Session)
+{
+  if (!reactorOf(Session))
   {
-    LOG(error) << "Session \"" << Session.name()
-               << "\": error when reading DATA: " << Err.what();
+    checkInputMode(Session);
     return;
   }
 
-  if (Session.getReader()->hasBufferedRead())
-    Poll->schedule(Session.getIdentifyingFD(),
-                   /* Incoming =*/true,
-                   /* Outgoing =*/false);
+  {
+    std::lock_guard<std::mutex> Lock{DeferredModeChecksLock};
+    if (std::find(DeferredModeChecks.begin(),
+                  DeferredModeChecks.end(),
+                  Session.name()) != DeferredModeChecks.end())
+      return;
+    DeferredModeChecks.emplace_back(Session.name());
+  }
+  Poll->wake();
+}
 
-  Session.activity();
-  MONOMUX_TRACE_LOG(LOG(data)
-                    << "Session \"" << Session.name() << "\" data: " << Data);
+void Server::handleDeferredModeChecks()
+{
+  decltype(DeferredModeChecks) Checks;
+  {
+    std::lock_guard<std::mutex> Lock{DeferredModeChecksLock};
+    if (DeferredModeChecks.empty())
+      return;
+    Checks.swap(DeferredModeChecks);
+  }
 
-  for (ClientData* C : Session.getAttachedClients())
-    if (Socket* DS = C->getDataSocket())
-    {
-      try
-      {
-        DS->write(Data);
-      }
-      catch (const buffer_overflow& BO)
-      {
-        // This is the part that can usually hang if there is too much data
-        // coming from the session that can't be sent to the clients in a
-        // timely manner.
-        sendKickClient(*C,
-                       "Overflow when sending, " +
-                         std::to_string(BO.channel().writeInBuffer()) +
-                         " bytes already pending");
-        exitCallback(*C);
-        continue;
-      }
-      catch (const std::system_error& Err)
-      {
-        LOG(error) << "Session \"" << Session.name()
-                   << "\": error when sending DATA to attached client \""
-                   << C->id() << "\": " << Err.what();
+  auto Locks = lockReactors();
+  for (const std::string& Name : Checks)
+    if (SessionData* S = getSession(Name))
+      checkInputMode(*S);
+}
 
-        if (DS->failed())
-        {
-          // We realise the client disconnected during an attempt to send.
-          exitCallback(*C);
-          continue;
-        }
-      }
+void Server::sendInputMode(ClientData& Client, const SessionData& Session)
+{
+  const std::optional<Pty::InputMode>& Mode = Session.getInputMode();
+  if (!Mode)
+    return;
 
-      if (DS->hasBufferedWrite())
-        Poll->schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
-    }
+  message::notification::TerminalMode Msg;
+  Msg.Echo = Mode->Echo;
+  Msg.Canonical = Mode->Canonical;
+  try
+  {
+    message::sendMessage(Client.getControlSocket(), Msg, Client.wireFormat());
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": error when sending terminal mode: " << Err.what();
+  }
 }
 
-void Server::clientAttachedCallback(ClientData& Client, SessionData& Session)
+message::SessionStatus Server::sessionStatus(const SessionData& Session)
 {
-  LOG(info) << "Client \"" << Client.id() << "\" attached to \""
-            << Session.name() << '"';
-  Client.attachToSession(Session);
-  Session.attachClient(Client);
+  message::SessionStatus Status;
+  Status.Session.Name = Session.name();
+  Status.Session.Created =
+    std::chrono::system_clock::to_time_t(Session.whenCreated());
+  Status.AttachedClients = Session.getAttachedClients().size();
+  return Status;
 }
 
-void Server::clientDetachedCallback(ClientData& Client, SessionData& Session)
+void Server::setSessionSubscriber(ClientData& Client, bool Subscribed)
 {
-  if (Client.getAttachedSession() != &Session)
+  if (Client.sessionSubscriber() == Subscribed)
     return;
-  LOG(info) << "Client \"" << Client.id() << "\" detached from \""
-            << Session.name() << '"';
-  Client.detachSession();
-  Session.removeClient(Client);
+  Client.setSessionSubscriber(Subscribed);
+  if (Subscribed)
+    SessionSubscribers.push_back(Client.id());
+  else
+    SessionSubscribers.erase(std::remove(SessionSubscribers.begin(),
+                                         SessionSubscribers.end(),
+                                         Client.id()),
+                             SessionSubscribers.end());
 }
 
-void Server::destroyCallback(SessionData& Session)
+void Server::notifySessionChange(
+  const SessionData& Session,
+  message::notification::SessionChange::ChangeKind Change)
 {
-  LOG(info) << "Session \"" << Session.name() << "\" exited";
-  if (Session.hasProcess() && Session.getProcess().hasPty())
+  ++SessionGeneration;
+  if (SessionSubscribers.empty())
+    return;
+
+  message::notification::SessionChange Msg;
+  Msg.Change = Change;
+  Msg.Generation = SessionGeneration;
+  Msg.Session = sessionStatus(Session);
+  broadcastSessionChange(Msg);
+}
+
+void Server::broadcastSessionChange(
+  const message::notification::SessionChange& Msg)
+{
+  // Every subscriber gets the same message, so it is only encoded once for
+  // each wire format.
+  std::string Frames[2];
+  for (std::size_t ID : SessionSubscribers)
   {
-    raw_fd FD = Session.getProcess().getPty()->raw();
+    ClientData* C = getClient(ID);
+    if (!C)
+      continue;
 
-    Poll->stop(FD);
-    FDLookup.erase(FD);
+    const message::WireFormat Format = C->wireFormat();
+    std::string& Frame = Frames[static_cast<std::size_t>(Format)];
+    if (Frame.empty())
+      message::frameInto(Frame, Msg, Format, /* WithSize =*/true);
+
+    Socket& Control = C->getControlSocket();
+    BufferedChannel::Result R = Control.tryWrite(Frame);
+    if (R.failed())
+      LOG(error) << "Client \"" << C->id() << "\": error when sending "
+                 << "session change: " << R.Error.message();
+    else if (Control.hasBufferedWrite())
+      Poll->schedule(
+        Control.raw(), /* Incoming =*/false, /* Outgoing =*/true);
   }
-
-  removeSession(Session);
 }
 
-void Server::turnClientIntoDataOfOtherClient(ClientData& MainClient,
-                                             ClientData& DataClient)
+Process::SpawnOptions Server::pooledSessionOptions() const
 {
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Client \"" << DataClient.id()
-                    << "\" becoming the DATA connection for Client \""
-                    << MainClient.id() << '"');
-  MainClient.subjugateIntoDataSocket(DataClient);
-  FDLookup[MainClient.getDataSocket()->raw()] =
-    ClientDataConnection{&MainClient};
-
-  // Remove the object from the owning data structure but do not fire the exit
-  // handler!
-  Clients.erase(DataClient.id());
+  Process::SpawnOptions Opts;
+  Opts.CreatePTY = true;
+  Opts.Program = defaultShell();
+  Opts.Affinity = sessionAffinity();
+  return Opts;
 }
 
-void Server::reapDeadChildren()
+void Server::refillSessionPool()
 {
-  for (Process::raw_handle& PID : DeadChildren)
+  while (SessionPool.size() < SessionPoolSize)
   {
-    if (PID == Process::Invalid)
-      continue;
+    Process::SpawnOptions Opts = pooledSessionOptions();
+    if (Opts.Program.empty())
+      return;
 
-    auto SessionForProc =
-      std::find_if(Sessions.begin(), Sessions.end(), [PID](auto&& E) {
-        return E.second->hasProcess() && E.second->getProcess().raw() == PID;
-      });
-    if (SessionForProc == Sessions.end())
-      continue;
-    Process& Proc = SessionForProc->second->getProcess();
+    MonomuxSession MS;
+    // A session might have been created with the name of the alias.
+    do
+      MS.SessionName = "pool-" + std::to_string(++SessionPoolSpawned);
+    while (getSession(MS.SessionName));
+    MS.Socket = SocketPath::absolutise(Sock.identifier());
+    for (std::pair<std::string, std::string> BuiltinEnvVar : MS.createEnvVars())
+      Opts.Environment[std::move(BuiltinEnvVar.first)] =
+        std::move(BuiltinEnvVar.second);
 
-    bool Dead = Proc.reapIfDead();
-    if (Dead)
+    try
     {
-      LOG(debug) << "Child PID " << PID << " of Session \""
-                 << SessionForProc->second->name() << "\" exited with "
-                 << Proc.exitCode();
-
-      for (ClientData* AC : SessionForProc->second->getAttachedClients())
-        AC->sendDetachReason(monomux::message::notification::Detached::Exit,
-                             Proc.exitCode());
-      destroyCallback(*SessionForProc->second);
+      Process P = Process::spawn(Opts);
+      LOG(debug) << "Started PID " << P.raw() << " in advance as session \""
+                 << MS.SessionName << '"';
+      SessionPool.push_back(PooledSession{std::move(MS.SessionName),
+                                          std::move(P)});
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Starting a session in advance failed: " << Err.what();
+      return;
     }
-
-    PID = Process::Invalid;
   }
 }
 
-std::string Server::statistics() const
+void Server::scheduleSessionPoolRefill(std::chrono::milliseconds After)
 {
-  std::ostringstream Output;
-  std::size_t IndentSize = 0;
-  const auto Indented = [&Output, &IndentSize]() -> std::ostringstream& {
-    Output << std::string(IndentSize, ' ');
-    return Output;
-  };
-  const auto Reindent = [&Indented](const std::string& S) {
-    std::string::size_type Pos1 = 0;
-    std::string::size_type Pos2 = S.find('\n');
+  if (Timers.scheduled(SessionPoolRefill))
+    return;
+  SessionPoolRefill = Timers.schedule(After, [this] { refillSessionPool(); });
+}
 
-    while (Pos1 < S.size() && Pos2 < S.size() && Pos2 != std::string::npos)
-    {
-      Indented() << S.substr(Pos1, Pos2 - Pos1) << '\n';
-      Pos1 = Pos2 + 1;
-      Pos2 = S.find('\n', Pos1);
-    }
-  };
-  const auto AddIndent = [&IndentSize](const std::size_t Value) -> std::string {
-    IndentSize += Value;
-    return "";
-  };
-  const auto ResetIndent = [&IndentSize] { IndentSize = 0; };
-  /// Save the indentation state at the moment of constructing this instance,
-  /// and restore it when it is destroyed.
-  struct IndentRAII
-  {
-    std::size_t& OutVariable;
-    std::size_t SavedIndent;
+bool Server::isPooledAlias(std::string_view Name) const noexcept
+{
+  return std::any_of(
+    SessionPool.begin(), SessionPool.end(), [Name](const PooledSession& PS) {
+      return PS.Alias == Name;
+    });
+}
 
-    IndentRAII(std::size_t& Indent) : OutVariable(Indent), SavedIndent(Indent)
-    {}
-    ~IndentRAII() { OutVariable = SavedIndent; }
-  };
-  const auto IndentScope = [&IndentSize]() -> IndentRAII {
-    return {IndentSize};
-  };
+std::optional<Server::PooledSession>
+Server::takePooledSession(const Process::SpawnOptions& Opts)
+{
+  if (!SessionPoolSize || !Opts.Arguments.empty() ||
+      !Opts.Environment.empty() ||
+      Opts.Program != pooledSessionOptions().Program)
+    return std::nullopt;
 
-  const auto DumpOneClient =
-    [&Output, &AddIndent, &Indented, &Reindent, &IndentScope](
-      const ClientData& C) {
-      auto X = IndentScope();
-      Output << "Client " << '\'' << C.id() << '\'' << '\n';
-      AddIndent(2);
-      Indented() << "* Connected         : " << formatTime(C.whenCreated())
-                 << '\n';
-      Indented() << "* LastActive        : " << formatTime(C.lastActive())
-                 << '\n';
-
-      auto& Cl = const_cast<ClientData&>(C);
-      Indented() << "* Control Connection:" << '\n';
-      {
-        auto X = IndentScope();
-        AddIndent(4);
-        Reindent(Cl.getControlSocket().statistics());
-      }
+  std::optional<PooledSession> Taken;
+  while (!Taken && !SessionPool.empty())
+  {
+    PooledSession& PS = SessionPool.front();
+    // The process might have died, without its signal handled yet.
+    if (!PS.Proc.reapIfDead())
+      Taken.emplace(std::move(PS));
+    SessionPool.erase(SessionPool.begin());
+  }
+  // Starting the replacement should not delay the response to the client.
+  scheduleSessionPoolRefill(std::chrono::milliseconds{0});
+  return Taken;
+}
 
-      if (auto* DS = Cl.getDataSocket())
-      {
-        Indented() << "* Data    Connection:" << '\n';
+bool Server::reapPooledSession(Process::raw_handle PID)
+{
+  auto It = std::find_if(
+    SessionPool.begin(), SessionPool.end(), [PID](const PooledSession& PS) {
+      return PS.Proc.raw() == PID;
+    });
+  if (It == SessionPool.end())
+    return false;
 
-        auto X = IndentScope();
-        AddIndent(4);
-        Reindent(DS->statistics());
-      }
-    };
-
-  Output << "MonoMux Server Statistics\n";
-
-  AddIndent(2);
-  Indented() << "on " << '\'' << Sock.identifier() << '\'' << '\n';
-  Indented() << "started at " << formatTime(whenStarted()) << '\n';
-  AddIndent(2);
-  Output << '\n';
-  Indented() << "* Attached clients               : " << Clients.size() << '\n';
-  Indented() << "* Running sessions               : " << Sessions.size()
-             << '\n';
-  Indented() << "* Open file descriptors in total : " << FDLookup.size()
-             << '\n';
-
-  std::set<std::size_t> AlreadyDumpedAttachedClients;
-  Output << '\n'
-         << "- = - = - = - = -"
-         << "         Sessions        "
-         << "- = - = - = - = -" << '\n';
-  ResetIndent();
-  AddIndent(2);
-  for (const auto& E : Sessions)
+  if (It->Proc.reapIfDead())
   {
-    const SessionData& S = *E.second;
-    auto X = IndentScope();
+    LOG(debug) << "Process of session \"" << It->Alias
+               << "\" started in advance exited with " << It->Proc.exitCode();
+    SessionPool.erase(It);
+    // Do not spin on a program that exits right away.
+    scheduleSessionPoolRefill(std::chrono::seconds{1});
+  }
+  return true;
+}
 
-    Indented() << "# Session " << '\'' << S.name() << '\'' << '\n';
-    AddIndent(2);
-    Indented() << "* Created     : " << formatTime(S.whenCreated()) << '\n';
-    Indented() << "* LastActive  : " << formatTime(S.lastActive()) << '\n';
+message::response::Metrics Server::metrics() const
+{
+  using message::MetricTable;
+
+  /// Fills a table row by row. The names of the columns are taken from the
+  /// first row, so every row must add the same metrics in the same order.
+  struct TableBuilder
+  {
+    MetricTable& Table;
 
-    if (S.hasProcess())
+    void row(std::string Subject)
+    {
+      Table.Subjects.emplace_back(std::move(Subject));
+    }
+    void add(MetricTable::MetricKind Kind, std::string Name, std::uint64_t V)
     {
-      auto& P = const_cast<Process&>(S.getProcess());
-      Indented() << "* Running PID : " << P.raw() << '\n';
-      if (P.hasPty())
+      if (Table.Subjects.size() == 1)
       {
-        Indented() << "* Communication "
-                   << "reader" << '\n';
-        {
-          auto X = IndentScope();
-          AddIndent(4);
-          Reindent(P.getPty()->reader().statistics());
-        }
-        Indented() << "* Communication "
-                   << "writer" << '\n';
-        {
-          auto X = IndentScope();
-          AddIndent(4);
-          Reindent(P.getPty()->writer().statistics());
-        }
+        Table.Names.emplace_back(std::move(Name));
+        Table.Kinds.emplace_back(Kind);
       }
-      else
-        Indented() << "! Associated Process does not have a PTY\n";
+      Table.Values.emplace_back(V);
     }
-    else
-      Indented() << "! No process associated with Session\n";
+    void counter(std::string Name, std::uint64_t V)
+    {
+      add(MetricTable::Counter, std::move(Name), V);
+    }
+    void gauge(std::string Name, std::uint64_t V)
+    {
+      add(MetricTable::Gauge, std::move(Name), V);
+    }
+    /// Adds the counters of \p Channel, which might not exist, in which case
+    /// the columns are filled with zeros.
+    void channel(const std::string& Prefix, const BufferedChannel* Channel)
+    {
+      const BufferedChannel::Metrics* M =
+        Channel ? &Channel->metrics() : nullptr;
+      counter(Prefix + "bytes_read", M ? M->BytesRead.get() : 0);
+      counter(Prefix + "bytes_written", M ? M->BytesWritten.get() : 0);
+      counter(Prefix + "read_calls", M ? M->ReadCalls.get() : 0);
+      counter(Prefix + "write_calls", M ? M->WriteCalls.get() : 0);
+      counter(Prefix + "overflows", M ? M->Overflows.get() : 0);
+      gauge(Prefix + "read_buffer_bytes",
+            Channel && Channel->readable() ? Channel->readInBuffer() : 0);
+      gauge(Prefix + "write_buffer_bytes",
+            Channel && Channel->writable() ? Channel->writeInBuffer() : 0);
+      gauge(Prefix + "read_buffer_peak", M ? M->ReadBufferPeak.get() : 0);
+      gauge(Prefix + "write_buffer_peak", M ? M->WriteBufferPeak.get() : 0);
+    }
+  };
 
-    Indented() << "* Attached client #: " << S.getAttachedClients().size()
-               << '\n';
-    AddIndent(4);
-    for (const ClientData* C : S.getAttachedClients())
+  message::response::Metrics Result;
+  {
+    TableBuilder T{Result.Server};
+    T.row("server");
+    T.gauge("clients", Clients.size());
+    T.gauge("sessions", Sessions.size());
+    T.gauge("reactors", Reactors.size());
+    T.counter("clients_accepted", Stats.ClientsAccepted.get());
+    T.counter("clients_kicked", Stats.ClientsKicked.get());
+    T.gauge("buffered_bytes", BufferedChannel::globalBufferedBytes());
+    T.gauge("pooled_bytes", BufferPool::global().cachedBytes());
+    T.counter("pool_reuses", BufferPool::global().reuses());
+    T.counter("loop_iterations", Stats.LoopIterations.get());
+    // The latency is measured in microseconds.
+    for (std::size_t I = 0; I < Histogram::BucketCount; ++I)
+    {
+      std::string Bound = I < Histogram::BucketCount - 1
+                            ? std::to_string(Histogram::upperBound(I))
+                            : "inf";
+      T.add(MetricTable::Histogram,
+            "loop_latency_us_le_" + Bound,
+            Stats.LoopLatency.bucket(I));
+    }
+    T.add(
+      MetricTable::Histogram, "loop_latency_us_sum", Stats.LoopLatency.sum());
+    T.add(MetricTable::Histogram,
+          "loop_latency_us_count",
+          Stats.LoopLatency.count());
+  }
+  {
+    TableBuilder T{Result.Clients};
+    for (const auto& E : Clients)
+    {
+      auto& C = const_cast<ClientData&>(*E.second);
+      T.row(std::to_string(C.id()));
+      T.counter("control_messages", C.metrics().ControlMessages.get());
+      T.counter("output_drops", C.metrics().OutputDrops.get());
+      T.channel("control_", &C.getControlSocket());
+      T.channel("data_", C.getDataSocket());
+    }
+  }
+  {
+    TableBuilder T{Result.Sessions};
+    for (const auto& E : Sessions)
     {
-      Indented() << '*' << ' ';
-      DumpOneClient(*C);
-      AlreadyDumpedAttachedClients.emplace(C->id());
+      auto& S = const_cast<SessionData&>(*E.second);
+      T.row(S.name());
+      T.gauge("attached_clients", S.getAttachedClients().size());
+      T.counter("spliced_bytes", S.metrics().SplicedBytes.get());
+      T.counter("read_pauses", S.metrics().ReadPauses.get());
+      T.gauge("throttled", S.throttled());
+      T.counter("throttles", S.metrics().Throttles.get());
+      T.gauge("hibernating", S.hibernating());
+      T.counter("hibernations", S.metrics().Hibernations.get());
+      if (const Recording* Rec = S.getRecording())
+        T.counter("recording_drops", Rec->dropped());
+      T.channel("reader_", S.getReader());
+      T.channel("writer_", S.getWriter());
     }
   }
+  return Result;
+}
 
-  Output << '\n'
-         << "- = - = - = - = -"
-         << "   Unassociated Clients   "
-         << "- = - = - = - = -" << '\n';
-  ResetIndent();
-  AddIndent(2);
-  for (const auto& E : Clients)
+message::response::Usage Server::usage()
+{
+  UsageRequested = TimerWheel::Clock::now();
+  if (!Timers.scheduled(UsageSampling))
   {
-    const ClientData& C = *E.second;
-    if (AlreadyDumpedAttachedClients.find(C.id()) !=
-        AlreadyDumpedAttachedClients.end())
-      continue;
+    // Take the first sample right away, to have the numbers that are not
+    // rates to report.
+    UsageSampleInterval = std::chrono::milliseconds{0};
+    sampleUsage();
+  }
+
+  message::response::Usage Result;
+  Result.IntervalMs = UsageSampleInterval.count();
+  Result.Sessions.reserve(Sessions.size());
+  for (const auto& E : Sessions)
+  {
+    SessionData& S = *E.second;
+    const SessionData::UsageSample& U = S.getUsage();
+    message::SessionUsage SU;
+    SU.Name = S.name();
+    SU.PID = S.hasProcess() ? S.getProcess().raw() : Process::Invalid;
+    SU.OutputBytes = U.OutputBytes;
+    SU.OutputRate = U.OutputRate;
+    SU.CPUPermille = U.CPUPermille;
+    SU.RSSBytes = U.RSSBytes;
+    if (const Pipe* R = S.getReader())
+      SU.OutputBufferPeak = R->metrics().ReadBufferPeak.get();
+    if (const Pipe* W = S.getWriter())
+      SU.InputBytes = W->metrics().BytesWritten.get();
+
+    for (ClientData* C : S.getAttachedClients())
+    {
+      const Socket* DS = C->getDataSocket();
+      SU.Clients.emplace_back(C->id());
+      SU.ClientBufferedBytes.emplace_back(
+        DS && DS->writable() ? DS->writeInBuffer() : 0);
+    }
+    Result.Sessions.emplace_back(std::move(SU));
+  }
+  return Result;
+}
 
-    Indented() << '#' << ' ';
-    DumpOneClient(C);
+void Server::sampleUsage()
+{
+  const auto Now = TimerWheel::Clock::now();
+  for (auto& E : Sessions)
+  {
+    SessionData& S = *E.second;
+    SessionData::UsageSample& U = S.getUsage();
+    const bool HasPrevious =
+      U.When != TimerWheel::Clock::time_point{} && U.When < Now;
+    const auto Elapsed =
+      std::chrono::duration_cast<std::chrono::microseconds>(Now - U.When);
+
+    const Pipe* R = S.getReader();
+    const std::uint64_t OutputBytes = R ? R->metrics().BytesRead.get() : 0;
+    U.OutputRate = HasPrevious ? (OutputBytes - U.OutputBytes) * 1'000'000 /
+                                   Elapsed.count()
+                               : 0;
+    U.OutputBytes = OutputBytes;
+
+    std::optional<Process::ResourceUsage> PU;
+    if (S.hasProcess() && !S.getProcess().dead())
+      PU = Process::usage(S.getProcess().raw());
+    if (PU)
+    {
+      U.CPUPermille = HasPrevious && PU->CPUTime >= U.CPUTime
+                        ? (PU->CPUTime - U.CPUTime).count() * 1000 /
+                            Elapsed.count()
+                        : 0;
+      U.CPUTime = PU->CPUTime;
+      U.RSSBytes = PU->RSSBytes;
+    }
+    else
+    {
+      U.CPUPermille = 0;
+      U.RSSBytes = 0;
+    }
+    U.When = Now;
   }
 
-  return Output.str();
+  if (Now - UsageRequested >= UsageLinger)
+  {
+    // Nobody is looking, stop spending time on this until the next request.
+    for (auto& E : Sessions)
+      E.second->getUsage() = {};
+    return;
+  }
+  UsageSampling = Timers.schedule(UsageInterval, [this] {
+    UsageSampleInterval = UsageInterval;
+    sampleUsage();
+  });
 }
 
 } // namespace monomux::server
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <algorithm>
+#include <cassert>
 
 #include "monomux/server/ClientData.hpp"
 #include "monomux/system/Pipe.hpp"
@@ -45,6 +46,52 @@ raw_fd SessionData::getIdentifyingFD() const noexcept
   return P.getPty()->raw().get();
 }
 
+Pipe::AnonymousPipe& SessionData::getRelayPipe()
+{
+  if (!RelayPipe)
+  {
+    RelayPipe.emplace(Pipe::create());
+    RelayPipe->getRead()->setNonblocking();
+    RelayPipe->getWrite()->setNonblocking();
+  }
+  return *RelayPipe;
+}
+
+Deflater& SessionData::getCompressor()
+{
+  if (!Compressor)
+    Compressor.emplace();
+  return *Compressor;
+}
+
+std::optional<std::size_t> SessionData::acquireRingSlot(std::size_t Capacity)
+{
+  if (!Ring)
+    Ring.emplace(SharedRing::create(Capacity));
+  std::optional<std::size_t> Slot = Ring->acquire();
+  if (Slot)
+    ++RingReaders;
+  return Slot;
+}
+
+void SessionData::releaseRingSlot(std::size_t Slot) noexcept
+{
+  assert(Ring && RingReaders);
+  Ring->release(Slot);
+  if (!--RingReaders)
+    // (The readers keep their own mapping of the memory, as long as they
+    // need it.)
+    Ring.reset();
+}
+
+void SessionData::releaseRelayResources() noexcept
+{
+  RelayPipe.reset();
+  Compressor.reset();
+  if (PendingOutput.empty())
+    std::string{}.swap(PendingOutput);
+}
+
 ClientData* SessionData::getLatestClient() const
 {
   MONOMUX_TRACE_LOG(LOG(trace) << "Searching latest active client of \"" << Name
@@ -53,7 +100,8 @@ ClientData* SessionData::getLatestClient() const
   std::optional<decltype(std::declval<ClientData>().lastActive())> Time;
   for (ClientData* C : AttachedClients)
   {
-    if (!C->getDataSocket())
+    if (!C->getDataSocket() || C->getAttachedSession() != this)
+      // (Watchers are not attached to the session.)
       continue;
     MONOMUX_TRACE_LOG(LOG(data)
                       << "\tCandidate client \"" << C->id()
@@ -72,17 +120,56 @@ ClientData* SessionData::getLatestClient() const
   return R;
 }
 
+static std::uint8_t fanOutFlags(const ClientData& Client,
+                                std::optional<std::uint32_t> Tag) noexcept
+{
+  std::uint8_t Flags = 0;
+  if (Client.readOnly())
+    Flags |= SessionData::FanOut::ReadOnly;
+  if (Tag)
+    // The frames of the watched sessions are not compressed.
+    Flags |= SessionData::FanOut::Tagged;
+  else if (Client.compressed())
+    Flags |= SessionData::FanOut::Compressed;
+  if (Client.outputDropped())
+    Flags |= SessionData::FanOut::OutputDropped;
+  if (Client.ringActive())
+    Flags |= SessionData::FanOut::SharedRing;
+  return Flags;
+}
+
 void SessionData::attachClient(ClientData& Client)
 {
+  Targets.Channels.reserve(AttachedClients.size() + 1);
+  Targets.Flags.reserve(AttachedClients.size() + 1);
+  Targets.Tags.reserve(AttachedClients.size() + 1);
+  const std::optional<std::uint32_t> Tag = Client.watchTag(*this);
   AttachedClients.emplace_back(&Client);
+  Targets.Channels.emplace_back(Client.getDataSocket());
+  Targets.Flags.emplace_back(fanOutFlags(Client, Tag));
+  Targets.Tags.emplace_back(Tag.value_or(0));
 }
 
 void SessionData::removeClient(ClientData& Client) noexcept
 {
-  for (auto It = AttachedClients.begin(); It != AttachedClients.end(); ++It)
-    if (*It == &Client)
+  for (std::size_t I = 0; I < AttachedClients.size(); ++I)
+    if (AttachedClients[I] == &Client)
+    {
+      AttachedClients.erase(AttachedClients.begin() + I);
+      Targets.Channels.erase(Targets.Channels.begin() + I);
+      Targets.Flags.erase(Targets.Flags.begin() + I);
+      Targets.Tags.erase(Targets.Tags.begin() + I);
+      break;
+    }
+}
+
+void SessionData::clientChanged(ClientData& Client) noexcept
+{
+  for (std::size_t I = 0; I < AttachedClients.size(); ++I)
+    if (AttachedClients[I] == &Client)
     {
-      It = AttachedClients.erase(It);
+      Targets.Channels[I] = Client.getDataSocket();
+      Targets.Flags[I] = fanOutFlags(Client, Client.watchTag(*this));
       break;
     }
 }
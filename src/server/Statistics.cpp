@@ -0,0 +1,395 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <charconv>
+#include <limits>
+#include <type_traits>
+
+#include "monomux/adt/BufferPool.hpp"
+#include "monomux/control/Message.hpp"
+#include "monomux/control/MessageCodec.hpp"
+#include "monomux/system/Pty.hpp"
+#include "monomux/system/Time.hpp"
+
+#include "monomux/server/Server.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("server/Statistics")
+
+namespace monomux::server
+{
+
+namespace
+{
+
+/// Appends lines of text at a changing indentation to a string, without
+/// creating temporary strings for the pieces.
+class ReportWriter
+{
+public:
+  /// Restores the indentation of the \p ReportWriter when destroyed.
+  class Scope
+  {
+    friend class ReportWriter;
+    std::size_t& Indent;
+    std::size_t Saved;
+
+    Scope(std::size_t& Indent, std::size_t By) : Indent(Indent), Saved(Indent)
+    {
+      Indent += By;
+    }
+
+  public:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { Indent = Saved; }
+  };
+
+  explicit ReportWriter(std::string& Out) : Out(Out) {}
+
+  /// Increases the indentation by \p By until the returned object is
+  /// destroyed.
+  [[nodiscard]] Scope indent(std::size_t By) { return Scope{Indent, By}; }
+
+  /// Starts a new line at the current indentation.
+  ReportWriter& line()
+  {
+    Out.append(Indent, ' ');
+    return *this;
+  }
+
+  ReportWriter& operator<<(char C)
+  {
+    Out.push_back(C);
+    return *this;
+  }
+  ReportWriter& operator<<(std::string_view S)
+  {
+    Out.append(S);
+    return *this;
+  }
+  template <typename T,
+            typename = std::enable_if_t<std::is_integral_v<T> &&
+                                        !std::is_same_v<T, char> &&
+                                        !std::is_same_v<T, bool>>>
+  ReportWriter& operator<<(T Value)
+  {
+    char Buffer[std::numeric_limits<T>::digits10 + 3];
+    std::to_chars_result R =
+      std::to_chars(Buffer, Buffer + sizeof(Buffer), Value);
+    Out.append(Buffer, R.ptr);
+    return *this;
+  }
+
+  template <typename T> ReportWriter& time(const T& Time)
+  {
+    char Buffer[FormattedTimeSize];
+    Out.append(Buffer, formatTime(Time, Buffer));
+    return *this;
+  }
+
+  /// Appends every complete line of \p Text at the current indentation.
+  void block(std::string_view Text)
+  {
+    std::string_view::size_type Begin = 0;
+    std::string_view::size_type End = Text.find('\n');
+    while (End != std::string_view::npos)
+    {
+      line() << Text.substr(Begin, End - Begin + 1);
+      Begin = End + 1;
+      End = Text.find('\n', Begin);
+    }
+  }
+
+private:
+  std::string& Out;
+  std::size_t Indent = 0;
+};
+
+void describeClient(ReportWriter& W, const ClientData& C)
+{
+  auto& Cl = const_cast<ClientData&>(C);
+  auto X = W.indent(2);
+  W << "Client " << '\'' << C.id() << '\'' << '\n';
+  W.line() << "* Connected         : ";
+  W.time(C.whenCreated()) << '\n';
+  W.line() << "* LastActive        : ";
+  W.time(C.lastActive()) << '\n';
+
+  W.line() << "* Control Connection:" << '\n';
+  {
+    auto X = W.indent(4);
+    W.block(Cl.getControlSocket().statistics());
+  }
+
+  if (auto* DS = Cl.getDataSocket())
+  {
+    W.line() << "* Data    Connection:" << '\n';
+
+    auto X = W.indent(4);
+    W.block(DS->statistics());
+  }
+}
+
+void describeSession(ReportWriter& W, const SessionData& S)
+{
+  auto X = W.indent(2);
+  W.line() << "# Session " << '\'' << S.name() << '\'' << '\n';
+  auto Y = W.indent(2);
+  W.line() << "* Created     : ";
+  W.time(S.whenCreated()) << '\n';
+  W.line() << "* LastActive  : ";
+  W.time(S.lastActive()) << '\n';
+  if (std::optional<std::size_t> R = S.getReactor())
+    W.line() << "* Reactor     : #" << *R << '\n';
+  if (const OutputThrottle* T = S.getThrottle())
+  {
+    W.line() << "* Output rate : " << T->limits().Rate << " bytes/s";
+    if (T->throttled())
+      W << " (throttled)";
+    W << '\n';
+  }
+  if (const Recording* Rec = S.getRecording())
+  {
+    W.line() << "* Recording   : '" << Rec->path() << '\'';
+    if (Rec->dropped())
+      W << " (" << Rec->dropped() << " events dropped)";
+    if (Rec->failed())
+      W << " (failed)";
+    W << '\n';
+  }
+  if (S.hibernating())
+  {
+    W.line() << "* Hibernating";
+    if (const Scrollback* H = const_cast<SessionData&>(S).getScrollback();
+        H && H->spilled())
+      W << ", scrollback spilled: " << H->size() << " bytes as "
+        << H->spilledBytes();
+    W << '\n';
+  }
+
+  if (S.hasProcess())
+  {
+    auto& P = const_cast<Process&>(S.getProcess());
+    W.line() << "* Running PID : " << P.raw() << '\n';
+    if (P.hasPty())
+    {
+      W.line() << "* Communication "
+               << "reader" << '\n';
+      {
+        auto X = W.indent(4);
+        W.block(P.getPty()->reader().statistics());
+      }
+      W.line() << "* Communication "
+               << "writer" << '\n';
+      {
+        auto X = W.indent(4);
+        W.block(P.getPty()->writer().statistics());
+      }
+    }
+    else
+      W.line() << "! Associated Process does not have a PTY\n";
+  }
+  else
+    W.line() << "! No process associated with Session\n";
+
+  W.line() << "* Attached client #: " << S.getAttachedClients().size()
+           << '\n';
+  auto Z = W.indent(4);
+  for (const ClientData* C : S.getAttachedClients())
+  {
+    W.line() << '*' << ' ';
+    describeClient(W, *C);
+  }
+}
+
+} // namespace
+
+void Server::beginStatistics(StatisticsJob& Job) const
+{
+  Job.Sessions.reserve(Sessions.size());
+  for (const auto& E : Sessions)
+    Job.Sessions.emplace_back(E.first);
+  Job.Clients.reserve(Clients.size());
+  for (const auto& E : Clients)
+    Job.Clients.emplace_back(E.first);
+
+  ReportWriter W{Job.Output};
+  W << "MonoMux Server Statistics\n";
+
+  auto X = W.indent(2);
+  W.line() << "on " << '\'' << Sock.identifier() << '\'' << '\n';
+  W.line() << "started at ";
+  W.time(whenStarted()) << '\n';
+  auto Y = W.indent(2);
+  W << '\n';
+  W.line() << "* Attached clients               : " << Clients.size() << '\n';
+  W.line() << "* Running sessions               : " << Sessions.size()
+           << '\n';
+  std::size_t FDCount = FDLookup.size();
+  for (const std::unique_ptr<Reactor>& R : Reactors)
+    FDCount += R->FDLookup.size();
+  W.line() << "* Open file descriptors in total : " << FDCount << '\n';
+  W.line() << "* Reactor threads                : " << Reactors.size()
+           << '\n';
+  if (ServerCPUs)
+    W.line() << "* Server CPUs                    : " << ServerCPUs->toString()
+             << '\n';
+  if (std::optional<CPUSet> CPUs = sessionAffinity())
+    W.line() << "* Session CPUs                   : " << CPUs->toString()
+             << '\n';
+  W.line() << "* Buffered bytes in total        : "
+           << BufferedChannel::globalBufferedBytes() << '\n';
+  W.line() << "* Pooled free buffer bytes       : "
+           << BufferPool::global().cachedBytes() << " ("
+           << BufferPool::global().reuses() << " reuses)" << '\n';
+
+  W << '\n'
+    << "- = - = - = - = -"
+    << "         Sessions        "
+    << "- = - = - = - = -" << '\n';
+}
+
+bool Server::continueStatistics(StatisticsJob& Job, std::size_t Budget) const
+{
+  ReportWriter W{Job.Output};
+  for (; Budget && Job.NextSession < Job.Sessions.size(); ++Job.NextSession)
+  {
+    auto It = Sessions.find(Job.Sessions[Job.NextSession]);
+    if (It == Sessions.end())
+      continue;
+
+    describeSession(W, *It->second);
+    --Budget;
+    if (Job.NextSession + 1 == Job.Sessions.size())
+      W << '\n'
+        << "- = - = - = - = -"
+        << "   Unassociated Clients   "
+        << "- = - = - = - = -" << '\n';
+  }
+  if (Job.NextSession < Job.Sessions.size())
+    return false;
+
+  auto X = W.indent(2);
+  for (; Budget && Job.NextClient < Job.Clients.size(); ++Job.NextClient)
+  {
+    auto It = Clients.find(Job.Clients[Job.NextClient]);
+    // The attached and watching clients were described with their session.
+    if (It == Clients.end() || It->second->getAttachedSession() ||
+        It->second->watching())
+      continue;
+
+    W.line() << '#' << ' ';
+    describeClient(W, *It->second);
+    --Budget;
+  }
+  return Job.NextClient == Job.Clients.size();
+}
+
+std::string Server::statistics() const
+{
+  StatisticsJob Job;
+  beginStatistics(Job);
+  continueStatistics(Job, std::numeric_limits<std::size_t>::max());
+  return std::move(Job.Output);
+}
+
+void Server::requestStatistics(ClientData& Client)
+{
+  StatisticsJob& Job = StatisticsJobs.emplace_back();
+  Job.Requester = Client.id();
+  beginStatistics(Job);
+
+  if (!Timers.scheduled(StatisticsStep))
+    StatisticsStep =
+      Timers.schedule(std::chrono::milliseconds{0}, [this] {
+        stepStatistics();
+      });
+}
+
+void Server::sendStatistics(StatisticsJob& Job)
+{
+  ClientData* Client = getClient(Job.Requester);
+  if (!Client)
+  {
+    LOG(debug) << "Client \"" << Job.Requester
+               << "\" left before its statistics were ready";
+    return;
+  }
+
+  BufferedChannel& Channel = Client->getControlSocket();
+  try
+  {
+    message::sendMessage(Channel,
+                         message::response::Statistics{std::move(Job.Output)},
+                         Client->wireFormat());
+  }
+  catch (const buffer_overflow&)
+  {
+    // The rest of the report is kept in the buffer of the connection.
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client->id()
+               << "\": error when sending statistics: " << Err.what();
+    return;
+  }
+
+  // This is not called from the handling of the connection's events, so the
+  // unsent part of the report is flushed by the next iteration of the loop.
+  if (Channel.hasBufferedWrite())
+    Poll->schedule(Channel.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+void Server::stepStatistics()
+{
+  if (StatisticsJobs.empty())
+    return;
+
+  {
+    // The sessions and clients of the reactors are described too.
+    auto Locks = lockReactors();
+    StatisticsJob& Job = StatisticsJobs.front();
+    if (continueStatistics(Job, StatisticsSliceSize))
+    {
+      sendStatistics(Job);
+      StatisticsJobs.erase(StatisticsJobs.begin());
+    }
+  }
+
+  if (!StatisticsJobs.empty())
+    StatisticsStep =
+      Timers.schedule(std::chrono::milliseconds{0}, [this] {
+        stepStatistics();
+      });
+}
+
+void Server::finishStatistics()
+{
+  Timers.cancel(StatisticsStep);
+  for (StatisticsJob& Job : StatisticsJobs)
+  {
+    continueStatistics(Job, std::numeric_limits<std::size_t>::max());
+    sendStatistics(Job);
+  }
+  StatisticsJobs.clear();
+}
+
+} // namespace monomux::server
+
+#undef LOG
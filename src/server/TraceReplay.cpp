@@ -0,0 +1,245 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Process.hpp"
+#include "monomux/system/Pty.hpp"
+
+#include "monomux/server/ClientData.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/server/SessionData.hpp"
+#include "monomux/server/TraceReplay.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("server/TraceReplay")
+
+namespace monomux::server
+{
+
+namespace
+{
+
+/// \returns a connected pair of sockets: the end given to the server, and the
+/// non-blocking end kept by the replay.
+std::pair<fd, Socket> makeConnection(const std::string& Identifier)
+{
+  int FDs[2];
+  CheckedPOSIXThrow(
+    [&FDs] {
+      return ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, FDs);
+    },
+    "socketpair()",
+    -1);
+  fd Local{FDs[0]};
+  fd Remote{FDs[1]};
+  fd::addStatusFlag(Remote, O_NONBLOCK);
+  return {std::move(Local),
+          Socket::wrap(std::move(Remote), Identifier + "#remote")};
+}
+
+} // namespace
+
+TraceReplay::TraceReplay(Server& S)
+  : S(S), Filler(1 << 16, 'x'), Scratch(1 << 16, '\0')
+{
+  S.iterate(std::chrono::milliseconds::zero());
+}
+
+TraceReplay::~TraceReplay()
+{
+  while (!Connections.empty())
+    close(Connections.begin()->first);
+}
+
+std::chrono::nanoseconds TraceReplay::replay(const EventTraceReader::Batch& B)
+{
+  for (const EventTraceReader::Change& C : B.Changes)
+    apply(C);
+
+  // The traffic that arrived while the loop was waiting.
+  for (const EventTraceReader::IO& IO : B.IOs)
+    if (IO.Kind == EventTrace::Read)
+      if (auto It = Connections.find(IO.FD); It != Connections.end())
+        feed(It->second.Remote, IO.Bytes);
+  for (const EventTraceReader::Event& E : B.Events)
+    if (Connections.find(E.FD) == Connections.end())
+      ++Skipped;
+
+  const auto Start = std::chrono::steady_clock::now();
+  S.iterate(std::chrono::milliseconds::zero());
+  return std::chrono::steady_clock::now() - Start;
+}
+
+void TraceReplay::drain()
+{
+  for (auto& [FD, C] : Connections)
+  {
+    C.Received += consume(C.Remote);
+    if (C.ControlRemote)
+      consume(*C.ControlRemote);
+  }
+}
+
+SessionData* TraceReplay::session(raw_fd FD) const noexcept
+{
+  auto It = Connections.find(FD);
+  return It != Connections.end() ? It->second.Session : nullptr;
+}
+
+ClientData* TraceReplay::client(raw_fd FD) const noexcept
+{
+  auto It = Connections.find(FD);
+  return It != Connections.end() ? It->second.Client : nullptr;
+}
+
+std::size_t TraceReplay::received(raw_fd FD) const noexcept
+{
+  auto It = Connections.find(FD);
+  return It != Connections.end() ? It->second.Received : 0;
+}
+
+void TraceReplay::apply(const EventTraceReader::Change& C)
+{
+  switch (C.Kind)
+  {
+    case EventTrace::Open:
+      open(C.FD, C.Role);
+      return;
+    case EventTrace::Close:
+      close(C.FD);
+      return;
+    case EventTrace::Attach:
+    case EventTrace::Detach:
+      break;
+    default:
+      return;
+  }
+
+  ClientData* Client = client(C.FD);
+  SessionData* Session = session(C.Session);
+  if (!Client || !Session)
+  {
+    LOG(debug) << "Attachment of " << C.FD << " to " << C.Session
+               << " not replayed, connections unknown";
+    return;
+  }
+  if (C.Kind == EventTrace::Attach)
+  {
+    if (SessionData* Previous = Client->getAttachedSession())
+      S.clientDetachedCallback(*Client, *Previous);
+    S.clientAttachedCallback(*Client, *Session);
+  }
+  else
+    S.clientDetachedCallback(*Client, *Session);
+}
+
+void TraceReplay::open(raw_fd FD, EventTrace::Role Role)
+{
+  // (The trace might have been cut before the previous user of the file was
+  // closed.)
+  close(FD);
+
+  const std::string Name = "replay-" + std::to_string(FD);
+  auto [Local, Remote] = makeConnection(Name);
+  Connection C{Role, std::move(Remote)};
+  if (Role == EventTrace::SessionRole)
+  {
+    SessionData Session{Name};
+    // The end of the connection stands in for the master side of the
+    // terminal, and there is no process to signal.
+    Session.setProcess(
+      Process::adopt(Process::Invalid, Pty::adopt(std::move(Local), Name)));
+    C.Session = S.makeSession(std::move(Session));
+    if (!C.Session)
+      return;
+    S.createCallback(*C.Session);
+  }
+  else if (Role == EventTrace::ClientDataRole)
+  {
+    auto [ControlLocal, ControlRemote] = makeConnection(Name + "#control");
+    fd::setNonBlockingCloseOnExec(ControlLocal);
+    C.ControlRemote.emplace(std::move(ControlRemote));
+    C.Client = S.makeClient(ClientData{std::make_unique<Socket>(
+      Socket::wrap(std::move(ControlLocal), Name))});
+    if (!C.Client)
+      return;
+    S.listenOnControlSocket(*C.Client);
+    S.attachDataSocket(*C.Client, std::move(Local));
+  }
+  else
+    return;
+
+  Connections.emplace(FD, std::move(C));
+}
+
+void TraceReplay::close(raw_fd FD)
+{
+  auto It = Connections.find(FD);
+  if (It == Connections.end())
+    return;
+
+  if (It->second.Session)
+    S.destroyCallback(*It->second.Session);
+  if (It->second.Client)
+    S.exitCallback(*It->second.Client);
+  Connections.erase(It);
+}
+
+void TraceReplay::feed(Socket& Remote, std::size_t Bytes)
+{
+  while (Bytes)
+  {
+    const ssize_t Written =
+      ::write(Remote.raw(), Filler.data(), std::min(Bytes, Filler.size()));
+    if (Written <= 0)
+    {
+      if (Written < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+    Bytes -= static_cast<std::size_t>(Written);
+  }
+  Truncated += Bytes;
+}
+
+std::size_t TraceReplay::consume(Socket& Remote)
+{
+  std::size_t Bytes = 0;
+  while (true)
+  {
+    const ssize_t Read = ::read(Remote.raw(), Scratch.data(), Scratch.size());
+    if (Read < 0 && errno == EINTR)
+      continue;
+    if (Read <= 0)
+      break;
+    Bytes += static_cast<std::size_t>(Read);
+  }
+  return Bytes;
+}
+
+} // namespace monomux::server
+
+#undef LOG
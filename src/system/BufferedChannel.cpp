@@ -16,12 +16,12 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <atomic>
 #include <sstream>
 
-#include "monomux/adt/RingBuffer.hpp"
 #include "monomux/system/Time.hpp"
 
-#include "monomux/system/BufferedChannel.hpp"
+#include "monomux/system/BasicBufferedChannel.hpp"
 
 #include "monomux/Log.hpp"
 #define LOG(SEVERITY) monomux::log::SEVERITY("system/BufferedChannel")
@@ -30,22 +30,33 @@
 namespace monomux
 {
 
-namespace detail
-{
+// The channels might be used from multiple threads.
+static std::atomic<std::size_t> BufferSizeMax{
+  BufferedChannel::DefaultBufferSizeMax};
+static std::atomic<std::size_t> GlobalBudget{0};
+static std::atomic<std::size_t> GlobalBuffered{0};
 
-class BufferedChannelBuffer : public RingBuffer<char>
+std::size_t BufferedChannel::bufferSizeMax() noexcept
 {
-public:
-  BufferedChannelBuffer(std::size_t SizeHint) : RingBuffer(SizeHint) {}
-};
-
-} // namespace detail
+  return BufferSizeMax.load(std::memory_order_relaxed);
+}
+void BufferedChannel::setBufferSizeMax(std::size_t Size) noexcept
+{
+  BufferSizeMax.store(Size, std::memory_order_relaxed);
+}
 
-/// The size when the dynamic size of the buffer triggers a
-/// \p buffer_overflow.
-static constexpr std::size_t BufferSizeMax = 1ULL << 31; // 2 GiB
-static_assert(BufferedChannel::BufferSize < BufferSizeMax,
-              "Default constructed buffer would throw");
+std::size_t BufferedChannel::globalBudget() noexcept
+{
+  return GlobalBudget.load(std::memory_order_relaxed);
+}
+void BufferedChannel::setGlobalBudget(std::size_t Size) noexcept
+{
+  GlobalBudget.store(Size, std::memory_order_relaxed);
+}
+std::size_t BufferedChannel::globalBufferedBytes() noexcept
+{
+  return GlobalBuffered.load(std::memory_order_relaxed);
+}
 
 std::string
 BufferedChannel::OverflowError::craftErrorMessage(const std::string& Identifier,
@@ -53,7 +64,7 @@ BufferedChannel::OverflowError::craftErrorMessage(const std::string& Identifier,
 {
   std::ostringstream B;
   B << "Channel '" << Identifier << "' buffer overflow maximum size of "
-    << BufferSizeMax << " <= actual size " << Size;
+    << bufferSizeMax() << " <= actual size " << Size;
   return B.str();
 }
 
@@ -66,312 +77,325 @@ BufferedChannel::BufferedChannel(
   std::size_t WriteBufferSize)
   : Channel(std::move(Handle), std::move(Identifier), NeedsCleanup)
 {
-  if (ReadBufferSize)
-    Read = new OpaqueBufferType(ReadBufferSize);
-  if (WriteBufferSize)
-    Write = new OpaqueBufferType(WriteBufferSize);
+  // Most of the channels never buffer anything, because the operations
+  // complete directly, so the buffers are only allocated when needed.
+  ReadCapacity = ReadBufferSize;
+  WriteCapacity = WriteBufferSize;
+}
+
+BufferedChannel::BufferedChannel(fd Handle,
+                                 std::string Identifier,
+                                 bool NeedsCleanup,
+                                 SizeHint* ReadHint,
+                                 SizeHint* WriteHint)
+  : BufferedChannel(std::move(Handle),
+                    std::move(Identifier),
+                    NeedsCleanup,
+                    ReadHint ? ReadHint->initialSize() : 0,
+                    WriteHint ? WriteHint->initialSize() : 0)
+{
+  this->ReadHint = ReadHint;
+  this->WriteHint = WriteHint;
 }
 
 BufferedChannel::~BufferedChannel()
 {
+  GlobalBuffered.fetch_sub(Accounted, std::memory_order_relaxed);
+  learnSizes();
   delete Read;
   delete Write;
   Read = nullptr;
   Write = nullptr;
 }
 
-bool BufferedChannel::hasBufferedRead() const noexcept
+BufferedChannel& BufferedChannel::operator=(BufferedChannel&& RHS) noexcept
 {
-  assert(Read && "Channel does not support reading");
-  return !Read->empty();
+  if (this == &RHS)
+    return *this;
+
+  GlobalBuffered.fetch_sub(Accounted, std::memory_order_relaxed);
+  learnSizes();
+  delete Read;
+  delete Write;
+
+  Channel::operator=(std::move(RHS));
+  Read = std::move(RHS.Read);
+  Write = std::move(RHS.Write);
+  ReadCapacity = std::move(RHS.ReadCapacity);
+  WriteCapacity = std::move(RHS.WriteCapacity);
+  ReadPeak = std::move(RHS.ReadPeak);
+  WritePeak = std::move(RHS.WritePeak);
+  Accounted = std::move(RHS.Accounted);
+  ReadHint = std::move(RHS.ReadHint);
+  WriteHint = std::move(RHS.WriteHint);
+  ReadChunk = std::move(RHS.ReadChunk);
+  WriteChunk = std::move(RHS.WriteChunk);
+  Stats = std::move(RHS.Stats);
+  return *this;
 }
-bool BufferedChannel::hasBufferedWrite() const noexcept
+
+void BufferedChannel::learnSizes() noexcept
 {
-  assert(Write && "Channel does not support writing");
-  return !Write->empty();
+  if (ReadHint && readable())
+    ReadHint->record(std::max<std::size_t>(ReadPeak,
+                                           Read ? Read->highWater() : 0));
+  if (WriteHint && writable())
+    WriteHint->record(std::max<std::size_t>(WritePeak,
+                                            Write ? Write->highWater() : 0));
 }
 
-std::size_t BufferedChannel::readInBuffer() const noexcept
+BufferedChannel::OpaqueBufferType& BufferedChannel::readBuffer()
 {
-  assert(Read && "Channel does not support reading");
-  return Read->size();
+  assert(readable() && "Channel does not support reading");
+  if (!Read)
+    Read = new OpaqueBufferType(ReadCapacity);
+  return *Read;
 }
-std::size_t BufferedChannel::writeInBuffer() const noexcept
+BufferedChannel::OpaqueBufferType& BufferedChannel::writeBuffer()
 {
-  assert(Write && "Channel does not support writing");
-  return Write->size();
+  assert(writable() && "Channel does not support writing");
+  if (!Write)
+    Write = new OpaqueBufferType(WriteCapacity);
+  return *Write;
 }
 
-static void throwIfFailed(bool Failed)
+void BufferedChannel::releaseEmpty(bool IdleOnly) noexcept
 {
-  if (Failed)
-    throw std::system_error{std::make_error_code(std::errc::io_error),
-                            "Channel has failed."};
+  const auto Now = CoarseClock::now();
+  const auto Release = [IdleOnly, Now](UniqueScalar<OpaqueBufferType*,
+                                                    nullptr>& Buffer,
+                                       UniqueScalar<std::size_t, 0>& Peak) {
+    if (!Buffer || Buffer->totalSize() != 0)
+      return;
+    if (IdleOnly && Now - Buffer->lastAccess() < IdleRelease)
+      return;
+
+    Peak = std::max<std::size_t>(Peak, Buffer->highWater());
+    delete Buffer;
+    Buffer = nullptr;
+  };
+  Release(Read, ReadPeak);
+  Release(Write, WritePeak);
 }
-static void throwIfNoRead(bool Read)
+
+std::size_t BufferedChannel::AdaptiveChunks::adaptRead(std::size_t Chunk,
+                                                      std::size_t Requested,
+                                                      std::size_t Got) noexcept
 {
-  if (!Read)
-    throw std::system_error{
-      std::make_error_code(std::errc::operation_not_permitted),
-      "Channel does not support reading."};
+  if (Requested != Chunk || !Got)
+    // Only reads of the optimal size tell about the optimal size, and reading
+    // nothing only tells that nothing was available.
+    return Chunk;
+  if (Got == Requested)
+    return std::min(Chunk * 2, MaxChunkSize);
+  if (Got <= Requested / 8)
+    return std::max(Chunk / 2, MinChunkSize);
+  return Chunk;
 }
-static void throwIfNoWrite(bool Write)
+
+std::size_t BufferedChannel::AdaptiveChunks::adaptWrite(std::size_t Chunk,
+                                                       std::size_t Requested,
+                                                       std::size_t Sent,
+                                                       bool More) noexcept
 {
-  if (!Write)
-    throw std::system_error{
-      std::make_error_code(std::errc::operation_not_permitted),
-      "Channel does not support writing."};
+  if (Requested != Chunk)
+    return Chunk;
+  if (Sent == Requested && More)
+    return std::min(Chunk * 2, MaxChunkSize);
+  if (Sent < Requested / 2)
+    return std::max(Chunk / 2, MinChunkSize);
+  return Chunk;
 }
 
-std::string BufferedChannel::read(std::size_t Bytes)
+/// \returns the index of the smallest size class of \p SizeHint that can hold
+/// \p Size bytes.
+static std::size_t sizeClassOf(std::size_t Size) noexcept
 {
-  throwIfFailed(failed());
-  throwIfNoRead(Read);
-
-  std::string Return;
-  Return.reserve(Bytes);
+  using SizeHint = BufferedChannel::SizeHint;
+  std::size_t Class = 0;
+  while (Class < SizeHint::Classes - 1 && (SizeHint::MinSize << Class) < Size)
+    ++Class;
+  return Class;
+}
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "read(" << Bytes << ")...");
-  if (std::size_t StoredBufferSize = readInBuffer())
+std::size_t BufferedChannel::SizeHint::initialSize() const noexcept
+{
+  const std::uint32_t Samples = Total.load(std::memory_order_relaxed);
+  if (Samples < MinSamples)
+    return Default;
+
+  // Choose the size that would have been enough for 90% of the channels.
+  const std::uint32_t Wanted = Samples - Samples / 10;
+  std::uint32_t Covered = 0;
+  std::size_t Class = 0;
+  for (; Class < Classes - 1; ++Class)
   {
-    std::size_t BytesFromBuffer = std::min(Bytes, StoredBufferSize);
-    std::vector<char> V = Read->takeFront(BytesFromBuffer);
-    Return.append(V.begin(), V.end());
+    Covered += Counts[Class].load(std::memory_order_relaxed);
+    if (Covered >= Wanted)
+      break;
+  }
+  return std::max(Default, MinSize << Class);
+}
 
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "read() "
-                      << "<- " << V.size() << " bytes buffer");
+void BufferedChannel::SizeHint::record(std::size_t Peak) noexcept
+{
+  Counts[sizeClassOf(Peak)].fetch_add(1, std::memory_order_relaxed);
+  if (Total.fetch_add(1, std::memory_order_relaxed) + 1 < DecayAfter)
+    return;
 
-    Bytes -= V.size();
+  // The halving races with other records, but the hint is only a heuristic.
+  std::uint32_t NewTotal = 0;
+  for (auto& Count : Counts)
+  {
+    std::uint32_t Halved = Count.load(std::memory_order_relaxed) / 2;
+    Count.store(Halved, std::memory_order_relaxed);
+    NewTotal += Halved;
   }
-  if (!Bytes)
-    return Return;
+  Total.store(NewTotal, std::memory_order_relaxed);
+}
 
-  const std::size_t ChunkSize = optimalReadSize();
-  bool ContinueReading = true;
-  while (ContinueReading && Bytes > 0)
-  {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(read) "
-                      << "Request " << ChunkSize << " bytes...");
-    std::string Chunk = readImpl(ChunkSize, ContinueReading);
-    if (Chunk.empty())
-    {
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "(read) "
-                                                   << "No more data!");
-      break;
-    }
+void BufferedChannel::account() noexcept
+{
+  const std::size_t ReadSize = Read ? Read->size() : 0;
+  const std::size_t WriteSize = Write ? Write->totalSize() : 0;
+  Stats.ReadBufferPeak.observe(ReadSize);
+  Stats.WriteBufferPeak.observe(WriteSize);
+
+  const std::size_t Current = ReadSize + WriteSize;
+  if (Current > Accounted)
+    GlobalBuffered.fetch_add(Current - Accounted, std::memory_order_relaxed);
+  else if (Current < Accounted)
+    GlobalBuffered.fetch_sub(Accounted - Current, std::memory_order_relaxed);
+  Accounted = Current;
+}
 
-    const std::size_t ReadSize = Chunk.size();
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(read) "
-                      << "Received " << ReadSize << " bytes");
-    if (ReadSize < ChunkSize)
-      // Managed to read less data than wanted to for the current chunk.
-      // Assume no more data remaining.
-      ContinueReading = false;
+bool BufferedChannel::overBudget() const noexcept
+{
+  const std::size_t Budget = globalBudget();
+  return Budget && Accounted && globalBufferedBytes() > Budget;
+}
 
-    // Serve at most the remaining byte count into the return value.
-    const std::size_t BytesFromRead = std::min(Bytes, ReadSize);
-    Return.append(Chunk.begin(), Chunk.begin() + BytesFromRead);
+bool BufferedChannel::hasBufferedRead() const noexcept
+{
+  assert(readable() && "Channel does not support reading");
+  return Read && !Read->empty();
+}
+bool BufferedChannel::hasBufferedWrite() const noexcept
+{
+  assert(writable() && "Channel does not support writing");
+  return Write && Write->totalSize() != 0;
+}
 
-    if (ReadSize > Bytes)
-    {
-      // Buffer anything that remained in the read chunk -- and thus already
-      // consumed from the system resource!
-      const std::size_t BytesToSave = ReadSize - Bytes;
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                        << "(read) "
-                        << "Buffering " << BytesToSave << " bytes");
-      Read->putBack(Chunk.data() + BytesFromRead, BytesToSave);
-      ContinueReading = false;
-    }
+std::size_t BufferedChannel::readInBuffer() const noexcept
+{
+  assert(readable() && "Channel does not support reading");
+  return Read ? Read->size() : 0;
+}
+std::size_t BufferedChannel::writeInBuffer() const noexcept
+{
+  assert(writable() && "Channel does not support writing");
+  return Write ? Write->totalSize() : 0;
+}
 
-    Bytes -= BytesFromRead;
-  }
+std::string BufferedChannel::bufferedRead() const
+{
+  return Read ? Read->copy() : std::string{};
+}
+std::string BufferedChannel::bufferedWrite() const
+{
+  return Write ? Write->copy() : std::string{};
+}
 
-  if (Read->size() > BufferSizeMax)
-  {
-    LOG_WITH_IDENTIFIER(trace) << "(read) "
-                               << "Buffer overflow!";
-    throw OverflowError(
-      *this, identifier() + "(read)", Read->size(), true, false);
-  }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "read() "
-                                               << "-> " << Return.size());
-  return Return;
+std::string BufferedChannel::read(std::size_t Bytes)
+{
+  return readVia<VirtualIO>(Bytes);
 }
 
-std::size_t BufferedChannel::write(std::string_view Data)
+std::string_view BufferedChannel::peek(std::size_t Bytes)
 {
-  throwIfFailed(failed());
-  throwIfNoWrite(Write);
+  return peekVia<VirtualIO>(Bytes);
+}
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                    << "write(" << Data.size() << ")...");
-  const std::size_t ChunkSize = optimalWriteSize();
-  bool ContinueWriting = true;
+void BufferedChannel::consume(std::size_t Bytes)
+{
+  detail::throwIfChannelNoRead(readable());
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "consume(" << Bytes << ')');
+  if (Read)
+    Read->dropFront(Bytes);
+  account();
+}
 
-  // First, try to see if there is data in the write buffer that could be served
-  // first.
-  if (const std::size_t InWriteBuffer = writeInBuffer(),
-      BufferSent = flushWrites();
-      BufferSent < InWriteBuffer)
-    // There was data in the buffer and not all of it managed to send. We can't
-    // send Data because that would be an out-of-order send.
-    ContinueWriting = false;
+bool BufferedChannel::writeOverflowed(const char* Operation) noexcept
+{
+  if (writeInBuffer() <= bufferSizeMax())
+    return false;
 
-  if (!ContinueWriting)
-  {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(write) "
-                      << "Buffering " << Data.size() << " bytes");
-    Write->putBack(Data.data(), Data.size());
-    if (Write->size() > BufferSizeMax)
-    {
-      LOG_WITH_IDENTIFIER(trace) << "(write) "
-                                 << "Buffer overflow!";
-      throw OverflowError(
-        *this, identifier() + "(write)", Write->size(), false, true);
-    }
-    return 0;
-  }
-  if (Data.empty())
-    return 0;
+  Stats.Overflows.add();
+  LOG_WITH_IDENTIFIER(trace) << '(' << Operation << ") "
+                             << "Buffer overflow!";
+  return true;
+}
 
-  // If we are this point, the buffer should be clear and Data is still unsent.
-  std::size_t BytesSent = 0;
-  ContinueWriting = true;
-  while (ContinueWriting && !Data.empty())
-  {
-    const std::size_t ToSend = std::min(ChunkSize, Data.size());
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Send " << ToSend << " bytes...");
-
-    std::string_view Chunk = Data.substr(0, std::min(ChunkSize, Data.size()));
-    const std::size_t ChunkWrittenSize = writeImpl(Chunk, ContinueWriting);
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Sent " << ChunkWrittenSize << " bytes");
-
-    if (ChunkWrittenSize < ToSend)
-      // Managed to write less data than wanted to for the current chunk.
-      // This is very likely an error, and we should stop trying for now.
-      // Assume no more data remaining.
-      ContinueWriting = false;
-
-    BytesSent += ChunkWrittenSize;
-    Data.remove_prefix(ChunkWrittenSize);
-  }
+void BufferedChannel::throwIfWriteOverflow(const char* Operation)
+{
+  if (writeOverflowed(Operation))
+    throw OverflowError(*this,
+                        identifier() + '(' + Operation + ')',
+                        writeInBuffer(),
+                        false,
+                        true);
+}
 
-  if (!Data.empty())
-  {
-    // Buffer anything that remained in the write chunk -- and thus already
-    // consumed from the client!
-    const std::size_t BytesToSave = Data.size();
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Buffering " << BytesToSave << " bytes");
-    Write->putBack(Data.data(), BytesToSave);
-  }
+std::size_t BufferedChannel::write(std::string_view Data)
+{
+  return writeVia<VirtualIO>(Data);
+}
 
-  if (Write->size() > BufferSizeMax)
-  {
-    LOG_WITH_IDENTIFIER(trace) << "(write) "
-                               << "Buffer overflow!";
-    throw OverflowError(
-      *this, identifier() + "(write)", Write->size(), false, true);
-  }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "write() "
-                                               << "-> " << BytesSent);
-  return BytesSent;
+std::size_t BufferedChannel::write(const SharedChunk& Data)
+{
+  return writeVia<VirtualIO>(Data);
 }
 
 std::size_t BufferedChannel::load(std::size_t Bytes)
 {
-  throwIfFailed(failed());
-  throwIfNoRead(Read);
+  return loadVia<VirtualIO>(Bytes);
+}
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "load(" << Bytes << ")...");
-  const std::size_t ChunkSize = optimalReadSize();
-  bool ContinueReading = true;
-  std::size_t ReadBytes = 0;
-  while (ContinueReading && Bytes > 0)
-  {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Request " << ChunkSize << " bytes...");
-    std::string Chunk = readImpl(ChunkSize, ContinueReading);
-    if (Chunk.empty())
-    {
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "(load) "
-                                                   << "No more data!");
-      break;
-    }
+void BufferedChannel::bufferRead(std::string_view Data)
+{
+  readBuffer().append(Data);
+  account();
+}
 
-    const std::size_t ReadSize = Chunk.size();
-    ReadBytes += ReadSize;
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Received " << ReadSize << " bytes");
-    if (ReadSize < ChunkSize)
-      // Managed to read less data than wanted to for the current chunk.
-      // Assume no more data remaining.
-      ContinueReading = false;
-
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Storing " << ReadSize << " bytes");
-    Read->putBack(Chunk.data(), ReadSize);
-
-    Bytes -= std::min(ReadSize, Bytes);
-  }
+std::size_t BufferedChannel::flushWrites()
+{
+  return flushWritesVia<VirtualIO>();
+}
 
-  if (Read->size() > BufferSizeMax)
-  {
-    LOG_WITH_IDENTIFIER(trace) << "(load) "
-                               << "Buffer overflow!";
-    throw OverflowError(
-      *this, identifier() + "(load)", Read->size(), true, false);
-  }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "load() "
-                                               << "-> " << ReadBytes);
-  return ReadBytes;
+BufferedChannel::Result BufferedChannel::tryWrite(std::string_view Data)
+{
+  return tryWriteVia<VirtualIO>(Data);
 }
 
-std::size_t BufferedChannel::flushWrites()
+BufferedChannel::Result BufferedChannel::tryWrite(const SharedChunk& Data)
 {
-  throwIfFailed(failed());
-  throwIfNoWrite(Write);
-  if (!hasBufferedWrite())
-    return 0;
-
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                    << "flush(" << writeInBuffer() << ")...");
-  const std::size_t ChunkSize = optimalWriteSize();
-  std::size_t BytesSent = 0;
-  bool ContinueWriting = true;
-  while (ContinueWriting && hasBufferedWrite())
-  {
-    std::vector<char> V = Write->peekFront(ChunkSize);
-    const std::size_t ChunkBytesSent =
-      writeImpl(std::string_view{V.data(), V.size()}, ContinueWriting);
-    BytesSent += ChunkBytesSent;
-
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(flush) "
-                      << "<- " << ChunkBytesSent << " bytes buffer");
-
-    if (ChunkBytesSent < V.size())
-      // If we managed to send less data then the chunk size, something is
-      // wrong and writing should stop. But only the actually sent bytes
-      // should be removed from the buffer!
-      ContinueWriting = false;
-
-    Write->dropFront(ChunkBytesSent);
-  }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "flush() "
-                                               << "-> " << BytesSent);
+  return tryWriteVia<VirtualIO>(Data);
+}
+
+BufferedChannel::Result BufferedChannel::tryFlushWrites()
+{
+  return tryFlushWritesVia<VirtualIO>();
+}
+
+BufferedChannel::Result BufferedChannel::tryLoad(std::size_t Bytes)
+{
+  return tryLoadVia<VirtualIO>(Bytes);
+}
 
-  return BytesSent;
+BufferedChannel::Result BufferedChannel::tryPeek(std::size_t Bytes,
+                                                 std::string_view& View)
+{
+  return tryPeekVia<VirtualIO>(Bytes, View);
 }
 
 void BufferedChannel::tryFreeResources()
@@ -380,6 +404,14 @@ void BufferedChannel::tryFreeResources()
     Read->tryCleanup();
   if (Write)
     Write->tryCleanup();
+  releaseEmpty(/* IdleOnly =*/true);
+}
+
+void BufferedChannel::releaseBuffers() { releaseEmpty(/* IdleOnly =*/false); }
+
+std::size_t BufferedChannel::allocatedBufferBytes() const noexcept
+{
+  return (Read ? Read->capacity() : 0) + (Write ? Write->capacity() : 0);
 }
 
 std::string BufferedChannel::statistics() const
@@ -403,23 +435,38 @@ std::string BufferedChannel::statistics() const
     Output << ']' << '\n';
   };
 
+  const auto FormatUnallocated = [&Output](std::size_t Capacity) {
+    Output << "InitialCapacity = " << Capacity << ", Unallocated" << '\n';
+  };
+
   Output << "BufferedChannel " << '\'' << identifier() << '\'' << '\n';
-  if (Read)
+  if (readable())
   {
     Output << " <- "
            << "Read" << ':' << '\n'
            << "      "
            << "OptimalChunkSize = " << optimalReadSize() << ',' << ' ';
-    FormatOneBuffer(*Read);
+    if (Read)
+      FormatOneBuffer(*Read);
+    else
+      FormatUnallocated(ReadCapacity);
   }
 
-  if (Write)
+  if (writable())
   {
     Output << " -> "
            << "Write" << ':' << '\n'
            << "      "
            << "OptimalChunkSize = " << optimalWriteSize() << ',' << ' ';
-    FormatOneBuffer(*Write);
+    if (Write)
+    {
+      FormatOneBuffer(*Write);
+      Output << "      "
+             << "SharedChunks = " << Write->Shared.size()
+             << ", SharedSize = " << Write->SharedSize << '\n';
+    }
+    else
+      FormatUnallocated(WriteCapacity);
   }
 
   return Output.str();
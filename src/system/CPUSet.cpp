@@ -0,0 +1,221 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
+#include <dirent.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/CPUSet.hpp"
+
+namespace monomux
+{
+
+/// Parses a single CPU number from the beginning of \p Str, and consumes it.
+static std::optional<unsigned> parseCPU(std::string_view& Str)
+{
+  unsigned CPU = 0;
+  auto [End, EC] = std::from_chars(Str.data(), Str.data() + Str.size(), CPU);
+  if (EC != std::errc{} || CPU >= CPU_SETSIZE)
+    return std::nullopt;
+  Str.remove_prefix(End - Str.data());
+  return CPU;
+}
+
+std::optional<CPUSet> CPUSet::parse(std::string_view List)
+{
+  // (The lists read from the kernel end with a newline.)
+  while (!List.empty() && (List.back() == '\n' || List.back() == ' '))
+    List.remove_suffix(1);
+
+  CPUSet Ret;
+  while (!List.empty())
+  {
+    std::optional<unsigned> First = parseCPU(List);
+    if (!First)
+      return std::nullopt;
+    std::optional<unsigned> Last = First;
+    if (!List.empty() && List.front() == '-')
+    {
+      List.remove_prefix(1);
+      Last = parseCPU(List);
+      if (!Last || *Last < *First)
+        return std::nullopt;
+    }
+    for (unsigned CPU = *First; CPU <= *Last; ++CPU)
+      Ret.add(CPU);
+
+    if (List.empty())
+      break;
+    if (List.front() != ',' || List.size() == 1)
+      return std::nullopt;
+    List.remove_prefix(1);
+  }
+  if (Ret.empty())
+    return std::nullopt;
+  return Ret;
+}
+
+CPUSet CPUSet::ofThisThread()
+{
+  CPUSet Ret;
+  CheckedPOSIXThrow(
+    [&Ret] { return ::sched_getaffinity(0, sizeof(::cpu_set_t), &Ret.Set); },
+    "sched_getaffinity()",
+    -1);
+  return Ret;
+}
+
+std::vector<CPUSet> CPUSet::numaNodes()
+{
+  static constexpr char NodeRoot[] = "/sys/devices/system/node";
+  static constexpr std::string_view NodePrefix = "node";
+
+  std::vector<std::pair<unsigned, CPUSet>> Nodes;
+  ::DIR* Dir = ::opendir(NodeRoot);
+  if (!Dir)
+    return {};
+  while (const struct ::dirent* Entry = ::readdir(Dir))
+  {
+    std::string_view Name = Entry->d_name;
+    if (Name.substr(0, NodePrefix.size()) != NodePrefix)
+      continue;
+    Name.remove_prefix(NodePrefix.size());
+    unsigned Node = 0;
+    auto [End, EC] =
+      std::from_chars(Name.data(), Name.data() + Name.size(), Node);
+    if (EC != std::errc{} || End != Name.data() + Name.size())
+      continue;
+
+    std::ifstream File{std::string{NodeRoot} + '/' + Entry->d_name +
+                       "/cpulist"};
+    std::string List;
+    if (!std::getline(File, List))
+      continue;
+    // (A node without CPUs, e.g., of memory only, has an empty list.)
+    if (std::optional<CPUSet> CPUs = parse(List))
+      Nodes.emplace_back(Node, std::move(*CPUs));
+  }
+  ::closedir(Dir);
+
+  std::sort(Nodes.begin(), Nodes.end(), [](const auto& L, const auto& R) {
+    return L.first < R.first;
+  });
+  std::vector<CPUSet> Ret;
+  Ret.reserve(Nodes.size());
+  for (auto& N : Nodes)
+    Ret.emplace_back(std::move(N.second));
+  return Ret;
+}
+
+void CPUSet::add(unsigned CPU) noexcept
+{
+  if (CPU < CPU_SETSIZE)
+    CPU_SET(CPU, &Set);
+}
+
+bool CPUSet::has(unsigned CPU) const noexcept
+{
+  return CPU < CPU_SETSIZE && CPU_ISSET(CPU, &Set);
+}
+
+std::size_t CPUSet::size() const noexcept { return CPU_COUNT(&Set); }
+
+std::vector<unsigned> CPUSet::cpus() const
+{
+  std::vector<unsigned> Ret;
+  Ret.reserve(size());
+  for (unsigned CPU = 0; CPU < CPU_SETSIZE; ++CPU)
+    if (has(CPU))
+      Ret.emplace_back(CPU);
+  return Ret;
+}
+
+std::vector<unsigned>
+CPUSet::interleaved(const std::vector<CPUSet>& Nodes) const
+{
+  std::vector<std::vector<unsigned>> PerNode;
+  CPUSet Placed;
+  for (const CPUSet& Node : Nodes)
+  {
+    std::vector<unsigned>& OnNode = PerNode.emplace_back();
+    for (unsigned CPU : Node.cpus())
+      if (has(CPU) && !Placed.has(CPU))
+      {
+        OnNode.emplace_back(CPU);
+        Placed.add(CPU);
+      }
+  }
+
+  std::vector<unsigned> Ret;
+  Ret.reserve(size());
+  for (std::size_t I = 0; Ret.size() < Placed.size(); ++I)
+    for (const std::vector<unsigned>& OnNode : PerNode)
+      if (I < OnNode.size())
+        Ret.emplace_back(OnNode[I]);
+  for (unsigned CPU : cpus())
+    if (!Placed.has(CPU))
+      Ret.emplace_back(CPU);
+  return Ret;
+}
+
+std::string CPUSet::toString() const
+{
+  std::string Ret;
+  const std::vector<unsigned> CPUs = cpus();
+  for (std::size_t I = 0; I < CPUs.size();)
+  {
+    std::size_t Last = I;
+    while (Last + 1 < CPUs.size() && CPUs[Last + 1] == CPUs[Last] + 1)
+      ++Last;
+
+    if (!Ret.empty())
+      Ret.push_back(',');
+    Ret.append(std::to_string(CPUs[I]));
+    if (Last != I)
+    {
+      Ret.push_back('-');
+      Ret.append(std::to_string(CPUs[Last]));
+    }
+    I = Last + 1;
+  }
+  return Ret;
+}
+
+void CPUSet::applyToThisThread() const
+{
+  CheckedPOSIXThrow(
+    [this] { return ::sched_setaffinity(0, sizeof(::cpu_set_t), &Set); },
+    "sched_setaffinity()",
+    -1);
+}
+
+bool CPUSet::applyToThisThreadUnchecked() const noexcept
+{
+  return ::sched_setaffinity(0, sizeof(::cpu_set_t), &Set) == 0;
+}
+
+bool CPUSet::operator==(const CPUSet& RHS) const noexcept
+{
+  return CPU_EQUAL(&Set, &RHS.Set);
+}
+
+} // namespace monomux
@@ -16,6 +16,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstring>
+
 #include "monomux/system/Channel.hpp"
 
 #include "monomux/Log.hpp"
@@ -64,6 +67,42 @@ std::size_t Channel::write(std::string_view Buffer)
   return writeImpl(Buffer, Unused);
 }
 
+std::size_t
+Channel::readvImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  std::size_t Total = 0;
+  for (std::size_t I = 0; I < Count; ++I)
+    Total += Vectors[I].iov_len;
+
+  std::string Data = readImpl(Total, Continue);
+  std::string_view View = Data;
+  for (std::size_t I = 0; I < Count && !View.empty(); ++I)
+  {
+    const std::size_t N = std::min(Vectors[I].iov_len, View.size());
+    std::memcpy(Vectors[I].iov_base, View.data(), N);
+    View.remove_prefix(N);
+  }
+  return Data.size() - View.size();
+}
+
+std::size_t
+Channel::writevImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  std::size_t BytesSent = 0;
+  Continue = true;
+  for (std::size_t I = 0; I < Count && Continue; ++I)
+  {
+    const std::size_t Written = writeImpl(
+      std::string_view{static_cast<const char*>(Vectors[I].iov_base),
+                       Vectors[I].iov_len},
+      Continue);
+    BytesSent += Written;
+    if (Written < Vectors[I].iov_len)
+      break;
+  }
+  return BytesSent;
+}
+
 } // namespace monomux
 
 #undef LOG_WITH_IDENTIFIER
@@ -0,0 +1,205 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdexcept>
+
+#include "monomux/Config.h"
+
+#ifdef MONOMUX_COMPRESSION
+#include <zlib.h>
+#endif /* MONOMUX_COMPRESSION */
+
+#include "monomux/system/Compression.hpp"
+
+namespace monomux
+{
+
+#ifdef MONOMUX_COMPRESSION
+
+/// The window size of the streams. Negative values select raw DEFLATE, without
+/// the zlib header and checksum.
+static constexpr int RawWindowBits = -15;
+static constexpr int MemoryLevel = 8;
+
+/// The amount of output space the stream is given at least, if it runs out.
+static constexpr std::size_t GrowSize = 4096;
+
+[[noreturn]] static void throwZlibError(const char* Operation,
+                                       const z_stream& Stream,
+                                       int Result)
+{
+  std::string Message = Operation;
+  Message.append(": ");
+  Message.append(Stream.msg ? Stream.msg : ::zError(Result));
+  throw std::runtime_error{Message};
+}
+
+Deflater::Deflater(int Level) : Stream(std::make_unique<z_stream>())
+{
+  int Result = ::deflateInit2(Stream.get(),
+                              Level,
+                              Z_DEFLATED,
+                              RawWindowBits,
+                              MemoryLevel,
+                              Z_DEFAULT_STRATEGY);
+  if (Result != Z_OK)
+    throwZlibError("deflateInit2()", *Stream, Result);
+}
+
+Deflater::~Deflater()
+{
+  if (Stream)
+    ::deflateEnd(Stream.get());
+}
+
+Deflater& Deflater::operator=(Deflater&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  if (Stream)
+    ::deflateEnd(Stream.get());
+  Stream = std::move(RHS.Stream);
+  Output = std::move(RHS.Output);
+  return *this;
+}
+
+std::string_view Deflater::compress(std::string_view Data)
+{
+  // (zlib does not modify the input, it is just not const-correct.)
+  Stream->next_in =
+    reinterpret_cast<Bytef*>(const_cast<char*>(Data.data())); // NOLINT
+  Stream->avail_in = static_cast<uInt>(Data.size());
+
+  // The bound does not include the markers of the flush.
+  Output.resize(::deflateBound(Stream.get(), Data.size()) + 16);
+  std::size_t Used = 0;
+  while (true)
+  {
+    Stream->next_out = reinterpret_cast<Bytef*>(Output.data() + Used);
+    Stream->avail_out = static_cast<uInt>(Output.size() - Used);
+
+    // A full flush makes the chunk independent of the earlier ones.
+    int Result = ::deflate(Stream.get(), Z_FULL_FLUSH);
+    if (Result != Z_OK && Result != Z_BUF_ERROR)
+      throwZlibError("deflate()", *Stream, Result);
+    Used = Output.size() - Stream->avail_out;
+    if (Stream->avail_out != 0)
+      break;
+    Output.resize(Output.size() + GrowSize);
+  }
+
+  Output.resize(Used);
+  return Output;
+}
+
+Inflater::Inflater() : Stream(std::make_unique<z_stream>())
+{
+  int Result = ::inflateInit2(Stream.get(), RawWindowBits);
+  if (Result != Z_OK)
+    throwZlibError("inflateInit2()", *Stream, Result);
+}
+
+Inflater::~Inflater()
+{
+  if (Stream)
+    ::inflateEnd(Stream.get());
+}
+
+Inflater& Inflater::operator=(Inflater&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  if (Stream)
+    ::inflateEnd(Stream.get());
+  Stream = std::move(RHS.Stream);
+  Output = std::move(RHS.Output);
+  return *this;
+}
+
+std::string_view Inflater::decompress(std::string_view Data)
+{
+  Stream->next_in =
+    reinterpret_cast<Bytef*>(const_cast<char*>(Data.data())); // NOLINT
+  Stream->avail_in = static_cast<uInt>(Data.size());
+
+  // Terminal output usually compresses very well.
+  Output.resize(Data.size() * 4 + GrowSize);
+  std::size_t Used = 0;
+  while (true)
+  {
+    Stream->next_out = reinterpret_cast<Bytef*>(Output.data() + Used);
+    Stream->avail_out = static_cast<uInt>(Output.size() - Used);
+
+    int Result = ::inflate(Stream.get(), Z_SYNC_FLUSH);
+    if (Result != Z_OK && Result != Z_BUF_ERROR && Result != Z_STREAM_END)
+      throwZlibError("inflate()", *Stream, Result);
+    Used = Output.size() - Stream->avail_out;
+    if (Stream->avail_out != 0 || Result == Z_STREAM_END)
+      break;
+    Output.resize(Output.size() * 2);
+  }
+
+  Output.resize(Used);
+  return Output;
+}
+
+#else /* !MONOMUX_COMPRESSION */
+
+} // namespace monomux
+
+/// Never created, but the owning pointers in the instances must be
+/// destructible.
+struct z_stream_s
+{};
+
+namespace monomux
+{
+
+Deflater::Deflater(int /* Level */)
+{
+  throw std::logic_error{"Compression is not supported by this build."};
+}
+
+Deflater::~Deflater() = default;
+Deflater& Deflater::operator=(Deflater&&) noexcept = default;
+
+std::string_view Deflater::compress(std::string_view /* Data */)
+{
+  throw std::logic_error{"Compression is not supported by this build."};
+}
+
+Inflater::Inflater()
+{
+  throw std::logic_error{"Compression is not supported by this build."};
+}
+
+Inflater::~Inflater() = default;
+Inflater& Inflater::operator=(Inflater&&) noexcept = default;
+
+std::string_view Inflater::decompress(std::string_view /* Data */)
+{
+  throw std::logic_error{"Compression is not supported by this build."};
+}
+
+#endif /* MONOMUX_COMPRESSION */
+
+// The address of the stream is unchanged, so zlib's state stays valid.
+Deflater::Deflater(Deflater&&) noexcept = default;
+Inflater::Inflater(Inflater&&) noexcept = default;
+
+} // namespace monomux
@@ -18,6 +18,11 @@
  */
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -30,9 +35,14 @@
 
 #include <dlfcn.h>
 #include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Environment.hpp"
 #include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
 
@@ -469,7 +479,10 @@ LLVMSymbolizer::symbolise(const std::string& Object,
 /// the currently backtracing executable's memory map.
 void putSharedObjectOffsets(const std::vector<Backtrace::Frame*>& Frames)
 {
-  if (Frames.empty())
+  if (std::all_of(Frames.begin(), Frames.end(), [](Backtrace::Frame* F) {
+        return F->ImageOffset != nullptr;
+      }))
+    // Frames loaded from a crash report already know their offsets.
     return;
 
   std::string BinaryStr{Frames.front()->Data.Binary};
@@ -486,6 +499,8 @@ void putSharedObjectOffsets(const std::vector<Backtrace::Frame*>& Frames)
   OffsetPtrs.reserve(Frames.size());
   for (Backtrace::Frame* F : Frames)
   {
+    if (F->ImageOffset)
+      continue;
     void* Offset = nullptr;
     // There can be two kinds of symbols in the dump.
     if (F->Data.Offset.empty())
@@ -571,8 +586,306 @@ void putSharedObjectOffsets(const std::vector<Backtrace::Frame*>& Frames)
     });
 }
 
+/// The first line of a crash report, identifying the format.
+constexpr char CrashReportHeader[] = "monomux-crash 1";
+
+/// The state prepared by \p prepareCrashReport(), so that writing the report
+/// in a signal handler needs no allocation.
+struct
+{
+  bool Prepared = false;
+  char Directory[PATH_MAX] = {};
+  char Version[128] = {};
+  char Path[PATH_MAX + 64] = {};
+} ReportTarget;
+
+/// Copies \p Src after \p Dst[At], as long as it fits, like \p strlcat().
+///
+/// \returns the new length of \p Dst.
+std::size_t appendSafe(char* Dst,
+                       std::size_t At,
+                       std::size_t Size,
+                       const char* Src) noexcept
+{
+  while (*Src && At + 1 < Size)
+    Dst[At++] = *Src++;
+  Dst[At] = '\0';
+  return At;
+}
+
+/// Formats \p Value into \p Buf in \p Base, and \returns the start of it.
+template <std::size_t N>
+const char* formatSafe(char (&Buf)[N], std::uintptr_t Value, unsigned Base)
+{
+  static constexpr char Digits[] = "0123456789abcdef";
+  char* P = Buf + N - 1;
+  *P = '\0';
+  do
+  {
+    *--P = Digits[Value % Base];
+    Value /= Base;
+  } while (Value && P > Buf);
+  return P;
+}
+
+/// Buffers the writes to a file using only async-signal-safe calls.
+class SafeWriter
+{
+public:
+  explicit SafeWriter(int FD) noexcept : FD(FD) {}
+  ~SafeWriter() { flush(); }
+  SafeWriter(const SafeWriter&) = delete;
+  SafeWriter& operator=(const SafeWriter&) = delete;
+
+  SafeWriter& operator<<(const char* Str) noexcept
+  {
+    while (*Str)
+      put(*Str++);
+    return *this;
+  }
+  SafeWriter& operator<<(char Ch) noexcept
+  {
+    put(Ch);
+    return *this;
+  }
+  SafeWriter& dec(std::uintptr_t Value) noexcept
+  {
+    char Buf[32];
+    return *this << formatSafe(Buf, Value, 10);
+  }
+  SafeWriter& hex(std::uintptr_t Value) noexcept
+  {
+    char Buf[32];
+    return *this << "0x" << formatSafe(Buf, Value, 16);
+  }
+
+  void flush() noexcept
+  {
+    std::size_t Sent = 0;
+    while (Sent < Length)
+    {
+      ::ssize_t R = ::write(FD, Buffer + Sent, Length - Sent);
+      if (R == -1 && errno == EINTR)
+        continue;
+      if (R <= 0)
+        break;
+      Sent += static_cast<std::size_t>(R);
+    }
+    Length = 0;
+  }
+
+private:
+  int FD;
+  char Buffer[1024];
+  std::size_t Length = 0;
+
+  void put(char Ch) noexcept
+  {
+    if (Length == sizeof(Buffer))
+      flush();
+    Buffer[Length++] = Ch;
+  }
+};
+
+/// Writes the range of memory the object in \p Info is loaded to.
+int writeModule(struct ::dl_phdr_info* Info, std::size_t /* Size */, void* Data)
+{
+  SafeWriter& W = *static_cast<SafeWriter*>(Data);
+  std::uintptr_t Begin = UINTPTR_MAX;
+  std::uintptr_t End = 0;
+  for (::ElfW(Half) I = 0; I < Info->dlpi_phnum; ++I)
+  {
+    const auto& Header = Info->dlpi_phdr[I];
+    if (Header.p_type != PT_LOAD)
+      continue;
+    Begin = std::min<std::uintptr_t>(Begin, Info->dlpi_addr + Header.p_vaddr);
+    End = std::max<std::uintptr_t>(
+      End, Info->dlpi_addr + Header.p_vaddr + Header.p_memsz);
+  }
+  if (Begin >= End)
+    return 0;
+
+  const char* Name = Info->dlpi_name;
+  char Self[PATH_MAX];
+  if (!Name || !*Name)
+  {
+    // The main program is reported without a name.
+    ::ssize_t Length = ::readlink("/proc/self/exe", Self, sizeof(Self) - 1);
+    Self[Length > 0 ? Length : 0] = '\0';
+    Name = Self;
+  }
+
+  W << "module ";
+  W.hex(Begin) << ' ';
+  W.hex(End) << ' ';
+  W.hex(Info->dlpi_addr) << ' ' << Name << '\n';
+  return 0;
+}
+
+/// Parses the hexadecimal number \p Str, with the \p 0x prefix.
+std::optional<std::uintptr_t> parseHex(std::string_view Str)
+{
+  if (Str.substr(0, 2) != "0x")
+    return std::nullopt;
+  Str.remove_prefix(2);
+  std::uintptr_t Value = 0;
+  auto [End, EC] =
+    std::from_chars(Str.data(), Str.data() + Str.size(), Value, 16);
+  if (EC != std::errc{} || End != Str.data() + Str.size())
+    return std::nullopt;
+  return Value;
+}
+
+/// Splits the first space-separated word off \p Line.
+std::string_view takeWord(std::string_view& Line)
+{
+  const auto Space = Line.find(' ');
+  std::string_view Word = Line.substr(0, Space);
+  Line.remove_prefix(Space == std::string_view::npos ? Line.size()
+                                                     : Space + 1);
+  return Word;
+}
+
 } // namespace
 
+const CrashReport::Module*
+CrashReport::moduleOf(std::uintptr_t Address) const noexcept
+{
+  for (const Module& M : Modules)
+    if (M.Begin <= Address && Address < M.End)
+      return &M;
+  return nullptr;
+}
+
+std::optional<CrashReport> CrashReport::parse(std::string_view Data)
+{
+  CrashReport R;
+  bool First = true;
+  while (!Data.empty())
+  {
+    const auto NewLine = Data.find('\n');
+    std::string_view Line = Data.substr(0, NewLine);
+    Data.remove_prefix(NewLine == std::string_view::npos ? Data.size()
+                                                         : NewLine + 1);
+    if (First)
+    {
+      if (Line != CrashReportHeader)
+        return std::nullopt;
+      First = false;
+      continue;
+    }
+
+    std::string_view Key = takeWord(Line);
+    if (Key == "version")
+      R.Version = Line;
+    else if (Key == "signal")
+      std::from_chars(Line.data(), Line.data() + Line.size(), R.Signal);
+    else if (Key == "module")
+    {
+      std::optional<std::uintptr_t> Begin = parseHex(takeWord(Line));
+      std::optional<std::uintptr_t> End = parseHex(takeWord(Line));
+      std::optional<std::uintptr_t> Base = parseHex(takeWord(Line));
+      if (!Begin || !End || !Base)
+        return std::nullopt;
+      R.Modules.push_back(Module{*Begin, *End, *Base, std::string{Line}});
+    }
+    else if (Key == "frame")
+    {
+      std::optional<std::uintptr_t> Address = parseHex(Line);
+      if (!Address)
+        return std::nullopt;
+      R.Frames.push_back(*Address);
+    }
+    // (Unknown lines are skipped, for compatibility with newer versions.)
+  }
+  if (First)
+    return std::nullopt;
+  return R;
+}
+
+std::optional<CrashReport> CrashReport::load(const std::string& Path)
+{
+  std::ifstream File{Path, std::ios::in | std::ios::binary};
+  if (!File.is_open())
+    return std::nullopt;
+  std::ostringstream Data;
+  Data << File.rdbuf();
+  return parse(Data.str());
+}
+
+void prepareCrashReport(const std::string& Directory,
+                        const std::string& Version)
+{
+  appendSafe(ReportTarget.Directory,
+             0,
+             sizeof(ReportTarget.Directory),
+             Directory.c_str());
+  appendSafe(
+    ReportTarget.Version, 0, sizeof(ReportTarget.Version), Version.c_str());
+
+  // The first call to backtrace() loads the unwinder library, which must not
+  // happen in the signal handler.
+  void* Address;
+  ::backtrace(&Address, 1);
+  ReportTarget.Prepared = true;
+}
+
+const char* writeCrashReport(int Signal) noexcept
+{
+  if (!ReportTarget.Prepared)
+    return nullptr;
+
+  char Number[32];
+  char* Path = ReportTarget.Path;
+  const std::size_t Size = sizeof(ReportTarget.Path);
+  std::size_t Length = appendSafe(Path, 0, Size, ReportTarget.Directory);
+  Length = appendSafe(Path, Length, Size, "/monomux-crash.");
+  Length = appendSafe(
+    Path,
+    Length,
+    Size,
+    formatSafe(Number, static_cast<std::uintptr_t>(::getpid()), 10));
+
+  // A crash during the teardown after another one must not overwrite the
+  // report of the first.
+  static constexpr std::uintptr_t MaxReportsPerProcess = 8;
+  int FD = -1;
+  for (std::uintptr_t I = 0; I < MaxReportsPerProcess && FD == -1; ++I)
+  {
+    std::size_t End = Length;
+    if (I)
+    {
+      End = appendSafe(Path, End, Size, ".");
+      End = appendSafe(Path, End, Size, formatSafe(Number, I, 10));
+    }
+    appendSafe(Path, End, Size, ".txt");
+    FD = ::open(Path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (FD == -1 && errno != EEXIST)
+      return nullptr;
+  }
+  if (FD == -1)
+    return nullptr;
+
+  {
+    SafeWriter W{FD};
+    W << CrashReportHeader << '\n';
+    W << "version " << ReportTarget.Version << '\n';
+    W << "signal ";
+    W.dec(static_cast<std::uintptr_t>(Signal)) << '\n';
+    ::dl_iterate_phdr(&writeModule, &W);
+
+    void* Addresses[Backtrace::MaxSize];
+    const int Count = ::backtrace(Addresses, Backtrace::MaxSize);
+    for (int I = 0; I < Count; ++I)
+    {
+      W << "frame ";
+      W.hex(reinterpret_cast<std::uintptr_t>(Addresses[I])) << '\n';
+    }
+  }
+  ::close(FD);
+  return Path;
+}
+
 // NOLINTNEXTLINE(misc-no-recursion)
 void Backtrace::Symbol::mergeFrom(Symbol&& RHS)
 {
@@ -677,6 +990,33 @@ Backtrace::Backtrace(std::size_t Depth, std::size_t Ignored)
   }
 }
 
+Backtrace::Backtrace(const CrashReport& Report)
+  : IgnoredFrameCount(0), SymbolDataBuffer(nullptr)
+{
+  LoadedData.reserve(Report.Frames.size() * 2);
+  Frames.reserve(Report.Frames.size());
+  for (std::size_t I = 0; I < Report.Frames.size(); ++I)
+  {
+    const std::uintptr_t Address = Report.Frames.at(I);
+    Frame F{};
+    F.Index = Report.Frames.size() - 1 - I;
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    F.Address = reinterpret_cast<const void*>(Address);
+
+    std::ostringstream Hex;
+    Hex << std::hex << std::showbase << Address;
+    F.Data.Full = F.Data.HexAddress = LoadedData.emplace_back(Hex.str());
+    if (const CrashReport::Module* M = Report.moduleOf(Address))
+    {
+      F.Data.Binary = LoadedData.emplace_back(M->Path);
+      // NOLINTNEXTLINE(performance-no-int-to-ptr)
+      F.ImageOffset = reinterpret_cast<const void*>(Address - M->Base);
+    }
+
+    Frames.emplace_back(std::move(F));
+  }
+}
+
 Backtrace::~Backtrace()
 {
   if (SymbolDataBuffer)
@@ -696,15 +1036,8 @@ Backtrace::~Backtrace()
   }
 }
 
-void Backtrace::prettify()
+void Backtrace::prettify(SymbolCache* Cache)
 {
-  std::vector<std::unique_ptr<Symboliser>> Symbolisers = makeSymbolisers();
-  if (Symbolisers.empty())
-  {
-    MONOMUX_TRACE_LOG(Symboliser::noSymbolisersMessage());
-    return;
-  }
-
   std::map<std::string, std::vector<Frame*>> FramesPerBinary;
   for (Frame& F : Frames)
   {
@@ -714,6 +1047,9 @@ void Backtrace::prettify()
     if (!F.Address || F.Data.Full.empty())
       // Nothing to prettify.
       return;
+    if (F.Data.Binary.empty())
+      // The frame was not in any of the objects loaded.
+      continue;
 
     auto& FramesForBinaryOfThisFrame =
       FramesPerBinary
@@ -722,18 +1058,44 @@ void Backtrace::prettify()
     FramesForBinaryOfThisFrame.emplace_back(&F);
   }
 
+  // The symbolisers are only looked for if there is something to symbolise
+  // that is not in the cache.
+  std::optional<std::vector<std::unique_ptr<Symboliser>>> Symbolisers;
   for (auto& P : FramesPerBinary)
   {
-    MONOMUX_TRACE_LOG(LOG(data) << "Prettifying " << P.second.size()
-                                << " stack frames from '" << P.first << "'");
     const std::string& Object = P.first;
-    const auto& Frames = P.second;
+    std::vector<Frame*>& Frames = P.second;
     putSharedObjectOffsets(Frames);
+    if (Cache)
+    {
+      Frames.erase(std::remove_if(Frames.begin(),
+                                  Frames.end(),
+                                  [Cache, &Object](Frame* F) {
+                                    if (!F->ImageOffset)
+                                      return false;
+                                    F->Info =
+                                      Cache->find(Object, F->ImageOffset);
+                                    return F->Info.has_value();
+                                  }),
+                   Frames.end());
+      if (Frames.empty())
+        continue;
+    }
+    MONOMUX_TRACE_LOG(LOG(data) << "Prettifying " << Frames.size()
+                                << " stack frames from '" << Object << "'");
+
+    if (!Symbolisers)
+      Symbolisers = makeSymbolisers();
+    if (Symbolisers->empty())
+    {
+      MONOMUX_TRACE_LOG(Symboliser::noSymbolisersMessage());
+      return;
+    }
 
     auto SymbolisersForThisObject = [&Symbolisers] {
       std::vector<Symboliser*> SymbPtrs;
-      std::transform(Symbolisers.begin(),
-                     Symbolisers.end(),
+      std::transform(Symbolisers->begin(),
+                     Symbolisers->end(),
                      std::back_inserter(SymbPtrs),
                      [](auto&& SPtr) { return SPtr.get(); });
       return SymbPtrs;
@@ -768,6 +1130,11 @@ void Backtrace::prettify()
 
       SymbolisersForThisObject.pop_back();
     }
+
+    if (Cache)
+      for (Frame* F : Frames)
+        if (F->ImageOffset && F->Info && F->Info->hasMeaningfulInformation())
+          Cache->insert(Object, F->ImageOffset, *F->Info);
   }
 }
 
@@ -1060,6 +1427,174 @@ private:
 
 } // namespace
 
+namespace
+{
+
+/// The first line of the file of a \p SymbolCache, identifying the format.
+constexpr char SymbolCacheHeader[] = "monomux-symbols 1";
+/// The number of fields a symbol (and each symbol inlining it) is saved as.
+constexpr std::size_t SymbolFields = 4;
+
+/// Appends \p S, and the symbols inlining it, to \p Out as tab-separated
+/// fields.
+void serialiseSymbol(std::string& Out, const Backtrace::Symbol& S)
+{
+  for (const Backtrace::Symbol* P = &S; P; P = P->InlinedBy.get())
+  {
+    if (P != &S)
+      Out.push_back('\t');
+    Out.append(P->Name).append("\t").append(P->Filename);
+    Out.append("\t").append(std::to_string(P->Line));
+    Out.append("\t").append(std::to_string(P->Column));
+  }
+}
+
+std::optional<Backtrace::Symbol> deserialiseSymbol(std::string_view In)
+{
+  std::vector<std::string_view> Fields;
+  while (true)
+  {
+    const auto Tab = In.find('\t');
+    Fields.emplace_back(In.substr(0, Tab));
+    if (Tab == std::string_view::npos)
+      break;
+    In.remove_prefix(Tab + 1);
+  }
+  if (Fields.empty() || Fields.size() % SymbolFields != 0)
+    return std::nullopt;
+
+  Backtrace::Symbol Result{};
+  Backtrace::Symbol* S = &Result;
+  for (std::size_t I = 0; I < Fields.size(); I += SymbolFields)
+  {
+    if (I)
+      S = &S->startInlineInfo();
+    S->Name = Fields.at(I);
+    S->Filename = Fields.at(I + 1);
+    std::from_chars(Fields.at(I + 2).data(),
+                    Fields.at(I + 2).data() + Fields.at(I + 2).size(),
+                    S->Line);
+    std::from_chars(Fields.at(I + 3).data(),
+                    Fields.at(I + 3).data() + Fields.at(I + 3).size(),
+                    S->Column);
+  }
+  return Result;
+}
+
+/// Creates the directory \p Path, and its parents, if they do not exist.
+void makeDirectories(const std::string& Path)
+{
+  for (std::size_t Slash = Path.find('/', 1); Slash != std::string::npos;
+       Slash = Path.find('/', Slash + 1))
+    ::mkdir(Path.substr(0, Slash).c_str(), 0700);
+  ::mkdir(Path.c_str(), 0700);
+}
+
+} // namespace
+
+SymbolCache::SymbolCache(std::string Path) : Path(std::move(Path))
+{
+  std::ifstream File{this->Path, std::ios::in};
+  std::string Line;
+  if (!File.is_open() || !std::getline(File, Line) ||
+      Line != SymbolCacheHeader)
+    return;
+
+  while (std::getline(File, Line))
+  {
+    // The key is the first four fields: the binary, its size and time of
+    // modification, and the offset in the image.
+    std::size_t KeyEnd = 0;
+    for (std::size_t I = 0; I < 4 && KeyEnd != std::string::npos; ++I)
+      KeyEnd = Line.find('\t', KeyEnd ? KeyEnd + 1 : 0);
+    if (KeyEnd == std::string::npos)
+      continue;
+    Entries.try_emplace(Line.substr(0, KeyEnd), Line.substr(KeyEnd + 1));
+  }
+}
+
+std::string SymbolCache::defaultPath()
+{
+  std::string Dir = getEnv("XDG_CACHE_HOME");
+  if (Dir.empty())
+  {
+    Dir = getEnv("HOME");
+    if (Dir.empty())
+      return {};
+    Dir.append("/.cache");
+  }
+  return Dir + "/monomux/symbols";
+}
+
+std::string SymbolCache::key(const std::string& Binary,
+                             const void* ImageOffset)
+{
+  POD<struct ::stat> Info;
+  if (::stat(Binary.c_str(), &Info) != 0)
+    return {};
+
+  std::ostringstream Key;
+  Key << Binary << '\t' << Info->st_size << '\t' << Info->st_mtim.tv_sec << '.'
+      << Info->st_mtim.tv_nsec << '\t' << ImageOffset;
+  return Key.str();
+}
+
+std::optional<Backtrace::Symbol>
+SymbolCache::find(const std::string& Binary, const void* ImageOffset) const
+{
+  std::string Key = key(Binary, ImageOffset);
+  if (Key.empty())
+    return std::nullopt;
+  auto It = Entries.find(Key);
+  if (It == Entries.end())
+    return std::nullopt;
+  return deserialiseSymbol(It->second);
+}
+
+void SymbolCache::insert(const std::string& Binary,
+                         const void* ImageOffset,
+                         const Backtrace::Symbol& Symbol)
+{
+  std::string Key = key(Binary, ImageOffset);
+  std::string Value;
+  serialiseSymbol(Value, Symbol);
+  if (Key.empty() || Key.find('\n') != std::string::npos ||
+      Value.find('\n') != std::string::npos)
+    return;
+  Entries.insert_or_assign(std::move(Key), std::move(Value));
+  Changed = true;
+}
+
+void SymbolCache::save() const
+{
+  if (!Changed || Path.empty())
+    return;
+
+  const auto Slash = Path.find_last_of('/');
+  if (Slash != std::string::npos && Slash != 0)
+    makeDirectories(Path.substr(0, Slash));
+
+  // The new contents replace the file at once, so a concurrent run does not
+  // see a partially written cache.
+  const std::string Temporary = Path + '.' + std::to_string(::getpid());
+  {
+    std::ofstream File{Temporary, std::ios::out | std::ios::trunc};
+    if (!File.is_open())
+    {
+      LOG(warn) << "Failed to save the symbol cache to '" << Path << '\'';
+      return;
+    }
+    File << SymbolCacheHeader << '\n';
+    for (const auto& [Key, Value] : Entries)
+      File << Key << '\t' << Value << '\n';
+  }
+  if (std::rename(Temporary.c_str(), Path.c_str()) != 0)
+  {
+    LOG(warn) << "Failed to save the symbol cache to '" << Path << '\'';
+    std::remove(Temporary.c_str());
+  }
+}
+
 void printBacktrace(std::ostream& OS, const Backtrace& Trace)
 {
   OS << "Stack trace (most recent call last):\n";
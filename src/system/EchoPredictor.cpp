@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "monomux/system/EchoPredictor.hpp"
+
+namespace monomux
+{
+
+/// \returns whether \p Char is echoed by the terminal as is.
+static bool isPrintable(char Char) noexcept
+{
+  return Char >= ' ' && Char < 0x7F;
+}
+
+std::string_view EchoPredictor::setEnabled(bool Enabled)
+{
+  Result.clear();
+  if (this->Enabled && !Enabled)
+  {
+    discard();
+    Barrier = false;
+  }
+  this->Enabled = Enabled;
+  return Result;
+}
+
+std::string_view EchoPredictor::predict(std::string_view Input)
+{
+  Result.clear();
+  if (!Enabled || Barrier)
+    return Result;
+
+  for (char Char : Input)
+  {
+    if (!isPrintable(Char))
+    {
+      // The echo of control keys is not known, and the program might react
+      // to them by changing how it handles the input.
+      Barrier = true;
+      Confirmed = false;
+      break;
+    }
+
+    Predicted.push_back(Char);
+    if (Confirmed && Displayed + 1 == Predicted.size())
+    {
+      Result.push_back(Char);
+      ++Displayed;
+    }
+  }
+  return Result;
+}
+
+std::string_view EchoPredictor::reconcile(std::string_view Output)
+{
+  if (Predicted.empty())
+  {
+    Barrier = false;
+    return Output;
+  }
+
+  Result.clear();
+  std::size_t Matched = 0;
+  for (; Matched < Output.size() && Matched < Predicted.size(); ++Matched)
+  {
+    if (Output[Matched] != Predicted[Matched])
+      break;
+    if (Matched >= Displayed)
+      // The echo of a prediction that is not displayed is written as usual.
+      Result.push_back(Output[Matched]);
+  }
+  Predicted.erase(0, Matched);
+  Displayed -= std::min(Matched, Displayed);
+
+  if (!Predicted.empty() && Matched < Output.size())
+  {
+    // Something other than the echo of the input arrived.
+    discard();
+    Barrier = false;
+    Result.append(Output.substr(Matched));
+    return Result;
+  }
+
+  if (Matched && !Barrier)
+  {
+    Confirmed = true;
+    // The input typed while the echo was unconfirmed is displayed now.
+    Result.append(Predicted, Displayed);
+    Displayed = Predicted.size();
+  }
+  if (Predicted.empty())
+    Barrier = false;
+  Result.append(Output.substr(Matched));
+  return Result;
+}
+
+void EchoPredictor::discard()
+{
+  if (Displayed)
+  {
+    Result.append(Displayed, '\b');
+    Result.append(EraseLine);
+  }
+  Predicted.clear();
+  Displayed = 0;
+  Confirmed = false;
+}
+
+} // namespace monomux
@@ -26,6 +26,7 @@
 
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Socket.hpp"
 
 #include "monomux/system/Environment.hpp"
 
@@ -119,6 +120,15 @@ SocketPath SocketPath::absolutise(const std::string& Path)
 {
   LOG(trace) << "Absolutising path \"" << Path << "\"...";
 
+  if (Socket::transportOf(Path) != Socket::Transport::Unix)
+  {
+    // Network addresses are not in the file system, and used verbatim.
+    SocketPath SP;
+    SP.Filename = Path;
+    SP.IsPathLikelyUserSpecific = false;
+    return SP;
+  }
+
   POD<char[PATH_MAX]> Result;
   if (Path.front() == '/')
   {
@@ -16,13 +16,18 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <iomanip>
+#include <limits>
+#include <system_error>
 
 #include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/Trace.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/EventTrace.hpp"
 
 #include "monomux/system/Event.hpp"
 
@@ -33,75 +38,92 @@
 namespace monomux
 {
 
-EPoll::EPoll(std::size_t EventCount)
+EPoll::EPoll(std::size_t EventCount) : EPoll(EventCount, NoKernelPoll{})
 {
-  Notifications.resize(EventCount);
-  ScheduledResult.reserve(EventCount);
-  ScheduledWaiting.reserve(EventCount);
-
   MasterFD = CheckedPOSIXThrow(
     [EventCount] { return ::epoll_create(EventCount); }, "epoll_create()", -1);
   fd::setNonBlockingCloseOnExec(MasterFD.get());
 
   LOG_WITH_IDENTIFIER(debug) << "Created with " << EventCount << " events";
+  listenForScheduled();
+}
+
+EPoll::EPoll(std::size_t EventCount, NoKernelPoll)
+{
+  Notifications.resize(EventCount);
+  ScheduledResult.reserve(EventCount);
+  ScheduledWaiting.reserve(EventCount);
 
   ScheduleFD = CheckedPOSIXThrow(
     [] { return ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); }, "eventfd()", -1);
-  LOG_WITH_IDENTIFIER(debug) << "Created eventfd token at " << ScheduleFD;
-  listen(ScheduleFD.get(), /* Incoming =*/true, /* Outgoing =*/false);
 }
 
 EPoll::~EPoll() { LOG_WITH_IDENTIFIER(debug) << "~EPoll"; }
 
-std::size_t EPoll::wait()
+void EPoll::listenForScheduled()
+{
+  LOG_WITH_IDENTIFIER(debug) << "Created eventfd token at " << ScheduleFD;
+  listen(ScheduleFD.get(), /* Incoming =*/true, /* Outgoing =*/false);
+  ScheduleListener = &Listeners.at(ScheduleFD.get());
+}
+
+std::size_t EPoll::wait(std::chrono::milliseconds Timeout)
 {
   ScheduledResult.clear();
   ScheduleFDNotifiedAtIndex.reset();
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "epoll_wait()...");
-  auto MaybeFiredEventCount = CheckedPOSIX(
-    [this] {
-      return ::epoll_wait(
-        MasterFD, &(*Notifications.data()), getMaxEventCount(), -1);
-    },
-    -1);
-  if (!MaybeFiredEventCount)
+  // If events are already scheduled, the system is only polled for what is
+  // ready right now. Otherwise, threads scheduling while we block must know
+  // that they have to wake us up.
   {
-    std::error_code EC = MaybeFiredEventCount.getError();
-    if (EC == std::errc::interrupted /* EINTR */)
-      // Interrupting epoll_wait() is not an issue.
-      return 0;
-    throw std::system_error{EC, "epoll_wait()"};
+    std::lock_guard<std::mutex> Lock{ScheduleLock};
+    if (!ScheduledWaiting.empty())
+      Timeout = std::chrono::milliseconds::zero();
+    Blocking = Timeout != std::chrono::milliseconds::zero();
+    // The events of the previous batch, which might have referred to the
+    // stopped listeners, are no longer accessible.
+    Stopped.clear();
   }
-  NotificationCount = MaybeFiredEventCount.get();
-  if (!ScheduledWaiting.empty())
-  {
-    // If there are scheduled results, the 'eventfd' will trigger and that
-    // will count as a nofication, but this would destroy our calculations.
-    --NotificationCount;
 
-    // Consume the scheduled event token.
-    POD<std::uint64_t> ScheduledCount;
-    CheckedPOSIX(
-      [Token = ScheduleFD.get(), &ScheduledCount] {
-        return ::read(Token, &ScheduledCount, sizeof(ScheduledCount));
-      },
-      -1);
-    if (ScheduledCount != ScheduledWaiting.size())
-      LOG_WITH_IDENTIFIER(debug) << "eventfd_read() -> " << ScheduledCount
-                                 << " != expected " << ScheduledWaiting.size();
-
-    // Save where the ScheduleFD was triggered at. The client should not be
-    // allowed to directly see that event.
-    for (std::size_t I = 0; I < NotificationCount + 1; ++I)
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "epoll_wait()...");
+  EventTrace::Clock::time_point WaitStart;
+  if (Trace)
+    WaitStart = EventTrace::Clock::now();
+  MONOMUX_PROBE(wait_enter, MasterFD.get(), Timeout.count());
+  NotificationCount =
+    waitImpl(&(*Notifications.data()), getMaxEventCount(), Timeout);
+  MONOMUX_PROBE(wait_exit, MasterFD.get(), NotificationCount);
+
+  // If another thread woke us up, the 'eventfd' will trigger and that will
+  // count as a notification, but this would destroy our calculations. Save
+  // where the ScheduleFD was triggered at. The client should not be allowed to
+  // directly see that event.
+  //
+  // The token is always counted before it is written, so if no wake-ups are
+  // outstanding, the 'eventfd' can not be in the result.
+  if (PendingWakes.load())
+    for (std::size_t I = 0; I < NotificationCount; ++I)
     {
       const struct ::epoll_event& E = **(Notifications.begin() + I);
-      if (E.data.fd == ScheduleFD)
+      if (E.data.ptr == ScheduleListener)
       {
         ScheduleFDNotifiedAtIndex.emplace(I);
         break;
       }
     }
+  if (ScheduleFDNotifiedAtIndex)
+  {
+    --NotificationCount;
+
+    // Consume the wake-up tokens.
+    POD<std::uint64_t> WakeCount;
+    auto Read = CheckedPOSIX(
+      [Token = ScheduleFD.get(), &WakeCount] {
+        return ::read(Token, &WakeCount, sizeof(WakeCount));
+      },
+      -1);
+    if (Read)
+      PendingWakes -= *WakeCount;
   }
 
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
@@ -109,8 +131,12 @@ std::size_t EPoll::wait()
                     << " -> " << NotificationCount << " events");
 
   // Move the events that were scheduled before wait() into the result set.
-  ScheduledWaiting.swap(ScheduledResult);
-  ScheduledWaitingMap.clear();
+  {
+    std::lock_guard<std::mutex> Lock{ScheduleLock};
+    Blocking = false;
+    ScheduledWaiting.swap(ScheduledResult);
+    ScheduledWaitingMap.clear();
+  }
   MONOMUX_TRACE_LOG({
     if (!ScheduledResult.empty())
       LOG_WITH_IDENTIFIER(trace)
@@ -118,30 +144,43 @@ std::size_t EPoll::wait()
         << " -> " << ScheduledResult.size() << " scheduled";
   });
 
+  if (Trace)
+  {
+    const std::size_t Count = ScheduledResult.size() + NotificationCount;
+    Trace->batch(WaitStart, Count);
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      const EventWithMode E = eventAt(I);
+      Trace->event(E.FD, E.Incoming, E.Outgoing);
+    }
+    EventTrace::setCurrent(Trace);
+  }
+
   return ScheduledResult.size() + NotificationCount;
 }
 
 void EPoll::schedule(raw_fd FD, bool Incoming, bool Outgoing)
 {
-  auto SetupEvent = [=](struct ::epoll_event& E) {
-    E.data.fd = FD;
+  auto SetupEvent = [=](ScheduledEvent& E) {
     if (Incoming)
-      E.events |= EPOLLIN;
+      E.Events |= EPOLLIN;
     if (Outgoing)
-      E.events |= EPOLLOUT;
+      E.Events |= EPOLLOUT;
   };
 
+  std::lock_guard<std::mutex> Lock{ScheduleLock};
   auto* MaybeIt = ScheduledWaitingMap.tryGet(FD);
   if (!MaybeIt)
   {
-    CheckedPOSIX(
-      [Token = ScheduleFD.get()] {
-        static UniqueScalar<std::uint64_t, 1> One;
-        return ::write(Token, &One, sizeof(One));
-      },
-      -1);
-
-    struct ::epoll_event& E = ScheduledWaiting.emplace_back();
+    // Scheduling from the thread that executes wait(), or from another thread
+    // while the waiting thread is not blocked, will be picked up by the next
+    // wait() without the need to wake anything.
+    if (Blocking && ScheduledWaiting.empty())
+      wake();
+
+    auto It = Listeners.find(FD);
+    ScheduledEvent& E = ScheduledWaiting.emplace_back(ScheduledEvent{
+      FD, 0, It != Listeners.end() ? &It->second : nullptr});
     ScheduledWaitingMap.set(FD, ScheduledWaiting.end() - 1);
     SetupEvent(E);
     return;
@@ -149,20 +188,62 @@ void EPoll::schedule(raw_fd FD, bool Incoming, bool Outgoing)
   SetupEvent(**MaybeIt);
 }
 
+void EPoll::wake()
+{
+  ++PendingWakes;
+  CheckedPOSIX(
+    [Token = ScheduleFD.get()] {
+      static UniqueScalar<std::uint64_t, 1> One;
+      return ::write(Token, &One, sizeof(One));
+    },
+    -1);
+}
+
+bool EPoll::startQueuedReads(raw_fd /* FD */) { return false; }
+
+void EPoll::stopQueuedReads(raw_fd /* FD */) {}
+
+std::size_t EPoll::readQueued(raw_fd /* FD */,
+                              const ::iovec* /* Vectors */,
+                              std::size_t /* Count */,
+                              bool& Continue,
+                              bool& /* EndOfFile */)
+{
+  Continue = false;
+  throw std::system_error{
+    std::make_error_code(std::errc::operation_not_supported),
+    "epoll does not read files"};
+}
+
+std::optional<std::size_t>
+EPoll::writeQueued(const std::shared_ptr<QueuedWrites>& /* Writes */,
+                   const ::iovec* /* Vectors */,
+                   std::size_t /* Count */,
+                   bool& /* Continue */)
+{
+  return std::nullopt;
+}
+
+void EPoll::cancelQueuedWrite(const QueuedWrites& /* Writes */) {}
+
 bool EPoll::isValidIndex(std::size_t I) const noexcept
 {
   return I < ScheduledResult.size() + NotificationCount;
 }
 
-const struct ::epoll_event& EPoll::at(std::size_t Index) const
+const struct ::epoll_event*
+EPoll::at(std::size_t Index, const ScheduledEvent** Scheduled) const
 {
   assert(isValidIndex(Index) && "Read past the end of the buffer.");
 
   const std::size_t ScheduledCount = ScheduledResult.size();
   if (Index < ScheduledCount)
+  {
     // The first set of events appearing to the client should be the
     // manually scheduled ones.
-    return *ScheduledResult.at(Index);
+    *Scheduled = &ScheduledResult[Index];
+    return nullptr;
+  }
 
   // The rest of the buffer should be taken from the real system result set.
   Index -= ScheduledCount;
@@ -170,13 +251,13 @@ const struct ::epoll_event& EPoll::at(std::size_t Index) const
   // arrived.
   if (!ScheduleFDNotifiedAtIndex.has_value() ||
       Index < *ScheduleFDNotifiedAtIndex)
-    return *Notifications.at(Index);
-  return *Notifications.at(Index + 1);
+    return &*Notifications[Index];
+  return &*Notifications[Index + 1];
 }
 
 raw_fd EPoll::fdAt(std::size_t Index) noexcept
 {
-  return isValidIndex(Index) ? at(Index).data.fd : fd::Invalid;
+  return eventAt(Index).FD;
 }
 
 EPoll::EventWithMode EPoll::eventAt(std::size_t Index) noexcept
@@ -184,69 +265,142 @@ EPoll::EventWithMode EPoll::eventAt(std::size_t Index) noexcept
   if (!isValidIndex(Index))
     return {fd::Invalid, false, false};
 
-  const struct ::epoll_event& E = at(Index);
-  return {E.data.fd,
-          (E.events & EPOLLIN) == EPOLLIN,
-          (E.events & EPOLLOUT) == EPOLLOUT};
+  const ScheduledEvent* Scheduled = nullptr;
+  const struct ::epoll_event* E = at(Index, &Scheduled);
+  const Listener* L = E ? static_cast<const Listener*>(E->data.ptr)
+                        : Scheduled->Registration;
+  const std::uint32_t Events = E ? E->events : Scheduled->Events;
+  return {E ? L->FDToListenFor : Scheduled->FD,
+          (Events & EPOLLIN) == EPOLLIN,
+          (Events & EPOLLOUT) == EPOLLOUT,
+          L && L->Listening ? L->UserData : nullptr};
+}
+
+std::size_t EPoll::waitImpl(struct ::epoll_event* Events,
+                            std::size_t MaxEvents,
+                            std::chrono::milliseconds Timeout)
+{
+  int TimeoutMS = -1;
+  if (Timeout.count() >= 0)
+    TimeoutMS = static_cast<int>(std::min<std::chrono::milliseconds::rep>(
+      Timeout.count(), std::numeric_limits<int>::max()));
+  auto MaybeFiredEventCount = CheckedPOSIX(
+    [this, Events, MaxEvents, TimeoutMS] {
+      return ::epoll_wait(MasterFD, Events, MaxEvents, TimeoutMS);
+    },
+    -1);
+  if (!MaybeFiredEventCount)
+  {
+    std::error_code EC = MaybeFiredEventCount.getError();
+    if (EC == std::errc::interrupted /* EINTR */)
+      // Interrupting epoll_wait() is not an issue.
+      return 0;
+    throw std::system_error{EC, "epoll_wait()"};
+  }
+  return MaybeFiredEventCount.get();
+}
+
+void EPoll::addImpl(raw_fd FD, std::uint32_t Events, ::epoll_data_t Data)
+{
+  POD<struct ::epoll_event> Control;
+  Control->data = Data;
+  Control->events = Events;
+
+  CheckedPOSIXThrow(
+    [this, &Control, FD] {
+      return ::epoll_ctl(MasterFD, EPOLL_CTL_ADD, FD, &Control);
+    },
+    "epoll_ctl registering file",
+    -1);
+}
+
+void EPoll::removeImpl(raw_fd FD)
+{
+  POD<struct ::epoll_event> Control;
+  CheckedPOSIX(
+    [this, &Control, FD] {
+      return ::epoll_ctl(MasterFD, EPOLL_CTL_DEL, FD, &Control);
+    },
+    -1);
 }
 
-void EPoll::listen(raw_fd FD, bool Incoming, bool Outgoing)
+void EPoll::listen(raw_fd FD,
+                   bool Incoming,
+                   bool Outgoing,
+                   bool EdgeTriggered,
+                   void* UserData)
 {
-  Listeners.try_emplace(FD, *this, FD, Incoming, Outgoing);
+  std::lock_guard<std::mutex> Lock{ScheduleLock};
+  auto [It, Inserted] = Listeners.try_emplace(
+    FD, *this, FD, Incoming, Outgoing, EdgeTriggered, UserData);
+  // Events scheduled for the file before it was stopped and listened for
+  // again are delivered to the new registration.
+  if (Inserted)
+    if (auto* MaybeScheduled = ScheduledWaitingMap.tryGet(FD))
+      (*MaybeScheduled)->Registration = &It->second;
 }
 
 void EPoll::stop(raw_fd FD)
 {
+  std::lock_guard<std::mutex> Lock{ScheduleLock};
   auto It = Listeners.find(FD);
   if (It == Listeners.end())
     return;
-  Listeners.erase(It);
+
+  It->second.stop();
+  if (auto* MaybeScheduled = ScheduledWaitingMap.tryGet(FD))
+    (*MaybeScheduled)->Registration = nullptr;
+  // Keep the stopped listener alive while the received events might refer it.
+  Stopped.emplace_back(Listeners.extract(It));
 }
 
 void EPoll::clear()
 {
+  std::lock_guard<std::mutex> Lock{ScheduleLock};
   for (auto It = Listeners.begin(); It != Listeners.end();)
-    It = Listeners.erase(It);
+  {
+    It->second.stop();
+    if (auto* MaybeScheduled = ScheduledWaitingMap.tryGet(It->first))
+      (*MaybeScheduled)->Registration = nullptr;
+    Stopped.emplace_back(Listeners.extract(It++));
+  }
 }
 
 EPoll::Listener::Listener(EPoll& Master,
                           raw_fd FD,
                           bool Incoming,
-                          bool Outgoing)
-  : Master(Master), FDToListenFor(FD)
+                          bool Outgoing,
+                          bool EdgeTriggered,
+                          void* UserData)
+  : Master(Master), FDToListenFor(FD), UserData(UserData), Listening(true)
 {
-  POD<struct ::epoll_event> Control;
-  Control->data.fd = FD;
-  Control->events = EPOLLHUP | EPOLLRDHUP;
+  std::uint32_t Events = EPOLLHUP | EPOLLRDHUP;
   if (Incoming)
-    Control->events |= EPOLLIN;
+    Events |= EPOLLIN;
   if (Outgoing)
-    Control->events |= EPOLLOUT;
+    Events |= EPOLLOUT;
+  if (EdgeTriggered)
+    Events |= EPOLLET;
 
-  CheckedPOSIXThrow(
-    [&Master, &Control, FD] {
-      return ::epoll_ctl(Master.MasterFD, EPOLL_CTL_ADD, FD, &Control);
-    },
-    "epoll_ctl registering file",
-    -1);
+  POD<::epoll_data_t> Data;
+  Data->ptr = this;
+  Master.addImpl(FD, Events, Data);
   LOG(trace) << Master.MasterFD << ": "
              << "Listen for FD " << FD << "(incoming: " << std::boolalpha
-             << Incoming << ", outgoing: " << Outgoing << std::noboolalpha
+             << Incoming << ", outgoing: " << Outgoing
+             << ", edge-triggered: " << EdgeTriggered << std::noboolalpha
              << ')';
 }
 
-EPoll::Listener::~Listener()
+EPoll::Listener::~Listener() { stop(); }
+
+void EPoll::Listener::stop()
 {
-  if (FDToListenFor == fd::Invalid)
+  if (!Listening || FDToListenFor == fd::Invalid)
     return;
 
-  POD<struct ::epoll_event> Control;
-  CheckedPOSIX(
-    [this, &Control] {
-      return ::epoll_ctl(
-        Master.MasterFD, EPOLL_CTL_DEL, FDToListenFor, &Control);
-    },
-    -1);
+  Listening = false;
+  Master.removeImpl(FDToListenFor);
   LOG(trace) << Master.MasterFD << ": "
              << "Stop listening for FD " << FDToListenFor;
 }
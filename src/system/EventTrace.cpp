@@ -0,0 +1,317 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/EventTrace.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/EventTrace")
+
+namespace monomux
+{
+
+namespace
+{
+
+thread_local EventTrace* CurrentTrace = nullptr;
+
+template <typename T> void append(std::string& Out, T Value)
+{
+  for (std::size_t I = 0; I < sizeof(T); ++I)
+    Out.push_back(static_cast<char>((Value >> (I * 8)) & 0xFF));
+}
+
+template <typename T> bool take(std::string_view& In, T& Value)
+{
+  if (In.size() < sizeof(T))
+    return false;
+  Value = 0;
+  for (std::size_t I = 0; I < sizeof(T); ++I)
+    Value |= static_cast<T>(static_cast<unsigned char>(In[I])) << (I * 8);
+  In.remove_prefix(sizeof(T));
+  return true;
+}
+
+/// \returns \p D in microseconds, saturated to fit 32 bits.
+std::uint32_t micros(EventTrace::Clock::duration D) noexcept
+{
+  auto US = std::chrono::duration_cast<std::chrono::microseconds>(D).count();
+  if (US < 0)
+    return 0;
+  if (static_cast<std::uint64_t>(US) > UINT32_MAX)
+    return UINT32_MAX;
+  return static_cast<std::uint32_t>(US);
+}
+
+} // namespace
+
+EventTrace::EventTrace(const std::string& Path)
+  : Path(Path), File(CheckedPOSIXThrow(
+                  [&Path] {
+                    return ::open(Path.c_str(),
+                                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                  S_IRUSR | S_IWUSR);
+                  },
+                  "open('" + Path + "')",
+                  -1)),
+    Last(Clock::now())
+{
+  Buffer.reserve(FlushSize + 64);
+  Buffer.append(Magic);
+}
+
+EventTrace::~EventTrace()
+{
+  if (CurrentTrace == this)
+    CurrentTrace = nullptr;
+  flush();
+}
+
+EventTrace* EventTrace::current() noexcept { return CurrentTrace; }
+
+void EventTrace::setCurrent(EventTrace* Trace) noexcept
+{
+  CurrentTrace = Trace;
+}
+
+void EventTrace::header(RecordKind Kind, Clock::time_point Now)
+{
+  if (!PendingEvents && Buffer.size() >= FlushSize)
+    write();
+  out().push_back(static_cast<char>(Kind));
+  append<std::uint32_t>(out(), micros(Now - Last));
+  Last = Now;
+}
+
+void EventTrace::batch(Clock::time_point WaitStart,
+                       std::size_t Count,
+                       Clock::time_point Now)
+{
+  std::lock_guard<std::mutex> L{Lock};
+  // The record is timed by the start of the wait, and the time spent handling
+  // the previous batch is the gap between the two.
+  header(Batch, WaitStart);
+  append<std::uint32_t>(Buffer, micros(Now - WaitStart));
+  PendingEvents = std::min<std::size_t>(Count, UINT16_MAX);
+  append<std::uint16_t>(Buffer, static_cast<std::uint16_t>(PendingEvents));
+  Last = Now;
+}
+
+void EventTrace::event(raw_fd FD, bool Incoming, bool Outgoing)
+{
+  std::lock_guard<std::mutex> L{Lock};
+  if (!PendingEvents)
+    // (More events than the record of the batch could count.)
+    return;
+  append<std::uint32_t>(Buffer, static_cast<std::uint32_t>(FD));
+  Buffer.push_back(static_cast<char>((Incoming ? EventIncoming : 0) |
+                                     (Outgoing ? EventOutgoing : 0)));
+  if (--PendingEvents == 0)
+  {
+    Buffer.append(Deferred);
+    Deferred.clear();
+  }
+}
+
+void EventTrace::connection(RecordKind Change,
+                            raw_fd FD,
+                            Role Kind,
+                            Clock::time_point Now)
+{
+  std::lock_guard<std::mutex> L{Lock};
+  header(Change, Now);
+  append<std::uint32_t>(out(), static_cast<std::uint32_t>(FD));
+  out().push_back(static_cast<char>(Kind));
+}
+
+void EventTrace::attachment(RecordKind Change,
+                            raw_fd Client,
+                            raw_fd Session,
+                            Clock::time_point Now)
+{
+  std::lock_guard<std::mutex> L{Lock};
+  header(Change, Now);
+  append<std::uint32_t>(out(), static_cast<std::uint32_t>(Client));
+  append<std::uint32_t>(out(), static_cast<std::uint32_t>(Session));
+}
+
+void EventTrace::io(RecordKind Kind,
+                    raw_fd FD,
+                    std::size_t Bytes,
+                    Clock::time_point Now)
+{
+  std::lock_guard<std::mutex> L{Lock};
+  header(Kind, Now);
+  append<std::uint32_t>(out(), static_cast<std::uint32_t>(FD));
+  append<std::uint32_t>(out(),
+                        static_cast<std::uint32_t>(
+                          std::min<std::size_t>(Bytes, UINT32_MAX)));
+}
+
+void EventTrace::flush()
+{
+  std::lock_guard<std::mutex> L{Lock};
+  // (The records deferred behind a batch cut short are kept in order.)
+  Buffer.append(Deferred);
+  Deferred.clear();
+  PendingEvents = 0;
+  write();
+}
+
+void EventTrace::write()
+{
+  std::string_view Data = Buffer;
+  while (!Failed && !Data.empty())
+  {
+    auto Written = CheckedPOSIX(
+      [this, &Data] { return ::write(File, Data.data(), Data.size()); }, -1);
+    if (!Written)
+    {
+      if (Written.getError() == std::errc::interrupted /* EINTR */)
+        continue;
+      LOG(error) << "Failed to write trace '" << Path
+                 << "': " << Written.getError().message();
+      Failed = true;
+      break;
+    }
+    Data.remove_prefix(static_cast<std::size_t>(Written.get()));
+  }
+  Buffer.clear();
+}
+
+std::optional<std::vector<EventTraceReader::Batch>>
+EventTraceReader::parse(std::string_view Data)
+{
+  if (Data.substr(0, EventTrace::Magic.size()) != EventTrace::Magic)
+    return std::nullopt;
+  Data.remove_prefix(EventTrace::Magic.size());
+
+  std::vector<Batch> Batches;
+  std::vector<Change> Changes;
+  std::chrono::microseconds Time{0};
+  while (!Data.empty())
+  {
+    std::string_view Record = Data;
+    std::uint8_t Kind;
+    std::uint32_t Delta;
+    if (!take(Record, Kind) || !take(Record, Delta))
+      break;
+
+    if (Kind == EventTrace::Batch)
+    {
+      std::uint32_t Waited;
+      std::uint16_t Count;
+      if (!take(Record, Waited) || !take(Record, Count))
+        break;
+      Batch B;
+      B.Start = Time + std::chrono::microseconds{Delta};
+      B.Waited = std::chrono::microseconds{Waited};
+      B.Events.reserve(Count);
+      bool Whole = true;
+      for (std::uint16_t I = 0; I < Count; ++I)
+      {
+        std::uint32_t FD;
+        std::uint8_t Mode;
+        if (!take(Record, FD) || !take(Record, Mode))
+        {
+          Whole = false;
+          break;
+        }
+        B.Events.push_back(Event{static_cast<raw_fd>(FD),
+                                 (Mode & EventTrace::EventIncoming) != 0,
+                                 (Mode & EventTrace::EventOutgoing) != 0});
+      }
+      if (!Whole)
+        break;
+
+      if (!Batches.empty())
+        Batches.back().Handled = B.Start - Batches.back().Start -
+                                 Batches.back().Waited;
+      Time = B.Start + B.Waited;
+      B.Changes = std::move(Changes);
+      Changes.clear();
+      Batches.emplace_back(std::move(B));
+    }
+    else if (Kind == EventTrace::Read || Kind == EventTrace::Write)
+    {
+      std::uint32_t FD;
+      std::uint32_t Bytes;
+      if (!take(Record, FD) || !take(Record, Bytes))
+        break;
+      Time += std::chrono::microseconds{Delta};
+      if (!Batches.empty())
+        Batches.back().IOs.push_back(
+          IO{static_cast<EventTrace::RecordKind>(Kind),
+             static_cast<raw_fd>(FD),
+             Bytes});
+    }
+    else if (Kind == EventTrace::Open || Kind == EventTrace::Close)
+    {
+      std::uint32_t FD;
+      std::uint8_t Role;
+      if (!take(Record, FD) || !take(Record, Role))
+        break;
+      Time += std::chrono::microseconds{Delta};
+      Changes.push_back(Change{static_cast<EventTrace::RecordKind>(Kind),
+                               static_cast<raw_fd>(FD),
+                               static_cast<EventTrace::Role>(Role),
+                               fd::Invalid});
+    }
+    else if (Kind == EventTrace::Attach || Kind == EventTrace::Detach)
+    {
+      std::uint32_t Client;
+      std::uint32_t Session;
+      if (!take(Record, Client) || !take(Record, Session))
+        break;
+      Time += std::chrono::microseconds{Delta};
+      Changes.push_back(Change{static_cast<EventTrace::RecordKind>(Kind),
+                               static_cast<raw_fd>(Client),
+                               EventTrace::ClientDataRole,
+                               static_cast<raw_fd>(Session)});
+    }
+    else
+      return std::nullopt;
+
+    Data = Record;
+  }
+  return Batches;
+}
+
+std::optional<std::vector<EventTraceReader::Batch>>
+EventTraceReader::load(const std::string& Path)
+{
+  std::ifstream In{Path, std::ios::binary};
+  if (!In)
+    return std::nullopt;
+  std::string Data{std::istreambuf_iterator<char>{In},
+                   std::istreambuf_iterator<char>{}};
+  return parse(Data);
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,804 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <system_error>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/IOUring.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/IOUring")
+#define LOG_WITH_IDENTIFIER(SEVERITY) LOG(SEVERITY) << RingFD << ": "
+
+namespace monomux
+{
+
+namespace
+{
+
+/// Marks the completions of \p IORING_OP_POLL_REMOVE and \p IORING_OP_TIMEOUT
+/// requests, which do not correspond to an event.
+constexpr std::uint64_t InternalTag = 1ULL << 63;
+/// Marks the completions of the reads and writes, which are identified by
+/// their buffer.
+constexpr std::uint64_t OperationTag = 1ULL << 62;
+constexpr std::uint32_t GenerationMask = 0x3FFF'FFFF;
+
+std::uint64_t userData(raw_fd FD, std::uint32_t Generation) noexcept
+{
+  return (static_cast<std::uint64_t>(Generation & GenerationMask) << 32) |
+         static_cast<std::uint32_t>(FD);
+}
+
+void* mapRing(raw_fd Ring, std::size_t Size, off_t Offset)
+{
+  void* Address = ::mmap(nullptr,
+                         Size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         Ring,
+                         Offset);
+  if (Address == MAP_FAILED)
+    throw std::system_error{std::error_code{errno, std::system_category()},
+                            "mmap(io_uring)"};
+  return Address;
+}
+
+template <typename T> T* ringAt(void* Ring, unsigned Offset) noexcept
+{
+  return reinterpret_cast<T*>(static_cast<char*>(Ring) + Offset);
+}
+
+} // namespace
+
+IOUring::IOUring(std::size_t EventCount) : EPoll(EventCount, NoKernelPoll{})
+{
+  POD<struct ::io_uring_params> Params;
+  RingFD = CheckedPOSIXThrow(
+    [EventCount, &Params] {
+      return static_cast<raw_fd>(
+        ::syscall(__NR_io_uring_setup, EventCount, &Params));
+    },
+    "io_uring_setup()",
+    -1);
+
+  SQRingSize = Params->sq_off.array + Params->sq_entries * sizeof(unsigned);
+  CQRingSize =
+    Params->cq_off.cqes + Params->cq_entries * sizeof(struct ::io_uring_cqe);
+  SQEsSize = Params->sq_entries * sizeof(struct ::io_uring_sqe);
+  const bool SingleMap = Params->features & IORING_FEAT_SINGLE_MMAP;
+  if (SingleMap)
+    SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+
+  try
+  {
+    SQRing = mapRing(RingFD, SQRingSize, IORING_OFF_SQ_RING);
+    CQRing =
+      SingleMap ? SQRing : mapRing(RingFD, CQRingSize, IORING_OFF_CQ_RING);
+    SQEs = static_cast<struct ::io_uring_sqe*>(
+      mapRing(RingFD, SQEsSize, IORING_OFF_SQES));
+
+    void* Arena = ::mmap(nullptr,
+                         BufferCount * BufferSize,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1,
+                         0);
+    if (Arena == MAP_FAILED)
+      throw std::system_error{std::error_code{errno, std::system_category()},
+                              "mmap(buffers)"};
+    Buffers = static_cast<char*>(Arena);
+  }
+  catch (...)
+  {
+    unmap();
+    throw;
+  }
+
+  SQHead = ringAt<unsigned>(SQRing, Params->sq_off.head);
+  SQTail = ringAt<unsigned>(SQRing, Params->sq_off.tail);
+  SQMask = *ringAt<unsigned>(SQRing, Params->sq_off.ring_mask);
+  SQEntries = *ringAt<unsigned>(SQRing, Params->sq_off.ring_entries);
+  SQArray = ringAt<unsigned>(SQRing, Params->sq_off.array);
+  SQLocalTail = *SQTail;
+  CQHead = ringAt<unsigned>(CQRing, Params->cq_off.head);
+  CQTail = ringAt<unsigned>(CQRing, Params->cq_off.tail);
+  CQMask = *ringAt<unsigned>(CQRing, Params->cq_off.ring_mask);
+  CQEs = ringAt<struct ::io_uring_cqe>(CQRing, Params->cq_off.cqes);
+
+  ::iovec Arena{Buffers, BufferCount * BufferSize};
+  auto Registered = CheckedPOSIX(
+    [this, &Arena] {
+      return static_cast<int>(::syscall(__NR_io_uring_register,
+                                        RingFD.get(),
+                                        IORING_REGISTER_BUFFERS,
+                                        &Arena,
+                                        1));
+    },
+    -1);
+  BuffersRegistered = static_cast<bool>(Registered);
+  if (!BuffersRegistered)
+    // (E.g., the limit of locked memory is too low.) The buffers are still
+    // used, but the kernel maps them for every request.
+    LOG_WITH_IDENTIFIER(debug) << "Failed to register buffers: "
+                               << Registered.getError().message();
+  Operations.resize(BufferCount);
+  for (unsigned B = BufferCount; B > 0; --B)
+    FreeBuffers.push_back(B - 1);
+
+  LOG_WITH_IDENTIFIER(debug) << "Created with " << SQEntries << " entries";
+  listenForScheduled();
+}
+
+IOUring::~IOUring()
+{
+  // The listeners must be unregistered while the ring still exists.
+  clear();
+  settle();
+  unmap();
+  LOG_WITH_IDENTIFIER(debug) << "~IOUring";
+}
+
+void IOUring::unmap() noexcept
+{
+  if (SQEs)
+    ::munmap(SQEs, SQEsSize);
+  if (CQRing && CQRing != SQRing)
+    ::munmap(CQRing, CQRingSize);
+  if (SQRing)
+    ::munmap(SQRing, SQRingSize);
+  if (Buffers)
+    ::munmap(Buffers, BufferCount * BufferSize);
+  SQEs = nullptr;
+  CQRing = SQRing = nullptr;
+  Buffers = nullptr;
+}
+
+void IOUring::settle() noexcept
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  std::size_t Pending = 0;
+  for (unsigned B = 0; B < Operations.size(); ++B)
+    if (Operations[B].InFlight)
+    {
+      cancel(OperationTag | B);
+      ++Pending;
+    }
+
+  // The requests in flight use the buffers, which must outlive them.
+  try
+  {
+    while (Pending)
+    {
+      if (!enter(&Lock))
+        continue;
+
+      unsigned Head = *CQHead;
+      unsigned Tail = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+      for (; Head != Tail; ++Head)
+      {
+        const struct ::io_uring_cqe& CQE = CQEs[Head & CQMask];
+        if (CQE.user_data & InternalTag || !(CQE.user_data & OperationTag))
+          continue;
+        Operation& Op = Operations.at(CQE.user_data & ~OperationTag);
+        if (!Op.InFlight)
+          continue;
+        Op.InFlight = false;
+        --Pending;
+        if (Op.Writes)
+        {
+          EPoll* Self = this;
+          Op.Writes->InFlight.compare_exchange_strong(Self, nullptr);
+          Self = this;
+          Op.Writes->Queue.compare_exchange_strong(Self, nullptr);
+        }
+      }
+      __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+    }
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Failed to cancel requests: " << Err.what();
+  }
+}
+
+struct io_uring_sqe& IOUring::getSQE()
+{
+  if (SQLocalTail - __atomic_load_n(SQHead, __ATOMIC_ACQUIRE) >= SQEntries)
+    // The submission queue is full, so the kernel must consume it first.
+    enter(/* WaitLock =*/nullptr);
+
+  unsigned Index = SQLocalTail & SQMask;
+  SQArray[Index] = Index;
+  ++SQLocalTail;
+
+  struct ::io_uring_sqe& SQE = SQEs[Index];
+  std::memset(&SQE, 0, sizeof(SQE));
+  return SQE;
+}
+
+std::uint32_t IOUring::pollEvents(raw_fd FD,
+                                  const Registration& R) const noexcept
+{
+  if (Reads.find(FD) == Reads.end())
+    return R.Events;
+  // The read in flight reports the data, and the hangup, of the file.
+  return R.Events & ~(EPOLLIN | EPOLLHUP | EPOLLRDHUP);
+}
+
+void IOUring::arm(raw_fd FD, Registration& R)
+{
+  const std::uint32_t Events = pollEvents(FD, R);
+  if (!Events)
+    return;
+
+  struct ::io_uring_sqe& SQE = getSQE();
+  SQE.opcode = IORING_OP_POLL_ADD;
+  SQE.fd = FD;
+  SQE.poll32_events = Events;
+  if (R.Multishot)
+    SQE.len = IORING_POLL_ADD_MULTI;
+  SQE.user_data = userData(FD, R.Generation);
+  R.Armed = true;
+}
+
+void IOUring::armPending()
+{
+  for (raw_fd FD : ToArm)
+  {
+    auto It = Registrations.find(FD);
+    if (It != Registrations.end() && !It->second.Armed)
+      arm(FD, It->second);
+  }
+  ToArm.clear();
+}
+
+bool IOUring::enter(std::unique_lock<std::mutex>* WaitLock)
+{
+  __atomic_store_n(SQTail, SQLocalTail, __ATOMIC_RELEASE);
+  unsigned ToSubmit = SQLocalTail - __atomic_load_n(SQHead, __ATOMIC_ACQUIRE);
+  const bool Wait = WaitLock != nullptr;
+  if (!ToSubmit && !Wait)
+    return true;
+
+  if (Wait)
+    WaitLock->unlock();
+  auto Entered = CheckedPOSIX(
+    [this, ToSubmit, Wait] {
+      return static_cast<int>(::syscall(__NR_io_uring_enter,
+                                        RingFD.get(),
+                                        ToSubmit,
+                                        Wait ? 1 : 0,
+                                        Wait ? IORING_ENTER_GETEVENTS : 0,
+                                        nullptr,
+                                        0));
+    },
+    -1);
+  if (Wait)
+    WaitLock->lock();
+  if (!Entered)
+  {
+    std::error_code EC = Entered.getError();
+    if (EC == std::errc::interrupted /* EINTR */)
+      return false;
+    throw std::system_error{EC, "io_uring_enter()"};
+  }
+  return true;
+}
+
+void IOUring::addImpl(raw_fd FD, std::uint32_t Events, ::epoll_data_t Data)
+{
+  Registration R;
+  // EPOLLET has no meaning for poll(2) masks, but the EPOLLIN, EPOLLOUT,
+  // EPOLLHUP, and EPOLLRDHUP bits are the same as their POLL* counterparts.
+  R.Events = Events & ~EPOLLET;
+  R.Generation = ++NextGeneration & GenerationMask;
+  R.Armed = false;
+  R.Multishot = Events & EPOLLET;
+  R.Data = Data;
+
+  std::unique_lock<std::mutex> Lock{RingLock};
+  auto [It, Inserted] = Registrations.emplace(FD, R);
+  if (!Inserted)
+    throw std::system_error{std::make_error_code(std::errc::file_exists),
+                            "io_uring registering file"};
+
+  // The waiting thread might already be blocked in the kernel, so the request
+  // must be submitted here to have an effect.
+  arm(FD, It->second);
+  if (auto Read = Reads.find(FD); Read != Reads.end())
+  {
+    QueuedRead& Q = Read->second;
+    if (Q.Begin != Q.End || Q.EndOfFile || Q.Error)
+    {
+      // The data read while the file was not listened for is reported by the
+      // next wait(), which must be woken up to do so.
+      ToReport.push_back(FD);
+      if (Waiting)
+      {
+        struct ::io_uring_sqe& SQE = getSQE();
+        SQE.opcode = IORING_OP_NOP;
+        SQE.user_data = InternalTag;
+      }
+    }
+    else
+      readAhead(FD, Q);
+  }
+  enter(/* WaitLock =*/nullptr);
+}
+
+void IOUring::removeImpl(raw_fd FD)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  auto It = Registrations.find(FD);
+  if (It == Registrations.end())
+    return;
+
+  if (It->second.Armed)
+  {
+    struct ::io_uring_sqe& SQE = getSQE();
+    SQE.opcode = IORING_OP_POLL_REMOVE;
+    SQE.fd = -1;
+    SQE.addr = userData(FD, It->second.Generation);
+    SQE.user_data = InternalTag;
+
+    // The in-flight request keeps a reference to the file, which must be
+    // released before the caller closes its handle, so submit immediately.
+    try
+    {
+      enter(/* WaitLock =*/nullptr);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG_WITH_IDENTIFIER(error) << "Failed to remove " << FD << ": "
+                                 << Err.what();
+    }
+  }
+  Registrations.erase(It);
+}
+
+void IOUring::submitIfWaiting()
+{
+  if (Waiting)
+    enter(/* WaitLock =*/nullptr);
+}
+
+void IOUring::cancel(std::uint64_t UserData)
+{
+  struct ::io_uring_sqe& SQE = getSQE();
+  SQE.opcode = IORING_OP_ASYNC_CANCEL;
+  SQE.fd = -1;
+  SQE.addr = UserData;
+  SQE.user_data = InternalTag;
+}
+
+void IOUring::releaseBuffer(unsigned Buffer)
+{
+  Operations.at(Buffer) = Operation{};
+  FreeBuffers.push_back(Buffer);
+}
+
+void IOUring::readAhead(raw_fd FD, QueuedRead& Q)
+{
+  Operation& Op = Operations.at(Q.Buffer);
+  if (Op.InFlight || Q.Begin != Q.End || Q.EndOfFile || Q.Error)
+    return;
+  auto It = Registrations.find(FD);
+  if (It == Registrations.end() || !(It->second.Events & EPOLLIN))
+    // Not reading the file holds its writer back, like epoll(7) would.
+    return;
+
+  struct ::io_uring_sqe& SQE = getSQE();
+  SQE.opcode = BuffersRegistered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  SQE.fd = FD;
+  SQE.addr = reinterpret_cast<std::uintptr_t>(bufferAt(Q.Buffer));
+  SQE.len = BufferSize;
+  SQE.user_data = OperationTag | Q.Buffer;
+  Op.InFlight = true;
+}
+
+void IOUring::submitWrite(unsigned Buffer)
+{
+  Operation& Op = Operations.at(Buffer);
+  struct ::io_uring_sqe& SQE = getSQE();
+  SQE.opcode = BuffersRegistered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  SQE.fd = Op.FD;
+  SQE.addr = reinterpret_cast<std::uintptr_t>(bufferAt(Buffer) + Op.Offset);
+  SQE.len = static_cast<std::uint32_t>(Op.Length - Op.Offset);
+  SQE.user_data = OperationTag | Buffer;
+  Op.InFlight = true;
+}
+
+bool IOUring::startQueuedReads(raw_fd FD)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  assert(Registrations.find(FD) == Registrations.end() &&
+         "Reading a file must start before it is listened for.");
+  if (Reads.find(FD) != Reads.end())
+    return true;
+  if (FreeBuffers.empty())
+  {
+    LOG_WITH_IDENTIFIER(debug) << "No buffer left to read " << FD;
+    return false;
+  }
+
+  QueuedRead Q;
+  Q.Buffer = FreeBuffers.back();
+  FreeBuffers.pop_back();
+  Operation& Op = Operations.at(Q.Buffer);
+  Op.Kind = Operation::Read;
+  Op.FD = FD;
+  Reads.emplace(FD, Q);
+  return true;
+}
+
+void IOUring::stopQueuedReads(raw_fd FD)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  auto It = Reads.find(FD);
+  if (It == Reads.end())
+    return;
+
+  const unsigned Buffer = It->second.Buffer;
+  Reads.erase(It);
+  Operation& Op = Operations.at(Buffer);
+  if (!Op.InFlight)
+  {
+    releaseBuffer(Buffer);
+    return;
+  }
+
+  // The buffer is released when the request completes. The request keeps a
+  // reference to the file, which must be released before the caller closes
+  // its handle, so submit immediately.
+  Op.FD = fd::Invalid;
+  cancel(OperationTag | Buffer);
+  try
+  {
+    enter(/* WaitLock =*/nullptr);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Failed to stop reading " << FD << ": "
+                               << Err.what();
+  }
+}
+
+std::size_t IOUring::readQueued(raw_fd FD,
+                                const ::iovec* Vectors,
+                                std::size_t Count,
+                                bool& Continue,
+                                bool& EndOfFile)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  auto It = Reads.find(FD);
+  if (It == Reads.end())
+    throw std::system_error{
+      std::make_error_code(std::errc::bad_file_descriptor),
+      "io_uring reading file"};
+
+  QueuedRead& Q = It->second;
+  Continue = false;
+  if (Q.Begin == Q.End)
+  {
+    if (Q.Error)
+      throw std::system_error{std::error_code{Q.Error, std::system_category()},
+                              "io_uring read"};
+    EndOfFile = Q.EndOfFile;
+    return 0;
+  }
+
+  std::size_t BytesRead = 0;
+  for (std::size_t I = 0; I < Count && Q.Begin != Q.End; ++I)
+  {
+    const std::size_t Fill = std::min(Vectors[I].iov_len, Q.End - Q.Begin);
+    std::memcpy(Vectors[I].iov_base, bufferAt(Q.Buffer) + Q.Begin, Fill);
+    Q.Begin += Fill;
+    BytesRead += Fill;
+  }
+  if (Q.Begin != Q.End)
+  {
+    Continue = true;
+    return BytesRead;
+  }
+
+  // Every byte was taken, so the buffer can be read into again.
+  Q.Begin = Q.End = 0;
+  readAhead(FD, Q);
+  submitIfWaiting();
+  return BytesRead;
+}
+
+std::optional<std::size_t>
+IOUring::writeQueued(const std::shared_ptr<QueuedWrites>& Writes,
+                     const ::iovec* Vectors,
+                     std::size_t Count,
+                     bool& Continue)
+{
+  Continue = false;
+  if (int Error = Writes->Error.exchange(0))
+    throw std::system_error{std::error_code{Error, std::system_category()},
+                            "io_uring write"};
+  if (Writes->InFlight.load())
+    // The caller buffers the data until the write in flight completes.
+    return 0;
+
+  std::size_t Total = 0;
+  for (std::size_t I = 0; I < Count; ++I)
+    Total += Vectors[I].iov_len;
+  if (!Total)
+  {
+    Continue = true;
+    return 0;
+  }
+  if (Total > BufferSize)
+    // The kernel copies a bulk of data in a single call anyway, and the data
+    // would have to be split between requests that may complete out of order.
+    return std::nullopt;
+
+  std::unique_lock<std::mutex> Lock{RingLock};
+  if (FreeBuffers.empty())
+    return std::nullopt;
+  const unsigned Buffer = FreeBuffers.back();
+  FreeBuffers.pop_back();
+
+  Operation& Op = Operations.at(Buffer);
+  Op.Kind = Operation::Write;
+  Op.FD = Writes->FD;
+  Op.Writes = Writes;
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    std::memcpy(
+      bufferAt(Buffer) + Op.Length, Vectors[I].iov_base, Vectors[I].iov_len);
+    Op.Length += Vectors[I].iov_len;
+  }
+  Writes->InFlight.store(this);
+  submitWrite(Buffer);
+  submitIfWaiting();
+
+  Continue = true;
+  return Total;
+}
+
+void IOUring::cancelQueuedWrite(const QueuedWrites& Writes)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  for (unsigned B = 0; B < Operations.size(); ++B)
+  {
+    const Operation& Op = Operations[B];
+    if (Op.InFlight && Op.Writes.get() == &Writes)
+      cancel(OperationTag | B);
+  }
+  try
+  {
+    enter(/* WaitLock =*/nullptr);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Failed to cancel writing " << Writes.FD
+                               << ": " << Err.what();
+  }
+}
+
+bool IOUring::reportRead(raw_fd FD, struct ::epoll_event& Event)
+{
+  auto Read = Reads.find(FD);
+  auto It = Registrations.find(FD);
+  if (Read == Reads.end() || It == Registrations.end() ||
+      !(It->second.Events & EPOLLIN))
+    return false;
+
+  Event.data = It->second.Data;
+  Event.events = EPOLLIN;
+  if (Read->second.EndOfFile)
+    Event.events |= EPOLLHUP;
+  if (Read->second.Error)
+    Event.events |= EPOLLERR;
+  return true;
+}
+
+bool IOUring::complete(const struct ::io_uring_cqe& CQE,
+                       struct ::epoll_event& Event)
+{
+  const auto Buffer = static_cast<unsigned>(CQE.user_data & ~OperationTag);
+  Operation& Op = Operations.at(Buffer);
+  Op.InFlight = false;
+
+  if (Op.Kind == Operation::Read)
+  {
+    if (Op.FD == fd::Invalid)
+    {
+      // The reading of the file was stopped meanwhile.
+      releaseBuffer(Buffer);
+      return false;
+    }
+    if (CQE.res == -ECANCELED)
+      return false;
+
+    QueuedRead& Q = Reads.at(Op.FD);
+    if (CQE.res > 0)
+    {
+      Q.Begin = 0;
+      Q.End = static_cast<std::size_t>(CQE.res);
+    }
+    else if (CQE.res == 0)
+      Q.EndOfFile = true;
+    else
+      Q.Error = -CQE.res;
+    return reportRead(Op.FD, Event);
+  }
+
+  if (CQE.res > 0 && Op.Offset + CQE.res < Op.Length)
+  {
+    // The rest of the data must be sent before anything else.
+    Op.Offset += static_cast<std::size_t>(CQE.res);
+    submitWrite(Buffer);
+    return false;
+  }
+
+  std::shared_ptr<QueuedWrites> Writes = std::move(Op.Writes);
+  releaseBuffer(Buffer);
+  if (CQE.res == -ECANCELED)
+  {
+    Writes->InFlight.store(nullptr);
+    return false;
+  }
+  if (CQE.res <= 0)
+    Writes->Error.store(CQE.res ? -CQE.res : EPIPE);
+  Writes->InFlight.store(nullptr);
+
+  // The queue that writes the file now flushes what was buffered meanwhile.
+  if (Writes->Queue.load() != this)
+  {
+    MovedWrites.emplace_back(std::move(Writes));
+    return false;
+  }
+  auto It = Registrations.find(Writes->FD);
+  if (It == Registrations.end())
+    return false;
+  Event.data = It->second.Data;
+  Event.events = EPOLLOUT;
+  return true;
+}
+
+std::size_t IOUring::waitImpl(struct ::epoll_event* Events,
+                              std::size_t MaxEvents,
+                              std::chrono::milliseconds Timeout)
+{
+  std::unique_lock<std::mutex> Lock{RingLock};
+  armPending();
+
+  if (Timeout != std::chrono::milliseconds::zero() && ToReport.empty() &&
+      *CQHead == __atomic_load_n(CQTail, __ATOMIC_ACQUIRE))
+  {
+    POD<struct ::__kernel_timespec> Spec;
+    if (Timeout.count() > 0)
+    {
+      // The timeout also completes when any other request completes, so it
+      // does not linger in the kernel after the wait.
+      Spec->tv_sec = Timeout.count() / 1000;
+      Spec->tv_nsec = (Timeout.count() % 1000) * 1'000'000;
+      struct ::io_uring_sqe& SQE = getSQE();
+      SQE.opcode = IORING_OP_TIMEOUT;
+      SQE.fd = -1;
+      SQE.addr = reinterpret_cast<std::uintptr_t>(&Spec);
+      SQE.len = 1;
+      SQE.off = 1;
+      SQE.user_data = InternalTag;
+    }
+    Waiting = true;
+    const bool Entered = enter(&Lock);
+    Waiting = false;
+    if (!Entered)
+      return 0;
+  }
+  else
+    // Completions are already available (or the caller does not want to
+    // wait), but the requests armed above must still be sent.
+    enter(/* WaitLock =*/nullptr);
+
+  // Even if only stale completions were received, return to the caller, which
+  // might have been asked to stop by a signal handler that ran while the
+  // completions were delivered.
+  const std::size_t EventCount = harvest(Events, MaxEvents);
+
+  // The queues of the files that were moved away while their writes were in
+  // flight are notified without holding the lock of this one.
+  std::vector<std::shared_ptr<QueuedWrites>> Moved;
+  Moved.swap(MovedWrites);
+  Lock.unlock();
+  for (const std::shared_ptr<QueuedWrites>& Writes : Moved)
+    if (EPoll* Queue = Writes->Queue.load())
+      Queue->schedule(Writes->FD, /* Incoming =*/false, /* Outgoing =*/true);
+
+  return EventCount;
+}
+
+std::size_t IOUring::harvest(struct ::epoll_event* Events,
+                             std::size_t MaxEvents)
+{
+  std::size_t EventCount = 0;
+  while (!ToReport.empty() && EventCount < MaxEvents)
+  {
+    const raw_fd FD = ToReport.back();
+    ToReport.pop_back();
+    if (reportRead(FD, Events[EventCount]))
+      ++EventCount;
+  }
+
+  unsigned Head = *CQHead;
+  unsigned Tail = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+  for (; Head != Tail && EventCount < MaxEvents; ++Head)
+  {
+    const struct ::io_uring_cqe& CQE = CQEs[Head & CQMask];
+    if (CQE.user_data & InternalTag)
+      continue;
+    if (CQE.user_data & OperationTag)
+    {
+      if (complete(CQE, Events[EventCount]))
+        ++EventCount;
+      continue;
+    }
+
+    raw_fd FD = static_cast<raw_fd>(CQE.user_data & 0xFFFF'FFFF);
+    auto It = Registrations.find(FD);
+    if (It == Registrations.end() ||
+        userData(FD, It->second.Generation) != CQE.user_data)
+      // Stale completion for a file that is no longer (or has since been re-)
+      // registered.
+      continue;
+
+    Registration& R = It->second;
+    if (!(CQE.flags & IORING_CQE_F_MORE))
+    {
+      R.Armed = false;
+      ToArm.push_back(FD);
+    }
+    if (CQE.res == -ECANCELED)
+      continue;
+    if (CQE.res == -EINVAL && R.Multishot)
+    {
+      // Older kernels do not support multishot poll requests.
+      LOG_WITH_IDENTIFIER(debug) << "Multishot poll unsupported for " << FD;
+      R.Multishot = false;
+      continue;
+    }
+
+    struct ::epoll_event& E = Events[EventCount++];
+    E.data = R.Data;
+    E.events = CQE.res < 0 ? EPOLLERR : static_cast<std::uint32_t>(CQE.res);
+  }
+  __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+
+  return EventCount;
+}
+
+} // namespace monomux
+
+#undef LOG_WITH_IDENTIFIER
+#undef LOG
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cassert>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "monomux/adt/MaskedRingBuffer.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/fd.hpp"
+
+#include "monomux/system/MirroredRingStorage.hpp"
+
+namespace monomux
+{
+
+void MirroredRingStorage::Unmap::operator()(char* Buffer) const noexcept
+{
+  if (Buffer)
+    ::munmap(Buffer, Size * 2);
+}
+
+std::size_t MirroredRingStorage::roundCapacity(std::size_t N) noexcept
+{
+  static const auto PageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  return detail::roundUpToPowerOfTwo(std::max(N, PageSize));
+}
+
+MirroredRingStorage::Pointer MirroredRingStorage::allocate(std::size_t N)
+{
+  assert(N == roundCapacity(N) && "Capacity can not be mirrored!");
+
+  fd Memory = CheckedPOSIXThrow(
+    [] { return ::memfd_create("monomux-ring", MFD_CLOEXEC); },
+    "memfd_create()",
+    -1);
+  CheckedPOSIXThrow([&Memory, N] { return ::ftruncate(Memory, N); },
+                    "ftruncate(memfd)",
+                    -1);
+
+  // Reserve the address space for both views first, so nothing else can be
+  // mapped between them.
+  auto* Base = static_cast<char*>(CheckedPOSIXThrow(
+    [N] {
+      return ::mmap(
+        nullptr, N * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    },
+    "mmap(reserve)",
+    MAP_FAILED));
+  Pointer Storage{Base, Unmap{N}};
+
+  for (char* View : {Base, Base + N})
+    CheckedPOSIXThrow(
+      [&Memory, View, N] {
+        return ::mmap(View,
+                      N,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED,
+                      Memory,
+                      0);
+      },
+      "mmap(view)",
+      MAP_FAILED);
+
+  // The mappings keep the memory alive after the file is closed.
+  return Storage;
+}
+
+} // namespace monomux
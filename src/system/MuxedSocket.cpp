@@ -0,0 +1,411 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <optional>
+#include <system_error>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/MuxedSocket.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/MuxedSocket")
+#define LOG_WITH_IDENTIFIER(SEVERITY) LOG(SEVERITY) << identifier() << ": "
+
+namespace monomux
+{
+
+struct MuxedSocket::Connection
+{
+  fd Handle;
+  /// The streams alive over the connection, indexed by \p Stream.
+  std::array<MuxedSocket*, 2> Streams = {nullptr, nullptr};
+
+  /// The header of the frame being received, and how much of it had arrived.
+  char ReadHeader[HeaderSize];
+  std::size_t ReadHeaderHave = 0;
+  /// The stream and the payload still to be received of the current frame.
+  Stream ReadStream = DataStream;
+  std::size_t ReadRemaining = 0;
+
+  /// The header of the frame being sent, and how much of it had been sent.
+  char WriteHeader[HeaderSize];
+  std::size_t WriteHeaderSent = 0;
+  /// The stream and the payload still to be sent of the frame, if a frame is
+  /// in progress.
+  std::optional<Stream> WriteStream;
+  std::size_t WriteRemaining = 0;
+};
+
+void MuxedSocket::encodeHeader(char (&Header)[HeaderSize],
+                               Stream S,
+                               std::uint16_t Size) noexcept
+{
+  Header[0] = static_cast<char>(S);
+  Header[1] = 0;
+  Header[2] = static_cast<char>(Size & 0xFF);
+  Header[3] = static_cast<char>(Size >> 8);
+}
+
+MuxedSocket::MuxedSocket(std::shared_ptr<Connection> Shared,
+                         Stream Kind,
+                         std::string Identifier)
+  : Socket(fd{Shared->Handle.get()},
+           std::move(Identifier),
+           /* NeedsCleanup =*/false),
+    Conn(std::move(Shared)), Kind(Kind)
+{
+  // The buffered operations of the socket must frame the data.
+  Overridden = true;
+  Conn->Streams.at(Kind) = this;
+}
+
+std::pair<std::unique_ptr<MuxedSocket>, std::unique_ptr<MuxedSocket>>
+MuxedSocket::create(fd&& FD, std::string Identifier)
+{
+  auto Shared = std::make_shared<Connection>();
+  Shared->Handle = std::move(FD);
+
+  std::unique_ptr<MuxedSocket> Data{
+    new MuxedSocket(Shared, DataStream, Identifier + "#data")};
+  std::unique_ptr<MuxedSocket> Control{
+    new MuxedSocket(std::move(Shared), ControlStream, std::move(Identifier))};
+  return {std::move(Control), std::move(Data)};
+}
+
+MuxedSocket::~MuxedSocket() noexcept
+{
+  Conn->Streams.at(Kind) = nullptr;
+  // The file descriptor is owned by the connection, and closed with it.
+  (void)Handle.release();
+}
+
+MuxedSocket* MuxedSocket::sibling() const noexcept
+{
+  return Conn->Streams.at(Kind == DataStream ? ControlStream : DataStream);
+}
+
+void MuxedSocket::failConnection() noexcept
+{
+  for (MuxedSocket* S : Conn->Streams)
+    if (S)
+      S->setFailed();
+}
+
+void MuxedSocket::flushConnection()
+{
+  MuxedSocket* First = this;
+  MuxedSocket* Second = sibling();
+  if (Conn->WriteStream && *Conn->WriteStream != Kind)
+    std::swap(First, Second);
+
+  if (First && !First->failed())
+    First->flushWrites();
+  if (Second && !Second->failed())
+    Second->flushWrites();
+}
+
+bool MuxedSocket::connectionHasBufferedRead() const noexcept
+{
+  const MuxedSocket* Other = sibling();
+  return hasBufferedRead() || (Other && Other->hasBufferedRead());
+}
+
+bool MuxedSocket::connectionHasBufferedWrite() const noexcept
+{
+  const MuxedSocket* Other = sibling();
+  return hasBufferedWrite() || (Other && Other->hasBufferedWrite());
+}
+
+bool MuxedSocket::midFrame() const noexcept
+{
+  return Conn->ReadHeaderHave || Conn->ReadRemaining ||
+         Conn->WriteStream.has_value();
+}
+
+std::string MuxedSocket::readImpl(std::size_t Bytes, bool& Continue)
+{
+  std::string Data(Bytes, 0);
+  ::iovec Vector{Data.data(), Data.size()};
+  Data.resize(readvImpl(&Vector, 1, Continue));
+  return Data;
+}
+
+std::size_t MuxedSocket::writeImpl(std::string_view Buffer, bool& Continue)
+{
+  ::iovec Vector{const_cast<char*>(Buffer.data()), Buffer.size()}; // NOLINT
+  return writevImpl(&Vector, 1, Continue);
+}
+
+std::size_t MuxedSocket::readvImpl(const ::iovec* Vectors,
+                                   std::size_t Count,
+                                   bool& Continue)
+{
+  // The frames are received into an intermediate buffer first, from which the
+  // payload of the frames is distributed between the streams.
+  static constexpr std::size_t ScratchSize = 1 << 16;
+  thread_local std::vector<char> Scratch;
+  Scratch.resize(ScratchSize);
+
+  std::size_t Capacity = 0;
+  for (std::size_t I = 0; I < Count; ++I)
+    Capacity += Vectors[I].iov_len;
+
+  Connection& C = *Conn;
+  std::size_t Vector = 0;
+  std::size_t Offset = 0;
+  std::size_t Delivered = 0;
+  Continue = false;
+  // Reading at most the capacity of the vectors ensures that the payload of
+  // the current stream in the read data always fits.
+  const std::size_t Want = std::min(Capacity, ScratchSize);
+  while (Want && !Delivered)
+  {
+    if (MuxedSocket* Other = sibling();
+        Other && Other->readInBuffer() >= bufferSizeMax())
+    {
+      // The other stream is not being read, so leave the data in the system.
+      LOG_WITH_IDENTIFIER(trace) << "Other stream's buffer full!";
+      break;
+    }
+
+    auto ReadBytes = CheckedPOSIX(
+      [FD = C.Handle.get(), Want] {
+        return ::recv(FD, Scratch.data(), Want, 0);
+      },
+      -1);
+    if (!ReadBytes)
+    {
+      std::errc EC = static_cast<std::errc>(ReadBytes.getError().value());
+      if (EC == std::errc::interrupted /* EINTR */)
+        continue;
+      if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+          EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+        // No more data left in the stream.
+        break;
+
+      LOG_WITH_IDENTIFIER(error) << "Read error";
+      failConnection();
+      throw std::system_error{std::make_error_code(EC)};
+    }
+    if (ReadBytes.get() == 0)
+    {
+      LOG_WITH_IDENTIFIER(error) << "Disconnected";
+      failConnection();
+      break;
+    }
+    Continue = static_cast<std::size_t>(ReadBytes.get()) == Want;
+
+    std::string_view Received{Scratch.data(),
+                              static_cast<std::size_t>(ReadBytes.get())};
+    while (!Received.empty())
+    {
+      if (C.ReadHeaderHave < HeaderSize)
+      {
+        const std::size_t Take =
+          std::min(HeaderSize - C.ReadHeaderHave, Received.size());
+        std::memcpy(C.ReadHeader + C.ReadHeaderHave, Received.data(), Take);
+        C.ReadHeaderHave += Take;
+        Received.remove_prefix(Take);
+        if (C.ReadHeaderHave < HeaderSize)
+          break;
+
+        const auto S = static_cast<unsigned char>(C.ReadHeader[0]);
+        if (S > ControlStream || C.ReadHeader[1] != 0)
+        {
+          LOG_WITH_IDENTIFIER(error) << "Invalid frame header received";
+          failConnection();
+          Continue = false;
+          return Delivered;
+        }
+        C.ReadStream = static_cast<Stream>(S);
+        C.ReadRemaining = static_cast<unsigned char>(C.ReadHeader[2]) |
+                          static_cast<unsigned char>(C.ReadHeader[3]) << 8;
+        if (!C.ReadRemaining)
+          C.ReadHeaderHave = 0;
+        continue;
+      }
+
+      std::string_view Payload = Received.substr(0, C.ReadRemaining);
+      Received.remove_prefix(Payload.size());
+      C.ReadRemaining -= Payload.size();
+      if (!C.ReadRemaining)
+        C.ReadHeaderHave = 0;
+
+      if (C.ReadStream != Kind)
+      {
+        // (If the other stream was already destroyed, its data is dropped.)
+        if (MuxedSocket* Other = sibling())
+          Other->bufferRead(Payload);
+        continue;
+      }
+
+      while (!Payload.empty())
+      {
+        assert(Vector < Count && "Payload exceeds the read capacity");
+        const ::iovec& V = Vectors[Vector];
+        const std::size_t Take = std::min(V.iov_len - Offset, Payload.size());
+        std::memcpy(
+          static_cast<char*>(V.iov_base) + Offset, Payload.data(), Take);
+        Payload.remove_prefix(Take);
+        Delivered += Take;
+        Offset += Take;
+        if (Offset == V.iov_len)
+        {
+          ++Vector;
+          Offset = 0;
+        }
+      }
+    }
+  }
+
+  return Delivered;
+}
+
+std::size_t MuxedSocket::writevImpl(const ::iovec* Vectors,
+                                    std::size_t Count,
+                                    bool& Continue)
+{
+  Connection& C = *Conn;
+  Continue = false;
+  if (C.WriteStream && *C.WriteStream != Kind)
+  {
+    // The frames must not be interleaved, so the other stream has to finish
+    // sending its frame first.
+    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                      << "Other stream is sending a frame");
+    return 0;
+  }
+
+  std::size_t Payload = 0;
+  for (std::size_t I = 0; I < Count; ++I)
+    Payload += Vectors[I].iov_len;
+
+  static constexpr std::size_t MaxVectors = 32;
+  std::size_t Vector = 0;
+  std::size_t Offset = 0;
+  std::size_t Sent = 0;
+  while (Sent < Payload)
+  {
+    if (!C.WriteStream)
+    {
+      const std::size_t Size = std::min(Payload - Sent, MaxFrameSize);
+      encodeHeader(C.WriteHeader, Kind, static_cast<std::uint16_t>(Size));
+      C.WriteHeaderSent = 0;
+      C.WriteStream = Kind;
+      C.WriteRemaining = Size;
+    }
+
+    // Send the (rest of the) header and the payload of the frame together.
+    std::array<::iovec, MaxVectors> Out;
+    std::size_t OutCount = 0;
+    std::size_t Requested = 0;
+    if (C.WriteHeaderSent < HeaderSize)
+    {
+      Out[OutCount++] = ::iovec{C.WriteHeader + C.WriteHeaderSent,
+                                HeaderSize - C.WriteHeaderSent};
+      Requested += HeaderSize - C.WriteHeaderSent;
+    }
+    std::size_t FrameLeft = C.WriteRemaining;
+    for (std::size_t V = Vector, Off = Offset;
+         V < Count && FrameLeft && OutCount < MaxVectors;
+         ++V, Off = 0)
+    {
+      const std::size_t Len = std::min(Vectors[V].iov_len - Off, FrameLeft);
+      if (!Len)
+        continue;
+      Out[OutCount++] =
+        ::iovec{static_cast<char*>(Vectors[V].iov_base) + Off, Len};
+      FrameLeft -= Len;
+      Requested += Len;
+    }
+
+    POD<struct ::msghdr> Msg;
+    Msg->msg_iov = Out.data();
+    Msg->msg_iovlen = OutCount;
+    auto SentBytes = CheckedPOSIX(
+      [FD = C.Handle.get(), &Msg] { return ::sendmsg(FD, &Msg, MSG_NOSIGNAL); },
+      -1);
+    if (!SentBytes)
+    {
+      std::errc EC = static_cast<std::errc>(SentBytes.getError().value());
+      if (EC == std::errc::interrupted /* EINTR */)
+        continue;
+      if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+          EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+      {
+        MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                          << SentBytes.getError().message());
+        return Sent;
+      }
+
+      LOG_WITH_IDENTIFIER(error) << "Write error";
+      failConnection();
+      throw std::system_error{std::make_error_code(EC)};
+    }
+    if (SentBytes.get() == 0)
+    {
+      LOG_WITH_IDENTIFIER(error) << "Disconnected";
+      failConnection();
+      return Sent;
+    }
+
+    const auto Written = static_cast<std::size_t>(SentBytes.get());
+    const std::size_t HeaderPart =
+      std::min(Written, HeaderSize - C.WriteHeaderSent);
+    C.WriteHeaderSent += HeaderPart;
+    std::size_t PayloadPart = Written - HeaderPart;
+    C.WriteRemaining -= PayloadPart;
+    Sent += PayloadPart;
+    while (PayloadPart)
+    {
+      const std::size_t Available = Vectors[Vector].iov_len - Offset;
+      if (PayloadPart < Available)
+      {
+        Offset += PayloadPart;
+        break;
+      }
+      PayloadPart -= Available;
+      ++Vector;
+      Offset = 0;
+    }
+    if (C.WriteHeaderSent == HeaderSize && !C.WriteRemaining)
+      C.WriteStream.reset();
+
+    if (Written < Requested)
+      // The socket did not take everything, it is likely full.
+      return Sent;
+  }
+
+  Continue = true;
+  return Sent;
+}
+
+} // namespace monomux
+
+#undef LOG_WITH_IDENTIFIER
+#undef LOG
@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "monomux/system/OutputCoalescer.hpp"
+
+namespace monomux
+{
+
+bool OutputCoalescer::shouldWrite(std::size_t PendingBytes)
+{
+  if (!PendingBytes)
+    return false;
+  if (!Clock.armed())
+  {
+    // The output was idle, so this is likely a response to user input, which
+    // should not be delayed. Further output will be held back.
+    Clock.arm(Limits.MaxDelay);
+    return true;
+  }
+  return PendingBytes >= Limits.MaxBytes;
+}
+
+bool OutputCoalescer::expired(std::size_t PendingBytes)
+{
+  if (!Clock.consume())
+    return false;
+  if (!PendingBytes)
+    // The output went idle.
+    return false;
+
+  // Keep holding back output for as long as it is streaming.
+  Clock.arm(Limits.MaxDelay);
+  return true;
+}
+
+} // namespace monomux
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "monomux/system/OutputThrottle.hpp"
+
+namespace monomux
+{
+
+OutputThrottle::OutputThrottle(ThrottleLimits Limits, Clock::time_point Now)
+  : Limits(Limits), Tokens(static_cast<std::int64_t>(Limits.burst())),
+    LastRefill(Now)
+{}
+
+void OutputThrottle::refill(Clock::time_point Now) noexcept
+{
+  using namespace std::chrono;
+  const auto Burst = static_cast<std::int64_t>(Limits.burst());
+  if (Now <= LastRefill || Tokens >= Burst)
+  {
+    LastRefill = std::max(LastRefill, Now);
+    return;
+  }
+
+  // Waiting longer than it takes to fill the bucket from empty gains nothing,
+  // so the elapsed time is clamped to keep the product in range.
+  const std::int64_t Full =
+    (Burst - Tokens) * 1'000'000 / static_cast<std::int64_t>(Limits.Rate) + 1;
+  const std::int64_t Elapsed = std::min<std::int64_t>(
+    duration_cast<microseconds>(Now - LastRefill).count(), Full);
+  const std::int64_t Gained =
+    Elapsed * static_cast<std::int64_t>(Limits.Rate) / 1'000'000;
+  if (!Gained)
+    // Keep accumulating the time until at least a byte is earned.
+    return;
+
+  Tokens = std::min(Tokens + Gained, Burst);
+  LastRefill = Now;
+}
+
+void OutputThrottle::waitForTokens()
+{
+  const auto ResumeAt =
+    std::max<std::int64_t>(static_cast<std::int64_t>(Limits.burst() / 4), 1);
+  const std::int64_t Missing = ResumeAt - Tokens;
+  Wakeup.arm(std::chrono::microseconds{
+    Missing * 1'000'000 / static_cast<std::int64_t>(Limits.Rate) + 1});
+}
+
+bool OutputThrottle::consumed(std::size_t Bytes, Clock::time_point Now)
+{
+  refill(Now);
+  Tokens -= static_cast<std::int64_t>(Bytes);
+  if (Tokens > 0)
+    return true;
+
+  waitForTokens();
+  return false;
+}
+
+bool OutputThrottle::expired(Clock::time_point Now)
+{
+  if (!Wakeup.consume())
+    return false;
+
+  refill(Now);
+  if (Tokens > 0)
+    return true;
+  // (The clocks of the timer and of the caller might not agree exactly.)
+  waitForTokens();
+  return false;
+}
+
+} // namespace monomux
@@ -20,10 +20,13 @@
 #include <sstream>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Event.hpp"
+#include "monomux/system/EventTrace.hpp"
 
 #include "monomux/system/Pipe.hpp"
 
@@ -36,18 +39,21 @@ namespace monomux
 
 static constexpr auto UserACL = S_IRUSR | S_IWUSR;
 
+/// The sizes learnt from the buffers of the pipes already closed.
+static BufferedChannel::SizeHint PipeReadHint{BUFSIZ};
+static BufferedChannel::SizeHint PipeWriteHint{BUFSIZ};
+
+template class BasicBufferedChannel<Pipe>;
+
 Pipe::Pipe(fd Handle, std::string Identifier, bool NeedsCleanup, Mode OpenMode)
-  : BufferedChannel(std::move(Handle),
-                    std::move(Identifier),
-                    NeedsCleanup,
-                    OpenMode == Read ? BUFSIZ : 0,
-                    OpenMode == Write ? BUFSIZ : 0),
+  : BasicBufferedChannel(std::move(Handle),
+                         std::move(Identifier),
+                         NeedsCleanup,
+                         OpenMode == Read ? &PipeReadHint : nullptr,
+                         OpenMode == Write ? &PipeWriteHint : nullptr),
     OpenedAs(OpenMode)
 {}
 
-std::size_t Pipe::optimalReadSize() const noexcept { return BUFSIZ; }
-std::size_t Pipe::optimalWriteSize() const noexcept { return BUFSIZ; }
-
 Pipe Pipe::create(std::string Path, bool InheritInChild)
 {
   CheckedPOSIXThrow(
@@ -193,61 +199,43 @@ void Pipe::setNonblocking()
   Nonblock = true;
 }
 
-static std::string read(raw_fd FD, std::size_t Bytes, bool* Success)
+std::size_t
+Pipe::splice(raw_fd From, raw_fd To, std::size_t Bytes, bool& Continue)
 {
-  static constexpr std::size_t BufferSize = BUFSIZ;
-  std::string Return;
-  Return.reserve(Bytes);
-
-  std::size_t RemainingBytes = Bytes;
-
-  bool ContinueReading = true;
-  while (ContinueReading && RemainingBytes > 0 && RemainingBytes <= Bytes)
+  while (true)
   {
-    POD<char[BufferSize]> RawBuffer;
-    auto ReadBytes = CheckedPOSIX(
-      [FD, ReadSize = std::min(BufferSize, RemainingBytes), &RawBuffer] {
-        return ::read(FD, &RawBuffer, ReadSize);
+    auto MovedBytes = CheckedPOSIX(
+      [From, To, Bytes] {
+        return ::splice(From,
+                        nullptr,
+                        To,
+                        nullptr,
+                        Bytes,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
       },
       -1);
-    if (!ReadBytes)
+    if (!MovedBytes)
     {
-      std::errc EC = static_cast<std::errc>(ReadBytes.getError().value());
+      std::errc EC = static_cast<std::errc>(MovedBytes.getError().value());
       if (EC == std::errc::interrupted /* EINTR */)
-        // Not an error, continue.
+        // Not an error.
         continue;
       if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
           EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
       {
-        // No more data left in the stream.
-        break;
+        Continue = false;
+        return 0;
       }
 
-      LOG(error) << FD << ": Read error";
-      if (Success)
-        *Success = false;
-      throw std::system_error{std::make_error_code(EC)};
-    }
-
-    if (ReadBytes.get() == 0)
-    {
-      LOG(error) << FD << ": Disconnected";
-      ContinueReading = false;
-      break;
+      Continue = false;
+      throw std::system_error{std::make_error_code(EC), "splice()"};
     }
 
-    std::size_t BytesToAppendFromCurrentRead =
-      std::min(static_cast<std::size_t>(ReadBytes.get()), RemainingBytes);
-    Return.append(RawBuffer, BytesToAppendFromCurrentRead);
-
-    RemainingBytes -= BytesToAppendFromCurrentRead;
+    Continue = MovedBytes.get() != 0;
+    EventTrace::traceIO(EventTrace::Read, From, MovedBytes.get());
+    EventTrace::traceIO(EventTrace::Write, To, MovedBytes.get());
+    return MovedBytes.get();
   }
-
-  if (!ContinueReading && Return.empty() && Success)
-    *Success = false;
-  else if (Success)
-    *Success = true;
-  return Return;
 }
 
 static std::size_t write(raw_fd FD, std::string_view Buffer, bool* Success)
@@ -313,15 +301,13 @@ std::string Pipe::readImpl(std::size_t Bytes, bool& Continue)
       std::make_error_code(std::errc::operation_not_permitted),
       "Not readable."};
 
-  bool Success;
-  std::string Data = monomux::read(Handle, Bytes, &Success);
-  if (!Success)
-  {
-    setFailed();
-    Continue = false;
-  }
-
-  return Data;
+  // Read directly into the result, without a bounce buffer that would limit
+  // the size of a read.
+  std::string Return;
+  Return.resize(Bytes);
+  ::iovec Vector{Return.data(), Bytes};
+  Return.resize(readvImpl(&Vector, 1, Continue));
+  return Return;
 }
 
 std::size_t Pipe::writeImpl(std::string_view Buffer, bool& Continue)
@@ -344,6 +330,163 @@ std::size_t Pipe::writeImpl(std::string_view Buffer, bool& Continue)
   return Bytes;
 }
 
+std::size_t
+Pipe::readvImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Pipe failed."};
+  if (OpenedAs != Read)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Not readable."};
+
+  // Similarly to reading into a contiguous buffer, try to fill all the
+  // buffers, as the kernel might only serve a pipe in smaller pieces.
+  std::size_t BytesRead = 0;
+  std::size_t Index = 0;
+  std::size_t Offset = 0;
+  while (Index < Count)
+  {
+    auto ReadBytes = CheckedPOSIX(
+      [FD = Handle.get(), Vectors, Count, Index, Offset] {
+        if (Offset)
+          // Finish filling the partially filled buffer first.
+          return ::read(FD,
+                        static_cast<char*>(Vectors[Index].iov_base) + Offset,
+                        Vectors[Index].iov_len - Offset);
+        return ::readv(FD, Vectors + Index, static_cast<int>(Count - Index));
+      },
+      -1);
+    if (!ReadBytes)
+    {
+      std::errc EC = static_cast<std::errc>(ReadBytes.getError().value());
+      if (EC == std::errc::interrupted /* EINTR */)
+        // Not an error, continue.
+        continue;
+      if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+          EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+      {
+        // No more data left in the stream.
+        Continue = false;
+        return BytesRead;
+      }
+
+      LOG_WITH_IDENTIFIER(error) << "Read error";
+      setFailed();
+      Continue = false;
+      throw std::system_error{std::make_error_code(EC)};
+    }
+
+    if (ReadBytes.get() == 0)
+    {
+      Continue = false;
+      if (!BytesRead)
+      {
+        LOG_WITH_IDENTIFIER(error) << "Disconnected";
+        setFailed();
+      }
+      return BytesRead;
+    }
+
+    std::size_t N = ReadBytes.get();
+    BytesRead += N;
+    while (N && Index < Count)
+    {
+      const std::size_t Fill = std::min(N, Vectors[Index].iov_len - Offset);
+      N -= Fill;
+      Offset += Fill;
+      if (Offset == Vectors[Index].iov_len)
+      {
+        ++Index;
+        Offset = 0;
+      }
+    }
+  }
+
+  Continue = true;
+  return BytesRead;
+}
+
+std::size_t
+Pipe::readQueued(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Pipe failed."};
+
+  bool EndOfFile = false;
+  std::size_t BytesRead;
+  try
+  {
+    BytesRead =
+      ReadQueue->readQueued(Handle.get(), Vectors, Count, Continue, EndOfFile);
+  }
+  catch (const std::system_error&)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Read error";
+    setFailed();
+    Continue = false;
+    throw;
+  }
+  if (EndOfFile)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Disconnected";
+    setFailed();
+  }
+  return BytesRead;
+}
+
+std::size_t
+Pipe::writevImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Pipe failed."};
+  if (OpenedAs != Write)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Not writable."};
+
+  while (true)
+  {
+    auto SentBytes = CheckedPOSIX(
+      [FD = Handle.get(), Vectors, Count] {
+        return ::writev(FD, Vectors, static_cast<int>(Count));
+      },
+      -1);
+    if (!SentBytes)
+    {
+      std::errc EC = static_cast<std::errc>(SentBytes.getError().value());
+      if (EC == std::errc::interrupted /* EINTR */)
+        // Not an error.
+        continue;
+      if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+          EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+      {
+        // Not a hard error. Allow buffering the remaining data.
+        MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                          << SentBytes.getError().message());
+        Continue = false;
+        return 0;
+      }
+
+      LOG_WITH_IDENTIFIER(error) << "Write error";
+      setFailed();
+      Continue = false;
+      throw std::system_error{std::make_error_code(EC)};
+    }
+
+    if (SentBytes.get() == 0)
+    {
+      LOG_WITH_IDENTIFIER(error) << "Disconnected";
+      setFailed();
+      Continue = false;
+    }
+    return SentBytes.get();
+  }
+}
+
 std::unique_ptr<Pipe> Pipe::AnonymousPipe::takeRead()
 {
   if (!Read)
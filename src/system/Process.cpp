@@ -16,12 +16,17 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cerrno>
+#include <charconv>
 #include <csignal>
 #include <cstdio>
 #include <cstring>
 #include <iomanip>
+#include <string_view>
 
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -63,39 +68,69 @@ std::string Process::thisProcessPath()
   return {Binary};
 }
 
-[[noreturn]] void Process::exec(const SpawnOptions& Opts)
+std::optional<Process::ResourceUsage> Process::usage(raw_handle Handle)
 {
-  LOG(debug) << "----- Process::exec() "
-             << "was called -----";
+  POD<char[64]> Path;
+  std::snprintf(Path, sizeof(Path), "/proc/%d/stat", Handle);
+  int FD = ::open(Path, O_RDONLY | O_CLOEXEC);
+  if (FD == -1)
+    return std::nullopt;
+  POD<char[1024]> Stat;
+  ::ssize_t Size = ::read(FD, Stat, sizeof(Stat) - 1);
+  ::close(FD);
+  if (Size <= 0)
+    return std::nullopt;
+
+  // The name of the program, in parentheses, might contain anything, so the
+  // fields are counted from the closing parenthesis, after which the third
+  // field, the state of the process, starts.
+  std::string_view Fields{Stat, static_cast<std::size_t>(Size)};
+  std::size_t NameEnd = Fields.rfind(')');
+  if (NameEnd == std::string_view::npos)
+    return std::nullopt;
+  Fields.remove_prefix(NameEnd + 1);
+
+  auto Field = [&Fields](std::size_t N) -> std::uint64_t {
+    std::size_t Begin = 0;
+    for (std::size_t I = 3; I <= N; ++I)
+    {
+      Begin = Fields.find_first_not_of(' ', Begin);
+      if (Begin == std::string_view::npos)
+        return 0;
+      if (I == N)
+        break;
+      Begin = Fields.find(' ', Begin);
+    }
+    std::uint64_t Value = 0;
+    std::from_chars(Fields.data() + Begin, Fields.data() + Fields.size(), Value);
+    return Value;
+  };
+
+  static const long TicksPerSecond = ::sysconf(_SC_CLK_TCK);
+  static const long PageSize = ::sysconf(_SC_PAGESIZE);
+  // (See proc(5) for the fields: utime, stime, and rss.)
+  const std::uint64_t Ticks = Field(14) + Field(15);
+  ResourceUsage R;
+  R.CPUTime = std::chrono::microseconds{Ticks * 1'000'000 / TicksPerSecond};
+  R.RSSBytes = Field(24) * PageSize;
+  return R;
+}
 
-  char** NewArgv = new char*[Opts.Arguments.size() + 2];
-  allocCopyString(Opts.Program, NewArgv, 0);
+static void logSpawnOptions(const char* Function,
+                            const Process::SpawnOptions& Opts)
+{
+  LOG(debug) << "----- " << Function << " was called -----";
   LOG(debug) << "        Program: " << Opts.Program;
-  NewArgv[Opts.Arguments.size() + 1] = nullptr;
   for (std::size_t I = 0; I < Opts.Arguments.size(); ++I)
-  {
-    allocCopyString(Opts.Arguments[I], NewArgv, I + 1);
     LOG(debug) << "        Arg "
                << std::setw(log::Logger::digits(Opts.Arguments.size())) << I
                << ": " << Opts.Arguments[I];
-  }
-
   for (const auto& E : Opts.Environment)
   {
     if (!E.second.has_value())
-    {
       LOG(debug) << "        Env unset: " << E.first;
-      CheckedPOSIX([&K = E.first] { return ::unsetenv(K.c_str()); }, -1);
-    }
     else
-    {
       LOG(debug) << "        Env   set: " << E.first << " = " << *E.second;
-      CheckedPOSIX(
-        [&K = E.first, &V = E.second] {
-          return ::setenv(K.c_str(), V->c_str(), 1);
-        },
-        -1);
-    }
   }
 
   if (Opts.CreatePTY)
@@ -109,9 +144,37 @@ std::string Process::thisProcessPath()
     if (Opts.StandardError)
       LOG(debug) << "       stderr: " << *Opts.StandardError;
   }
+  if (Opts.Affinity)
+    LOG(debug) << "         CPUs: " << Opts.Affinity->toString();
+
+  LOG(debug) << "----- " << Function << " firing... -----";
+}
+
+[[noreturn]] void Process::exec(const SpawnOptions& Opts)
+{
+  logSpawnOptions("Process::exec()", Opts);
+
+  char** NewArgv = new char*[Opts.Arguments.size() + 2];
+  allocCopyString(Opts.Program, NewArgv, 0);
+  NewArgv[Opts.Arguments.size() + 1] = nullptr;
+  for (std::size_t I = 0; I < Opts.Arguments.size(); ++I)
+    allocCopyString(Opts.Arguments[I], NewArgv, I + 1);
+
+  for (const auto& E : Opts.Environment)
+  {
+    if (!E.second.has_value())
+      CheckedPOSIX([&K = E.first] { return ::unsetenv(K.c_str()); }, -1);
+    else
+      CheckedPOSIX(
+        [&K = E.first, &V = E.second] {
+          return ::setenv(K.c_str(), V->c_str(), 1);
+        },
+        -1);
+  }
 
-  LOG(debug) << "----- Process::exec() "
-             << "firing... -----";
+  if (Opts.Affinity && !Opts.Affinity->applyToThisThreadUnchecked())
+    LOG(warn) << "Restricting to CPUs " << Opts.Affinity->toString()
+              << " failed";
 
   if (!Opts.CreatePTY)
   {
@@ -145,37 +208,164 @@ std::string Process::thisProcessPath()
   unreachable("::exec() should've started a new process");
 }
 
+namespace
+{
+
+/// The arguments and the environment of a program to start, laid out as the
+/// arrays \p execve() takes. This is prepared before the new process is
+/// created, so the child does not need to allocate.
+struct ExecImage
+{
+  std::vector<std::string> Arguments;
+  std::vector<std::string> Environment;
+  std::vector<char*> Argv;
+  std::vector<char*> Envp;
+
+  explicit ExecImage(const Process::SpawnOptions& Opts);
+};
+
+std::vector<char*> makeCStringArray(std::vector<std::string>& Strings)
+{
+  std::vector<char*> Array;
+  Array.reserve(Strings.size() + 1);
+  for (std::string& S : Strings)
+    Array.emplace_back(S.data());
+  Array.emplace_back(nullptr);
+  return Array;
+}
+
+ExecImage::ExecImage(const Process::SpawnOptions& Opts)
+{
+  Arguments.reserve(Opts.Arguments.size() + 1);
+  Arguments.emplace_back(Opts.Program);
+  Arguments.insert(
+    Arguments.end(), Opts.Arguments.begin(), Opts.Arguments.end());
+
+  // The inherited environment, without the variables that are overridden.
+  for (char** E = environ; E && *E; ++E)
+  {
+    std::string_view Var = *E;
+    std::string_view Key = Var.substr(0, Var.find('='));
+    auto It = Opts.Environment.find(std::string{Key});
+    if (It == Opts.Environment.end())
+      Environment.emplace_back(Var);
+  }
+  for (const auto& E : Opts.Environment)
+    if (E.second.has_value())
+      Environment.emplace_back(E.first + '=' + *E.second);
+
+  Argv = makeCStringArray(Arguments);
+  Envp = makeCStringArray(Environment);
+}
+
+} // namespace
+
 Process Process::spawn(const SpawnOptions& Opts)
 {
+  logSpawnOptions("Process::spawn()", Opts);
+
   std::optional<Pty> PTY;
   if (Opts.CreatePTY)
     PTY.emplace(Pty{});
-
-  raw_handle ForkResult =
-    CheckedPOSIXThrow([] { return ::fork(); }, "fork() failed in spawn()", -1);
-  if (ForkResult != 0)
+  const ExecImage Image{Opts};
+
+  // The child created by vfork() runs in the memory of the parent, without
+  // the need to copy the page tables, until it exec()s. It must not run the
+  // signal handlers of the parent in the meantime, which are reset in the
+  // child while every signal is blocked.
+  POD<::sigset_t> AllSignals;
+  POD<::sigset_t> OldMask;
+  ::sigfillset(&AllSignals);
+  ::pthread_sigmask(SIG_SETMASK, &AllSignals, &OldMask);
+  // The parent might block signals to read them from a signalfd, which the
+  // program must not inherit.
+  POD<::sigset_t> ChildMask;
+  ::sigemptyset(&ChildMask);
+
+  // Written by the child, read by the parent after the child exec()ed or died.
+  volatile int ChildError = 0;
+  raw_handle ForkResult = ::vfork();
+  if (ForkResult == 0)
   {
-    // We are in the parent.
-    Process P;
-    P.Handle = ForkResult;
-    MONOMUX_TRACE_LOG(LOG(debug) << "PID " << P.Handle << " spawned.");
+    // We are in the child. Only async-signal-safe calls on the data prepared
+    // above are allowed until exec().
+    for (int Sig = 1; Sig < NSIG; ++Sig)
+    {
+      struct ::sigaction Action;
+      if (::sigaction(Sig, nullptr, &Action) == -1 ||
+          Action.sa_handler == SIG_IGN || Action.sa_handler == SIG_DFL)
+        continue;
+      Action.sa_handler = SIG_DFL;
+      Action.sa_flags = 0;
+      ::sigemptyset(&Action.sa_mask);
+      ::sigaction(Sig, &Action, nullptr);
+    }
 
+    ::setsid();
+    if (Opts.Affinity)
+      // (Failing to do so is not fatal, the program may run anywhere.)
+      Opts.Affinity->applyToThisThreadUnchecked();
+    bool Ready = true;
     if (PTY)
+      Ready = PTY->setupChildrenSide();
+    else
     {
-      PTY->setupParentSide();
-      P.PTY = std::move(PTY);
+      // Replaces the "Original" file descriptor with the new "With" one.
+      auto ReplaceFD = [](raw_fd Original, raw_fd With) {
+        if (With == fd::Invalid)
+          return ::close(Original) != -1 || errno == EBADF;
+        if (::dup2(With, Original) == -1)
+          return false;
+        ::close(With);
+        return true;
+      };
+      if (Opts.StandardInput)
+        Ready = Ready && ReplaceFD(STDIN_FILENO, *Opts.StandardInput);
+      if (Opts.StandardError)
+        Ready = Ready && ReplaceFD(STDERR_FILENO, *Opts.StandardError);
+      if (Opts.StandardOutput)
+        Ready = Ready && ReplaceFD(STDOUT_FILENO, *Opts.StandardOutput);
     }
 
-    return P;
+    if (Ready)
+    {
+      ::sigprocmask(SIG_SETMASK, &ChildMask, nullptr);
+      ::execvpe(Image.Argv.front(), Image.Argv.data(), Image.Envp.data());
+    }
+    ChildError = errno;
+    ::_exit(-SIGCHLD);
   }
+  int SpawnError = errno;
+  ::pthread_sigmask(SIG_SETMASK, &OldMask, nullptr);
+  if (ForkResult == -1)
+    throw std::system_error{std::error_code{SpawnError, std::system_category()},
+                            "vfork() failed in spawn()"};
+
+  // We are in the parent.
+  Process P;
+  P.Handle = ForkResult;
+  MONOMUX_TRACE_LOG(LOG(debug) << "PID " << P.Handle << " spawned.");
+  if (ChildError)
+    LOG(error) << "Starting '" << Opts.Program << "' (PID " << P.Handle
+               << ") failed: "
+               << std::error_code{ChildError, std::system_category()}.message();
 
-  // We are in the child.
-  CheckedPOSIXThrow([] { return ::setsid(); }, "setsid()", -1);
   if (PTY)
-    PTY->setupChildrenSide();
+  {
+    PTY->setupParentSide();
+    P.PTY = std::move(PTY);
+  }
+
+  return P;
+}
 
-  Process::exec(Opts);
-  unreachable("Process::exec() should've replaced the process.");
+Process Process::adopt(raw_handle Handle, std::optional<Pty> PTY)
+{
+  Process P;
+  P.Handle = Handle;
+  P.PTY = std::move(PTY);
+  MONOMUX_TRACE_LOG(LOG(debug) << "PID " << P.Handle << " taken over.");
+  return P;
 }
 
 static std::pair<bool, int> reapAndGetExitCode(Process::raw_handle PID,
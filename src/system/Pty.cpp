@@ -20,6 +20,7 @@
 
 #include <linux/limits.h>
 #include <pty.h>
+#include <termios.h>
 #include <unistd.h>
 #include <utmp.h>
 
@@ -66,6 +67,21 @@ void Pty::setupParentSide()
   fd::close(PTS);
 
   IsMaster = true;
+  wrapMaster();
+}
+
+Pty Pty::adopt(fd Master, std::string Name)
+{
+  // The default constructor would open a new pair.
+  Pty P{std::move(Master), std::move(Name)};
+  LOG(debug) << "Took over " << P.name() << " (master: " << P.Master << ')';
+  P.IsMaster = true;
+  P.wrapMaster();
+  return P;
+}
+
+void Pty::wrapMaster()
+{
   fd::setNonBlockingCloseOnExec(Master);
 
   std::ostringstream InName;
@@ -79,20 +95,15 @@ void Pty::setupParentSide()
     Pipe::weakWrap(Master.get(), Pipe::Write, OutName.str()));
 }
 
-void Pty::setupChildrenSide()
+bool Pty::setupChildrenSide() const noexcept
 {
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                    << Slave << " - Set up as child...");
-
-  // Closes PTM, the pseudoterminal multiplexer master (PTMX).
-  raw_fd PTM = Master.release();
-  fd::close(PTM);
-
-  CheckedPOSIXThrow(
-    [this] { return ::login_tty(Slave); }, "login_tty in child", -1);
+  // Closes PTM, the pseudoterminal multiplexer master (PTMX). The handle in
+  // the instance is left alone, as the memory might be shared with the parent.
+  ::close(Master.get());
 
   // Generally the PTY children are exec()ing away, so we can safely just NOT
   // set up the Pipe data structures here, right?
+  return ::login_tty(Slave.get()) != -1;
 }
 
 void Pty::setSize(unsigned short Rows, unsigned short Columns)
@@ -112,6 +123,26 @@ void Pty::setSize(unsigned short Rows, unsigned short Columns)
     -1);
 }
 
+Pty::InputMode Pty::getInputMode() const
+{
+  if (!isMaster())
+    throw std::invalid_argument{"getInputMode() not allowed on slave device."};
+
+  // The terminal settings queried through the master are those of the slave.
+  POD<struct ::termios> Settings;
+  CheckedPOSIXThrow(
+    [RawFD = Master.get(), &Settings] {
+      return ::tcgetattr(RawFD, &Settings);
+    },
+    "tcgetattr(PTMX)",
+    -1);
+
+  InputMode Mode;
+  Mode.Echo = Settings->c_lflag & ECHO;
+  Mode.Canonical = Settings->c_lflag & ICANON;
+  return Mode;
+}
+
 } // namespace monomux
 
 #undef LOG_WITH_IDENTIFIER
@@ -0,0 +1,389 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/Recorder.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/Recorder")
+
+namespace monomux
+{
+
+namespace
+{
+
+/// \returns the length of the UTF-8 sequence started by the \p Lead byte, or
+/// \p 0 if it can not start one.
+std::size_t utf8Length(unsigned char Lead) noexcept
+{
+  if (Lead < 0x80)
+    return 1;
+  if ((Lead & 0xE0) == 0xC0 && Lead >= 0xC2)
+    return 2;
+  if ((Lead & 0xF0) == 0xE0)
+    return 3;
+  if ((Lead & 0xF8) == 0xF0 && Lead <= 0xF4)
+    return 4;
+  return 0;
+}
+
+bool isContinuation(unsigned char C) noexcept { return (C & 0xC0) == 0x80; }
+
+/// Appends \p Byte escaped as a JSON code point.
+void appendEscaped(std::string& Out, unsigned char Byte)
+{
+  char Escape[8];
+  std::snprintf(Escape, sizeof(Escape), "\\u%04x", Byte);
+  Out.append(Escape);
+}
+
+/// Appends \p Data to \p Out as the contents of a JSON string. Bytes that are
+/// not part of valid UTF-8 are taken as Latin-1 characters.
+///
+/// \returns the number of bytes at the end of \p Data that were not appended,
+/// because they start a character that is not complete.
+std::size_t appendJSON(std::string& Out, std::string_view Data)
+{
+  for (std::size_t I = 0; I < Data.size();)
+  {
+    const auto C = static_cast<unsigned char>(Data[I]);
+    switch (C)
+    {
+      case '"':
+        Out.append("\\\"");
+        ++I;
+        continue;
+      case '\\':
+        Out.append("\\\\");
+        ++I;
+        continue;
+      case '\n':
+        Out.append("\\n");
+        ++I;
+        continue;
+      case '\r':
+        Out.append("\\r");
+        ++I;
+        continue;
+      case '\t':
+        Out.append("\\t");
+        ++I;
+        continue;
+      default:
+        break;
+    }
+    if (C < 0x20 || C == 0x7F)
+    {
+      appendEscaped(Out, C);
+      ++I;
+      continue;
+    }
+
+    const std::size_t Length = utf8Length(C);
+    if (!Length)
+    {
+      appendEscaped(Out, C);
+      ++I;
+      continue;
+    }
+    std::size_t Valid = 1;
+    while (Valid < Length && I + Valid < Data.size() &&
+           isContinuation(static_cast<unsigned char>(Data[I + Valid])))
+      ++Valid;
+    if (Valid == Length)
+    {
+      Out.append(Data.substr(I, Length));
+      I += Length;
+    }
+    else if (I + Valid == Data.size())
+      // The rest of the character is in the next chunk.
+      return Valid;
+    else
+    {
+      appendEscaped(Out, C);
+      ++I;
+    }
+  }
+  return 0;
+}
+
+/// Appends the time of an event to \p Out, in seconds.
+void appendTime(std::string& Out, std::uint64_t Microseconds)
+{
+  char Time[32];
+  std::snprintf(Time,
+                sizeof(Time),
+                "%llu.%06llu",
+                static_cast<unsigned long long>(Microseconds / 1000000),
+                static_cast<unsigned long long>(Microseconds % 1000000));
+  Out.append(Time);
+}
+
+/// Writes the entirety of \p Data to \p File.
+///
+/// \throws std::system_error If the writing failed.
+void writeAll(raw_fd File, std::string_view Data)
+{
+  while (!Data.empty())
+  {
+    const ssize_t Written = CheckedPOSIXThrow(
+      [File, &Data] { return ::write(File, Data.data(), Data.size()); },
+      "write()",
+      -1);
+    Data.remove_prefix(static_cast<std::size_t>(Written));
+  }
+}
+
+} // namespace
+
+Recording::Recording(Recorder& Owner,
+                     std::string Path,
+                     fd File,
+                     std::size_t QueueSize,
+                     Clock::time_point Start)
+  : Owner(Owner), Path(std::move(Path)), File(std::move(File)), Start(Start),
+    Queue(QueueSize)
+{}
+
+bool Recording::output(std::string_view Data, Clock::time_point Now)
+{
+  return push('o', Data, Now);
+}
+
+bool Recording::resize(std::uint16_t Rows,
+                       std::uint16_t Columns,
+                       Clock::time_point Now)
+{
+  const std::string Size = std::to_string(Columns) + 'x' + std::to_string(Rows);
+  return push('r', Size, Now);
+}
+
+bool Recording::push(char Kind, std::string_view Data, Clock::time_point Now)
+{
+  Event E{};
+  E.Microseconds = static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(Now - Start)
+      .count());
+  E.Size = static_cast<std::uint32_t>(Data.size());
+  E.Kind = Kind;
+
+  const std::size_t Needed = sizeof(E) + Data.size();
+  std::array<SPSCRingBuffer<>::Range, 2> Free = Queue.reserveBack(Needed);
+  if (Free[0].Size + Free[1].Size < Needed)
+  {
+    Dropped.fetch_add(1, std::memory_order_relaxed);
+    Owner.wake();
+    return false;
+  }
+
+  std::size_t RangeIndex = 0;
+  std::size_t RangeOffset = 0;
+  for (std::string_view Part :
+       {std::string_view{reinterpret_cast<const char*>(&E), sizeof(E)}, Data})
+    while (!Part.empty())
+    {
+      SPSCRingBuffer<>::Range& R = Free.at(RangeIndex);
+      const std::size_t Len = std::min(Part.size(), R.Size - RangeOffset);
+      std::memcpy(R.Begin + RangeOffset, Part.data(), Len);
+      Part.remove_prefix(Len);
+      RangeOffset += Len;
+      if (RangeOffset == R.Size)
+      {
+        ++RangeIndex;
+        RangeOffset = 0;
+      }
+    }
+  Queue.commitBack(Needed);
+  Queue.publish();
+
+  if (Queue.size() > Queue.capacity() / 2)
+    // Wake the writer before the queue fills up.
+    Owner.wake();
+  return true;
+}
+
+bool Recording::drain(std::string& Scratch)
+{
+  Scratch.clear();
+  Event E;
+  std::string Data;
+  while (Queue.takeFront(reinterpret_cast<char*>(&E), sizeof(E)) == sizeof(E))
+  {
+    // The data of the event is published together with its header.
+    Data = E.Kind == 'o' ? std::move(Partial) : std::string{};
+    const std::size_t Offset = Data.size();
+    Data.resize(Offset + E.Size);
+    Queue.takeFront(Data.data() + Offset, E.Size);
+
+    Scratch.push_back('[');
+    appendTime(Scratch, E.Microseconds);
+    Scratch.append(", \"");
+    Scratch.push_back(E.Kind);
+    Scratch.append("\", \"");
+    const std::size_t Held = appendJSON(Scratch, Data);
+    if (E.Kind == 'o')
+      Partial = Data.substr(Data.size() - Held);
+    Scratch.append("\"]\n");
+  }
+
+  if (Scratch.empty() || Failed.load(std::memory_order_relaxed))
+    return false;
+  try
+  {
+    writeAll(File, Scratch);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Writing recording '" << Path << "' failed: " << Err.what();
+    Failed.store(true, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+Recorder::Recorder()
+{
+  Writer = std::thread{[this] { run(); }};
+}
+
+Recorder::~Recorder()
+{
+  {
+    std::lock_guard<std::mutex> Lock{WakeLock};
+    Stopping.store(true);
+  }
+  Wake.notify_one();
+  Writer.join();
+  drain();
+}
+
+std::shared_ptr<Recording> Recorder::start(std::string Path,
+                                           std::uint16_t Rows,
+                                           std::uint16_t Columns,
+                                           std::string_view Title,
+                                           std::size_t QueueSize)
+{
+  fd File = CheckedPOSIXThrow(
+    [&Path] {
+      return ::open(Path.c_str(),
+                    O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR);
+    },
+    "open('" + Path + "')",
+    -1);
+
+  std::string Header = "{\"version\": 2, \"width\": " +
+                       std::to_string(Columns) +
+                       ", \"height\": " + std::to_string(Rows) +
+                       ", \"timestamp\": " +
+                       std::to_string(std::chrono::duration_cast<
+                                        std::chrono::seconds>(
+                                        std::chrono::system_clock::now()
+                                          .time_since_epoch())
+                                        .count()) +
+                       ", \"title\": \"";
+  appendJSON(Header, Title);
+  Header.append("\"}\n");
+  writeAll(File, Header);
+
+  auto R = std::make_shared<Recording>(
+    *this, std::move(Path), std::move(File), QueueSize, Recording::Clock::now());
+  std::lock_guard<std::mutex> Lock{RegistryLock};
+  Recordings.emplace_back(R);
+  return R;
+}
+
+void Recorder::flush() { drain(); }
+
+void Recorder::wake()
+{
+  if (Sleeping.exchange(false))
+    Wake.notify_one();
+}
+
+void Recorder::drain()
+{
+  std::lock_guard<std::mutex> Draining{DrainLock};
+  std::vector<std::shared_ptr<Recording>> Current;
+  {
+    std::lock_guard<std::mutex> Lock{RegistryLock};
+    Current = Recordings;
+  }
+
+  // The disk is written without holding up the starting of new recordings.
+  std::string Scratch;
+  std::vector<Recording*> Retired;
+  for (const std::shared_ptr<Recording>& R : Current)
+  {
+    // If the recording is finished, nothing more will be queued after the
+    // events written now.
+    const bool Finished = R->Finished.load(std::memory_order_acquire);
+    R->drain(Scratch);
+    if (Finished)
+    {
+      // (An incomplete character at the very end could not be shown anyway.)
+      if (R->dropped())
+        LOG(warn) << "Recording '" << R->path() << "' dropped " << R->dropped()
+                  << " events";
+      fd Closed = std::move(R->File);
+      Retired.emplace_back(R.get());
+    }
+  }
+
+  if (Retired.empty())
+    return;
+  std::lock_guard<std::mutex> Lock{RegistryLock};
+  Recordings.erase(std::remove_if(Recordings.begin(),
+                                  Recordings.end(),
+                                  [&Retired](const auto& R) {
+                                    return std::find(Retired.begin(),
+                                                     Retired.end(),
+                                                     R.get()) != Retired.end();
+                                  }),
+                   Recordings.end());
+}
+
+void Recorder::run()
+{
+  while (!Stopping.load())
+  {
+    {
+      std::unique_lock<std::mutex> Lock{WakeLock};
+      Sleeping.store(true);
+      Wake.wait_for(Lock, WakeInterval, [this] {
+        return Stopping.load() || !Sleeping.load();
+      });
+      Sleeping.store(false);
+    }
+    drain();
+  }
+}
+
+} // namespace monomux
+
+#undef LOG
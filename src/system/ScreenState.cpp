@@ -0,0 +1,602 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "monomux/adt/ByteScan.hpp"
+
+#include "monomux/system/ScreenState.hpp"
+
+namespace monomux
+{
+
+/// The longest CSI sequence kept, longer ones are not interpreted.
+static constexpr std::size_t MaxSequenceSize = 64;
+static constexpr std::size_t TabStop = 8;
+
+static bool isPrintableASCII(char C) noexcept { return C >= 0x20 && C < 0x7F; }
+
+ScreenState::ScreenState(std::size_t Rows, std::size_t Columns)
+  : Rows(std::max(Rows, std::size_t{1})),
+    Columns(std::max(Columns, std::size_t{1})), ScrollBottom(this->Rows - 1)
+{
+  Screen.resize(this->Rows);
+  for (Row& R : Screen)
+    R.Cells.resize(this->Columns);
+}
+
+void ScreenState::resize(std::size_t NewRows, std::size_t NewColumns)
+{
+  if (!NewRows || !NewColumns || (NewRows == Rows && NewColumns == Columns))
+    // Terminals without a size report 0, which is meaningless to track.
+    return;
+
+  auto ResizeScreen = [NewRows, NewColumns](std::vector<Row>& S,
+                                            std::size_t KeepRow) {
+    if (KeepRow >= NewRows)
+      // Keep the line of the cursor visible, like terminals do.
+      S.erase(S.begin(), S.begin() + (KeepRow - NewRows + 1));
+    S.resize(NewRows);
+    for (Row& R : S)
+    {
+      R.Cells.resize(NewColumns);
+      R.Dirty = true;
+    }
+  };
+
+  if (AlternateScreen)
+  {
+    ResizeScreen(SavedScreen, SavedCursorRow);
+    SavedCursorRow = std::min(SavedCursorRow, NewRows - 1);
+  }
+  ResizeScreen(Screen, CursorRow);
+
+  Rows = NewRows;
+  Columns = NewColumns;
+  CursorRow = std::min(CursorRow, Rows - 1);
+  CursorColumn = std::min(CursorColumn, Columns - 1);
+  SavedCursorRow = std::min(SavedCursorRow, Rows - 1);
+  SavedCursorColumn = std::min(SavedCursorColumn, Columns - 1);
+  WrapPending = false;
+  ScrollTop = 0;
+  ScrollBottom = Rows - 1;
+}
+
+void ScreenState::feed(std::string_view Data)
+{
+  const char* Ptr = Data.data();
+  const char* const End = Ptr + Data.size();
+  while (Ptr != End)
+  {
+    if (State == ParseState::Ground && isPrintableASCII(*Ptr))
+    {
+      // The bulk of the output is plain text, which is handled without
+      // going through the state machine for every byte.
+      const char* RunEnd =
+        Ptr + scan::findNonPrintable(Ptr, static_cast<std::size_t>(End - Ptr));
+      for (; Ptr != RunEnd; ++Ptr)
+        printable(Ptr, 1);
+      continue;
+    }
+
+    const char C = *Ptr++;
+    const auto UC = static_cast<unsigned char>(C);
+    switch (State)
+    {
+      case ParseState::Ground:
+        if (UC >= 0x80)
+          utf8(UC);
+        else
+          control(C);
+        break;
+      case ParseState::Escape:
+        if (UC < 0x20)
+          control(C);
+        else
+          escape(C);
+        break;
+      case ParseState::EscapeIntermediate:
+        if (UC < 0x20)
+          control(C);
+        else if (UC >= 0x30)
+          // The designated character set is not tracked.
+          State = ParseState::Ground;
+        break;
+      case ParseState::CSI:
+        if (UC >= 0x40 && UC < 0x7F)
+        {
+          State = ParseState::Ground;
+          if (Sequence.size() < MaxSequenceSize)
+            csi(C);
+        }
+        else if (UC >= 0x20 && UC < 0x40)
+        {
+          if (Sequence.size() < MaxSequenceSize)
+            Sequence.push_back(C);
+        }
+        else if (UC < 0x20)
+          control(C);
+        else
+          State = ParseState::Ground;
+        break;
+      case ParseState::String:
+        if (C == '\a')
+          State = ParseState::Ground;
+        else if (C == '\033')
+          State = ParseState::StringEscape;
+        break;
+      case ParseState::StringEscape:
+        State = ParseState::Ground;
+        if (C != '\\')
+          escape(C);
+        break;
+    }
+  }
+}
+
+void ScreenState::utf8(unsigned char C)
+{
+  if (C < 0xC0)
+  {
+    // A continuation byte, without a lead byte it is dropped.
+    if (!PartialExpected)
+      return;
+    Partial.Bytes[Partial.Size++] = static_cast<char>(C);
+    if (Partial.Size == PartialExpected)
+    {
+      PartialExpected = 0;
+      printable(Partial.Bytes, Partial.Size);
+    }
+    return;
+  }
+
+  if (C >= 0xF0)
+    PartialExpected = 4;
+  else if (C >= 0xE0)
+    PartialExpected = 3;
+  else
+    PartialExpected = 2;
+  Partial.Bytes[0] = static_cast<char>(C);
+  Partial.Size = 1;
+}
+
+void ScreenState::printable(const char* Bytes, std::size_t Size)
+{
+  if (WrapPending)
+  {
+    WrapPending = false;
+    CursorColumn = 0;
+    lineFeed();
+  }
+
+  Row& R = Screen[CursorRow];
+  Cell& Ch = R.Cells[CursorColumn];
+  std::memcpy(Ch.Bytes, Bytes, Size);
+  Ch.Size = static_cast<std::uint8_t>(Size);
+  R.Dirty = true;
+
+  if (CursorColumn + 1 == Columns)
+    WrapPending = true;
+  else
+    ++CursorColumn;
+}
+
+void ScreenState::control(char C)
+{
+  switch (C)
+  {
+    case '\r':
+      CursorColumn = 0;
+      WrapPending = false;
+      break;
+    case '\n':
+    case '\v':
+    case '\f':
+      lineFeed();
+      break;
+    case '\b':
+      if (CursorColumn)
+        --CursorColumn;
+      WrapPending = false;
+      break;
+    case '\t':
+      CursorColumn =
+        std::min((CursorColumn / TabStop + 1) * TabStop, Columns - 1);
+      WrapPending = false;
+      break;
+    case '\033':
+      State = ParseState::Escape;
+      Sequence.clear();
+      break;
+    default:
+      // Other control characters do not change the screen.
+      break;
+  }
+  PartialExpected = 0;
+}
+
+void ScreenState::escape(char Final)
+{
+  State = ParseState::Ground;
+  switch (Final)
+  {
+    case '[':
+      State = ParseState::CSI;
+      Sequence.clear();
+      break;
+    case ']':
+    case 'P':
+    case 'X':
+    case '^':
+    case '_':
+      State = ParseState::String;
+      break;
+    case '7':
+      SavedCursorRow = CursorRow;
+      SavedCursorColumn = CursorColumn;
+      break;
+    case '8':
+      moveCursor(SavedCursorRow, SavedCursorColumn);
+      break;
+    case 'D':
+      lineFeed();
+      break;
+    case 'E':
+      CursorColumn = 0;
+      lineFeed();
+      break;
+    case 'M':
+      reverseLineFeed();
+      break;
+    case 'c':
+      *this = ScreenState(Rows, Columns);
+      break;
+    default:
+      if (Final >= 0x20 && Final < 0x30)
+        State = ParseState::EscapeIntermediate;
+      break;
+  }
+}
+
+std::size_t ScreenState::param(std::size_t Index, std::size_t Default) const
+{
+  std::size_t Pos = 0;
+  if (!Sequence.empty() && Sequence.front() >= 0x3C)
+    // Skip the private marker.
+    Pos = 1;
+
+  for (; Index && Pos < Sequence.size(); ++Pos)
+    if (Sequence[Pos] == ';')
+      --Index;
+  if (Index)
+    return Default;
+
+  std::size_t Value = 0;
+  for (; Pos < Sequence.size() && Sequence[Pos] >= '0' && Sequence[Pos] <= '9';
+       ++Pos)
+    Value = std::min(Value * 10 + (Sequence[Pos] - '0'), std::size_t{65535});
+  return Value ? Value : Default;
+}
+
+void ScreenState::csi(char Final)
+{
+  const bool Private = !Sequence.empty() && Sequence.front() >= 0x3C;
+  const bool Intermediate =
+    std::any_of(Sequence.begin(), Sequence.end(), [](char C) {
+      return C >= 0x20 && C < 0x30;
+    });
+  if (Intermediate)
+    return;
+
+  if (Private)
+  {
+    if (Sequence.front() != '?' || (Final != 'h' && Final != 'l'))
+      return;
+    const bool Set = Final == 'h';
+    for (std::size_t I = 0; I <= static_cast<std::size_t>(std::count(
+                                   Sequence.begin(), Sequence.end(), ';'));
+         ++I)
+    {
+      switch (param(I, 0))
+      {
+        case 1049:
+          if (Set)
+          {
+            SavedCursorRow = CursorRow;
+            SavedCursorColumn = CursorColumn;
+            setAlternateScreen(true);
+          }
+          else
+          {
+            setAlternateScreen(false);
+            moveCursor(SavedCursorRow, SavedCursorColumn);
+          }
+          break;
+        case 47:
+        case 1047:
+          setAlternateScreen(Set);
+          break;
+      }
+    }
+    return;
+  }
+
+  const std::size_t N = param(0);
+  switch (Final)
+  {
+    case 'A':
+      moveCursor(CursorRow - std::min(N, CursorRow), CursorColumn);
+      break;
+    case 'B':
+    case 'e':
+      moveCursor(CursorRow + N, CursorColumn);
+      break;
+    case 'C':
+    case 'a':
+      moveCursor(CursorRow, CursorColumn + N);
+      break;
+    case 'D':
+      moveCursor(CursorRow, CursorColumn - std::min(N, CursorColumn));
+      break;
+    case 'E':
+      moveCursor(CursorRow + N, 0);
+      break;
+    case 'F':
+      moveCursor(CursorRow - std::min(N, CursorRow), 0);
+      break;
+    case 'G':
+    case '`':
+      moveCursor(CursorRow, N - 1);
+      break;
+    case 'd':
+      moveCursor(N - 1, CursorColumn);
+      break;
+    case 'H':
+    case 'f':
+      moveCursor(N - 1, param(1) - 1);
+      break;
+    case 'J':
+      switch (param(0, 0))
+      {
+        case 0:
+          clearCells(CursorRow, CursorColumn, Columns);
+          for (std::size_t R = CursorRow + 1; R < Rows; ++R)
+            clearCells(R, 0, Columns);
+          break;
+        case 1:
+          for (std::size_t R = 0; R < CursorRow; ++R)
+            clearCells(R, 0, Columns);
+          clearCells(CursorRow, 0, CursorColumn + 1);
+          break;
+        default:
+          for (std::size_t R = 0; R < Rows; ++R)
+            clearCells(R, 0, Columns);
+          break;
+      }
+      break;
+    case 'K':
+      switch (param(0, 0))
+      {
+        case 0:
+          clearCells(CursorRow, CursorColumn, Columns);
+          break;
+        case 1:
+          clearCells(CursorRow, 0, CursorColumn + 1);
+          break;
+        default:
+          clearCells(CursorRow, 0, Columns);
+          break;
+      }
+      break;
+    case 'X':
+      clearCells(CursorRow, CursorColumn, CursorColumn + N);
+      break;
+    case 'L':
+      if (CursorRow >= ScrollTop && CursorRow <= ScrollBottom)
+        scroll(CursorRow, ScrollBottom, -static_cast<long>(N));
+      break;
+    case 'M':
+      if (CursorRow >= ScrollTop && CursorRow <= ScrollBottom)
+        scroll(CursorRow, ScrollBottom, static_cast<long>(N));
+      break;
+    case 'S':
+      scroll(ScrollTop, ScrollBottom, static_cast<long>(N));
+      break;
+    case 'T':
+      scroll(ScrollTop, ScrollBottom, -static_cast<long>(N));
+      break;
+    case 'P':
+    case '@':
+    {
+      Row& R = Screen[CursorRow];
+      const std::size_t Count = std::min(N, Columns - CursorColumn);
+      auto Begin = R.Cells.begin() + CursorColumn;
+      if (Final == 'P')
+        std::rotate(Begin, Begin + Count, R.Cells.end());
+      else
+        std::rotate(Begin, R.Cells.end() - Count, R.Cells.end());
+      std::size_t ClearFrom = Final == 'P' ? Columns - Count : CursorColumn;
+      clearCells(CursorRow, ClearFrom, ClearFrom + Count);
+      WrapPending = false;
+      break;
+    }
+    case 'r':
+    {
+      const std::size_t Top = param(0) - 1;
+      const std::size_t Bottom = std::min(param(1, Rows), Rows) - 1;
+      if (Top < Bottom)
+      {
+        ScrollTop = Top;
+        ScrollBottom = Bottom;
+      }
+      moveCursor(0, 0);
+      break;
+    }
+    case 's':
+      SavedCursorRow = CursorRow;
+      SavedCursorColumn = CursorColumn;
+      break;
+    case 'u':
+      moveCursor(SavedCursorRow, SavedCursorColumn);
+      break;
+    default:
+      // Graphic renditions (m) and reports do not change the contents.
+      break;
+  }
+}
+
+void ScreenState::moveCursor(std::size_t Row, std::size_t Column)
+{
+  CursorRow = std::min(Row, Rows - 1);
+  CursorColumn = std::min(Column, Columns - 1);
+  WrapPending = false;
+}
+
+void ScreenState::lineFeed()
+{
+  WrapPending = false;
+  if (CursorRow == ScrollBottom)
+    scroll(ScrollTop, ScrollBottom, 1);
+  else if (CursorRow + 1 < Rows)
+    ++CursorRow;
+}
+
+void ScreenState::reverseLineFeed()
+{
+  WrapPending = false;
+  if (CursorRow == ScrollTop)
+    scroll(ScrollTop, ScrollBottom, -1);
+  else if (CursorRow)
+    --CursorRow;
+}
+
+void ScreenState::scroll(std::size_t Top, std::size_t Bottom, long N)
+{
+  const std::size_t Height = Bottom - Top + 1;
+  const std::size_t Count =
+    std::min(static_cast<std::size_t>(N < 0 ? -N : N), Height);
+  if (!Count)
+    return;
+
+  // Rows that only move keep their rendering, as that does not depend on the
+  // position of the row.
+  auto Begin = Screen.begin() + Top;
+  auto End = Screen.begin() + Bottom + 1;
+  if (N > 0)
+  {
+    std::rotate(Begin, Begin + Count, End);
+    for (std::size_t R = Bottom + 1 - Count; R <= Bottom; ++R)
+      clearCells(R, 0, Columns);
+  }
+  else
+  {
+    std::rotate(Begin, End - Count, End);
+    for (std::size_t R = Top; R < Top + Count; ++R)
+      clearCells(R, 0, Columns);
+  }
+}
+
+void ScreenState::clearCells(std::size_t Row, std::size_t From, std::size_t To)
+{
+  To = std::min(To, Columns);
+  if (From >= To)
+    return;
+  auto& R = Screen[Row];
+  std::fill(R.Cells.begin() + From, R.Cells.begin() + To, Cell{});
+  R.Dirty = true;
+}
+
+void ScreenState::setAlternateScreen(bool Enabled)
+{
+  if (Enabled == AlternateScreen)
+    return;
+  AlternateScreen = Enabled;
+
+  if (Enabled)
+  {
+    SavedScreen = std::move(Screen);
+    Screen.clear();
+    Screen.resize(Rows);
+    for (Row& R : Screen)
+      R.Cells.resize(Columns);
+  }
+  else
+  {
+    Screen = std::move(SavedScreen);
+    SavedScreen.clear();
+  }
+  ScrollTop = 0;
+  ScrollBottom = Rows - 1;
+  WrapPending = false;
+}
+
+std::string ScreenState::rowText(std::size_t Row) const
+{
+  std::string Text;
+  if (Row >= Rows)
+    return Text;
+
+  const auto& Cells = Screen[Row].Cells;
+  auto Last = std::find_if(Cells.rbegin(), Cells.rend(), [](const Cell& C) {
+                return C.Size != 1 || C.Bytes[0] != ' ';
+              }).base();
+  for (auto It = Cells.begin(); It != Last; ++It)
+    Text.append(It->Bytes, It->Size);
+  return Text;
+}
+
+std::string ScreenState::snapshot()
+{
+  std::string Result;
+  if (AlternateScreen)
+    Result.append("\033[?1049h");
+  Result.append("\033[0m\033[r\033[H\033[2J");
+
+  for (std::size_t R = 0; R < Rows; ++R)
+  {
+    Row& Line = Screen[R];
+    if (Line.Dirty)
+    {
+      Line.Rendered = rowText(R);
+      Line.Dirty = false;
+    }
+    if (Line.Rendered.empty())
+      continue;
+
+    Result.append("\033[")
+      .append(std::to_string(R + 1))
+      .append(";1H")
+      .append(Line.Rendered);
+  }
+
+  if (ScrollTop != 0 || ScrollBottom != Rows - 1)
+    Result.append("\033[")
+      .append(std::to_string(ScrollTop + 1))
+      .append(";")
+      .append(std::to_string(ScrollBottom + 1))
+      .append("r");
+  Result.append("\033[")
+    .append(std::to_string(CursorRow + 1))
+    .append(";")
+    .append(std::to_string(CursorColumn + 1))
+    .append("H");
+  return Result;
+}
+
+} // namespace monomux
@@ -0,0 +1,207 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Compression.hpp"
+
+#include "monomux/system/Scrollback.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/Scrollback")
+
+namespace monomux
+{
+
+/// The initial size of the storage, which is grown as needed.
+static constexpr std::size_t InitialCapacity = BufferPool::MinPooledSize * 4;
+
+Scrollback::Scrollback(std::size_t Limit)
+  : Limit(Limit), History(std::in_place, std::min(Limit, InitialCapacity))
+{}
+
+void Scrollback::append(std::string_view Data)
+{
+  if (!Limit || Data.empty())
+    return;
+  if (!History)
+    restore();
+
+  if (Data.size() >= Limit)
+  {
+    Truncated = Truncated || !History->empty() || Data.size() > Limit;
+    History->clear();
+    Data.remove_prefix(Data.size() - Limit);
+  }
+  else if (History->size() + Data.size() > Limit)
+  {
+    Truncated = true;
+    History->dropFront(History->size() + Data.size() - Limit);
+  }
+  History->putBack(Data.data(), Data.size());
+}
+
+std::string Scrollback::tail() const
+{
+  std::string Result = contents();
+  if (Truncated)
+  {
+    std::size_t LineBreak = Result.find('\n');
+    Result.erase(0, LineBreak == std::string::npos ? Result.size()
+                                                   : LineBreak + 1);
+  }
+  return Result;
+}
+
+void Scrollback::clear() noexcept
+{
+  if (History)
+    History->clear();
+  {
+    fd Discarded = std::move(Spill);
+  }
+  SpilledSize = 0;
+  SpilledStored = 0;
+  Truncated = false;
+}
+
+/// Creates a file in \p Directory that is deleted once it is closed.
+static fd createUnlinkedFile(const std::string& Directory)
+{
+  auto Unnamed = CheckedPOSIX(
+    [&Directory] {
+      return ::open(
+        Directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    },
+    -1);
+  if (Unnamed)
+    return fd{Unnamed.get()};
+
+  // Not every file system supports unnamed files.
+  std::string Path = Directory + "/mnmx-scrollback.XXXXXX";
+  fd Handle = CheckedPOSIXThrow(
+    [&Path] { return ::mkostemp(Path.data(), O_CLOEXEC); },
+    "mkostemp('" + Path + "')",
+    -1);
+  ::unlink(Path.c_str());
+  return Handle;
+}
+
+std::size_t Scrollback::spill(const std::string& Directory)
+{
+  if (!History)
+    return 0;
+  const std::size_t Released = History->capacity();
+  if (History->empty())
+  {
+    History.reset();
+    return Released;
+  }
+
+  const std::string Data = contents();
+  std::string_view Stored = Data;
+  std::optional<Deflater> Compressor;
+  if constexpr (Deflater::available())
+    Stored = Compressor.emplace().compress(Data);
+
+  fd File = createUnlinkedFile(Directory);
+  for (std::size_t Written = 0; Written < Stored.size();)
+    Written += CheckedPOSIXThrow(
+      [&] {
+        return ::write(
+          File, Stored.data() + Written, Stored.size() - Written);
+      },
+      "write() scrollback",
+      -1);
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Spilled " << Data.size() << " bytes as "
+                               << Stored.size() << " bytes");
+  Spill = std::move(File);
+  SpilledSize = Data.size();
+  SpilledStored = Stored.size();
+  History.reset();
+  return Released;
+}
+
+std::string Scrollback::contents() const
+{
+  std::string Result;
+  if (History)
+  {
+    Result.reserve(History->size());
+    for (const auto& R : History->peekFrontRanges(History->size()))
+      Result.append(R.Begin, R.Size);
+    return Result;
+  }
+  if (!SpilledStored)
+    return Result;
+
+  Result.resize(SpilledStored);
+  for (std::size_t Read = 0; Read < SpilledStored;)
+  {
+    auto R = CheckedPOSIX(
+      [&] {
+        return ::pread(
+          Spill, Result.data() + Read, SpilledStored - Read, Read);
+      },
+      -1);
+    if (!R || R.get() == 0)
+    {
+      LOG(error) << "Failed to read spilled scrollback: "
+                 << (R ? "unexpected end of file" : R.getError().message());
+      return {};
+    }
+    Read += R.get();
+  }
+
+  if constexpr (Deflater::available())
+  {
+    try
+    {
+      Inflater Decompressor;
+      return std::string{Decompressor.decompress(Result)};
+    }
+    catch (const std::runtime_error& Err)
+    {
+      LOG(error) << "Failed to decompress spilled scrollback: " << Err.what();
+      return {};
+    }
+  }
+  return Result;
+}
+
+void Scrollback::restore()
+{
+  std::string Data = contents();
+  {
+    fd Loaded = std::move(Spill);
+  }
+  SpilledSize = 0;
+  SpilledStored = 0;
+
+  History.emplace(std::min(Limit, std::max(InitialCapacity, Data.size())));
+  History->putBack(Data.data(), Data.size());
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,224 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/SessionLog.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/SessionLog")
+
+namespace monomux
+{
+
+SessionLog::SessionLog(std::string PathPrefix,
+                       std::size_t Limit,
+                       std::size_t SegmentSize)
+  : PathPrefix(std::move(PathPrefix)), Limit(Limit),
+    SegmentSize(std::max(SegmentSize, std::size_t{1}))
+{
+  openSegment();
+}
+
+SessionLog::SessionLog(SessionLog&& RHS) noexcept
+  : PathPrefix(std::move(RHS.PathPrefix)), Limit(RHS.Limit),
+    SegmentSize(RHS.SegmentSize), Segments(std::move(RHS.Segments)),
+    NextSequence(RHS.NextSequence), Retained(RHS.Retained),
+    Truncated(RHS.Truncated), Current(std::move(RHS.Current)),
+    Map(std::move(RHS.Map))
+{
+  RHS.Segments.clear();
+  RHS.Retained = 0;
+}
+
+SessionLog::~SessionLog()
+{
+  closeSegment();
+  for (const Segment& S : Segments)
+    ::unlink(S.Path.c_str());
+}
+
+void SessionLog::openSegment()
+{
+  std::ostringstream Path;
+  Path << PathPrefix << '.' << std::setw(6) << std::setfill('0')
+       << NextSequence++ << ".log";
+  std::string P = Path.str();
+
+  fd Handle = CheckedPOSIXThrow(
+    [&P] {
+      return ::open(
+        P.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    },
+    "open('" + P + "')",
+    -1);
+  void* Mapping = nullptr;
+  try
+  {
+    CheckedPOSIXThrow(
+      [&Handle, this] { return ::ftruncate(Handle, SegmentSize); },
+      "ftruncate('" + P + "')",
+      -1);
+    Mapping = CheckedPOSIXThrow(
+      [&Handle, this] {
+        return ::mmap(nullptr,
+                      SegmentSize,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      Handle,
+                      0);
+      },
+      "mmap('" + P + "')",
+      MAP_FAILED);
+  }
+  catch (...)
+  {
+    ::unlink(P.c_str());
+    throw;
+  }
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Opened segment '" << P << '\'');
+  Current = std::move(Handle);
+  Map = static_cast<char*>(Mapping);
+  Segments.push_back(Segment{std::move(P), 0});
+}
+
+void SessionLog::closeSegment() noexcept
+{
+  if (!Map)
+    return;
+  ::munmap(Map, SegmentSize);
+  Map = nullptr;
+  Current = fd{};
+}
+
+void SessionLog::rotate() noexcept
+{
+  // (The newest segment is never deleted.)
+  while (Segments.size() > 1 && Retained - Segments.front().Size >= Limit)
+  {
+    MONOMUX_TRACE_LOG(LOG(trace)
+                      << "Deleting segment '" << Segments.front().Path << '\'');
+    ::unlink(Segments.front().Path.c_str());
+    Retained -= Segments.front().Size;
+    Segments.pop_front();
+    Truncated = true;
+  }
+}
+
+void SessionLog::append(std::string_view Data)
+{
+  while (!Data.empty())
+  {
+    if (!Map)
+      openSegment();
+
+    Segment& S = Segments.back();
+    const std::size_t N = std::min(Data.size(), SegmentSize - S.Size);
+    std::memcpy(Map + S.Size, Data.data(), N);
+    S.Size += N;
+    Retained += N;
+    Data.remove_prefix(N);
+
+    if (S.Size == SegmentSize)
+    {
+      // Full segments are only read back rarely, so they need not stay
+      // mapped.
+      closeSegment();
+      rotate();
+    }
+  }
+}
+
+std::string SessionLog::tail(std::size_t Bytes) const
+{
+  // If older output exists, read an extra byte to see whether the tail
+  // begins at a line.
+  const std::size_t Want = std::min(Bytes < Retained ? Bytes + 1 : Bytes,
+                                    Retained);
+  const bool HasPreceding = Want > Bytes;
+  std::string Result(Want, '\0');
+
+  // Fill the result from its end, walking the segments from the newest.
+  std::size_t Remaining = Want;
+  for (auto It = Segments.rbegin(); It != Segments.rend() && Remaining; ++It)
+  {
+    const std::size_t N = std::min(Remaining, It->Size);
+    const std::size_t Offset = It->Size - N;
+    char* Into = Result.data() + Remaining - N;
+    Remaining -= N;
+
+    if (It == Segments.rbegin() && Map)
+    {
+      std::memcpy(Into, Map + Offset, N);
+      continue;
+    }
+
+    auto Open = CheckedPOSIX(
+      [&It] { return ::open(It->Path.c_str(), O_RDONLY | O_CLOEXEC); }, -1);
+    if (!Open)
+    {
+      LOG(error) << "Failed to open segment '" << It->Path
+                 << "': " << Open.getError().message();
+      Result.erase(0, Remaining + N);
+      Remaining = 0;
+      break;
+    }
+    fd Handle{Open.get()};
+    std::size_t Read = 0;
+    while (Read < N)
+    {
+      auto R = CheckedPOSIX(
+        [&] { return ::pread(Handle, Into + Read, N - Read, Offset + Read); },
+        -1);
+      if (!R || R.get() == 0)
+        break;
+      Read += R.get();
+    }
+    if (Read < N)
+    {
+      LOG(error) << "Failed to read segment '" << It->Path << '\'';
+      Result.erase(0, Remaining + N);
+      Remaining = 0;
+      break;
+    }
+  }
+
+  if (HasPreceding && !Result.empty() && Result.front() == '\n')
+    Result.erase(0, 1);
+  else if (Truncated || HasPreceding)
+  {
+    std::size_t LineBreak = Result.find('\n');
+    Result.erase(0, LineBreak == std::string::npos ? Result.size()
+                                                   : LineBreak + 1);
+  }
+  return Result;
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,378 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/MaskedRingBuffer.hpp"
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/SharedRing.hpp"
+
+namespace monomux
+{
+
+namespace
+{
+
+/// Identifies the memory of a \p SharedRing.
+constexpr std::uint64_t RingMagic = 0x474E'4952'5858'4E4D; // "MNXXRING"
+
+enum SlotState : std::uint32_t
+{
+  Free = 0,
+  Reserved,
+  Active
+};
+
+/// The state of a reader of the ring, on its own cache line, so the readers
+/// do not disturb each other.
+struct alignas(64) ReaderSlot
+{
+  std::atomic<std::uint64_t> Cursor;
+  std::atomic<std::uint32_t> State;
+  std::atomic<std::uint32_t> ReaderWaiting;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                std::atomic<std::uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must not be implemented with locks!");
+
+std::size_t pageSize() noexcept
+{
+  static const auto PageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  return PageSize;
+}
+
+} // namespace
+
+struct SharedRing::Header
+{
+  std::uint64_t Magic;
+  std::uint64_t Capacity;
+  /// The number of bytes published, and, ahead of it while the writer is
+  /// copying, the number of bytes that will be. Data older than \p Reserved
+  /// minus the capacity may be overwritten at any time.
+  alignas(64) std::atomic<std::uint64_t> Head;
+  std::atomic<std::uint64_t> Reserved;
+  ReaderSlot Readers[SharedRing::MaxReaders];
+};
+
+std::size_t SharedRing::headerSize() noexcept
+{
+  const std::size_t Page = pageSize();
+  return (sizeof(SharedRing::Header) + Page - 1) / Page * Page;
+}
+
+/// Maps \p Size bytes of \p Memory at \p Offset.
+static void*
+mapShared(const fd& Memory, std::size_t Size, std::size_t Offset, int Protect)
+{
+  return CheckedPOSIXThrow(
+    [&Memory, Size, Offset, Protect] {
+      return ::mmap(nullptr,
+                    Size,
+                    Protect,
+                    MAP_SHARED,
+                    Memory,
+                    static_cast<::off_t>(Offset));
+    },
+    "mmap(SharedRing)",
+    MAP_FAILED);
+}
+
+SharedRing SharedRing::create(std::size_t Capacity)
+{
+  Capacity = detail::roundUpToPowerOfTwo(std::max(Capacity, pageSize()));
+  fd Memory = CheckedPOSIXThrow(
+    [] { return ::memfd_create("monomux-shared-ring", MFD_CLOEXEC); },
+    "memfd_create()",
+    -1);
+  CheckedPOSIXThrow(
+    [&Memory, Capacity] {
+      return ::ftruncate(Memory, static_cast<::off_t>(headerSize() + Capacity));
+    },
+    "ftruncate(memfd)",
+    -1);
+
+  // (The memory of a new file is zero, which is the initial state of the
+  // atomics, too.)
+  auto* Control = static_cast<Header*>(
+    mapShared(Memory, headerSize(), 0, PROT_READ | PROT_WRITE));
+  char* Data;
+  try
+  {
+    Data = static_cast<char*>(
+      mapShared(Memory, Capacity, headerSize(), PROT_READ | PROT_WRITE));
+  }
+  catch (...)
+  {
+    ::munmap(Control, headerSize());
+    throw;
+  }
+  Control->Magic = RingMagic;
+  Control->Capacity = Capacity;
+  return SharedRing{std::move(Memory), Capacity, Control, Data};
+}
+
+SharedRing SharedRing::open(fd Memory)
+{
+  POD<struct ::stat> Stat;
+  CheckedPOSIXThrow([&Memory, &Stat] { return ::fstat(Memory, &Stat); },
+                    "fstat(SharedRing)",
+                    -1);
+  const auto Size = static_cast<std::size_t>(Stat->st_size);
+  if (Size <= headerSize())
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "SharedRing too small"};
+
+  auto* Control = static_cast<Header*>(
+    mapShared(Memory, headerSize(), 0, PROT_READ | PROT_WRITE));
+  const std::size_t Capacity = Control->Capacity;
+  if (Control->Magic != RingMagic || Capacity != Size - headerSize() ||
+      Capacity != detail::roundUpToPowerOfTwo(Capacity))
+  {
+    ::munmap(Control, headerSize());
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "Not a SharedRing"};
+  }
+
+  char* Data;
+  try
+  {
+    Data =
+      static_cast<char*>(mapShared(Memory, Capacity, headerSize(), PROT_READ));
+  }
+  catch (...)
+  {
+    ::munmap(Control, headerSize());
+    throw;
+  }
+  return SharedRing{std::move(Memory), Capacity, Control, Data};
+}
+
+SharedRing::SharedRing(fd Memory,
+                       std::size_t Capacity,
+                       Header* Control,
+                       char* Data)
+  : Memory(std::move(Memory)), Capacity(Capacity), Control(Control), Data(Data)
+{}
+
+SharedRing::SharedRing(SharedRing&& RHS) noexcept
+  : Memory(std::move(RHS.Memory)), Capacity(RHS.Capacity),
+    Control(RHS.Control), Data(RHS.Data)
+{
+  RHS.Capacity = 0;
+  RHS.Control = nullptr;
+  RHS.Data = nullptr;
+}
+
+SharedRing& SharedRing::operator=(SharedRing&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  SharedRing Old{std::move(*this)};
+  Memory = std::move(RHS.Memory);
+  std::swap(Capacity, RHS.Capacity);
+  std::swap(Control, RHS.Control);
+  std::swap(Data, RHS.Data);
+  return *this;
+}
+
+SharedRing::~SharedRing()
+{
+  if (Data)
+    ::munmap(Data, Capacity);
+  if (Control)
+    ::munmap(Control, headerSize());
+}
+
+std::uint64_t SharedRing::head() const noexcept
+{
+  return Control->Head.load(std::memory_order_acquire);
+}
+
+void SharedRing::publish(std::string_view Bytes) noexcept
+{
+  if (Bytes.empty())
+    return;
+
+  const std::uint64_t Head = Control->Head.load(std::memory_order_relaxed);
+  const std::uint64_t NewHead = Head + Bytes.size();
+  // Readers that copy the data being overwritten will see that they did.
+  Control->Reserved.store(NewHead, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  std::uint64_t Position = Head;
+  if (Bytes.size() > Capacity)
+  {
+    Position += Bytes.size() - Capacity;
+    Bytes.remove_prefix(Bytes.size() - Capacity);
+  }
+  const std::size_t Offset = Position & (Capacity - 1);
+  const std::size_t First = std::min(Bytes.size(), Capacity - Offset);
+  std::memcpy(Data + Offset, Bytes.data(), First);
+  std::memcpy(Data, Bytes.data() + First, Bytes.size() - First);
+
+  // (Sequentially consistent, so the waiting readers are seen afterwards.)
+  Control->Head.store(NewHead, std::memory_order_seq_cst);
+}
+
+std::optional<std::size_t> SharedRing::acquire() noexcept
+{
+  for (std::size_t I = 0; I < MaxReaders; ++I)
+  {
+    ReaderSlot& S = Control->Readers[I];
+    if (S.State.load(std::memory_order_relaxed) != Free)
+      continue;
+    S.ReaderWaiting.store(0, std::memory_order_relaxed);
+    S.State.store(Reserved, std::memory_order_release);
+    return I;
+  }
+  return std::nullopt;
+}
+
+void SharedRing::activate(std::size_t Slot) noexcept
+{
+  assert(Slot < MaxReaders);
+  ReaderSlot& S = Control->Readers[Slot];
+  S.Cursor.store(Control->Head.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+  S.State.store(Active, std::memory_order_release);
+}
+
+void SharedRing::release(std::size_t Slot) noexcept
+{
+  assert(Slot < MaxReaders);
+  Control->Readers[Slot].State.store(Free, std::memory_order_release);
+}
+
+std::uint64_t SharedRing::lag(std::size_t Slot) const noexcept
+{
+  assert(Slot < MaxReaders);
+  const ReaderSlot& S = Control->Readers[Slot];
+  if (S.State.load(std::memory_order_relaxed) != Active)
+    return 0;
+  return Control->Head.load(std::memory_order_relaxed) -
+         S.Cursor.load(std::memory_order_seq_cst);
+}
+
+bool SharedRing::takeReaderWaiting(std::size_t Slot) noexcept
+{
+  assert(Slot < MaxReaders);
+  std::atomic<std::uint32_t>& Flag = Control->Readers[Slot].ReaderWaiting;
+  // (Reading first keeps the cache line shared while the reader is busy.)
+  return Flag.load(std::memory_order_seq_cst) &&
+         Flag.exchange(0, std::memory_order_seq_cst);
+}
+
+bool SharedRing::active(std::size_t Slot) const noexcept
+{
+  assert(Slot < MaxReaders);
+  return Control->Readers[Slot].State.load(std::memory_order_acquire) ==
+         Active;
+}
+
+SharedRing::ReadResult
+SharedRing::read(std::size_t Slot, std::string& Out, std::size_t Bytes)
+{
+  assert(Slot < MaxReaders);
+  ReadResult R;
+  if (!active(Slot))
+    return R;
+
+  ReaderSlot& S = Control->Readers[Slot];
+  std::uint64_t Cursor = S.Cursor.load(std::memory_order_relaxed);
+  const std::uint64_t Head = Control->Head.load(std::memory_order_acquire);
+  if (Head - Cursor > Capacity)
+  {
+    R.Lost = Head - Capacity - Cursor;
+    Cursor = Head - Capacity;
+  }
+
+  std::size_t N = std::min<std::uint64_t>(Head - Cursor, Bytes);
+  const std::size_t Begin = Out.size();
+  const std::size_t Offset = Cursor & (Capacity - 1);
+  const std::size_t First = std::min(N, Capacity - Offset);
+  Out.append(Data + Offset, First);
+  Out.append(Data, N - First);
+
+  // If the writer started overwriting what was copied, that part is lost.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t Reserved =
+    Control->Reserved.load(std::memory_order_relaxed);
+  if (Reserved - Cursor > Capacity)
+  {
+    const std::size_t Torn =
+      std::min<std::uint64_t>(Reserved - Capacity - Cursor, N);
+    Out.erase(Begin, Torn);
+    R.Lost += Torn;
+    Cursor += Torn;
+    N -= Torn;
+  }
+
+  S.Cursor.store(Cursor + N, std::memory_order_seq_cst);
+  R.Read = N;
+  return R;
+}
+
+bool SharedRing::wait(std::size_t Slot) noexcept
+{
+  assert(Slot < MaxReaders);
+  ReaderSlot& S = Control->Readers[Slot];
+  S.ReaderWaiting.store(1, std::memory_order_seq_cst);
+  if (S.State.load(std::memory_order_acquire) == Active &&
+      Control->Head.load(std::memory_order_seq_cst) !=
+        S.Cursor.load(std::memory_order_relaxed))
+  {
+    S.ReaderWaiting.store(0, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+fd SharedRing::makeWakeup()
+{
+  return CheckedPOSIXThrow(
+    [] { return ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); },
+    "eventfd(SharedRing)",
+    -1);
+}
+
+void SharedRing::wake(raw_fd Wakeup) noexcept
+{
+  // (If the counter is about to overflow, the reader is awake already.)
+  ::eventfd_write(Wakeup, 1);
+}
+
+void SharedRing::clearWakeup(raw_fd Wakeup) noexcept
+{
+  ::eventfd_t Count;
+  ::eventfd_read(Wakeup, &Count);
+}
+
+} // namespace monomux
@@ -20,6 +20,9 @@
 #include <system_error>
 #include <type_traits>
 
+#include <sys/signalfd.h>
+#include <unistd.h>
+
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/unreachable.hpp"
@@ -165,6 +168,8 @@ SignalHandling::SignalHandling()
   Objects.fill(std::any{});
   RegisteredSignals.fill(false);
   MaskedSignals.fill(false);
+  FileSignals.fill(false);
+  ::sigemptyset(&SignalFileSet);
 }
 
 static void handleSignal(SignalHandling::Signal S,
@@ -210,6 +215,7 @@ static void ignoreSignal(SignalHandling::Signal S)
 
 void SignalHandling::enable()
 {
+  bool FileChanged = false;
   for (std::size_t S = 0; S < SignalCount; ++S)
   {
     if (!Callbacks.at(S).at(0))
@@ -222,9 +228,18 @@ void SignalHandling::enable()
       // Ignored signals will not be overwritten.
       continue;
 
-    handleSignal(S, &handler);
+    if (FileSignals.at(S))
+    {
+      ::sigaddset(&SignalFileSet, S);
+      FileChanged = true;
+    }
+    else
+      handleSignal(S, &handler);
     RegisteredSignals.at(S) = true;
   }
+
+  if (FileChanged)
+    updateSignalFile();
 }
 
 void SignalHandling::disable()
@@ -238,11 +253,80 @@ void SignalHandling::disable()
       // Ignored signals will not be overwritten.
       continue;
 
+    releaseFromFile(S);
     defaultSignal(S);
     RegisteredSignals.at(S) = false;
   }
 }
 
+void SignalHandling::deliverThroughFile(Signal SigNum)
+{
+  if (static_cast<std::size_t>(SigNum) > SignalCount)
+    throw std::out_of_range{"Invalid signal " + std::to_string(SigNum)};
+  FileSignals.at(SigNum) = true;
+}
+
+void SignalHandling::updateSignalFile()
+{
+  if (::sigisemptyset(&SignalFileSet))
+  {
+    if (SignalFile.has())
+      fd::close(SignalFile.release());
+    return;
+  }
+
+  // The signals must be blocked, otherwise they would be delivered the usual
+  // way, instead of being queued for the file.
+  ::pthread_sigmask(SIG_BLOCK, &SignalFileSet, nullptr);
+  raw_fd Existing = SignalFile.get();
+  raw_fd FD = CheckedPOSIXThrow(
+    [this, Existing] {
+      return ::signalfd(Existing, &SignalFileSet, SFD_NONBLOCK | SFD_CLOEXEC);
+    },
+    "signalfd()",
+    -1);
+  if (FD != Existing)
+    SignalFile = fd{FD};
+}
+
+void SignalHandling::releaseFromFile(Signal SigNum)
+{
+  if (!::sigismember(&SignalFileSet, SigNum))
+    return;
+
+  ::sigdelset(&SignalFileSet, SigNum);
+  updateSignalFile();
+
+  POD<::sigset_t> Released;
+  ::sigemptyset(&Released);
+  ::sigaddset(&Released, SigNum);
+  ::pthread_sigmask(SIG_UNBLOCK, &Released, nullptr);
+}
+
+std::size_t SignalHandling::dispatchFile()
+{
+  if (!SignalFile.has())
+    return 0;
+
+  std::size_t Count = 0;
+  POD<struct ::signalfd_siginfo> FileInfo;
+  while (::read(SignalFile, &FileInfo, sizeof(FileInfo)) == sizeof(FileInfo))
+  {
+    // The callbacks expect the same information as from a real handler.
+    POD<::siginfo_t> Info;
+    Info->si_signo = static_cast<int>(FileInfo->ssi_signo);
+    Info->si_errno = FileInfo->ssi_errno;
+    Info->si_code = FileInfo->ssi_code;
+    Info->si_pid = static_cast<::pid_t>(FileInfo->ssi_pid);
+    Info->si_uid = static_cast<::uid_t>(FileInfo->ssi_uid);
+    Info->si_status = FileInfo->ssi_status;
+
+    handler(Info->si_signo, &Info, nullptr);
+    ++Count;
+  }
+  return Count;
+}
+
 bool SignalHandling::enabled(Signal SigNum) const noexcept
 {
   return RegisteredSignals.at(SigNum) || MaskedSignals.at(SigNum);
@@ -278,9 +362,10 @@ void SignalHandling::unignore(Signal SigNum)
     // Not ignored signals will not be touched.
     return;
 
-  if (RegisteredSignals.at(SigNum))
+  if (RegisteredSignals.at(SigNum) && !FileSignals.at(SigNum))
     handleSignal(SigNum, &handler);
   else
+    // A blocked signal is only queued for the file if it is not ignored.
     defaultSignal(SigNum);
 
   MaskedSignals.at(SigNum) = false;
@@ -366,6 +451,7 @@ void SignalHandling::defaultCallback(Signal SigNum)
     RegisteredSignals.at(SigNum) = false;
     MaskedSignals.at(SigNum) = false;
 
+    releaseFromFile(SigNum);
     defaultSignal(SigNum);
   }
 }
@@ -17,12 +17,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <linux/vm_sockets.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Event.hpp"
 
 #include "monomux/system/Socket.hpp"
 
@@ -33,63 +42,228 @@
 namespace monomux
 {
 
+/// The sizes learnt from the buffers of the sockets already closed.
+static BufferedChannel::SizeHint SocketReadHint{BUFSIZ};
+static BufferedChannel::SizeHint SocketWriteHint{BUFSIZ};
+
+template class BasicBufferedChannel<Socket>;
+
 Socket::Socket(fd Handle, std::string Identifier, bool NeedsCleanup)
-  : BufferedChannel(
-      std::move(Handle), std::move(Identifier), NeedsCleanup, BUFSIZ, BUFSIZ)
+  : BasicBufferedChannel(std::move(Handle),
+                         std::move(Identifier),
+                         NeedsCleanup,
+                         &SocketReadHint,
+                         &SocketWriteHint)
 {}
 
-std::size_t Socket::optimalReadSize() const noexcept { return BUFSIZ; }
-std::size_t Socket::optimalWriteSize() const noexcept { return BUFSIZ; }
+Socket::Transport Socket::transportOf(std::string_view Address) noexcept
+{
+  if (Address.substr(0, 4) == "tcp:")
+    return Transport::TCP;
+  if (Address.substr(0, 6) == "vsock:")
+    return Transport::VSock;
+  return Transport::Unix;
+}
+
+namespace
+{
+
+/// A resolved address a socket can be bound or connected to.
+struct Endpoint
+{
+  Socket::Transport Kind;
+  int Family;
+  POD<struct ::sockaddr_storage> Addr;
+  ::socklen_t Length;
+};
+
+} // namespace
+
+/// Splits \p Address, without the transport prefix, at the last \p ':' into
+/// the host and the port parts. Brackets around an IPv6 host are removed.
+static std::pair<std::string, std::string>
+splitHostPort(std::string_view Address)
+{
+  std::size_t Colon = Address.rfind(':');
+  if (Colon == std::string_view::npos)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "Missing port in address '" +
+                              std::string{Address} + '\''};
+
+  std::string_view Host = Address.substr(0, Colon);
+  if (Host.size() >= 2 && Host.front() == '[' && Host.back() == ']')
+    Host = Host.substr(1, Host.size() - 2);
+  if (Host == "*")
+    Host = {};
+  return {std::string{Host}, std::string{Address.substr(Colon + 1)}};
+}
+
+/// Resolves the address of the socket at \p Path, which is either a file
+/// system path or a \p tcp: or \p vsock: address. A \p Passive address is
+/// meant to be bound, and an empty host in it means any host.
+static Endpoint resolve(const std::string& Path, bool Passive)
+{
+  Endpoint E;
+  E.Kind = Socket::transportOf(Path);
+  switch (E.Kind)
+  {
+    case Socket::Transport::Unix:
+    {
+      auto* SocketAddr = reinterpret_cast<struct ::sockaddr_un*>(&E.Addr);
+      SocketAddr->sun_family = AF_UNIX;
+      std::strncpy(
+        SocketAddr->sun_path, Path.c_str(), sizeof(SocketAddr->sun_path) - 1);
+      E.Family = AF_UNIX;
+      E.Length = sizeof(struct ::sockaddr_un);
+      break;
+    }
+    case Socket::Transport::TCP:
+    {
+      auto [Host, Port] = splitHostPort(std::string_view{Path}.substr(4));
+      POD<struct ::addrinfo> Hints;
+      Hints->ai_family = AF_UNSPEC;
+      Hints->ai_socktype = SOCK_STREAM;
+      Hints->ai_flags = AI_NUMERICSERV | (Passive ? AI_PASSIVE : 0);
+      struct ::addrinfo* Result = nullptr;
+      int Error = ::getaddrinfo(
+        Host.empty() ? nullptr : Host.c_str(), Port.c_str(), &Hints, &Result);
+      if (Error != 0)
+        throw std::system_error{
+          std::make_error_code(std::errc::invalid_argument),
+          "getaddrinfo('" + Path + "'): " + ::gai_strerror(Error)};
+      std::memcpy(&E.Addr, Result->ai_addr, Result->ai_addrlen);
+      E.Family = Result->ai_family;
+      E.Length = Result->ai_addrlen;
+      ::freeaddrinfo(Result);
+      break;
+    }
+    case Socket::Transport::VSock:
+    {
+      auto [CID, Port] = splitHostPort(std::string_view{Path}.substr(6));
+      auto* SocketAddr = reinterpret_cast<struct ::sockaddr_vm*>(&E.Addr);
+      SocketAddr->svm_family = AF_VSOCK;
+      char* End = nullptr;
+      SocketAddr->svm_cid = CID.empty()
+                              ? VMADDR_CID_ANY
+                              : static_cast<unsigned>(
+                                  std::strtoul(CID.c_str(), &End, 10));
+      if (End && *End)
+        throw std::system_error{
+          std::make_error_code(std::errc::invalid_argument),
+          "Invalid context ID in address '" + Path + '\''};
+      SocketAddr->svm_port =
+        static_cast<unsigned>(std::strtoul(Port.c_str(), &End, 10));
+      if (Port.empty() || *End)
+        throw std::system_error{
+          std::make_error_code(std::errc::invalid_argument),
+          "Invalid port in address '" + Path + '\''};
+      E.Family = AF_VSOCK;
+      E.Length = sizeof(struct ::sockaddr_vm);
+      break;
+    }
+  }
+  return E;
+}
+
+/// \returns the address that accepted the connection from \p Addr as a string
+/// that \p Socket::connect() understands.
+static std::string formatAddress(const struct ::sockaddr_storage& Addr)
+{
+  switch (Addr.ss_family)
+  {
+    case AF_INET:
+    case AF_INET6:
+    {
+      char Host[INET6_ADDRSTRLEN] = {0};
+      const void* Raw;
+      unsigned short Port;
+      if (Addr.ss_family == AF_INET)
+      {
+        const auto& In = reinterpret_cast<const struct ::sockaddr_in&>(Addr);
+        Raw = &In.sin_addr;
+        Port = ntohs(In.sin_port);
+      }
+      else
+      {
+        const auto& In = reinterpret_cast<const struct ::sockaddr_in6&>(Addr);
+        Raw = &In.sin6_addr;
+        Port = ntohs(In.sin6_port);
+      }
+      ::inet_ntop(Addr.ss_family, Raw, Host, sizeof(Host));
+      if (Addr.ss_family == AF_INET6)
+        return "tcp:[" + std::string{Host} + "]:" + std::to_string(Port);
+      return "tcp:" + std::string{Host} + ':' + std::to_string(Port);
+    }
+    case AF_VSOCK:
+    {
+      const auto& VM = reinterpret_cast<const struct ::sockaddr_vm&>(Addr);
+      return "vsock:" + std::to_string(VM.svm_cid) + ':' +
+             std::to_string(VM.svm_port);
+    }
+    case AF_UNIX:
+    default:
+      return reinterpret_cast<const struct ::sockaddr_un&>(Addr).sun_path;
+  }
+}
 
 Socket Socket::create(std::string Path, bool InheritInChild)
 {
+  Endpoint E = resolve(Path, /* Passive =*/true);
   fd::flag_t ExtraFlags = InheritInChild ? 0 : SOCK_CLOEXEC;
   fd Handle = CheckedPOSIXThrow(
-    [ExtraFlags] { return ::socket(AF_UNIX, SOCK_STREAM | ExtraFlags, 0); },
+    [&E, ExtraFlags] {
+      return ::socket(E.Family, SOCK_STREAM | ExtraFlags, 0);
+    },
     "socket()",
     -1);
 
   // TODO: Mask?
 
-  POD<struct ::sockaddr_un> SocketAddr;
-  SocketAddr->sun_family = AF_UNIX;
-  std::strncpy(
-    SocketAddr->sun_path, Path.c_str(), sizeof(SocketAddr->sun_path) - 1);
+  if (E.Kind == Transport::TCP)
+  {
+    // A restarted server must be able to take the port over immediately.
+    int On = 1;
+    CheckedPOSIXThrow(
+      [&Handle, &On] {
+        return ::setsockopt(Handle, SOL_SOCKET, SO_REUSEADDR, &On, sizeof(On));
+      },
+      "setsockopt(SO_REUSEADDR)",
+      -1);
+  }
 
   CheckedPOSIXThrow(
-    [&Handle, &SocketAddr] {
-      return ::bind(Handle,
-                    reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
-                    sizeof(SocketAddr));
+    [&Handle, &E] {
+      return ::bind(
+        Handle, reinterpret_cast<struct ::sockaddr*>(&E.Addr), E.Length);
     },
     "bind('" + Path + "')",
     -1);
 
   LOG(debug) << "Created at '" << Path << '\'';
 
-  Socket S{std::move(Handle), std::move(Path), true};
+  // Only the sockets in the file system leave something behind to remove.
+  const bool NeedsCleanup = E.Kind == Transport::Unix;
+  Socket S{std::move(Handle), std::move(Path), NeedsCleanup};
   S.Owning = true;
+  S.Kind = E.Kind;
   return S;
 }
 
 Socket Socket::connect(std::string Path, bool InheritInChild)
 {
+  Endpoint E = resolve(Path, /* Passive =*/false);
   fd::flag_t ExtraFlags = InheritInChild ? 0 : SOCK_CLOEXEC;
   fd Handle = CheckedPOSIXThrow(
-    [ExtraFlags] { return ::socket(AF_UNIX, SOCK_STREAM | ExtraFlags, 0); },
+    [&E, ExtraFlags] {
+      return ::socket(E.Family, SOCK_STREAM | ExtraFlags, 0);
+    },
     "socket()",
     -1);
 
-  POD<struct ::sockaddr_un> SocketAddr;
-  SocketAddr->sun_family = AF_UNIX;
-  std::strncpy(
-    SocketAddr->sun_path, Path.c_str(), sizeof(SocketAddr->sun_path) - 1);
-
   CheckedPOSIXThrow(
-    [&Handle, &SocketAddr] {
-      return ::connect(Handle,
-                       reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
-                       sizeof(SocketAddr));
+    [&Handle, &E] {
+      return ::connect(
+        Handle, reinterpret_cast<struct ::sockaddr*>(&E.Addr), E.Length);
     },
     "connect('" + Path + "')",
     -1);
@@ -98,10 +272,13 @@ Socket Socket::connect(std::string Path, bool InheritInChild)
 
   Socket S{std::move(Handle), std::move(Path), false};
   S.Owning = false;
+  S.Kind = E.Kind;
+  // The messages of the protocol are small, and each is waited for.
+  S.setNoDelay(true);
   return S;
 }
 
-Socket Socket::wrap(fd&& FD, std::string Identifier)
+Socket Socket::wrap(fd&& FD, std::string Identifier, Transport Kind)
 {
   if (Identifier.empty())
   {
@@ -114,11 +291,32 @@ Socket Socket::wrap(fd&& FD, std::string Identifier)
 
   Socket S{std::move(FD), std::move(Identifier), false};
   S.Owning = false;
+  S.Kind = Kind;
+  return S;
+}
+
+Socket Socket::adopt(fd&& FD, std::string Path)
+{
+  LOG(debug) << "Taking over '" << Path << "' (FD " << FD.get() << ')';
+  fd::addDescriptorFlag(FD, FD_CLOEXEC);
+
+  const Transport Kind = transportOf(Path);
+  Socket S{std::move(FD), std::move(Path), Kind == Transport::Unix};
+  // (Calling listen() again is allowed, and only updates the backlog.)
+  S.Owning = true;
+  S.Kind = Kind;
   return S;
 }
 
 Socket::~Socket() noexcept
 {
+  if (Queued)
+  {
+    Queued->Queue.store(nullptr);
+    // The write in flight would keep the connection open until it completes.
+    if (EPoll* InFlight = Queued->InFlight.load())
+      InFlight->cancelQueuedWrite(*Queued);
+  }
   if (needsCleanup())
   {
     auto RemoveResult =
@@ -151,16 +349,17 @@ void Socket::listen(std::size_t QueueSize)
 
 std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
 {
-  POD<struct ::sockaddr_un> SocketAddr;
-  POD<::socklen_t> SocketAddrLen;
+  POD<struct ::sockaddr_storage> SocketAddr;
+  ::socklen_t SocketAddrLen = sizeof(SocketAddr);
 
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "Accepting client...");
 
   auto MaybeClient = CheckedPOSIX(
     [this, &SocketAddr, &SocketAddrLen] {
-      return ::accept(raw(),
-                      reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
-                      &SocketAddrLen);
+      return ::accept4(raw(),
+                       reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
+                       &SocketAddrLen,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
     },
     -1);
   if (!MaybeClient)
@@ -180,8 +379,14 @@ std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
     }
     else if (EC == std::errc::resource_unavailable_try_again /* EAGAIN */ ||
              EC == std::errc::interrupted /* EINTR */ ||
-             EC == std::errc::connection_aborted /* ECONNABORTED */ ||
-             static_cast<int>(EC) != 0)
+             EC == std::errc::connection_aborted /* ECONNABORTED */)
+    {
+      // No (more) clients are waiting, or the client that was went away.
+      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                        << "No client accepted: " << MaybeClient.getError());
+      ConsiderRecoverable = false;
+    }
+    else if (static_cast<int>(EC) != 0)
     {
       LOG_WITH_IDENTIFIER(error)
         << "Failed to accept client: " << MaybeClient.getError() << ' '
@@ -195,25 +400,262 @@ std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
   }
 
   // Successfully accepted a client.
-  std::string ClientPath = SocketAddr->sun_path;
+  std::string ClientPath = formatAddress(SocketAddr);
   LOG_WITH_IDENTIFIER(trace) << "Client \"" << ClientPath << "\" connected";
-  return Socket::wrap(MaybeClient.get(), std::move(ClientPath));
+  Socket S = Socket::wrap(MaybeClient.get(), std::move(ClientPath));
+  S.Kind = Kind;
+  S.setNoDelay(true);
+  return S;
 }
 
-std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
+std::pair<Socket, Socket> Socket::pair(std::string Identifier)
+{
+  int FDs[2];
+  CheckedPOSIXThrow(
+    [&FDs] {
+      return ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, FDs);
+    },
+    "socketpair()",
+    -1);
+  fd First{FDs[0]};
+  fd Second{FDs[1]};
+  return {Socket::wrap(std::move(First), Identifier + "#0"),
+          Socket::wrap(std::move(Second), Identifier + "#1")};
+}
+
+/// The size of the ancillary buffer that fits \p Socket::MaxReceivedFiles
+/// file descriptors.
+static constexpr std::size_t FileControlSize =
+  CMSG_SPACE(sizeof(int) * Socket::MaxReceivedFiles);
+
+void Socket::collectFiles(const struct ::msghdr& Msg)
+{
+  for (const struct ::cmsghdr* C = CMSG_FIRSTHDR(&Msg); C;
+       C = CMSG_NXTHDR(const_cast<struct ::msghdr*>(&Msg),
+                       const_cast<struct ::cmsghdr*>(C)))
+  {
+    if (C->cmsg_level != SOL_SOCKET || C->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    const std::size_t Count = (C->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      int Raw;
+      std::memcpy(&Raw, CMSG_DATA(C) + I * sizeof(int), sizeof(int));
+      fd File{Raw};
+      if (ReceivedFiles.size() >= MaxReceivedFiles)
+      {
+        LOG_WITH_IDENTIFIER(warn) << "Too many files received, closing " << Raw;
+        continue;
+      }
+      ReceivedFiles.emplace_back(std::move(File));
+    }
+  }
+  if (Msg.msg_flags & MSG_CTRUNC)
+    LOG_WITH_IDENTIFIER(warn) << "Files received were truncated";
+}
+
+fd Socket::takeReceivedFile()
+{
+  if (ReceivedFiles.empty())
+    return fd{};
+  fd File = std::move(ReceivedFiles.front());
+  ReceivedFiles.erase(ReceivedFiles.begin());
+  return File;
+}
+
+/// Sets the \p Option of the TCP connection \p FD to \p Value.
+static void setTCPOption(raw_fd FD, int Option, bool Value, const char* Name)
+{
+  int On = Value ? 1 : 0;
+  auto Result = CheckedPOSIX(
+    [FD, Option, &On] {
+      return ::setsockopt(FD, IPPROTO_TCP, Option, &On, sizeof(On));
+    },
+    -1);
+  if (!Result)
+    LOG(warn) << "setsockopt(" << Name << ") failed: " << Result.getError()
+              << ' ' << Result.getError().message();
+}
+
+void Socket::setNoDelay(bool NoDelay)
+{
+  if (Kind != Transport::TCP)
+    return;
+  setTCPOption(raw(), TCP_NODELAY, NoDelay, "TCP_NODELAY");
+}
+
+void Socket::cork()
+{
+  if (Kind != Transport::TCP || Corked)
+    return;
+  setTCPOption(raw(), TCP_CORK, true, "TCP_CORK");
+  Corked = true;
+}
+
+void Socket::uncork()
+{
+  if (!Corked)
+    return;
+  setTCPOption(raw(), TCP_CORK, false, "TCP_CORK");
+  Corked = false;
+}
+
+std::size_t Socket::writeWithFile(std::string_view Data, raw_fd File)
+{
+  return writeWithFiles(Data, {File});
+}
+
+std::size_t Socket::writeWithFiles(std::string_view Data,
+                                   const std::vector<raw_fd>& Files)
 {
-  static constexpr std::size_t BufferSize = BUFSIZ;
+  assert(!Data.empty() && "A file can only be passed with some data!");
+  assert(!Files.empty() && Files.size() <= MaxReceivedFiles &&
+         "Too many files passed!");
+  flushWrites();
+  if (hasBufferedWrite())
+    throw std::system_error{
+      std::make_error_code(std::errc::resource_unavailable_try_again),
+      "writeWithFiles() while the write buffer is not empty"};
+
+  union
+  {
+    char Buffer[FileControlSize];
+    struct ::cmsghdr Align;
+  } Control;
+  std::memset(&Control, 0, sizeof(Control));
+
+  ::iovec Vector{const_cast<char*>(Data.data()), Data.size()};
+  POD<struct ::msghdr> Msg;
+  Msg->msg_iov = &Vector;
+  Msg->msg_iovlen = 1;
+  Msg->msg_control = Control.Buffer;
+  Msg->msg_controllen = CMSG_SPACE(sizeof(int) * Files.size());
+
+  struct ::cmsghdr* C = CMSG_FIRSTHDR(&Msg);
+  C->cmsg_level = SOL_SOCKET;
+  C->cmsg_type = SCM_RIGHTS;
+  C->cmsg_len = CMSG_LEN(sizeof(int) * Files.size());
+  for (std::size_t I = 0; I < Files.size(); ++I)
+    std::memcpy(CMSG_DATA(C) + I * sizeof(int), &Files[I], sizeof(int));
+
+  auto SentBytes = CheckedPOSIXThrow(
+    [FD = Handle.get(), &Msg] { return ::sendmsg(FD, &Msg, MSG_NOSIGNAL); },
+    "sendmsg(SCM_RIGHTS)",
+    -1);
+  Data.remove_prefix(static_cast<std::size_t>(SentBytes));
+  if (!Data.empty())
+    write(Data);
+  return static_cast<std::size_t>(SentBytes);
+}
+
+void Socket::writeThrough(EPoll* Queue)
+{
+  if (Overridden || (Queue && !Queue->queuesIO()))
+    Queue = nullptr;
+  if (!Queued)
+  {
+    if (!Queue)
+      return;
+    Queued = std::make_shared<EPoll::QueuedWrites>(Handle.get());
+  }
+  Queued->Queue.store(Queue);
+}
 
+std::optional<std::size_t>
+Socket::writeQueued(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  EPoll* Queue = Queued->Queue.load();
+  if (!Queue)
+    return std::nullopt;
+  try
+  {
+    return Queue->writeQueued(Queued, Vectors, Count, Continue);
+  }
+  catch (const std::system_error&)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Write error";
+    setFailed();
+    Continue = false;
+    throw;
+  }
+}
+
+std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
+{
+  // Read directly into the result, without a bounce buffer that would limit
+  // the size of a read.
   std::string Return;
-  Return.reserve(Bytes);
+  Return.resize(Bytes);
+  ::iovec Vector{Return.data(), Bytes};
+  Return.resize(readvImpl(&Vector, 1, Continue));
+  return Return;
+}
 
-  POD<char[BufferSize]> RawBuffer;
-  if (Bytes > BufferSize)
-    Bytes = BufferSize;
+std::size_t Socket::writeImpl(std::string_view Buffer, bool& Continue)
+{
+  auto SentBytes = CheckedPOSIX(
+    [FD = Handle.get(), Buffer = Buffer.data(), Size = Buffer.size()] {
+      return ::send(FD, Buffer, Size, 0);
+    },
+    -1);
+  if (!SentBytes)
+  {
+    std::errc EC = static_cast<std::errc>(SentBytes.getError().value());
+    if (EC == std::errc::interrupted /* EINTR */)
+    {
+      // Not an error, may continue.
+      Continue = true;
+      return 0;
+    }
+    if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+        EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+    {
+      // This is a soft error. Writing must not continue yet, but the higher
+      // level API should be allowed to buffer.
+      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                        << SentBytes.getError().message());
+      Continue = false;
+      return 0;
+    }
+
+    LOG_WITH_IDENTIFIER(error) << "Write error";
+    setFailed();
+    Continue = false;
+    throw std::system_error{std::make_error_code(EC)};
+  }
+
+  Continue = true;
+  if (SentBytes.get() == 0)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Disconnected";
+    setFailed();
+    Continue = false;
+  }
+
+  return SentBytes.get();
+}
+
+std::size_t
+Socket::readvImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+{
+  // Files passed by the peer are only kept if there is room for them in the
+  // ancillary data, otherwise the kernel closes them.
+  union
+  {
+    char Buffer[FileControlSize];
+    struct ::cmsghdr Align;
+  } Control;
+
+  POD<struct ::msghdr> Msg;
+  Msg->msg_iov = const_cast<::iovec*>(Vectors);
+  Msg->msg_iovlen = Count;
+  Msg->msg_control = Control.Buffer;
+  Msg->msg_controllen = sizeof(Control.Buffer);
 
   auto ReadBytes = CheckedPOSIX(
-    [FD = Handle.get(), Bytes, &RawBuffer] {
-      return ::recv(FD, &RawBuffer, Bytes, 0);
+    [FD = Handle.get(), &Msg] {
+      return ::recvmsg(FD, &Msg, MSG_CMSG_CLOEXEC);
     },
     -1);
   if (!ReadBytes)
@@ -223,14 +665,14 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     {
       // Not an error, continue.
       Continue = true;
-      return {};
+      return 0;
     }
     if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
         EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
     {
       // No more data left in the stream.
       Continue = false;
-      return {};
+      return 0;
     }
 
     LOG_WITH_IDENTIFIER(error) << "Read error";
@@ -239,7 +681,9 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     throw std::system_error{std::make_error_code(EC)};
   }
 
-  Return.append(RawBuffer, ReadBytes.get());
+  if (Msg->msg_controllen)
+    collectFiles(Msg);
+
   Continue = true;
   if (ReadBytes.get() == 0)
   {
@@ -247,16 +691,18 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     setFailed();
     Continue = false;
   }
-  return Return;
+  return ReadBytes.get();
 }
 
-std::size_t Socket::writeImpl(std::string_view Buffer, bool& Continue)
+std::size_t
+Socket::writevImpl(const ::iovec* Vectors, std::size_t Count, bool& Continue)
 {
+  POD<struct ::msghdr> Msg;
+  Msg->msg_iov = const_cast<::iovec*>(Vectors);
+  Msg->msg_iovlen = Count;
+
   auto SentBytes = CheckedPOSIX(
-    [FD = Handle.get(), Buffer = Buffer.data(), Size = Buffer.size()] {
-      return ::send(FD, Buffer, Size, 0);
-    },
-    -1);
+    [FD = Handle.get(), &Msg] { return ::sendmsg(FD, &Msg, 0); }, -1);
   if (!SentBytes)
   {
     std::errc EC = static_cast<std::errc>(SentBytes.getError().value());
@@ -290,7 +736,6 @@ std::size_t Socket::writeImpl(std::string_view Buffer, bool& Continue)
     setFailed();
     Continue = false;
   }
-
   return SentBytes.get();
 }
 
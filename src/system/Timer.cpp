@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/Timer.hpp"
+
+namespace monomux
+{
+
+Timer::Timer()
+  : Handle(CheckedPOSIXThrow(
+      [] {
+        return ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      },
+      "timerfd_create()",
+      -1))
+{}
+
+void Timer::arm(std::chrono::nanoseconds After)
+{
+  using namespace std::chrono;
+  // A zero value would disarm the timer instead.
+  if (After <= nanoseconds::zero())
+    After = nanoseconds{1};
+
+  POD<struct ::itimerspec> Spec;
+  Spec->it_value.tv_sec = duration_cast<seconds>(After).count();
+  Spec->it_value.tv_nsec = (After % seconds{1}).count();
+  CheckedPOSIXThrow(
+    [this, &Spec] { return ::timerfd_settime(Handle, 0, &Spec, nullptr); },
+    "timerfd_settime()",
+    -1);
+  Armed = true;
+}
+
+void Timer::disarm()
+{
+  POD<struct ::itimerspec> Spec;
+  CheckedPOSIXThrow(
+    [this, &Spec] { return ::timerfd_settime(Handle, 0, &Spec, nullptr); },
+    "timerfd_settime()",
+    -1);
+  Armed = false;
+}
+
+bool Timer::consume() noexcept
+{
+  POD<std::uint64_t> Expirations;
+  auto Read = CheckedPOSIX(
+    [this, &Expirations] {
+      return ::read(Handle, &Expirations, sizeof(Expirations));
+    },
+    -1);
+  if (!Read || !*Expirations)
+    return false;
+
+  Armed = false;
+  return true;
+}
+
+} // namespace monomux
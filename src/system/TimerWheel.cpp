@@ -0,0 +1,260 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cassert>
+
+#include "monomux/system/TimerWheel.hpp"
+
+namespace monomux
+{
+
+namespace
+{
+
+constexpr std::uint64_t SlotMask = TimerWheel::SlotCount - 1;
+
+/// \returns the number of ticks a slot on \p Level spans, as a power of 2.
+constexpr std::size_t levelShift(std::size_t Level) noexcept
+{
+  return Level * TimerWheel::SlotBits;
+}
+
+/// \returns the distance of the first set bit of \p Bits starting from
+/// \p From, going around.
+std::size_t nextSetBit(std::uint64_t Bits, std::size_t From) noexcept
+{
+  std::uint64_t Rotated = From ? (Bits >> From) | (Bits << (64 - From)) : Bits;
+  return static_cast<std::size_t>(__builtin_ctzll(Rotated));
+}
+
+} // namespace
+
+TimerWheel::TimerWheel(std::chrono::milliseconds Resolution,
+                       Clock::time_point Start)
+  : Resolution(Resolution), Epoch(Start)
+{
+  static_assert(SlotCount == 64, "Occupied bitmaps assume 64 slots");
+  assert(Resolution.count() > 0 && "Resolution must be positive");
+  Slots.fill(None);
+}
+
+std::uint64_t TimerWheel::ticksAt(Clock::time_point T,
+                                  bool RoundUp) const noexcept
+{
+  if (T <= Epoch)
+    return 0;
+  auto Elapsed = static_cast<std::uint64_t>((T - Epoch).count());
+  auto Tick = static_cast<std::uint64_t>(
+    std::chrono::duration_cast<Clock::duration>(Resolution).count());
+  return RoundUp ? (Elapsed + Tick - 1) / Tick : Elapsed / Tick;
+}
+
+TimerWheel::Clock::time_point
+TimerWheel::timeOf(std::uint64_t Tick) const noexcept
+{
+  return Epoch + Resolution * Tick;
+}
+
+TimerWheel::Handle TimerWheel::schedule(Clock::time_point Deadline,
+                                        Callback Fn)
+{
+  std::uint32_t I;
+  if (FreeList != None)
+  {
+    I = FreeList;
+    FreeList = Nodes[I].Next;
+  }
+  else
+  {
+    I = static_cast<std::uint32_t>(Nodes.size());
+    Nodes.emplace_back();
+  }
+
+  Node& N = Nodes[I];
+  // The current tick was already processed, so the timer can expire at the
+  // next one the earliest.
+  N.Expiry = std::max(ticksAt(Deadline, /* RoundUp =*/true), CurrentTick + 1);
+  N.Fn = std::move(Fn);
+  link(I);
+  ++Count;
+
+  Handle H;
+  H.Index = I;
+  H.Generation = N.Generation;
+  return H;
+}
+
+bool TimerWheel::scheduled(Handle H) const noexcept
+{
+  return H.Index < Nodes.size() && Nodes[H.Index].Generation == H.Generation &&
+         Nodes[H.Index].SlotIndex != None;
+}
+
+bool TimerWheel::cancel(Handle H) noexcept
+{
+  if (!scheduled(H))
+    return false;
+  unlink(H.Index);
+  release(H.Index);
+  --Count;
+  return true;
+}
+
+void TimerWheel::link(std::uint32_t I) noexcept
+{
+  Node& N = Nodes[I];
+  std::uint64_t Placement = N.Expiry;
+  std::uint64_t Delta = Placement > CurrentTick ? Placement - CurrentTick : 0;
+  std::size_t Level = 0;
+  while (Level < LevelCount - 1 &&
+         Delta >= (std::uint64_t{1} << levelShift(Level + 1)))
+    ++Level;
+  if (Delta >= (std::uint64_t{1} << levelShift(LevelCount)))
+    // Timers beyond the range of the wheel are placed to its far end, and are
+    // re-linked when cascaded.
+    Placement = CurrentTick + (std::uint64_t{1} << levelShift(LevelCount)) - 1;
+
+  const std::size_t Slot = (Placement >> levelShift(Level)) & SlotMask;
+  const auto SlotIndex = static_cast<std::uint32_t>(Level * SlotCount + Slot);
+  N.SlotIndex = SlotIndex;
+  N.Prev = None;
+  N.Next = Slots[SlotIndex];
+  if (N.Next != None)
+    Nodes[N.Next].Prev = I;
+  Slots[SlotIndex] = I;
+  Occupied[Level] |= std::uint64_t{1} << Slot;
+}
+
+void TimerWheel::unlink(std::uint32_t I) noexcept
+{
+  Node& N = Nodes[I];
+  if (N.Prev != None)
+    Nodes[N.Prev].Next = N.Next;
+  else
+    Slots[N.SlotIndex] = N.Next;
+  if (N.Next != None)
+    Nodes[N.Next].Prev = N.Prev;
+
+  if (Slots[N.SlotIndex] == None)
+    Occupied[N.SlotIndex / SlotCount] &=
+      ~(std::uint64_t{1} << (N.SlotIndex % SlotCount));
+  N.SlotIndex = N.Prev = N.Next = None;
+}
+
+void TimerWheel::release(std::uint32_t I) noexcept
+{
+  Node& N = Nodes[I];
+  N.Fn = nullptr;
+  if (++N.Generation == 0)
+    N.Generation = 1;
+  N.Next = FreeList;
+  FreeList = I;
+}
+
+void TimerWheel::cascade(std::size_t Level, std::size_t Slot) noexcept
+{
+  const std::size_t SlotIndex = Level * SlotCount + Slot;
+  std::uint32_t I = Slots[SlotIndex];
+  Slots[SlotIndex] = None;
+  Occupied[Level] &= ~(std::uint64_t{1} << Slot);
+
+  while (I != None)
+  {
+    std::uint32_t Next = Nodes[I].Next;
+    link(I);
+    I = Next;
+  }
+}
+
+std::size_t TimerWheel::advance(Clock::time_point Now)
+{
+  const std::uint64_t Target = ticksAt(Now, /* RoundUp =*/false);
+  std::size_t Fired = 0;
+  while (CurrentTick < Target)
+  {
+    if (!Count)
+    {
+      CurrentTick = Target;
+      break;
+    }
+    if (!Occupied[0])
+    {
+      // Nothing can expire before the lowest level must be refilled.
+      std::uint64_t Boundary = (CurrentTick | SlotMask) + 1;
+      if (Boundary > Target)
+      {
+        CurrentTick = Target;
+        break;
+      }
+      CurrentTick = Boundary;
+    }
+    else
+      ++CurrentTick;
+
+    for (std::size_t Level = LevelCount - 1; Level > 0; --Level)
+    {
+      const std::uint64_t Mask = (std::uint64_t{1} << levelShift(Level)) - 1;
+      if ((CurrentTick & Mask) == 0)
+        cascade(Level, (CurrentTick >> levelShift(Level)) & SlotMask);
+    }
+
+    const std::size_t SlotIndex = CurrentTick & SlotMask;
+    while (Slots[SlotIndex] != None)
+    {
+      std::uint32_t I = Slots[SlotIndex];
+      assert(Nodes[I].Expiry <= CurrentTick && "Timer linked to wrong slot");
+      unlink(I);
+      Callback Fn = std::move(Nodes[I].Fn);
+      release(I);
+      --Count;
+
+      ++Fired;
+      if (Fn)
+        Fn();
+    }
+  }
+  return Fired;
+}
+
+std::chrono::milliseconds
+TimerWheel::timeout(Clock::time_point Now) const noexcept
+{
+  if (!Count)
+    return std::chrono::milliseconds{-1};
+
+  // The slots of the levels are visited starting after the current one, as
+  // the current slot contains the timers of the next revolution, if any.
+  std::uint64_t Earliest = ~std::uint64_t{0};
+  for (std::size_t Level = 0; Level < LevelCount; ++Level)
+  {
+    if (!Occupied[Level])
+      continue;
+    const std::uint64_t Next = (CurrentTick >> levelShift(Level)) + 1;
+    const std::size_t Distance = nextSetBit(Occupied[Level], Next & SlotMask);
+    // For the higher levels, this is the tick when the slot is cascaded.
+    Earliest = std::min(Earliest, (Next + Distance) << levelShift(Level));
+  }
+
+  Clock::time_point Deadline = timeOf(Earliest);
+  if (Deadline <= Now)
+    return std::chrono::milliseconds::zero();
+  return std::chrono::ceil<std::chrono::milliseconds>(Deadline - Now);
+}
+
+} // namespace monomux
@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/Log.hpp"
+
+using namespace monomux::log;
+
+TEST(Logger, DiscardedMessagesAreNotFormatted)
+{
+  std::ostringstream OS;
+  Logger L{Info, OS};
+
+  L(Debug, "test") << "hidden";
+  EXPECT_TRUE(OS.str().empty());
+
+  L(Info, "test") << "shown " << 42;
+  const std::string Out = OS.str();
+  EXPECT_NE(Out.find("test: shown 42\n"), std::string::npos);
+  EXPECT_EQ(Out.find("hidden"), std::string::npos);
+}
+
+TEST(Logger, AsynchronousKeepsPerThreadOrder)
+{
+  static constexpr std::size_t Threads = 4;
+  static constexpr std::size_t Lines = 4000;
+
+  std::ostringstream OS;
+  Logger L{Info, OS};
+  L.setAsynchronous(true);
+  ASSERT_TRUE(L.isAsynchronous());
+
+  std::vector<std::thread> Workers;
+  for (std::size_t T = 0; T < Threads; ++T)
+    Workers.emplace_back([&L, T] {
+      for (std::size_t I = 0; I < Lines; ++I)
+        L(Info, "test") << "T" << T << ' ' << I;
+    });
+  for (std::thread& W : Workers)
+    W.join();
+  L.setAsynchronous(false);
+  EXPECT_FALSE(L.isAsynchronous());
+
+  std::vector<std::size_t> Next(Threads, 0);
+  std::istringstream In{OS.str()};
+  std::string Line;
+  std::size_t Count = 0;
+  while (std::getline(In, Line))
+  {
+    const std::size_t Pos = Line.find("test: T");
+    ASSERT_NE(Pos, std::string::npos) << Line;
+    std::istringstream Fields{Line.substr(Pos + 7)};
+    std::size_t T;
+    std::size_t I;
+    Fields >> T >> I;
+    ASSERT_LT(T, Threads);
+    EXPECT_EQ(I, Next[T]) << "Out of order message from thread " << T;
+    Next[T] = I + 1;
+    ++Count;
+  }
+  EXPECT_EQ(Count, Threads * Lines);
+}
+
+TEST(Logger, AsynchronousFatalIsWrittenImmediately)
+{
+  std::ostringstream OS;
+  Logger L{Info, OS};
+  L.setAsynchronous(true);
+
+  L(Info, "test") << "queued";
+  L(Fatal, "test") << "last words";
+  const std::string Out = OS.str();
+  const std::size_t Queued = Out.find("queued");
+  const std::size_t Fatal = Out.find("last words");
+  ASSERT_NE(Queued, std::string::npos);
+  ASSERT_NE(Fatal, std::string::npos);
+  EXPECT_LT(Queued, Fatal);
+
+  L(Info, "test") << "flushed";
+  L.flush();
+  EXPECT_NE(OS.str().find("flushed"), std::string::npos);
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/BufferPool.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+
+using namespace monomux;
+
+TEST(BufferPool, ReleasedBufferIsReused)
+{
+  BufferPool Pool;
+  char* Raw = nullptr;
+  {
+    BufferPool::Handle H = Pool.acquire(BufferPool::MinPooledSize);
+    Raw = H.get();
+  }
+  EXPECT_EQ(Pool.cachedBytes(), BufferPool::MinPooledSize);
+
+  // A smaller request is served from the same size class.
+  BufferPool::Handle H = Pool.acquire(BufferPool::MinPooledSize / 2);
+  EXPECT_EQ(H.get(), Raw);
+  EXPECT_EQ(Pool.reuses(), 1);
+  EXPECT_EQ(Pool.cachedBytes(), 0);
+}
+
+TEST(BufferPool, SizeClassesAreSeparate)
+{
+  BufferPool Pool;
+  {
+    BufferPool::Handle H = Pool.acquire(BufferPool::MinPooledSize);
+  }
+  BufferPool::Handle Larger = Pool.acquire(BufferPool::MinPooledSize + 1);
+  EXPECT_EQ(Pool.reuses(), 0);
+  EXPECT_EQ(Pool.cachedBytes(), BufferPool::MinPooledSize);
+
+  Pool.trim();
+  EXPECT_EQ(Pool.cachedBytes(), 0);
+}
+
+TEST(BufferPool, HugeBuffersAreNotKept)
+{
+  BufferPool Pool;
+  {
+    BufferPool::Handle H = Pool.acquire(BufferPool::MaxPooledSize * 2);
+    ASSERT_NE(H.get(), nullptr);
+  }
+  EXPECT_EQ(Pool.cachedBytes(), 0);
+}
+
+TEST(BufferPool, RingBufferReturnsStorage)
+{
+  const std::size_t Cached = BufferPool::global().cachedBytes();
+  {
+    RingBuffer<char, PooledRingStorage> RB(BufferPool::MinPooledSize);
+    const std::string Data(BufferPool::MinPooledSize * 2, 'x');
+    RB.putBack(Data.data(), Data.size());
+    EXPECT_GT(RB.capacity(), BufferPool::MinPooledSize);
+  }
+  // Both the grown and the original storage are back in the pool.
+  EXPECT_GE(BufferPool::global().cachedBytes(),
+            Cached + BufferPool::MinPooledSize * 3);
+}
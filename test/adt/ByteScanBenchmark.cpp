@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/ByteScan.hpp"
+
+/// Microbenchmarks of the scanning routines, for comparing the throughput of
+/// the implementations supported by the machine. These are disabled by
+/// default, run them (preferably in a Release build) with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='ByteScanBenchmark.*'
+
+using namespace monomux;
+using scan::Implementation;
+
+static constexpr std::size_t DataSize = 16ULL << 20; // 16 MiB
+static constexpr std::size_t Repetitions = 20;
+
+/// Generates \p DataSize bytes of text resembling terminal output, with a
+/// line break every 80 characters and an escape sequence every 8 lines.
+static const std::string& terminalText()
+{
+  static const std::string Text = [] {
+    std::string S;
+    S.reserve(DataSize);
+    for (std::size_t Line = 0; S.size() < DataSize; ++Line)
+    {
+      if (Line % 8 == 0)
+        S.append("\033[1;32m");
+      S.append(79, static_cast<char>('a' + Line % 26)).push_back('\n');
+    }
+    S.resize(DataSize);
+    return S;
+  }();
+  return Text;
+}
+
+/// Measures and prints the throughput of \p Fn consuming all of \p Data, for
+/// every implementation supported by the machine.
+template <typename Fn> static void benchmark(const char* What, Fn&& F)
+{
+  const std::string& Data = terminalText();
+  Implementation Original = scan::active();
+  for (Implementation I : {Implementation::Scalar,
+                           Implementation::SSE2,
+                           Implementation::AVX2,
+                           Implementation::NEON})
+  {
+    if (!scan::setActive(I))
+      continue;
+
+    std::size_t Result = 0;
+    auto Begin = std::chrono::steady_clock::now();
+    for (std::size_t R = 0; R < Repetitions; ++R)
+      Result += F(Data.data(), Data.size());
+    auto Elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Begin);
+
+    double GiBps =
+      static_cast<double>(Data.size() * Repetitions) / (1ULL << 30) /
+      Elapsed.count();
+    std::cout << What << " (" << scan::name(I) << "): " << GiBps
+              << " GiB/s (" << Result << ")\n";
+  }
+  scan::setActive(Original);
+}
+
+/// Consumes \p Data token by token with \p Find, like a parser would.
+template <typename FindFn>
+static std::size_t tokens(const char* Data, std::size_t Size, FindFn Find)
+{
+  std::size_t N = 0;
+  for (std::size_t I = 0; I < Size; ++N)
+    I += Find(Data + I, Size - I) + 1;
+  return N;
+}
+
+TEST(ByteScanBenchmark, DISABLED_Newlines)
+{
+  benchmark("find('\\n')", [](const char* D, std::size_t S) {
+    return tokens(D, S, [](const char* D, std::size_t S) {
+      return scan::find(D, S, '\n');
+    });
+  });
+}
+
+TEST(ByteScanBenchmark, DISABLED_NewlinesOrEscapes)
+{
+  benchmark("findEither('\\n', ESC)", [](const char* D, std::size_t S) {
+    return tokens(D, S, [](const char* D, std::size_t S) {
+      return scan::findEither(D, S, '\n', '\033');
+    });
+  });
+}
+
+TEST(ByteScanBenchmark, DISABLED_NonPrintable)
+{
+  benchmark("findNonPrintable()", [](const char* D, std::size_t S) {
+    return tokens(D, S, &scan::findNonPrintable);
+  });
+}
+
+TEST(ByteScanBenchmark, DISABLED_CountNewlines)
+{
+  benchmark("count('\\n')", [](const char* D, std::size_t S) {
+    return scan::count(D, S, '\n');
+  });
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/ByteScan.hpp"
+#include "monomux/adt/RingBuffer.hpp"
+
+using namespace monomux;
+using scan::Implementation;
+
+/// Runs \p Fn with every implementation supported by the current machine.
+template <typename Fn> static void forEachImplementation(Fn&& F)
+{
+  Implementation Original = scan::active();
+  for (Implementation I : {Implementation::Scalar,
+                           Implementation::SSE2,
+                           Implementation::AVX2,
+                           Implementation::NEON})
+  {
+    if (!scan::setActive(I))
+      continue;
+    SCOPED_TRACE(scan::name(I));
+    F();
+  }
+  scan::setActive(Original);
+}
+
+TEST(ByteScan, ScalarAlwaysSupported)
+{
+  EXPECT_TRUE(scan::isSupported(Implementation::Scalar));
+  EXPECT_TRUE(scan::isSupported(scan::active()));
+}
+
+TEST(ByteScan, FindAtEveryPosition)
+{
+  forEachImplementation([] {
+    for (std::size_t Size = 0; Size < 100; ++Size)
+    {
+      std::string Data(Size, 'x');
+      EXPECT_EQ(scan::find(Data.data(), Size, '\n'), Size);
+      EXPECT_EQ(scan::findEither(Data.data(), Size, '\n', '\033'), Size);
+      EXPECT_EQ(scan::findNonPrintable(Data.data(), Size), Size);
+      EXPECT_EQ(scan::count(Data.data(), Size, '\n'), 0);
+
+      for (std::size_t Pos = 0; Pos < Size; ++Pos)
+      {
+        Data.assign(Size, 'x');
+        Data[Pos] = '\n';
+        EXPECT_EQ(scan::find(Data.data(), Size, '\n'), Pos);
+        EXPECT_EQ(scan::findEither(Data.data(), Size, '\033', '\n'), Pos);
+        EXPECT_EQ(scan::findNonPrintable(Data.data(), Size), Pos);
+        EXPECT_EQ(scan::count(Data.data(), Size, '\n'), 1);
+      }
+    }
+  });
+}
+
+TEST(ByteScan, NonPrintableBytes)
+{
+  forEachImplementation([] {
+    std::string Data(40, 'a');
+    for (int C : {0x00, 0x1B, 0x1F, 0x7F, 0x80, 0xC3, 0xFF})
+    {
+      Data[33] = static_cast<char>(C);
+      EXPECT_EQ(scan::findNonPrintable(Data.data(), Data.size()), 33) << C;
+    }
+    for (int C : {0x20, 0x41, 0x7E})
+    {
+      Data[33] = static_cast<char>(C);
+      EXPECT_EQ(scan::findNonPrintable(Data.data(), Data.size()), 40) << C;
+    }
+  });
+}
+
+TEST(ByteScan, CountMany)
+{
+  forEachImplementation([] {
+    std::string Data;
+    for (std::size_t I = 0; I < 1000; ++I)
+      Data.append(I % 7, 'x').push_back('\n');
+    EXPECT_EQ(scan::count(Data.data(), Data.size(), '\n'), 1000);
+    EXPECT_EQ(scan::find(Data.data(), Data.size(), '\n'), 0);
+    EXPECT_EQ(scan::find(Data.data() + 1, Data.size() - 1, 'y'),
+              Data.size() - 1);
+  });
+}
+
+TEST(ByteScan, RingBufferSegments)
+{
+  RingBuffer<char> RB(static_cast<std::size_t>(64));
+  RB.putBack(std::string(48, 'x').data(), 48);
+  RB.dropFront(40);
+  RB.putBack(std::string(40, 'y').data(), 40);
+  RB.back() = '\n';
+  // The contents wrap around the end of the storage.
+  ASSERT_NE(RB.peekFrontRanges(RB.size())[1].Size, 0);
+
+  forEachImplementation([&RB] {
+    EXPECT_EQ(scan::find(RB, '\n'), RB.size() - 1);
+    EXPECT_EQ(scan::find(RB, 'y'), 8);
+    EXPECT_EQ(scan::find(RB, 'z'), RB.size());
+    EXPECT_EQ(scan::findEither(RB, 'z', 'y'), 8);
+    EXPECT_EQ(scan::count(RB, 'y'), 39);
+  });
+}
+
+TEST(ByteScan, UTF8CompletePrefix)
+{
+  auto Prefix = [](const std::string& S) {
+    return scan::utf8CompletePrefix(S.data(), S.size());
+  };
+  EXPECT_EQ(Prefix(""), 0);
+  EXPECT_EQ(Prefix("abc"), 3);
+  // U+00E1, 2 bytes.
+  EXPECT_EQ(Prefix("a\xc3\xa1"), 3);
+  EXPECT_EQ(Prefix("a\xc3"), 1);
+  // U+20AC, 3 bytes.
+  EXPECT_EQ(Prefix("a\xe2\x82\xac"), 4);
+  EXPECT_EQ(Prefix("a\xe2\x82"), 1);
+  EXPECT_EQ(Prefix("a\xe2"), 1);
+  // U+1F600, 4 bytes.
+  EXPECT_EQ(Prefix("a\xf0\x9f\x98\x80"), 5);
+  EXPECT_EQ(Prefix("a\xf0\x9f\x98"), 1);
+}
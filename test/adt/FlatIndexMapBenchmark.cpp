@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+#include <variant>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/FlatIndexMap.hpp"
+#include "monomux/adt/SmallIndexMap.hpp"
+#include "monomux/adt/Tagged.hpp"
+
+/// Microbenchmarks of the file descriptor lookup of the server, comparing
+/// the flat map of tagged pointers to the small-buffer optimised map of
+/// variants it replaced. These are disabled by default, run them (preferably
+/// in a Release build) with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='FlatIndexMapBenchmark.*'
+
+using namespace monomux;
+
+namespace
+{
+
+struct alignas(8) Client
+{
+  std::size_t ID;
+};
+struct alignas(8) Session
+{
+  std::size_t ID;
+};
+
+using ControlConn = Tagged<1, Client>;
+using DataConn = Tagged<2, Client>;
+using SessionConn = Tagged<4, Session>;
+using TimerConn = Tagged<8, Session>;
+
+using Variant =
+  std::variant<std::monostate, ControlConn, DataConn, SessionConn, TimerConn>;
+using SmallMap = SmallIndexMap<Variant,
+                               256,
+                               /* StoreInPlace =*/true,
+                               /* IntrusiveDefaultSentinel =*/true>;
+using Union = TaggedUnion<ControlConn, DataConn, SessionConn, TimerConn>;
+using FlatMap = FlatIndexMap<Union>;
+
+constexpr std::size_t Lookups = 16ULL << 20;
+/// The first descriptor that is mapped, as the standard streams and the
+/// server socket come before.
+constexpr std::size_t FirstFD = 5;
+
+std::size_t visit(const Variant& V)
+{
+  if (const auto* S = std::get_if<SessionConn>(&V))
+    return (*S)->ID;
+  if (const auto* T = std::get_if<TimerConn>(&V))
+    return (*T)->ID;
+  if (const auto* D = std::get_if<DataConn>(&V))
+    return (*D)->ID;
+  if (const auto* C = std::get_if<ControlConn>(&V))
+    return (*C)->ID;
+  return 0;
+}
+
+std::size_t visit(const Union& U)
+{
+  if (const auto* S = U.getIf<SessionConn>())
+    return S->ID;
+  if (const auto* T = U.getIf<TimerConn>())
+    return T->ID;
+  if (const auto* D = U.getIf<DataConn>())
+    return D->ID;
+  if (const auto* C = U.getIf<ControlConn>())
+    return C->ID;
+  return 0;
+}
+
+/// Maps \p FDs descriptors like a server with that many connections would,
+/// then measures looking them up in a scattered order, like dispatching
+/// events would.
+template <typename Map> void benchmark(const char* What, std::size_t FDs)
+{
+  std::vector<Client> Clients(FDs);
+  std::vector<Session> Sessions(FDs);
+  Map M;
+  for (std::size_t I = 0; I < FDs; ++I)
+  {
+    Clients[I].ID = Sessions[I].ID = I;
+    switch (I % 4)
+    {
+      case 0:
+        M[FirstFD + I] = ControlConn{&Clients[I]};
+        break;
+      case 1:
+        M[FirstFD + I] = DataConn{&Clients[I]};
+        break;
+      case 2:
+        M[FirstFD + I] = SessionConn{&Sessions[I]};
+        break;
+      case 3:
+        M[FirstFD + I] = TimerConn{&Sessions[I]};
+        break;
+    }
+  }
+
+  std::size_t Result = 0;
+  std::size_t FD = 0;
+  auto Begin = std::chrono::steady_clock::now();
+  for (std::size_t L = 0; L < Lookups; ++L)
+  {
+    // Stride through the descriptors with a step coprime to most counts.
+    FD = (FD + 7919) % FDs;
+    if (const auto* E = M.tryGet(FirstFD + FD))
+      Result += visit(*E);
+  }
+  auto Elapsed = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - Begin);
+
+  std::cout << What << " with " << FDs
+            << " descriptors: " << Elapsed.count() / Lookups
+            << " ns/lookup (" << Result << ")\n";
+}
+
+} // namespace
+
+TEST(FlatIndexMapBenchmark, DISABLED_FewDescriptors)
+{
+  benchmark<SmallMap>("SmallIndexMap", 200);
+  benchmark<FlatMap>("FlatIndexMap", 200);
+}
+
+TEST(FlatIndexMapBenchmark, DISABLED_ManyDescriptors)
+{
+  for (std::size_t FDs : {1024, 16384})
+  {
+    benchmark<SmallMap>("SmallIndexMap", FDs);
+    benchmark<FlatMap>("FlatIndexMap", FDs);
+  }
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include "monomux/adt/FlatIndexMap.hpp"
+#include "monomux/adt/Tagged.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+struct alignas(8) Client
+{
+  int ID;
+};
+struct alignas(8) Session
+{
+  int ID;
+};
+
+using ControlConn = Tagged<1, Client>;
+using DataConn = Tagged<2, Client>;
+using SessionConn = Tagged<4, Session>;
+using Entry = TaggedUnion<ControlConn, DataConn, SessionConn>;
+
+} // namespace
+
+TEST(TaggedUnion, StoresAlternativeInPointer)
+{
+  static_assert(sizeof(Entry) == sizeof(void*));
+  static_assert(std::is_trivially_copyable_v<Entry>);
+
+  Client C{1};
+  Session S{2};
+
+  Entry E;
+  EXPECT_TRUE(E.empty());
+  EXPECT_FALSE(E.is<ControlConn>());
+  EXPECT_EQ(E.getIf<ControlConn>(), nullptr);
+
+  E = DataConn{&C};
+  EXPECT_FALSE(E.empty());
+  EXPECT_TRUE(E.is<DataConn>());
+  EXPECT_FALSE(E.is<ControlConn>());
+  EXPECT_EQ(E.getIf<DataConn>(), &C);
+  EXPECT_EQ(E.getIf<ControlConn>(), nullptr);
+  EXPECT_NE(E, Entry{ControlConn{&C}});
+  EXPECT_EQ(E, Entry{DataConn{&C}});
+
+  E = SessionConn{&S};
+  EXPECT_EQ(E.getIf<SessionConn>()->ID, 2);
+
+  // Null pointers of any alternative are the empty state.
+  E = SessionConn{nullptr};
+  EXPECT_TRUE(E.empty());
+  EXPECT_EQ(E, Entry{});
+}
+
+TEST(FlatIndexMap, Pointers)
+{
+  FlatIndexMap<int*> M;
+  int A = 1;
+  int B = 2;
+  EXPECT_TRUE(M.empty());
+  EXPECT_EQ(M.capacity(), 0);
+
+  M[5] = &A;
+  M.set(6, &B);
+  EXPECT_EQ(M.size(), 2);
+  EXPECT_EQ(M.capacity(), FlatIndexMap<int*>::MinCapacity);
+  EXPECT_TRUE(M.contains(5));
+  EXPECT_FALSE(M.contains(4));
+  EXPECT_FALSE(M.contains(100000));
+  EXPECT_EQ(M.get(5), &A);
+  EXPECT_EQ(*M.tryGet(6), &B);
+  EXPECT_EQ(M.tryGet(7), nullptr);
+  EXPECT_THROW(M.get(7), std::out_of_range);
+
+  // Overwriting does not change the size.
+  M[5] = &B;
+  EXPECT_EQ(M.size(), 2);
+  EXPECT_EQ(M.get(5), &B);
+
+  M.erase(5);
+  M.erase(5);
+  M.erase(100000);
+  EXPECT_EQ(M.size(), 1);
+  EXPECT_FALSE(M.contains(5));
+}
+
+TEST(FlatIndexMap, GrowsGeometrically)
+{
+  FlatIndexMap<Entry> M;
+  std::vector<Client> Clients(4096);
+  for (std::size_t I = 0; I < Clients.size(); ++I)
+  {
+    Clients[I].ID = static_cast<int>(I);
+    M[I] = ControlConn{&Clients[I]};
+  }
+  EXPECT_EQ(M.size(), 4096);
+  EXPECT_EQ(M.capacity(), 4096);
+
+  M[4096] = DataConn{&Clients.front()};
+  EXPECT_EQ(M.capacity(), 8192);
+  EXPECT_TRUE(M.get(4096).is<DataConn>());
+  for (std::size_t I = 0; I < Clients.size(); ++I)
+    ASSERT_EQ(M.get(I).getIf<ControlConn>()->ID, static_cast<int>(I));
+
+  M.clear();
+  EXPECT_TRUE(M.empty());
+  EXPECT_EQ(M.capacity(), 0);
+  EXPECT_FALSE(M.contains(1));
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/MaskedRingBuffer.hpp"
+#include "monomux/system/MirroredRingStorage.hpp"
+
+using namespace monomux;
+
+TEST(MaskedRingBuffer, CapacityIsPowerOfTwo)
+{
+  MaskedRingBuffer<int> RB(5);
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_TRUE(RB.empty());
+
+  for (int I = 0; I < 9; ++I)
+    RB.push_back(I);
+  EXPECT_EQ(RB.capacity(), 16);
+  EXPECT_EQ(RB.size(), 9);
+  EXPECT_EQ(RB.front(), 0);
+  EXPECT_EQ(RB.back(), 8);
+  EXPECT_THROW(RB.at(9), std::out_of_range);
+}
+
+TEST(MaskedRingBuffer, WrapsAround)
+{
+  MaskedRingBuffer<char> RB(8);
+  RB.putBack("abcdef", 6);
+  RB.dropFront(4);
+  RB.putBack("ghijk", 5);
+  // [i, j, k, -, *e, f, g, h]
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_EQ(RB.size(), 7);
+
+  auto Used = RB.peekFrontRanges(RB.size());
+  EXPECT_EQ(std::string(Used[0].Begin, Used[0].Size), "efgh");
+  EXPECT_EQ(std::string(Used[1].Begin, Used[1].Size), "ijk");
+  auto Free = RB.reserveBack(1);
+  EXPECT_EQ(Free[0].Size, 1);
+  EXPECT_EQ(Free[1].Size, 0);
+
+  char Out[8] = {};
+  EXPECT_EQ(RB.takeFront(Out, 100), 7);
+  EXPECT_EQ(std::string(Out, 7), "efghijk");
+  EXPECT_TRUE(RB.empty());
+}
+
+TEST(MaskedRingBuffer, GrowKeepsOrder)
+{
+  MaskedRingBuffer<char> RB(8);
+  RB.putBack("0123456", 7);
+  RB.dropFront(5);
+  RB.putBack("789abcdef", 9);
+  EXPECT_EQ(RB.capacity(), 16);
+  std::vector<char> V = RB.takeFront(RB.size());
+  EXPECT_EQ(std::string(V.begin(), V.end()), "56789abcdef");
+}
+
+TEST(MaskedRingBuffer, MoveResets)
+{
+  MaskedRingBuffer<char> RB(8);
+  RB.putBack("abc", 3);
+  MaskedRingBuffer<char> RB2 = std::move(RB);
+  EXPECT_EQ(RB2.size(), 3);
+  // NOLINTNEXTLINE(bugprone-use-after-move)
+  EXPECT_EQ(RB.size(), 0);
+  EXPECT_EQ(RB.capacity(), 0);
+  RB.putBack("d", 1);
+  EXPECT_EQ(RB.front(), 'd');
+}
+
+TEST(MaskedRingBuffer, MirroredIsContiguous)
+{
+  using Mirrored = MaskedRingBuffer<char, MirroredRingStorage>;
+  static_assert(Mirrored::Mirrored);
+
+  Mirrored RB(1);
+  const std::size_t Capacity = RB.capacity();
+  EXPECT_GE(Capacity, 4096);
+
+  std::string Data(Capacity - 10, 'x');
+  RB.putBack(Data.data(), Data.size());
+  RB.dropFront(Data.size() - 5);
+  RB.putBack("0123456789abcdef", 16);
+  EXPECT_EQ(RB.capacity(), Capacity);
+
+  // The contents wrap around the end of the storage, but are reported as one
+  // contiguous range.
+  auto Used = RB.peekFrontRanges(RB.size());
+  EXPECT_EQ(Used[1].Size, 0);
+  EXPECT_EQ(std::string(Used[0].Begin, Used[0].Size),
+            "xxxxx0123456789abcdef");
+
+  // So the whole buffer can be written out at once.
+  int Pipe[2];
+  ASSERT_EQ(::pipe(Pipe), 0);
+  ASSERT_EQ(::write(Pipe[1], Used[0].Begin, Used[0].Size), Used[0].Size);
+  char Out[32] = {};
+  ASSERT_EQ(::read(Pipe[0], Out, sizeof(Out)), Used[0].Size);
+  EXPECT_EQ(std::string(Out, Used[0].Size), "xxxxx0123456789abcdef");
+  ::close(Pipe[0]);
+  ::close(Pipe[1]);
+
+  RB.putBack(Data.data(), Data.size());
+  EXPECT_GT(RB.capacity(), Capacity);
+  EXPECT_EQ(RB.size(), 21 + Data.size());
+  EXPECT_EQ(RB[5], '0');
+}
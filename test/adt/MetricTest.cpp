@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/Metric.hpp"
+
+using namespace monomux;
+
+TEST(Metric, CounterAddsConcurrently)
+{
+  Counter C;
+  std::vector<std::thread> Threads;
+  for (int T = 0; T < 4; ++T)
+    Threads.emplace_back([&C] {
+      for (int I = 0; I < 1000; ++I)
+        C.add();
+    });
+  for (std::thread& T : Threads)
+    T.join();
+  EXPECT_EQ(C.get(), 4000);
+
+  C.add(5);
+  EXPECT_EQ(C.get(), 4005);
+}
+
+TEST(Metric, HighWaterKeepsMaximum)
+{
+  HighWater HW;
+  EXPECT_EQ(HW.get(), 0);
+  HW.observe(16);
+  HW.observe(4);
+  EXPECT_EQ(HW.get(), 16);
+  HW.observe(32);
+  EXPECT_EQ(HW.get(), 32);
+}
+
+TEST(Metric, HistogramBuckets)
+{
+  Histogram H;
+  H.record(0);
+  H.record(1);
+  H.record(2);
+  H.record(3);
+  H.record(1000);
+  H.record(std::numeric_limits<std::uint64_t>::max());
+
+  EXPECT_EQ(H.bucket(0), 1);
+  EXPECT_EQ(H.bucket(1), 1);
+  EXPECT_EQ(H.bucket(2), 2);
+  // 1000 is in (511, 1023].
+  EXPECT_EQ(Histogram::upperBound(10), 1023);
+  EXPECT_EQ(H.bucket(10), 1);
+  EXPECT_EQ(H.bucket(Histogram::BucketCount - 1), 1);
+  EXPECT_EQ(H.count(), 6);
+
+  Histogram Sum;
+  Sum.record(10);
+  Sum.record(20);
+  EXPECT_EQ(Sum.sum(), 30);
+}
@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/RingBuffer.hpp"
+
+/// Microbenchmarks of the bulk operations of the buffer that holds the data
+/// of the channels, with the contents starting at various positions of the
+/// storage, so that some of the operations must be split in two at the wrap.
+/// These are disabled by default, run them (preferably in a Release build)
+/// with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='RingBufferBenchmark.*'
+
+using namespace monomux;
+
+namespace
+{
+
+constexpr std::size_t Capacity = 1 << 16;
+constexpr std::size_t Chunk = 1 << 12;
+constexpr std::size_t Transferred = 4ULL << 30; // 4 GiB
+
+/// \returns a buffer of \p Capacity whose contents begin at \p Offset.
+RingBuffer<char> bufferAt(std::size_t Offset)
+{
+  RingBuffer<char> Buf(Capacity);
+  std::vector<char> Fill(Offset, 'x');
+  Buf.putBack(Fill.data(), Fill.size());
+  Buf.dropFront(Offset);
+  return Buf;
+}
+
+/// Measures and prints the throughput of moving \p Transferred bytes through
+/// the buffer, \p Chunk bytes at a time, with \p Move, for contents starting
+/// at various positions.
+template <typename Fn> void benchmark(const char* What, Fn&& Move)
+{
+  std::vector<char> In(Chunk, 'a');
+  std::vector<char> Out(Chunk);
+  for (std::size_t Offset :
+       {std::size_t{0}, Chunk / 2, Capacity / 2, Capacity - Chunk / 2})
+  {
+    RingBuffer<char> Buf = bufferAt(Offset);
+    // Keep half the buffer full, so every operation near the wrap splits.
+    std::vector<char> Fill(Capacity / 2 - Chunk, 'y');
+    Buf.putBack(Fill.data(), Fill.size());
+
+    auto Begin = std::chrono::steady_clock::now();
+    for (std::size_t Moved = 0; Moved < Transferred; Moved += Chunk)
+      Move(Buf, In, Out);
+    auto Elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Begin);
+
+    std::cout << What << " at offset " << Offset << ": "
+              << static_cast<double>(Transferred) / (1ULL << 30) /
+                   Elapsed.count()
+              << " GiB/s (" << Buf.size() << ")\n";
+  }
+}
+
+} // namespace
+
+TEST(RingBufferBenchmark, DISABLED_PutAndTake)
+{
+  benchmark("putBack() + takeFront()",
+            [](RingBuffer<char>& B, std::vector<char>& In,
+               std::vector<char>& Out) {
+              B.putBack(In.data(), In.size());
+              B.takeFront(Out.data(), Out.size());
+            });
+}
+
+TEST(RingBufferBenchmark, DISABLED_PeekAndDrop)
+{
+  benchmark("putBack() + peekFront() + dropFront()",
+            [](RingBuffer<char>& B, std::vector<char>& In,
+               std::vector<char>& Out) {
+              B.putBack(In.data(), In.size());
+              B.peekFront(Out.data(), Out.size());
+              B.dropFront(Out.size());
+            });
+}
+
+TEST(RingBufferBenchmark, DISABLED_Ranges)
+{
+  benchmark("reserveBack() + commitBack() + peekFrontRanges()",
+            [](RingBuffer<char>& B, std::vector<char>& In,
+               std::vector<char>& /* Out */) {
+              // Like a vectored read into, and a write from, the buffer.
+              auto Free = B.reserveBack(In.size());
+              std::size_t Filled = 0;
+              for (const auto& R : Free)
+              {
+                std::size_t N = std::min(R.Size, In.size() - Filled);
+                std::copy_n(In.data() + Filled, N, R.Begin);
+                Filled += N;
+              }
+              B.commitBack(Filled);
+
+              std::size_t Sum = 0;
+              for (const auto& R : B.peekFrontRanges(In.size()))
+                Sum += R.Size;
+              B.dropFront(Sum);
+            });
+}
@@ -17,6 +17,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "monomux/adt/RingBuffer.hpp"
@@ -247,3 +250,65 @@ TEST(RingBuffer, PeekAndDrop)
   EXPECT_EQ(RB[0], 3);
   EXPECT_EQ(RB[1], 4);
 }
+
+TEST(RingBuffer, ContiguousRanges)
+{
+  RingBuffer<int> RB(static_cast<std::size_t>(8));
+  RB.putBack(std::vector<int>{1, 2, 3, 4, 5, 6});
+  RB.dropFront(4);
+  // [-, -, -, -, *5, 6, -, -]
+
+  auto Free = RB.reserveBack(4);
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_EQ(Free[0].Size, 2);
+  EXPECT_EQ(Free[1].Size, 4);
+  Free[0].Begin[0] = 7;
+  Free[0].Begin[1] = 8;
+  Free[1].Begin[0] = 9;
+  RB.commitBack(3);
+  // [9, -, -, -, *5, 6, 7, 8]
+  EXPECT_EQ(RB.size(), 5);
+  EXPECT_EQ(RB.back(), 9);
+
+  auto Used = RB.peekFrontRanges(RB.size());
+  EXPECT_EQ(Used[0].Size, 4);
+  EXPECT_EQ(Used[0].Begin[0], 5);
+  EXPECT_EQ(Used[0].Begin[3], 8);
+  EXPECT_EQ(Used[1].Size, 1);
+  EXPECT_EQ(Used[1].Begin[0], 9);
+
+  Used = RB.peekFrontRanges(2);
+  EXPECT_EQ(Used[0].Size, 2);
+  EXPECT_EQ(Used[1].Size, 0);
+
+  RB.push_back(Magic32);
+  EXPECT_EQ(RB[5], Magic32);
+}
+
+TEST(RingBuffer, BulkCopyIntoCallerBuffer)
+{
+  RingBuffer<char> RB(static_cast<std::size_t>(8));
+  RB.putBack("abcdef", 6);
+  RB.dropFront(4);
+  RB.putBack("ghijk", 5);
+  // [i, j, k, -, *e, f, g, h]
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_EQ(RB.size(), 7);
+
+  char Out[8] = {};
+  EXPECT_EQ(RB.peekFront(Out, 6), 6);
+  EXPECT_EQ(std::string(Out, 6), "efghij");
+  EXPECT_EQ(RB.size(), 7);
+
+  EXPECT_EQ(RB.takeFront(Out, 100), 7);
+  EXPECT_EQ(std::string(Out, 7), "efghijk");
+  EXPECT_TRUE(RB.empty());
+
+  // Growing keeps the wrapped contents in order.
+  RB.putBack("0123456", 7);
+  RB.dropFront(5);
+  RB.putBack("789abcdef", 9);
+  EXPECT_GT(RB.capacity(), 8);
+  std::vector<char> V = RB.takeFront(RB.size());
+  EXPECT_EQ(std::string(V.begin(), V.end()), "56789abcdef");
+}
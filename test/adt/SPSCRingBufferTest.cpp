@@ -0,0 +1,195 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/SPSCRingBuffer.hpp"
+#include "monomux/system/MirroredRingStorage.hpp"
+
+using namespace monomux;
+
+TEST(SPSCRingBuffer, FillAndDrain)
+{
+  SPSCRingBuffer<> RB(6);
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_TRUE(RB.empty());
+
+  EXPECT_EQ(RB.putBack("abcdef", 6), 6);
+  EXPECT_EQ(RB.size(), 6);
+  EXPECT_EQ(RB.putBack("ghijk", 5), 2);
+  EXPECT_EQ(RB.size(), 8);
+
+  char Out[16] = {};
+  EXPECT_EQ(RB.takeFront(Out, 5), 5);
+  EXPECT_EQ(std::string(Out, 5), "abcde");
+  EXPECT_EQ(RB.putBack("ijk", 3), 3);
+  // [i, j, k, -, -, *f, g, h]
+  auto Used = RB.peekFrontRanges(100);
+  EXPECT_EQ(std::string(Used[0].Begin, Used[0].Size), "fgh");
+  EXPECT_EQ(std::string(Used[1].Begin, Used[1].Size), "ijk");
+
+  EXPECT_EQ(RB.takeFront(Out, 100), 6);
+  EXPECT_EQ(std::string(Out, 6), "fghijk");
+  EXPECT_TRUE(RB.empty());
+}
+
+TEST(SPSCRingBuffer, CommittedDataVisibleOnlyAfterPublish)
+{
+  SPSCRingBuffer<> RB(16);
+  auto Free = RB.reserveBack(4);
+  std::memcpy(Free[0].Begin, "abcd", 4);
+  RB.commitBack(4);
+  EXPECT_EQ(RB.peekFrontRanges(4)[0].Size, 0);
+
+  RB.publish();
+  auto Used = RB.peekFrontRanges(4);
+  EXPECT_EQ(std::string(Used[0].Begin, Used[0].Size), "abcd");
+}
+
+TEST(SPSCRingBuffer, MirroredIsContiguous)
+{
+  SPSCRingBuffer<MirroredRingStorage> RB(1);
+  const std::size_t Capacity = RB.capacity();
+  std::string Data(Capacity - 3, 'x');
+  ASSERT_EQ(RB.putBack(Data.data(), Data.size()), Data.size());
+  RB.dropFront(Data.size());
+  ASSERT_EQ(RB.putBack("0123456789", 10), 10);
+
+  auto Used = RB.peekFrontRanges(100);
+  EXPECT_EQ(Used[1].Size, 0);
+  EXPECT_EQ(std::string(Used[0].Begin, Used[0].Size), "0123456789");
+}
+
+/// Sends \p Total bytes of a known sequence through \p RB from a producer
+/// thread, in chunks of random size, and verifies them in the consumer.
+template <class Buffer>
+static void stress(Buffer& RB, std::size_t Total, bool Batched)
+{
+  std::thread Producer{[&RB, Total, Batched] {
+    std::minstd_rand Rand{1};
+    char Chunk[1024];
+    std::size_t Sent = 0;
+    while (Sent < Total)
+    {
+      std::size_t N = std::min<std::size_t>(Rand() % sizeof(Chunk) + 1,
+                                            Total - Sent);
+      for (std::size_t I = 0; I < N; ++I)
+        Chunk[I] = static_cast<char>((Sent + I) % 251);
+
+      if (!Batched)
+      {
+        std::size_t Copied = RB.putBack(Chunk, N);
+        Sent += Copied;
+        if (!Copied)
+          std::this_thread::yield();
+        continue;
+      }
+
+      std::size_t Copied = 0;
+      for (const auto& R : RB.reserveBack(N))
+      {
+        std::size_t Len = std::min(N - Copied, R.Size);
+        std::memcpy(R.Begin, Chunk + Copied, Len);
+        Copied += Len;
+      }
+      RB.commitBack(Copied);
+      Sent += Copied;
+      if (Rand() % 4 == 0 || Sent == Total || Copied < N)
+        RB.publish();
+      if (!Copied)
+        std::this_thread::yield();
+    }
+  }};
+
+  std::size_t Received = 0;
+  bool Mismatch = false;
+  char Out[777];
+  while (Received < Total)
+  {
+    std::size_t N = RB.takeFront(Out, sizeof(Out));
+    for (std::size_t I = 0; I < N; ++I)
+      Mismatch |= Out[I] != static_cast<char>((Received + I) % 251);
+    Received += N;
+    if (!N)
+      std::this_thread::yield();
+  }
+  Producer.join();
+
+  EXPECT_EQ(Received, Total);
+  EXPECT_FALSE(Mismatch);
+  EXPECT_TRUE(RB.empty());
+}
+
+TEST(SPSCRingBuffer, StressConcurrent)
+{
+  SPSCRingBuffer<> RB(4096);
+  stress(RB, 16ULL << 20, /* Batched =*/false);
+}
+
+TEST(SPSCRingBuffer, StressConcurrentBatched)
+{
+  SPSCRingBuffer<> RB(4096);
+  stress(RB, 16ULL << 20, /* Batched =*/true);
+}
+
+TEST(SPSCRingBuffer, StressConcurrentMirrored)
+{
+  SPSCRingBuffer<MirroredRingStorage> RB(4096);
+  stress(RB, 16ULL << 20, /* Batched =*/true);
+}
+
+/// Measures the throughput of relaying data between two threads. Disabled by
+/// default, run it with '--gtest_also_run_disabled_tests'.
+TEST(SPSCRingBuffer, DISABLED_Throughput)
+{
+  static constexpr std::size_t Total = 4ULL << 30; // 4 GiB
+  static constexpr std::size_t ChunkSize = 16384;
+  SPSCRingBuffer<> RB(1 << 20);
+
+  auto Begin = std::chrono::steady_clock::now();
+  std::thread Producer{[&RB] {
+    std::string Chunk(ChunkSize, 'x');
+    for (std::size_t Sent = 0; Sent < Total;)
+      if (std::size_t N =
+            RB.putBack(Chunk.data(), std::min(ChunkSize, Total - Sent)))
+        Sent += N;
+      else
+        std::this_thread::yield();
+  }};
+
+  std::string Out(ChunkSize, 0);
+  for (std::size_t Received = 0; Received < Total;)
+    if (std::size_t N = RB.takeFront(Out.data(), Out.size()))
+      Received += N;
+    else
+      std::this_thread::yield();
+  Producer.join();
+  auto Elapsed = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - Begin);
+
+  std::cout << "SPSC relay: "
+            << static_cast<double>(Total) / (1ULL << 30) / Elapsed.count()
+            << " GiB/s\n";
+}
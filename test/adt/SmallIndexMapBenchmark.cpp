@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/SmallIndexMap.hpp"
+
+/// Microbenchmarks of the map in its small (array-like) and large (tree-like)
+/// representation. These are disabled by default, run them (preferably in a
+/// Release build) with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='SmallIndexMapBenchmark.*'
+
+using namespace monomux;
+
+namespace
+{
+
+constexpr std::size_t SmallSize = 64;
+constexpr std::size_t Operations = 4ULL << 20;
+
+using Map = SmallIndexMap<std::size_t*, SmallSize>;
+
+/// Measures and prints the cost of looking up, and of setting and erasing,
+/// \p Keys keys starting at \p FirstKey.
+void benchmark(const char* What, std::size_t FirstKey, std::size_t Keys)
+{
+  std::size_t Value = 1;
+  Map M;
+  for (std::size_t K = 0; K < Keys; ++K)
+    M.set(FirstKey + K, &Value);
+  EXPECT_EQ(M.isSmall(), FirstKey + Keys <= SmallSize);
+
+  std::size_t Result = 0;
+  std::size_t K = 0;
+  auto Begin = std::chrono::steady_clock::now();
+  for (std::size_t L = 0; L < Operations; ++L)
+  {
+    K = (K + 7) % Keys;
+    if (std::size_t* const* E = M.tryGet(FirstKey + K))
+      Result += **E;
+  }
+  auto Lookup = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - Begin);
+
+  Begin = std::chrono::steady_clock::now();
+  for (std::size_t L = 0; L < Operations; ++L)
+  {
+    // Replace the mapping of one key, like a reconnecting client would.
+    K = (K + 7) % Keys;
+    M.erase(FirstKey + K);
+    M.set(FirstKey + K, &Value);
+  }
+  auto Churn = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - Begin);
+
+  std::cout << What << " with " << Keys << " keys: "
+            << Lookup.count() / Operations << " ns/lookup, "
+            << Churn.count() / Operations << " ns/erase+set (" << Result
+            << ")\n";
+}
+
+} // namespace
+
+TEST(SmallIndexMapBenchmark, DISABLED_Small)
+{
+  benchmark("Small", 0, SmallSize / 2);
+  benchmark("Small", 0, SmallSize);
+}
+
+TEST(SmallIndexMapBenchmark, DISABLED_Large)
+{
+  benchmark("Large", SmallSize, SmallSize / 2);
+  benchmark("Large", 0, SmallSize * 16);
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/client/Client.hpp"
+#include "monomux/control/Message.hpp"
+#include "monomux/control/PascalString.hpp"
+
+using namespace monomux;
+using namespace monomux::client;
+using namespace monomux::message;
+
+namespace
+{
+
+/// Creates a connected pair of sockets, the first of which is used by the
+/// \p Client under test, and the second plays the role of the server.
+std::pair<Socket, Socket> makeSocketPair()
+{
+  int FDs[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, FDs) == -1)
+    throw std::system_error{errno, std::system_category()};
+  return {Socket::wrap(fd{FDs[0]}, "client"), Socket::wrap(fd{FDs[1]}, "")};
+}
+
+response::Statistics statistics(std::string Contents)
+{
+  response::Statistics Resp;
+  Resp.Contents = std::move(Contents);
+  return Resp;
+}
+
+} // namespace
+
+TEST(ClientRequestQueue, SendsQueuedRequestsTogether)
+{
+  auto [ClientSock, ServerSock] = makeSocketPair();
+  Client C{std::move(ClientSock)};
+
+  // The server's answers are already waiting when the requests are sent.
+  response::SessionList Sessions;
+  Sessions.Sessions.emplace_back();
+  Sessions.Sessions.back().Name = "Foo";
+  sendMessage(ServerSock, Sessions);
+  sendMessage(ServerSock, statistics("Bar"));
+
+  std::vector<std::string> Order;
+  std::size_t FirstID = C.queueRequest(
+    request::SessionList{}, [&Order](std::optional<response::SessionList> R) {
+      ASSERT_TRUE(R.has_value());
+      ASSERT_EQ(R->Sessions.size(), 1);
+      Order.emplace_back(R->Sessions.front().Name);
+    });
+  std::size_t SecondID = C.queueRequest(
+    request::Statistics{}, [&Order](std::optional<response::Statistics> R) {
+      ASSERT_TRUE(R.has_value());
+      Order.emplace_back(R->Contents);
+    });
+  EXPECT_LT(FirstID, SecondID);
+
+  EXPECT_TRUE(C.sendQueuedRequests());
+  EXPECT_EQ(Order, (std::vector<std::string>{"Foo", "Bar"}));
+
+  // Both requests must have arrived to the server, in order.
+  PascalStringReader Reader;
+  std::vector<MessageKind> Kinds;
+  while (Kinds.size() < 2)
+  {
+    Reader.fill(ServerSock);
+    while (std::optional<std::string_view> Frame = Reader.next())
+      Kinds.emplace_back(Message::unpack(*Frame).Kind);
+  }
+  EXPECT_EQ(Kinds,
+            (std::vector<MessageKind>{MessageKind::SessionListRequest,
+                                      MessageKind::StatisticsRequest}));
+}
+
+TEST(ClientRequestQueue, DispatchesInterleavedNotifications)
+{
+  auto [ClientSock, ServerSock] = makeSocketPair();
+  Client C{std::move(ClientSock)};
+
+  std::size_t Notifications = 0;
+  C.registerMessageHandler(
+    static_cast<std::uint16_t>(MessageKind::DetachedNotification),
+    [&Notifications](Client&, std::string_view) { ++Notifications; });
+
+  sendMessage(ServerSock, notification::Detached{});
+  sendMessage(ServerSock, statistics("Foo"));
+
+  std::string Contents;
+  C.queueRequest(request::Statistics{},
+                 [&Contents](std::optional<response::Statistics> R) {
+                   ASSERT_TRUE(R.has_value());
+                   Contents = R->Contents;
+                 });
+  EXPECT_TRUE(C.sendQueuedRequests());
+  EXPECT_EQ(Contents, "Foo");
+  EXPECT_EQ(Notifications, 1);
+}
+
+TEST(ClientRequestQueue, FailsRequestsWithoutResponse)
+{
+  auto [ClientSock, ServerSock] = makeSocketPair();
+  Client C{std::move(ClientSock)};
+
+  sendMessage(ServerSock, statistics("Foo"));
+  ::shutdown(ServerSock.raw(), SHUT_WR);
+
+  std::vector<bool> Received;
+  auto Record = [&Received](std::optional<response::Statistics> R) {
+    Received.emplace_back(R.has_value());
+  };
+  C.queueRequest(request::Statistics{}, Record);
+  C.queueRequest(request::Statistics{}, Record);
+  EXPECT_FALSE(C.sendQueuedRequests());
+  EXPECT_EQ(Received, (std::vector<bool>{true, false}));
+}
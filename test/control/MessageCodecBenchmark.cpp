@@ -0,0 +1,214 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/control/Message.hpp"
+
+/// Microbenchmarks of encoding and decoding every message in both wire
+/// formats. These are disabled by default, run them (preferably in a Release
+/// build) with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='MessageCodecBenchmark.*'
+
+using namespace monomux::message;
+
+namespace
+{
+
+constexpr std::size_t Repetitions = 1 << 18;
+
+/// Fills \p M with values typical of a message sent by a real client or
+/// server. Messages without content are left as they are.
+template <typename T> void populate(T& /* M */) {}
+
+void populate(request::DataSocket& M)
+{
+  M.Client.ID = 42;
+  M.Client.Nonce = 0x1234'5678;
+}
+
+void populate(request::MakeSession& M)
+{
+  M.Name = "session-1";
+  M.SpawnOpts.Program = "/bin/bash";
+  M.SpawnOpts.Arguments = {"--login", "-i"};
+  M.SpawnOpts.SetEnvironment = {{"TERM", "xterm-256color"},
+                                {"LANG", "en_GB.UTF-8"}};
+  M.SpawnOpts.UnsetEnvironment = {"DISPLAY"};
+}
+
+void populate(request::Attach& M) { M.Name = "session-1"; }
+
+void populate(request::Signal& M) { M.SigNum = 28; }
+
+void populate(response::ClientID& M)
+{
+  M.Client.ID = 42;
+  M.Client.Nonce = 0x1234'5678;
+}
+
+void populate(response::Handshake& M)
+{
+  M.Client.ID = 42;
+  M.Client.Nonce = 0x1234'5678;
+  M.Success = true;
+}
+
+void populate(response::SessionList& M)
+{
+  for (int I = 0; I < 8; ++I)
+  {
+    SessionData S;
+    S.Name = "session-" + std::to_string(I);
+    S.Created = 1'650'000'000 + I;
+    M.Sessions.emplace_back(std::move(S));
+  }
+}
+
+void populate(response::MakeSession& M)
+{
+  M.Success = true;
+  M.Name = "session-1";
+}
+
+void populate(response::Attach& M)
+{
+  M.Success = true;
+  M.Session.Name = "session-1";
+  M.Session.Created = 1'650'000'000;
+}
+
+void populate(response::Statistics& M) { M.Contents = std::string(2048, 's'); }
+
+void populate(response::Metrics& M)
+{
+  for (MetricTable* T : {&M.Server, &M.Clients, &M.Sessions})
+  {
+    T->Names = {"bytes_read", "bytes_written", "buffered"};
+    T->Kinds = {MetricTable::Counter, MetricTable::Counter, MetricTable::Gauge};
+    for (int S = 0; S < 4; ++S)
+    {
+      T->Subjects.emplace_back("subject-" + std::to_string(S));
+      for (std::uint64_t V = 0; V < T->Names.size(); ++V)
+        T->Values.emplace_back(V * 1'000'003 + S);
+    }
+  }
+}
+
+void populate(notification::Connection& M)
+{
+  M.Accepted = true;
+  M.BinaryVersion = BinaryWireVersion;
+}
+
+void populate(notification::Detached& M)
+{
+  M.Mode = notification::Detached::Exit;
+  M.ExitCode = 1;
+  M.Reason = "Session exited";
+}
+
+void populate(notification::Redraw& M)
+{
+  M.Rows = 50;
+  M.Columns = 200;
+}
+
+void populate(notification::TerminalMode& M)
+{
+  M.Echo = true;
+  M.Canonical = true;
+}
+
+/// Measures and prints the cost of encoding and decoding \p T in \p Format.
+template <typename T> void benchmark(const char* What, WireFormat Format)
+{
+  T M;
+  populate(M);
+
+  std::size_t Bytes = 0;
+  auto Begin = std::chrono::steady_clock::now();
+  for (std::size_t R = 0; R < Repetitions; ++R)
+    Bytes += encode(M, Format).size();
+  auto Encode = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - Begin);
+
+  const std::string Encoded = encode(M, Format);
+  std::size_t Decoded = 0;
+  Begin = std::chrono::steady_clock::now();
+  for (std::size_t R = 0; R < Repetitions; ++R)
+    Decoded += decode<T>(Encoded).has_value();
+  auto Decode = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - Begin);
+  EXPECT_EQ(Decoded, Repetitions) << What;
+
+  std::cout << What << " (" << (Format == WireFormat::Text ? "text" : "binary")
+            << ", " << Encoded.size()
+            << " bytes): " << Encode.count() / Repetitions << " ns/encode, "
+            << Decode.count() / Repetitions << " ns/decode (" << Bytes
+            << ")\n";
+}
+
+template <typename T> void benchmark(const char* What)
+{
+  benchmark<T>(What, WireFormat::Text);
+  benchmark<T>(What, WireFormat::Binary);
+}
+
+} // namespace
+
+TEST(MessageCodecBenchmark, DISABLED_Requests)
+{
+  benchmark<request::ClientID>("request::ClientID");
+  benchmark<request::DataSocket>("request::DataSocket");
+  benchmark<request::Handshake>("request::Handshake");
+  benchmark<request::SessionList>("request::SessionList");
+  benchmark<request::MakeSession>("request::MakeSession");
+  benchmark<request::Attach>("request::Attach");
+  benchmark<request::Detach>("request::Detach");
+  benchmark<request::Signal>("request::Signal");
+  benchmark<request::Statistics>("request::Statistics");
+  benchmark<request::Metrics>("request::Metrics");
+}
+
+TEST(MessageCodecBenchmark, DISABLED_Responses)
+{
+  benchmark<response::ClientID>("response::ClientID");
+  benchmark<response::DataSocket>("response::DataSocket");
+  benchmark<response::Handshake>("response::Handshake");
+  benchmark<response::SessionList>("response::SessionList");
+  benchmark<response::MakeSession>("response::MakeSession");
+  benchmark<response::Attach>("response::Attach");
+  benchmark<response::Detach>("response::Detach");
+  benchmark<response::Statistics>("response::Statistics");
+  benchmark<response::Metrics>("response::Metrics");
+}
+
+TEST(MessageCodecBenchmark, DISABLED_Notifications)
+{
+  benchmark<notification::Connection>("notification::Connection");
+  benchmark<notification::Detached>("notification::Detached");
+  benchmark<notification::Redraw>("notification::Redraw");
+  benchmark<notification::TerminalMode>("notification::TerminalMode");
+}
@@ -44,6 +44,17 @@ template <typename Msg> static Msg codec(const Msg& M)
   return *Decode;
 }
 
+template <typename Msg> static Msg binaryCodec(const Msg& M)
+{
+  using namespace monomux::message;
+
+  std::string Data = monomux::message::encode(M, WireFormat::Binary);
+  EXPECT_EQ(Message::unpack(Data).format(), WireFormat::Binary);
+  std::optional<Msg> Decode = decode<Msg>(Data);
+  EXPECT_TRUE(Decode && "Decoding just encoded message should succeed!");
+  return *Decode;
+}
+
 TEST(ControlMessageSerialisation, ConnectionNotification)
 {
   monomux::message::notification::Connection Obj;
@@ -66,6 +77,13 @@ TEST(ControlMessageSerialisation, ConnectionNotification)
   Obj.Accepted = true;
   EXPECT_EQ(encode(Obj), "<CONNECTION><TRUE /></CONNECTION>");
   EXPECT_EQ(codec(Obj).Accepted, true);
+  EXPECT_EQ(codec(Obj).BinaryVersion, 0);
+
+  Obj.BinaryVersion = 1;
+  EXPECT_EQ(encode(Obj),
+            "<CONNECTION><TRUE /><WIRE Version=\"1\" /></CONNECTION>");
+  EXPECT_EQ(codec(Obj).Accepted, true);
+  EXPECT_EQ(codec(Obj).BinaryVersion, 1);
 }
 
 TEST(ControlMessageSerialisation, ClientIDRequest)
@@ -122,6 +140,55 @@ TEST(ControlMessageSerialisation, DataSocketRespons)
   }
 }
 
+TEST(ControlMessageSerialisation, HandshakeRequest)
+{
+  EXPECT_EQ(encode(monomux::message::request::Handshake{}), "<HANDSHAKE />");
+
+  monomux::message::request::Handshake Obj;
+  Obj.Multiplexed = true;
+  EXPECT_EQ(encode(Obj), "<HANDSHAKE><TRUE /></HANDSHAKE>");
+  EXPECT_TRUE(codec(Obj).Multiplexed);
+  EXPECT_FALSE(codec(Obj).Compressed);
+
+  Obj.Multiplexed = false;
+  Obj.Compressed = true;
+  EXPECT_EQ(encode(Obj), "<HANDSHAKE><FALSE /><COMPRESSED /></HANDSHAKE>");
+  EXPECT_FALSE(codec(Obj).Multiplexed);
+  EXPECT_TRUE(codec(Obj).Compressed);
+  EXPECT_FALSE(codec(Obj).SharedRing);
+
+  Obj.Compressed = false;
+  Obj.SharedRing = true;
+  EXPECT_EQ(encode(Obj), "<HANDSHAKE><FALSE /><SHARED-RING /></HANDSHAKE>");
+  EXPECT_FALSE(codec(Obj).Compressed);
+  EXPECT_TRUE(codec(Obj).SharedRing);
+}
+
+TEST(ControlMessageSerialisation, HandshakeResponse)
+{
+  monomux::message::response::Handshake Obj;
+  Obj.Client.ID = 2;
+  Obj.Client.Nonce = 3;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj),
+            "<HANDSHAKE><CLIENT><ID>2</ID><NONCE>3</NONCE></CLIENT>"
+            "<TRUE /><FALSE /><FALSE /></HANDSHAKE>");
+
+  auto Decode = codec(Obj);
+  EXPECT_EQ(Obj.Client.ID, Decode.Client.ID);
+  EXPECT_EQ(Obj.Client.Nonce, Decode.Client.Nonce);
+  EXPECT_EQ(Obj.Success, Decode.Success);
+  EXPECT_EQ(Obj.Multiplexed, Decode.Multiplexed);
+  EXPECT_EQ(Obj.Compressed, Decode.Compressed);
+  EXPECT_FALSE(Decode.SharedRing);
+
+  Obj.SharedRing = true;
+  EXPECT_EQ(encode(Obj),
+            "<HANDSHAKE><CLIENT><ID>2</ID><NONCE>3</NONCE></CLIENT>"
+            "<TRUE /><FALSE /><FALSE /><SHARED-RING /></HANDSHAKE>");
+  EXPECT_TRUE(codec(Obj).SharedRing);
+}
+
 TEST(ControlMessageSerialisation, SessionListRequest)
 {
   EXPECT_EQ(encode(monomux::message::request::SessionList{}),
@@ -161,6 +228,57 @@ TEST(ControlMessageSerialisation, SessionListResponse)
   }
 }
 
+TEST(ControlMessageSerialisation, SessionSubscribeRequest)
+{
+  using namespace monomux::message::request;
+  SessionSubscribe Obj;
+  EXPECT_EQ(encode(Obj), "<SESSION-UNSUBSCRIBE />");
+  EXPECT_FALSE(codec(Obj).Subscribe);
+
+  Obj.Subscribe = true;
+  Obj.KnownGeneration = 4;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<SESSION-SUBSCRIBE><GENERATION>4</GENERATION>"
+              "</SESSION-SUBSCRIBE>");
+    EXPECT_TRUE(Decode.Subscribe);
+    EXPECT_EQ(Decode.KnownGeneration, 4);
+  }
+}
+
+TEST(ControlMessageSerialisation, SessionSubscribeResponse)
+{
+  monomux::message::response::SessionSubscribe Obj;
+  Obj.Generation = 7;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<SESSION-SUBSCRIBE Generation=\"7\"><FALSE />"
+              "</SESSION-SUBSCRIBE>");
+    EXPECT_EQ(Decode.Generation, 7);
+    EXPECT_FALSE(Decode.Snapshot);
+  }
+
+  Obj.Snapshot = true;
+  Obj.Sessions.push_back({});
+  Obj.Sessions.at(0).Session.Name = "Foo";
+  Obj.Sessions.at(0).Session.Created = 1;
+  Obj.Sessions.at(0).AttachedClients = 2;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<SESSION-SUBSCRIBE Generation=\"7\"><TRUE />"
+              "<SESSIONS Count=\"1\"><SESSION-STATUS><SESSION><NAME>Foo</NAME>"
+              "<CREATED>1</CREATED></SESSION><CLIENTS>2</CLIENTS>"
+              "</SESSION-STATUS></SESSIONS></SESSION-SUBSCRIBE>");
+    EXPECT_TRUE(Decode.Snapshot);
+    ASSERT_EQ(Decode.Sessions.size(), 1);
+    EXPECT_EQ(Decode.Sessions.at(0).Session.Name, "Foo");
+    EXPECT_EQ(Decode.Sessions.at(0).AttachedClients, 2);
+  }
+}
+
 TEST(ControlMessageSerialisation, MakeSessionRequest)
 {
   monomux::message::request::MakeSession Obj;
@@ -250,6 +368,18 @@ TEST(ControlMessageSerialisation, AttachRequest)
   {
     auto Decode = codec(Obj);
     EXPECT_EQ(Decode.Name, "Bar");
+    EXPECT_FALSE(Decode.ReadOnly);
+  }
+
+  Obj.ReadOnly = true;
+
+  EXPECT_EQ(encode(Obj), "<ATTACH><NAME>Bar</NAME><READ-ONLY /></ATTACH>");
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.Name, "Bar");
+    EXPECT_TRUE(Decode.ReadOnly);
+    EXPECT_TRUE(binaryCodec(Obj).ReadOnly);
   }
 }
 
@@ -277,6 +407,24 @@ TEST(ControlMessageSerialisation, AttachResponse)
     EXPECT_TRUE(Decode.Success);
     EXPECT_EQ(Decode.Session.Name, Obj.Session.Name);
     EXPECT_EQ(Decode.Session.Created, Obj.Session.Created);
+    EXPECT_FALSE(Decode.Replayed);
+  }
+
+  Obj.Replayed = true;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_TRUE(Decode.Replayed);
+    EXPECT_FALSE(Decode.SharedRing);
+  }
+
+  Obj.SharedRing = true;
+  Obj.RingSlot = 7;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_TRUE(Decode.Replayed);
+    EXPECT_TRUE(Decode.SharedRing);
+    EXPECT_EQ(Decode.RingSlot, 7);
   }
 }
 
@@ -357,6 +505,54 @@ TEST(ControlMessageSerialisation, RedrawNotification)
   }
 }
 
+TEST(ControlMessageSerialisation, TerminalModeNotification)
+{
+  monomux::message::notification::TerminalMode Obj;
+  Obj.Echo = true;
+  Obj.Canonical = false;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<TERMINAL-MODE><ECHO><TRUE /></ECHO>"
+              "<CANONICAL><FALSE /></CANONICAL></TERMINAL-MODE>");
+    EXPECT_TRUE(Decode.Echo);
+    EXPECT_FALSE(Decode.Canonical);
+  }
+  {
+    auto Decode = binaryCodec(Obj);
+    EXPECT_TRUE(Decode.Echo);
+    EXPECT_FALSE(Decode.Canonical);
+  }
+}
+
+TEST(ControlMessageSerialisation, SessionChangeNotification)
+{
+  using namespace monomux::message::notification;
+  SessionChange Obj;
+  Obj.Change = SessionChange::Attachment;
+  Obj.Generation = 3;
+  Obj.Session.Session.Name = "Foo";
+  Obj.Session.Session.Created = 1;
+  Obj.Session.AttachedClients = 1;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<SESSION-CHANGE Generation=\"3\"><MODE>Attachment</MODE>"
+              "<SESSION-STATUS><SESSION><NAME>Foo</NAME>"
+              "<CREATED>1</CREATED></SESSION><CLIENTS>1</CLIENTS>"
+              "</SESSION-STATUS></SESSION-CHANGE>");
+    EXPECT_EQ(Decode.Change, SessionChange::Attachment);
+    EXPECT_EQ(Decode.Generation, 3);
+    EXPECT_EQ(Decode.Session.Session.Name, "Foo");
+    EXPECT_EQ(Decode.Session.AttachedClients, 1);
+  }
+
+  Obj.Change = SessionChange::Destroyed;
+  EXPECT_EQ(codec(Obj).Change, SessionChange::Destroyed);
+}
+
 TEST(ControlMessageSerialisation, StatisticsRequest)
 {
   monomux::message::request::Statistics Obj;
@@ -374,3 +570,455 @@ TEST(ControlMessageSerialisation, StatisticsResponse)
     EXPECT_EQ(Decode.Contents, Obj.Contents);
   }
 }
+
+TEST(ControlMessageSerialisation, MetricsRequest)
+{
+  monomux::message::request::Metrics Obj;
+  EXPECT_EQ(encode(Obj), "<SEND-METRICS />");
+}
+
+TEST(ControlMessageSerialisation, MetricsResponse)
+{
+  monomux::message::response::Metrics Obj;
+  Obj.Server.Names = {"clients"};
+  Obj.Server.Kinds = {monomux::message::MetricTable::Gauge};
+  Obj.Server.Subjects = {"server"};
+  Obj.Server.Values = {2};
+  Obj.Clients.Names = {"bytes_read", "bytes_written"};
+  Obj.Clients.Kinds = {monomux::message::MetricTable::Counter,
+                       monomux::message::MetricTable::Counter};
+  Obj.Clients.Subjects = {"1", "2"};
+  Obj.Clients.Values = {10, 20, 30, 40};
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(
+      encode(Obj),
+      "<METRICS><SERVER><METRIC-TABLE>"
+      "<NAMES Count=\"1\"><NAME Size=\"7\">clients</NAME></NAMES>"
+      "<KINDS Count=\"1\">1;</KINDS>"
+      "<SUBJECTS Count=\"1\"><SUBJECT Size=\"6\">server</SUBJECT></SUBJECTS>"
+      "<VALUES Count=\"1\">2;</VALUES>"
+      "</METRIC-TABLE></SERVER><CLIENTS><METRIC-TABLE>"
+      "<NAMES Count=\"2\"><NAME Size=\"10\">bytes_read</NAME>"
+      "<NAME Size=\"13\">bytes_written</NAME></NAMES>"
+      "<KINDS Count=\"2\">0;0;</KINDS>"
+      "<SUBJECTS Count=\"2\"><SUBJECT Size=\"1\">1</SUBJECT>"
+      "<SUBJECT Size=\"1\">2</SUBJECT></SUBJECTS>"
+      "<VALUES Count=\"4\">10;20;30;40;</VALUES>"
+      "</METRIC-TABLE></CLIENTS><SESSIONS><METRIC-TABLE>"
+      "<NAMES Count=\"0\"></NAMES><KINDS Count=\"0\"></KINDS>"
+      "<SUBJECTS Count=\"0\"></SUBJECTS>"
+      "<VALUES Count=\"0\"></VALUES>"
+      "</METRIC-TABLE></SESSIONS></METRICS>");
+    EXPECT_EQ(Decode.Server.Names, Obj.Server.Names);
+    EXPECT_EQ(Decode.Server.Kinds, Obj.Server.Kinds);
+    EXPECT_EQ(Decode.Server.at(0, 0), 2);
+    EXPECT_EQ(Decode.Clients.Names, Obj.Clients.Names);
+    EXPECT_EQ(Decode.Clients.Subjects, Obj.Clients.Subjects);
+    EXPECT_EQ(Decode.Clients.at(1, 0), 30);
+    EXPECT_TRUE(Decode.Sessions.Names.empty());
+    EXPECT_TRUE(Decode.Sessions.Values.empty());
+  }
+}
+
+TEST(ControlMessageSerialisation, FramingInPlace)
+{
+  using namespace monomux::message;
+  request::Attach Obj;
+  Obj.Name = "Foo";
+
+  std::string Raw;
+  request::Attach::encode(Raw, Obj);
+  Message MB;
+  MB.Kind = request::Attach::Kind;
+  MB.RawData = Raw;
+  EXPECT_EQ(monomux::message::encode(Obj), MB.pack());
+  EXPECT_EQ(monomux::message::encodeWithSize(Obj),
+            Message::sizeToBinaryString(MB.pack().size()) + MB.pack());
+
+  std::string Buffer = "Prefix";
+  frameInto(Buffer, Obj, WireFormat::Text, /* WithSize =*/true);
+  EXPECT_EQ(Buffer, "Prefix" + monomux::message::encodeWithSize(Obj));
+}
+
+TEST(ControlMessageSerialisation, UsageRequest)
+{
+  monomux::message::request::Usage Obj;
+  EXPECT_EQ(encode(Obj), "<SEND-USAGE />");
+}
+
+TEST(ControlMessageSerialisation, UsageResponse)
+{
+  monomux::message::response::Usage Obj;
+  Obj.IntervalMs = 2000;
+  Obj.Sessions.push_back({});
+  Obj.Sessions.at(0).Name = "Foo";
+  Obj.Sessions.at(0).PID = -1;
+  Obj.Sessions.at(0).OutputBytes = 4096;
+  Obj.Sessions.at(0).OutputRate = 2048;
+  Obj.Sessions.at(0).OutputBufferPeak = 512;
+  Obj.Sessions.at(0).InputBytes = 3;
+  Obj.Sessions.at(0).CPUPermille = 125;
+  Obj.Sessions.at(0).RSSBytes = 1 << 20;
+  Obj.Sessions.at(0).Clients = {1, 2};
+  Obj.Sessions.at(0).ClientBufferedBytes = {0, 64};
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(encode(Obj),
+              "<USAGE Interval=\"2000\" Count=\"1\"><SESSION-USAGE>"
+              "<NAME Size=\"3\">Foo</NAME><PID>-1</PID>"
+              "<OUTPUT Bytes=\"4096\" Rate=\"2048\" Peak=\"512\" />"
+              "<INPUT Bytes=\"3\" />"
+              "<PROCESS CPU=\"125\" RSS=\"1048576\" />"
+              "<CLIENTS Count=\"2\">1:0;2:64;</CLIENTS>"
+              "</SESSION-USAGE></USAGE>");
+    EXPECT_EQ(Decode.IntervalMs, 2000);
+    ASSERT_EQ(Decode.Sessions.size(), 1);
+    EXPECT_EQ(Decode.Sessions.at(0).Name, "Foo");
+    EXPECT_EQ(Decode.Sessions.at(0).PID, -1);
+    EXPECT_EQ(Decode.Sessions.at(0).OutputRate, 2048);
+    EXPECT_EQ(Decode.Sessions.at(0).CPUPermille, 125);
+    EXPECT_EQ(Decode.Sessions.at(0).Clients, Obj.Sessions.at(0).Clients);
+    EXPECT_EQ(Decode.Sessions.at(0).ClientBufferedBytes,
+              Obj.Sessions.at(0).ClientBufferedBytes);
+  }
+}
+
+TEST(ControlMessageSerialisation, WatchRequest)
+{
+  monomux::message::request::Watch Obj;
+  Obj.Name = "Foo";
+
+  EXPECT_EQ(encode(Obj), "<WATCH><NAME>Foo</NAME></WATCH>");
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_FALSE(Decode.Stop);
+  }
+
+  Obj.Stop = true;
+  EXPECT_EQ(encode(Obj), "<UNWATCH><NAME>Foo</NAME></UNWATCH>");
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_TRUE(Decode.Stop);
+  }
+}
+
+TEST(ControlMessageSerialisation, WatchResponse)
+{
+  monomux::message::response::Watch Obj;
+  Obj.Success = true;
+  Obj.Session.Name = "Foo";
+  Obj.Session.Created = 1;
+  Obj.Tag = 3;
+  Obj.Replayed = true;
+
+  auto Decode = codec(Obj);
+  EXPECT_TRUE(Decode.Success);
+  EXPECT_EQ(Decode.Session.Name, "Foo");
+  EXPECT_EQ(Decode.Session.Created, 1);
+  EXPECT_EQ(Decode.Tag, 3);
+  EXPECT_TRUE(Decode.Replayed);
+}
+
+TEST(ControlMessageBinarySerialisation, FormatDetection)
+{
+  using namespace monomux::message;
+  request::Attach Obj;
+  Obj.Name = "Foo";
+
+  std::string Text = monomux::message::encode(Obj);
+  std::string Binary = monomux::message::encode(Obj, WireFormat::Binary);
+  EXPECT_EQ(Message::unpack(Text).format(), WireFormat::Text);
+  EXPECT_EQ(Message::unpack(Binary).format(), WireFormat::Binary);
+  EXPECT_LT(Binary.size(), Text.size());
+
+  EXPECT_EQ(decode<request::Attach>(Text)->Name, "Foo");
+  EXPECT_EQ(decode<request::Attach>(Binary)->Name, "Foo");
+}
+
+TEST(ControlMessageBinarySerialisation, RejectsMalformed)
+{
+  using namespace monomux::message;
+  request::MakeSession Obj;
+  Obj.Name = "Foo";
+  Obj.SpawnOpts.Program = "/bin/bash";
+  Obj.SpawnOpts.Arguments.emplace_back("--norc");
+
+  std::string Raw = request::MakeSession::encodeBinary(Obj);
+  ASSERT_TRUE(request::MakeSession::decode(Raw));
+
+  for (std::size_t I = 0; I < Raw.size(); ++I)
+    EXPECT_FALSE(request::MakeSession::decode(Raw.substr(0, I)))
+      << "Truncated to " << I << " bytes";
+  EXPECT_FALSE(request::MakeSession::decode(Raw + '\0'));
+
+  std::string FutureVersion = Raw;
+  FutureVersion.front() = static_cast<char>(BinaryWireVersion + 1);
+  EXPECT_FALSE(request::MakeSession::decode(FutureVersion));
+}
+
+TEST(ControlMessageBinarySerialisation, Requests)
+{
+  using namespace monomux::message::request;
+  binaryCodec(ClientID{});
+  binaryCodec(Handshake{});
+  {
+    Handshake Obj;
+    Obj.Multiplexed = true;
+    Obj.Compressed = true;
+    Obj.SharedRing = true;
+    EXPECT_TRUE(binaryCodec(Obj).Multiplexed);
+    EXPECT_TRUE(binaryCodec(Obj).Compressed);
+    EXPECT_TRUE(binaryCodec(Obj).SharedRing);
+  }
+  binaryCodec(SessionList{});
+  binaryCodec(Statistics{});
+  binaryCodec(Metrics{});
+  binaryCodec(Usage{});
+
+  {
+    DataSocket Obj;
+    Obj.Client.ID = 4;
+    Obj.Client.Nonce = static_cast<std::size_t>(-1);
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Client.ID, 4);
+    EXPECT_EQ(Decode.Client.Nonce, static_cast<std::size_t>(-1));
+  }
+  {
+    MakeSession Obj;
+    Obj.Name = "Foo";
+    Obj.SpawnOpts.Program = "/bin/bash";
+    Obj.SpawnOpts.Arguments.emplace_back("--norc");
+    Obj.SpawnOpts.Arguments.emplace_back("");
+    Obj.SpawnOpts.SetEnvironment.emplace_back("SHLVL", "8");
+    Obj.SpawnOpts.UnsetEnvironment.emplace_back("TERM");
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_EQ(Decode.SpawnOpts.Program, "/bin/bash");
+    EXPECT_EQ(Decode.SpawnOpts.Arguments, Obj.SpawnOpts.Arguments);
+    EXPECT_EQ(Decode.SpawnOpts.SetEnvironment, Obj.SpawnOpts.SetEnvironment);
+    EXPECT_EQ(Decode.SpawnOpts.UnsetEnvironment,
+              Obj.SpawnOpts.UnsetEnvironment);
+  }
+  {
+    Attach Obj;
+    Obj.Name = std::string{"With\0Zero", 9};
+    EXPECT_EQ(binaryCodec(Obj).Name, Obj.Name);
+  }
+  {
+    Detach Obj;
+    Obj.Mode = Detach::All;
+    EXPECT_EQ(binaryCodec(Obj).Mode, Detach::All);
+  }
+  {
+    Signal Obj;
+    Obj.SigNum = -1;
+    EXPECT_EQ(binaryCodec(Obj).SigNum, -1);
+  }
+  {
+    SessionSubscribe Obj;
+    Obj.Subscribe = true;
+    Obj.KnownGeneration = static_cast<std::uint64_t>(-1);
+    auto Decode = binaryCodec(Obj);
+    EXPECT_TRUE(Decode.Subscribe);
+    EXPECT_EQ(Decode.KnownGeneration, Obj.KnownGeneration);
+  }
+  {
+    Watch Obj;
+    Obj.Name = "Foo";
+    Obj.Stop = true;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_TRUE(Decode.Stop);
+  }
+}
+
+TEST(ControlMessageBinarySerialisation, Responses)
+{
+  using namespace monomux::message::response;
+  binaryCodec(Detach{});
+
+  {
+    ClientID Obj;
+    Obj.Client.ID = 4;
+    Obj.Client.Nonce = 2;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Client.ID, 4);
+    EXPECT_EQ(Decode.Client.Nonce, 2);
+  }
+  {
+    DataSocket Obj;
+    Obj.Success = true;
+    EXPECT_TRUE(binaryCodec(Obj).Success);
+  }
+  {
+    Handshake Obj;
+    Obj.Client.ID = 4;
+    Obj.Client.Nonce = 2;
+    Obj.Success = false;
+    Obj.Multiplexed = true;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Client.ID, 4);
+    EXPECT_EQ(Decode.Client.Nonce, 2);
+    EXPECT_FALSE(Decode.Success);
+    EXPECT_TRUE(Decode.Multiplexed);
+    EXPECT_FALSE(Decode.Compressed);
+  }
+  {
+    SessionList Obj;
+    EXPECT_TRUE(binaryCodec(Obj).Sessions.empty());
+    Obj.Sessions.push_back({});
+    Obj.Sessions.at(0).Name = "Foo";
+    Obj.Sessions.at(0).Created = 1;
+    Obj.Sessions.push_back({});
+    Obj.Sessions.at(1).Name = "Bar";
+    Obj.Sessions.at(1).Created = -1;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Sessions.size(), 2);
+    EXPECT_EQ(Decode.Sessions.at(0).Name, "Foo");
+    EXPECT_EQ(Decode.Sessions.at(0).Created, 1);
+    EXPECT_EQ(Decode.Sessions.at(1).Name, "Bar");
+    EXPECT_EQ(Decode.Sessions.at(1).Created, -1);
+  }
+  {
+    MakeSession Obj;
+    Obj.Success = true;
+    Obj.Name = "Foo";
+    auto Decode = binaryCodec(Obj);
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_EQ(Decode.Name, "Foo");
+  }
+  {
+    Attach Obj;
+    Obj.Success = false;
+    EXPECT_FALSE(binaryCodec(Obj).Success);
+    Obj.Success = true;
+    Obj.Session.Name = "Foo";
+    Obj.SharedRing = true;
+    Obj.RingSlot = 31;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_EQ(Decode.Session.Name, "Foo");
+    EXPECT_TRUE(Decode.SharedRing);
+    EXPECT_EQ(Decode.RingSlot, 31);
+  }
+  {
+    Statistics Obj;
+    Obj.Contents = "Foo\nBar";
+    EXPECT_EQ(binaryCodec(Obj).Contents, Obj.Contents);
+  }
+  {
+    Metrics Obj;
+    Obj.Sessions.Names = {"bytes_read"};
+    Obj.Sessions.Kinds = {monomux::message::MetricTable::Histogram};
+    Obj.Sessions.Subjects = {"Foo"};
+    Obj.Sessions.Values = {static_cast<std::uint64_t>(-1)};
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Sessions.Subjects, Obj.Sessions.Subjects);
+    EXPECT_EQ(Decode.Sessions.Kinds, Obj.Sessions.Kinds);
+    EXPECT_EQ(Decode.Sessions.at(0, 0), static_cast<std::uint64_t>(-1));
+    EXPECT_TRUE(Decode.Clients.Values.empty());
+  }
+  {
+    SessionSubscribe Obj;
+    Obj.Generation = 9;
+    Obj.Snapshot = true;
+    Obj.Sessions.push_back({});
+    Obj.Sessions.at(0).Session.Name = "Foo";
+    Obj.Sessions.at(0).AttachedClients = 3;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Generation, 9);
+    EXPECT_TRUE(Decode.Snapshot);
+    ASSERT_EQ(Decode.Sessions.size(), 1);
+    EXPECT_EQ(Decode.Sessions.at(0).Session.Name, "Foo");
+    EXPECT_EQ(Decode.Sessions.at(0).AttachedClients, 3);
+  }
+  {
+    Usage Obj;
+    Obj.Sessions.push_back({});
+    Obj.Sessions.at(0).Name = "Foo";
+    Obj.Sessions.at(0).PID = 42;
+    Obj.Sessions.at(0).RSSBytes = static_cast<std::uint64_t>(-1);
+    Obj.Sessions.at(0).Clients = {7};
+    Obj.Sessions.at(0).ClientBufferedBytes = {9};
+    auto Decode = binaryCodec(Obj);
+    ASSERT_EQ(Decode.Sessions.size(), 1);
+    EXPECT_EQ(Decode.Sessions.at(0).PID, 42);
+    EXPECT_EQ(Decode.Sessions.at(0).RSSBytes, Obj.Sessions.at(0).RSSBytes);
+    EXPECT_EQ(Decode.Sessions.at(0).ClientBufferedBytes.at(0), 9);
+  }
+  {
+    Watch Obj;
+    Obj.Success = true;
+    Obj.Session.Name = "Foo";
+    Obj.Tag = static_cast<std::uint32_t>(-1);
+    auto Decode = binaryCodec(Obj);
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_EQ(Decode.Session.Name, "Foo");
+    EXPECT_EQ(Decode.Tag, Obj.Tag);
+    EXPECT_FALSE(Decode.Replayed);
+  }
+}
+
+TEST(ControlMessageBinarySerialisation, Notifications)
+{
+  using namespace monomux::message::notification;
+  {
+    Connection Obj;
+    Obj.Accepted = false;
+    Obj.Reason = "Bad intent";
+    auto Decode = binaryCodec(Obj);
+    EXPECT_FALSE(Decode.Accepted);
+    EXPECT_EQ(Decode.Reason, "Bad intent");
+  }
+  {
+    Detached Obj;
+    Obj.Mode = Detached::Exit;
+    Obj.ExitCode = 2;
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Mode, Detached::Exit);
+    EXPECT_EQ(Decode.ExitCode, 2);
+  }
+  {
+    Redraw Obj;
+    Obj.Columns = 80; // NOLINT(readability-magic-numbers)
+    Obj.Rows = 24;    // NOLINT(readability-magic-numbers)
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Rows, Obj.Rows);
+    EXPECT_EQ(Decode.Columns, Obj.Columns);
+  }
+  {
+    SessionChange Obj;
+    Obj.Change = SessionChange::Created;
+    Obj.Generation = 2;
+    Obj.Session.Session.Name = "Foo";
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Change, SessionChange::Created);
+    EXPECT_EQ(Decode.Generation, 2);
+    EXPECT_EQ(Decode.Session.Session.Name, "Foo");
+  }
+}
+
+TEST(ControlMessageBinarySerialisation, PrecomputedSizeAndFraming)
+{
+  using namespace monomux::message;
+  request::MakeSession Obj;
+  Obj.Name = "Foo";
+  Obj.SpawnOpts.Program = "/bin/bash";
+  Obj.SpawnOpts.Arguments.emplace_back("--norc");
+  Obj.SpawnOpts.SetEnvironment.emplace_back("SHLVL", "8");
+
+  std::string Raw = request::MakeSession::encodeBinary(Obj);
+  EXPECT_EQ(Raw.size(), sizeof(BinaryWireVersion) + binary::sizeOf(Obj));
+
+  Message MB;
+  MB.Kind = request::MakeSession::Kind;
+  MB.RawData = Raw;
+  EXPECT_EQ(monomux::message::encode(Obj, WireFormat::Binary), MB.pack());
+  EXPECT_EQ(monomux::message::encodeWithSize(Obj, WireFormat::Binary),
+            Message::sizeToBinaryString(MB.pack().size()) + MB.pack());
+}
@@ -0,0 +1,122 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/control/Message.hpp"
+#include "monomux/control/PascalString.hpp"
+#include "monomux/system/Pipe.hpp"
+
+using namespace monomux;
+using namespace monomux::message;
+
+namespace
+{
+
+/// Creates an anonymous pipe with non-blocking ends.
+Pipe::AnonymousPipe makePipe()
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  P.getRead()->setNonblocking();
+  P.getWrite()->setNonblocking();
+  return P;
+}
+
+std::string attachFrame(std::string Name)
+{
+  request::Attach Msg;
+  Msg.Name = std::move(Name);
+  return encodeWithSize(Msg);
+}
+
+std::string nameOf(std::string_view Frame)
+{
+  std::optional<request::Attach> Msg = decode<request::Attach>(Frame);
+  EXPECT_TRUE(Msg.has_value());
+  return Msg ? Msg->Name : std::string{};
+}
+
+} // namespace
+
+TEST(PascalStringReader, KeepsPartialFramesBetweenFills)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  PascalStringReader Reader;
+  const std::string Frame = attachFrame("Foo");
+
+  // Deliver the frame in pieces smaller than the size prefix.
+  for (std::size_t I = 0; I < Frame.size(); I += 3)
+  {
+    P.getWrite()->write(Frame.substr(I, 3));
+    Reader.fill(*P.getRead());
+    if (I + 3 < Frame.size())
+    {
+      EXPECT_FALSE(Reader.next().has_value()) << "Incomplete at " << I;
+    }
+  }
+
+  std::optional<std::string_view> Complete = Reader.next();
+  ASSERT_TRUE(Complete.has_value());
+  EXPECT_EQ(nameOf(*Complete), "Foo");
+  EXPECT_FALSE(Reader.next().has_value());
+}
+
+TEST(PascalStringReader, ExtractsPipelinedFrames)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  PascalStringReader Reader;
+  const std::string Third = attachFrame("Baz");
+
+  P.getWrite()->write(attachFrame("Foo") + attachFrame("Bar") +
+                      Third.substr(0, Third.size() / 2));
+  Reader.fill(*P.getRead());
+
+  std::optional<std::string_view> Frame = Reader.next();
+  ASSERT_TRUE(Frame.has_value());
+  EXPECT_EQ(nameOf(*Frame), "Foo");
+  Frame = Reader.next();
+  ASSERT_TRUE(Frame.has_value());
+  EXPECT_EQ(nameOf(*Frame), "Bar");
+  EXPECT_FALSE(Reader.next().has_value());
+
+  P.getWrite()->write(Third.substr(Third.size() / 2));
+  Reader.fill(*P.getRead());
+  Frame = Reader.next();
+  ASSERT_TRUE(Frame.has_value());
+  EXPECT_EQ(nameOf(*Frame), "Baz");
+  EXPECT_FALSE(Reader.next().has_value());
+}
+
+TEST(PascalStringReader, StopsOnCorruptSize)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  PascalStringReader Reader;
+
+  const std::size_t BogusSize = -1;
+  P.getWrite()->write(Message::sizeToBinaryString(BogusSize) +
+                      attachFrame("Foo"));
+  Reader.fill(*P.getRead());
+  EXPECT_FALSE(Reader.next().has_value());
+  EXPECT_TRUE(Reader.corrupted());
+
+  P.getWrite()->write(attachFrame("Bar"));
+  Reader.fill(*P.getRead());
+  EXPECT_FALSE(Reader.next().has_value());
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/control/SessionFrame.hpp"
+
+using namespace monomux::message;
+
+namespace
+{
+
+std::string frame(std::uint32_t Tag, std::string_view Data)
+{
+  char Header[SessionFrame::HeaderSize];
+  SessionFrame::encodeHeader(
+    Header, Tag, static_cast<std::uint32_t>(Data.size()));
+  std::string Frame{Header, SessionFrame::HeaderSize};
+  Frame.append(Data);
+  return Frame;
+}
+
+} // namespace
+
+TEST(SessionFrame, HeaderIsLittleEndian)
+{
+  char Header[SessionFrame::HeaderSize];
+  SessionFrame::encodeHeader(Header, 0x01020304, 0x0A0B);
+  EXPECT_EQ(std::string(Header, SessionFrame::HeaderSize),
+            std::string("\x04\x03\x02\x01\x0B\x0A\x00\x00", 8));
+}
+
+TEST(SessionFrameReader, SplitsInterleavedSessions)
+{
+  SessionFrameReader R;
+  R.append(frame(1, "first") + frame(2, "second") + frame(1, "third"));
+
+  std::optional<SessionFrame> F = R.next();
+  ASSERT_TRUE(F);
+  EXPECT_EQ(F->Tag, 1);
+  EXPECT_EQ(F->Data, "first");
+  F = R.next();
+  ASSERT_TRUE(F);
+  EXPECT_EQ(F->Tag, 2);
+  EXPECT_EQ(F->Data, "second");
+  F = R.next();
+  ASSERT_TRUE(F);
+  EXPECT_EQ(F->Tag, 1);
+  EXPECT_EQ(F->Data, "third");
+  EXPECT_FALSE(R.next());
+  EXPECT_FALSE(R.hasPartial());
+}
+
+TEST(SessionFrameReader, KeepsPartialFramesBetweenAppends)
+{
+  SessionFrameReader R;
+  const std::string Data = frame(7, "output") + frame(7, {});
+
+  R.append(Data.substr(0, 3));
+  EXPECT_FALSE(R.next());
+  R.append(Data.substr(3, 10));
+  EXPECT_FALSE(R.next());
+  EXPECT_TRUE(R.hasPartial());
+  R.append(Data.substr(13));
+
+  std::optional<SessionFrame> F = R.next();
+  ASSERT_TRUE(F);
+  EXPECT_EQ(F->Tag, 7);
+  EXPECT_EQ(F->Data, "output");
+  // The end of the output of the session.
+  F = R.next();
+  ASSERT_TRUE(F);
+  EXPECT_EQ(F->Tag, 7);
+  EXPECT_TRUE(F->Data.empty());
+  EXPECT_FALSE(R.hasPartial());
+}
@@ -0,0 +1,110 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/HandOver.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+static HandOverState makeState()
+{
+  HandOverState State;
+  State.SocketPath = "/tmp/mm.sock";
+  State.SocketFD = 3;
+  State.MetricsSocketFD = fd::Invalid;
+  State.SessionPoolSpawned = 2;
+  State.SessionGeneration = 17;
+
+  HandedOverSession S;
+  S.Name = "shell";
+  S.Alias = "pool-1";
+  S.Created = 1700000000;
+  S.PID = 1234;
+  S.PtyFD = 5;
+  S.PtyName = "/dev/pts/7";
+  S.Output = std::string{"out\0put", 7};
+  S.Recent = "$ ";
+  State.Sessions.push_back(S);
+
+  HandedOverClient C;
+  C.Identifier = "/tmp/mm.sock:6";
+  C.ControlFD = 6;
+  C.DataFD = 7;
+  C.BinaryWire = true;
+  C.Multiplexed = false;
+  C.Compressed = false;
+  C.ReadOnly = true;
+  C.SessionSubscriber = true;
+  C.HasSize = true;
+  C.Rows = 24;
+  C.Columns = 80;
+  C.Session = "shell";
+  C.ControlInput = "12 partial";
+  C.DataOutput = "pending";
+  State.Clients.push_back(C);
+  return State;
+}
+
+static void expectSame(const HandOverState& L, const HandOverState& R)
+{
+  EXPECT_EQ(L.SocketPath, R.SocketPath);
+  EXPECT_EQ(L.SocketFD, R.SocketFD);
+  EXPECT_EQ(L.MetricsSocketFD, R.MetricsSocketFD);
+  EXPECT_EQ(L.SessionPoolSpawned, R.SessionPoolSpawned);
+  EXPECT_EQ(L.SessionGeneration, R.SessionGeneration);
+  ASSERT_EQ(L.Sessions.size(), R.Sessions.size());
+  EXPECT_EQ(L.Sessions.at(0).Alias, R.Sessions.at(0).Alias);
+  EXPECT_EQ(L.Sessions.at(0).Created, R.Sessions.at(0).Created);
+  EXPECT_EQ(L.Sessions.at(0).PID, R.Sessions.at(0).PID);
+  EXPECT_EQ(L.Sessions.at(0).Output, R.Sessions.at(0).Output);
+  ASSERT_EQ(L.Clients.size(), R.Clients.size());
+  EXPECT_EQ(L.Clients.at(0).DataFD, R.Clients.at(0).DataFD);
+  EXPECT_EQ(L.Clients.at(0).ReadOnly, R.Clients.at(0).ReadOnly);
+  EXPECT_EQ(L.Clients.at(0).SessionSubscriber,
+            R.Clients.at(0).SessionSubscriber);
+  EXPECT_EQ(L.Clients.at(0).Columns, R.Clients.at(0).Columns);
+  EXPECT_EQ(L.Clients.at(0).Session, R.Clients.at(0).Session);
+  EXPECT_EQ(L.Clients.at(0).ControlInput, R.Clients.at(0).ControlInput);
+  EXPECT_EQ(L.Clients.at(0).DataOutput, R.Clients.at(0).DataOutput);
+}
+
+TEST(HandOver, EncodeDecode)
+{
+  HandOverState State = makeState();
+  std::string Data = State.encode();
+
+  std::optional<HandOverState> Decoded = HandOverState::decode(Data);
+  ASSERT_TRUE(Decoded);
+  expectSame(State, *Decoded);
+
+  EXPECT_FALSE(HandOverState::decode(Data.substr(0, Data.size() - 1)));
+}
+
+TEST(HandOver, ThroughFile)
+{
+  HandOverState State = makeState();
+  fd File = State.writeToFile();
+
+  std::optional<HandOverState> Read = HandOverState::readFromFile(File);
+  ASSERT_TRUE(Read);
+  expectSame(State, *Read);
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/control/Message.hpp"
+#include "monomux/server/OpenMetrics.hpp"
+
+using namespace monomux::message;
+using namespace monomux::server;
+
+TEST(OpenMetrics, CountersAndGauges)
+{
+  response::Metrics Obj;
+  Obj.Server.Names = {"clients", "clients_accepted"};
+  Obj.Server.Kinds = {MetricTable::Gauge, MetricTable::Counter};
+  Obj.Server.Subjects = {"server"};
+  Obj.Server.Values = {1, 4};
+  Obj.Sessions.Names = {"read_pauses"};
+  Obj.Sessions.Kinds = {MetricTable::Counter};
+  Obj.Sessions.Subjects = {"a", "b\"\\\n"};
+  Obj.Sessions.Values = {2, 3};
+
+  EXPECT_EQ(formatOpenMetrics(Obj),
+            "# TYPE monomux_server_clients gauge\n"
+            "monomux_server_clients 1\n"
+            "# TYPE monomux_server_clients_accepted counter\n"
+            "monomux_server_clients_accepted_total 4\n"
+            "# TYPE monomux_session_read_pauses counter\n"
+            "monomux_session_read_pauses_total{session=\"a\"} 2\n"
+            "monomux_session_read_pauses_total{session=\"b\\\"\\\\\\n\"} 3\n"
+            "# EOF\n");
+}
+
+TEST(OpenMetrics, HistogramIsCumulative)
+{
+  response::Metrics Obj;
+  Obj.Clients.Names = {"latency_le_1",
+                       "latency_le_3",
+                       "latency_le_inf",
+                       "latency_sum",
+                       "latency_count",
+                       "drops"};
+  Obj.Clients.Kinds = {MetricTable::Histogram,
+                       MetricTable::Histogram,
+                       MetricTable::Histogram,
+                       MetricTable::Histogram,
+                       MetricTable::Histogram,
+                       MetricTable::Counter};
+  Obj.Clients.Subjects = {"7"};
+  Obj.Clients.Values = {1, 2, 3, 30, 6, 0};
+
+  EXPECT_EQ(formatOpenMetrics(Obj),
+            "# TYPE monomux_client_latency histogram\n"
+            "monomux_client_latency_bucket{client=\"7\",le=\"1\"} 1\n"
+            "monomux_client_latency_bucket{client=\"7\",le=\"3\"} 3\n"
+            "monomux_client_latency_bucket{client=\"7\",le=\"+Inf\"} 6\n"
+            "monomux_client_latency_sum{client=\"7\"} 30\n"
+            "monomux_client_latency_count{client=\"7\"} 6\n"
+            "# TYPE monomux_client_drops counter\n"
+            "monomux_client_drops_total{client=\"7\"} 0\n"
+            "# EOF\n");
+}
@@ -0,0 +1,251 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/client/Client.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/system/Environment.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+/// Runs a \p Server in a thread of the test, listening in a temporary
+/// directory.
+class ServerTest : public ::testing::Test
+{
+protected:
+  std::string Dir;
+  std::string SocketPath;
+  std::optional<server::Server> S;
+  std::thread Loop;
+
+  void SetUp() override
+  {
+    std::signal(SIGPIPE, SIG_IGN);
+    log::Logger::get().setLimit(log::Warning);
+
+    const char* Tmp = std::getenv("TMPDIR");
+    std::string Template =
+      std::string{Tmp ? Tmp : "/tmp"} + "/monomux-test-server-XXXXXX";
+    ASSERT_NE(::mkdtemp(Template.data()), nullptr);
+    Dir = Template;
+    SocketPath = Dir + "/server.sock";
+    S.emplace(Socket::create(SocketPath));
+    S->setExitIfNoMoreSessions(false);
+  }
+
+  void start()
+  {
+    S->listen();
+    Loop = std::thread{[this] { S->loop(); }};
+  }
+
+  void TearDown() override
+  {
+    if (Loop.joinable())
+    {
+      S->interrupt();
+      Loop.join();
+      S->shutdown();
+    }
+    S.reset();
+    std::system(("rm -rf '" + Dir + "'").c_str());
+  }
+
+  client::Client connect()
+  {
+    std::string Failure;
+    std::optional<client::Client> C =
+      client::Client::create(SocketPath, &Failure);
+    EXPECT_TRUE(C.has_value()) << Failure;
+    EXPECT_TRUE(C->handshake(&Failure)) << Failure;
+    return std::move(*C);
+  }
+
+  /// Starts a session which output is read so slowly that it is paused most
+  /// of the time, and which program does not read its input at first, so the
+  /// input of the client is buffered by the server, and expects all of the
+  /// input to reach the program nevertheless.
+  void expectInputReachesPausedSession();
+};
+
+/// \returns the size of the file at \p Path, once it reaches \p Size, or
+/// whatever it is after \p Timeout.
+std::size_t waitForSize(const std::string& Path,
+                        std::size_t Size,
+                        std::chrono::milliseconds Timeout)
+{
+  const auto Deadline = std::chrono::steady_clock::now() + Timeout;
+  std::size_t Current = 0;
+  while (std::chrono::steady_clock::now() < Deadline)
+  {
+    std::ifstream File{Path, std::ios::binary | std::ios::ate};
+    Current = File ? static_cast<std::size_t>(File.tellg()) : 0;
+    if (Current >= Size)
+      break;
+    std::this_thread::sleep_for(20ms);
+  }
+  return Current;
+}
+
+void ServerTest::expectInputReachesPausedSession()
+{
+  ThrottleLimits Throttle;
+  Throttle.Rate = 256;
+  S->setOutputThrottle(Throttle);
+  start();
+
+  static constexpr std::size_t InputSize = 64 << 10;
+  const std::string Received = Dir + "/received";
+  client::Client C = connect();
+  Process::SpawnOptions Program;
+  Program.Program = "/bin/sh";
+  Program.Arguments = {
+    "-c",
+    "stty raw -echo; (head -c 1000000 /dev/zero | tr '\\0' x) & sleep 1; "
+    "head -c " +
+      std::to_string(InputSize) + " > '" + Received + "'"};
+  std::optional<std::string> Name =
+    C.requestMakeSession("paused", std::move(Program));
+  ASSERT_TRUE(Name.has_value());
+  ASSERT_TRUE(C.requestAttach(*Name));
+
+  std::this_thread::sleep_for(300ms);
+  C.sendData(std::string(InputSize, 'i'));
+  EXPECT_EQ(waitForSize(Received, InputSize, 10s), InputSize);
+}
+
+/// \returns the contents of the files in \p Directory.
+std::string readFiles(const std::string& Directory)
+{
+  std::string Contents;
+  ::DIR* Dir = ::opendir(Directory.c_str());
+  if (!Dir)
+    return Contents;
+  while (const struct ::dirent* Entry = ::readdir(Dir))
+  {
+    if (Entry->d_name[0] == '.')
+      continue;
+    std::ifstream File{Directory + '/' + Entry->d_name, std::ios::binary};
+    Contents.append(std::istreambuf_iterator<char>{File},
+                    std::istreambuf_iterator<char>{});
+  }
+  ::closedir(Dir);
+  return Contents;
+}
+
+} // namespace
+
+TEST_F(ServerTest, PausedSessionReceivesInput)
+{
+  expectInputReachesPausedSession();
+}
+
+TEST_F(ServerTest, PausedSessionReceivesInputEdgeTriggered)
+{
+  S->setEdgeTriggered(true);
+  expectInputReachesPausedSession();
+}
+
+TEST_F(ServerTest, SplicedSessionIsRecorded)
+{
+  const std::string RecordDir = Dir + "/recordings";
+  ASSERT_EQ(::mkdir(RecordDir.c_str(), 0700), 0);
+  S->setSpliceRelay(true);
+  S->setRecording(RecordDir, "*");
+  start();
+
+  client::Client C = connect();
+  Process::SpawnOptions Program;
+  Program.Program = "/bin/sh";
+  // The output is produced once the single client is attached, so it could
+  // be spliced to it.
+  Program.Arguments = {"-c", "sleep 0.5; echo recorded-output; sleep 5"};
+  std::optional<std::string> Name =
+    C.requestMakeSession("spliced", std::move(Program));
+  ASSERT_TRUE(Name.has_value());
+  ASSERT_TRUE(C.requestAttach(*Name));
+
+  // The recorder writes the queued events periodically.
+  const auto Deadline = std::chrono::steady_clock::now() + 10s;
+  std::string Cast;
+  while (std::chrono::steady_clock::now() < Deadline &&
+         Cast.find("recorded-output") == std::string::npos)
+  {
+    std::this_thread::sleep_for(100ms);
+    Cast = readFiles(RecordDir);
+  }
+  EXPECT_NE(Cast.find(", \"o\", "), std::string::npos) << Cast;
+  EXPECT_NE(Cast.find("recorded-output"), std::string::npos) << Cast;
+}
+
+TEST_F(ServerTest, PooledAliasesDoNotCollideWithSessions)
+{
+  S->setSessionPool(1);
+  start();
+  // ("pool-1" is started in advance.)
+  std::this_thread::sleep_for(300ms);
+
+  client::Client C = connect();
+  auto Sleeping = [] {
+    Process::SpawnOptions Program;
+    Program.Program = "/bin/sh";
+    Program.Arguments = {"-c", "sleep 30"};
+    return Program;
+  };
+  auto Pooled = [] {
+    Process::SpawnOptions Program;
+    Program.Program = defaultShell();
+    return Program;
+  };
+  EXPECT_FALSE(C.requestMakeSession("pool-1", Sleeping()).has_value());
+  ASSERT_TRUE(C.requestMakeSession("pool-2", Sleeping()).has_value());
+
+  // Taking "pool-1" starts the next one in advance, which must skip the name
+  // of the session created meanwhile.
+  ASSERT_TRUE(C.requestMakeSession("first", Pooled()).has_value());
+  std::this_thread::sleep_for(300ms);
+  std::optional<std::string> Name = C.requestMakeSession("second", Pooled());
+  ASSERT_TRUE(Name.has_value());
+  ASSERT_TRUE(C.requestAttach(*Name));
+
+  const std::string Alias = Dir + "/alias";
+  C.sendData("echo \"$MONOMUX_SESSION\" > '" + Alias + "'\n");
+  ASSERT_GT(waitForSize(Alias, 1, 10s), 0);
+  std::ifstream File{Alias};
+  std::string Contents;
+  std::getline(File, Contents);
+  EXPECT_EQ(Contents, "pool-3");
+}
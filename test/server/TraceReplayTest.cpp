@@ -0,0 +1,203 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/server/ClientData.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/server/SessionData.hpp"
+#include "monomux/server/TraceReplay.hpp"
+#include "monomux/system/EventTrace.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+/// Replays traces into \p Server instances listening in a temporary
+/// directory.
+class TraceReplayTest : public ::testing::Test
+{
+protected:
+  std::string Dir;
+
+  void SetUp() override
+  {
+    std::signal(SIGPIPE, SIG_IGN);
+    log::Logger::get().setLimit(log::Warning);
+
+    const char* Tmp = std::getenv("TMPDIR");
+    std::string Template =
+      std::string{Tmp ? Tmp : "/tmp"} + "/monomux-test-replay-XXXXXX";
+    ASSERT_NE(::mkdtemp(Template.data()), nullptr);
+    Dir = Template;
+  }
+
+  void TearDown() override { std::system(("rm -rf '" + Dir + "'").c_str()); }
+
+  std::unique_ptr<Server> makeServer(const std::string& Name)
+  {
+    auto S =
+      std::make_unique<Server>(Socket::create(Dir + '/' + Name + ".sock"));
+    S->setExitIfNoMoreSessions(false);
+    return S;
+  }
+
+  /// Writes a trace of a session (\p 10) with an attached client (\p 20),
+  /// which exchange some data, before the client exits.
+  std::vector<EventTraceReader::Batch> recordSessionTrace()
+  {
+    const std::string Path = Dir + "/session.trace";
+    {
+      EventTrace T{Path};
+      auto Now = EventTrace::Clock::now();
+      T.connection(EventTrace::Open, 10, EventTrace::SessionRole, Now);
+      T.connection(EventTrace::Open, 20, EventTrace::ClientDataRole, Now);
+      T.attachment(EventTrace::Attach, 20, 10, Now);
+      T.batch(Now, 2, Now);
+      T.event(10, /* Incoming =*/true, /* Outgoing =*/false);
+      // (A control connection, which is not replayed.)
+      T.event(5, /* Incoming =*/true, /* Outgoing =*/false);
+      T.io(EventTrace::Read, 10, 4096, Now);
+      T.io(EventTrace::Write, 20, 4096, Now);
+
+      T.batch(Now, 1, Now);
+      T.event(20, /* Incoming =*/true, /* Outgoing =*/false);
+      T.io(EventTrace::Read, 20, 100, Now);
+      T.io(EventTrace::Write, 10, 100, Now);
+
+      T.attachment(EventTrace::Detach, 20, 10, Now);
+      T.connection(EventTrace::Close, 20, EventTrace::ClientDataRole, Now);
+      T.batch(Now, 0, Now);
+    }
+    std::optional<std::vector<EventTraceReader::Batch>> Trace =
+      EventTraceReader::load(Path);
+    EXPECT_TRUE(Trace.has_value());
+    return Trace ? std::move(*Trace) : std::vector<EventTraceReader::Batch>{};
+  }
+};
+
+/// Runs the event loop of \p S until \p FD received \p Bytes in \p R.
+void relayUntil(Server& S, TraceReplay& R, raw_fd FD, std::size_t Bytes)
+{
+  for (int I = 0; I < 100 && R.received(FD) < Bytes; ++I)
+  {
+    S.iterate(10ms);
+    R.drain();
+  }
+}
+
+} // namespace
+
+TEST_F(TraceReplayTest, ReplayDrivesServer)
+{
+  std::vector<EventTraceReader::Batch> Trace = recordSessionTrace();
+  ASSERT_EQ(Trace.size(), 3);
+  ASSERT_EQ(Trace.front().Changes.size(), 3);
+
+  std::unique_ptr<Server> S = makeServer("replay");
+  TraceReplay R{*S};
+
+  R.replay(Trace.at(0));
+  SessionData* Session = R.session(10);
+  ClientData* Client = R.client(20);
+  ASSERT_NE(Session, nullptr);
+  ASSERT_NE(Client, nullptr);
+  EXPECT_EQ(S->getSession("replay-10"), Session);
+  EXPECT_EQ(Client->getAttachedSession(), Session);
+  EXPECT_EQ(Session->getAttachedClients().size(), 1);
+  EXPECT_EQ(R.skippedEvents(), 1);
+
+  // The output of the session reached the client.
+  relayUntil(*S, R, 20, 4096);
+  EXPECT_EQ(R.received(20), 4096);
+
+  // The input of the client reached the session.
+  R.replay(Trace.at(1));
+  relayUntil(*S, R, 10, 100);
+  EXPECT_EQ(R.received(10), 100);
+
+  R.replay(Trace.at(2));
+  EXPECT_EQ(R.client(20), nullptr);
+  EXPECT_EQ(S->getSession("replay-10"), Session);
+  EXPECT_TRUE(Session->getAttachedClients().empty());
+  EXPECT_EQ(R.truncated(), 0);
+}
+
+TEST_F(TraceReplayTest, ServerRecordsReplayableTrace)
+{
+  // The trace of the loop of a server replaying a trace has the connections
+  // of the server, which are replayed the same way.
+  const std::string Prefix = Dir + "/recorded";
+  {
+    std::unique_ptr<Server> Traced = makeServer("traced");
+    Traced->setEventTrace(Prefix);
+    TraceReplay R{*Traced};
+    for (const EventTraceReader::Batch& B : recordSessionTrace())
+    {
+      R.replay(B);
+      for (const EventTraceReader::IO& IO : B.IOs)
+        if (IO.Kind == EventTrace::Write)
+          relayUntil(*Traced, R, IO.FD, IO.Bytes);
+    }
+  }
+
+  std::optional<std::vector<EventTraceReader::Batch>> Trace =
+    EventTraceReader::load(Prefix + ".0.trace");
+  ASSERT_TRUE(Trace.has_value());
+
+  std::unique_ptr<Server> S = makeServer("replay");
+  TraceReplay R{*S};
+  raw_fd SessionFD = fd::Invalid;
+  raw_fd ClientFD = fd::Invalid;
+  bool Attached = false;
+  std::size_t Output = 0;
+  for (const EventTraceReader::Batch& B : *Trace)
+  {
+    for (const EventTraceReader::Change& C : B.Changes)
+      if (C.Kind == EventTrace::Attach)
+      {
+        ClientFD = C.FD;
+        SessionFD = C.Session;
+      }
+    R.replay(B);
+    R.drain();
+
+    if (ClientData* Client = R.client(ClientFD))
+      Attached |= Client->getAttachedSession() == R.session(SessionFD) &&
+                  R.session(SessionFD);
+    Output = std::max(Output, R.received(ClientFD));
+  }
+  EXPECT_TRUE(Attached);
+  EXPECT_GT(Output, 0);
+  EXPECT_EQ(R.client(ClientFD), nullptr);
+}
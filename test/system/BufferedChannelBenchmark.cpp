@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Socket.hpp"
+#include "monomux/system/fd.hpp"
+
+/// Microbenchmarks of moving data through the buffered channel abstraction
+/// over a connected pair of sockets. These are disabled by default, run them
+/// (preferably in a Release build) with:
+///
+///     monomux_tests --gtest_also_run_disabled_tests
+///                   --gtest_filter='BufferedChannelBenchmark.*'
+
+using namespace monomux;
+
+namespace
+{
+
+constexpr std::size_t Transferred = 256ULL << 20; // 256 MiB
+
+/// \returns a connected pair of non-blocking sockets.
+std::pair<Socket, Socket> nonBlockingPair()
+{
+  auto Pair = Socket::pair("bench");
+  fd::addStatusFlag(Pair.first.raw(), O_NONBLOCK);
+  fd::addStatusFlag(Pair.second.raw(), O_NONBLOCK);
+  return Pair;
+}
+
+void report(const char* What,
+            std::size_t Chunk,
+            std::chrono::steady_clock::time_point Begin)
+{
+  auto Elapsed =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - Begin);
+  std::cout << What << " with " << Chunk << " byte chunks: "
+            << static_cast<double>(Transferred) / (1ULL << 20) /
+                 Elapsed.count()
+            << " MiB/s\n";
+}
+
+} // namespace
+
+TEST(BufferedChannelBenchmark, DISABLED_WriteThenRead)
+{
+  for (std::size_t Chunk : {64, 4096, 65536})
+  {
+    auto [Writer, Reader] = nonBlockingPair();
+    const std::string Data(Chunk, 'x');
+
+    auto Begin = std::chrono::steady_clock::now();
+    for (std::size_t Moved = 0; Moved < Transferred; Moved += Chunk)
+    {
+      // Every write fits the socket, like a keystroke or a line of output.
+      Writer.write(Data);
+      std::size_t Got = 0;
+      while (Got < Chunk)
+        Got += Reader.read(Chunk - Got).size();
+    }
+    report("write() + read()", Chunk, Begin);
+  }
+}
+
+TEST(BufferedChannelBenchmark, DISABLED_BufferedWrites)
+{
+  for (std::size_t Chunk : {4096, 65536})
+  {
+    auto [Writer, Reader] = nonBlockingPair();
+    const std::string Data(Chunk, 'x');
+    // More than the socket takes, so part of every burst is buffered and
+    // sent by flushWrites() once the reader made room.
+    constexpr std::size_t Burst = 4 << 20;
+
+    auto Begin = std::chrono::steady_clock::now();
+    for (std::size_t Moved = 0; Moved < Transferred; Moved += Burst)
+    {
+      for (std::size_t Written = 0; Written < Burst; Written += Chunk)
+        Writer.write(Data);
+      std::size_t Got = 0;
+      while (Got < Burst)
+      {
+        Got += Reader.read(Reader.optimalReadSize()).size();
+        Writer.flushWrites();
+      }
+    }
+    EXPECT_FALSE(Writer.hasBufferedWrite());
+    report("write() + flushWrites() + read()", Chunk, Begin);
+  }
+}
@@ -0,0 +1,436 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/SharedChunk.hpp"
+#include "monomux/system/BasicBufferedChannel.hpp"
+#include "monomux/system/Pipe.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+/// Creates an anonymous pipe with a non-blocking write end.
+Pipe::AnonymousPipe makePipe()
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  P.getRead()->setNonblocking();
+  P.getWrite()->setNonblocking();
+  return P;
+}
+
+/// Fills the kernel buffer of the pipe so subsequent writes are buffered.
+void fillPipe(Pipe& W)
+{
+  const std::string Garbage(BUFSIZ, 'x');
+  while (!W.hasBufferedWrite())
+    W.write(Garbage);
+}
+
+/// Reads everything currently available from \p R.
+std::string drain(Pipe& R)
+{
+  std::string Result;
+  while (true)
+  {
+    std::string Chunk = R.read(BUFSIZ);
+    if (Chunk.empty())
+      break;
+    Result.append(Chunk);
+  }
+  return Result;
+}
+
+/// A channel over a pipe that counts how its low-level operations are
+/// called.
+class CountingChannel final : public BasicBufferedChannel<CountingChannel>
+{
+public:
+  std::size_t DirectCalls = 0;
+  std::size_t VirtualCalls = 0;
+
+  CountingChannel(fd Handle)
+    : BasicBufferedChannel(std::move(Handle), "counting", false)
+  {}
+
+  std::size_t
+  transportReadv(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    ++DirectCalls;
+    return io(::readv(raw(), Vectors, static_cast<int>(Count)), Continue);
+  }
+  std::size_t transportWrite(std::string_view Buffer, bool& Continue)
+  {
+    ++DirectCalls;
+    return io(::write(raw(), Buffer.data(), Buffer.size()), Continue);
+  }
+  std::size_t
+  transportWritev(const ::iovec* Vectors, std::size_t Count, bool& Continue)
+  {
+    ++DirectCalls;
+    return io(::writev(raw(), Vectors, static_cast<int>(Count)), Continue);
+  }
+
+protected:
+  std::string readImpl(std::size_t Bytes, bool& Continue) override
+  {
+    std::string Data(Bytes, 0);
+    ::iovec Vector{Data.data(), Bytes};
+    Data.resize(readvImpl(&Vector, 1, Continue));
+    return Data;
+  }
+  std::size_t writeImpl(std::string_view Buffer, bool& Continue) override
+  {
+    ++VirtualCalls;
+    return io(::write(raw(), Buffer.data(), Buffer.size()), Continue);
+  }
+  std::size_t readvImpl(const ::iovec* Vectors,
+                        std::size_t Count,
+                        bool& Continue) override
+  {
+    ++VirtualCalls;
+    return io(::readv(raw(), Vectors, static_cast<int>(Count)), Continue);
+  }
+  std::size_t writevImpl(const ::iovec* Vectors,
+                         std::size_t Count,
+                         bool& Continue) override
+  {
+    ++VirtualCalls;
+    return io(::writev(raw(), Vectors, static_cast<int>(Count)), Continue);
+  }
+
+private:
+  static std::size_t io(::ssize_t Result, bool& Continue)
+  {
+    Continue = Result > 0;
+    return Result > 0 ? static_cast<std::size_t>(Result) : 0;
+  }
+};
+
+} // namespace
+
+TEST(BufferedChannel, SharedChunkIsReferencedNotCopied)
+{
+  Pipe::AnonymousPipe P1 = makePipe();
+  Pipe::AnonymousPipe P2 = makePipe();
+  fillPipe(*P1.getWrite());
+  fillPipe(*P2.getWrite());
+
+  SharedChunk Data{std::string(BUFSIZ * 4, 'A')};
+  EXPECT_EQ(Data.useCount(), 1);
+
+  const std::size_t Pending1 = P1.getWrite()->writeInBuffer();
+  const std::size_t Pending2 = P2.getWrite()->writeInBuffer();
+  EXPECT_EQ(P1.getWrite()->write(Data), 0);
+  EXPECT_EQ(P2.getWrite()->write(Data), 0);
+
+  // Both channels keep a reference to the same data.
+  EXPECT_EQ(Data.useCount(), 3);
+  EXPECT_EQ(P1.getWrite()->writeInBuffer(), Pending1 + Data.size());
+  EXPECT_EQ(P2.getWrite()->writeInBuffer(), Pending2 + Data.size());
+
+  std::string Received;
+  while (P1.getWrite()->hasBufferedWrite())
+  {
+    Received.append(drain(*P1.getRead()));
+    P1.getWrite()->flushWrites();
+  }
+  Received.append(drain(*P1.getRead()));
+
+  // After flushing, the reference is released.
+  EXPECT_EQ(Data.useCount(), 2);
+  EXPECT_EQ(Received.substr(Received.size() - Data.size()), Data.view());
+}
+
+TEST(BufferedChannel, WritesAfterSharedChunkKeepOrder)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  fillPipe(*P.getWrite());
+
+  SharedChunk Data{std::string(BUFSIZ, 'A')};
+  P.getWrite()->write(Data);
+  P.getWrite()->write(std::string(BUFSIZ, 'B'));
+  P.getWrite()->write(Data);
+
+  std::string Received;
+  while (P.getWrite()->hasBufferedWrite())
+  {
+    Received.append(drain(*P.getRead()));
+    P.getWrite()->flushWrites();
+  }
+  Received.append(drain(*P.getRead()));
+
+  const std::string Expected = std::string(BUFSIZ, 'A') +
+                               std::string(BUFSIZ, 'B') +
+                               std::string(BUFSIZ, 'A');
+  ASSERT_GE(Received.size(), Expected.size());
+  EXPECT_EQ(Received.substr(Received.size() - Expected.size()), Expected);
+  EXPECT_EQ(Data.useCount(), 1);
+}
+
+TEST(BufferedChannel, ReadExcessLandsInBuffer)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  const std::size_t Chunk = P.getRead()->optimalReadSize();
+  const std::string Data = std::string(Chunk, 'A') + std::string(Chunk, 'B');
+  EXPECT_EQ(P.getWrite()->write(Data), Data.size());
+
+  std::string Head = P.getRead()->read(Chunk / 2);
+  EXPECT_EQ(Head, std::string(Chunk / 2, 'A'));
+  // The rest of the chunk that was read from the system is buffered.
+  EXPECT_EQ(P.getRead()->readInBuffer(), Chunk - Chunk / 2);
+
+  EXPECT_EQ(Head + drain(*P.getRead()), Data);
+  EXPECT_FALSE(P.getRead()->hasBufferedRead());
+}
+
+TEST(BufferedChannel, PeekAndConsume)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  EXPECT_TRUE(P.getRead()->peek(BUFSIZ).empty());
+
+  P.getWrite()->write("Hello World!");
+  std::string_view V = P.getRead()->peek(5);
+  EXPECT_EQ(V, "Hello");
+  // Peeking does not consume.
+  EXPECT_EQ(P.getRead()->peek(5), "Hello");
+  EXPECT_EQ(P.getRead()->readInBuffer(), 12);
+
+  P.getRead()->consume(6);
+  EXPECT_EQ(P.getRead()->peek(BUFSIZ), "World!");
+  P.getRead()->consume(BUFSIZ);
+  EXPECT_FALSE(P.getRead()->hasBufferedRead());
+}
+
+TEST(BufferedChannel, BufferedBytesAreAccountedGlobally)
+{
+  const std::size_t Before = BufferedChannel::globalBufferedBytes();
+  {
+    Pipe::AnonymousPipe P = makePipe();
+    fillPipe(*P.getWrite());
+    const std::size_t Pending = P.getWrite()->writeInBuffer();
+    EXPECT_EQ(BufferedChannel::globalBufferedBytes(), Before + Pending);
+
+    EXPECT_FALSE(P.getWrite()->overBudget());
+    BufferedChannel::setGlobalBudget(Before + Pending - 1);
+    EXPECT_TRUE(P.getWrite()->overBudget());
+    // A channel without buffered data is not held back.
+    EXPECT_FALSE(P.getRead()->overBudget());
+
+    drain(*P.getRead());
+    P.getWrite()->flushWrites();
+    EXPECT_FALSE(P.getWrite()->overBudget());
+    BufferedChannel::setGlobalBudget(0);
+
+    P.getWrite()->write(std::string(BUFSIZ * 4, 'A'));
+  }
+  // Destroying the channel releases its share.
+  EXPECT_EQ(BufferedChannel::globalBufferedBytes(), Before);
+}
+
+TEST(BufferedChannel, LoadStopsAtBufferSizeMax)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  const std::string Data(BufferedChannel::BufferSize * 4, 'A');
+  std::size_t Written = P.getWrite()->write(Data);
+  ASSERT_GT(Written, BufferedChannel::BufferSize * 2);
+
+  BufferedChannel::setBufferSizeMax(BufferedChannel::BufferSize);
+  std::size_t Loaded = 0;
+  EXPECT_NO_THROW(Loaded = P.getRead()->load(Data.size()));
+  BufferedChannel::setBufferSizeMax(BufferedChannel::DefaultBufferSizeMax);
+
+  // The rest of the data is left in the pipe, and is not lost.
+  EXPECT_EQ(Loaded, BufferedChannel::BufferSize);
+  EXPECT_EQ(P.getRead()->readInBuffer(), BufferedChannel::BufferSize);
+  EXPECT_EQ(drain(*P.getRead()).size(), Written);
+}
+
+TEST(BufferedChannel, TryWriteReportsOverflowWithoutThrowing)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  fillPipe(*P.getWrite());
+
+  BufferedChannel::setBufferSizeMax(BufferedChannel::BufferSize);
+  const std::string Data(BufferedChannel::BufferSize * 2, 'B');
+  BufferedChannel::Result R;
+  EXPECT_NO_THROW(R = P.getWrite()->tryWrite(Data));
+  BufferedChannel::setBufferSizeMax(BufferedChannel::DefaultBufferSizeMax);
+
+  // Like with the throwing variant, the data is kept in the buffer.
+  EXPECT_TRUE(R.overflow());
+  EXPECT_GE(P.getWrite()->writeInBuffer(), Data.size());
+
+  drain(*P.getRead());
+  R = P.getWrite()->tryFlushWrites();
+  EXPECT_TRUE(R.ok());
+  EXPECT_GT(R.Bytes, 0);
+}
+
+TEST(BufferedChannel, TryOperationsReportUnsupportedDirection)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  BufferedChannel::Result R;
+  EXPECT_NO_THROW(R = P.getRead()->tryWrite("Data"));
+  EXPECT_TRUE(R.failed());
+  EXPECT_TRUE(R.Error);
+
+  std::string_view View = "Garbage";
+  EXPECT_NO_THROW(R = P.getWrite()->tryPeek(BUFSIZ, View));
+  EXPECT_TRUE(R.failed());
+  EXPECT_TRUE(View.empty());
+
+  P.getWrite()->write("Hello");
+  R = P.getRead()->tryPeek(BUFSIZ, View);
+  EXPECT_TRUE(R.ok());
+  EXPECT_EQ(View, "Hello");
+}
+
+TEST(BufferedChannel, SizeHintLearnsTypicalPeak)
+{
+  BufferedChannel::SizeHint Hint{BUFSIZ};
+  EXPECT_EQ(Hint.initialSize(), BUFSIZ);
+
+  // A single sample is not enough to learn from.
+  Hint.record(1 << 18);
+  EXPECT_EQ(Hint.initialSize(), BUFSIZ);
+
+  for (int I = 0; I < 32; ++I)
+    Hint.record(100000);
+  EXPECT_EQ(Hint.initialSize(), 1 << 17);
+
+  // Outliers do not make every new buffer large.
+  Hint.record(1 << 30);
+  EXPECT_EQ(Hint.initialSize(), 1 << 17);
+
+  // Small peaks never go below the default.
+  BufferedChannel::SizeHint Small{BUFSIZ};
+  for (int I = 0; I < 16; ++I)
+    Small.record(1);
+  EXPECT_EQ(Small.initialSize(), BUFSIZ);
+}
+
+TEST(BufferedChannel, ChunkSizesAdapt)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  const std::size_t InitialRead = P.getRead()->optimalReadSize();
+  const std::size_t InitialWrite = P.getWrite()->optimalWriteSize();
+
+  // Writing a lot at once grows the write chunk.
+  const std::string Data(InitialWrite * 2, 'A');
+  P.getWrite()->write(Data);
+  EXPECT_GT(P.getWrite()->optimalWriteSize(), InitialWrite);
+  EXPECT_LE(P.getWrite()->optimalWriteSize(), BufferedChannel::MaxChunkSize);
+
+  // Reads that fill entire chunks grow the read chunk.
+  EXPECT_EQ(drain(*P.getRead()), Data);
+  EXPECT_GT(P.getRead()->optimalReadSize(), InitialRead);
+
+  // Reads that barely get anything shrink it.
+  const std::size_t Grown = P.getRead()->optimalReadSize();
+  P.getWrite()->write("x");
+  EXPECT_EQ(drain(*P.getRead()), "x");
+  EXPECT_LT(P.getRead()->optimalReadSize(), Grown);
+  EXPECT_GE(P.getRead()->optimalReadSize(), BufferedChannel::MinChunkSize);
+}
+
+TEST(BufferedChannel, BuffersAreAllocatedOnlyWhenNeeded)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  EXPECT_EQ(P.getRead()->allocatedBufferBytes(), 0);
+  EXPECT_EQ(P.getWrite()->allocatedBufferBytes(), 0);
+
+  // Writes and reads that complete directly do not need a buffer.
+  P.getWrite()->write("Hello");
+  EXPECT_EQ(P.getRead()->read(P.getRead()->optimalReadSize()), "Hello");
+  EXPECT_EQ(P.getRead()->allocatedBufferBytes(), 0);
+  EXPECT_EQ(P.getWrite()->allocatedBufferBytes(), 0);
+
+  fillPipe(*P.getWrite());
+  EXPECT_GT(P.getWrite()->allocatedBufferBytes(), 0);
+
+  // A buffer still holding data is kept.
+  P.getWrite()->releaseBuffers();
+  EXPECT_GT(P.getWrite()->allocatedBufferBytes(), 0);
+
+  while (P.getWrite()->hasBufferedWrite())
+  {
+    drain(*P.getRead());
+    P.getWrite()->flushWrites();
+  }
+  // Recently used empty buffers are not released by the heuristics.
+  P.getWrite()->tryFreeResources();
+  EXPECT_GT(P.getWrite()->allocatedBufferBytes(), 0);
+  P.getWrite()->releaseBuffers();
+  EXPECT_EQ(P.getWrite()->allocatedBufferBytes(), 0);
+  EXPECT_NE(P.getWrite()->statistics().find("Unallocated"), std::string::npos);
+
+  // The released buffer is allocated again when needed.
+  fillPipe(*P.getWrite());
+  EXPECT_GT(P.getWrite()->allocatedBufferBytes(), 0);
+}
+
+TEST(BufferedChannel, BasicChannelCallsTransportDirectly)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  CountingChannel Out{std::move(*P.getWrite()).release()};
+  Pipe& In = *P.getRead();
+
+  Out.write("Direct");
+  Out.tryWrite(SharedChunk{std::string{"Shared"}});
+  EXPECT_GT(Out.DirectCalls, 0);
+  EXPECT_EQ(Out.VirtualCalls, 0);
+  EXPECT_EQ(drain(In), "DirectShared");
+
+  // Through the embedding API, the same channel is called virtually.
+  BufferedChannel& Embedded = Out;
+  const std::size_t DirectCalls = Out.DirectCalls;
+  Embedded.write("Virtual");
+  EXPECT_EQ(Out.DirectCalls, DirectCalls);
+  EXPECT_GT(Out.VirtualCalls, 0);
+  EXPECT_EQ(drain(In), "Virtual");
+}
+
+TEST(BufferedChannel, BasicChannelKeepsOrderWithEmbeddingAPI)
+{
+  Pipe::AnonymousPipe P = makePipe();
+  Pipe& W = *P.getWrite();
+  BufferedChannel& Embedded = W;
+  fillPipe(W);
+
+  // The buffered data is shared by both kinds of calls.
+  Embedded.write("One");
+  W.write("Two");
+  Embedded.write(SharedChunk{std::string{"Three"}});
+
+  std::string Received;
+  while (W.hasBufferedWrite())
+  {
+    Received.append(drain(*P.getRead()));
+    W.flushWrites();
+  }
+  Received.append(drain(*P.getRead()));
+  EXPECT_EQ(Received.substr(Received.size() - 11), "OneTwoThree");
+}
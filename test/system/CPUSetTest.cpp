@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include "monomux/system/CPUSet.hpp"
+
+using namespace monomux;
+
+TEST(CPUSet, ParseList)
+{
+  std::optional<CPUSet> S = CPUSet::parse("0-3,8,10-11\n");
+  ASSERT_TRUE(S.has_value());
+  EXPECT_EQ(S->cpus(), (std::vector<unsigned>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(S->toString(), "0-3,8,10-11");
+  EXPECT_EQ(CPUSet::parse("5")->toString(), "5");
+
+  EXPECT_FALSE(CPUSet::parse(""));
+  EXPECT_FALSE(CPUSet::parse("3-1"));
+  EXPECT_FALSE(CPUSet::parse("1,"));
+  EXPECT_FALSE(CPUSet::parse("1;2"));
+  EXPECT_FALSE(CPUSet::parse("x"));
+}
+
+TEST(CPUSet, InterleavesNodes)
+{
+  std::vector<CPUSet> Nodes{*CPUSet::parse("0-3"), *CPUSet::parse("4-7")};
+  EXPECT_EQ(CPUSet::parse("0-2,4-5,9")->interleaved(Nodes),
+            (std::vector<unsigned>{0, 4, 1, 5, 2, 9}));
+  // Without the topology known, the CPUs are taken in order.
+  EXPECT_EQ(CPUSet::parse("2,6")->interleaved({}),
+            (std::vector<unsigned>{2, 6}));
+}
+
+TEST(CPUSet, ApplyToThisThread)
+{
+  const CPUSet Original = CPUSet::ofThisThread();
+  ASSERT_FALSE(Original.empty());
+
+  CPUSet First;
+  First.add(Original.cpus().front());
+  First.applyToThisThread();
+  EXPECT_EQ(CPUSet::ofThisThread(), First);
+  Original.applyToThisThread();
+  EXPECT_EQ(CPUSet::ofThisThread(), Original);
+}
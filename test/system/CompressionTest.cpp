@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Compression.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+std::string repeated(std::string_view Line, std::size_t Count)
+{
+  std::string R;
+  for (std::size_t I = 0; I < Count; ++I)
+    R.append(Line);
+  return R;
+}
+
+} // namespace
+
+TEST(Compression, RoundTrip)
+{
+  if (!Deflater::available())
+    GTEST_SKIP() << "Compression not supported by the build.";
+
+  Deflater D;
+  Inflater I;
+  const std::string Data =
+    repeated("[ 42%] Building CXX object Foo.cpp.o\n", 1000);
+  std::string Compressed{D.compress(Data)};
+  EXPECT_LT(Compressed.size(), Data.size() / 10);
+  EXPECT_EQ(I.decompress(Compressed), Data);
+
+  EXPECT_EQ(I.decompress(D.compress("x")), "x");
+  EXPECT_EQ(I.decompress(D.compress("")), "");
+}
+
+TEST(Compression, ChunksAreIndependent)
+{
+  if (!Deflater::available())
+    GTEST_SKIP() << "Compression not supported by the build.";
+
+  Deflater D;
+  D.compress(repeated("abcdefgh", 128));
+  std::string Second{D.compress(repeated("abcdefgh", 64))};
+
+  // A receiver joining at the second chunk does not need the first one.
+  Inflater Late;
+  EXPECT_EQ(Late.decompress(Second), repeated("abcdefgh", 64));
+}
+
+TEST(Compression, InputSplitArbitrarily)
+{
+  if (!Deflater::available())
+    GTEST_SKIP() << "Compression not supported by the build.";
+
+  Deflater D;
+  const std::string Data = repeated("0123456789", 500);
+  std::string Compressed{D.compress(Data)};
+  Compressed.append(D.compress("tail"));
+
+  Inflater I;
+  std::string Result;
+  for (std::size_t Pos = 0; Pos < Compressed.size(); Pos += 3)
+    Result.append(I.decompress(std::string_view{Compressed}.substr(Pos, 3)));
+  EXPECT_EQ(Result, Data + "tail");
+}
+
+TEST(Compression, CorruptStreamThrows)
+{
+  if (!Deflater::available())
+    GTEST_SKIP() << "Compression not supported by the build.";
+
+  Inflater I;
+  EXPECT_THROW(I.decompress("\xff\xff\xff\xff"), std::runtime_error);
+}
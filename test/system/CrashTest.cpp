@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <csignal>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Crash.hpp"
+
+using namespace monomux;
+
+TEST(Crash, ReportRoundTrip)
+{
+  prepareCrashReport(::testing::TempDir(), "test-version");
+  const char* Written = writeCrashReport(SIGSEGV);
+  ASSERT_NE(Written, nullptr);
+  const std::string Path = Written;
+
+  std::optional<CrashReport> Report = CrashReport::load(Path);
+  ::unlink(Path.c_str());
+  ASSERT_TRUE(Report);
+  EXPECT_EQ(Report->Version, "test-version");
+  EXPECT_EQ(Report->Signal, SIGSEGV);
+  ASSERT_FALSE(Report->Frames.empty());
+  ASSERT_FALSE(Report->Modules.empty());
+  // The frame of the writer itself is in the test binary.
+  EXPECT_NE(Report->moduleOf(Report->Frames.front()), nullptr);
+
+  Backtrace BT{*Report};
+  ASSERT_EQ(BT.getFrames().size(), Report->Frames.size());
+  EXPECT_NE(BT.getFrames().front().ImageOffset, nullptr);
+  EXPECT_FALSE(BT.getFrames().front().Data.Binary.empty());
+}
+
+TEST(Crash, ReportRejectsOtherFiles)
+{
+  EXPECT_FALSE(CrashReport::parse(""));
+  EXPECT_FALSE(CrashReport::parse("hello\nframe 0x1\n"));
+  EXPECT_FALSE(CrashReport::parse("monomux-crash 1\nframe zzz\n"));
+
+  std::optional<CrashReport> R =
+    CrashReport::parse("monomux-crash 1\nsignal 6\nfuture line\n"
+                       "module 0x1000 0x2000 0x1000 /bin/some thing\n"
+                       "frame 0x1800\nframe 0x3000\n");
+  ASSERT_TRUE(R);
+  EXPECT_EQ(R->Signal, 6);
+  ASSERT_EQ(R->Modules.size(), 1);
+  EXPECT_EQ(R->Modules.front().Path, "/bin/some thing");
+  EXPECT_EQ(R->moduleOf(0x1800), &R->Modules.front());
+  EXPECT_EQ(R->moduleOf(0x3000), nullptr);
+}
+
+TEST(Crash, SymbolCacheRoundTrip)
+{
+  const std::string Binary = ::testing::TempDir() + "/symbol-cache-binary";
+  const std::string CachePath = ::testing::TempDir() + "/symbol-cache";
+  ::unlink(CachePath.c_str());
+  std::ofstream{Binary} << "v1";
+  const void* Offset = reinterpret_cast<const void*>(0x1234);
+
+  Backtrace::Symbol S{};
+  S.Name = "foo()";
+  S.Filename = "foo.cpp";
+  S.Line = 12;
+  S.Column = 3;
+  S.startInlineInfo().Name = "bar()";
+
+  {
+    SymbolCache Cache{CachePath};
+    EXPECT_FALSE(Cache.find(Binary, Offset));
+    Cache.insert(Binary, Offset, S);
+    Cache.save();
+  }
+
+  {
+    SymbolCache Cache{CachePath};
+    std::optional<Backtrace::Symbol> Found = Cache.find(Binary, Offset);
+    ASSERT_TRUE(Found);
+    EXPECT_EQ(Found->Name, "foo()");
+    EXPECT_EQ(Found->Filename, "foo.cpp");
+    EXPECT_EQ(Found->Line, 12);
+    EXPECT_EQ(Found->Column, 3);
+    ASSERT_TRUE(Found->InlinedBy);
+    EXPECT_EQ(Found->InlinedBy->Name, "bar()");
+    EXPECT_FALSE(Cache.find(Binary, reinterpret_cast<const void*>(0x1)));
+  }
+
+  // A rebuilt binary invalidates what was cached for it.
+  std::ofstream{Binary} << "version 2";
+  EXPECT_FALSE(SymbolCache{CachePath}.find(Binary, Offset));
+
+  ::unlink(Binary.c_str());
+  ::unlink(CachePath.c_str());
+}
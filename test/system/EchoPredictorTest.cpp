@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/EchoPredictor.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+/// Creates a predictor which has seen the echo of the input already.
+EchoPredictor confirmed()
+{
+  EchoPredictor P;
+  P.setEnabled(true);
+  P.predict("a");
+  P.reconcile("a");
+  return P;
+}
+
+} // namespace
+
+TEST(EchoPredictor, DisabledPassesThrough)
+{
+  EchoPredictor P;
+  EXPECT_TRUE(P.predict("abc").empty());
+  EXPECT_EQ(P.outstanding(), 0);
+  EXPECT_EQ(P.reconcile("abc"), "abc");
+}
+
+TEST(EchoPredictor, DisplaysOnlyAfterConfirmation)
+{
+  EchoPredictor P;
+  P.setEnabled(true);
+  EXPECT_TRUE(P.predict("ab").empty());
+  EXPECT_EQ(P.outstanding(), 2);
+
+  // The echo of the first character confirms the prediction, and the rest of
+  // the input is displayed after it.
+  EXPECT_EQ(P.reconcile("a"), "ab");
+  EXPECT_EQ(P.outstanding(), 1);
+  EXPECT_EQ(P.displayed(), 1);
+
+  EXPECT_EQ(P.predict("c"), "c");
+  EXPECT_EQ(P.displayed(), 2);
+}
+
+TEST(EchoPredictor, ConfirmedEchoIsRemovedFromOutput)
+{
+  EchoPredictor P = confirmed();
+  EXPECT_EQ(P.predict("xyz"), "xyz");
+  EXPECT_EQ(P.reconcile("xy"), "");
+  EXPECT_EQ(P.reconcile("z$ "), "$ ");
+  EXPECT_EQ(P.outstanding(), 0);
+}
+
+TEST(EchoPredictor, MismatchErasesPredictions)
+{
+  EchoPredictor P = confirmed();
+  EXPECT_EQ(P.predict("xyz"), "xyz");
+  EXPECT_EQ(P.reconcile("xQ"),
+            std::string{"\b\b"} + std::string{EchoPredictor::EraseLine} + "Q");
+  EXPECT_EQ(P.outstanding(), 0);
+
+  // After the mismatch, the echo must be seen again.
+  EXPECT_TRUE(P.predict("k").empty());
+  EXPECT_EQ(P.reconcile("k"), "k");
+}
+
+TEST(EchoPredictor, ControlKeyStopsPrediction)
+{
+  EchoPredictor P = confirmed();
+  EXPECT_EQ(P.predict("ls\rvi"), "ls");
+  EXPECT_EQ(P.outstanding(), 2);
+  EXPECT_TRUE(P.predict("j").empty());
+
+  // The echo up to the control key resolves the predictions, but does not
+  // confirm the input typed afterwards.
+  EXPECT_EQ(P.reconcile("ls\r\n"), "\r\n");
+  EXPECT_EQ(P.outstanding(), 0);
+  EXPECT_TRUE(P.predict("j").empty());
+  EXPECT_EQ(P.outstanding(), 1);
+
+  // A program that does not echo does not get keys displayed.
+  EXPECT_EQ(P.reconcile("\033[H"), "\033[H");
+  EXPECT_EQ(P.outstanding(), 0);
+  EXPECT_EQ(P.displayed(), 0);
+}
+
+TEST(EchoPredictor, DisablingErasesPredictions)
+{
+  EchoPredictor P = confirmed();
+  EXPECT_EQ(P.predict("xy"), "xy");
+  EXPECT_EQ(P.setEnabled(false),
+            std::string{"\b\b"} + std::string{EchoPredictor::EraseLine});
+  EXPECT_TRUE(P.predict("z").empty());
+  EXPECT_EQ(P.reconcile("xy"), "xy");
+}
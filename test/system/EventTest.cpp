@@ -0,0 +1,359 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/Config.h"
+#include "monomux/system/Event.hpp"
+#include "monomux/system/IOUring.hpp"
+#include "monomux/system/Pipe.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+
+TEST(EPoll, ScheduledEventAppearsWithoutToken)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  Poll.schedule(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  ASSERT_EQ(Poll.wait(), 1);
+  EXPECT_EQ(Poll.getScheduledCount(), 1);
+  EXPECT_EQ(Poll.getEventCount(), 0);
+
+  EPoll::EventWithMode E = Poll.eventAt(0);
+  EXPECT_EQ(E.FD, P.getRead()->raw());
+  EXPECT_TRUE(E.Incoming);
+  EXPECT_FALSE(E.Outgoing);
+}
+
+TEST(EPoll, ScheduledEventCollectsReadyNotifications)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  P.getWrite()->write("x");
+
+  Poll.schedule(P.getWrite()->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  ASSERT_EQ(Poll.wait(), 2);
+  EXPECT_EQ(Poll.getScheduledCount(), 1);
+  EXPECT_EQ(Poll.getEventCount(), 1);
+  EXPECT_EQ(Poll.eventAt(0).FD, P.getWrite()->raw());
+  EXPECT_EQ(Poll.eventAt(1).FD, P.getRead()->raw());
+}
+
+TEST(EPoll, UserDataIsReported)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  int Data = 0;
+  Poll.listen(P.getRead()->raw(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/false,
+              &Data);
+  P.getWrite()->write("x");
+
+  Poll.schedule(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  Poll.schedule(P.getWrite()->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  ASSERT_EQ(Poll.wait(), 3);
+  EXPECT_EQ(Poll.eventAt(0).UserData, &Data);
+  EXPECT_EQ(Poll.eventAt(1).FD, P.getWrite()->raw());
+  EXPECT_EQ(Poll.eventAt(1).UserData, nullptr);
+  EXPECT_EQ(Poll.eventAt(2).FD, P.getRead()->raw());
+  EXPECT_EQ(Poll.eventAt(2).UserData, &Data);
+
+  // Events already received for a stopped file lose their data.
+  Poll.stop(P.getRead()->raw());
+  EXPECT_EQ(Poll.eventAt(0).FD, P.getRead()->raw());
+  EXPECT_EQ(Poll.eventAt(0).UserData, nullptr);
+  EXPECT_EQ(Poll.eventAt(2).FD, P.getRead()->raw());
+  EXPECT_EQ(Poll.eventAt(2).UserData, nullptr);
+}
+
+TEST(EPoll, WakeFromOtherThread)
+{
+  EPoll Poll{4};
+  std::thread Waker{[&Poll] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Poll.wake();
+  }};
+
+  EXPECT_EQ(Poll.wait(), 0);
+  Waker.join();
+}
+
+TEST(EPoll, WaitTimesOut)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  auto Start = std::chrono::steady_clock::now();
+  EXPECT_EQ(Poll.wait(std::chrono::milliseconds{10}), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - Start,
+            std::chrono::milliseconds{10});
+}
+
+TEST(EPoll, ScheduleFromOtherThread)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  std::thread Scheduler{[&Poll, FD = P.getWrite()->raw()] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Poll.schedule(FD, /* Incoming =*/false, /* Outgoing =*/true);
+  }};
+
+  ASSERT_EQ(Poll.wait(), 1);
+  Scheduler.join();
+
+  EPoll::EventWithMode E = Poll.eventAt(0);
+  EXPECT_EQ(E.FD, P.getWrite()->raw());
+  EXPECT_FALSE(E.Incoming);
+  EXPECT_TRUE(E.Outgoing);
+}
+
+TEST(EPoll, ScheduledEventFollowsNewRegistration)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  EPoll Poll{4};
+  int First = 1;
+  int Second = 2;
+  Poll.listen(P.getWrite()->raw(),
+              /* Incoming =*/false,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/false,
+              &First);
+
+  Poll.schedule(P.getWrite()->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  // Changing the interest in the file keeps the scheduled event.
+  Poll.stop(P.getWrite()->raw());
+  Poll.listen(P.getWrite()->raw(),
+              /* Incoming =*/false,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/false,
+              &Second);
+  ASSERT_EQ(Poll.wait(), 1);
+  EXPECT_TRUE(Poll.eventAt(0).Outgoing);
+  EXPECT_EQ(Poll.eventAt(0).UserData, &Second);
+}
+
+#ifdef MONOMUX_IO_URING
+TEST(IOUring, LevelTriggeredRefires)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  IOUring Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  P.getWrite()->write("x");
+
+  for (int I = 0; I < 2; ++I)
+  {
+    ASSERT_EQ(Poll.wait(), 1);
+    EXPECT_EQ(Poll.getEventCount(), 1);
+    EPoll::EventWithMode E = Poll.eventAt(0);
+    EXPECT_EQ(E.FD, P.getRead()->raw());
+    EXPECT_TRUE(E.Incoming);
+  }
+}
+
+TEST(IOUring, WaitTimesOut)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  IOUring Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  auto Start = std::chrono::steady_clock::now();
+  EXPECT_EQ(Poll.wait(std::chrono::milliseconds{10}), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - Start,
+            std::chrono::milliseconds{10});
+
+  // The timeout must not linger and cut a later wait short.
+  P.getWrite()->write("x");
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_EQ(Poll.eventAt(0).FD, P.getRead()->raw());
+}
+
+TEST(IOUring, ScheduledAndStoppedEvents)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  IOUring Poll{4};
+  Poll.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  P.getWrite()->write("x");
+  Poll.stop(P.getRead()->raw());
+
+  Poll.schedule(P.getWrite()->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  ASSERT_EQ(Poll.wait(), 1);
+  EXPECT_EQ(Poll.getScheduledCount(), 1);
+  EXPECT_EQ(Poll.getEventCount(), 0);
+  EXPECT_EQ(Poll.eventAt(0).FD, P.getWrite()->raw());
+}
+TEST(IOUring, QueuedReadsDeliverData)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  Pipe& Reader = *P.getRead();
+  IOUring Poll{4};
+  ASSERT_TRUE(Poll.startQueuedReads(Reader.raw()));
+  Reader.readThrough(&Poll);
+  Poll.listen(Reader.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  P.getWrite()->write("Hello");
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_EQ(Poll.eventAt(0).FD, Reader.raw());
+  EXPECT_TRUE(Poll.eventAt(0).Incoming);
+  EXPECT_EQ(Reader.read(16), "Hello");
+  // The next read is in flight, and nothing was read by it yet.
+  EXPECT_EQ(Reader.read(16), "");
+
+  P.getWrite()->write("World");
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_EQ(Reader.read(16), "World");
+
+  Poll.stop(Reader.raw());
+  Poll.stopQueuedReads(Reader.raw());
+}
+
+TEST(IOUring, QueuedReadsReportedWhenListenedAgain)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  Pipe& Reader = *P.getRead();
+  IOUring Poll{4};
+  ASSERT_TRUE(Poll.startQueuedReads(Reader.raw()));
+  Reader.readThrough(&Poll);
+  Poll.listen(Reader.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  P.getWrite()->write("1");
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  // The data is not taken, and the file is not listened for a while.
+  Poll.stop(Reader.raw());
+  P.getWrite()->write("2");
+  EXPECT_EQ(Poll.wait(std::chrono::milliseconds{10}), 0);
+
+  Poll.listen(Reader.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_TRUE(Poll.eventAt(0).Incoming);
+  EXPECT_EQ(Reader.read(16), "1");
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_EQ(Reader.read(16), "2");
+
+  Poll.stop(Reader.raw());
+  Poll.stopQueuedReads(Reader.raw());
+}
+
+TEST(IOUring, QueuedReadsReachEndOfFile)
+{
+  Pipe::AnonymousPipe P = Pipe::create();
+  std::unique_ptr<Pipe> Reader = P.takeRead();
+  IOUring Poll{4};
+  ASSERT_TRUE(Poll.startQueuedReads(Reader->raw()));
+  Reader->readThrough(&Poll);
+  Poll.listen(Reader->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_TRUE(Poll.eventAt(0).Incoming);
+  EXPECT_EQ(Reader->read(16), "");
+  EXPECT_TRUE(Reader->failed());
+
+  Poll.stop(Reader->raw());
+  Poll.stopQueuedReads(Reader->raw());
+}
+
+namespace
+{
+
+std::pair<Socket, Socket> connectedSockets()
+{
+  int FDs[2];
+  EXPECT_EQ(
+    ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, FDs),
+    0);
+  return {Socket::wrap(fd{FDs[0]}, "writer"),
+          Socket::wrap(fd{FDs[1]}, "reader")};
+}
+
+} // namespace
+
+TEST(IOUring, QueuedWritesKeepOrder)
+{
+  auto [Writer, Peer] = connectedSockets();
+  IOUring Poll{4};
+  Writer.writeThrough(&Poll);
+  ASSERT_TRUE(Writer.writesQueued());
+  Poll.listen(Writer.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  EXPECT_EQ(Writer.write("1"), 1);
+  // The first write is in flight, so the second one is buffered.
+  Writer.write("2");
+  EXPECT_TRUE(Writer.hasBufferedWrite());
+
+  // The completion of the write is reported to flush the buffer.
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+  EXPECT_TRUE(Poll.eventAt(0).Outgoing);
+  Writer.flushWrites();
+  EXPECT_FALSE(Writer.hasBufferedWrite());
+  ASSERT_EQ(Poll.wait(std::chrono::milliseconds{1000}), 1);
+
+  // Bulk data is written directly, after the queued writes completed.
+  const std::string Bulk(2 * IOUring::BufferSize, 'x');
+  EXPECT_GT(Writer.write(Bulk), 0);
+
+  std::string Received;
+  for (int I = 0; I < 100 && Received.size() < Bulk.size() + 2; ++I)
+  {
+    Received += Peer.read(Bulk.size());
+    Poll.wait(std::chrono::milliseconds{10});
+    Writer.flushWrites();
+  }
+  EXPECT_FALSE(Writer.hasBufferedWrite());
+  EXPECT_EQ(Received, "12" + Bulk);
+  Poll.stop(Writer.raw());
+}
+
+TEST(IOUring, QueuedWriteCompletesAfterMove)
+{
+  auto [Writer, Peer] = connectedSockets();
+  IOUring First{4};
+  IOUring Second{4};
+  Writer.writeThrough(&First);
+  First.listen(Writer.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  EXPECT_EQ(Writer.write("1"), 1);
+  First.stop(Writer.raw());
+  Writer.writeThrough(&Second);
+  Second.listen(Writer.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  Writer.write("2");
+  EXPECT_TRUE(Writer.hasBufferedWrite());
+
+  // The write in flight completes in the first queue, which tells the second
+  // one to flush what was buffered meanwhile.
+  EXPECT_EQ(First.wait(std::chrono::milliseconds{1000}), 0);
+  ASSERT_EQ(Second.wait(std::chrono::milliseconds{0}), 1);
+  EXPECT_EQ(Second.eventAt(0).FD, Writer.raw());
+  EXPECT_TRUE(Second.eventAt(0).Outgoing);
+  Writer.flushWrites();
+  ASSERT_EQ(Second.wait(std::chrono::milliseconds{1000}), 1);
+
+  EXPECT_EQ(Peer.read(16), "12");
+  Second.stop(Writer.raw());
+}
+#endif /* MONOMUX_IO_URING */
@@ -0,0 +1,193 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "monomux/system/Event.hpp"
+#include "monomux/system/EventTrace.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+/// \returns a unique path in the temporary directory.
+std::string makePath()
+{
+  const char* Dir = std::getenv("TMPDIR");
+  return std::string{Dir ? Dir : "/tmp"} + "/monomux-test-trace-" +
+         std::to_string(::getpid()) + '-' +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name() +
+         ".trace";
+}
+
+} // namespace
+
+TEST(EventTrace, RoundTrip)
+{
+  const std::string Path = makePath();
+  {
+    EventTrace T{Path};
+    const auto Start = EventTrace::Clock::now();
+    T.batch(Start, 2, Start + 100us);
+    T.event(4, /* Incoming =*/true, /* Outgoing =*/false);
+    T.event(7, /* Incoming =*/true, /* Outgoing =*/true);
+    T.io(EventTrace::Read, 4, 512, Start + 300us);
+    T.io(EventTrace::Write, 7, 70000, Start + 600us);
+    T.batch(Start + 1100us, 0, Start + 1200us);
+  }
+
+  auto Batches = EventTraceReader::load(Path);
+  ::unlink(Path.c_str());
+  ASSERT_TRUE(Batches.has_value());
+  ASSERT_EQ(Batches->size(), 2);
+
+  const EventTraceReader::Batch& First = Batches->front();
+  EXPECT_EQ(First.Waited, 100us);
+  ASSERT_EQ(First.Events.size(), 2);
+  EXPECT_EQ(First.Events[0].FD, 4);
+  EXPECT_TRUE(First.Events[0].Incoming);
+  EXPECT_FALSE(First.Events[0].Outgoing);
+  EXPECT_EQ(First.Events[1].FD, 7);
+  EXPECT_TRUE(First.Events[1].Outgoing);
+  ASSERT_EQ(First.IOs.size(), 2);
+  EXPECT_EQ(First.IOs[0].Kind, EventTrace::Read);
+  EXPECT_EQ(First.IOs[0].Bytes, 512);
+  EXPECT_EQ(First.IOs[1].Kind, EventTrace::Write);
+  EXPECT_EQ(First.IOs[1].FD, 7);
+  EXPECT_EQ(First.IOs[1].Bytes, 70000);
+  // The handling lasted from the end of the first wait to the second.
+  ASSERT_TRUE(First.Handled.has_value());
+  EXPECT_EQ(*First.Handled, 1000us);
+
+  const EventTraceReader::Batch& Second = Batches->back();
+  EXPECT_EQ(Second.Start - First.Start, 1100us);
+  EXPECT_TRUE(Second.Events.empty());
+  EXPECT_FALSE(Second.Handled.has_value());
+}
+
+TEST(EventTrace, TruncatedTraceKeepsWholeRecords)
+{
+  const std::string Path = makePath();
+  {
+    EventTrace T{Path};
+    const auto Now = EventTrace::Clock::now();
+    T.batch(Now, 1, Now);
+    T.event(3, /* Incoming =*/true, /* Outgoing =*/false);
+    T.batch(Now, 1, Now);
+    T.event(3, /* Incoming =*/true, /* Outgoing =*/false);
+  }
+  std::ifstream File{Path, std::ios::binary};
+  std::string Data{std::istreambuf_iterator<char>{File},
+                   std::istreambuf_iterator<char>{}};
+  ::unlink(Path.c_str());
+
+  // The program writing the trace was killed in the middle of a record.
+  Data.pop_back();
+  auto Batches = EventTraceReader::parse(Data);
+  ASSERT_TRUE(Batches.has_value());
+  EXPECT_EQ(Batches->size(), 1);
+
+  EXPECT_TRUE(EventTraceReader::parse(EventTrace::Magic)->empty());
+  EXPECT_FALSE(EventTraceReader::parse("garbage").has_value());
+}
+
+TEST(EventTrace, ConnectionChangesKeepBatchesWhole)
+{
+  const std::string Path = makePath();
+  {
+    EventTrace T{Path};
+    const auto Now = EventTrace::Clock::now();
+    T.connection(EventTrace::Open, 4, EventTrace::SessionRole, Now);
+    T.batch(Now, 1, Now);
+    // Written by another thread while the events of the batch are recorded.
+    T.connection(EventTrace::Open, 7, EventTrace::ClientDataRole, Now);
+    T.attachment(EventTrace::Attach, 7, 4, Now);
+    T.event(4, /* Incoming =*/true, /* Outgoing =*/false);
+    T.connection(EventTrace::Close, 7, EventTrace::ClientDataRole, Now);
+    T.batch(Now, 0, Now);
+  }
+
+  auto Batches = EventTraceReader::load(Path);
+  ::unlink(Path.c_str());
+  ASSERT_TRUE(Batches.has_value());
+  ASSERT_EQ(Batches->size(), 2);
+
+  const EventTraceReader::Batch& First = Batches->front();
+  ASSERT_EQ(First.Changes.size(), 1);
+  EXPECT_EQ(First.Changes[0].Kind, EventTrace::Open);
+  EXPECT_EQ(First.Changes[0].FD, 4);
+  EXPECT_EQ(First.Changes[0].Role, EventTrace::SessionRole);
+  ASSERT_EQ(First.Events.size(), 1);
+  EXPECT_EQ(First.Events[0].FD, 4);
+
+  const EventTraceReader::Batch& Second = Batches->back();
+  ASSERT_EQ(Second.Changes.size(), 3);
+  EXPECT_EQ(Second.Changes[0].Kind, EventTrace::Open);
+  EXPECT_EQ(Second.Changes[0].Role, EventTrace::ClientDataRole);
+  EXPECT_EQ(Second.Changes[1].Kind, EventTrace::Attach);
+  EXPECT_EQ(Second.Changes[1].FD, 7);
+  EXPECT_EQ(Second.Changes[1].Session, 4);
+  EXPECT_EQ(Second.Changes[2].Kind, EventTrace::Close);
+  EXPECT_EQ(Second.Changes[2].FD, 7);
+}
+
+TEST(EventTrace, CapturesEventLoop)
+{
+  const std::string Path = makePath();
+  auto [A, B] = Socket::pair("trace");
+  {
+    EventTrace T{Path};
+    EPoll Poll{4};
+    Poll.setTrace(&T);
+    Poll.listen(B.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+    A.write("ping");
+    ASSERT_EQ(Poll.wait(), 1);
+    EXPECT_EQ(EventTrace::current(), &T);
+    EXPECT_EQ(B.read(4), "ping");
+    B.write("pong!");
+    EXPECT_EQ(Poll.wait(0ms), 0);
+  }
+  EXPECT_EQ(EventTrace::current(), nullptr);
+  EXPECT_EQ(A.read(5), "pong!");
+
+  auto Batches = EventTraceReader::load(Path);
+  ::unlink(Path.c_str());
+  ASSERT_TRUE(Batches.has_value());
+  ASSERT_EQ(Batches->size(), 2);
+  const EventTraceReader::Batch& First = Batches->front();
+  ASSERT_EQ(First.Events.size(), 1);
+  EXPECT_EQ(First.Events[0].FD, B.raw());
+  ASSERT_EQ(First.IOs.size(), 2);
+  EXPECT_EQ(First.IOs[0].Kind, EventTrace::Read);
+  EXPECT_EQ(First.IOs[0].FD, B.raw());
+  EXPECT_EQ(First.IOs[0].Bytes, 4);
+  EXPECT_EQ(First.IOs[1].Kind, EventTrace::Write);
+  EXPECT_EQ(First.IOs[1].Bytes, 5);
+  EXPECT_TRUE(Batches->back().Events.empty());
+}
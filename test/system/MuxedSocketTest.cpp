@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <fcntl.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/MuxedSocket.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+struct Muxed
+{
+  std::unique_ptr<MuxedSocket> Control;
+  std::unique_ptr<MuxedSocket> Data;
+};
+
+Muxed mux(Socket&& S)
+{
+  std::string Identifier = S.identifier();
+  auto [Control, Data] =
+    MuxedSocket::create(std::move(S).release(), std::move(Identifier));
+  return Muxed{std::move(Control), std::move(Data)};
+}
+
+} // namespace
+
+TEST(MuxedSocket, FrameFormat)
+{
+  auto [A, B] = Socket::pair("mux");
+  Muxed M = mux(std::move(A));
+  EXPECT_EQ(M.Control->raw(), M.Data->raw());
+
+  M.Control->write("ctrl");
+  M.Data->write("data!");
+  EXPECT_EQ(B.read(17), std::string("\x01\x00\x04\x00"
+                                    "ctrl"
+                                    "\x00\x00\x05\x00"
+                                    "data!",
+                                    17));
+
+  B.write(std::string("\x00\x00\x02\x00"
+                      "hi",
+                      6));
+  EXPECT_EQ(M.Data->read(2), "hi");
+}
+
+TEST(MuxedSocket, ReadingDemultiplexes)
+{
+  auto [A, B] = Socket::pair("mux");
+  Muxed MA = mux(std::move(A));
+  Muxed MB = mux(std::move(B));
+
+  MA.Data->write("data1");
+  MA.Control->write("ctrl");
+  MA.Data->write("data2");
+
+  EXPECT_EQ(MB.Control->read(4), "ctrl");
+  // The data frame before the control one was kept for the data stream.
+  EXPECT_TRUE(MB.Data->hasBufferedRead());
+  EXPECT_FALSE(MB.Control->hasBufferedRead());
+  EXPECT_TRUE(MB.Control->connectionHasBufferedRead());
+  EXPECT_EQ(MB.Data->read(10), "data1data2");
+}
+
+TEST(MuxedSocket, FramesArriveInPieces)
+{
+  auto [A, B] = Socket::pair("mux");
+  Muxed M = mux(std::move(A));
+
+  B.write(std::string("\x01\x00", 2));
+  B.write(std::string("\x03\x00"
+                      "ab",
+                      4));
+  B.write(std::string("c"
+                      "\x00\x00\x01\x00"
+                      "d",
+                      6));
+  EXPECT_EQ(M.Control->read(3), "abc");
+  EXPECT_EQ(M.Data->read(1), "d");
+}
+
+TEST(MuxedSocket, InvalidFrameFailsConnection)
+{
+  auto [A, B] = Socket::pair("mux");
+  Muxed M = mux(std::move(A));
+
+  B.write(std::string("\x07\x00\x01\x00"
+                      "x",
+                      5));
+  EXPECT_EQ(M.Data->read(1), "");
+  EXPECT_TRUE(M.Data->failed());
+  EXPECT_TRUE(M.Control->failed());
+}
+
+TEST(MuxedSocket, PartialFrameHoldsBackOtherStream)
+{
+  auto [A, B] = Socket::pair("mux");
+  fd::addStatusFlag(A.raw(), O_NONBLOCK);
+  fd::addStatusFlag(B.raw(), O_NONBLOCK);
+  Muxed MA = mux(std::move(A));
+  Muxed MB = mux(std::move(B));
+
+  // Large enough to fill the socket in the middle of a frame.
+  const std::string Big(1 << 22, 'x');
+  EXPECT_LT(MA.Data->write(Big), Big.size());
+  EXPECT_EQ(MA.Control->write("ctrl"), 0);
+  EXPECT_TRUE(MA.Control->hasBufferedWrite());
+
+  std::string Data;
+  std::string Control;
+  while (Data.size() < Big.size() || Control.empty())
+  {
+    MA.Data->flushConnection();
+    Data.append(MB.Data->read(1 << 16));
+    if (MB.Control->hasBufferedRead())
+      Control.append(MB.Control->read(4));
+  }
+  EXPECT_EQ(Data, Big);
+  EXPECT_EQ(Control, "ctrl");
+  EXPECT_FALSE(MA.Control->connectionHasBufferedWrite());
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Event.hpp"
+#include "monomux/system/OutputCoalescer.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+CoalescingLimits limits()
+{
+  CoalescingLimits L;
+  L.MaxDelay = std::chrono::milliseconds{1};
+  L.MaxBytes = 16;
+  return L;
+}
+
+/// Blocks until the timer of \p C fires.
+void waitForTimer(const OutputCoalescer& C)
+{
+  EPoll Poll{1};
+  Poll.listen(C.timerFD(), /* Incoming =*/true, /* Outgoing =*/false);
+  // An interrupted wait reports no events, e.g. when the teardown of an
+  // io_uring instance of an earlier test notifies the thread.
+  std::size_t Events;
+  while ((Events = Poll.wait()) == 0)
+    ;
+  ASSERT_EQ(Events, 1);
+}
+
+} // namespace
+
+TEST(OutputCoalescer, WritesImmediatelyAfterIdle)
+{
+  OutputCoalescer C{limits()};
+  EXPECT_FALSE(C.shouldWrite(0));
+  EXPECT_TRUE(C.shouldWrite(1));
+  // Following output is held back...
+  EXPECT_FALSE(C.shouldWrite(1));
+  EXPECT_FALSE(C.shouldWrite(15));
+  // ... until enough accumulates.
+  EXPECT_TRUE(C.shouldWrite(16));
+}
+
+TEST(OutputCoalescer, WritesHeldBackOutputOnExpiry)
+{
+  OutputCoalescer C{limits()};
+  EXPECT_TRUE(C.shouldWrite(1));
+  EXPECT_FALSE(C.shouldWrite(4));
+
+  waitForTimer(C);
+  EXPECT_TRUE(C.expired(4));
+  // The output is still streaming, so more would be held back.
+  EXPECT_FALSE(C.shouldWrite(2));
+
+  waitForTimer(C);
+  EXPECT_TRUE(C.expired(2));
+
+  // If nothing arrived during the delay, the output went idle.
+  waitForTimer(C);
+  EXPECT_FALSE(C.expired(0));
+  EXPECT_TRUE(C.shouldWrite(1));
+}
+
+TEST(OutputCoalescer, DisabledByDefault)
+{
+  EXPECT_FALSE(CoalescingLimits{}.enabled());
+  EXPECT_TRUE(limits().enabled());
+}
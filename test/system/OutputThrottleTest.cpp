@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/OutputThrottle.hpp"
+
+using namespace monomux;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+ThrottleLimits limits()
+{
+  ThrottleLimits L;
+  L.Rate = 1000;
+  L.Burst = 400;
+  return L;
+}
+
+} // namespace
+
+TEST(OutputThrottle, AllowsBurst)
+{
+  const auto Start = OutputThrottle::Clock::now();
+  OutputThrottle T{limits(), Start};
+  EXPECT_TRUE(T.consumed(399, Start));
+  EXPECT_FALSE(T.throttled());
+  EXPECT_FALSE(T.consumed(1, Start));
+  EXPECT_TRUE(T.throttled());
+}
+
+TEST(OutputThrottle, RefillsAtRate)
+{
+  const auto Start = OutputThrottle::Clock::now();
+  OutputThrottle T{limits(), Start};
+  EXPECT_FALSE(T.consumed(400, Start));
+
+  // A quarter of the burst is needed to resume, which takes 100 ms.
+  EXPECT_FALSE(T.expired(Start + 50ms));
+  EXPECT_TRUE(T.throttled());
+  EXPECT_TRUE(T.consumed(99, Start + 100ms));
+  EXPECT_FALSE(T.consumed(1, Start + 100ms));
+}
+
+TEST(OutputThrottle, OverdraftDelaysResume)
+{
+  const auto Start = OutputThrottle::Clock::now();
+  OutputThrottle T{limits(), Start};
+  // More might be read at once than is available, which is paid back first.
+  EXPECT_FALSE(T.consumed(600, Start));
+  EXPECT_FALSE(T.consumed(0, Start + 200ms));
+  EXPECT_TRUE(T.consumed(0, Start + 201ms));
+}
+
+TEST(OutputThrottle, IdleDoesNotAccumulateBeyondBurst)
+{
+  const auto Start = OutputThrottle::Clock::now();
+  OutputThrottle T{limits(), Start};
+  EXPECT_TRUE(T.consumed(100, Start));
+  EXPECT_TRUE(T.consumed(399, Start + 1h));
+  EXPECT_FALSE(T.consumed(1, Start + 1h));
+}
+
+TEST(OutputThrottle, TimerFiresWhenReadingMayResume)
+{
+  ThrottleLimits L;
+  L.Rate = 1'000'000;
+  OutputThrottle T{L};
+  EXPECT_FALSE(T.consumed(L.burst()));
+  ASSERT_TRUE(T.throttled());
+
+  // The timer is armed for a quarter second.
+  std::this_thread::sleep_for(300ms);
+  EXPECT_TRUE(T.expired());
+  EXPECT_FALSE(T.throttled());
+}
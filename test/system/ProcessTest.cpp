@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <optional>
+#include <string>
+
+#include <poll.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Pipe.hpp"
+#include "monomux/system/Process.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+/// Runs \p Script in a shell, and returns what it printed.
+std::string runShell(Process::SpawnOptions& SO, const std::string& Script)
+{
+  SO.Program = "/bin/sh";
+  SO.Arguments = {"-c", Script};
+  Pipe::AnonymousPipe Out = Pipe::create(true);
+  SO.StandardOutput.emplace(Out.getWrite()->raw());
+
+  Process P = Process::spawn(SO);
+  P.wait();
+  EXPECT_EQ(P.exitCode(), 0);
+
+  std::unique_ptr<Pipe> Read = Out.takeRead();
+  Read->setNonblocking();
+  return Read->read(256);
+}
+
+} // namespace
+
+TEST(Process, SpawnSetsEnvironment)
+{
+  ::setenv("MONOMUX_TEST_INHERITED", "inherited", 1);
+  ::setenv("MONOMUX_TEST_UNSET", "unset", 1);
+
+  Process::SpawnOptions SO;
+  SO.Environment["MONOMUX_TEST_SET"] = "set";
+  SO.Environment["MONOMUX_TEST_UNSET"] = std::nullopt;
+  EXPECT_EQ(runShell(SO,
+                     "echo \"$MONOMUX_TEST_INHERITED,$MONOMUX_TEST_SET,"
+                     "${MONOMUX_TEST_UNSET:-none}\""),
+            "inherited,set,none\n");
+
+  // The environment of the parent is left intact.
+  EXPECT_EQ(std::string{::getenv("MONOMUX_TEST_UNSET")}, "unset");
+  EXPECT_EQ(::getenv("MONOMUX_TEST_SET"), nullptr);
+  ::unsetenv("MONOMUX_TEST_INHERITED");
+  ::unsetenv("MONOMUX_TEST_UNSET");
+}
+
+TEST(Process, SpawnStartsNewSession)
+{
+  Process::SpawnOptions SO;
+  std::string PIDs = runShell(SO, "echo $$ $(ps -o sid= -p $$)");
+  std::size_t Space = PIDs.find(' ');
+  ASSERT_NE(Space, std::string::npos);
+  EXPECT_EQ(std::stoi(PIDs.substr(0, Space)),
+            std::stoi(PIDs.substr(Space + 1)));
+}
+
+TEST(Process, SpawnRestrictsCPUs)
+{
+  const CPUSet Parent = CPUSet::ofThisThread();
+  CPUSet Last;
+  Last.add(Parent.cpus().back());
+
+  Process::SpawnOptions SO;
+  SO.Affinity = Last;
+  EXPECT_EQ(runShell(SO,
+                     "sed -n 's/^Cpus_allowed_list:[[:space:]]*//p' "
+                     "/proc/$$/status"),
+            Last.toString() + '\n');
+  EXPECT_EQ(CPUSet::ofThisThread(), Parent);
+}
+
+TEST(Process, SpawnFailureExits)
+{
+  Process::SpawnOptions SO;
+  SO.Program = "/nonexistent/monomux-test";
+  Process P = Process::spawn(SO);
+  P.wait();
+  EXPECT_NE(P.exitCode(), 0);
+}
+
+TEST(Process, SpawnWithPty)
+{
+  Process::SpawnOptions SO;
+  SO.Program = "/bin/sh";
+  SO.Arguments = {"-c", "test -t 0 && test -t 1 && printf tty"};
+  SO.CreatePTY = true;
+
+  Process P = Process::spawn(SO);
+  ASSERT_TRUE(P.hasPty());
+  // The output must be read before the terminal is hung up by the exit.
+  ::pollfd PFD{P.getPty()->raw().get(), POLLIN, 0};
+  ASSERT_EQ(::poll(&PFD, 1, 5000), 1);
+  EXPECT_EQ(P.getPty()->reader().read(16), "tty");
+  P.wait();
+  EXPECT_EQ(P.exitCode(), 0);
+}
+
+TEST(Process, UsageOfRunningProcess)
+{
+  std::optional<Process::ResourceUsage> Self =
+    Process::usage(Process::thisProcess());
+  ASSERT_TRUE(Self);
+  EXPECT_GT(Self->RSSBytes, 0);
+
+  Process::SpawnOptions SO;
+  SO.Program = "/bin/sh";
+  SO.Arguments = {"-c", "exit 0"};
+  Process P = Process::spawn(SO);
+  const Process::raw_handle PID = P.raw();
+  P.wait();
+  EXPECT_FALSE(Process::usage(PID));
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "monomux/system/Recorder.hpp"
+
+using namespace monomux;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+/// \returns a unique path in the temporary directory.
+std::string makePath()
+{
+  const char* Dir = std::getenv("TMPDIR");
+  return std::string{Dir ? Dir : "/tmp"} + "/monomux-test-cast-" +
+         std::to_string(::getpid()) + '-' +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name() +
+         ".cast";
+}
+
+std::vector<std::string> readLines(const std::string& Path)
+{
+  std::ifstream File{Path};
+  std::vector<std::string> Lines;
+  for (std::string Line; std::getline(File, Line);)
+    Lines.emplace_back(std::move(Line));
+  return Lines;
+}
+
+} // namespace
+
+TEST(Recorder, WritesAsciicast)
+{
+  const std::string Path = makePath();
+  {
+    Recorder Rec;
+    std::shared_ptr<Recording> R = Rec.start(Path, 24, 80, "a \"title\"");
+    const auto Start = Recording::Clock::now();
+    EXPECT_TRUE(R->output("hello\r\n", Start + 1500ms));
+    EXPECT_TRUE(R->resize(30, 100, Start + 2s));
+    EXPECT_TRUE(R->output("\x1b[1m\\", Start + 2s));
+    R->finish();
+  }
+
+  std::vector<std::string> Lines = readLines(Path);
+  ASSERT_EQ(Lines.size(), 4);
+  EXPECT_EQ(Lines[0].find("{\"version\": 2, \"width\": 80, \"height\": 24"), 0);
+  EXPECT_NE(Lines[0].find("\"title\": \"a \\\"title\\\"\"}"), std::string::npos);
+  EXPECT_EQ(Lines[1].substr(0, 3), "[1.");
+  EXPECT_EQ(Lines[1].substr(Lines[1].find(',')), ", \"o\", \"hello\\r\\n\"]");
+  EXPECT_EQ(Lines[2].substr(Lines[2].find(',')), ", \"r\", \"100x30\"]");
+  EXPECT_EQ(Lines[3].substr(Lines[3].find(',')),
+            ", \"o\", \"\\u001b[1m\\\\\"]");
+  ::unlink(Path.c_str());
+}
+
+TEST(Recorder, KeepsCharactersSplitBetweenChunksTogether)
+{
+  const std::string Path = makePath();
+  {
+    Recorder Rec;
+    std::shared_ptr<Recording> R = Rec.start(Path, 24, 80, "");
+    // "é" is C3 A9 in UTF-8, and FF is never valid.
+    R->output("caf\xC3");
+    R->output("\xA9\xFF");
+    R->finish();
+  }
+
+  std::vector<std::string> Lines = readLines(Path);
+  ASSERT_EQ(Lines.size(), 3);
+  EXPECT_EQ(Lines[1].substr(Lines[1].find(',')), ", \"o\", \"caf\"]");
+  EXPECT_EQ(Lines[2].substr(Lines[2].find(',')),
+            ", \"o\", \"\xC3\xA9\\u00ff\"]");
+  ::unlink(Path.c_str());
+}
+
+TEST(Recorder, DropsWhenQueueIsFull)
+{
+  const std::string Path = makePath();
+  {
+    Recorder Rec;
+    std::shared_ptr<Recording> R =
+      Rec.start(Path, 24, 80, "", /* QueueSize =*/64);
+    EXPECT_FALSE(R->output(std::string(100, 'x')));
+    EXPECT_EQ(R->dropped(), 1);
+    EXPECT_TRUE(R->output("fits"));
+    R->finish();
+  }
+
+  std::vector<std::string> Lines = readLines(Path);
+  ASSERT_EQ(Lines.size(), 2);
+  EXPECT_EQ(Lines[1].substr(Lines[1].find(',')), ", \"o\", \"fits\"]");
+  ::unlink(Path.c_str());
+}
@@ -0,0 +1,131 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/ScreenState.hpp"
+
+using namespace monomux;
+
+TEST(ScreenState, PrintsAndWraps)
+{
+  ScreenState S{3, 5};
+  S.feed("Hello World");
+  EXPECT_EQ(S.rowText(0), "Hello");
+  EXPECT_EQ(S.rowText(1), " Worl");
+  EXPECT_EQ(S.rowText(2), "d");
+  EXPECT_EQ(S.cursorRow(), 2);
+  EXPECT_EQ(S.cursorColumn(), 1);
+}
+
+TEST(ScreenState, ScrollsOffTheTop)
+{
+  ScreenState S{2, 10};
+  S.feed("one\r\ntwo\r\nthree");
+  EXPECT_EQ(S.rowText(0), "two");
+  EXPECT_EQ(S.rowText(1), "three");
+}
+
+TEST(ScreenState, SequencesSplitBetweenChunks)
+{
+  ScreenState S{4, 10};
+  S.feed("abc\033[");
+  S.feed("3;");
+  S.feed("5Hx\033]0;title");
+  S.feed("\ayz");
+  EXPECT_EQ(S.rowText(0), "abc");
+  EXPECT_EQ(S.rowText(2), "    xyz");
+}
+
+TEST(ScreenState, EraseAndEdit)
+{
+  ScreenState S{2, 10};
+  S.feed("0123456789\033[1;3H\033[K");
+  EXPECT_EQ(S.rowText(0), "01");
+  S.feed("\033[2;1Habcdef\033[2;2H\033[2P");
+  EXPECT_EQ(S.rowText(1), "adef");
+  S.feed("\033[2J");
+  EXPECT_EQ(S.rowText(0), "");
+  EXPECT_EQ(S.rowText(1), "");
+}
+
+TEST(ScreenState, IgnoresRenditionAndKeepsUTF8)
+{
+  ScreenState S{1, 10};
+  S.feed("\033[1;31ma\xc3");
+  S.feed("\xa1\033[0mb");
+  EXPECT_EQ(S.rowText(0), "a\xc3\xa1"
+                          "b");
+  EXPECT_EQ(S.cursorColumn(), 3);
+}
+
+TEST(ScreenState, AlternateScreenRestoresMain)
+{
+  ScreenState S{2, 10};
+  S.feed("shell$ ");
+  S.feed("\033[?1049h\033[Heditor");
+  EXPECT_EQ(S.rowText(0), "editor");
+  S.feed("\033[?1049l");
+  EXPECT_EQ(S.rowText(0), "shell$");
+  EXPECT_EQ(S.cursorColumn(), 7);
+}
+
+TEST(ScreenState, ScrollRegion)
+{
+  ScreenState S{4, 10};
+  S.feed("top\033[2;3r\033[2;1Ha\r\nb\r\nc");
+  EXPECT_EQ(S.rowText(0), "top");
+  EXPECT_EQ(S.rowText(1), "b");
+  EXPECT_EQ(S.rowText(2), "c");
+  EXPECT_EQ(S.rowText(3), "");
+}
+
+TEST(ScreenState, SnapshotDrawsScreen)
+{
+  ScreenState S{3, 10};
+  S.feed("ab\r\n\r\ncd");
+  EXPECT_EQ(S.snapshot(),
+            "\033[0m\033[r\033[H\033[2J\033[1;1Hab\033[3;1Hcd\033[3;3H");
+
+  // Replaying the snapshot yields the same screen.
+  ScreenState Replayed{3, 10};
+  S.feed("\033[2;5Hx");
+  Replayed.feed("garbage");
+  Replayed.feed(S.snapshot());
+  for (std::size_t R = 0; R < 3; ++R)
+    EXPECT_EQ(Replayed.rowText(R), S.rowText(R));
+  EXPECT_EQ(Replayed.cursorRow(), S.cursorRow());
+  EXPECT_EQ(Replayed.cursorColumn(), S.cursorColumn());
+}
+
+TEST(ScreenState, ResizeKeepsCursorLine)
+{
+  ScreenState S{4, 10};
+  S.feed("1\r\n2\r\n3\r\n4");
+  S.resize(2, 5);
+  EXPECT_EQ(S.rows(), 2);
+  EXPECT_EQ(S.rowText(0), "3");
+  EXPECT_EQ(S.rowText(1), "4");
+  EXPECT_EQ(S.cursorRow(), 1);
+
+  S.resize(0, 0);
+  EXPECT_EQ(S.rows(), 2);
+  EXPECT_EQ(S.columns(), 5);
+}
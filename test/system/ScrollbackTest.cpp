@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Scrollback.hpp"
+
+using namespace monomux;
+
+TEST(Scrollback, KeepsEverythingWithinLimit)
+{
+  Scrollback S{64};
+  S.append("Hello ");
+  S.append("World!");
+  EXPECT_EQ(S.size(), 12);
+  EXPECT_EQ(S.tail(), "Hello World!");
+
+  S.clear();
+  EXPECT_TRUE(S.empty());
+  EXPECT_EQ(S.tail(), "");
+}
+
+TEST(Scrollback, DiscardsOldestAndStartsAtLine)
+{
+  Scrollback S{16};
+  S.append("first\nsecond\n");
+  S.append("third\n");
+  EXPECT_EQ(S.size(), 16);
+  // The partial line "st\n" that survived is not replayed.
+  EXPECT_EQ(S.tail(), "second\nthird\n");
+}
+
+TEST(Scrollback, HugeAppendKeepsOnlyTail)
+{
+  Scrollback S{8};
+  S.append(std::string(100, 'x') + "\nabc");
+  EXPECT_EQ(S.size(), 8);
+  EXPECT_EQ(S.tail(), "abc");
+}
+
+TEST(Scrollback, DisabledKeepsNothing)
+{
+  Scrollback S{0};
+  S.append("Hello");
+  EXPECT_TRUE(S.empty());
+}
+
+TEST(Scrollback, SpillKeepsOutputOutOfMemory)
+{
+  Scrollback S{64};
+  S.append("first\nsecond\n");
+  EXPECT_GT(S.spill(::testing::TempDir()), 0);
+  EXPECT_TRUE(S.spilled());
+  EXPECT_GT(S.spilledBytes(), 0);
+  EXPECT_EQ(S.size(), 13);
+  EXPECT_EQ(S.tail(), "first\nsecond\n");
+
+  // New output loads the spilled output back.
+  S.append("third\n");
+  EXPECT_FALSE(S.spilled());
+  EXPECT_EQ(S.tail(), "first\nsecond\nthird\n");
+}
+
+TEST(Scrollback, SpillKeepsTruncation)
+{
+  Scrollback S{16};
+  S.append("first\nsecond\nthird\n");
+  S.spill(::testing::TempDir());
+  EXPECT_EQ(S.tail(), "second\nthird\n");
+
+  S.clear();
+  EXPECT_TRUE(S.empty());
+  EXPECT_EQ(S.tail(), "");
+}
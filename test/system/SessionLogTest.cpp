@@ -0,0 +1,85 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "monomux/system/SessionLog.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+/// \returns a unique path prefix in the temporary directory.
+std::string makePrefix()
+{
+  const char* Dir = std::getenv("TMPDIR");
+  return std::string{Dir ? Dir : "/tmp"} + "/monomux-test-log-" +
+         std::to_string(::getpid()) + '-' +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name();
+}
+
+bool exists(const std::string& Path)
+{
+  return ::access(Path.c_str(), F_OK) == 0;
+}
+
+} // namespace
+
+TEST(SessionLog, TailWithinSegment)
+{
+  const std::string Prefix = makePrefix();
+  {
+    SessionLog L{Prefix, 1024, 64};
+    EXPECT_TRUE(exists(Prefix + ".000000.log"));
+    L.append("Hello ");
+    L.append("World!");
+    EXPECT_EQ(L.size(), 12);
+    EXPECT_EQ(L.tail(100), "Hello World!");
+  }
+  EXPECT_FALSE(exists(Prefix + ".000000.log"));
+}
+
+TEST(SessionLog, TailAcrossSegments)
+{
+  const std::string Prefix = makePrefix();
+  SessionLog L{Prefix, 1024, 8};
+  L.append("0123456\nabcdefgh\nXYZ");
+  EXPECT_EQ(L.segmentCount(), 3);
+  EXPECT_EQ(L.tail(1024), "0123456\nabcdefgh\nXYZ");
+  // A partial tail begins at a line.
+  EXPECT_EQ(L.tail(10), "XYZ");
+}
+
+TEST(SessionLog, OldSegmentsRotateOut)
+{
+  const std::string Prefix = makePrefix();
+  SessionLog L{Prefix, 16, 8};
+  for (int I = 0; I < 10; ++I)
+    L.append("line 00\n");
+
+  EXPECT_GE(L.size(), 16);
+  EXPECT_LT(L.size(), 16 + 8 + 8);
+  EXPECT_FALSE(exists(Prefix + ".000000.log"));
+  EXPECT_TRUE(exists(Prefix + ".000009.log"));
+  EXPECT_EQ(L.tail(8), "line 00\n");
+}
@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/SharedRing.hpp"
+
+using namespace monomux;
+
+TEST(SharedRing, CapacityIsRoundedUp)
+{
+  SharedRing W = SharedRing::create(5000);
+  EXPECT_EQ(W.capacity(), 8192);
+  EXPECT_EQ(W.head(), 0);
+}
+
+TEST(SharedRing, ReaderMapsTheSameMemory)
+{
+  SharedRing W = SharedRing::create(4096);
+  SharedRing R = SharedRing::open(fd::dup(W.file()));
+  EXPECT_EQ(R.capacity(), W.capacity());
+
+  auto Slot = W.acquire();
+  ASSERT_TRUE(Slot);
+  W.publish("Before");
+  EXPECT_FALSE(R.active(*Slot));
+
+  std::string Out;
+  EXPECT_EQ(R.read(*Slot, Out, 4096).Read, 0);
+
+  W.activate(*Slot);
+  EXPECT_TRUE(R.active(*Slot));
+  EXPECT_EQ(R.read(*Slot, Out, 4096).Read, 0);
+
+  W.publish("Hello ");
+  W.publish("World!");
+  EXPECT_EQ(W.lag(*Slot), 12);
+  auto Result = R.read(*Slot, Out, 8);
+  EXPECT_EQ(Result.Read, 8);
+  EXPECT_EQ(Result.Lost, 0);
+  EXPECT_EQ(Out, "Hello Wo");
+  Result = R.read(*Slot, Out, 4096);
+  EXPECT_EQ(Result.Read, 4);
+  EXPECT_EQ(Out, "Hello World!");
+  EXPECT_EQ(W.lag(*Slot), 0);
+}
+
+TEST(SharedRing, ReadsAcrossTheWrap)
+{
+  SharedRing W = SharedRing::create(4096);
+  auto Slot = W.acquire();
+  W.activate(*Slot);
+
+  std::string Out;
+  W.publish(std::string(4000, 'a'));
+  EXPECT_EQ(W.read(*Slot, Out, 4096).Read, 4000);
+
+  Out.clear();
+  const std::string Data = std::string(90, 'b') + std::string(10, 'c');
+  W.publish(Data);
+  EXPECT_EQ(W.read(*Slot, Out, 4096).Read, 100);
+  EXPECT_EQ(Out, Data);
+}
+
+TEST(SharedRing, OverrunIsReported)
+{
+  SharedRing W = SharedRing::create(4096);
+  auto Slot = W.acquire();
+  W.activate(*Slot);
+
+  W.publish(std::string(4000, 'a'));
+  W.publish(std::string(1000, 'b'));
+  EXPECT_EQ(W.lag(*Slot), 5000);
+
+  std::string Out;
+  auto Result = W.read(*Slot, Out, 8192);
+  EXPECT_EQ(Result.Lost, 5000 - 4096);
+  EXPECT_EQ(Result.Read, 4096);
+  EXPECT_EQ(Out, std::string(3096, 'a') + std::string(1000, 'b'));
+
+  // Publishing more than the capacity at once keeps the end of the data.
+  Out.clear();
+  W.publish(std::string(5000, 'c') + "!");
+  Result = W.read(*Slot, Out, 8192);
+  EXPECT_EQ(Result.Lost, 5001 - 4096);
+  EXPECT_EQ(Out, std::string(4095, 'c') + "!");
+}
+
+TEST(SharedRing, WaitingFlags)
+{
+  SharedRing W = SharedRing::create(4096);
+  SharedRing R = SharedRing::open(fd::dup(W.file()));
+  auto Slot = W.acquire();
+  W.activate(*Slot);
+
+  EXPECT_FALSE(W.takeReaderWaiting(*Slot));
+  EXPECT_TRUE(R.wait(*Slot));
+  EXPECT_TRUE(W.takeReaderWaiting(*Slot));
+  EXPECT_FALSE(W.takeReaderWaiting(*Slot));
+
+  W.publish("X");
+  EXPECT_FALSE(R.wait(*Slot));
+  EXPECT_FALSE(W.takeReaderWaiting(*Slot));
+}
+
+TEST(SharedRing, Wakeup)
+{
+  fd Wakeup = SharedRing::makeWakeup();
+  struct pollfd P{};
+  P.fd = Wakeup;
+  P.events = POLLIN;
+  EXPECT_EQ(::poll(&P, 1, 0), 0);
+
+  SharedRing::wake(Wakeup);
+  SharedRing::wake(Wakeup);
+  EXPECT_EQ(::poll(&P, 1, 0), 1);
+
+  SharedRing::clearWakeup(Wakeup);
+  EXPECT_EQ(::poll(&P, 1, 0), 0);
+}
+
+TEST(SharedRing, SlotsAreLimited)
+{
+  SharedRing W = SharedRing::create(4096);
+  for (std::size_t I = 0; I < SharedRing::MaxReaders; ++I)
+    EXPECT_EQ(W.acquire(), I);
+  EXPECT_FALSE(W.acquire());
+
+  W.release(3);
+  EXPECT_EQ(W.acquire(), 3);
+}
+
+TEST(SharedRing, RejectsOtherMemory)
+{
+  fd NotRing = ::memfd_create("not-a-ring", MFD_CLOEXEC);
+  ASSERT_EQ(::ftruncate(NotRing, 1 << 16), 0);
+  EXPECT_THROW(SharedRing::open(std::move(NotRing)), std::system_error);
+}
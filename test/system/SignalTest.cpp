@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <csignal>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/Signal.hpp"
+
+using namespace monomux;
+
+namespace
+{
+
+int Received;
+::pid_t Sender;
+
+void countSignal(SignalHandling::Signal /* SigNum */,
+                 ::siginfo_t* Info,
+                 const SignalHandling* /* Handling */)
+{
+  ++Received;
+  Sender = Info->si_pid;
+}
+
+bool blocked(int SigNum)
+{
+  POD<::sigset_t> Mask;
+  ::pthread_sigmask(SIG_SETMASK, nullptr, &Mask);
+  return ::sigismember(&Mask, SigNum);
+}
+
+} // namespace
+
+TEST(Signal, DeliverThroughFile)
+{
+  SignalHandling& Sig = SignalHandling::get();
+  Received = 0;
+  Sig.registerCallback(SIGUSR1, &countSignal);
+  Sig.deliverThroughFile(SIGUSR1);
+  Sig.enable();
+  ASSERT_NE(Sig.signalFile(), fd::Invalid);
+  EXPECT_TRUE(blocked(SIGUSR1));
+
+  // Nothing fires until the file is dispatched.
+  ::raise(SIGUSR1);
+  EXPECT_EQ(Received, 0);
+
+  POD<struct ::pollfd> PFD;
+  PFD->fd = Sig.signalFile();
+  PFD->events = POLLIN;
+  ASSERT_EQ(::poll(&PFD, 1, 1000), 1);
+  EXPECT_EQ(Sig.dispatchFile(), 1);
+  EXPECT_EQ(Received, 1);
+  EXPECT_EQ(Sender, ::getpid());
+  EXPECT_EQ(Sig.dispatchFile(), 0);
+
+  Sig.defaultCallback(SIGUSR1);
+  EXPECT_EQ(Sig.signalFile(), fd::Invalid);
+  EXPECT_FALSE(blocked(SIGUSR1));
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+
+TEST(Socket, PairIsConnected)
+{
+  auto [A, B] = Socket::pair("test");
+  A.write("ping");
+  EXPECT_EQ(B.read(4), "ping");
+  B.write("pong");
+  EXPECT_EQ(A.read(4), "pong");
+}
+
+TEST(Socket, PassFile)
+{
+  auto [Control, ControlPeer] = Socket::pair("control");
+  auto [Data, DataPeer] = Socket::pair("data");
+
+  EXPECT_FALSE(ControlPeer.takeReceivedFile().has());
+  EXPECT_EQ(Control.writeWithFile("handshake", DataPeer.raw()), 9);
+  // Only the descriptor passed over is kept at the other end.
+  DataPeer = Socket::wrap(fd{}, "closed");
+
+  EXPECT_EQ(ControlPeer.read(9), "handshake");
+  fd Received = ControlPeer.takeReceivedFile();
+  ASSERT_TRUE(Received.has());
+  EXPECT_FALSE(ControlPeer.takeReceivedFile().has());
+
+  Socket Passed = Socket::wrap(std::move(Received), "passed");
+  Passed.write("over the passed end");
+  EXPECT_EQ(Data.read(19), "over the passed end");
+}
+
+TEST(Socket, PassFilesTogether)
+{
+  auto [Control, ControlPeer] = Socket::pair("control");
+  auto [First, FirstPeer] = Socket::pair("first");
+  auto [Second, SecondPeer] = Socket::pair("second");
+
+  EXPECT_EQ(
+    Control.writeWithFiles("attach", {FirstPeer.raw(), SecondPeer.raw()}), 6);
+  EXPECT_EQ(ControlPeer.read(6), "attach");
+
+  // The files arrive in the order they were passed.
+  Socket ReceivedFirst = Socket::wrap(ControlPeer.takeReceivedFile(), "1");
+  Socket ReceivedSecond = Socket::wrap(ControlPeer.takeReceivedFile(), "2");
+  EXPECT_FALSE(ControlPeer.takeReceivedFile().has());
+  ReceivedFirst.write("1st");
+  ReceivedSecond.write("2nd");
+  EXPECT_EQ(First.read(3), "1st");
+  EXPECT_EQ(Second.read(3), "2nd");
+}
+
+TEST(Socket, ExcessPassedFilesAreClosed)
+{
+  auto [Control, ControlPeer] = Socket::pair("control");
+  auto [Data, DataPeer] = Socket::pair("data");
+
+  for (std::size_t I = 0; I < Socket::MaxReceivedFiles + 2; ++I)
+    Control.writeWithFile("x", DataPeer.raw());
+  // The data carrying files is not merged together by the kernel.
+  std::string Read;
+  while (Read.size() < Socket::MaxReceivedFiles + 2)
+    Read.append(ControlPeer.read(Socket::MaxReceivedFiles + 2));
+
+  std::size_t Count = 0;
+  while (ControlPeer.takeReceivedFile().has())
+    ++Count;
+  EXPECT_EQ(Count, Socket::MaxReceivedFiles);
+}
+
+TEST(Socket, TransportOfAddress)
+{
+  EXPECT_EQ(Socket::transportOf("/tmp/mnmx"), Socket::Transport::Unix);
+  EXPECT_EQ(Socket::transportOf("tcp-socket"), Socket::Transport::Unix);
+  EXPECT_EQ(Socket::transportOf("tcp:localhost:7000"), Socket::Transport::TCP);
+  EXPECT_EQ(Socket::transportOf("vsock:2:7000"), Socket::Transport::VSock);
+}
+
+TEST(Socket, TCPLoopback)
+{
+  Socket Server = Socket::create("tcp:127.0.0.1:0");
+  Server.listen(1);
+  EXPECT_EQ(Server.transport(), Socket::Transport::TCP);
+
+  struct ::sockaddr_in Bound = {};
+  ::socklen_t Length = sizeof(Bound);
+  ASSERT_EQ(::getsockname(Server.raw(),
+                          reinterpret_cast<struct ::sockaddr*>(&Bound),
+                          &Length),
+            0);
+  Socket Client = Socket::connect("tcp:127.0.0.1:" +
+                                  std::to_string(ntohs(Bound.sin_port)));
+  std::optional<Socket> Peer = Server.accept();
+  ASSERT_TRUE(Peer.has_value());
+  EXPECT_EQ(Peer->transport(), Socket::Transport::TCP);
+  EXPECT_FALSE(Peer->canPassFiles());
+
+  Client.write("ping");
+  EXPECT_EQ(Peer->read(4), "ping");
+
+  Peer->cork();
+  Peer->write("po");
+  Peer->write("ng");
+  Peer->uncork();
+  std::string Read;
+  while (Read.size() < 4)
+    Read.append(Client.read(4 - Read.size()));
+  EXPECT_EQ(Read, "pong");
+}
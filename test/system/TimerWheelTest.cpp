@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/TimerWheel.hpp"
+
+using namespace monomux;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+using Clock = TimerWheel::Clock;
+
+/// Advances \p W the way an event loop would, sleeping for \p timeout() at
+/// each step, until \p End. \returns the number of steps taken.
+std::size_t run(TimerWheel& W, Clock::time_point& Now, Clock::time_point End)
+{
+  std::size_t Steps = 0;
+  while (Now < End)
+  {
+    std::chrono::milliseconds Timeout = W.timeout(Now);
+    if (Timeout.count() < 0 || Now + Timeout > End)
+      Now = End;
+    else
+      Now += Timeout;
+    W.advance(Now);
+    ++Steps;
+  }
+  return Steps;
+}
+
+} // namespace
+
+TEST(TimerWheel, FiresAtDeadline)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{1ms, Start};
+  int Fired = 0;
+  TimerWheel::Handle H = W.schedule(Start + 5ms, [&Fired] { ++Fired; });
+  EXPECT_TRUE(H);
+  EXPECT_TRUE(W.scheduled(H));
+  EXPECT_EQ(W.size(), 1);
+  EXPECT_EQ(W.timeout(Start), 5ms);
+
+  EXPECT_EQ(W.advance(Start + 4ms), 0);
+  EXPECT_EQ(Fired, 0);
+  EXPECT_EQ(W.timeout(Start + 4ms), 1ms);
+  EXPECT_EQ(W.advance(Start + 5ms), 1);
+  EXPECT_EQ(Fired, 1);
+  EXPECT_FALSE(W.scheduled(H));
+  EXPECT_TRUE(W.empty());
+  EXPECT_LT(W.timeout(Start + 5ms).count(), 0);
+}
+
+TEST(TimerWheel, Cancel)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{1ms, Start};
+  int Fired = 0;
+  TimerWheel::Handle H1 = W.schedule(Start + 5ms, [&Fired] { Fired += 1; });
+  TimerWheel::Handle H2 = W.schedule(Start + 5ms, [&Fired] { Fired += 2; });
+
+  EXPECT_TRUE(W.cancel(H1));
+  EXPECT_FALSE(W.cancel(H1));
+  EXPECT_EQ(W.advance(Start + 10ms), 1);
+  EXPECT_EQ(Fired, 2);
+  EXPECT_FALSE(W.cancel(H2));
+
+  // The released node is reused, but the old handle stays invalid.
+  TimerWheel::Handle H3 = W.schedule(Start + 15ms, [] {});
+  EXPECT_FALSE(W.scheduled(H1));
+  EXPECT_FALSE(W.scheduled(H2));
+  EXPECT_TRUE(W.scheduled(H3));
+  EXPECT_FALSE(W.cancel(TimerWheel::Handle{}));
+}
+
+TEST(TimerWheel, FarTimersCascadeInOrder)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{1ms, Start};
+  // One timer for every level of the wheel, and one beyond its range.
+  const std::vector<Clock::duration> Delays = {
+    10h, 2h, 5min, 61s, 4100ms, 130ms, 63ms, 1ms};
+  std::vector<Clock::duration> FiredAt;
+  Clock::time_point Now = Start;
+  for (Clock::duration D : Delays)
+    W.schedule(Start + D,
+               [&FiredAt, &Now, &Start] { FiredAt.push_back(Now - Start); });
+
+  std::size_t Steps = run(W, Now, Start + 11h);
+  EXPECT_TRUE(W.empty());
+  ASSERT_EQ(FiredAt.size(), Delays.size());
+  for (std::size_t I = 0; I < Delays.size(); ++I)
+    EXPECT_EQ(FiredAt[I], Delays[Delays.size() - 1 - I]);
+  // The loop only wakes up for the cascades and the expiries.
+  EXPECT_LT(Steps, 64);
+}
+
+TEST(TimerWheel, AdvanceOverLongSleep)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{1ms, Start};
+  int Fired = 0;
+  for (int I = 1; I <= 100; ++I)
+    W.schedule(Start + std::chrono::seconds{I}, [&Fired] { ++Fired; });
+
+  EXPECT_EQ(W.advance(Start + 50s), 50);
+  EXPECT_EQ(W.advance(Start + 1h), 50);
+  EXPECT_EQ(Fired, 100);
+}
+
+TEST(TimerWheel, CallbackReschedules)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{1ms, Start};
+  Clock::time_point Now = Start;
+  std::vector<Clock::duration> Ticks;
+  std::function<void()> Tick = [&] {
+    Ticks.push_back(Now - Start);
+    if (Ticks.size() < 5)
+      W.schedule(Now + 100ms, Tick);
+  };
+  W.schedule(Start + 100ms, Tick);
+
+  run(W, Now, Start + 1s);
+  ASSERT_EQ(Ticks.size(), 5);
+  for (std::size_t I = 0; I < Ticks.size(); ++I)
+    EXPECT_EQ(Ticks[I], 100ms * (I + 1));
+}
+
+TEST(TimerWheel, CoarseResolution)
+{
+  Clock::time_point Start = Clock::now();
+  TimerWheel W{10ms, Start};
+  int Fired = 0;
+  W.schedule(Start + 15ms, [&Fired] { ++Fired; });
+
+  // The deadline is rounded up to the next tick.
+  EXPECT_EQ(W.timeout(Start), 20ms);
+  EXPECT_EQ(W.advance(Start + 19ms), 0);
+  EXPECT_EQ(W.advance(Start + 20ms), 1);
+  EXPECT_EQ(Fired, 1);
+}